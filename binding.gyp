@@ -5,9 +5,33 @@
       "cflags!": [ "-fno-exceptions" ],
       "cflags_cc!": [ "-fno-exceptions" ],
       "sources": [
-        "./src/Binding.cpp",
+        "./src/binding.cpp",
         "./src/RegKey.cpp",
-        "./src/RegKeyWrap.cpp"
+        "./src/RegKeyWrap.cpp",
+        "./src/RegTrace.cpp",
+        "./src/RegBackend.cpp",
+        "./src/Win32Backend.cpp",
+        "./src/MemoryBackend.cpp",
+        "./src/RegString.cpp",
+        "./src/RegThreadPool.cpp",
+        "./src/RegSearch.cpp",
+        "./src/RegTreeOp.cpp",
+        "./src/RegBatch.cpp",
+        "./src/RegWriteBack.cpp",
+        "./src/RegExpand.cpp",
+        "./src/RegSchema.cpp",
+        "./src/RegCompress.cpp",
+        "./src/RegConnectionPool.cpp",
+        "./src/RegHandleBudget.cpp",
+        "./src/RegHostQuery.cpp",
+        "./src/RegTreeCache.cpp",
+        "./src/RegTreeSync.cpp",
+        "./src/RegFile.cpp",
+        "./src/RegRecorder.cpp",
+        "./src/RegColumnar.cpp",
+        "./src/HiveBackend.cpp",
+        "./src/RegQuery.cpp",
+        "./src/RegMarshal.cpp"
        ],
       "include_dirs": [
         "./include",
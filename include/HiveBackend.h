@@ -0,0 +1,152 @@
+#pragma once
+
+#include "RegBackend.h"
+#include <map>
+#include <mutex>
+#include <set>
+#include <shared_mutex>
+#include <cstdio>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// An offline hive file, the "regf" format Windows stores each part of its registry in,
+// read and patched in place without mounting it.
+//
+// The whole file is held in memory. Every base key opens the root key of the hive.
+// Changes go to the image and the 4 KiB pages they touch are written back by FlushKey
+// (and when the backend is destroyed): the primary sequence number is bumped and the
+// header written first, then the dirty pages, then the secondary sequence number, so an
+// interrupted flush leaves the hive marked as needing recovery, as Windows would.
+// Hives whose sequence numbers already differ need their transaction logs replayed,
+// which is not supported; they can only be loaded read-only.
+//
+// Cells are allocated from size-class free lists built from the free cells of every
+// hbin: one class per 8-byte size up to 512 bytes, then one per power of two. A freed
+// cell is merged with free neighbours in its hbin, and a new hbin is appended when no
+// free cell fits.
+class HiveBackend : public RegBackend
+{
+public:
+    HiveBackend(const std::string &name);
+    ~HiveBackend();
+
+    // Loads `file`; ERROR_FILE_NOT_FOUND when it is missing, ERROR_BADDB when it is not a valid hive.
+    LSTATUS Load(const std::string &file, bool writable);
+    // Writes a new hive holding an empty root key to `file` and loads it.
+    LSTATUS Create(const std::string &file);
+
+    bool IsWritable() const
+    {
+        return _writable;
+    }
+
+    const char *GetName() const override
+    {
+        return _name.c_str();
+    }
+
+    LSTATUS OpenKey(HKEY hKey, const Char *subKey, REGSAM access, HKEY *result) override;
+    LSTATUS CreateKey(HKEY hKey, const Char *subKey, REGSAM access, HKEY *result) override;
+    LSTATUS ConnectRegistry(const Char *host, HKEY hKey, HKEY *result) override;
+    LSTATUS CloseKey(HKEY hKey) override;
+    LSTATUS FlushKey(HKEY hKey) override;
+
+    LSTATUS CopyTree(HKEY hSrc, const Char *subKey, HKEY hDest) override;
+    LSTATUS RenameKey(HKEY hKey, const Char *subKey, const Char *newName) override;
+    LSTATUS DeleteTree(HKEY hKey, const Char *subKey) override;
+    LSTATUS DeleteKey(HKEY hKey, const Char *subKey) override;
+
+    LSTATUS QueryInfoKey(HKEY hKey, RegKeyInfo *info) override;
+    LSTATUS EnumKey(HKEY hKey, DWORD index, Char *name, DWORD *nameLength) override;
+    LSTATUS EnumValue(HKEY hKey, DWORD index, Char *name, DWORD *nameLength,
+                      DWORD *type, BYTE *data, DWORD *dataSize) override;
+
+    LSTATUS QueryValue(HKEY hKey, const Char *name, DWORD *type, BYTE *data, DWORD *dataSize) override;
+    LSTATUS SetValue(HKEY hKey, const Char *name, DWORD type, const BYTE *data, DWORD dataSize) override;
+    LSTATUS DeleteValue(HKEY hKey, const Char *name) override;
+
+    // Writes the dirty pages back to the file.
+    LSTATUS Flush();
+
+private:
+    struct HandleSlot
+    {
+        uint32_t key;
+        uint32_t generation;
+        bool used;
+    };
+
+    // A subkey list entry: the key cell, and the name hash of lh lists or the name hint of lf lists.
+    struct ChildEntry
+    {
+        uint32_t key;
+        uint32_t hint;
+        char list;
+    };
+
+    static const int FreeClasses = 80;
+
+    // Cells
+    BYTE *_Cell(uint32_t offset, uint32_t size);
+    uint32_t _CellSize(uint32_t offset) const;
+    uint32_t _Allocate(uint32_t size);
+    void _Free(uint32_t offset);
+    uint32_t _Reallocate(uint32_t offset, uint32_t size);
+    bool _Grow(uint32_t cellSize);
+    void _AddFree(uint32_t offset, uint32_t size);
+    void _RemoveFree(uint32_t offset, uint32_t size);
+    void _Dirty(uint32_t offset, uint32_t size);
+    void _DirtyCell(uint32_t offset);
+    LSTATUS _Parse();
+    void _WriteHeader();
+
+    // Keys
+    LSTATUS _Resolve(HKEY hKey, uint32_t *key);
+    HKEY _NewHandle(uint32_t key);
+    LSTATUS _Walk(uint32_t from, const Char *path, bool create, uint32_t *key);
+    bool _KeyName(uint32_t key, String &name);
+    bool _Children(uint32_t key, std::vector<ChildEntry> &children);
+    bool _CollectList(uint32_t list, std::vector<ChildEntry> &children, int depth);
+    uint32_t _ChildAt(uint32_t key, DWORD index);
+    uint32_t _FindChild(uint32_t key, const Char *name, size_t length, std::vector<ChildEntry> &children,
+                        size_t *position);
+    bool _SetChildren(uint32_t key, std::vector<ChildEntry> &children);
+    void _FreeList(uint32_t list, int depth);
+    uint32_t _NewKey(uint32_t parent, const Char *name, size_t length);
+    void _FreeKey(uint32_t key);
+    bool _DeleteSubtree(uint32_t key);
+    bool _CopyInto(uint32_t src, uint32_t dest);
+    void _Touch(uint32_t key);
+
+    // Values
+    bool _Values(uint32_t key, std::vector<uint32_t> &values);
+    bool _ValueName(uint32_t value, String &name);
+    uint32_t _FindValue(uint32_t key, const Char *name, size_t *index);
+    LSTATUS _ValueData(uint32_t value, DWORD *type, BYTE *data, DWORD *dataSize);
+    bool _ReadValueData(uint32_t value, ByteArray &data);
+    bool _StoreData(uint32_t value, const BYTE *data, DWORD size);
+    void _FreeData(uint32_t value);
+    LSTATUS _PutValue(uint32_t key, const Char *name, size_t length, DWORD type, const BYTE *data, DWORD size);
+
+    std::string _name;
+    std::string _file;
+    FILE *_fp;
+    bool _writable;
+
+    mutable std::shared_mutex _treeMutex;
+    std::mutex _handleMutex;
+
+    ByteArray _image;
+    uint32_t _minorVersion;
+    // Offsets of the hbins relative to the first, and their sizes.
+    std::map<uint32_t, uint32_t> _bins;
+    std::set<uint32_t> _freeCells[FreeClasses];
+    std::vector<bool> _dirtyPages;
+    bool _dirty;
+
+    // Bumped when a key cell is freed, so handles to it fail with ERROR_KEY_DELETED.
+    std::unordered_map<uint32_t, uint32_t> _generations;
+    std::vector<HandleSlot> _handles;
+    std::vector<uint32_t> _freeHandles;
+};
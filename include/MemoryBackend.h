@@ -0,0 +1,133 @@
+#pragma once
+
+#include "RegBackend.h"
+#include <map>
+#include <mutex>
+#include <shared_mutex>
+#include <vector>
+
+// Bump allocator with power-of-two size classes for value data.
+// Freed blocks go to per-class free lists; blocks above the largest class use the heap.
+class MemoryArena
+{
+public:
+    MemoryArena();
+    ~MemoryArena();
+
+    MemoryArena(const MemoryArena &) = delete;
+    MemoryArena &operator=(const MemoryArena &) = delete;
+
+    BYTE *Allocate(DWORD size, DWORD *capacity);
+    void Free(BYTE *data, DWORD capacity);
+
+private:
+    static const DWORD MinBlockSize = 16;
+    static const int SizeClasses = 12;
+    static const DWORD ChunkSize = 256 * 1024;
+
+    std::vector<BYTE *> _chunks;
+    BYTE *_cursor;
+    DWORD _remaining;
+    BYTE *_freeLists[SizeClasses];
+};
+
+struct MemoryValue
+{
+    String name;
+    String foldedName;
+    // Hash of foldedName, checked before comparing names.
+    uint32_t hash;
+    DWORD type;
+    DWORD size;
+    DWORD capacity;
+    BYTE *data;
+};
+
+struct MemoryNode
+{
+    String name;
+    String foldedName;
+    uint32_t parent;
+    uint32_t generation;
+    bool live;
+    QWORD lastWriteTime;
+    // Sorted by folded name, which is also the Win32 enumeration order.
+    std::vector<uint32_t> children;
+    // Insertion order, as RegEnumValueW reports them.
+    std::vector<MemoryValue> values;
+};
+
+// A process-local registry kept entirely in memory.
+// Nodes live in one vector and refer to each other by index; handles are slots
+// in a table that remember the node generation, so handles to deleted keys fail
+// with ERROR_KEY_DELETED just like on Windows.
+class MemoryBackend : public RegBackend
+{
+public:
+    MemoryBackend();
+    ~MemoryBackend();
+
+    const char *GetName() const override
+    {
+        return "memory";
+    }
+
+    LSTATUS OpenKey(HKEY hKey, const Char *subKey, REGSAM access, HKEY *result) override;
+    LSTATUS CreateKey(HKEY hKey, const Char *subKey, REGSAM access, HKEY *result) override;
+    LSTATUS ConnectRegistry(const Char *host, HKEY hKey, HKEY *result) override;
+    LSTATUS CloseKey(HKEY hKey) override;
+    LSTATUS FlushKey(HKEY hKey) override;
+
+    LSTATUS CopyTree(HKEY hSrc, const Char *subKey, HKEY hDest) override;
+    LSTATUS RenameKey(HKEY hKey, const Char *subKey, const Char *newName) override;
+    LSTATUS DeleteTree(HKEY hKey, const Char *subKey) override;
+    LSTATUS DeleteKey(HKEY hKey, const Char *subKey) override;
+
+    LSTATUS QueryInfoKey(HKEY hKey, RegKeyInfo *info) override;
+    LSTATUS EnumKey(HKEY hKey, DWORD index, Char *name, DWORD *nameLength) override;
+    LSTATUS EnumValue(HKEY hKey, DWORD index, Char *name, DWORD *nameLength,
+                      DWORD *type, BYTE *data, DWORD *dataSize) override;
+
+    LSTATUS QueryValue(HKEY hKey, const Char *name, DWORD *type, BYTE *data, DWORD *dataSize) override;
+    LSTATUS SetValue(HKEY hKey, const Char *name, DWORD type, const BYTE *data, DWORD dataSize) override;
+    LSTATUS DeleteValue(HKEY hKey, const Char *name) override;
+
+    // Remove every key and value. Open handles keep failing with ERROR_KEY_DELETED.
+    void Clear();
+
+private:
+    struct HandleSlot
+    {
+        uint32_t node;
+        uint32_t generation;
+        bool used;
+    };
+
+    static const uint32_t NoNode = 0xFFFFFFFF;
+
+    uint32_t _NewNode(uint32_t parent, const String &name, const String &foldedName);
+    uint32_t _GetRoot(const String &host, HKEY baseKey);
+    LSTATUS _Resolve(HKEY hKey, uint32_t *node) const;
+    LSTATUS _Walk(uint32_t from, const Char *path, bool create, uint32_t *node);
+    uint32_t _FindChild(uint32_t parent, const String &foldedName) const;
+    void _InsertChild(uint32_t parent, uint32_t child);
+    void _RemoveChild(uint32_t parent, uint32_t child);
+    MemoryValue *_FindValue(uint32_t node, const Char *name);
+    void _PutValue(uint32_t node, const String &name, DWORD type, const BYTE *data, DWORD size);
+    void _ClearNode(uint32_t node);
+    void _FreeSubtree(uint32_t node);
+    void _CopyInto(uint32_t src, uint32_t dest);
+    void _Touch(uint32_t node);
+    HKEY _NewHandle(uint32_t node);
+
+    mutable std::shared_mutex _treeMutex;
+    mutable std::shared_mutex _handleMutex;
+
+    std::vector<MemoryNode> _nodes;
+    std::vector<uint32_t> _freeNodes;
+    std::map<std::pair<String, uint32_t>, uint32_t> _roots;
+    MemoryArena _arena;
+
+    std::vector<HandleSlot> _handles;
+    std::vector<uint32_t> _freeHandles;
+};
@@ -0,0 +1,69 @@
+#pragma once
+
+#include "RegPlatform.h"
+#include <memory>
+
+struct RegKeyInfo
+{
+    DWORD subKeys;
+    DWORD maxSubKeyLength;
+    DWORD values;
+    DWORD maxValueNameLength;
+    DWORD maxValueLength;
+    // 100-nanosecond intervals since January 1, 1601 (UTC), as in FILETIME.
+    QWORD lastWriteTime;
+};
+
+// The registry primitives RegKey is built on.
+// Every backend follows the Win32 Reg* semantics: statuses are Win32 error codes,
+// lengths are counted in characters, buffers that are too small yield ERROR_MORE_DATA,
+// and an access of 0 means "default access" (RegOpenKeyW / RegCreateKeyW).
+class RegBackend
+{
+public:
+    virtual ~RegBackend() {}
+
+    virtual const char *GetName() const = 0;
+
+    // The backend doing the work; differs from this for wrappers such as the workload recorder.
+    virtual RegBackend *GetTarget()
+    {
+        return this;
+    }
+
+    virtual LSTATUS OpenKey(HKEY hKey, const Char *subKey, REGSAM access, HKEY *result) = 0;
+    virtual LSTATUS CreateKey(HKEY hKey, const Char *subKey, REGSAM access, HKEY *result) = 0;
+    virtual LSTATUS ConnectRegistry(const Char *host, HKEY hKey, HKEY *result) = 0;
+    virtual LSTATUS CloseKey(HKEY hKey) = 0;
+    virtual LSTATUS FlushKey(HKEY hKey) = 0;
+
+    virtual LSTATUS CopyTree(HKEY hSrc, const Char *subKey, HKEY hDest) = 0;
+    virtual LSTATUS RenameKey(HKEY hKey, const Char *subKey, const Char *newName) = 0;
+    virtual LSTATUS DeleteTree(HKEY hKey, const Char *subKey) = 0;
+    virtual LSTATUS DeleteKey(HKEY hKey, const Char *subKey) = 0;
+
+    virtual LSTATUS QueryInfoKey(HKEY hKey, RegKeyInfo *info) = 0;
+    virtual LSTATUS EnumKey(HKEY hKey, DWORD index, Char *name, DWORD *nameLength) = 0;
+    virtual LSTATUS EnumValue(HKEY hKey, DWORD index, Char *name, DWORD *nameLength,
+                              DWORD *type, BYTE *data, DWORD *dataSize) = 0;
+
+    virtual LSTATUS QueryValue(HKEY hKey, const Char *name, DWORD *type, BYTE *data, DWORD *dataSize) = 0;
+    virtual LSTATUS SetValue(HKEY hKey, const Char *name, DWORD type, const BYTE *data, DWORD dataSize) = 0;
+    virtual LSTATUS DeleteValue(HKEY hKey, const Char *name) = 0;
+
+    // Returns nullptr for unknown names and for backends not built on this platform.
+    // While a workload is being recorded, the backends returned record their calls.
+    static std::shared_ptr<RegBackend> Get(const std::string &name);
+
+    static std::shared_ptr<RegBackend> GetDefault();
+    static bool SetDefault(const std::string &name);
+
+    // Makes `backend` available under `name`, as loaded hives are. Returns false when the
+    // name is taken or reserved ("memory", "win32").
+    static bool Mount(const std::string &name, const std::shared_ptr<RegBackend> &backend);
+    // Returns the backend that was mounted under `name`, or nullptr.
+    static std::shared_ptr<RegBackend> Unmount(const std::string &name);
+
+private:
+    static std::shared_ptr<RegBackend> _Find(const std::string &name);
+};
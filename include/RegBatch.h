@@ -0,0 +1,72 @@
+#pragma once
+
+#include "RegKey.h"
+#include "RegExpand.h"
+#include "RegThreadPool.h"
+
+struct RegReadRequest
+{
+    String host;
+    HKEY baseKey;
+    String subKey;
+    // Names of the values to read; every value of the key when empty.
+    std::vector<String> values;
+};
+
+struct RegReadResult
+{
+    // The status of opening the key.
+    LSTATUS status;
+    // One entry per requested value (or per value found), with a matching status.
+    std::vector<RegValue> values;
+    std::vector<LSTATUS> statuses;
+};
+
+// Reads values from many keys at once. Requests are sorted by path so that every parent key
+// is opened once and its subkeys are opened relative to it; each parent is then read
+// by its own task on the shared pool.
+class RegBatchReader
+{
+public:
+    RegBatchReader(const std::shared_ptr<RegBackend> &backend,
+                   std::vector<RegReadRequest> &&requests,
+                   REGSAM access = KEY_READ);
+
+    // REG_EXPAND_SZ values are expanded with these variables when set.
+    void SetEnvironment(const std::shared_ptr<const RegEnvironment> &environment)
+    {
+        _environment = environment;
+    }
+
+    // Blocks until every request has been served.
+    void Run();
+
+    const std::vector<RegReadRequest> &GetRequests() const
+    {
+        return _requests;
+    }
+
+    // Aligned with the requests.
+    const std::vector<RegReadResult> &GetResults() const
+    {
+        return _results;
+    }
+
+    // Keys opened to serve the batch, including parents.
+    size_t GetOpenCount() const
+    {
+        return _openCount.load(std::memory_order_relaxed);
+    }
+
+private:
+    void _ReadGroup(HKEY root, const String &parent, const std::vector<size_t> &indexes);
+    void _ReadKey(RegKey &key, const RegReadRequest &request, RegReadResult &result);
+    void _Fail(size_t index, LSTATUS status);
+
+    std::shared_ptr<RegBackend> _backend;
+    std::shared_ptr<const RegEnvironment> _environment;
+    std::vector<RegReadRequest> _requests;
+    std::vector<RegReadResult> _results;
+    REGSAM _access;
+    std::atomic<size_t> _openCount;
+};
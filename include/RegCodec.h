@@ -0,0 +1,191 @@
+#pragma once
+
+#include "RegPlatform.h"
+#include "RegString.h"
+#include <cstring>
+
+// Converts registry data of one REG_* type to and from its native representation.
+// Every specialization provides:
+//   Value                                         the native type
+//   bool Decode(data, size, Value &value)         false when the data is not valid for the type
+//   bool Encode(const Value &value, ByteArray &)  false when the value cannot be stored as the type
+// Raw data is read and written byte-wise, so it never needs to be aligned.
+// Types without a specialization are passed through as plain bytes.
+template <DWORD Type>
+struct RegCodec
+{
+    typedef ByteArray Value;
+
+    static bool Decode(const BYTE *data, size_t size, Value &value)
+    {
+        value.assign(data, data + size);
+        return true;
+    }
+
+    static bool Encode(const Value &value, ByteArray &data)
+    {
+        data = value;
+        return true;
+    }
+};
+
+namespace RegCodecDetail
+{
+    inline DWORD Swap32(DWORD value)
+    {
+        return (value >> 24) | ((value >> 8) & 0xFF00) | ((value << 8) & 0xFF0000) | (value << 24);
+    }
+
+    // Little-endian integers of a fixed size; the registry stores them as written by x86.
+    template <typename T, bool BigEndian>
+    struct IntegerCodec
+    {
+        typedef T Value;
+
+        static bool Decode(const BYTE *data, size_t size, Value &value)
+        {
+            if (size != sizeof(T))
+                return false;
+            memcpy(&value, data, sizeof(T));
+            if constexpr (BigEndian)
+                value = T(Swap32(DWORD(value)));
+            return true;
+        }
+
+        static bool Encode(const Value &value, ByteArray &data)
+        {
+            data.resize(sizeof(T));
+            if constexpr (BigEndian)
+            {
+                T stored = T(Swap32(DWORD(value)));
+                memcpy(data.data(), &stored, sizeof(T));
+            }
+            else
+                memcpy(data.data(), &value, sizeof(T));
+            return true;
+        }
+    };
+
+    // Strings end at the first null; data without one (or with an odd trailing byte) is still accepted,
+    // as RegQueryValueEx does not enforce termination either.
+    struct StringCodec
+    {
+        typedef String Value;
+
+        static bool Decode(const BYTE *data, size_t size, Value &value)
+        {
+            size_t length = RegString::FindNull(data, size / sizeof(Char));
+            value.resize(length);
+            if (length > 0)
+                memcpy(&value[0], data, length * sizeof(Char));
+            return true;
+        }
+
+        static bool Encode(const Value &value, ByteArray &data)
+        {
+            data.resize((value.size() + 1) * sizeof(Char));
+            memcpy(data.data(), value.c_str(), data.size());
+            return true;
+        }
+    };
+
+    // A sequence of null-terminated strings closed by an empty one.
+    struct MultiStringCodec
+    {
+        typedef std::vector<String> Value;
+
+        static bool Decode(const BYTE *data, size_t size, Value &value)
+        {
+            value.clear();
+            size_t count = size / sizeof(Char);
+            for (size_t begin = 0; begin < count;)
+            {
+                size_t length = RegString::FindNull(data + begin * sizeof(Char), count - begin);
+                if (length == 0)
+                    break;
+                value.push_back(String());
+                value.back().resize(length);
+                memcpy(&value.back()[0], data + begin * sizeof(Char), length * sizeof(Char));
+                begin += length + 1;
+            }
+            return true;
+        }
+
+        // Empty strings would end the list early, and strings with nulls would split, so both are rejected.
+        static bool Encode(const Value &value, ByteArray &data)
+        {
+            size_t units = 1;
+            for (auto it = value.begin(); it != value.end(); it++)
+            {
+                if (it->empty() || RegString::FindNull(it->c_str(), it->size()) != it->size())
+                    return false;
+                units += it->size() + 1;
+            }
+
+            data.resize(units * sizeof(Char));
+            BYTE *p = data.data();
+            for (auto it = value.begin(); it != value.end(); it++)
+            {
+                size_t bytes = (it->size() + 1) * sizeof(Char);
+                memcpy(p, it->c_str(), bytes);
+                p += bytes;
+            }
+            memset(p, 0, sizeof(Char));
+            return true;
+        }
+    };
+}
+
+template <>
+struct RegCodec<REG_SZ> : RegCodecDetail::StringCodec
+{
+};
+
+template <>
+struct RegCodec<REG_EXPAND_SZ> : RegCodecDetail::StringCodec
+{
+};
+
+template <>
+struct RegCodec<REG_MULTI_SZ> : RegCodecDetail::MultiStringCodec
+{
+};
+
+template <>
+struct RegCodec<REG_DWORD> : RegCodecDetail::IntegerCodec<DWORD, false>
+{
+};
+
+template <>
+struct RegCodec<REG_DWORD_BIG_ENDIAN> : RegCodecDetail::IntegerCodec<DWORD, true>
+{
+};
+
+template <>
+struct RegCodec<REG_QWORD> : RegCodecDetail::IntegerCodec<QWORD, false>
+{
+};
+
+// Calls `visitor.template Visit<Type>()` with the codec type matching a run-time REG_* type.
+// Unknown types are visited as REG_BINARY.
+template <typename Visitor>
+typename Visitor::Result RegVisitCodec(DWORD type, Visitor &visitor)
+{
+    switch (type)
+    {
+    case REG_SZ:
+        return visitor.template Visit<REG_SZ>();
+    case REG_EXPAND_SZ:
+        return visitor.template Visit<REG_EXPAND_SZ>();
+    case REG_MULTI_SZ:
+        return visitor.template Visit<REG_MULTI_SZ>();
+    case REG_DWORD:
+        return visitor.template Visit<REG_DWORD>();
+    case REG_DWORD_BIG_ENDIAN:
+        return visitor.template Visit<REG_DWORD_BIG_ENDIAN>();
+    case REG_QWORD:
+        return visitor.template Visit<REG_QWORD>();
+    default:
+        return visitor.template Visit<REG_BINARY>();
+    }
+}
@@ -0,0 +1,138 @@
+#pragma once
+
+#include "RegTreeSync.h"
+#include <cstdio>
+#include <string>
+#include <unordered_map>
+
+// Columnar dumps of registry subtrees: one row per value, stored column by column so a scan
+// over many dumps reads and decodes only the column it needs.
+//
+// Layout, little-endian:
+//   header      "RKCD" | version u32 | row count u32 | source (u32 length + UTF-16 units)
+//   dictionary  for the path column, then the name column: count u32, then each string as
+//               u32 length + UTF-16 units, sorted case-insensitively so a range of codes is
+//               also a range of names
+//   pages       the path, name, type and data columns, each split into pages
+//   page index  for each column, the page count u32, then per page:
+//               offset u64 | size u32 | rows u32 | min u32 | max u32
+//   trailer     page index offset u64 | "RKCD"
+// Path, name and type pages start with a width byte and hold one 1, 2 or 4-byte integer per row,
+// the narrowest that fits the page. Data pages hold a u32 length and the bytes of each value.
+// Min and max are the smallest and largest integer of a page (codes, types or data lengths),
+// so scans for a range skip pages without reading them.
+enum class RegColumn : uint8_t
+{
+    Path,
+    Name,
+    Type,
+    Data
+};
+
+const size_t RegColumnCount = 4;
+
+class RegColumnarWriter
+{
+public:
+    explicit RegColumnarWriter(const String &source, uint32_t pageRows = 4096);
+
+    // `path` is relative to the root of the dump, empty for the root itself.
+    void Add(const String &path, const String &name, DWORD type, const BYTE *data, size_t size);
+    // Adds every value under `root`. Keys that cannot be opened are skipped; returns false
+    // when `root` itself cannot be read.
+    bool AddTree(RegKey &root);
+    void AddState(const RegTreeState &state);
+
+    // Writes a temporary file beside `file` and renames it over.
+    bool Write(const std::string &file, size_t *bytes = nullptr);
+
+    size_t GetRowCount() const
+    {
+        return _rows.size();
+    }
+
+private:
+    struct Row
+    {
+        uint32_t path;
+        uint32_t name;
+        DWORD type;
+        size_t offset;
+        uint32_t size;
+    };
+
+    uint32_t _Intern(std::unordered_map<String, uint32_t> &ids, std::vector<String> &strings, const String &str);
+    void _AddKey(RegKey &key, const String &path);
+
+    String _source;
+    uint32_t _pageRows;
+    std::vector<Row> _rows;
+    ByteArray _data;
+    std::unordered_map<String, uint32_t> _pathIds;
+    std::unordered_map<String, uint32_t> _nameIds;
+    std::vector<String> _paths;
+    std::vector<String> _names;
+};
+
+struct RegColumnPage
+{
+    uint64_t offset;
+    uint32_t size;
+    uint32_t rows;
+    uint32_t min;
+    uint32_t max;
+};
+
+// The rows of one column whose integer (code, type or data length) is within a range.
+struct RegColumnScan
+{
+    std::vector<uint32_t> rows;
+    // Codes or types; data lengths for the data column.
+    std::vector<uint32_t> values;
+    // For the data column: the bytes of the rows, back to back.
+    ByteArray data;
+};
+
+class RegColumnarReader
+{
+public:
+    RegColumnarReader();
+    ~RegColumnarReader();
+
+    RegColumnarReader(const RegColumnarReader &) = delete;
+    RegColumnarReader &operator=(const RegColumnarReader &) = delete;
+
+    // Reads the header, the dictionaries and the page index; the pages are read by Scan.
+    bool Open(const std::string &file);
+
+    const String &GetSource() const
+    {
+        return _source;
+    }
+
+    uint32_t GetRowCount() const
+    {
+        return _rowCount;
+    }
+
+    // Empty for the type and data columns.
+    const std::vector<String> &GetDictionary(RegColumn column) const;
+
+    // Codes of the path or name column whose string starts with `prefix`, ignoring case.
+    // Returns false when there are none.
+    bool FindPrefix(RegColumn column, const String &prefix, uint32_t *min, uint32_t *max) const;
+
+    // Decodes the rows whose integer is within [min, max]. Returns false on a read error or corrupt page.
+    bool Scan(RegColumn column, uint32_t min, uint32_t max, RegColumnScan &result);
+
+private:
+    bool _ReadPage(const RegColumnPage &page, ByteArray &buffer);
+
+    FILE *_fp;
+    uint64_t _size;
+    String _source;
+    uint32_t _rowCount;
+    std::vector<String> _paths;
+    std::vector<String> _names;
+    std::vector<RegColumnPage> _pages[RegColumnCount];
+};
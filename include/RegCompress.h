@@ -0,0 +1,67 @@
+#pragma once
+
+#include "RegPlatform.h"
+#include <functional>
+
+// A small LZ77 codec (the LZ4 block format) for large REG_BINARY payloads.
+//
+// Compressed values start with a 12-byte header: the magic "RKZ\x01", the size of the raw
+// data and the block size, both little-endian 32-bit. Blocks of up to `blockSize` raw bytes
+// follow, each as a 32-bit length and its bytes. A length with the top bit set marks a block
+// stored as it is, used when compressing it would not save space.
+namespace RegCompress
+{
+    const size_t HeaderSize = 12;
+    const uint32_t BlockSize = 64 * 1024;
+    // Payloads below this size are stored as they are by default.
+    const uint32_t DefaultThreshold = 64 * 1024;
+
+    // Whether `data` starts with a valid header.
+    bool IsCompressed(const BYTE *data, size_t size);
+
+    // Whether `data` is a whole compressed value: a valid header followed by exactly the blocks it
+    // announces. Plain data that happens to start with the magic almost never passes, and the check
+    // is cheap enough to make before allocating the raw size.
+    bool IsCompleteValue(const BYTE *data, size_t size);
+
+    // Size of the data once decompressed; `data` must pass IsCompressed.
+    uint32_t GetRawSize(const BYTE *data);
+
+    // Returns false, leaving `out` empty, when the result would not be smaller than `data`.
+    bool Compress(const BYTE *data, size_t size, ByteArray &out);
+
+    // Decompresses a whole value into `out`, which must hold GetRawSize() bytes.
+    // Returns false on corrupt data.
+    bool Decompress(const BYTE *data, size_t size, BYTE *out, size_t outSize);
+
+    // Decompresses a value fed in chunks of any size, handing each block to the sink as soon as
+    // it is complete. Memory use is bounded by the block size, not the size of the value.
+    class Decoder
+    {
+    public:
+        typedef std::function<void(const BYTE *data, size_t size)> Sink;
+
+        Decoder();
+
+        // Returns false once the data is found to be corrupt.
+        bool Feed(const BYTE *data, size_t size, const Sink &sink);
+        // Whether all of the raw data has been produced.
+        bool IsDone() const;
+
+        uint32_t GetRawSize() const
+        {
+            return _rawSize;
+        }
+
+    private:
+        bool _DecodeBlock(const Sink &sink);
+
+        ByteArray _pending;
+        ByteArray _block;
+        uint32_t _rawSize;
+        uint32_t _blockSize;
+        uint32_t _produced;
+        bool _header;
+        bool _failed;
+    };
+}
@@ -0,0 +1,119 @@
+#pragma once
+
+#include "RegBackend.h"
+#include <chrono>
+#include <condition_variable>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+struct RegConnectionPoolOptions
+{
+    // Connections kept open per host, across its root keys; 0 disables pooling.
+    size_t maxPerHost;
+    // Milliseconds an unused connection stays open.
+    unsigned idleTimeout;
+    // Connections unused for this many milliseconds are probed before they are handed out again.
+    unsigned healthCheckInterval;
+
+    RegConnectionPoolOptions()
+        : maxPerHost(4)
+        , idleTimeout(30000)
+        , healthCheckInterval(5000)
+    {
+    }
+};
+
+struct RegConnectionPoolStats
+{
+    // Calls to ConnectRegistry.
+    uint64_t connects;
+    // Acquisitions served by an open connection.
+    uint64_t reuses;
+    // Connections closed after idleTimeout.
+    uint64_t expired;
+    // Connections dropped by a failed health check or a connection error.
+    uint64_t unhealthy;
+    size_t open;
+    // Open connections with at least one user.
+    size_t busy;
+};
+
+// Shares remote registry connections (RegConnectRegistry) between keys opened on the same
+// host and root key. A root handle can serve any number of users at once, so a connection
+// is only added while every existing one is busy and the host is below maxPerHost;
+// past that, the least used connection is shared. Connections are closed by a background
+// thread once unused for idleTimeout.
+class RegConnectionPool
+{
+public:
+    static RegConnectionPool &Shared();
+
+    void SetOptions(const RegConnectionPoolOptions &options);
+    RegConnectionPoolOptions GetOptions();
+
+    // Returns a connected root key in `result`. It must be given back with Release()
+    // and must not be closed by the caller.
+    LSTATUS Acquire(const std::shared_ptr<RegBackend> &backend, const String &host, HKEY root, HKEY *result);
+    // `status` is the result of using the connection; connection errors discard it.
+    void Release(const std::shared_ptr<RegBackend> &backend, HKEY hKey, LSTATUS status = ERROR_SUCCESS);
+
+    // Closes every unused connection.
+    void Clear();
+
+    RegConnectionPoolStats GetStats();
+
+    // Statuses meaning the connection itself has failed.
+    static bool IsConnectionError(LSTATUS status);
+
+private:
+    typedef std::chrono::steady_clock Clock;
+
+    struct Connection
+    {
+        std::shared_ptr<RegBackend> backend;
+        HKEY root;
+        HKEY hKey;
+        size_t users;
+        // Never handed out again and closed by its last user: opened over the limit
+        // or with pooling disabled, or found broken.
+        bool retired;
+        Clock::time_point lastUsed;
+    };
+
+    struct Host
+    {
+        std::vector<std::unique_ptr<Connection>> connections;
+        // Connections being opened, counted against maxPerHost.
+        size_t connecting;
+
+        Host()
+            : connecting(0)
+        {
+        }
+    };
+
+    RegConnectionPool();
+
+    // Opens a connection for `name` with the lock released; it starts with one user.
+    LSTATUS _Connect(std::unique_lock<std::mutex> &lock, const std::shared_ptr<RegBackend> &backend,
+                     const String &host, const String &name, HKEY root, bool retired, HKEY *result);
+    // Takes a connection out of the pool; the caller closes its handle.
+    std::unique_ptr<Connection> _Remove(const String &name, Connection *connection);
+    void _Close(std::vector<std::unique_ptr<Connection>> &connections);
+    void _Run();
+
+    std::mutex _mutex;
+    std::condition_variable _wake;
+    // Signaled when a connection attempt ends.
+    std::condition_variable _connected;
+    RegConnectionPoolOptions _options;
+    RegConnectionPoolStats _stats;
+    // Keyed by the folded host name without leading backslashes.
+    std::unordered_map<String, Host> _hosts;
+    // Keyed by backend as well, since separate backends may hand out the same handle values.
+    std::map<std::pair<const RegBackend *, HKEY>, std::pair<String, Connection *>> _handles;
+    bool _started;
+};
@@ -0,0 +1,53 @@
+#pragma once
+
+#include "RegPlatform.h"
+#include <memory>
+#include <vector>
+
+// A snapshot of environment variables for expanding REG_EXPAND_SZ data.
+// Names are matched ignoring case, as Windows does; the table is open-addressed
+// on RegString::HashFold so lookups never allocate.
+class RegEnvironment
+{
+public:
+    RegEnvironment();
+
+    // Copies the environment of the process.
+    static std::shared_ptr<RegEnvironment> Snapshot();
+
+    // Adds or replaces a variable.
+    void Set(const String &name, const String &value);
+
+    // Returns nullptr for unknown names.
+    const String *Find(const Char *name, size_t length) const;
+
+    size_t GetSize() const
+    {
+        return _count;
+    }
+
+    // Replaces every %NAME% with the value of NAME in a single pass, like ExpandEnvironmentStrings:
+    // unknown names and unpaired '%' are kept as they are.
+    String Expand(const Char *text, size_t length) const;
+
+    String Expand(const String &text) const
+    {
+        return Expand(text.c_str(), text.size());
+    }
+
+private:
+    struct Variable
+    {
+        String name;
+        String value;
+        uint32_t hash;
+    };
+
+    size_t _FindSlot(const Char *name, size_t length, uint32_t hash) const;
+    void _Grow();
+
+    std::vector<Variable> _variables;
+    // Indexes into _variables plus one; 0 marks an empty slot. The size is a power of two.
+    std::vector<uint32_t> _slots;
+    size_t _count;
+};
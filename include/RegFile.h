@@ -0,0 +1,16 @@
+#pragma once
+
+#include "RegPlatform.h"
+#include <cstdio>
+#include <string>
+
+// File helpers taking UTF-8 paths on every platform.
+namespace RegFile
+{
+    FILE *Open(const std::string &file, const char *mode);
+    bool Replace(const std::string &from, const std::string &to);
+    void Remove(const std::string &file);
+
+    // Reads a whole file; returns false when it is missing or cannot be read.
+    bool Read(const std::string &file, ByteArray &out);
+}
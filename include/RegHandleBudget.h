@@ -0,0 +1,121 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <list>
+#include <mutex>
+#include <thread>
+
+struct RegHandleBudgetStats
+{
+    // Key handles open in the process, counted by the budget.
+    size_t open;
+    size_t peak;
+    // Handles closed to stay within the limit.
+    uint64_t evictions;
+    // Evicted handles opened again on use.
+    uint64_t reopens;
+};
+
+// Caps the number of open key handles in the process. Keys that can be reopened register
+// their handle here; when a handle is opened past the limit, the least recently used idle
+// keys of the same thread are closed, and their owners reopen them the next time they are
+// used. Keys of other threads are never closed, so the limit may be exceeded when the
+// calling thread has nothing left to evict.
+class RegHandleBudget
+{
+public:
+    class Entry
+    {
+    public:
+        Entry()
+            : _listed(false)
+            , _pins(0)
+        {
+        }
+
+        virtual ~Entry()
+        {
+            RegHandleBudget::Shared().Closed(this);
+        }
+
+        Entry(const Entry &) = delete;
+        Entry &operator=(const Entry &) = delete;
+
+    protected:
+        // Closes the handle; returns false when the key cannot be closed right now.
+        // Called with the budget locked, on the thread that opened the handle.
+        virtual bool _Evict() = 0;
+
+    private:
+        friend class RegHandleBudget;
+
+        std::list<Entry *>::iterator _position;
+        std::thread::id _thread;
+        bool _listed;
+        // Pins held; a pinned handle is never evicted.
+        int _pins;
+    };
+
+    // Keeps the handle of an entry open while it lives, for calls that use two keys at once:
+    // reopening one of them must not evict the other.
+    class Pin
+    {
+    public:
+        explicit Pin(Entry *entry)
+            : _entry(entry)
+        {
+            Shared()._Pin(_entry, 1);
+        }
+
+        ~Pin()
+        {
+            Shared()._Pin(_entry, -1);
+        }
+
+        Pin(const Pin &) = delete;
+        Pin &operator=(const Pin &) = delete;
+
+    private:
+        Entry *_entry;
+    };
+
+    static RegHandleBudget &Shared();
+
+    // 0 lifts the limit.
+    void SetLimit(size_t limit);
+
+    size_t GetLimit() const
+    {
+        return _limit.load(std::memory_order_relaxed);
+    }
+
+    // Counts the handle of `entry` as open and most recently used, evicting others over the limit.
+    void Opened(Entry *entry, bool reopened = false);
+    // Forgets the handle of `entry`; a no-op when it is not counted.
+    void Closed(Entry *entry);
+
+    // Marks the handle of `entry` as most recently used. Free while no limit is set.
+    void Touch(Entry *entry)
+    {
+        if (_limit.load(std::memory_order_relaxed) != 0)
+            _Touch(entry);
+    }
+
+    RegHandleBudgetStats GetStats();
+
+private:
+    RegHandleBudget();
+
+    void _Touch(Entry *entry);
+    void _Pin(Entry *entry, int delta);
+    // Evicts unpinned handles of the calling thread until the count is within the limit. Needs the lock.
+    void _Trim(const Entry *keep);
+
+    std::mutex _mutex;
+    std::atomic<size_t> _limit;
+    // Most recently used first.
+    std::list<Entry *> _entries;
+    RegHandleBudgetStats _stats;
+};
@@ -0,0 +1,103 @@
+#pragma once
+
+#include "RegKey.h"
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+
+struct RegHostQueryOptions
+{
+    // Hosts queried at the same time.
+    size_t concurrency;
+    // Milliseconds a host may take to connect, open and read; 0 for no limit.
+    unsigned timeout;
+    REGSAM access;
+
+    RegHostQueryOptions()
+        : concurrency(32)
+        , timeout(10000)
+        , access(KEY_READ)
+    {
+    }
+};
+
+struct RegHostResult
+{
+    String host;
+    // The status of connecting and opening the key; ERROR_TIMEOUT past the deadline.
+    LSTATUS status;
+    // One entry per requested value (or per value found), with a matching status.
+    std::vector<RegValue> values;
+    std::vector<LSTATUS> statuses;
+    // Milliseconds spent on the host.
+    double elapsed;
+};
+
+// Reads the same key from many remote hosts. Hosts are served by threads of the query's own,
+// never the shared pool: a call to a dead host can block for a long time and cannot be
+// interrupted. When a host passes its deadline it is reported as timed out and a new
+// thread takes its place, so the batch keeps `concurrency` hosts in flight; the late
+// answer is dropped whenever the blocked call returns.
+class RegHostQuery : public std::enable_shared_from_this<RegHostQuery>
+{
+public:
+    // Called from the query threads, once per host, in completion order.
+    typedef std::function<void(RegHostResult &&result)> ResultCallback;
+    // Receives ERROR_CANCELLED when cancelled, otherwise ERROR_SUCCESS.
+    typedef std::function<void(LSTATUS status)> DoneCallback;
+
+    static std::shared_ptr<RegHostQuery> Create(const std::shared_ptr<RegBackend> &backend,
+                                                std::vector<String> &&hosts,
+                                                HKEY baseKey,
+                                                const String &subKey,
+                                                std::vector<String> &&values,
+                                                const RegHostQueryOptions &options,
+                                                ResultCallback onResult,
+                                                DoneCallback onDone);
+
+    void Start();
+
+    // Hosts not started yet are skipped; hosts in flight still report.
+    void Cancel();
+
+private:
+    typedef std::chrono::steady_clock Clock;
+
+    struct Running
+    {
+        size_t index;
+        Clock::time_point start;
+        Clock::time_point deadline;
+    };
+
+    RegHostQuery(const std::shared_ptr<RegBackend> &backend,
+                 std::vector<String> &&hosts,
+                 HKEY baseKey,
+                 const String &subKey,
+                 std::vector<String> &&values,
+                 const RegHostQueryOptions &options,
+                 ResultCallback onResult,
+                 DoneCallback onDone);
+
+    void _Work();
+    void _Watch();
+    RegHostResult _Query(const String &host);
+
+    std::shared_ptr<RegBackend> _backend;
+    std::vector<String> _hosts;
+    HKEY _baseKey;
+    String _subKey;
+    std::vector<String> _values;
+    RegHostQueryOptions _options;
+    ResultCallback _onResult;
+    DoneCallback _onDone;
+
+    std::mutex _mutex;
+    std::condition_variable _changed;
+    size_t _next;
+    // Hosts not reported yet, started or not.
+    size_t _remaining;
+    std::vector<Running> _running;
+    bool _cancelled;
+};
@@ -1,16 +1,12 @@
-#include <Windows.h>
+#pragma once
+
+#include "RegPlatform.h"
+#include "RegBackend.h"
+#include "RegWriteBack.h"
 #include <string>
 #include <vector>
 #include <memory>
-
-typedef wchar_t Char;
-typedef std::wstring String;
-typedef unsigned long long QWORD;
-typedef std::vector<byte> ByteArray;
-
-#define STR(x) L##x
-#define STRLEN(x) wcslen(x)
-#define STRCOPY(x, x_size, y) wcscpy_s(x, x_size, y)
+#include <functional>
 
 struct RegValue
 {
@@ -19,6 +15,23 @@ struct RegValue
     ByteArray data;
 };
 
+struct RegValueCopyOptions
+{
+    // Values to copy; every value of the key when empty. Missing names are skipped.
+    std::vector<String> names;
+    // Name patterns with '*' and '?' wildcards; when not empty, a value must match one.
+    std::vector<String> patterns;
+    // Called with the name and type of each candidate value; false skips it.
+    std::function<bool(const String &name, DWORD type)> filter;
+    // Replace values that already exist in the destination.
+    bool overwrite;
+
+    RegValueCopyOptions()
+        : overwrite(true)
+    {
+    }
+};
+
 class RegKey
 {
 public:
@@ -27,21 +40,32 @@ public:
            const String &hostname = STR(""),
            REGSAM access = 0);
 
+    explicit RegKey(const std::shared_ptr<RegBackend> &backend,
+                    HKEY hKey = NULL);
+
     ~RegKey()
     {
         Close();
     }
 
     RegKey(RegKey &&r)
+        : _backend(r._backend)
+        , _writeBuffer(std::move(r._writeBuffer))
     {
-        _hKey = r.Detach();
         _lastStatus = r._lastStatus;
+        _hKey = r.Detach();
     }
 
     RegKey &operator=(RegKey &&r)
     {
-        _hKey = r.Detach();
-        _lastStatus = r._lastStatus;
+        if (this != &r)
+        {
+            Close();
+            _backend = r._backend;
+            _writeBuffer = std::move(r._writeBuffer);
+            _lastStatus = r._lastStatus;
+            _hKey = r.Detach();
+        }
         return *this;
     }
 
@@ -60,6 +84,7 @@ public:
     HKEY Connect(const String &hostname,
                  HKEY baseKey);
 
+    // Remote roots are shared through RegConnectionPool; the key holds a handle of its own.
     HKEY ConnectAndCreate(HKEY baseKey,
                           const String &subKeyName,
                           const String &hostname,
@@ -84,6 +109,11 @@ public:
         return _hKey;
     }
 
+    const std::shared_ptr<RegBackend> &GetBackend() const
+    {
+        return _backend;
+    }
+
     LSTATUS GetLastStatus() const
     {
         return _lastStatus;
@@ -96,8 +126,22 @@ public:
 
     bool IsWritable();
 
+    // Flushes pending buffered writes, then the key itself.
     bool Flush();
 
+    // Buffers value writes until they are flushed, see RegWriteBuffer.
+    // Other handles to the key do not see buffered writes.
+    bool EnableWriteBack(const RegWriteBackOptions &options = RegWriteBackOptions());
+    // Flushes pending writes and writes through again.
+    bool DisableWriteBack();
+    // Applies pending buffered writes; a no-op without write-back.
+    bool FlushWriteBack();
+
+    const std::shared_ptr<RegWriteBuffer> &GetWriteBuffer() const
+    {
+        return _writeBuffer;
+    }
+
     bool CopyTree(HKEY hSrc);
 
     bool Rename(const String &newName);
@@ -115,6 +159,8 @@ public:
 
     bool HasSubKey(const String &subKeyName);
 
+    bool QueryInfo(RegKeyInfo *info);
+
     std::vector<String> GetSubKeyNames();
 
     RegValue GetValue(const String &valueName,
@@ -172,7 +218,24 @@ public:
 
     bool DeleteValue(const String &valueName);
 
+    // Renames a value by copying its data under the new name, without decoding it.
+    // Fails with ERROR_ALREADY_EXISTS when `to` exists and `overwrite` is false,
+    // or when both names differ only in case.
+    bool MoveValue(const String &from, const String &to, bool overwrite = false);
+
+    // Copies values of this key to `dest` through a single buffer, sized once from QueryInfo.
+    // Stops at the first failure, whose status is set on both keys. `copied` receives the
+    // number of values written.
+    bool CopyValues(RegKey &dest, const RegValueCopyOptions &options, size_t *copied = nullptr);
+
 private:
+    LSTATUS _QueryValue(const String &valueName, DWORD *type, BYTE *data, DWORD *size);
+    // Reads the whole value, starting with a buffer of `sizeHint` bytes.
+    LSTATUS _QueryData(const String &valueName, DWORD *type, ByteArray &data, DWORD sizeHint = 256);
+    LSTATUS _SetValue(const String &valueName, DWORD type, const BYTE *data, DWORD size);
+
+    std::shared_ptr<RegBackend> _backend;
+    std::shared_ptr<RegWriteBuffer> _writeBuffer;
     HKEY _hKey;
     LSTATUS _lastStatus;
 };
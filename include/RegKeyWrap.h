@@ -1,14 +1,66 @@
+#pragma once
+
 #include "RegKey.h"
+#include "RegHandleBudget.h"
+#include "RegMarshal.h"
 #include <napi.h>
+#include <unordered_set>
+
+class RegKeyWrap;
+
+// State of the addon in one environment: the main thread and every worker thread
+// loading it get their own, so nothing JavaScript-side is shared between them.
+struct RegAddonData
+{
+  Napi::FunctionReference constructor;
+  // Keys alive in this environment, closed by its cleanup hook.
+  std::unordered_set<RegKeyWrap *> keys;
+  // Record where each key is created, for the leak report.
+  bool captureStacks = false;
+  // RegKey.prototype.__throwRegKeyError__, looked up on the first error.
+  Napi::FunctionReference throwRegKeyError;
+  // Cached names and type names of results.
+  RegMarshal marshal;
+};
 
-class RegKeyWrap : public Napi::ObjectWrap<RegKeyWrap>
+class RegKeyWrap : public Napi::ObjectWrap<RegKeyWrap>, public RegHandleBudget::Entry
 {
 public:
   static Napi::Object Init(Napi::Env env, Napi::Object exports);
-  static Napi::Object NewInstance(Napi::Env env, HKEY hKey, const std::wstring &path);
+  static Napi::Object NewInstance(Napi::Env env, HKEY hKey, const String &path);
+  // `access` is what the key was opened with, used to reopen it after an eviction.
+  static Napi::Object NewInstance(Napi::Env env, RegKey &&regKey, const String &path, REGSAM access = 0);
+  static bool IsInstance(Napi::Env env, const Napi::Value &value);
+
+  // Splits a key path into host, base key and subkey. Slashes may be used as separators;
+  // returns false when a "\\host" prefix is not followed by a base key.
+  static bool ParsePath(const String &path, String &hostname, String &baseKeyName, String &subKeyName);
+
+  // Module functions reading values from many keys in one call.
+  static Napi::Value ReadMany(const Napi::CallbackInfo &info);
+  static Napi::Value ReadManySync(const Napi::CallbackInfo &info);
+  // Streams the same key read from many remote hosts to a callback; returns a cancel function.
+  static Napi::Value QueryHosts(const Napi::CallbackInfo &info);
+  // Runs a path query on the pool, streaming batches of matches to a callback; returns a cancel function.
+  static Napi::Value Query(const Napi::CallbackInfo &info);
+  // Compiles a { name: type, defaults } object into a schema for __readSchema__.
+  static Napi::Value CompileSchema(const Napi::CallbackInfo &info);
+  // Returns one key of a tree state from syncTree or __cachedTree__, by its path relative to the root.
+  static Napi::Value ReadTreeState(const Napi::CallbackInfo &info);
+  // Scans one column of many columnar dumps, see RegColumnarReader.
+  static Napi::Value ScanColumnar(const Napi::CallbackInfo &info);
+  // Sets the handle limit of the process and stack capture of the environment.
+  static Napi::Value ConfigureHandles(const Napi::CallbackInfo &info);
+  // Lists the keys of the environment holding a handle, with their creation stacks.
+  static Napi::Value HandleReport(const Napi::CallbackInfo &info);
+  // Formats the message of a status code; RegKeyError.lastError calls it on first access.
+  static Napi::Value TranslateStatus(const Napi::CallbackInfo &info);
 
   RegKeyWrap(const Napi::CallbackInfo &info);
 
+  // Takes a key handed over from another environment by transfer().
+  static Napi::Value Receive(const Napi::CallbackInfo &info);
+
   // Properties
 
   Napi::Value IsValid(const Napi::CallbackInfo &info);
@@ -17,23 +69,31 @@ public:
   Napi::Value GetName(const Napi::CallbackInfo &info);
   void SetName(const Napi::CallbackInfo &info, const Napi::Value &value);
   Napi::Value GetLastStatus(const Napi::CallbackInfo &info);
+  Napi::Value GetBackend(const Napi::CallbackInfo &info);
   Napi::Value IsWritable(const Napi::CallbackInfo &info);
   Napi::Value Flush(const Napi::CallbackInfo &info);
+  Napi::Value EnableWriteBack(const Napi::CallbackInfo &info);
+  Napi::Value DisableWriteBack(const Napi::CallbackInfo &info);
+  Napi::Value GetWriteBackStats(const Napi::CallbackInfo &info);
   void SetLastStatus(const Napi::CallbackInfo &info, const Napi::Value &value);
   Napi::Value GetLastError(const Napi::CallbackInfo &info);
   Napi::Value Close(const Napi::CallbackInfo &info);
+  Napi::Value Info(const Napi::CallbackInfo &info);
   Napi::Value CopyTree(const Napi::CallbackInfo &info);
 
   // Value Operations
 
+  Napi::Value GetValue(const Napi::CallbackInfo &info);
   Napi::Value GetBinaryValue(const Napi::CallbackInfo &info);
   Napi::Value GetStringValue(const Napi::CallbackInfo &info);
+  Napi::Value GetExpandedValue(const Napi::CallbackInfo &info);
   Napi::Value GetMultiStringValue(const Napi::CallbackInfo &info);
   Napi::Value GetDwordValue(const Napi::CallbackInfo &info);
   Napi::Value GetQwordValue(const Napi::CallbackInfo &info);
   Napi::Value GetValueType(const Napi::CallbackInfo &info);
   Napi::Value HasValue(const Napi::CallbackInfo &info);
   Napi::Value GetValueNames(const Napi::CallbackInfo &info);
+  Napi::Value SetValue(const Napi::CallbackInfo &info);
   Napi::Value SetBinaryValue(const Napi::CallbackInfo &info);
   Napi::Value SetStringValue(const Napi::CallbackInfo &info);
   Napi::Value SetMultiStringValue(const Napi::CallbackInfo &info);
@@ -50,13 +110,83 @@ public:
   Napi::Value GetSubKeyNames(const Napi::CallbackInfo &info);
   Napi::Value HasSubKey(const Napi::CallbackInfo &info);
 
+  // Bulk Operations
+
+  Napi::Value Search(const Napi::CallbackInfo &info);
+  Napi::Value TreeOp(const Napi::CallbackInfo &info);
+  Napi::Value ReadSchema(const Napi::CallbackInfo &info);
+  Napi::Value SyncTree(const Napi::CallbackInfo &info);
+  Napi::Value SyncTreeAsync(const Napi::CallbackInfo &info);
+  Napi::Value CachedTree(const Napi::CallbackInfo &info);
+  Napi::Value Transfer(const Napi::CallbackInfo &info);
+  // Writes the subtree, or a tree state from syncTree, as a columnar dump.
+  Napi::Value ExportColumnar(const Napi::CallbackInfo &info);
+  Napi::Value MoveValue(const Napi::CallbackInfo &info);
+  // Copies values from the key given first to this one, see RegKey::CopyValues.
+  Napi::Value CopyValues(const Napi::CallbackInfo &info);
+
 private:
   void _ThrowRegKeyError(const Napi::CallbackInfo &info,
                          const std::string &message,
-                         const std::wstring &value = L"");
+                         const String &value = STR(""));
+
+  static RegAddonData &_GetAddonData(Napi::Env env);
+  // Cleanup hook of an environment: closes its keys before it is torn down, so handles
+  // of an exiting worker are not left to the finalizers of a dead isolate.
+  static void _CloseKeys(RegAddonData *addon);
+
+  // Reopens the key if it was evicted and marks it as used; every handle access goes through it.
+  RegKey &_Use();
+  // Counts the handle against RegHandleBudget if it can be reopened by path.
+  void _Track();
+  bool _Evict() override;
+
+  // Runs a getter without throwing RegKeyErrors; failures return undefined and leave
+  // their status in lastStatus. Argument errors still throw.
+  template <Napi::Value (RegKeyWrap::*Method)(const Napi::CallbackInfo &)>
+  Napi::Value _Try(const Napi::CallbackInfo &info)
+  {
+    struct Quiet
+    {
+      RegKeyWrap *key;
+      ~Quiet() { key->_quiet = false; }
+    } quiet = { this };
+    _quiet = true;
+    _failed = false;
+    Napi::Value result = (this->*Method)(info);
+    return _failed ? info.Env().Undefined() : result;
+  }
+
+  // Keeps the key in the live set of its environment for as long as it exists,
+  // including when the constructor throws.
+  class Tracker
+  {
+  public:
+    Tracker(RegAddonData &addon, RegKeyWrap *key)
+        : _addon(addon)
+        , _key(key)
+    {
+      _addon.keys.insert(_key);
+    }
+
+    ~Tracker()
+    {
+      _addon.keys.erase(_key);
+    }
 
-  static Napi::FunctionReference constructor;
+  private:
+    RegAddonData &_addon;
+    RegKeyWrap *_key;
+  };
 
+  Tracker _tracker;
   RegKey _regKey;
-  std::wstring _path;
+  String _path;
+  REGSAM _access;
+  // The handle was closed by RegHandleBudget and is reopened on the next use.
+  bool _evicted;
+  std::string _stack;
+  // Set by _Try: _ThrowRegKeyError records the failure in _failed instead of throwing.
+  bool _quiet;
+  bool _failed;
 };
@@ -0,0 +1,98 @@
+#pragma once
+
+#include "RegPlatform.h"
+#include <napi.h>
+#include <unordered_map>
+#include <vector>
+
+struct RegMarshalStats
+{
+    // Strings created in the engine heap or handed to it, cached names excluded.
+    uint64_t strings;
+    // Of those, strings stored one byte per character.
+    uint64_t latin1Strings;
+    // Of those, strings left in native memory as external strings.
+    uint64_t externalStrings;
+    // Names served from the cache of an environment.
+    uint64_t namesReused;
+    // Names created and added to the cache.
+    uint64_t namesCreated;
+    uint64_t arrays;
+    // Engine calls spent filling arrays.
+    uint64_t arrayCalls;
+};
+
+// Builds the JavaScript side of results with as few engine allocations as possible.
+// Type names, property names and the value and subkey names that keep coming back are
+// created once per environment as property keys; text that fits in Latin-1 is stored one
+// byte per character; large text stays in native memory as external strings where the
+// engine supports them; arrays are created at their final length and filled through the engine,
+// so scripts that patch Array do not see or change results.
+// Each environment has its own, in RegAddonData. The counters are process-wide.
+class RegMarshal
+{
+public:
+    // Properties set on every result object.
+    enum Property
+    {
+        PathProperty,
+        NameProperty,
+        TypeProperty,
+        ValueProperty,
+        DataProperty,
+        StatusProperty,
+        PropertyCount
+    };
+
+    // Names longer than this are not cached.
+    static const size_t MaxNameLength = 64;
+    // The cache is cleared when it reaches this size, so it follows the current workload.
+    static const size_t MaxNames = 4096;
+    // Strings from this many code units on are created as external strings.
+    static const size_t ExternalThreshold = 16384;
+
+    static Napi::String NewString(Napi::Env env, const Char *str, size_t length);
+
+    static Napi::String NewString(Napi::Env env, const String &str)
+    {
+        return NewString(env, str.c_str(), str.size());
+    }
+
+    // A value or subkey name, from the cache when it was seen before.
+    Napi::String NewName(Napi::Env env, const String &name);
+    // "REG_SZ" and the like; an empty string for unknown types.
+    Napi::String TypeName(Napi::Env env, DWORD type);
+
+    void Set(Napi::Object &object, Property property, napi_value value);
+
+    Napi::Array NewArray(Napi::Env env, const std::vector<napi_value> &elements);
+
+    template <typename T, typename Convert>
+    Napi::Array NewArray(Napi::Env env, const std::vector<T> &items, Convert convert)
+    {
+        Napi::Array result = _NewArray(env, items.size());
+        for (size_t i = 0; i < items.size(); i++)
+            result.Set(uint32_t(i), convert(items[i]));
+        return result;
+    }
+
+    static RegMarshalStats GetStats();
+    static void ResetStats();
+
+    // Whether the running host has external strings and property keys (Node-API 10, or
+    // experimental in Node.js 20); without them large text is copied and cached names are plain strings.
+    static bool HasExternalStrings();
+    static bool HasPropertyKeys();
+
+private:
+    // Creates an interned string where the engine supports property keys.
+    static Napi::String _NewKey(Napi::Env env, const Char *str, size_t length);
+    // An empty array of `length` elements, counted in the stats.
+    static Napi::Array _NewArray(Napi::Env env, size_t length);
+
+    std::unordered_map<String, Napi::Reference<Napi::String>> _names;
+    // Indexed by type, up to REG_QWORD.
+    Napi::Reference<Napi::String> _typeNames[REG_QWORD + 1];
+    Napi::Reference<Napi::String> _unknownType;
+    Napi::Reference<Napi::String> _properties[PropertyCount];
+};
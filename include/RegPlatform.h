@@ -0,0 +1,115 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <cstdint>
+
+#ifdef _WIN32
+
+#include <Windows.h>
+
+typedef wchar_t Char;
+#define STR(x) L##x
+
+#else
+
+// Stand-in definitions so the addon builds without Windows headers.
+// Values match the Windows SDK, so statuses and flags mean the same on both sides.
+
+typedef uint32_t DWORD;
+typedef int32_t LSTATUS;
+typedef DWORD REGSAM;
+typedef unsigned char BYTE;
+typedef unsigned char byte;
+typedef BYTE *LPBYTE;
+
+struct HKEY__;
+typedef HKEY__ *HKEY;
+
+#define PREDEFINED_HKEY(x) ((HKEY)(uintptr_t)(intptr_t)(int32_t)(x))
+
+#define HKEY_CLASSES_ROOT                   PREDEFINED_HKEY(0x80000000)
+#define HKEY_CURRENT_USER                   PREDEFINED_HKEY(0x80000001)
+#define HKEY_LOCAL_MACHINE                  PREDEFINED_HKEY(0x80000002)
+#define HKEY_USERS                          PREDEFINED_HKEY(0x80000003)
+#define HKEY_PERFORMANCE_DATA               PREDEFINED_HKEY(0x80000004)
+#define HKEY_CURRENT_CONFIG                 PREDEFINED_HKEY(0x80000005)
+#define HKEY_PERFORMANCE_TEXT               PREDEFINED_HKEY(0x80000050)
+#define HKEY_PERFORMANCE_NLSTEXT            PREDEFINED_HKEY(0x80000060)
+
+#define ERROR_SUCCESS                       0L
+#define ERROR_FILE_NOT_FOUND                2L
+#define ERROR_ACCESS_DENIED                 5L
+#define ERROR_INVALID_HANDLE                6L
+#define ERROR_NOT_ENOUGH_MEMORY             8L
+#define ERROR_BAD_FORMAT                    11L
+#define ERROR_INVALID_DATA                  13L
+#define ERROR_NOT_SAME_DEVICE               17L
+#define ERROR_NOT_SUPPORTED                 50L
+#define ERROR_BAD_NETPATH                   53L
+#define ERROR_UNEXP_NET_ERR                 59L
+#define ERROR_NETNAME_DELETED               64L
+#define ERROR_INVALID_PARAMETER             87L
+#define ERROR_ALREADY_EXISTS                183L
+#define ERROR_MORE_DATA                     234L
+#define ERROR_NO_MORE_ITEMS                 259L
+#define ERROR_IO_PENDING                    997L
+#define ERROR_BADDB                         1009L
+#define ERROR_BADKEY                        1010L
+#define ERROR_CANTREAD                      1012L
+#define ERROR_CANTWRITE                     1013L
+#define ERROR_KEY_DELETED                   1018L
+#define ERROR_CANCELLED                     1223L
+#define ERROR_INTERNAL_ERROR                1359L
+#define ERROR_TIMEOUT                       1460L
+#define ERROR_DATATYPE_MISMATCH             1629L
+#define RPC_S_SERVER_UNAVAILABLE            1722L
+#define RPC_S_CALL_FAILED                   1726L
+
+#define REG_NONE                            0
+#define REG_SZ                              1
+#define REG_EXPAND_SZ                       2
+#define REG_BINARY                          3
+#define REG_DWORD                           4
+#define REG_DWORD_LITTLE_ENDIAN             4
+#define REG_DWORD_BIG_ENDIAN                5
+#define REG_LINK                            6
+#define REG_MULTI_SZ                        7
+#define REG_RESOURCE_LIST                   8
+#define REG_FULL_RESOURCE_DESCRIPTOR        9
+#define REG_RESOURCE_REQUIREMENTS_LIST      10
+#define REG_QWORD                           11
+#define REG_QWORD_LITTLE_ENDIAN             11
+
+#define KEY_QUERY_VALUE                     0x0001
+#define KEY_SET_VALUE                       0x0002
+#define KEY_CREATE_SUB_KEY                  0x0004
+#define KEY_ENUMERATE_SUB_KEYS              0x0008
+#define KEY_NOTIFY                          0x0010
+#define KEY_CREATE_LINK                     0x0020
+#define KEY_WOW64_64KEY                     0x0100
+#define KEY_WOW64_32KEY                     0x0200
+#define KEY_WOW64_RES                       0x0300
+
+#define STANDARD_RIGHTS_REQUIRED            0x000F0000
+#define STANDARD_RIGHTS_READ                0x00020000
+#define STANDARD_RIGHTS_WRITE               0x00020000
+#define STANDARD_RIGHTS_EXECUTE             0x00020000
+#define STANDARD_RIGHTS_ALL                 0x001F0000
+#define MAXIMUM_ALLOWED                     0x02000000
+
+#define KEY_READ                            0x20019
+#define KEY_WRITE                           0x20006
+#define KEY_EXECUTE                         0x20019
+#define KEY_ALL_ACCESS                      0xF003F
+
+typedef char16_t Char;
+#define STR(x) u##x
+
+#endif
+
+typedef std::basic_string<Char> String;
+typedef unsigned long long QWORD;
+typedef std::vector<byte> ByteArray;
+
+#define STRLEN(x) std::char_traits<Char>::length(x)
@@ -0,0 +1,131 @@
+#pragma once
+
+#include "RegKey.h"
+#include "RegThreadPool.h"
+#include <functional>
+
+// Path queries such as HKLM/Software/*/Uninstall/*[DisplayName ~ "Java*"]/DisplayVersion.
+//
+//   query      := base ('/' step)*                 '\' separates steps too
+//   step       := '**' | name [':' type] ('[' predicate ']')*
+//   predicate  := name [':' type] [op literal]     op: = != ~ < <= > >=
+//   literal    := "string" | number                numbers may be hexadecimal (0x...)
+//
+// Names take '*' and '?' wildcards and match case-insensitively; a quoted name ("...", with
+// \" and \\ escapes) is taken literally, and @ stands for the default value. '**' matches
+// any number of levels of subkeys, including none. Every step but the last selects subkeys.
+// The last selects subkeys and values, only values when it has a type, and only subkeys when
+// it has predicates. A predicate holds when the key has the value (of that type) and its data
+// compares as asked: strings ignoring case, '~' with wildcards, integers numerically.
+enum class RegQueryOp : uint8_t
+{
+    Exists,
+    Equal,
+    NotEqual,
+    Match,
+    Less,
+    LessEqual,
+    Greater,
+    GreaterEqual
+};
+
+struct RegQueryPredicate
+{
+    String valueName;
+    // Any type when false.
+    bool typed;
+    DWORD type;
+    RegQueryOp op;
+    String text;
+    // Whether the literal was a number; `text` then holds it as written.
+    bool numeric;
+    QWORD number;
+};
+
+enum class RegQueryStepKind : uint8_t
+{
+    Literal,
+    Pattern,
+    Recursive
+};
+
+struct RegQueryStep
+{
+    RegQueryStepKind kind;
+    String name;
+    // The step only matches values of this type when set.
+    bool typed;
+    DWORD type;
+    std::vector<RegQueryPredicate> predicates;
+};
+
+// A compiled query. The leading literal steps are folded into `root`, opened once; the
+// remaining steps are run as a state machine so keys no step can match are never opened.
+struct RegQueryPlan
+{
+    String baseKey;
+    String root;
+    std::vector<RegQueryStep> steps;
+};
+
+struct RegQueryMatch
+{
+    // Relative to the root of the plan, empty for the root itself.
+    String path;
+    bool isValue;
+    String valueName;
+    DWORD type;
+    ByteArray data;
+};
+
+class RegQuery : public std::enable_shared_from_this<RegQuery>
+{
+public:
+    typedef std::function<void(std::vector<RegQueryMatch> &&matches)> MatchCallback;
+    // Receives the status of a task that failed (such as ERROR_NOT_ENOUGH_MEMORY), else
+    // ERROR_CANCELLED when cancelled, otherwise ERROR_SUCCESS.
+    typedef std::function<void(LSTATUS status)> DoneCallback;
+
+    // Returns false with a message and the offset of the offending character on a syntax error.
+    static bool Compile(const String &expression, RegQueryPlan &plan, std::string &error, size_t *position);
+
+    // Takes ownership of `root`, the key `plan.root` names, which must stay open for the whole query.
+    static std::shared_ptr<RegQuery> Create(RegKey &&root,
+                                            const RegQueryPlan &plan,
+                                            MatchCallback onMatches,
+                                            DoneCallback onDone);
+
+    void Start();
+
+    void Cancel()
+    {
+        _group.Cancel();
+    }
+
+    bool IsCancelled() const
+    {
+        return _group.IsCancelled();
+    }
+
+private:
+    // A step a key matched by name, still to be confirmed by the predicates of the step.
+    struct Transition
+    {
+        uint16_t step;
+        bool recursive;
+    };
+
+    RegQuery(RegKey &&root, const RegQueryPlan &plan, MatchCallback onMatches, DoneCallback onDone);
+
+    void _Visit(const String &path, const std::vector<Transition> &transitions);
+    void _Close(std::vector<uint16_t> &states) const;
+    bool _MatchName(const RegQueryStep &step, const String &name) const;
+    bool _Test(RegKey &key, const RegQueryPredicate &predicate) const;
+    void _MatchValues(RegKey &key, const String &path, const RegQueryStep &step, std::vector<RegQueryMatch> &matches);
+
+    RegKey _root;
+    RegQueryPlan _plan;
+    MatchCallback _onMatches;
+    DoneCallback _onDone;
+    RegTaskGroup _group;
+};
@@ -0,0 +1,126 @@
+#pragma once
+
+#include "RegBackend.h"
+#include "RegTrace.h"
+#include <map>
+#include <string>
+
+// Records every backend call of the keys opened while recording into a compact binary file,
+// and replays such a file against any backend.
+//
+// The file starts with the magic "RKRC", a version byte and 3 reserved bytes. Records follow,
+// each an op byte and LEB128 varints. Op 0xFF defines the next string (ids start at 1, 0 means
+// none): its length in UTF-16 code units, then the units little-endian. Other ops are RegTraceOp
+// values followed by: the begin time in nanoseconds since the previous call (zigzag), the duration,
+// the status and the key, then the fields of the op. Keys are 0 when unknown, (id << 1) for keys
+// opened while recording and (predefined key & 0xFFFF) << 1 | 1 for base keys; a key opened by
+// a call is given by its id, numbered from 1 in the order they are opened.
+// Value data is never recorded, only its type and size; replays write zeros.
+namespace RegRecorder
+{
+    struct Stats
+    {
+        uint64_t calls;
+        uint64_t bytes;
+    };
+
+    // Returns false when already recording or when the file cannot be created.
+    bool Start(const std::string &file);
+    // Writes out the remaining records and closes the file.
+    bool Stop(Stats *stats = nullptr);
+    bool IsRecording();
+
+    // Returns a backend recording its calls into the current file, or `backend` when not recording.
+    std::shared_ptr<RegBackend> Wrap(const std::shared_ptr<RegBackend> &backend);
+}
+
+struct RegReplayOptions
+{
+    // Multiple of the recorded pace; 0 replays every call as soon as the previous one returns.
+    double speed;
+    // Before replaying, create the keys and values the recording found, so a workload recorded
+    // elsewhere can run against an empty backend.
+    bool seed;
+
+    RegReplayOptions()
+        : speed(0)
+        , seed(false)
+    {
+    }
+};
+
+struct RegLatencySummary
+{
+    uint64_t calls;
+    // Nanoseconds.
+    uint64_t mean;
+    uint64_t p50;
+    uint64_t p90;
+    uint64_t p99;
+    uint64_t p999;
+    uint64_t max;
+};
+
+struct RegReplayReport
+{
+    uint64_t calls;
+    // Calls whose status differs from the recorded one.
+    uint64_t mismatches;
+    // Nanoseconds, and calls per second.
+    uint64_t elapsed;
+    double throughput;
+    RegLatencySummary latency;
+    RegLatencySummary recordedLatency;
+    std::map<std::string, RegLatencySummary> ops;
+};
+
+class RegReplay
+{
+public:
+    RegReplay()
+        : _handleCount(0)
+    {
+    }
+
+    // Returns false, with a message in `error`, when the file is missing or malformed.
+    bool Load(const std::string &file, std::string &error);
+
+    // Runs the loaded calls on the calling thread.
+    RegReplayReport Run(const std::shared_ptr<RegBackend> &backend, const RegReplayOptions &options);
+
+    size_t GetCallCount() const
+    {
+        return _calls.size();
+    }
+
+private:
+    struct Call
+    {
+        RegTraceOp op;
+        uint64_t begin;
+        uint64_t duration;
+        LSTATUS status;
+        uint32_t key;
+        uint32_t name;
+        uint32_t name2;
+        uint32_t result;
+        uint32_t dest;
+        REGSAM access;
+        DWORD index;
+        DWORD type;
+        DWORD size;
+        // Size of the buffer passed in plus 1, 0 when there was none.
+        DWORD capacity;
+    };
+
+    HKEY _Resolve(const std::vector<HKEY> &handles, uint32_t key) const;
+    const Char *_String(uint32_t id) const;
+    struct Buffers;
+
+    LSTATUS _Execute(RegBackend *backend, std::vector<HKEY> &handles, const Call &call, Buffers &buffers);
+    void _Seed(RegBackend *backend);
+
+    std::vector<Call> _calls;
+    std::vector<String> _strings;
+    uint32_t _handleCount;
+};
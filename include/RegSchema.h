@@ -0,0 +1,37 @@
+#pragma once
+
+#include "RegKey.h"
+
+struct RegSchemaField
+{
+    String name;
+    // The REG_* type the value is expected to have.
+    DWORD type;
+};
+
+// A set of typed values read from a key in one go. Fields are fixed when the schema is
+// compiled, so reading does no parsing and no allocation beyond the value data.
+class RegSchema
+{
+public:
+    void AddField(const String &name, DWORD type)
+    {
+        _fields.push_back({name, type});
+    }
+
+    const std::vector<RegSchemaField> &GetFields() const
+    {
+        return _fields;
+    }
+
+    // Whether a value of type `actual` can be read as `expected`: strings of either kind
+    // are interchangeable, and DWORDs may be stored big-endian.
+    static bool Accepts(DWORD expected, DWORD actual);
+
+    // Reads every field into `values` (aligned with the fields), with a status for each:
+    // ERROR_FILE_NOT_FOUND for missing values, ERROR_DATATYPE_MISMATCH when the type is not accepted.
+    void Read(RegKey &key, std::vector<RegValue> &values, std::vector<LSTATUS> &statuses) const;
+
+private:
+    std::vector<RegSchemaField> _fields;
+};
@@ -0,0 +1,85 @@
+#pragma once
+
+#include "RegKey.h"
+#include "RegThreadPool.h"
+#include <functional>
+
+enum class RegSearchField : uint8_t
+{
+    Key = 1,
+    Name = 2,
+    Data = 4
+};
+
+struct RegSearchOptions
+{
+    String pattern;
+    // A mask of RegSearchField bits.
+    uint32_t fields;
+    // Value types whose names and data are matched; empty matches names of all types
+    // and data of the string types.
+    std::vector<DWORD> types;
+    // Levels below the search root to visit; negative for no limit.
+    int maxDepth;
+
+    RegSearchOptions()
+        : fields(uint32_t(RegSearchField::Key) | uint32_t(RegSearchField::Name) | uint32_t(RegSearchField::Data))
+        , maxDepth(-1)
+    {
+    }
+};
+
+struct RegSearchHit
+{
+    // Relative to the search root, empty for the root itself.
+    String path;
+    String valueName;
+    DWORD type;
+    RegSearchField field;
+};
+
+// Case-insensitive substring search over a subtree. Every key is visited by its own task
+// on the shared pool, and hits are handed out in batches from whichever worker found them.
+class RegSearch : public std::enable_shared_from_this<RegSearch>
+{
+public:
+    typedef std::function<void(std::vector<RegSearchHit> &&hits)> HitCallback;
+    // Receives the status of a task that failed (such as ERROR_NOT_ENOUGH_MEMORY), else
+    // ERROR_CANCELLED when cancelled, otherwise ERROR_SUCCESS.
+    typedef std::function<void(LSTATUS status)> DoneCallback;
+
+    // Takes ownership of `root`, which must stay open for the whole search.
+    static std::shared_ptr<RegSearch> Create(RegKey &&root,
+                                             const RegSearchOptions &options,
+                                             HitCallback onHits,
+                                             DoneCallback onDone);
+
+    void Start();
+
+    void Cancel()
+    {
+        _group.Cancel();
+    }
+
+    bool IsCancelled() const
+    {
+        return _group.IsCancelled();
+    }
+
+    // Whether `text` contains the pattern, ignoring case.
+    bool Match(const Char *text, size_t length) const;
+
+private:
+    RegSearch(RegKey &&root, const RegSearchOptions &options, HitCallback onHits, DoneCallback onDone);
+
+    void _Visit(const String &path, int depth);
+    bool _MatchType(DWORD type, bool data) const;
+    bool _MatchData(const ByteArray &data) const;
+
+    RegKey _root;
+    RegSearchOptions _options;
+    String _foldedPattern;
+    HitCallback _onHits;
+    DoneCallback _onDone;
+    RegTaskGroup _group;
+};
@@ -0,0 +1,62 @@
+#pragma once
+
+#include "RegPlatform.h"
+#include <vector>
+
+// Case-insensitive helpers for registry names.
+// Registry names compare equal when their upper-cased UTF-16 code units are equal.
+// The vectorized kernels (SSE2, AVX2 or NEON, picked at run time where possible)
+// fold blocks of ASCII characters at once and fall back to the scalar table for the rest,
+// so both paths always produce identical results.
+namespace RegString
+{
+    Char FoldChar(Char c);
+
+    void Fold(const Char *src, Char *dst, size_t length);
+    String Fold(const Char *str, size_t length);
+
+    inline String Fold(const String &str)
+    {
+        return Fold(str.c_str(), str.size());
+    }
+
+    // Orders like a plain comparison of the folded strings.
+    int CompareFold(const Char *a, size_t aLength, const Char *b, size_t bLength);
+    bool EqualsFold(const Char *a, size_t aLength, const Char *b, size_t bLength);
+    uint32_t HashFold(const Char *str, size_t length);
+
+    inline bool EqualsFold(const String &a, const String &b)
+    {
+        return EqualsFold(a.c_str(), a.size(), b.c_str(), b.size());
+    }
+
+    inline uint32_t HashFold(const String &str)
+    {
+        return HashFold(str.c_str(), str.size());
+    }
+
+    // Wildcard match ignoring case: '*' matches any run of characters (backslashes included)
+    // and '?' matches exactly one.
+    bool MatchPattern(const Char *pattern, size_t patternLength, const Char *text, size_t textLength);
+
+    inline bool MatchPattern(const String &pattern, const String &text)
+    {
+        return MatchPattern(pattern.c_str(), pattern.size(), text.c_str(), text.size());
+    }
+
+    // Index of the first zero code unit in `units` (which need not be aligned), or `length`.
+    size_t FindNull(const void *units, size_t length);
+
+    // Scalar reference implementations, kept for verification and benchmarks.
+    int CompareFoldScalar(const Char *a, size_t aLength, const Char *b, size_t bLength);
+    uint32_t HashFoldScalar(const Char *str, size_t length);
+    size_t FindNullScalar(const void *units, size_t length);
+
+    // "avx2", "sse2", "neon" or "scalar".
+    const char *GetKernelName();
+    // The kernels this machine can run, fastest first; "scalar" is always last.
+    std::vector<const char *> GetKernelNames();
+    // Switches every function above to the named kernel, so tests and benchmarks can compare
+    // them. Not thread-safe. Returns false when the kernel is not available.
+    bool UseKernel(const char *name);
+}
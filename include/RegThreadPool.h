@@ -0,0 +1,109 @@
+#pragma once
+
+#include "RegPlatform.h"
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// A work-stealing pool shared by the bulk operations (search, batch reads, tree copies).
+// Tasks submitted from a worker go to the front of that worker's own deque, so a tree
+// walk runs depth-first per thread, while idle workers steal from the back of the others.
+class RegThreadPool
+{
+public:
+    typedef std::function<void()> Task;
+
+    // Sized to the hardware concurrency; registry calls block on I/O for remote keys,
+    // so at least four workers are started.
+    static RegThreadPool &Shared();
+
+    explicit RegThreadPool(size_t threadCount);
+    ~RegThreadPool();
+
+    RegThreadPool(const RegThreadPool &) = delete;
+    RegThreadPool &operator=(const RegThreadPool &) = delete;
+
+    size_t GetThreadCount() const
+    {
+        return _workers.size();
+    }
+
+    void Submit(Task task);
+
+    // Runs one queued task on the calling thread, if any. Used while waiting on a group
+    // so a worker blocked in Wait keeps the pool moving instead of deadlocking it.
+    bool RunPending();
+
+private:
+    struct Worker
+    {
+        std::mutex mutex;
+        std::deque<Task> tasks;
+    };
+
+    void _Run(size_t index);
+    bool _Pop(size_t index, Task &task);
+
+    std::vector<std::unique_ptr<Worker>> _workers;
+    std::vector<std::thread> _threads;
+    std::atomic<size_t> _queued;
+    std::atomic<size_t> _nextWorker;
+    std::mutex _sleepMutex;
+    std::condition_variable _wake;
+    bool _stopping;
+};
+
+// Tracks a set of tasks, including the ones they spawn, and reports when all have finished.
+// Once cancelled, tasks that have not started are skipped. A task that throws is recorded
+// as the group's failure (ERROR_NOT_ENOUGH_MEMORY for std::bad_alloc, ERROR_INTERNAL_ERROR
+// otherwise); the other tasks still run.
+class RegTaskGroup
+{
+public:
+    // Receives the first failure, or else ERROR_CANCELLED when cancelled, or else ERROR_SUCCESS.
+    typedef std::function<void(LSTATUS status)> DoneCallback;
+
+    explicit RegTaskGroup(RegThreadPool &pool = RegThreadPool::Shared());
+
+    RegTaskGroup(const RegTaskGroup &) = delete;
+    RegTaskGroup &operator=(const RegTaskGroup &) = delete;
+
+    // Called once by the thread finishing the last task. Must be set before the first Run.
+    void OnDone(DoneCallback done)
+    {
+        _done = std::move(done);
+    }
+
+    void Run(RegThreadPool::Task task);
+    void Wait();
+
+    void Cancel()
+    {
+        _cancelled.store(true, std::memory_order_relaxed);
+    }
+
+    bool IsCancelled() const
+    {
+        return _cancelled.load(std::memory_order_relaxed);
+    }
+
+    // The status OnDone receives; final once Wait has returned or OnDone was called.
+    LSTATUS GetStatus();
+
+private:
+    void _Fail(LSTATUS status);
+    void _Finish();
+
+    RegThreadPool &_pool;
+    std::mutex _mutex;
+    std::condition_variable _finished;
+    size_t _pending;
+    std::atomic<bool> _cancelled;
+    LSTATUS _failure;
+    DoneCallback _done;
+};
@@ -0,0 +1,91 @@
+#pragma once
+
+#include "RegPlatform.h"
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+
+enum class RegTraceOp : uint8_t
+{
+    OpenKey,
+    CreateKey,
+    ConnectRegistry,
+    CloseKey,
+    FlushKey,
+    CopyTree,
+    RenameKey,
+    DeleteTree,
+    DeleteKey,
+    QueryInfoKey,
+    EnumKey,
+    EnumValue,
+    QueryValue,
+    SetValue,
+    DeleteValue
+};
+
+const size_t RegTraceNameCapacity = 46;
+
+// A fixed-size record, so the per-thread ring never allocates once created.
+struct RegTraceEvent
+{
+    uint64_t begin;
+    uint64_t end;
+    uint64_t key;
+    // The path the key was opened with, by its index in the path table; 0 when the key
+    // was opened before tracing was enabled.
+    uint32_t path;
+    int32_t status;
+    RegTraceOp op;
+    uint8_t nameLength;
+    // The subkey or value name the call was given, cut at RegTraceNameCapacity;
+    // empty for calls that take none.
+    Char name[RegTraceNameCapacity];
+};
+
+namespace RegTrace
+{
+    extern std::atomic<bool> enabled;
+
+    inline bool IsEnabled()
+    {
+        return enabled.load(std::memory_order_relaxed);
+    }
+
+    // Rings are allocated per thread on first use with the given number of slots
+    // (rounded up to a power of two). Enabling again drops all recorded events.
+    void Enable(size_t capacityPerThread = 4096);
+    void Disable();
+    void Clear();
+
+    const char *GetOpName(RegTraceOp op);
+
+    uint64_t Now();
+    void Record(RegTraceOp op, HKEY hKey, const Char *name, LSTATUS status, uint64_t begin, uint64_t end);
+
+    // Remembers the path of a handle opened while tracing is on, so the calls made on it are
+    // exported with the key they hit. Closing the handle forgets it, as its value may be reused.
+    void NameKey(HKEY hKey, const String &path);
+    void NameKey(HKEY hKey, HKEY parent, const Char *subKey);
+    // "HKEY_CURRENT_USER" and the like for predefined keys; empty for handles not named.
+    String GetKeyPath(HKEY hKey);
+
+    // Chrome trace-event JSON, loadable by Perfetto and chrome://tracing.
+    std::string DumpChromeJson();
+
+    template <typename Call>
+    LSTATUS Invoke(RegTraceOp op, HKEY hKey, const Char *name, Call &&call)
+    {
+        uint64_t begin = Now();
+        LSTATUS status = call();
+        Record(op, hKey, name, status, begin, Now());
+        return status;
+    }
+}
+
+// Evaluates `call` and records it in the calling thread's ring when tracing is on.
+// When tracing is off the only overhead is one relaxed atomic load.
+#define REG_TRACED(op, hKey, name, call)                                              \
+    (RegTrace::IsEnabled()                                                          \
+         ? RegTrace::Invoke(RegTraceOp::op, (hKey), (name), [&]() -> LSTATUS { return (call); }) \
+         : LSTATUS(call))
@@ -0,0 +1,18 @@
+#pragma once
+
+#include "RegTreeSync.h"
+#include <string>
+
+// Persists a RegTreeState so a later process can start from it instead of reading the tree again.
+// The file is read in one call and validated by a checksum; a RegTreeSync pass over the loaded
+// state then re-reads only the keys whose last write time moved since it was saved.
+class RegTreeCache
+{
+public:
+    // `file` is UTF-8. `source` identifies the tree (backend and path); a cache saved for another
+    // source, or one that is missing, truncated or corrupt, loads as null.
+    static std::shared_ptr<RegTreeState> Load(const std::string &file, const String &source);
+
+    // Writes a temporary file beside `file` and renames it over, so a reader never sees a partial cache.
+    static bool Save(const std::string &file, const String &source, const RegTreeState &state);
+};
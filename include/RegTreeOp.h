@@ -0,0 +1,139 @@
+#pragma once
+
+#include "RegKey.h"
+#include "RegThreadPool.h"
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <unordered_set>
+
+enum class RegTreeOpKind
+{
+    Copy,
+    Move,
+    Delete
+};
+
+struct RegTreeOpOptions
+{
+    // Key paths relative to the source, with '*' and '?' wildcards. When not empty,
+    // only matching keys and their subkeys are processed (parents are created as needed).
+    std::vector<String> include;
+    // Matching keys are skipped along with their subkeys.
+    std::vector<String> exclude;
+    // Value names that are neither copied nor deleted.
+    std::vector<String> excludeValues;
+    // Keys completed by an interrupted copy; their values are not written again.
+    std::vector<String> resume;
+    // Keys read ahead of the writer before readers wait for it.
+    size_t queueSize;
+
+    RegTreeOpOptions()
+        : queueSize(256)
+    {
+    }
+};
+
+struct RegTreeOpProgress
+{
+    uint64_t keys;
+    uint64_t values;
+    uint64_t bytes;
+    // Source keys that could not be opened.
+    uint64_t skipped;
+};
+
+struct RegTreeOpResult
+{
+    RegTreeOpProgress progress;
+    LSTATUS status;
+    // The key the first failing write was made to.
+    String failedPath;
+    // Keys whose values were fully written, filled when the operation did not complete,
+    // so it can be resumed through RegTreeOpOptions::resume.
+    std::vector<String> completed;
+};
+
+// Copies, moves or deletes a subtree in two stages: readers walk the source on the shared pool
+// and feed a bounded queue, while a writer thread applies each key to the destination.
+// A key is queued before its subkeys are read, so the writer always sees parents first.
+// Deletions run children first once the walk is complete. Source and destination
+// may live in different backends.
+class RegTreeOp : public std::enable_shared_from_this<RegTreeOp>
+{
+public:
+    typedef std::function<void(const RegTreeOpProgress &progress)> ProgressCallback;
+    typedef std::function<void(RegTreeOpResult &&result)> DoneCallback;
+
+    // Takes ownership of both handles; `dest` is unused for deletions.
+    // Progress is reported from the writer thread at most every `progressInterval` milliseconds.
+    static std::shared_ptr<RegTreeOp> Create(RegTreeOpKind kind,
+                                             RegKey &&source,
+                                             RegKey &&dest,
+                                             const RegTreeOpOptions &options,
+                                             ProgressCallback onProgress,
+                                             DoneCallback onDone,
+                                             unsigned progressInterval = 100);
+
+    void Start();
+    void Cancel();
+
+    bool IsCancelled() const
+    {
+        return _group.IsCancelled();
+    }
+
+private:
+    struct Item
+    {
+        String path;
+        std::vector<RegValue> values;
+        // Some values were excluded, so the key itself must stay.
+        bool keep;
+    };
+
+    RegTreeOp(RegTreeOpKind kind, RegKey &&source, RegKey &&dest, const RegTreeOpOptions &options,
+              ProgressCallback onProgress, DoneCallback onDone, unsigned progressInterval);
+
+    void _Read(const String &path, bool selected);
+    void _Write();
+    bool _WriteItem(const Item &item);
+    void _DeleteItems();
+    bool _DeleteValues(RegKey &key, const Item &item);
+
+    bool _Push(Item &&item);
+    bool _Pop(Item &item);
+    void _Close(LSTATUS readStatus);
+
+    bool _MatchAny(const std::vector<String> &patterns, const String &text) const;
+    void _Fail(LSTATUS status, const String &path);
+    void _Report(bool force);
+
+    RegTreeOpKind _kind;
+    RegKey _source;
+    RegKey _dest;
+    RegTreeOpOptions _options;
+    std::unordered_set<String> _resume;
+    ProgressCallback _onProgress;
+    DoneCallback _onDone;
+    unsigned _progressInterval;
+
+    std::mutex _queueMutex;
+    std::condition_variable _notEmpty;
+    std::condition_variable _notFull;
+    std::deque<Item> _queue;
+    bool _closed;
+    // Set with _closed: how the readers ended, ERROR_SUCCESS unless one of them failed.
+    LSTATUS _readStatus;
+
+    // Owned by the writer thread.
+    std::vector<Item> _visited;
+    std::vector<String> _completed;
+    RegTreeOpProgress _progress;
+    std::chrono::steady_clock::time_point _lastReport;
+    LSTATUS _status;
+    String _failedPath;
+
+    std::atomic<uint64_t> _skipped;
+    RegTaskGroup _group;
+};
@@ -0,0 +1,59 @@
+#pragma once
+
+#include "RegKey.h"
+#include <unordered_map>
+
+// What a sync pass saw of every key under its root, keyed by the folded path relative to the root.
+struct RegTreeState
+{
+    struct Key
+    {
+        // The path as enumerated, empty for the root.
+        String path;
+        QWORD lastWriteTime;
+        std::vector<String> subKeys;
+        std::vector<RegValue> values;
+    };
+
+    std::unordered_map<String, Key> keys;
+};
+
+enum class RegTreeChangeKind
+{
+    KeyAdded,
+    KeyRemoved,
+    ValueSet,
+    ValueRemoved
+};
+
+struct RegTreeChange
+{
+    RegTreeChangeKind kind;
+    String path;
+    // The value set, or just the name of the value removed.
+    RegValue value;
+};
+
+struct RegTreeSyncStats
+{
+    // Keys whose last write time was queried.
+    size_t visited;
+    // Keys whose values and subkeys were read again.
+    size_t reread;
+};
+
+// Brings a RegTreeState up to date with the tree under a key, reporting the differences.
+// A key's last write time changes when its values change or when direct subkeys are added
+// or removed, so keys whose time is unchanged keep their recorded values and subkeys
+// and cost a single QueryInfoKey. Every key is still visited: a change deep in a subtree
+// does not touch the times of its ancestors.
+class RegTreeSync
+{
+public:
+    // `previous` may be null for a first, full pass. Returns null, with the status in `root`,
+    // when the root itself cannot be queried.
+    static std::shared_ptr<const RegTreeState> Sync(RegKey &root,
+                                                    const std::shared_ptr<const RegTreeState> &previous,
+                                                    std::vector<RegTreeChange> &changes,
+                                                    RegTreeSyncStats *stats = nullptr);
+};
@@ -0,0 +1,97 @@
+#pragma once
+
+#include "RegBackend.h"
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+struct RegWriteBackOptions
+{
+    // Milliseconds a write may stay buffered before a background flush; 0 disables the timer.
+    unsigned interval;
+    // Pending bytes (names and data) that make the writing thread flush.
+    size_t maxBytes;
+
+    RegWriteBackOptions()
+        : interval(1000)
+        , maxBytes(64 * 1024)
+    {
+    }
+};
+
+struct RegWriteBackStats
+{
+    // Sets and deletes taken by the buffer.
+    uint64_t writes;
+    // Writes that replaced a pending write to the same value.
+    uint64_t merged;
+    // Flushes that reached the backend.
+    uint64_t flushes;
+    // Values written or deleted by those flushes.
+    uint64_t flushed;
+    // Values dropped because the backend rejected them.
+    uint64_t failed;
+    size_t pending;
+    // The status of the last rejected write.
+    LSTATUS lastStatus;
+};
+
+// Buffers the value writes of one key and applies them in batches. Repeated writes to a value
+// are merged, so only the last one reaches the backend. Pending writes are flushed once
+// `interval` has passed since the first of them, when `maxBytes` is reached, on Flush()
+// and on Close(). Reads of a pending value are served from the buffer.
+class RegWriteBuffer : public std::enable_shared_from_this<RegWriteBuffer>
+{
+public:
+    static std::shared_ptr<RegWriteBuffer> Create(const std::shared_ptr<RegBackend> &backend,
+                                                  HKEY hKey,
+                                                  const RegWriteBackOptions &options);
+
+    RegWriteBuffer(const RegWriteBuffer &) = delete;
+    RegWriteBuffer &operator=(const RegWriteBuffer &) = delete;
+
+    // Return the status the caller reports: ERROR_SUCCESS unless a size-triggered flush failed.
+    LSTATUS SetValue(const String &name, DWORD type, const BYTE *data, DWORD size);
+    LSTATUS DeleteValue(const String &name);
+
+    // Serves a query with RegQueryValueEx semantics into `status`.
+    // Returns false when the value has no pending write and must be read from the backend.
+    bool QueryValue(const String &name, DWORD *type, BYTE *data, DWORD *size, LSTATUS *status);
+
+    // Returns the first failing status; failed writes are dropped.
+    LSTATUS Flush();
+    // Flushes and stops buffering. The handle is not used afterwards.
+    LSTATUS Close();
+
+    RegWriteBackStats GetStats();
+
+    // Flushes every open buffer, e.g. before the process exits.
+    static void FlushAll();
+
+private:
+    struct Entry
+    {
+        String name;
+        DWORD type;
+        ByteArray data;
+        bool deleted;
+    };
+
+    RegWriteBuffer(const std::shared_ptr<RegBackend> &backend, HKEY hKey, const RegWriteBackOptions &options);
+
+    LSTATUS _Put(const String &name, Entry &&entry);
+    LSTATUS _Flush();
+
+    std::shared_ptr<RegBackend> _backend;
+    RegWriteBackOptions _options;
+
+    std::mutex _mutex;
+    HKEY _hKey;
+    // Keyed by the folded name.
+    std::unordered_map<String, Entry> _pending;
+    size_t _pendingBytes;
+    bool _scheduled;
+    RegWriteBackStats _stats;
+
+    friend class RegWriteBackTimer;
+};
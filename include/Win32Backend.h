@@ -0,0 +1,37 @@
+#pragma once
+
+#include "RegBackend.h"
+
+#ifdef _WIN32
+
+// Forwards every call to the Win32 registry API.
+class Win32Backend : public RegBackend
+{
+public:
+    const char *GetName() const override
+    {
+        return "win32";
+    }
+
+    LSTATUS OpenKey(HKEY hKey, const Char *subKey, REGSAM access, HKEY *result) override;
+    LSTATUS CreateKey(HKEY hKey, const Char *subKey, REGSAM access, HKEY *result) override;
+    LSTATUS ConnectRegistry(const Char *host, HKEY hKey, HKEY *result) override;
+    LSTATUS CloseKey(HKEY hKey) override;
+    LSTATUS FlushKey(HKEY hKey) override;
+
+    LSTATUS CopyTree(HKEY hSrc, const Char *subKey, HKEY hDest) override;
+    LSTATUS RenameKey(HKEY hKey, const Char *subKey, const Char *newName) override;
+    LSTATUS DeleteTree(HKEY hKey, const Char *subKey) override;
+    LSTATUS DeleteKey(HKEY hKey, const Char *subKey) override;
+
+    LSTATUS QueryInfoKey(HKEY hKey, RegKeyInfo *info) override;
+    LSTATUS EnumKey(HKEY hKey, DWORD index, Char *name, DWORD *nameLength) override;
+    LSTATUS EnumValue(HKEY hKey, DWORD index, Char *name, DWORD *nameLength,
+                      DWORD *type, BYTE *data, DWORD *dataSize) override;
+
+    LSTATUS QueryValue(HKEY hKey, const Char *name, DWORD *type, BYTE *data, DWORD *dataSize) override;
+    LSTATUS SetValue(HKEY hKey, const Char *name, DWORD type, const BYTE *data, DWORD dataSize) override;
+    LSTATUS DeleteValue(HKEY hKey, const Char *name) override;
+};
+
+#endif
@@ -1,4 +1,5 @@
 import { Buffer } from 'buffer'
+import { Readable, Writable } from 'stream'
 
 /**
  * Registry key access rights
@@ -90,6 +91,295 @@ export declare interface RegKeyOptions {
    * The desired access rights.
    */
   access?: RegKeyAccess | RegKeyAccess[]
+
+  /**
+   * The registry backend to use. Defaults to the value of getDefaultBackend().
+   */
+  backend?: RegBackendName
+}
+
+/**
+ * - 'win32': The Windows registry. Only available on Windows.
+ * - 'memory': A process-local in-memory registry, available on every platform.
+ * - Any other name: a hive file mounted with loadHive().
+ */
+export declare type RegBackendName = 'win32' | 'memory' | (string & {})
+
+/**
+ * Where key.search() looks for the pattern.
+ * - 'keys': Subkey names.
+ * - 'names': Value names.
+ * - 'data': Value data, read as UTF-16 text.
+ */
+export declare type RegSearchField = 'keys' | 'names' | 'data'
+
+export declare interface RegSearchOptions {
+  /**
+   * Where to look for the pattern. Defaults to all fields.
+   */
+  in?: RegSearchField[]
+
+  /**
+   * Only match values of these types.
+   * By default value names of every type and data of REG_SZ, REG_EXPAND_SZ and REG_MULTI_SZ are matched.
+   */
+  types?: RegValueType[]
+
+  /**
+   * How many levels below the key to visit. Unlimited by default.
+   */
+  maxDepth?: number
+}
+
+export declare interface RegSearchHit {
+  /**
+   * The full path of the key that matched or holds the matching value.
+   */
+  path: string
+
+  /**
+   * The name of the matching value. Not set for key hits.
+   */
+  value?: string
+
+  /**
+   * The type of the matching value. Not set for key hits.
+   */
+  type?: RegValueType
+
+  in: RegSearchField
+}
+
+export declare interface RegTreeProgress {
+  /** Keys copied or deleted so far. */
+  keys: number
+  /** Values copied or deleted so far. */
+  values: number
+  /** Bytes of value data copied so far. */
+  bytes: number
+  /** Source keys that could not be opened and were skipped. */
+  skipped: number
+}
+
+export declare interface RegTreeResult extends RegTreeProgress {
+  /** The Win32 status of the operation. */
+  status: number
+  cancelled: boolean
+  /** The error message, when the operation failed. */
+  error?: string
+  /** The destination key that could not be written, when the operation failed. */
+  failedPath?: string
+  /** Keys already copied, when the operation did not complete. */
+  completed?: string[]
+}
+
+export declare interface RegTreeOptions {
+  /**
+   * Key paths relative to the source, with '*' and '?' wildcards.
+   * When given, only matching keys and their subkeys are processed.
+   */
+  include?: string | string[]
+  /** Key paths whose whole subtree is skipped. */
+  exclude?: string | string[]
+  /** Value names that are left alone. */
+  excludeValues?: string | string[]
+  /** Continue an interrupted copy: the result it ended with, or its completed keys. */
+  resume?: RegTreeResult | string[]
+  /** Called from time to time with the counts so far. */
+  onProgress?: (progress: RegTreeProgress) => void
+  /** Cancels the operation when aborted. The promise then resolves with `cancelled` set. */
+  signal?: AbortSignal
+}
+
+export declare interface RegKeyInfo {
+  subKeys: number
+  values: number
+  /** The longest subkey name, in characters. */
+  maxSubKeyLength: number
+  /** The longest value name, in characters. */
+  maxValueNameLength: number
+  /** The largest value data, in bytes. */
+  maxValueLength: number
+  lastWriteTime: Date
+}
+
+/**
+ * The tree as seen by a syncTree pass. Only meaningful when passed back to syncTree.
+ */
+export declare interface RegTreeState {
+  /** The number of keys in the tree. */
+  readonly keys: number
+}
+
+export declare interface RegTreeChange {
+  kind: 'keyAdded' | 'keyRemoved' | 'valueSet' | 'valueRemoved'
+  /** The full path of the key. */
+  path: string
+  /** The value name, for value changes. */
+  name?: string
+  /** The new type, for valueSet. */
+  type?: RegValueType
+  /** The new value, for valueSet. */
+  value?: string | string[] | number | bigint | Buffer
+}
+
+export declare interface RegCachedKey {
+  /** The path relative to the root of the tree. */
+  path: string
+  lastWriteTime: Date
+  subKeys: string[]
+  values: { name: string, type: RegValueType, value: string | string[] | number | bigint | Buffer }[]
+}
+
+export declare class RegCachedTree {
+  /** The full path of the root key. */
+  readonly path: string
+  /** False when the cache file was missing or invalid and the whole tree was read. */
+  readonly fromCache: boolean
+  /** Changes since the cache was saved; every key and value when it was not used. */
+  readonly changes: RegTreeChange[]
+  /** Resolves to whether the cache file is up to date. */
+  readonly saved: Promise<boolean>
+  /** The state of the tree, which can be passed to RegKey.syncTree of the root key. */
+  readonly state: RegTreeState
+
+  /**
+   * @param subPath - A path relative to the root; the root when omitted.
+   * @returns The key, or null if it is not in the tree.
+   */
+  key(subPath?: string): RegCachedKey | null
+  has(subPath?: string): boolean
+  subKeys(subPath?: string): string[]
+  values(subPath?: string): RegCachedKey['values']
+  /** The value data, or undefined if there is no such value. Names are matched ignoring case. */
+  getValue(subPath: string, name: string): string | string[] | number | bigint | Buffer | undefined
+}
+
+export declare interface RegTreeSyncResult {
+  /** Pass to the next syncTree call. */
+  state: RegTreeState
+  /** Changes since the previous state; every key and value of the tree on the first pass. */
+  changes: RegTreeChange[]
+  /** Keys whose last write time was checked. */
+  visited: number
+  /** Keys whose last write time changed, so their values and subkeys were read again. */
+  reread: number
+}
+
+export declare interface RegReadRequest {
+  /** The full path of the key, e.g. 'HKLM\\Software\\MyApp' or '\\\\host\\HKLM\\Software'. */
+  path: string
+  /** The values to read. Every value of the key is read when omitted. */
+  values?: string | string[]
+}
+
+export declare interface RegReadOptions {
+  /** The backend to read from. Defaults to the default backend. */
+  backend?: RegBackendName
+  /** Extra access rights (e.g. RegKeyAccess.ia32) used to open the keys. */
+  access?: RegKeyAccess | number
+  /**
+   * Expand environment variables in REG_EXPAND_SZ values, using one snapshot
+   * of the environment for the whole batch. The type of the values stays REG_EXPAND_SZ.
+   */
+  expand?: boolean
+  /** Variables that override the environment when expanding. */
+  env?: Record<string, string>
+}
+
+export declare interface RegReadValue {
+  name: string
+  /** The Win32 status of reading the value; 0 on success. */
+  status: number
+  /** Set when the value was read. */
+  type?: RegValueType
+  /**
+   * Set when the value was read: a string for REG_SZ and REG_EXPAND_SZ, an array for REG_MULTI_SZ,
+   * a number for REG_DWORD, a bigint for REG_QWORD and a Buffer otherwise.
+   */
+  value?: string | string[] | number | bigint | Buffer
+}
+
+export declare interface RegReadResult {
+  /** The path as given in the request. */
+  path: string
+  /** The Win32 status of opening the key; 0 on success. */
+  status: number
+  /** One entry per requested value, in request order. */
+  values: RegReadValue[]
+}
+
+/**
+ * The value type of every field, plus optional default values.
+ * Defaults are used for missing values and for values that fail the type check.
+ */
+export declare type RegSchemaSpec = {
+  [name: string]: RegValueType | Record<string, any> | undefined
+  defaults?: Record<string, any>
+}
+
+export declare interface RegSchemaError {
+  /** The name of the value. */
+  name: string
+  /** The Win32 status: ERROR_DATATYPE_MISMATCH (1629), ERROR_INVALID_DATA (13) or the status of the read. */
+  status: number
+  /** The type the schema expects. */
+  expected: RegValueType
+  /** The type found in the registry, or null when the value could not be read. */
+  type: RegValueType | null
+}
+
+export declare interface RegSchema {
+  /** The names of the values read by the schema. */
+  readonly fields: string[]
+  /**
+   * Read every field from the key in one native call.
+   * REG_SZ and REG_EXPAND_SZ satisfy each other, and REG_DWORD accepts REG_DWORD_BIG_ENDIAN.
+   * Missing values without a default are left out of `values`.
+   */
+  read(key: RegKey): { values: Record<string, any>, errors: RegSchemaError[] }
+}
+
+export declare interface RegWriteBackOptions {
+  /** Milliseconds a write may stay buffered. 0 only flushes by size or by hand. Defaults to 1000. */
+  interval?: number
+  /** Buffered bytes (names and data) that trigger a flush. Defaults to 65536. */
+  maxBytes?: number
+}
+
+export declare interface RegWriteBackStats {
+  /** Writes and deletions taken by the buffer. */
+  writes: number
+  /** Writes that replaced a buffered write to the same value. */
+  merged: number
+  /** merged / writes. */
+  mergeRatio: number
+  /** Flushes that reached the registry. */
+  flushes: number
+  /** Values written or deleted by those flushes. */
+  flushed: number
+  /** Values dropped because the registry rejected them. */
+  failed: number
+  /** Values waiting for the next flush. */
+  pending: number
+  /** The Win32 status of the last rejected write. */
+  lastStatus: number
+}
+
+/**
+ * Streams search hits as they are found.
+ * Breaking out of a for await loop cancels the search.
+ */
+export declare interface RegSearchResults extends AsyncIterableIterator<RegSearchHit> {
+  /**
+   * Stop the search and end the iteration.
+   */
+  cancel(): Promise<IteratorResult<RegSearchHit>>
+
+  /**
+   * Wait for the search to finish and collect all hits.
+   */
+  toArray(): Promise<RegSearchHit[]>
 }
 
 /**
@@ -113,6 +403,14 @@ export declare class RegKey {
    */
   constructor(path: string, access: RegKeyAccess | RegKeyAccess[])
 
+  /**
+   * Take over a key handed out by transfer(), typically in another worker thread.
+   * A token can be received once.
+   * 
+   * @param token - The token returned by transfer().
+   */
+  static receive(token: number): RegKey
+
   /**
    * @readonly The full path to the registry key.
    */
@@ -140,6 +438,12 @@ export declare class RegKey {
    */
   lastStatus: number
 
+  /**
+   * @readonly The backend the key belongs to.
+   *           Subkeys opened or created from this key use the same backend.
+   */
+  readonly backend: RegBackendName
+
   /**
    * Check if the key is writable.
    * 
@@ -149,12 +453,37 @@ export declare class RegKey {
 
   /**
    * Flushes the key to disk.
+   * Buffered writes (see enableWriteBack()) are applied first.
    * 
    * @returns True if the key was flushed.
    * @throws {RegistryError} if failed.
    */
   flush(): boolean
 
+  /**
+   * Buffer value writes and deletions of this key and apply them in batches.
+   * Repeated writes to a value are merged, so only the last one is written.
+   * Buffered writes are read back by this key, but other keys opened on the same path do not see them until flushed.
+   * They are flushed after `interval`, when `maxBytes` is reached, on flush(), close(), disableWriteBack() and when the process exits.
+   * 
+   * @returns True if write-back was enabled.
+   * @throws {RegistryError} if the key is not open.
+   */
+  enableWriteBack(options?: RegWriteBackOptions): boolean
+
+  /**
+   * Flush buffered writes and write through again.
+   * 
+   * @returns True if every buffered write succeeded.
+   * @throws {RegistryError} if a buffered write failed.
+   */
+  disableWriteBack(): boolean
+
+  /**
+   * Counters of the write-back buffer, or null when write-back is disabled.
+   */
+  readonly writeBackStats: RegWriteBackStats | null
+
   /**
    * Get the last error message
    * 
@@ -170,9 +499,70 @@ export declare class RegKey {
    */
   copyTree(src: RegKey): boolean
 
+  /**
+   * Copy the subkey tree from the source key to the current key without blocking.
+   * The source is read on worker threads while a writer applies it to this key.
+   * The keys may use different backends.
+   * 
+   * @param src - The source key.
+   * @param options - Filters, progress and cancellation.
+   * @returns The final counts. If the copy fails, the promise rejects with a RegKeyError
+   * that has a `result` property, which can be passed as `resume` to continue.
+   */
+  copyTreeAsync(src: RegKey, options?: RegTreeOptions): Promise<RegTreeResult>
+
+  /**
+   * Like copyTreeAsync, but removes what was copied from the source afterwards.
+   * Source keys holding excluded values or subkeys are kept.
+   */
+  moveTreeAsync(src: RegKey, options?: RegTreeOptions): Promise<RegTreeResult>
+
+  /**
+   * Get the counts, name lengths and last write time of the key.
+   */
+  info(): RegKeyInfo
+
+  /**
+   * Read the subkey tree and report what changed since a previous pass.
+   * Keys whose last write time did not change are not read again, so a pass over
+   * an unchanged tree costs one query per key.
+   * 
+   * @param previous - The state returned by the previous pass, or nothing for the first one.
+   */
+  syncTree(previous?: RegTreeState | null): RegTreeSyncResult
+
+  /**
+   * Like syncTree, but runs on a worker thread.
+   */
+  syncTreeAsync(previous?: RegTreeState | null): Promise<RegTreeSyncResult>
+
+  /**
+   * Write every value of the subtree as a row of a columnar dump, see scanColumnar.
+   * Values of keys that cannot be opened are left out.
+   * 
+   * @param file - The dump file. It is written beside and renamed over, so readers never see a partial dump.
+   * @param options.state - A state returned by syncTree to dump instead of reading the registry again.
+   * @param options.pageRows - Rows per page, 4096 by default. Smaller pages let scans skip more.
+   */
+  exportColumnar(file: string, options?: { state?: RegTreeState, pageRows?: number }): { rows: number, bytes: number } | null
+
+  /**
+   * Close the key at the end of a `using` block.
+   */
+  [Symbol.dispose](): void
+
+  /**
+   * Hand the key over to another worker thread. Pending buffered writes are flushed
+   * and the key is left closed; pass the token to RegKey.receive in the other thread.
+   * 
+   * @returns A token that can be posted to another thread.
+   */
+  transfer(): number
+
   /**
    * Close the registry key.
-   * The key will be automatically closed when the Javascript object is garbage collected.
+   * The key will be automatically closed when the Javascript object is garbage collected,
+   * or when the thread that opened it exits.
    */
   close(): void
 
@@ -184,6 +574,12 @@ export declare class RegKey {
    */
   deleteTree(subKey?: string): boolean
 
+  /**
+   * Delete subkeys and values of the current key without blocking, honoring filters.
+   * Keys holding excluded values or subkeys are kept.
+   */
+  deleteTreeAsync(options?: RegTreeOptions): Promise<RegTreeResult>
+
   /**
    * Open the subkey of the given name.
    * If failed, the function will return null.
@@ -194,6 +590,12 @@ export declare class RegKey {
    */
   openSubKey(name: string, access?: RegKeyAccess | RegKeyAccess[]): RegKey | null
 
+  /**
+   * Like openSubKey, but returns undefined instead of throwing when the subkey cannot be opened.
+   * The status is left in lastStatus.
+   */
+  tryOpenSubKey(name: string, access?: RegKeyAccess | RegKeyAccess[]): RegKey | undefined
+
   /**
    * Create the subkey of the given name.
    * If failed, the function will return null.
@@ -227,6 +629,22 @@ export declare class RegKey {
    */
   hasSubKey(name: string): boolean
 
+  /**
+   * Search the key and its subkeys for a string, ignoring case.
+   * The subtree is walked on native worker threads and hits are streamed back in no particular order.
+   * Keys that cannot be opened are skipped.
+   * 
+   * @param pattern - The string to look for. An empty string matches everything.
+   * @param options - Where to look and how deep.
+   * @returns An async iterable of hits.
+   * 
+   * @example
+   * for await (const hit of hklm.openSubKey('Software').search('notepad.exe')) {
+   *   console.log(hit.path, hit.value)
+   * }
+   */
+  search(pattern: string, options?: RegSearchOptions): RegSearchResults
+
   /**
    * Get a RegValue object with the given name.
    * 
@@ -253,6 +671,41 @@ export declare class RegKey {
   newValue(name: string,
            val?: string | string[] | number | bigint | Buffer,
            type?: RegValueType): RegValue | null
+
+  /**
+   * Get the value of the given name, decoded by its type:
+   * a string for REG_SZ and REG_EXPAND_SZ, an array for REG_MULTI_SZ,
+   * a number for REG_DWORD and REG_DWORD_BIG_ENDIAN, a bigint for REG_QWORD and a Buffer otherwise.
+   * Data that does not fit its type (e.g. a REG_DWORD of 3 bytes) is returned as a Buffer.
+   * 
+   * @param name - The name of the value.
+   * @throws {RegKeyError} if failed.
+   */
+  getValue(name: string): string | string[] | number | bigint | Buffer
+
+  /**
+   * Like getValue, but returns undefined instead of throwing when the value cannot be read.
+   * The status is left in lastStatus. Probing for optional values this way does not build an error.
+   */
+  tryGetValue(name: string): string | string[] | number | bigint | Buffer | undefined
+
+  /** Like getBinaryValue, but returns undefined instead of throwing. */
+  tryGetBinaryValue(name: string, options?: RegBinaryReadOptions): Buffer | undefined
+
+  /** Like getStringValue, but returns undefined instead of throwing. */
+  tryGetStringValue(name: string): string | undefined
+
+  /** Like getExpandedValue, but returns undefined instead of throwing. */
+  tryGetExpandedValue(name: string, env?: Record<string, string>): string | undefined
+
+  /** Like getMultiStringValue, but returns undefined instead of throwing. */
+  tryGetMultiStringValue(name: string): string[] | undefined
+
+  /** Like getDwordValue, but returns undefined instead of throwing. */
+  tryGetDwordValue(name: string): number | undefined
+
+  /** Like getQwordValue, but returns undefined instead of throwing. */
+  tryGetQwordValue(name: string): bigint | undefined
            
   /**
    * Get the binary value of the given name.
@@ -261,7 +714,7 @@ export declare class RegKey {
    * @returns The binary value in a buffer.
    * @throws {RegKeyError} if failed.
    */
-  getBinaryValue(name: string): Buffer
+  getBinaryValue(name: string, options?: RegBinaryReadOptions): Buffer
 
   /**
    * Get the string value of the given name.
@@ -273,6 +726,19 @@ export declare class RegKey {
    */
   getStringValue(name: string): string
 
+  /**
+   * Get the string value with the specified name, expanding environment variables (%NAME%)
+   * if it is of type REG_EXPAND_SZ, the way ExpandEnvironmentStrings does.
+   * Variable names are matched ignoring case, and unknown ones are kept as they are.
+   * The target value type must be REG_SZ or REG_EXPAND_SZ.
+   * 
+   * @param name - The name of the value.
+   * @param env - Variables that override the environment of the process.
+   * @returns The expanded string value.
+   * @throws {RegKeyError} if failed.
+   */
+  getExpandedValue(name: string, env?: Record<string, string>): string
+
   /**
    * Get the multi-string value of the given name.
    * The target value type must be REG_MULTI_SZ.
@@ -285,7 +751,7 @@ export declare class RegKey {
 
   /**
    * Get the DWORD value of the given name.
-   * The target value type must be REG_DWORD or REG_DWORD_LITTLE_ENDIAN.
+   * The target value type must be REG_DWORD, REG_DWORD_LITTLE_ENDIAN or REG_DWORD_BIG_ENDIAN.
    * 
    * @param name - The name of the value.
    * @returns A number equaling to the DWORD value.
@@ -327,16 +793,28 @@ export declare class RegKey {
    */
   getValueNames(): string[]
 
+  /**
+   * Set the value of the given name, encoded for the given type.
+   * Buffers are written as they are whatever the type.
+   * 
+   * @param name - The name of the value.
+   * @param val - The value. REG_MULTI_SZ arrays may not contain empty strings.
+   * @param type - The type of the value.
+   * @returns True if the value is set successfully.
+   * @throws {TypeError} if the value does not match the type.
+   * @throws {RegKeyError} if failed.
+   */
+  setValue(name: string, val: string | string[] | number | bigint | Buffer, type: RegValueType): boolean
+
   /**
    * Set the binary value of the given name.
    * 
    * @param name - The name of the value.
    * @param val - The value.
-   * @param type - The type of the value.
-   *               If not specified, the type will be REG_BINARY.
+   * @param options - The type of the value, REG_BINARY if not specified, or write options.
    * @returns True if the value is set successfully.
    */
-  setBinaryValue(name: string, val: Buffer): boolean
+  setBinaryValue(name: string, val: Buffer, options?: RegValueType | RegBinaryWriteOptions): boolean
 
   /**
    * Set the string value of the given name.
@@ -389,6 +867,36 @@ export declare class RegKey {
    * @returns True if the value is deleted successfully.
    */
   deleteValue(name: string): boolean
+
+  /**
+   * Rename a value. The data is moved natively, without being decoded.
+   * 
+   * @param from - The current name of the value.
+   * @param to - The new name of the value.
+   * @param overwrite - Replace a value named `to`. Defaults to false.
+   * @returns True if the value is moved successfully.
+   * @throws {RegKeyError} if failed, e.g. `to` exists and overwrite is false.
+   */
+  moveValue(from: string, to: string, overwrite?: boolean): boolean
+
+  /**
+   * Read a binary value as a stream, one chunk at a time.
+   * Values written by createValueWriteStream are reassembled; other values are read in one piece.
+   * 
+   * @param name - The name of the value.
+   * @param options - Options passed to the Readable constructor.
+   */
+  createValueReadStream(name: string, options?: { highWaterMark?: number }): Readable
+
+  /**
+   * Write a binary value from a stream. Payloads larger than one chunk are stored across
+   * values named `name~<generation>.<index>`, with a manifest stored under `name`.
+   * The manifest is written last, so readers see either the old or the new data.
+   * 
+   * @param name - The name of the value.
+   * @param options - chunkSize defaults to 262144 bytes.
+   */
+  createValueWriteStream(name: string, options?: { chunkSize?: number, highWaterMark?: number }): Writable
 }
 
 /**
@@ -502,11 +1010,12 @@ export declare class RegKeyError extends Error {
    * @param key - The RegKey object.
    * @param value - The name of the value.
    * @param lastError - The last error message. Call RegKey.getLastError() to get it.
+   *                    Errors thrown by the addon pass the status code instead.
    */
   constructor(message: string,
               key: RegKey,
               value: string,
-              lastError: string)
+              lastError: string | number)
 
   /**
    * The RegKey object.
@@ -519,9 +1028,14 @@ export declare class RegKeyError extends Error {
   value: string
 
   /**
-   * The last error message.
+   * The status code of the failed call, for errors thrown by the addon.
+   */
+  status?: number
+
+  /**
+   * The last error message, formatted on first access.
    */
-  lastError: string
+  readonly lastError: string
 }
 
 /**
@@ -545,6 +1059,185 @@ export declare function throwRegKeyError(message: string,
  */
 export declare function disableRegKeyErrors(disabled?: boolean): void
 
+/**
+ * Set the backend used by RegKey objects created without an explicit backend.
+ * The predefined keys (hkcu, hklm...) keep the backend that was the default when the module was loaded.
+ *
+ * @param name - The name of the backend.
+ * @throws {TypeError} if the backend is unknown or unavailable on this platform.
+ */
+export declare function setDefaultBackend(name: RegBackendName): void
+
+/**
+ * Get the backend used by RegKey objects created without an explicit backend.
+ * It is 'win32' on Windows and 'memory' elsewhere unless changed with setDefaultBackend().
+ */
+export declare function getDefaultBackend(): RegBackendName
+
+/**
+ * Remove every key and value from the in-memory registry.
+ * Keys that are still open fail with ERROR_KEY_DELETED afterwards.
+ */
+export declare function clearMemoryRegistry(): void
+
+export declare interface RegHiveOptions {
+  /**
+   * Open the hive without writing to it. Required for hives that were not cleanly closed.
+   */
+  readOnly?: boolean
+  /**
+   * Create an empty hive when the file does not exist.
+   */
+  create?: boolean
+}
+
+/**
+ * Mount a registry hive file (such as NTUSER.DAT or SOFTWARE) as the backend `name`.
+ * Every base key of the backend opens the root key of the hive.
+ * Changes are written back in place by key.flush() and unloadHive().
+ *
+ * @throws {TypeError} if the name is taken.
+ * @throws {Error} with a `status` property if the file cannot be loaded.
+ */
+export declare function loadHive(name: string, file: string, options?: RegHiveOptions): void
+
+/**
+ * Write the changes of a hive back to its file and unmount it.
+ * Returns false when no hive is mounted under `name`.
+ */
+export declare function unloadHive(name: string): boolean
+
+/**
+ * Read values from many keys at once on native worker threads.
+ * Keys sharing a parent are opened relative to it, so each parent is opened only once.
+ * Failures are reported per key and per value rather than thrown.
+ *
+ * @param requests - Key paths, or key paths with the values to read.
+ * @returns One result per request, in request order.
+ */
+export declare function readMany(requests: (string | RegReadRequest)[], options?: RegReadOptions): Promise<RegReadResult[]>
+
+/**
+ * The synchronous version of readMany().
+ */
+export declare function readManySync(requests: (string | RegReadRequest)[], options?: RegReadOptions): RegReadResult[]
+
+export declare interface RegHostQueryOptions {
+  /** Hosts queried at the same time. Defaults to 32. */
+  concurrency?: number
+  /** Milliseconds a host may take to connect, open the key and read; 0 for no limit. Defaults to 10000. */
+  timeoutMs?: number
+  /** The backend to read from. Defaults to the default backend. */
+  backend?: RegBackendName
+  /** Extra access rights (e.g. RegKeyAccess.ia32) used to open the key. */
+  access?: RegKeyAccess | number
+}
+
+export declare interface RegHostResult {
+  host: string
+  /** The Win32 status of connecting and opening the key; 0 on success, 1460 (ERROR_TIMEOUT) past the deadline. */
+  status: number
+  /** Milliseconds spent on the host. */
+  elapsed: number
+  /** One entry per requested value, in request order. */
+  values: RegReadValue[]
+}
+
+export declare interface RegHostResults extends AsyncIterableIterator<RegHostResult> {
+  /**
+   * Skip the hosts not started yet and end the iteration.
+   */
+  cancel(): Promise<IteratorResult<RegHostResult>>
+
+  /**
+   * Wait for every host and collect the results.
+   */
+  toArray(): Promise<RegHostResult[]>
+}
+
+/**
+ * Read the same key from many remote hosts in parallel.
+ * Hosts are served by threads of their own, and a host that passes its deadline
+ * is reported with ERROR_TIMEOUT without holding up the others.
+ * 
+ * @param hosts - The names of the hosts.
+ * @param path - The path of the key on each host, e.g. 'HKLM\\Software\\MyApp'.
+ * @param values - The names of the values to read; every value of the key if omitted.
+ * @returns An async iterable yielding each result as its host completes.
+ */
+export declare function queryHosts(hosts: string[], path: string, values?: string | string[], options?: RegHostQueryOptions): RegHostResults
+
+export declare interface RegQueryOptions {
+  /** The backend to query. Defaults to the default backend. */
+  backend?: RegBackendName
+}
+
+export declare interface RegQueryMatch {
+  /** The path of the matched key, or of the key holding the matched value. Names matched exactly keep the spelling of the query. */
+  path: string
+  /** Set when a value matched; '' for the default value. */
+  value?: string
+  /** Set when a value matched. */
+  type?: RegValueType
+  /**
+   * Set when a value matched: a string for REG_SZ and REG_EXPAND_SZ, an array for REG_MULTI_SZ,
+   * a number for REG_DWORD, a bigint for REG_QWORD and a Buffer otherwise.
+   */
+  data?: string | string[] | number | bigint | Buffer
+}
+
+export declare interface RegQueryResults extends AsyncIterableIterator<RegQueryMatch> {
+  /**
+   * Stop the query and end the iteration.
+   */
+  cancel(): Promise<IteratorResult<RegQueryMatch>>
+
+  /**
+   * Wait for the query to complete and collect the matches.
+   */
+  toArray(): Promise<RegQueryMatch[]>
+}
+
+/**
+ * Find keys and values by a path query such as 'HKLM\\Software\\*\\Uninstall\\*[DisplayName ~ "Java*"]\\DisplayVersion'.
+ * Steps are separated by '/' or '\\' and take '*' and '?' wildcards; '**' spans any number of levels.
+ * A step may be followed by a type (e.g. 'Version:REG_SZ') and by predicates on the values of the key
+ * (e.g. '[Size > 1000]', '[Name = "x"]', '[Name ~ "a*"]' or just '[Name]'). The query is evaluated
+ * natively on worker threads, so matches arrive in no particular order.
+ *
+ * @param expression - The query.
+ * @returns An async iterable yielding the matches.
+ * @throws TypeError if the query is not valid, with the offset of the error in the message.
+ */
+export declare function query(expression: string, options?: RegQueryOptions): RegQueryResults
+
+/**
+ * Compile a schema of typed values, to be read from keys in a single native call.
+ * 
+ * @param spec - The value type of each field, e.g. { Port: 'REG_DWORD', Hosts: 'REG_MULTI_SZ', defaults: { Port: 80 } }.
+ * @returns The compiled schema.
+ * @throws {TypeError} if a field has an unknown type.
+ */
+export declare function compileSchema(spec: RegSchemaSpec): RegSchema
+
+/**
+ * Read a subtree through a cache file.
+ * The cache is loaded in one read and checked against the last write time of every key;
+ * only keys that changed since it was saved are read from the registry.
+ * The updated tree is then saved again on a worker thread.
+ * 
+ * @param path - The full path of the root key, e.g. 'HKCU\\Software\\MyApp'.
+ * @param cacheFile - The cache file. It is created when missing and ignored when corrupt or saved for another key.
+ * @returns The tree, or null if the key cannot be read and errors are disabled.
+ */
+export declare function cachedTree(path: string, cacheFile: string): RegCachedTree | null
+
+/**
+ * Flush the buffered writes of every key with write-back enabled.
+ * It is called when the process exits.
+ */
+export declare function flushWriteBacks(): void
+
 /**
  * A RegKey object related to HKEY_CLASS_ROOT.
  */
@@ -584,3 +1277,322 @@ export declare const hkpt: RegKey
  * A RegKey object related to HKEY_PERFORMANCE_NLSTEXT.
  */
 export declare const hkpn: RegKey
+
+export declare interface RegBinaryWriteOptions {
+  /** Defaults to REG_BINARY. */
+  type?: RegValueType
+  /**
+   * Store the payload compressed when it is at least `threshold` bytes and gets smaller.
+   * Compressed values start with a recognizable header and are read back with getBinaryValue(name, { decompress: true }).
+   * They are not transparent: values(), RegValue and other programs see the compressed bytes.
+   */
+  compress?: boolean
+  /** Smallest payload compressed, in bytes. Defaults to 65536. */
+  threshold?: number
+}
+
+export declare interface RegBinaryReadOptions {
+  /**
+   * Decompress values written with `compress`. Other values are returned as they are, including plain
+   * data that starts with the compressed header but does not decode.
+   */
+  decompress?: boolean
+}
+
+export declare interface RegCopyValuesOptions {
+  /** Values to copy. Defaults to every value of the source key; missing names are skipped. */
+  names?: string[]
+  /**
+   * Name patterns with '*' and '?' wildcards, or a function called with the name and type of each value.
+   * Values that do not match are skipped.
+   */
+  filter?: string | string[] | ((name: string, type: RegValueType) => boolean)
+  /** Replace values that exist in the destination. Defaults to true. */
+  overwrite?: boolean
+}
+
+/**
+ * Copy values from one key to another in a single native call.
+ * The data is copied as it is stored, without being decoded.
+ * 
+ * @returns The number of values copied.
+ * @throws {RegKeyError} if a value cannot be read or written.
+ */
+export declare function copyValues(srcKey: RegKey, dstKey: RegKey, options?: RegCopyValuesOptions): number
+
+export declare interface RegConnectionPoolOptions {
+  /** Connections kept open per host, across its base keys. 0 disables pooling. Defaults to 4. */
+  maxPerHost?: number
+  /** Milliseconds an unused connection stays open. Defaults to 30000. */
+  idleTimeout?: number
+  /** Connections unused for this many milliseconds are checked before they are reused. Defaults to 5000. */
+  healthCheckInterval?: number
+}
+
+export declare interface RegConnectionPoolStats {
+  /** Connections made to remote hosts. */
+  connects: number
+  /** Keys served by an open connection. */
+  reuses: number
+  /** Connections closed after idleTimeout. */
+  expired: number
+  /** Connections dropped after a failed health check or a connection error. */
+  unhealthy: number
+  open: number
+  /** Open connections in use. */
+  busy: number
+}
+
+/**
+ * Remote registry connections, shared by the keys opened on the same host and base key.
+ */
+export declare namespace connectionPool {
+  /**
+   * Change the pool options. Options left out keep their values.
+   *
+   * @returns The options now in effect.
+   */
+  function configure(options?: RegConnectionPoolOptions): Required<RegConnectionPoolOptions>
+
+  function stats(): RegConnectionPoolStats
+
+  /**
+   * Close every unused connection.
+   */
+  function clear(): void
+}
+
+export declare interface RegHandleOptions {
+  /**
+   * Key handles kept open in the process. Past it, the least recently used keys of the
+   * calling thread are closed and reopened by path on their next use. 0, the default, sets no limit.
+   * Root keys, remote keys and keys with write-back enabled are never closed.
+   */
+  limit?: number
+  /** Record where keys of the calling thread are created, for report(). Defaults to false. */
+  captureStacks?: boolean
+}
+
+export declare interface RegHandleStats {
+  /** Handles counted against the limit. */
+  open: number
+  peak: number
+  /** Handles closed to stay within the limit. */
+  evictions: number
+  /** Closed handles opened again on use. */
+  reopens: number
+  limit: number
+}
+
+export declare interface RegHandleReportEntry {
+  path: string
+  backend: string
+  /** False when the handle was closed to stay within the limit. */
+  open: boolean
+  /** Where the key was created, when captureStacks was enabled at the time. */
+  stack: string | null
+}
+
+/**
+ * Handles held by RegKey objects.
+ */
+export declare namespace handles {
+  /**
+   * Change the handle options. Options left out keep their values.
+   *
+   * @returns The options now in effect.
+   */
+  function configure(options?: RegHandleOptions): Required<RegHandleOptions>
+
+  function stats(): RegHandleStats
+
+  /**
+   * List the keys of the calling thread that have not been closed.
+   */
+  function report(): RegHandleReportEntry[]
+}
+
+export declare interface RegMarshalStats {
+  /** Strings created for results, cached names excluded. */
+  strings: number
+  /** Strings stored one byte per character. */
+  latin1Strings: number
+  /** Strings left in native memory instead of being copied. */
+  externalStrings: number
+  /** Names served from the cache. */
+  namesReused: number
+  /** Names created and added to the cache. */
+  namesCreated: number
+  arrays: number
+  /** Engine calls spent on arrays: one to create each, one per element. */
+  arrayCalls: number
+}
+
+/**
+ * Conversion of results to JavaScript values. The counters cover every thread of the process.
+ */
+export declare namespace marshal {
+  function stats(): RegMarshalStats
+  function resetStats(): void
+  /** Whether large strings can stay in native memory. Needs a Node.js with Node-API 10; otherwise `externalStrings` stays 0. */
+  const externalStrings: boolean
+  /** Whether cached names are created as property keys. Needs a Node.js with Node-API 10; otherwise they are plain strings. */
+  const propertyKeys: boolean
+}
+
+/**
+ * Operation tracing.
+ * Every registry call made by the addon is recorded into a per-thread ring buffer
+ * while tracing is enabled. Older events are overwritten when a ring is full.
+ */
+export declare namespace trace {
+  /**
+   * Start recording registry calls. Previously recorded events are dropped.
+   *
+   * @param capacity - The number of events kept per thread. Defaults to 4096.
+   */
+  function enable(capacity?: number): void
+
+  /**
+   * Stop recording registry calls. Recorded events are kept until the next enable() or clear().
+   */
+  function disable(): void
+
+  /**
+   * Drop all recorded events.
+   */
+  function clear(): void
+
+  /**
+   * @returns True if tracing is enabled.
+   */
+  function isEnabled(): boolean
+
+  /**
+   * Export the recorded events in Chrome trace-event format.
+   * The result can be opened in Perfetto or chrome://tracing.
+   * The args of each event hold the status, the key handle, the path of the key and the subkey
+   * or value name the call was given, cut at 46 characters and empty for calls that take none
+   * (enumerations, QueryInfoKey). The path is empty for keys opened before tracing was enabled.
+   *
+   * @param file - If specified, the JSON is also written to this file.
+   * @returns The trace JSON.
+   */
+  function dump(file?: string): string
+}
+
+export declare interface RegRecordingStats {
+  /** Backend calls recorded. */
+  calls: number
+  /** Size of the recording in bytes. */
+  bytes: number
+}
+
+/**
+ * Workload recording.
+ * Keys opened while recording log every backend call (operation, path, value name, type, size,
+ * status and timing) into a compact binary file, which replay() re-executes. Value data is not recorded.
+ */
+export declare namespace recorder {
+  /**
+   * Start recording into a file. Only keys opened afterwards are recorded.
+   *
+   * @returns False if a recording is already running or the file cannot be created.
+   */
+  function start(file: string): boolean
+
+  /**
+   * Stop recording and close the file.
+   *
+   * @returns Null if no recording was running.
+   */
+  function stop(): RegRecordingStats | null
+
+  function isRecording(): boolean
+}
+
+export declare interface RegReplayOptions {
+  /** The backend to replay against. Defaults to the default backend. */
+  backend?: 'win32' | 'memory'
+  /** Multiple of the recorded pace, e.g. 1 for the recorded timing. 0, the default, replays as fast as possible. */
+  speed?: number
+  /**
+   * Create the keys and values the recording found before replaying, so a workload
+   * recorded on another machine runs against an empty registry. Defaults to false.
+   */
+  seed?: boolean
+}
+
+/** Latencies in microseconds. */
+export declare interface RegLatencySummary {
+  calls: number
+  mean: number
+  p50: number
+  p90: number
+  p99: number
+  p999: number
+  max: number
+}
+
+export declare interface RegReplayReport {
+  calls: number
+  /** Calls whose status differs from the recorded one. */
+  mismatches: number
+  /** Milliseconds. */
+  elapsed: number
+  /** Calls per second. */
+  throughput: number
+  latency: RegLatencySummary
+  /** The latencies in the recording, for comparison. */
+  recordedLatency: RegLatencySummary
+  /** Latencies by operation, e.g. QueryValue. */
+  ops: Record<string, RegLatencySummary>
+}
+
+/**
+ * Re-execute a recording made with recorder.start() on a worker thread.
+ * Values are written with zeros of the recorded size.
+ *
+ * @throws if the file is missing or not a valid recording.
+ */
+export declare function replay(file: string, options?: RegReplayOptions): Promise<RegReplayReport>
+
+export declare type RegColumn = 'path' | 'name' | 'type' | 'data'
+
+export declare interface RegColumnScanOptions {
+  /** The path or name column: rows whose path or value name starts with it, ignoring case. */
+  prefix?: string
+  /** The type column: rows of this type. */
+  type?: RegValueType
+  /** The smallest and largest code, type or data size to return. */
+  min?: number
+  max?: number
+}
+
+export declare interface RegColumnScanResult {
+  file: string
+  /** Set when the file is missing or corrupt; no other field but file is then set. */
+  error?: string
+  /** The backend and path of the dumped key. */
+  source?: string
+  rowCount?: number
+  /** The matching rows, in ascending order. Rows are numbered alike in every column of a dump. */
+  rows?: Uint32Array
+  /** The path or name column: the code of each row, an index into dictionary. */
+  codes?: Uint32Array
+  /** The paths or names of the dump, relative to its source and sorted ignoring case. */
+  dictionary?: string[]
+  /** The type column: the type of each row, as a number. */
+  types?: Uint32Array
+  /** The data column: the size of each row, and their data back to back. */
+  sizes?: Uint32Array
+  data?: Buffer
+}
+
+/**
+ * Scan one column of many dumps written by RegKey.exportColumnar.
+ * Only the pages of that column whose range of values overlaps the query are read.
+ * 
+ * @returns One result per file, in the same order.
+ */
+export declare function scanColumnar(files: string[], column: RegColumn, options?: RegColumnScanOptions): RegColumnScanResult[]
@@ -1,9 +1,11 @@
 const RegKey = require('./lib/RegKey')
 const RegValue = require('./lib/RegValue')
+const RegCachedTree = require('./lib/RegCachedTree')
 const Error = require('./lib/Error')
 
 module.exports = {
   ...RegKey,
   ...RegValue,
+  ...RegCachedTree,
   ...Error
 }
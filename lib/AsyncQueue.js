@@ -0,0 +1,75 @@
+// An async iterable fed from native callbacks.
+// Items pushed before anyone awaits them are buffered; `onReturn` runs when the consumer
+// stops early (e.g. `break` in `for await`) so the native side can cancel its work.
+class AsyncQueue {
+  constructor(onReturn) {
+    this._items = []
+    this._waiters = []
+    this._ended = false
+    this._error = null
+    this._onReturn = onReturn
+  }
+
+  push(item) {
+    if (this._ended) {
+      return
+    }
+    const waiter = this._waiters.shift()
+    if (waiter) {
+      waiter.resolve({ value: item, done: false })
+    } else {
+      this._items.push(item)
+    }
+  }
+
+  end(error) {
+    if (this._ended) {
+      return
+    }
+    this._ended = true
+    this._error = error || null
+    for (const waiter of this._waiters.splice(0)) {
+      if (this._error) {
+        waiter.reject(this._error)
+      } else {
+        waiter.resolve({ value: undefined, done: true })
+      }
+    }
+  }
+
+  next() {
+    if (this._items.length > 0) {
+      return Promise.resolve({ value: this._items.shift(), done: false })
+    }
+    if (this._ended) {
+      const error = this._error
+      this._error = null
+      return error ? Promise.reject(error) : Promise.resolve({ value: undefined, done: true })
+    }
+    return new Promise((resolve, reject) => this._waiters.push({ resolve, reject }))
+  }
+
+  return() {
+    if (!this._ended && this._onReturn) {
+      this._onReturn()
+    }
+    this._items = []
+    this.end()
+    return Promise.resolve({ value: undefined, done: true })
+  }
+
+  // Collect everything into an array
+  async toArray() {
+    const items = []
+    for await (const item of this) {
+      items.push(item)
+    }
+    return items
+  }
+
+  [Symbol.asyncIterator]() {
+    return this
+  }
+}
+
+module.exports = { AsyncQueue }
@@ -5,7 +5,25 @@ class RegKeyError extends Error {
     this.key = key
     this.path = key.path
     this.value = value
-    this.lastError = lastError
+    // The native side passes the status code; its message is formatted on first access.
+    // An own enumerable accessor keeps lastError listed, serialized and assignable like the other fields.
+    if (typeof lastError === 'number') {
+      this.status = lastError
+      lastError = undefined
+    }
+    Object.defineProperty(this, 'lastError', {
+      enumerable: true,
+      configurable: true,
+      get() {
+        if (lastError === undefined && this.status !== undefined) {
+          lastError = this.key.__translateError__(this.status)
+        }
+        return lastError
+      },
+      set(message) {
+        lastError = message
+      }
+    })
 
     Error.captureStackTrace(this, RegKeyError)
   }
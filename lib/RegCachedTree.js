@@ -0,0 +1,52 @@
+const util = require('util')
+
+// A registry subtree as read by regkey.cachedTree, answered from memory
+class RegCachedTree {
+  constructor(path, result, readState) {
+    this.path = path
+    this.fromCache = result.fromCache
+    this.changes = result.changes
+    this.saved = result.saved
+    this.state = result.state
+    this.readState = readState
+  }
+
+  // The cached key at a path relative to the root, or null
+  key(subPath) {
+    return this.readState(this.state, subPath || '')
+  }
+
+  has(subPath) {
+    return this.key(subPath) !== null
+  }
+
+  subKeys(subPath) {
+    const key = this.key(subPath)
+    return key ? key.subKeys : []
+  }
+
+  values(subPath) {
+    const key = this.key(subPath)
+    return key ? key.values : []
+  }
+
+  getValue(subPath, name) {
+    const lowerName = String(name).toLowerCase()
+    const value = this.values(subPath).find(v => v.name.toLowerCase() === lowerName)
+    return value ? value.value : undefined
+  }
+
+  [util.inspect.custom](depth, options) {
+    options.depth = depth
+    return util.inspect({
+      path: this.path,
+      fromCache: this.fromCache,
+      keys: this.state.keys,
+      changes: this.changes.length
+    }, options)
+  }
+}
+
+module.exports = {
+  RegCachedTree
+}
@@ -1,15 +1,33 @@
+const fs = require('fs')
 const path = require("path")
 const util = require('util')
 
-const regkey = process.platform == 'win32' ?
-  require('node-gyp-build')(path.resolve(__dirname, '..')) : 
-  { RegKey: () => { } }
+// Prebuilt binaries are only shipped for Windows.
+// Elsewhere the addon is used when it has been built locally (it then defaults to the memory backend).
+function loadBinding() {
+  try {
+    return require('node-gyp-build')(path.resolve(__dirname, '..'))
+  } catch (e) {
+    if (process.platform == 'win32') {
+      throw e
+    }
+    return { RegKey: function RegKey() { } }
+  }
+}
+
+const regkey = loadBinding()
 const RegKey = regkey.RegKey
 const { throwRegKeyError } = require("./Error")
 const { RegValue } = require("./RegValue")
+const { AsyncQueue } = require("./AsyncQueue")
+const { RegCachedTree } = require("./RegCachedTree")
+const { RegValueReadStream, RegValueWriteStream } = require("./RegValueStream")
 
 // Provide access to throw a RegKeyError for native code
 RegKey.prototype.__throwRegKeyError__ = throwRegKeyError
+// Native errors carry a status code, formatted when their lastError is read
+RegKey.prototype.__translateError__ = regkey.__translateError__ ||
+  (status => `An unknown error occurred. (code ${status})`)
 
 // Inspect properties
 RegKey.prototype[util.inspect.custom] = function (depth, options) {
@@ -23,6 +41,13 @@ RegKey.prototype[util.inspect.custom] = function (depth, options) {
   }, options)
 }
 
+// Close the key at the end of a `using` block
+if (Symbol.dispose) {
+  RegKey.prototype[Symbol.dispose] = function () {
+    this.close()
+  }
+}
+
 RegKey.prototype.value = function value(name) {
   return new RegValue(this, name)
 }
@@ -42,4 +67,193 @@ RegKey.prototype.newValue = function newValue(name, val, type) {
   return null
 }
 
+// Large payloads are split across chunk values, see RegValueStream.js
+RegKey.prototype.createValueReadStream = function createValueReadStream(name, options) {
+  return new RegValueReadStream(this, name, options)
+}
+
+RegKey.prototype.createValueWriteStream = function createValueWriteStream(name, options) {
+  return new RegValueWriteStream(this, name, options)
+}
+
+// Stream search hits as they are found, the walk runs on native worker threads
+RegKey.prototype.search = function search(pattern, options) {
+  let cancel = null
+  const hits = new AsyncQueue(() => cancel && cancel())
+  cancel = this.__search__(String(pattern), options || {}, (batch, status) => {
+    if (batch) {
+      batch.forEach(hit => hits.push(hit))
+    } else if (status !== 0 && status !== 1223) { // ERROR_CANCELLED
+      // A worker failed, so hits may be missing
+      try {
+        throwRegKeyError('Search failed.', this, undefined, status)
+        hits.end()
+      } catch (e) {
+        hits.end(e)
+      }
+    } else {
+      hits.end()
+    }
+  })
+  if (!cancel) {
+    // The key could not be opened and errors are disabled
+    hits.end()
+  }
+  hits.cancel = () => hits.return()
+  return hits
+}
+
+// Run a native tree operation ('copy', 'move' or 'delete') and settle when the writer is done
+function runTreeOp(key, kind, source, options) {
+  options = options || {}
+  const nativeOptions = { ...options }
+  if (options.resume && !Array.isArray(options.resume)) {
+    nativeOptions.resume = options.resume.completed || []
+  }
+
+  return new Promise((resolve, reject) => {
+    let cancel = null
+    const onAbort = () => cancel && cancel()
+    cancel = key.__treeOp__(kind, source, nativeOptions, (event, result) => {
+      if (event === 'progress') {
+        if (options.onProgress) {
+          options.onProgress(result)
+        }
+        return
+      }
+      if (options.signal) {
+        options.signal.removeEventListener('abort', onAbort)
+      }
+      result.cancelled = result.status === 1223 // ERROR_CANCELLED
+      if (result.status !== 0 && !result.cancelled) {
+        try {
+          throwRegKeyError(`Failed to ${kind} tree.`, key, result.failedPath, result.error)
+        } catch (e) {
+          e.result = result
+          return reject(e)
+        }
+      }
+      resolve(result)
+    })
+    if (!cancel) {
+      // The keys could not be opened and errors are disabled
+      return resolve(null)
+    }
+    if (options.signal) {
+      if (options.signal.aborted) {
+        cancel()
+      } else {
+        options.signal.addEventListener('abort', onAbort)
+      }
+    }
+  })
+}
+
+RegKey.prototype.copyTreeAsync = function copyTreeAsync(source, options) {
+  return runTreeOp(this, 'copy', source, options)
+}
+
+RegKey.prototype.moveTreeAsync = function moveTreeAsync(source, options) {
+  return runTreeOp(this, 'move', source, options)
+}
+
+RegKey.prototype.deleteTreeAsync = function deleteTreeAsync(options) {
+  return runTreeOp(this, 'delete', null, options)
+}
+
+// Copy values between keys in a single native call, the data never reaches JavaScript
+regkey.copyValues = function copyValues(srcKey, dstKey, options) {
+  return dstKey.__copyValues__(srcKey, options || {})
+}
+
+// Stream the results of reading a key from many hosts as each host completes
+if (regkey.__queryHosts__) {
+  const queryHosts = regkey.__queryHosts__
+  regkey.queryHosts = function (hosts, path, values, options) {
+    let cancel = null
+    const results = new AsyncQueue(() => cancel && cancel())
+    cancel = queryHosts(hosts, String(path), values, options || {}, (batch) => {
+      if (batch) {
+        batch.forEach(result => results.push(result))
+      } else {
+        results.end()
+      }
+    })
+    results.cancel = () => results.return()
+    return results
+  }
+}
+
+// Stream the matches of a path query, evaluated on native worker threads
+if (regkey.__query__) {
+  const query = regkey.__query__
+  regkey.query = function (expression, options) {
+    let cancel = null
+    const matches = new AsyncQueue(() => cancel && cancel())
+    cancel = query(String(expression), options || {}, (batch, status) => {
+      if (batch) {
+        batch.forEach(match => matches.push(match))
+      } else if (status !== 0 && status !== 1223) { // ERROR_CANCELLED
+        // A worker failed, so matches may be missing
+        const error = new Error('Query failed.')
+        error.status = status
+        matches.end(error)
+      } else {
+        matches.end()
+      }
+    })
+    if (!cancel) {
+      // The fixed part of the path does not exist
+      matches.end()
+    }
+    matches.cancel = () => matches.return()
+    return matches
+  }
+}
+
+// A compiled schema reads all of its fields from a key in a single native call
+if (regkey.compileSchema) {
+  const compileSchema = regkey.compileSchema
+  regkey.compileSchema = function (spec) {
+    const schema = compileSchema(spec)
+    return {
+      fields: Object.keys(spec).filter(name => name !== 'defaults'),
+      read(key) {
+        return key.__readSchema__(schema)
+      }
+    }
+  }
+}
+
+// Load a subtree from a cache file, re-read the keys that changed since it was saved and save it again
+if (regkey.__readTreeState__) {
+  const readTreeState = regkey.__readTreeState__
+  regkey.cachedTree = function (path, cacheFile) {
+    const key = new RegKey(String(path), regkey.RegKeyAccess.Read)
+    try {
+      const result = key.__cachedTree__(String(cacheFile))
+      return result ? new RegCachedTree(key.path, result, readTreeState) : null
+    } finally {
+      key.close()
+    }
+  }
+}
+
+// Buffered writes must not be lost when the process exits normally
+if (regkey.flushWriteBacks) {
+  process.on('exit', regkey.flushWriteBacks)
+}
+
+// Write the Chrome trace JSON to a file when a path is given
+if (regkey.trace) {
+  const dumpTrace = regkey.trace.dump
+  regkey.trace.dump = function dump(file) {
+    const json = dumpTrace()
+    if (file) {
+      fs.writeFileSync(file, json)
+    }
+    return json
+  }
+}
+
 module.exports = regkey
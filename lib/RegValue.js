@@ -18,6 +18,31 @@ const RegValueType = {
   REG_NONE                        : 'REG_NONE'
 }
 
+// The type a value is stored as when none is given
+function inferValueType(val) {
+  switch (typeof val) {
+    case 'number':
+      if (Number.isInteger(val) && val >= 0 && val <= 0xFFFFFFFF) {
+        return RegValueType.REG_DWORD
+      } else if (Number.isInteger(val) && val >= 0) {
+        return RegValueType.REG_QWORD
+      }
+      return RegValueType.REG_SZ
+    case 'bigint':
+      return RegValueType.REG_QWORD
+    case 'string':
+      return RegValueType.REG_SZ
+    case 'object':
+      if (val instanceof Buffer) {
+        return RegValueType.REG_BINARY
+      }
+      if (Array.isArray(val)) {
+        return RegValueType.REG_MULTI_SZ
+      }
+  }
+  return null
+}
+
 class RegValue {
   constructor(key, name) {
     this.key = key
@@ -25,12 +50,18 @@ class RegValue {
   }
 
   get(resultType) {
+    if (!resultType) {
+      // Decoded natively by the type of the value
+      return this.key.getValue(this.name)
+    }
+
     const valueType = this.key.getValueType(this.name)
-    switch (resultType || valueType) {
+    switch (resultType) {
       case Number:
       case BigInt: {
         switch (valueType) {
           case RegValueType.REG_DWORD:
+          case RegValueType.REG_DWORD_BIG_ENDIAN:
             return resultType(this.key.getDwordValue(this.name))
           
           case RegValueType.REG_QWORD:
@@ -47,6 +78,7 @@ class RegValue {
       }
       
       case RegValueType.REG_DWORD:
+      case RegValueType.REG_DWORD_BIG_ENDIAN:
         return this.key.getDwordValue(this.name)
       case RegValueType.REG_QWORD:
         return this.key.getQwordValue(this.name)
@@ -64,46 +96,19 @@ class RegValue {
         return this.key.getBinaryValue(this.name)
       
       default:
-        if (resultType) {
-          throwRegKeyError('Invalid result type.', this.key, this.name, this.key.getLastError())
-          return null
-        } else {
-          return this.key.getBinaryValue(this.name)
-        }
+        throwRegKeyError('Invalid result type.', this.key, this.name, this.key.getLastError())
+        return null
     }
   }
 
   set(val, type) {
-    switch (typeof val) {
-      case 'number':
-        if (type === RegValueType.REG_DWORD || (Number.isInteger(val) && val >= 0 && val <= 0xFFFFFFFF)) {
-          return this.key.setDwordValue(this.name, val, type || RegValueType.REG_DWORD)
-        } else if (type === RegValueType.REG_QWORD || (Number.isInteger(val) && val >= 0)) {
-          return this.key.setQwordValue(this.name, val, type || RegValueType.REG_QWORD)
-        } else {
-          return this.key.setStringValue(this.name, val.toString(), type || RegValueType.REG_SZ)
-        }
-      case 'bigint':
-        if (type === RegValueType.REG_DWORD) {
-          return this.key.setDwordValue(this.name, Number(val))
-        } else if (type === RegValueType.REG_SZ || type === RegValueType.REG_EXPAND_SZ) {
-          return this.key.setStringValue(this.name, val.toString(), type)
-        } else {
-          return this.key.setQwordValue(this.name, val, type || RegValueType.REG_QWORD)
-        }
-      case 'string':
-        return this.key.setStringValue(this.name, val, type || RegValueType.REG_SZ)
-      case 'object':
-        if (val instanceof Buffer) {
-          return this.key.setBinaryValue(this.name, val, type || RegValueType.REG_BINARY)
-        }
-        if (Array.isArray(val)) {
-          return this.key.setMultiStringValue(this.name, val, type || RegValueType.REG_MULTI_SZ)
-        }
-      default:
-        throwRegKeyError('Invalid value type.', this.key, this.name, this.key.getLastError())
-        return false
+    type = type || inferValueType(val)
+    if (!type) {
+      throwRegKeyError('Invalid value type.', this.key, this.name, this.key.getLastError())
+      return false
     }
+    // Encoded natively for the type; Buffers are written as they are
+    return this.key.setValue(this.name, val, type)
   }
 
   get type() {
@@ -143,8 +148,7 @@ class RegValue {
       return false
     }
 
-    if (this.key.setBinaryValue(newName, this.data, this.type)) {
-      this.key.deleteValue(this.name)
+    if (this.key.moveValue(this.name, newName)) {
       this.name = newName
       return true
     }
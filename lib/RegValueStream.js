@@ -0,0 +1,191 @@
+const { Readable, Writable } = require('stream')
+
+// A value written by a stream is either stored as it is, when it fits in one chunk, or split
+// across chunk values named `${name}~${generation}.${index}` and described by a manifest
+// stored under the name itself:
+//   magic "RKST" | version | 3 reserved bytes | generation | chunk count | chunk size | total size (64-bit)
+// all little-endian. A rewrite uses the next generation and replaces the manifest last,
+// so readers never see a mix of old and new chunks.
+const MANIFEST_MAGIC = Buffer.from('RKST', 'latin1')
+const MANIFEST_VERSION = 1
+const MANIFEST_SIZE = 28
+const DEFAULT_CHUNK_SIZE = 256 * 1024
+
+function chunkName(name, generation, index) {
+  return `${name}~${generation}.${index}`
+}
+
+function readManifest(data) {
+  if (data.length !== MANIFEST_SIZE || !data.subarray(0, 4).equals(MANIFEST_MAGIC) ||
+      data[4] !== MANIFEST_VERSION) {
+    return null
+  }
+  return {
+    generation: data.readUInt32LE(8),
+    chunkCount: data.readUInt32LE(12),
+    chunkSize: data.readUInt32LE(16),
+    totalSize: Number(data.readBigUInt64LE(20))
+  }
+}
+
+function writeManifest(manifest) {
+  const data = Buffer.alloc(MANIFEST_SIZE)
+  MANIFEST_MAGIC.copy(data, 0)
+  data[4] = MANIFEST_VERSION
+  data.writeUInt32LE(manifest.generation, 8)
+  data.writeUInt32LE(manifest.chunkCount, 12)
+  data.writeUInt32LE(manifest.chunkSize, 16)
+  data.writeBigUInt64LE(BigInt(manifest.totalSize), 20)
+  return data
+}
+
+// The manifest of a chunked value, or null for plain and missing values
+function findManifest(key, name) {
+  const data = key.tryGetBinaryValue(name)
+  return data === undefined ? null : readManifest(data)
+}
+
+// Chunks already gone are not an error
+function deleteChunks(key, name, manifest) {
+  for (let i = 0; i < manifest.chunkCount; i++) {
+    const chunk = chunkName(name, manifest.generation, i)
+    if (key.hasValue(chunk)) {
+      key.deleteValue(chunk)
+    }
+  }
+}
+
+// Reads and writes may return null or false instead of throwing when RegKeyErrors are disabled
+function check(result, key, message) {
+  if (result === null || result === false) {
+    throw new Error(`${message} ${key.getLastError()}`)
+  }
+  return result
+}
+
+// Reads one chunk per _read call, so at most highWaterMark bytes plus a chunk are held
+class RegValueReadStream extends Readable {
+  constructor(key, name, options) {
+    super(options)
+    this.key = key
+    this.name = name
+    this._manifest = undefined
+    this._index = 0
+    this._bytes = 0
+  }
+
+  _read() {
+    try {
+      if (this._manifest === undefined) {
+        const data = check(this.key.getBinaryValue(this.name), this.key, 'Failed to read value.')
+        this._manifest = readManifest(data)
+        if (!this._manifest) {
+          this.push(data)
+          this.push(null)
+          return
+        }
+      }
+
+      const manifest = this._manifest
+      if (this._index === manifest.chunkCount) {
+        if (this._bytes !== manifest.totalSize) {
+          throw new Error(`Chunked value ${this.name} is truncated.`)
+        }
+        this.push(null)
+        return
+      }
+      const chunk = check(this.key.getBinaryValue(chunkName(this.name, manifest.generation, this._index++)),
+                          this.key, 'Failed to read chunk.')
+      this._bytes += chunk.length
+      this.push(chunk)
+    } catch (e) {
+      this.destroy(e)
+    }
+  }
+}
+
+// Collects writes into chunks of chunkSize bytes and writes each one as soon as it is full
+class RegValueWriteStream extends Writable {
+  constructor(key, name, options) {
+    options = options || {}
+    super(options)
+    this.key = key
+    this.name = name
+    this.chunkSize = options.chunkSize || DEFAULT_CHUNK_SIZE
+    this._previous = findManifest(key, name)
+    this._generation = this._previous ? (this._previous.generation + 1) >>> 0 : 0
+    this._pending = []
+    this._pendingSize = 0
+    this._chunkCount = 0
+    this._totalSize = 0
+  }
+
+  _write(data, encoding, callback) {
+    try {
+      this._pending.push(data)
+      this._pendingSize += data.length
+      this._totalSize += data.length
+      if (this._pendingSize > this.chunkSize) {
+        this._flushChunks(false)
+      }
+      callback()
+    } catch (e) {
+      callback(e)
+    }
+  }
+
+  _final(callback) {
+    try {
+      if (this._chunkCount === 0) {
+        check(this.key.setBinaryValue(this.name, Buffer.concat(this._pending, this._pendingSize)),
+              this.key, 'Failed to write value.')
+      } else {
+        this._flushChunks(true)
+        check(this.key.setBinaryValue(this.name, writeManifest({
+          generation: this._generation,
+          chunkCount: this._chunkCount,
+          chunkSize: this.chunkSize,
+          totalSize: this._totalSize
+        })), this.key, 'Failed to write manifest.')
+      }
+      if (this._previous) {
+        deleteChunks(this.key, this.name, this._previous)
+      }
+      callback()
+    } catch (e) {
+      callback(e)
+    }
+  }
+
+  _destroy(error, callback) {
+    // Chunks of an unfinished write are never referenced by a manifest.
+    if (error && this._chunkCount > 0) {
+      deleteChunks(this.key, this.name, { generation: this._generation, chunkCount: this._chunkCount })
+    }
+    callback(error)
+  }
+
+  // Writes the pending data as chunks. Unless `all` is set, the last full chunk is kept until
+  // more data comes: if it turns out to be the only one, the value is stored plain.
+  _flushChunks(all) {
+    const data = Buffer.concat(this._pending, this._pendingSize)
+    let offset = 0
+    while (data.length - offset > this.chunkSize || (all && offset < data.length)) {
+      const size = Math.min(this.chunkSize, data.length - offset)
+      check(this.key.setBinaryValue(chunkName(this.name, this._generation, this._chunkCount),
+                                    data.subarray(offset, offset + size)),
+            this.key, 'Failed to write chunk.')
+      this._chunkCount++
+      offset += size
+    }
+    this._pending = offset < data.length ? [data.subarray(offset)] : []
+    this._pendingSize = data.length - offset
+  }
+}
+
+module.exports = {
+  RegValueReadStream,
+  RegValueWriteStream,
+  deleteChunks,
+  findManifest
+}
@@ -0,0 +1,1781 @@
+#include "HiveBackend.h"
+#include "RegFile.h"
+#include "RegString.h"
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+
+namespace
+{
+    const uint32_t NoCell = 0xFFFFFFFF;
+    const uint32_t BaseBlockSize = 4096;
+    const uint32_t PageSize = 4096;
+    const uint32_t BinHeaderSize = 32;
+    // Cells are 8-byte aligned; smaller remainders are left in the cell they were split from.
+    const uint32_t MinSplitSize = 16;
+    // Values larger than this are split into segments by hives of version 1.4 and later.
+    const uint32_t BigDataSegment = 16344;
+    const uint32_t MaxLeafEntries = 512;
+    const size_t MaxKeyNameLength = 255;
+    const size_t MaxValueNameLength = 16383;
+
+    // Base block
+    const uint32_t BasePrimarySequence = 4;
+    const uint32_t BaseSecondarySequence = 8;
+    const uint32_t BaseLastWritten = 12;
+    const uint32_t BaseMajorVersion = 20;
+    const uint32_t BaseMinorVersion = 24;
+    const uint32_t BaseFileType = 28;
+    const uint32_t BaseFileFormat = 32;
+    const uint32_t BaseRootCell = 36;
+    const uint32_t BaseBinsSize = 40;
+    const uint32_t BaseClustering = 44;
+    const uint32_t BaseFileName = 48;
+    const uint32_t BaseChecksum = 508;
+
+    // hbin header
+    const uint32_t BinOffset = 4;
+    const uint32_t BinSize = 8;
+    const uint32_t BinTimestamp = 20;
+
+    // Key node (nk)
+    const uint32_t NkFlags = 2;
+    const uint32_t NkLastWritten = 4;
+    const uint32_t NkParent = 16;
+    const uint32_t NkSubKeyCount = 20;
+    const uint32_t NkSubKeyList = 28;
+    const uint32_t NkVolatileSubKeyList = 32;
+    const uint32_t NkValueCount = 36;
+    const uint32_t NkValueList = 40;
+    const uint32_t NkSecurity = 44;
+    const uint32_t NkClass = 48;
+    const uint32_t NkMaxSubKeyName = 52;
+    const uint32_t NkMaxValueName = 60;
+    const uint32_t NkMaxValueData = 64;
+    const uint32_t NkNameLength = 72;
+    const uint32_t NkClassLength = 74;
+    const uint32_t NkName = 76;
+    const uint16_t KeyHiveEntry = 0x0004;
+    const uint16_t KeyNoDelete = 0x0008;
+    const uint16_t KeyCompressedName = 0x0020;
+
+    // Key value (vk)
+    const uint32_t VkNameLength = 2;
+    const uint32_t VkDataSize = 4;
+    const uint32_t VkData = 8;
+    const uint32_t VkType = 12;
+    const uint32_t VkFlags = 16;
+    const uint32_t VkName = 20;
+    const uint16_t ValueCompressedName = 0x0001;
+    const uint32_t DataResident = 0x80000000;
+
+    // Key security (sk)
+    const uint32_t SkFlink = 4;
+    const uint32_t SkBlink = 8;
+    const uint32_t SkRefCount = 12;
+    const uint32_t SkDescriptorSize = 16;
+    const uint32_t SkDescriptor = 20;
+
+    // Self-relative security descriptor of new hives: full control for Administrators
+    // and read access for Everyone, inherited by subkeys; owned by Administrators.
+    const BYTE DefaultSecurity[] = {
+        0x01, 0x00, 0x04, 0x80, 0x4C, 0x00, 0x00, 0x00, 0x5C, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+        0x14, 0x00, 0x00, 0x00,
+        // DACL with two ACEs
+        0x02, 0x00, 0x38, 0x00, 0x02, 0x00, 0x00, 0x00,
+        0x00, 0x02, 0x18, 0x00, 0x3F, 0x00, 0x0F, 0x00,
+        0x01, 0x02, 0x00, 0x00, 0x00, 0x00, 0x00, 0x05, 0x20, 0x00, 0x00, 0x00, 0x20, 0x02, 0x00, 0x00,
+        0x00, 0x02, 0x14, 0x00, 0x19, 0x00, 0x02, 0x00,
+        0x01, 0x01, 0x00, 0x00, 0x00, 0x00, 0x00, 0x01, 0x00, 0x00, 0x00, 0x00,
+        // Owner and group: S-1-5-32-544
+        0x01, 0x02, 0x00, 0x00, 0x00, 0x00, 0x00, 0x05, 0x20, 0x00, 0x00, 0x00, 0x20, 0x02, 0x00, 0x00,
+        0x01, 0x02, 0x00, 0x00, 0x00, 0x00, 0x00, 0x05, 0x20, 0x00, 0x00, 0x00, 0x20, 0x02, 0x00, 0x00,
+    };
+
+    const struct
+    {
+        HKEY key;
+    } predefinedKeys[] = {
+        {HKEY_CLASSES_ROOT},
+        {HKEY_CURRENT_USER},
+        {HKEY_LOCAL_MACHINE},
+        {HKEY_USERS},
+        {HKEY_PERFORMANCE_DATA},
+        {HKEY_CURRENT_CONFIG},
+        {HKEY_PERFORMANCE_TEXT},
+        {HKEY_PERFORMANCE_NLSTEXT},
+    };
+
+    bool IsPredefinedKey(HKEY hKey)
+    {
+        for (size_t i = 0; i < sizeof(predefinedKeys) / sizeof(predefinedKeys[0]); i++)
+        {
+            if (predefinedKeys[i].key == hKey)
+                return true;
+        }
+        return false;
+    }
+
+    uint16_t Get16(const BYTE *p)
+    {
+        uint16_t value;
+        memcpy(&value, p, sizeof(value));
+        return value;
+    }
+
+    uint32_t Get32(const BYTE *p)
+    {
+        uint32_t value;
+        memcpy(&value, p, sizeof(value));
+        return value;
+    }
+
+    void Put16(BYTE *p, uint16_t value)
+    {
+        memcpy(p, &value, sizeof(value));
+    }
+
+    void Put32(BYTE *p, uint32_t value)
+    {
+        memcpy(p, &value, sizeof(value));
+    }
+
+    void Put64(BYTE *p, QWORD value)
+    {
+        memcpy(p, &value, sizeof(value));
+    }
+
+    uint32_t Align8(uint32_t size)
+    {
+        return (size + 7) & ~7u;
+    }
+
+    QWORD CurrentFileTime()
+    {
+        // FILETIME counts 100ns intervals from 1601, the system clock from 1970.
+        auto sinceEpoch = std::chrono::system_clock::now().time_since_epoch();
+        return QWORD(std::chrono::duration_cast<std::chrono::microseconds>(sinceEpoch).count()) * 10 +
+               116444736000000000ULL;
+    }
+
+    uint32_t HeaderChecksum(const BYTE *base)
+    {
+        uint32_t sum = 0;
+        for (uint32_t i = 0; i < BaseChecksum; i += 4)
+            sum ^= Get32(base + i);
+        if (sum == 0xFFFFFFFF)
+            return 0xFFFFFFFE;
+        return sum == 0 ? 1 : sum;
+    }
+
+    int FreeClass(uint32_t cellSize)
+    {
+        if (cellSize <= 512)
+            return int(cellSize / 8) - 1;
+        int sizeClass = 64;
+        for (uint32_t size = 1024; size <= cellSize && sizeClass + 1 < 80; size <<= 1)
+            sizeClass++;
+        return sizeClass;
+    }
+
+    // Names stored one byte per character when every character fits.
+    bool CanCompress(const Char *name, size_t length)
+    {
+        for (size_t i = 0; i < length; i++)
+        {
+            if (uint16_t(name[i]) > 0xFF)
+                return false;
+        }
+        return true;
+    }
+
+    void EncodeName(BYTE *out, const Char *name, size_t length, bool compressed)
+    {
+        for (size_t i = 0; i < length; i++)
+        {
+            if (compressed)
+                out[i] = BYTE(name[i]);
+            else
+                Put16(out + i * 2, uint16_t(name[i]));
+        }
+    }
+
+    void DecodeName(const BYTE *in, size_t bytes, bool compressed, String &name)
+    {
+        size_t length = compressed ? bytes : bytes / 2;
+        name.resize(length);
+        for (size_t i = 0; i < length; i++)
+            name[i] = compressed ? Char(in[i]) : Char(Get16(in + i * 2));
+    }
+
+    uint32_t NameHash(const String &name)
+    {
+        uint32_t hash = 0;
+        for (auto it = name.begin(); it != name.end(); it++)
+            hash = hash * 37 + uint16_t(RegString::FoldChar(*it));
+        return hash;
+    }
+
+    uint32_t NameHint(const String &name)
+    {
+        BYTE hint[4] = {0, 0, 0, 0};
+        for (size_t i = 0; i < name.size() && i < 4; i++)
+            hint[i] = uint16_t(name[i]) < 0x80 ? BYTE(name[i]) : 0;
+        return Get32(hint);
+    }
+}
+
+HiveBackend::HiveBackend(const std::string &name)
+    : _name(name)
+    , _fp(NULL)
+    , _writable(false)
+    , _minorVersion(0)
+    , _dirty(false)
+{
+}
+
+HiveBackend::~HiveBackend()
+{
+    Flush();
+    if (_fp != NULL)
+        fclose(_fp);
+}
+
+BYTE *HiveBackend::_Cell(uint32_t offset, uint32_t size)
+{
+    uint32_t binsSize = Get32(_image.data() + BaseBinsSize);
+    if (offset == NoCell || offset % 8 != 0 || offset >= binsSize || binsSize - offset < 4)
+        return nullptr;
+    BYTE *cell = _image.data() + BaseBlockSize + offset;
+    int32_t raw = int32_t(Get32(cell));
+    if (raw >= 0 || raw == INT32_MIN)
+        return nullptr;
+    uint32_t cellSize = uint32_t(-raw);
+    if (cellSize - 4 < size || cellSize < 4 || cellSize > binsSize - offset)
+        return nullptr;
+    return cell + 4;
+}
+
+uint32_t HiveBackend::_CellSize(uint32_t offset) const
+{
+    int32_t raw = int32_t(Get32(_image.data() + BaseBlockSize + offset));
+    return raw < 0 ? uint32_t(-raw) : uint32_t(raw);
+}
+
+void HiveBackend::_Dirty(uint32_t offset, uint32_t size)
+{
+    if (size == 0)
+        return;
+    size_t first = (BaseBlockSize + size_t(offset)) / PageSize;
+    size_t last = (BaseBlockSize + size_t(offset) + size - 1) / PageSize;
+    if (_dirtyPages.size() <= last)
+        _dirtyPages.resize(last + 1, false);
+    for (size_t page = first; page <= last; page++)
+        _dirtyPages[page] = true;
+    _dirty = true;
+}
+
+void HiveBackend::_DirtyCell(uint32_t offset)
+{
+    _Dirty(offset, _CellSize(offset));
+}
+
+void HiveBackend::_AddFree(uint32_t offset, uint32_t size)
+{
+    Put32(_image.data() + BaseBlockSize + offset, size);
+    _Dirty(offset, 4);
+    _freeCells[FreeClass(size)].insert(offset);
+}
+
+void HiveBackend::_RemoveFree(uint32_t offset, uint32_t size)
+{
+    _freeCells[FreeClass(size)].erase(offset);
+}
+
+bool HiveBackend::_Grow(uint32_t cellSize)
+{
+    uint32_t binsSize = Get32(_image.data() + BaseBinsSize);
+    uint64_t binSize = (uint64_t(cellSize) + BinHeaderSize + PageSize - 1) / PageSize * PageSize;
+    if (uint64_t(binsSize) + binSize > 0x7FFFF000)
+        return false;
+
+    size_t end = BaseBlockSize + size_t(binsSize) + size_t(binSize);
+    if (_image.size() < end)
+        _image.resize(end, 0);
+    BYTE *bin = _image.data() + BaseBlockSize + binsSize;
+    memset(bin, 0, BinHeaderSize);
+    memcpy(bin, "hbin", 4);
+    Put32(bin + BinOffset, binsSize);
+    Put32(bin + BinSize, uint32_t(binSize));
+    Put64(bin + BinTimestamp, CurrentFileTime());
+    Put32(_image.data() + BaseBinsSize, binsSize + uint32_t(binSize));
+
+    _bins[binsSize] = uint32_t(binSize);
+    _Dirty(binsSize, uint32_t(binSize));
+    _AddFree(binsSize + BinHeaderSize, uint32_t(binSize) - BinHeaderSize);
+    return true;
+}
+
+uint32_t HiveBackend::_Allocate(uint32_t size)
+{
+    if (size > 0x7FFFF000 - BinHeaderSize - 8)
+        return NoCell;
+    uint32_t cellSize = Align8(size + 4);
+
+    uint32_t offset = NoCell;
+    uint32_t found = 0;
+    for (int sizeClass = FreeClass(cellSize); sizeClass < FreeClasses && offset == NoCell; sizeClass++)
+    {
+        // Classes up to 512 bytes hold one size; lower offsets first keeps the hive dense.
+        for (auto it = _freeCells[sizeClass].begin(); it != _freeCells[sizeClass].end(); it++)
+        {
+            uint32_t free = _CellSize(*it);
+            if (free >= cellSize)
+            {
+                offset = *it;
+                found = free;
+                _freeCells[sizeClass].erase(it);
+                break;
+            }
+        }
+    }
+    if (offset == NoCell)
+    {
+        if (!_Grow(cellSize))
+            return NoCell;
+        return _Allocate(size);
+    }
+
+    if (found - cellSize >= MinSplitSize)
+        _AddFree(offset + cellSize, found - cellSize);
+    else
+        cellSize = found;
+    Put32(_image.data() + BaseBlockSize + offset, uint32_t(-int32_t(cellSize)));
+    _Dirty(offset, cellSize);
+    return offset;
+}
+
+void HiveBackend::_Free(uint32_t offset)
+{
+    if (_Cell(offset, 0) == nullptr)
+        return;
+    uint32_t size = _CellSize(offset);
+    auto bin = _bins.upper_bound(offset);
+    if (bin == _bins.begin())
+        return;
+    bin--;
+    uint32_t binEnd = bin->first + bin->second;
+
+    // Merge with the free cells around it; cells never span hbins.
+    uint32_t next = offset + size;
+    if (next < binEnd && int32_t(Get32(_image.data() + BaseBlockSize + next)) > 0)
+    {
+        uint32_t nextSize = _CellSize(next);
+        _RemoveFree(next, nextSize);
+        size += nextSize;
+    }
+    uint32_t previous = NoCell;
+    for (uint32_t cell = bin->first + BinHeaderSize; cell < offset; cell += _CellSize(cell))
+        previous = cell;
+    if (previous != NoCell && int32_t(Get32(_image.data() + BaseBlockSize + previous)) > 0)
+    {
+        uint32_t previousSize = _CellSize(previous);
+        _RemoveFree(previous, previousSize);
+        offset = previous;
+        size += previousSize;
+    }
+    _AddFree(offset, size);
+}
+
+uint32_t HiveBackend::_Reallocate(uint32_t offset, uint32_t size)
+{
+    if (_Cell(offset, 0) == nullptr)
+        return _Allocate(size);
+    uint32_t cellSize = _CellSize(offset);
+    uint32_t needed = Align8(size + 4);
+    if (cellSize >= needed)
+        return offset;
+
+    // Grow into the free cell that follows, when there is one in the same hbin.
+    auto bin = _bins.upper_bound(offset);
+    bin--;
+    uint32_t next = offset + cellSize;
+    if (next < bin->first + bin->second && int32_t(Get32(_image.data() + BaseBlockSize + next)) > 0 &&
+        cellSize + _CellSize(next) >= needed)
+    {
+        uint32_t total = cellSize + _CellSize(next);
+        _RemoveFree(next, _CellSize(next));
+        if (total - needed >= MinSplitSize)
+            _AddFree(offset + needed, total - needed);
+        else
+            needed = total;
+        Put32(_image.data() + BaseBlockSize + offset, uint32_t(-int32_t(needed)));
+        _Dirty(offset, needed);
+        return offset;
+    }
+
+    uint32_t moved = _Allocate(size);
+    if (moved == NoCell)
+        return NoCell;
+    memcpy(_image.data() + BaseBlockSize + moved + 4, _image.data() + BaseBlockSize + offset + 4, cellSize - 4);
+    _Free(offset);
+    return moved;
+}
+
+LSTATUS HiveBackend::_Parse()
+{
+    if (_image.size() < BaseBlockSize + PageSize)
+        return ERROR_BADDB;
+    const BYTE *base = _image.data();
+    if (memcmp(base, "regf", 4) != 0 || Get32(base + BaseChecksum) != HeaderChecksum(base))
+        return ERROR_BADDB;
+    _minorVersion = Get32(base + BaseMinorVersion);
+    if (Get32(base + BaseMajorVersion) != 1 || _minorVersion < 2 || _minorVersion > 6 ||
+        Get32(base + BaseFileType) != 0 || Get32(base + BaseFileFormat) != 1)
+        return ERROR_BADDB;
+
+    uint32_t binsSize = Get32(base + BaseBinsSize);
+    if (binsSize == 0 || binsSize % PageSize != 0 || binsSize > _image.size() - BaseBlockSize)
+        return ERROR_BADDB;
+
+    _bins.clear();
+    for (int i = 0; i < FreeClasses; i++)
+        _freeCells[i].clear();
+    for (uint32_t at = 0; at < binsSize;)
+    {
+        const BYTE *bin = base + BaseBlockSize + at;
+        uint32_t size = Get32(bin + BinSize);
+        if (memcmp(bin, "hbin", 4) != 0 || Get32(bin + BinOffset) != at || size < PageSize ||
+            size % PageSize != 0 || size > binsSize - at)
+            return ERROR_BADDB;
+
+        for (uint32_t cell = at + BinHeaderSize; cell < at + size;)
+        {
+            int32_t raw = int32_t(Get32(base + BaseBlockSize + cell));
+            uint32_t cellSize = raw < 0 ? uint32_t(0) - uint32_t(raw) : uint32_t(raw);
+            if (cellSize < 8 || cellSize % 8 != 0 || cellSize > at + size - cell)
+                return ERROR_BADDB;
+            if (raw > 0)
+                _freeCells[FreeClass(cellSize)].insert(cell);
+            cell += cellSize;
+        }
+        _bins[at] = size;
+        at += size;
+    }
+
+    const BYTE *root = _Cell(Get32(base + BaseRootCell), NkName);
+    if (root == nullptr || memcmp(root, "nk", 2) != 0)
+        return ERROR_BADDB;
+    _dirtyPages.assign((_image.size() + PageSize - 1) / PageSize, false);
+    _dirty = false;
+    return ERROR_SUCCESS;
+}
+
+LSTATUS HiveBackend::Load(const std::string &file, bool writable)
+{
+    std::unique_lock<std::shared_mutex> lock(_treeMutex);
+    if (_fp != NULL)
+    {
+        fclose(_fp);
+        _fp = NULL;
+    }
+    _writable = false;
+    if (!RegFile::Read(file, _image))
+        return ERROR_FILE_NOT_FOUND;
+    LSTATUS status = _Parse();
+    if (status != ERROR_SUCCESS)
+    {
+        _image.clear();
+        return status;
+    }
+
+    _file = file;
+    if (writable)
+    {
+        if (Get32(_image.data() + BasePrimarySequence) != Get32(_image.data() + BaseSecondarySequence))
+            return ERROR_BADDB;
+        _fp = RegFile::Open(file, "r+b");
+        if (_fp == NULL)
+            return ERROR_ACCESS_DENIED;
+        _writable = true;
+    }
+    return ERROR_SUCCESS;
+}
+
+LSTATUS HiveBackend::Create(const std::string &file)
+{
+    {
+        std::unique_lock<std::shared_mutex> lock(_treeMutex);
+        _image.assign(BaseBlockSize + PageSize, 0);
+        BYTE *base = _image.data();
+        memcpy(base, "regf", 4);
+        Put32(base + BasePrimarySequence, 1);
+        Put32(base + BaseSecondarySequence, 1);
+        Put64(base + BaseLastWritten, CurrentFileTime());
+        Put32(base + BaseMajorVersion, 1);
+        Put32(base + BaseMinorVersion, 5);
+        Put32(base + BaseFileFormat, 1);
+        Put32(base + BaseBinsSize, PageSize);
+        Put32(base + BaseClustering, 1);
+        size_t nameStart = file.find_last_of("/\\");
+        std::string name = file.substr(nameStart == std::string::npos ? 0 : nameStart + 1);
+        for (size_t i = 0; i < name.size() && i < 31; i++)
+            Put16(base + BaseFileName + i * 2, uint16_t(BYTE(name[i])));
+
+        BYTE *bin = base + BaseBlockSize;
+        memcpy(bin, "hbin", 4);
+        Put32(bin + BinSize, PageSize);
+        Put64(bin + BinTimestamp, CurrentFileTime());
+        Put32(bin + BinHeaderSize, PageSize - BinHeaderSize);
+        _bins.clear();
+        _bins[0] = PageSize;
+        for (int i = 0; i < FreeClasses; i++)
+            _freeCells[i].clear();
+        _freeCells[FreeClass(PageSize - BinHeaderSize)].insert(BinHeaderSize);
+        _minorVersion = 5;
+
+        uint32_t security = _Allocate(SkDescriptor + sizeof(DefaultSecurity));
+        BYTE *sk = _Cell(security, SkDescriptor + sizeof(DefaultSecurity));
+        memcpy(sk, "sk", 2);
+        Put32(sk + SkFlink, security);
+        Put32(sk + SkBlink, security);
+        Put32(sk + SkRefCount, 1);
+        Put32(sk + SkDescriptorSize, sizeof(DefaultSecurity));
+        memcpy(sk + SkDescriptor, DefaultSecurity, sizeof(DefaultSecurity));
+
+        static const char rootName[] = "ROOT";
+        uint32_t root = _Allocate(NkName + sizeof(rootName) - 1);
+        BYTE *nk = _Cell(root, NkName + sizeof(rootName) - 1);
+        memset(nk, 0, NkName);
+        memcpy(nk, "nk", 2);
+        Put16(nk + NkFlags, KeyHiveEntry | KeyNoDelete | KeyCompressedName);
+        Put64(nk + NkLastWritten, CurrentFileTime());
+        Put32(nk + NkSubKeyList, NoCell);
+        Put32(nk + NkVolatileSubKeyList, NoCell);
+        Put32(nk + NkValueList, NoCell);
+        Put32(nk + NkSecurity, security);
+        Put32(nk + NkClass, NoCell);
+        Put16(nk + NkNameLength, sizeof(rootName) - 1);
+        memcpy(nk + NkName, rootName, sizeof(rootName) - 1);
+        Put32(base + BaseRootCell, root);
+        Put32(base + BaseChecksum, HeaderChecksum(base));
+
+        std::string temporary = file + ".tmp";
+        FILE *fp = RegFile::Open(temporary, "wb");
+        if (fp == NULL)
+            return ERROR_ACCESS_DENIED;
+        bool written = fwrite(_image.data(), 1, _image.size(), fp) == _image.size();
+        written = fclose(fp) == 0 && written;
+        if (!written || !RegFile::Replace(temporary, file))
+        {
+            RegFile::Remove(temporary);
+            return ERROR_ACCESS_DENIED;
+        }
+    }
+    return Load(file, true);
+}
+
+void HiveBackend::_WriteHeader()
+{
+    BYTE *base = _image.data();
+    Put32(base + BaseChecksum, HeaderChecksum(base));
+    fseek(_fp, 0, SEEK_SET);
+    fwrite(base, 1, BaseBlockSize, _fp);
+    fflush(_fp);
+}
+
+LSTATUS HiveBackend::Flush()
+{
+    std::unique_lock<std::shared_mutex> lock(_treeMutex);
+    if (!_dirty || _fp == NULL)
+        return ERROR_SUCCESS;
+
+    BYTE *base = _image.data();
+    uint32_t sequence = Get32(base + BasePrimarySequence) + 1;
+    Put32(base + BasePrimarySequence, sequence);
+    Put64(base + BaseLastWritten, CurrentFileTime());
+    _WriteHeader();
+
+    bool written = !ferror(_fp);
+    for (size_t page = 1; page < _dirtyPages.size() && written; page++)
+    {
+        if (!_dirtyPages[page])
+            continue;
+        // Runs of dirty pages go out in one write.
+        size_t last = page;
+        while (last + 1 < _dirtyPages.size() && _dirtyPages[last + 1])
+            last++;
+        size_t begin = page * PageSize;
+        size_t end = std::min(_image.size(), (last + 1) * PageSize);
+        written = fseek(_fp, long(begin), SEEK_SET) == 0 && fwrite(base + begin, 1, end - begin, _fp) == end - begin;
+        page = last;
+    }
+    if (!written || fflush(_fp) != 0)
+        return ERROR_CANTWRITE;
+
+    Put32(base + BaseSecondarySequence, sequence);
+    _WriteHeader();
+    if (ferror(_fp))
+        return ERROR_CANTWRITE;
+    std::fill(_dirtyPages.begin(), _dirtyPages.end(), false);
+    _dirty = false;
+    return ERROR_SUCCESS;
+}
+
+LSTATUS HiveBackend::_Resolve(HKEY hKey, uint32_t *key)
+{
+    if (_image.empty())
+        return ERROR_INVALID_HANDLE;
+    if (IsPredefinedKey(hKey))
+    {
+        *key = Get32(_image.data() + BaseRootCell);
+        return ERROR_SUCCESS;
+    }
+
+    uintptr_t index = (uintptr_t(hKey) >> 2) - 1;
+    std::lock_guard<std::mutex> lock(_handleMutex);
+    if (hKey == NULL || index >= _handles.size() || !_handles[index].used)
+        return ERROR_INVALID_HANDLE;
+
+    const HandleSlot &slot = _handles[index];
+    auto generation = _generations.find(slot.key);
+    if (generation != _generations.end() && generation->second != slot.generation)
+        return ERROR_KEY_DELETED;
+    *key = slot.key;
+    return ERROR_SUCCESS;
+}
+
+HKEY HiveBackend::_NewHandle(uint32_t key)
+{
+    std::lock_guard<std::mutex> lock(_handleMutex);
+    uint32_t index;
+    if (!_freeHandles.empty())
+    {
+        index = _freeHandles.back();
+        _freeHandles.pop_back();
+    }
+    else
+    {
+        index = uint32_t(_handles.size());
+        _handles.emplace_back();
+    }
+
+    HandleSlot &slot = _handles[index];
+    auto generation = _generations.find(key);
+    slot.key = key;
+    slot.generation = generation != _generations.end() ? generation->second : 0;
+    slot.used = true;
+    return HKEY(uintptr_t(index + 1) << 2);
+}
+
+bool HiveBackend::_KeyName(uint32_t key, String &name)
+{
+    const BYTE *nk = _Cell(key, NkName);
+    if (nk == nullptr)
+        return false;
+    uint16_t length = Get16(nk + NkNameLength);
+    if ((nk = _Cell(key, NkName + length)) == nullptr)
+        return false;
+    DecodeName(nk + NkName, length, (Get16(nk + NkFlags) & KeyCompressedName) != 0, name);
+    return true;
+}
+
+bool HiveBackend::_CollectList(uint32_t list, std::vector<ChildEntry> &children, int depth)
+{
+    const BYTE *cell = _Cell(list, 4);
+    if (cell == nullptr)
+        return false;
+    uint16_t count = Get16(cell + 2);
+    if (cell[0] == 'r' && cell[1] == 'i')
+    {
+        // Index roots point to leaves, never to other roots.
+        if (depth > 0 || (cell = _Cell(list, 4 + count * 4u)) == nullptr)
+            return false;
+        for (uint16_t i = 0; i < count; i++)
+        {
+            if (!_CollectList(Get32(cell + 4 + i * 4u), children, depth + 1))
+                return false;
+            cell = _Cell(list, 4 + count * 4u);
+        }
+        return true;
+    }
+
+    bool indexLeaf = cell[0] == 'l' && cell[1] == 'i';
+    bool hashed = cell[0] == 'l' && (cell[1] == 'h' || cell[1] == 'f');
+    if (!indexLeaf && !hashed)
+        return false;
+    uint32_t entrySize = indexLeaf ? 4 : 8;
+    if ((cell = _Cell(list, 4 + count * entrySize)) == nullptr)
+        return false;
+    for (uint16_t i = 0; i < count; i++)
+    {
+        ChildEntry entry;
+        entry.key = Get32(cell + 4 + i * entrySize);
+        entry.hint = indexLeaf ? 0 : Get32(cell + 8 + i * entrySize);
+        entry.list = char(cell[1]);
+        children.push_back(entry);
+    }
+    return true;
+}
+
+bool HiveBackend::_Children(uint32_t key, std::vector<ChildEntry> &children)
+{
+    children.clear();
+    const BYTE *nk = _Cell(key, NkName);
+    if (nk == nullptr)
+        return false;
+    if (Get32(nk + NkSubKeyCount) == 0)
+        return true;
+    return _CollectList(Get32(nk + NkSubKeyList), children, 0);
+}
+
+uint32_t HiveBackend::_ChildAt(uint32_t key, DWORD index)
+{
+    const BYTE *nk = _Cell(key, NkName);
+    if (nk == nullptr || index >= Get32(nk + NkSubKeyCount))
+        return NoCell;
+    uint32_t list = Get32(nk + NkSubKeyList);
+    const BYTE *cell = _Cell(list, 4);
+    if (cell == nullptr)
+        return NoCell;
+
+    // Skip whole leaves of an index root instead of collecting every entry.
+    if (cell[0] == 'r' && cell[1] == 'i')
+    {
+        uint16_t count = Get16(cell + 2);
+        if (_Cell(list, 4 + count * 4u) == nullptr)
+            return NoCell;
+        for (uint16_t i = 0; i < count; i++)
+        {
+            uint32_t leaf = Get32(_Cell(list, 4 + count * 4u) + 4 + i * 4u);
+            const BYTE *leafCell = _Cell(leaf, 4);
+            if (leafCell == nullptr || (leafCell[0] == 'r' && leafCell[1] == 'i'))
+                return NoCell;
+            uint16_t entries = Get16(leafCell + 2);
+            if (index < entries)
+            {
+                list = leaf;
+                cell = leafCell;
+                break;
+            }
+            index -= entries;
+        }
+        if (cell[0] == 'r')
+            return NoCell;
+    }
+
+    uint32_t entrySize = cell[0] == 'l' && cell[1] == 'i' ? 4 : 8;
+    if (index >= Get16(cell + 2) || (cell = _Cell(list, 4 + (index + 1) * entrySize)) == nullptr)
+        return NoCell;
+    return Get32(cell + 4 + index * entrySize);
+}
+
+uint32_t HiveBackend::_FindChild(uint32_t key, const Char *name, size_t length, std::vector<ChildEntry> &children,
+                                 size_t *position)
+{
+    *position = 0;
+    if (!_Children(key, children))
+        return NoCell;
+
+    // Lists are sorted by upper-cased name, which is the order CompareFold gives.
+    String childName;
+    auto it = std::lower_bound(children.begin(), children.end(), 0, [&](const ChildEntry &entry, int) {
+        if (!_KeyName(entry.key, childName))
+            childName.clear();
+        return RegString::CompareFold(childName.c_str(), childName.size(), name, length) < 0;
+    });
+    *position = size_t(it - children.begin());
+    if (it != children.end() && _KeyName(it->key, childName) &&
+        RegString::EqualsFold(childName.c_str(), childName.size(), name, length))
+        return it->key;
+    return NoCell;
+}
+
+void HiveBackend::_FreeList(uint32_t list, int depth)
+{
+    const BYTE *cell = _Cell(list, 4);
+    if (cell == nullptr)
+        return;
+    if (cell[0] == 'r' && cell[1] == 'i' && depth == 0)
+    {
+        uint16_t count = Get16(cell + 2);
+        if (_Cell(list, 4 + count * 4u) != nullptr)
+        {
+            for (uint16_t i = 0; i < count; i++)
+                _FreeList(Get32(_Cell(list, 4 + count * 4u) + 4 + i * 4u), depth + 1);
+        }
+    }
+    _Free(list);
+}
+
+bool HiveBackend::_SetChildren(uint32_t key, std::vector<ChildEntry> &children)
+{
+    // Version 1.5 hives use hashed leaves, older ones name hints.
+    char listType = _minorVersion >= 5 ? 'h' : 'f';
+    String name;
+    uint32_t maxName = 0;
+    for (auto it = children.begin(); it != children.end(); it++)
+    {
+        if (!_KeyName(it->key, name))
+            return false;
+        if (it->list != listType)
+        {
+            it->hint = listType == 'h' ? NameHash(name) : NameHint(name);
+            it->list = listType;
+        }
+        maxName = std::max(maxName, uint32_t(name.size() * 2));
+    }
+
+    std::vector<uint32_t> leaves;
+    for (size_t first = 0; first < children.size(); first += MaxLeafEntries)
+    {
+        uint16_t count = uint16_t(std::min<size_t>(MaxLeafEntries, children.size() - first));
+        uint32_t leaf = _Allocate(4 + count * 8u);
+        if (leaf == NoCell)
+        {
+            for (auto it = leaves.begin(); it != leaves.end(); it++)
+                _Free(*it);
+            return false;
+        }
+        BYTE *cell = _Cell(leaf, 4 + count * 8u);
+        cell[0] = 'l';
+        cell[1] = BYTE(listType);
+        Put16(cell + 2, count);
+        for (uint16_t i = 0; i < count; i++)
+        {
+            Put32(cell + 4 + i * 8u, children[first + i].key);
+            Put32(cell + 8 + i * 8u, children[first + i].hint);
+        }
+        leaves.push_back(leaf);
+    }
+
+    uint32_t list = leaves.empty() ? NoCell : leaves[0];
+    if (leaves.size() > 1)
+    {
+        list = _Allocate(4 + uint32_t(leaves.size()) * 4);
+        if (list == NoCell)
+        {
+            for (auto it = leaves.begin(); it != leaves.end(); it++)
+                _Free(*it);
+            return false;
+        }
+        BYTE *cell = _Cell(list, 4 + uint32_t(leaves.size()) * 4);
+        memcpy(cell, "ri", 2);
+        Put16(cell + 2, uint16_t(leaves.size()));
+        for (size_t i = 0; i < leaves.size(); i++)
+            Put32(cell + 4 + i * 4, leaves[i]);
+    }
+
+    BYTE *nk = _Cell(key, NkName);
+    uint32_t previous = Get32(nk + NkSubKeyCount) > 0 ? Get32(nk + NkSubKeyList) : NoCell;
+    Put32(nk + NkSubKeyCount, uint32_t(children.size()));
+    Put32(nk + NkSubKeyList, list);
+    // The upper half holds flags on recent versions of Windows.
+    uint32_t maxField = Get32(nk + NkMaxSubKeyName);
+    Put32(nk + NkMaxSubKeyName, (maxField & 0xFFFF0000) | std::max(maxField & 0xFFFF, maxName));
+    _DirtyCell(key);
+    if (previous != NoCell)
+        _FreeList(previous, 0);
+    return true;
+}
+
+void HiveBackend::_Touch(uint32_t key)
+{
+    BYTE *nk = _Cell(key, NkName);
+    if (nk == nullptr)
+        return;
+    Put64(nk + NkLastWritten, CurrentFileTime());
+    _Dirty(key + 4 + NkLastWritten, 8);
+}
+
+uint32_t HiveBackend::_NewKey(uint32_t parent, const Char *name, size_t length)
+{
+    bool compressed = CanCompress(name, length);
+    uint32_t nameBytes = uint32_t(compressed ? length : length * 2);
+    uint32_t key = _Allocate(NkName + nameBytes);
+    if (key == NoCell)
+        return NoCell;
+
+    uint32_t security = Get32(_Cell(parent, NkName) + NkSecurity);
+    BYTE *nk = _Cell(key, NkName + nameBytes);
+    memset(nk, 0, NkName);
+    memcpy(nk, "nk", 2);
+    Put16(nk + NkFlags, compressed ? KeyCompressedName : 0);
+    Put64(nk + NkLastWritten, CurrentFileTime());
+    Put32(nk + NkParent, parent);
+    Put32(nk + NkSubKeyList, NoCell);
+    Put32(nk + NkVolatileSubKeyList, NoCell);
+    Put32(nk + NkValueList, NoCell);
+    Put32(nk + NkSecurity, security);
+    Put32(nk + NkClass, NoCell);
+    Put16(nk + NkNameLength, uint16_t(nameBytes));
+    EncodeName(nk + NkName, name, length, compressed);
+
+    // Subkeys share the security cell of their parent.
+    BYTE *sk = _Cell(security, SkDescriptor);
+    if (sk != nullptr && memcmp(sk, "sk", 2) == 0)
+    {
+        Put32(sk + SkRefCount, Get32(sk + SkRefCount) + 1);
+        _Dirty(security + 4 + SkRefCount, 4);
+    }
+    return key;
+}
+
+void HiveBackend::_FreeKey(uint32_t key)
+{
+    std::vector<uint32_t> values;
+    if (_Values(key, values))
+    {
+        for (auto it = values.begin(); it != values.end(); it++)
+        {
+            _FreeData(*it);
+            _Free(*it);
+        }
+    }
+
+    const BYTE *nk = _Cell(key, NkName);
+    uint32_t valueList = Get32(nk + NkValueCount) > 0 ? Get32(nk + NkValueList) : NoCell;
+    uint32_t subKeyList = Get32(nk + NkSubKeyCount) > 0 ? Get32(nk + NkSubKeyList) : NoCell;
+    uint32_t className = Get16(nk + NkClassLength) > 0 ? Get32(nk + NkClass) : NoCell;
+    uint32_t security = Get32(nk + NkSecurity);
+    _Free(valueList);
+    _FreeList(subKeyList, 0);
+    _Free(className);
+
+    BYTE *sk = _Cell(security, SkDescriptor);
+    if (sk != nullptr && memcmp(sk, "sk", 2) == 0)
+    {
+        uint32_t references = Get32(sk + SkRefCount);
+        Put32(sk + SkRefCount, references > 0 ? references - 1 : 0);
+        _Dirty(security + 4 + SkRefCount, 4);
+        uint32_t flink = Get32(sk + SkFlink);
+        uint32_t blink = Get32(sk + SkBlink);
+        // Unused descriptors leave the list of the hive, unless they are the last one.
+        if (references <= 1 && flink != security)
+        {
+            BYTE *next = _Cell(flink, SkDescriptor);
+            BYTE *previous = _Cell(blink, SkDescriptor);
+            if (next != nullptr && previous != nullptr)
+            {
+                Put32(previous + SkFlink, flink);
+                Put32(next + SkBlink, blink);
+                _Dirty(blink + 4 + SkFlink, 4);
+                _Dirty(flink + 4 + SkBlink, 4);
+                _Free(security);
+            }
+        }
+    }
+
+    _Free(key);
+    _generations[key]++;
+}
+
+bool HiveBackend::_DeleteSubtree(uint32_t key)
+{
+    std::vector<ChildEntry> children;
+    if (!_Children(key, children))
+        return false;
+    for (auto it = children.begin(); it != children.end(); it++)
+    {
+        if (!_DeleteSubtree(it->key))
+            return false;
+    }
+    _FreeKey(key);
+    return true;
+}
+
+LSTATUS HiveBackend::_Walk(uint32_t from, const Char *path, bool create, uint32_t *key)
+{
+    uint32_t current = from;
+    const Char *p = path;
+    std::vector<ChildEntry> children;
+    while (p != nullptr && *p != 0)
+    {
+        const Char *end = p;
+        while (*end != 0 && *end != '\\')
+            end++;
+        if (end != p)
+        {
+            size_t length = size_t(end - p);
+            size_t position;
+            uint32_t child = _FindChild(current, p, length, children, &position);
+            if (child == NoCell)
+            {
+                if (_Cell(current, NkName) == nullptr)
+                    return ERROR_BADDB;
+                if (!create)
+                    return ERROR_FILE_NOT_FOUND;
+                if (!_writable)
+                    return ERROR_ACCESS_DENIED;
+                if (length > MaxKeyNameLength)
+                    return ERROR_INVALID_PARAMETER;
+                if ((child = _NewKey(current, p, length)) == NoCell)
+                    return ERROR_NOT_ENOUGH_MEMORY;
+                ChildEntry entry = {child, 0, 0};
+                children.insert(children.begin() + position, entry);
+                if (!_SetChildren(current, children))
+                {
+                    _FreeKey(child);
+                    return ERROR_NOT_ENOUGH_MEMORY;
+                }
+                _Touch(current);
+            }
+            current = child;
+        }
+        p = *end != 0 ? end + 1 : end;
+    }
+    if (_Cell(current, NkName) == nullptr || memcmp(_Cell(current, NkName), "nk", 2) != 0)
+        return ERROR_BADDB;
+    *key = current;
+    return ERROR_SUCCESS;
+}
+
+bool HiveBackend::_Values(uint32_t key, std::vector<uint32_t> &values)
+{
+    values.clear();
+    const BYTE *nk = _Cell(key, NkName);
+    if (nk == nullptr)
+        return false;
+    uint32_t count = Get32(nk + NkValueCount);
+    if (count == 0)
+        return true;
+    uint32_t list = Get32(nk + NkValueList);
+    if (count > 0x3FFFFFFF)
+        return false;
+    const BYTE *cell = _Cell(list, count * 4);
+    if (cell == nullptr)
+        return false;
+    values.resize(count);
+    memcpy(values.data(), cell, count * 4);
+    return true;
+}
+
+bool HiveBackend::_ValueName(uint32_t value, String &name)
+{
+    const BYTE *vk = _Cell(value, VkName);
+    if (vk == nullptr || memcmp(vk, "vk", 2) != 0)
+        return false;
+    uint16_t length = Get16(vk + VkNameLength);
+    if ((vk = _Cell(value, VkName + length)) == nullptr)
+        return false;
+    DecodeName(vk + VkName, length, (Get16(vk + VkFlags) & ValueCompressedName) != 0, name);
+    return true;
+}
+
+uint32_t HiveBackend::_FindValue(uint32_t key, const Char *name, size_t *index)
+{
+    std::vector<uint32_t> values;
+    if (!_Values(key, values))
+        return NoCell;
+    size_t length = name != nullptr ? STRLEN(name) : 0;
+    String valueName;
+    for (size_t i = 0; i < values.size(); i++)
+    {
+        if (_ValueName(values[i], valueName) &&
+            RegString::EqualsFold(valueName.c_str(), valueName.size(), name != nullptr ? name : STR(""), length))
+        {
+            *index = i;
+            return values[i];
+        }
+    }
+    return NoCell;
+}
+
+bool HiveBackend::_ReadValueData(uint32_t value, ByteArray &data)
+{
+    const BYTE *vk = _Cell(value, VkName);
+    if (vk == nullptr)
+        return false;
+    uint32_t raw = Get32(vk + VkDataSize);
+    uint32_t size = raw & ~DataResident;
+    uint32_t offset = Get32(vk + VkData);
+    if ((raw & DataResident) != 0)
+    {
+        // Resident data lives in the offset field itself.
+        data.assign(vk + VkData, vk + VkData + std::min<uint32_t>(size, 4));
+        return true;
+    }
+    if (size == 0)
+    {
+        data.clear();
+        return true;
+    }
+
+    const BYTE *cell = _Cell(offset, 2);
+    if (cell == nullptr)
+        return false;
+    if (size > BigDataSegment && _minorVersion >= 4 && cell[0] == 'd' && cell[1] == 'b')
+    {
+        if ((cell = _Cell(offset, 8)) == nullptr)
+            return false;
+        uint16_t count = Get16(cell + 2);
+        uint32_t list = Get32(cell + 4);
+        if (_Cell(list, count * 4u) == nullptr)
+            return false;
+        data.clear();
+        data.reserve(size);
+        for (uint16_t i = 0; i < count && data.size() < size; i++)
+        {
+            uint32_t segment = Get32(_Cell(list, count * 4u) + i * 4u);
+            uint32_t length = std::min<uint32_t>(BigDataSegment, size - uint32_t(data.size()));
+            const BYTE *bytes = _Cell(segment, length);
+            if (bytes == nullptr)
+                return false;
+            data.insert(data.end(), bytes, bytes + length);
+        }
+        return data.size() == size;
+    }
+
+    if ((cell = _Cell(offset, size)) == nullptr)
+        return false;
+    data.assign(cell, cell + size);
+    return true;
+}
+
+LSTATUS HiveBackend::_ValueData(uint32_t value, DWORD *type, BYTE *data, DWORD *dataSize)
+{
+    const BYTE *vk = _Cell(value, VkName);
+    if (vk == nullptr)
+        return ERROR_BADDB;
+    if (type != nullptr)
+        *type = Get32(vk + VkType);
+    if (dataSize == nullptr)
+        return ERROR_SUCCESS;
+
+    uint32_t raw = Get32(vk + VkDataSize);
+    uint32_t size = (raw & DataResident) != 0 ? std::min<uint32_t>(raw & ~DataResident, 4) : raw;
+    DWORD bufferSize = *dataSize;
+    *dataSize = size;
+    if (data == nullptr)
+        return ERROR_SUCCESS;
+    if (bufferSize < size)
+        return ERROR_MORE_DATA;
+
+    ByteArray bytes;
+    if (!_ReadValueData(value, bytes) || bytes.size() != size)
+        return ERROR_BADDB;
+    if (size > 0)
+        memcpy(data, bytes.data(), size);
+    return ERROR_SUCCESS;
+}
+
+void HiveBackend::_FreeData(uint32_t value)
+{
+    const BYTE *vk = _Cell(value, VkName);
+    if (vk == nullptr)
+        return;
+    uint32_t raw = Get32(vk + VkDataSize);
+    uint32_t offset = Get32(vk + VkData);
+    if ((raw & DataResident) != 0 || raw == 0)
+        return;
+
+    const BYTE *cell = _Cell(offset, 8);
+    if (raw > BigDataSegment && _minorVersion >= 4 && cell != nullptr && cell[0] == 'd' && cell[1] == 'b')
+    {
+        uint16_t count = Get16(cell + 2);
+        uint32_t list = Get32(cell + 4);
+        if (_Cell(list, count * 4u) != nullptr)
+        {
+            for (uint16_t i = 0; i < count; i++)
+                _Free(Get32(_Cell(list, count * 4u) + i * 4u));
+            _Free(list);
+        }
+    }
+    _Free(offset);
+}
+
+bool HiveBackend::_StoreData(uint32_t value, const BYTE *data, DWORD size)
+{
+    if ((size & DataResident) != 0)
+        return false;
+    BYTE *vk = _Cell(value, VkName);
+    uint32_t raw = Get32(vk + VkDataSize);
+    uint32_t offset = Get32(vk + VkData);
+
+    if (size <= 4)
+    {
+        _FreeData(value);
+        vk = _Cell(value, VkName);
+        Put32(vk + VkDataSize, size | DataResident);
+        Put32(vk + VkData, 0);
+        if (size > 0)
+            memcpy(vk + VkData, data, size);
+        _Dirty(value + 4, VkName);
+        return true;
+    }
+
+    bool big = size > BigDataSegment && _minorVersion >= 4;
+    bool oldBig = raw > BigDataSegment && _minorVersion >= 4 && (raw & DataResident) == 0;
+    if (!big && !oldBig && (raw & DataResident) == 0 && raw > 0 && _Cell(offset, size) != nullptr)
+    {
+        // The old data cell is large enough: overwrite it in place.
+        memcpy(_Cell(offset, size), data, size);
+        _Dirty(offset + 4, size);
+        Put32(vk + VkDataSize, size);
+        _Dirty(value + 4, VkName);
+        return true;
+    }
+
+    uint32_t stored;
+    if (big)
+    {
+        uint16_t count = uint16_t((size + BigDataSegment - 1) / BigDataSegment);
+        if (count * uint64_t(BigDataSegment) < size || count == 0)
+            return false;
+        std::vector<uint32_t> segments;
+        for (uint32_t at = 0; at < size; at += BigDataSegment)
+        {
+            uint32_t length = std::min<uint32_t>(BigDataSegment, size - at);
+            uint32_t segment = _Allocate(length);
+            if (segment == NoCell)
+                break;
+            memcpy(_Cell(segment, length), data + at, length);
+            segments.push_back(segment);
+        }
+        uint32_t list = segments.size() == count ? _Allocate(count * 4u) : NoCell;
+        stored = list != NoCell ? _Allocate(8) : NoCell;
+        if (stored == NoCell)
+        {
+            for (auto it = segments.begin(); it != segments.end(); it++)
+                _Free(*it);
+            _Free(list);
+            return false;
+        }
+        memcpy(_Cell(list, count * 4u), segments.data(), count * 4u);
+        BYTE *db = _Cell(stored, 8);
+        memcpy(db, "db", 2);
+        Put16(db + 2, count);
+        Put32(db + 4, list);
+    }
+    else
+    {
+        if ((stored = _Allocate(size)) == NoCell)
+            return false;
+        memcpy(_Cell(stored, size), data, size);
+    }
+
+    _FreeData(value);
+    vk = _Cell(value, VkName);
+    Put32(vk + VkDataSize, size);
+    Put32(vk + VkData, stored);
+    _Dirty(value + 4, VkName);
+    return true;
+}
+
+LSTATUS HiveBackend::_PutValue(uint32_t key, const Char *name, size_t length, DWORD type, const BYTE *data, DWORD size)
+{
+    if (!_writable)
+        return ERROR_ACCESS_DENIED;
+    if (length > MaxValueNameLength)
+        return ERROR_INVALID_PARAMETER;
+
+    String folded(name, length);
+    size_t index;
+    uint32_t value = _FindValue(key, folded.c_str(), &index);
+    if (value == NoCell)
+    {
+        bool compressed = CanCompress(name, length);
+        uint32_t nameBytes = uint32_t(compressed ? length : length * 2);
+        if ((value = _Allocate(VkName + nameBytes)) == NoCell)
+            return ERROR_NOT_ENOUGH_MEMORY;
+        BYTE *vk = _Cell(value, VkName + nameBytes);
+        memset(vk, 0, VkName);
+        memcpy(vk, "vk", 2);
+        Put16(vk + VkNameLength, uint16_t(nameBytes));
+        Put32(vk + VkDataSize, DataResident);
+        Put16(vk + VkFlags, compressed ? ValueCompressedName : 0);
+        EncodeName(vk + VkName, name, length, compressed);
+
+        const BYTE *nk = _Cell(key, NkName);
+        uint32_t count = Get32(nk + NkValueCount);
+        uint32_t list = _Reallocate(count > 0 ? Get32(nk + NkValueList) : NoCell, (count + 1) * 4);
+        if (list == NoCell)
+        {
+            _Free(value);
+            return ERROR_NOT_ENOUGH_MEMORY;
+        }
+        Put32(_Cell(list, (count + 1) * 4) + count * 4, value);
+        _Dirty(list + 4 + count * 4, 4);
+
+        BYTE *node = _Cell(key, NkName);
+        Put32(node + NkValueCount, count + 1);
+        Put32(node + NkValueList, list);
+        Put32(node + NkMaxValueName, std::max(Get32(node + NkMaxValueName), uint32_t(length * 2)));
+        _DirtyCell(key);
+    }
+
+    if (!_StoreData(value, data, size))
+        return ERROR_NOT_ENOUGH_MEMORY;
+    Put32(_Cell(value, VkName) + VkType, type);
+    BYTE *nk = _Cell(key, NkName);
+    Put32(nk + NkMaxValueData, std::max(Get32(nk + NkMaxValueData), size));
+    _DirtyCell(key);
+    _Touch(key);
+    return ERROR_SUCCESS;
+}
+
+bool HiveBackend::_CopyInto(uint32_t src, uint32_t dest)
+{
+    std::vector<uint32_t> values;
+    if (!_Values(src, values))
+        return false;
+    String name;
+    ByteArray data;
+    for (auto it = values.begin(); it != values.end(); it++)
+    {
+        if (!_ValueName(*it, name) || !_ReadValueData(*it, data))
+            return false;
+        DWORD type = Get32(_Cell(*it, VkName) + VkType);
+        if (_PutValue(dest, name.c_str(), name.size(), type, data.data(), DWORD(data.size())) != ERROR_SUCCESS)
+            return false;
+    }
+
+    std::vector<ChildEntry> children;
+    if (!_Children(src, children))
+        return false;
+    for (auto it = children.begin(); it != children.end(); it++)
+    {
+        uint32_t destChild;
+        if (!_KeyName(it->key, name))
+            return false;
+        name.push_back(0);
+        if (_Walk(dest, name.c_str(), true, &destChild) != ERROR_SUCCESS || !_CopyInto(it->key, destChild))
+            return false;
+    }
+    return true;
+}
+
+LSTATUS HiveBackend::OpenKey(HKEY hKey, const Char *subKey, REGSAM, HKEY *result)
+{
+    std::shared_lock<std::shared_mutex> lock(_treeMutex);
+    uint32_t key;
+    LSTATUS status = _Resolve(hKey, &key);
+    if (status != ERROR_SUCCESS || (status = _Walk(key, subKey, false, &key)) != ERROR_SUCCESS)
+        return status;
+    *result = _NewHandle(key);
+    return ERROR_SUCCESS;
+}
+
+LSTATUS HiveBackend::CreateKey(HKEY hKey, const Char *subKey, REGSAM, HKEY *result)
+{
+    std::unique_lock<std::shared_mutex> lock(_treeMutex);
+    uint32_t key;
+    LSTATUS status = _Resolve(hKey, &key);
+    if (status != ERROR_SUCCESS || (status = _Walk(key, subKey, true, &key)) != ERROR_SUCCESS)
+        return status;
+    *result = _NewHandle(key);
+    return ERROR_SUCCESS;
+}
+
+LSTATUS HiveBackend::ConnectRegistry(const Char *host, HKEY hKey, HKEY *result)
+{
+    if (!IsPredefinedKey(hKey))
+        return ERROR_INVALID_HANDLE;
+    if (host != nullptr && *host != 0)
+        return ERROR_BAD_NETPATH;
+
+    std::shared_lock<std::shared_mutex> lock(_treeMutex);
+    uint32_t key;
+    LSTATUS status = _Resolve(hKey, &key);
+    if (status != ERROR_SUCCESS)
+        return status;
+    *result = _NewHandle(key);
+    return ERROR_SUCCESS;
+}
+
+LSTATUS HiveBackend::CloseKey(HKEY hKey)
+{
+    if (IsPredefinedKey(hKey))
+        return ERROR_SUCCESS;
+
+    uintptr_t index = (uintptr_t(hKey) >> 2) - 1;
+    std::lock_guard<std::mutex> lock(_handleMutex);
+    if (hKey == NULL || index >= _handles.size() || !_handles[index].used)
+        return ERROR_INVALID_HANDLE;
+    _handles[index].used = false;
+    _freeHandles.push_back(uint32_t(index));
+    return ERROR_SUCCESS;
+}
+
+LSTATUS HiveBackend::FlushKey(HKEY hKey)
+{
+    {
+        std::shared_lock<std::shared_mutex> lock(_treeMutex);
+        uint32_t key;
+        LSTATUS status = _Resolve(hKey, &key);
+        if (status != ERROR_SUCCESS)
+            return status;
+    }
+    return Flush();
+}
+
+LSTATUS HiveBackend::CopyTree(HKEY hSrc, const Char *subKey, HKEY hDest)
+{
+    std::unique_lock<std::shared_mutex> lock(_treeMutex);
+    uint32_t src, dest;
+    LSTATUS status = _Resolve(hSrc, &src);
+    if (status != ERROR_SUCCESS || (status = _Resolve(hDest, &dest)) != ERROR_SUCCESS)
+        return status;
+    if ((status = _Walk(src, subKey, false, &src)) != ERROR_SUCCESS)
+        return status;
+    if (!_writable)
+        return ERROR_ACCESS_DENIED;
+
+    uint32_t root = Get32(_image.data() + BaseRootCell);
+    for (uint32_t key = dest, depth = 0; depth < 512; depth++)
+    {
+        if (key == src)
+            return ERROR_INVALID_PARAMETER;
+        if (key == root || _Cell(key, NkName) == nullptr)
+            break;
+        key = Get32(_Cell(key, NkName) + NkParent);
+    }
+    return _CopyInto(src, dest) ? ERROR_SUCCESS : ERROR_BADDB;
+}
+
+LSTATUS HiveBackend::RenameKey(HKEY hKey, const Char *subKey, const Char *newName)
+{
+    if (newName == nullptr || *newName == 0)
+        return ERROR_INVALID_PARAMETER;
+    size_t length = STRLEN(newName);
+    for (const Char *p = newName; *p != 0; p++)
+    {
+        if (*p == '\\')
+            return ERROR_INVALID_PARAMETER;
+    }
+    if (length > MaxKeyNameLength)
+        return ERROR_INVALID_PARAMETER;
+
+    std::unique_lock<std::shared_mutex> lock(_treeMutex);
+    uint32_t key;
+    LSTATUS status = _Resolve(hKey, &key);
+    if (status != ERROR_SUCCESS || (status = _Walk(key, subKey, false, &key)) != ERROR_SUCCESS)
+        return status;
+    if (!_writable)
+        return ERROR_ACCESS_DENIED;
+    if (key == Get32(_image.data() + BaseRootCell))
+        return ERROR_ACCESS_DENIED;
+
+    uint32_t parent = Get32(_Cell(key, NkName) + NkParent);
+    std::vector<ChildEntry> children;
+    size_t position;
+    uint32_t sibling = _FindChild(parent, newName, length, children, &position);
+    if (sibling != NoCell && sibling != key)
+        return ERROR_ACCESS_DENIED;
+
+    bool compressed = CanCompress(newName, length);
+    uint32_t nameBytes = uint32_t(compressed ? length : length * 2);
+    uint32_t renamed = key;
+    if (_Cell(key, NkName + nameBytes) == nullptr)
+    {
+        // The name does not fit: move the node, then repoint its subkeys and handles.
+        if ((renamed = _Allocate(NkName + nameBytes)) == NoCell)
+            return ERROR_NOT_ENOUGH_MEMORY;
+        memcpy(_Cell(renamed, NkName), _Cell(key, NkName), NkName);
+        std::vector<ChildEntry> grandChildren;
+        _Children(renamed, grandChildren);
+        for (auto it = grandChildren.begin(); it != grandChildren.end(); it++)
+        {
+            BYTE *child = _Cell(it->key, NkName);
+            if (child != nullptr)
+            {
+                Put32(child + NkParent, renamed);
+                _Dirty(it->key + 4 + NkParent, 4);
+            }
+        }
+        std::lock_guard<std::mutex> handleLock(_handleMutex);
+        auto generation = _generations.find(renamed);
+        for (auto it = _handles.begin(); it != _handles.end(); it++)
+        {
+            if (it->used && it->key == key)
+            {
+                it->key = renamed;
+                it->generation = generation != _generations.end() ? generation->second : 0;
+            }
+        }
+    }
+
+    BYTE *nk = _Cell(renamed, NkName + nameBytes);
+    uint16_t flags = Get16(nk + NkFlags);
+    Put16(nk + NkFlags, compressed ? (flags | KeyCompressedName) : (flags & ~KeyCompressedName));
+    Put16(nk + NkNameLength, uint16_t(nameBytes));
+    EncodeName(nk + NkName, newName, length, compressed);
+    _DirtyCell(renamed);
+
+    _Children(parent, children);
+    for (auto it = children.begin(); it != children.end(); it++)
+    {
+        if (it->key == key)
+        {
+            children.erase(it);
+            break;
+        }
+    }
+    String childName;
+    auto it = std::lower_bound(children.begin(), children.end(), 0, [&](const ChildEntry &entry, int) {
+        if (!_KeyName(entry.key, childName))
+            childName.clear();
+        return RegString::CompareFold(childName.c_str(), childName.size(), newName, length) < 0;
+    });
+    ChildEntry entry = {renamed, 0, 0};
+    children.insert(it, entry);
+    if (!_SetChildren(parent, children))
+        return ERROR_NOT_ENOUGH_MEMORY;
+    if (renamed != key)
+        _Free(key);
+    _Touch(parent);
+    return ERROR_SUCCESS;
+}
+
+LSTATUS HiveBackend::DeleteTree(HKEY hKey, const Char *subKey)
+{
+    std::unique_lock<std::shared_mutex> lock(_treeMutex);
+    uint32_t key;
+    LSTATUS status = _Resolve(hKey, &key);
+    if (status != ERROR_SUCCESS || (status = _Walk(key, subKey, false, &key)) != ERROR_SUCCESS)
+        return status;
+    if (!_writable)
+        return ERROR_ACCESS_DENIED;
+
+    std::vector<ChildEntry> children;
+    if (subKey == nullptr || *subKey == 0)
+    {
+        // Only the contents go; the key itself stays.
+        if (!_Children(key, children))
+            return ERROR_BADDB;
+        for (auto it = children.begin(); it != children.end(); it++)
+        {
+            if (!_DeleteSubtree(it->key))
+                return ERROR_BADDB;
+        }
+        BYTE *nk = _Cell(key, NkName);
+        if (!children.empty())
+            _FreeList(Get32(nk + NkSubKeyList), 0);
+        Put32(nk + NkSubKeyCount, 0);
+        Put32(nk + NkSubKeyList, NoCell);
+
+        std::vector<uint32_t> values;
+        _Values(key, values);
+        for (auto it = values.begin(); it != values.end(); it++)
+        {
+            _FreeData(*it);
+            _Free(*it);
+        }
+        nk = _Cell(key, NkName);
+        uint32_t valueList = Get32(nk + NkValueList);
+        Put32(nk + NkValueCount, 0);
+        Put32(nk + NkValueList, NoCell);
+        _DirtyCell(key);
+        if (!values.empty())
+            _Free(valueList);
+        _Touch(key);
+        return ERROR_SUCCESS;
+    }
+
+    if (key == Get32(_image.data() + BaseRootCell))
+        return ERROR_ACCESS_DENIED;
+    uint32_t parent = Get32(_Cell(key, NkName) + NkParent);
+    if (!_Children(parent, children))
+        return ERROR_BADDB;
+    children.erase(std::remove_if(children.begin(), children.end(), [key](const ChildEntry &entry) {
+        return entry.key == key;
+    }), children.end());
+    if (!_SetChildren(parent, children))
+        return ERROR_NOT_ENOUGH_MEMORY;
+    _Touch(parent);
+    return _DeleteSubtree(key) ? ERROR_SUCCESS : ERROR_BADDB;
+}
+
+LSTATUS HiveBackend::DeleteKey(HKEY hKey, const Char *subKey)
+{
+    std::unique_lock<std::shared_mutex> lock(_treeMutex);
+    uint32_t key;
+    LSTATUS status = _Resolve(hKey, &key);
+    if (status != ERROR_SUCCESS || (status = _Walk(key, subKey, false, &key)) != ERROR_SUCCESS)
+        return status;
+    if (!_writable)
+        return ERROR_ACCESS_DENIED;
+
+    const BYTE *nk = _Cell(key, NkName);
+    if (key == Get32(_image.data() + BaseRootCell) || Get32(nk + NkSubKeyCount) > 0)
+        return ERROR_ACCESS_DENIED;
+    uint32_t parent = Get32(nk + NkParent);
+    std::vector<ChildEntry> children;
+    if (!_Children(parent, children))
+        return ERROR_BADDB;
+    children.erase(std::remove_if(children.begin(), children.end(), [key](const ChildEntry &entry) {
+        return entry.key == key;
+    }), children.end());
+    if (!_SetChildren(parent, children))
+        return ERROR_NOT_ENOUGH_MEMORY;
+    _FreeKey(key);
+    _Touch(parent);
+    return ERROR_SUCCESS;
+}
+
+LSTATUS HiveBackend::QueryInfoKey(HKEY hKey, RegKeyInfo *info)
+{
+    std::shared_lock<std::shared_mutex> lock(_treeMutex);
+    uint32_t key;
+    LSTATUS status = _Resolve(hKey, &key);
+    if (status != ERROR_SUCCESS)
+        return status;
+
+    std::vector<ChildEntry> children;
+    std::vector<uint32_t> values;
+    if (!_Children(key, children) || !_Values(key, values))
+        return ERROR_BADDB;
+
+    // Lengths come from the cells rather than the maximums in the node, which other
+    // tools do not always keep up to date.
+    const BYTE *nk = _Cell(key, NkName);
+    info->subKeys = DWORD(children.size());
+    info->values = DWORD(values.size());
+    info->maxSubKeyLength = 0;
+    info->maxValueNameLength = 0;
+    info->maxValueLength = 0;
+    memcpy(&info->lastWriteTime, nk + NkLastWritten, sizeof(info->lastWriteTime));
+    for (auto it = children.begin(); it != children.end(); it++)
+    {
+        const BYTE *child = _Cell(it->key, NkName);
+        if (child == nullptr)
+            return ERROR_BADDB;
+        DWORD length = Get16(child + NkNameLength);
+        if ((Get16(child + NkFlags) & KeyCompressedName) == 0)
+            length /= 2;
+        info->maxSubKeyLength = std::max(info->maxSubKeyLength, length);
+    }
+    for (auto it = values.begin(); it != values.end(); it++)
+    {
+        const BYTE *vk = _Cell(*it, VkName);
+        if (vk == nullptr)
+            return ERROR_BADDB;
+        DWORD length = Get16(vk + VkNameLength);
+        if ((Get16(vk + VkFlags) & ValueCompressedName) == 0)
+            length /= 2;
+        uint32_t raw = Get32(vk + VkDataSize);
+        DWORD size = (raw & DataResident) != 0 ? std::min<uint32_t>(raw & ~DataResident, 4) : raw;
+        info->maxValueNameLength = std::max(info->maxValueNameLength, length);
+        info->maxValueLength = std::max(info->maxValueLength, size);
+    }
+    return ERROR_SUCCESS;
+}
+
+LSTATUS HiveBackend::EnumKey(HKEY hKey, DWORD index, Char *name, DWORD *nameLength)
+{
+    std::shared_lock<std::shared_mutex> lock(_treeMutex);
+    uint32_t key;
+    LSTATUS status = _Resolve(hKey, &key);
+    if (status != ERROR_SUCCESS)
+        return status;
+
+    const BYTE *nk = _Cell(key, NkName);
+    if (nk == nullptr)
+        return ERROR_BADDB;
+    if (index >= Get32(nk + NkSubKeyCount))
+        return ERROR_NO_MORE_ITEMS;
+    String childName;
+    if (!_KeyName(_ChildAt(key, index), childName))
+        return ERROR_BADDB;
+    if (*nameLength < childName.size() + 1)
+        return ERROR_MORE_DATA;
+    std::copy(childName.begin(), childName.end(), name);
+    name[childName.size()] = 0;
+    *nameLength = DWORD(childName.size());
+    return ERROR_SUCCESS;
+}
+
+LSTATUS HiveBackend::EnumValue(HKEY hKey, DWORD index, Char *name, DWORD *nameLength,
+                               DWORD *type, BYTE *data, DWORD *dataSize)
+{
+    std::shared_lock<std::shared_mutex> lock(_treeMutex);
+    uint32_t key;
+    LSTATUS status = _Resolve(hKey, &key);
+    if (status != ERROR_SUCCESS)
+        return status;
+
+    const BYTE *nk = _Cell(key, NkName);
+    if (nk == nullptr)
+        return ERROR_BADDB;
+    uint32_t count = Get32(nk + NkValueCount);
+    if (index >= count)
+        return ERROR_NO_MORE_ITEMS;
+    const BYTE *list = _Cell(Get32(nk + NkValueList), (index + 1) * 4);
+    String valueName;
+    uint32_t value = list != nullptr ? Get32(list + index * 4) : NoCell;
+    if (!_ValueName(value, valueName))
+        return ERROR_BADDB;
+    if (*nameLength < valueName.size() + 1)
+        return ERROR_MORE_DATA;
+    std::copy(valueName.begin(), valueName.end(), name);
+    name[valueName.size()] = 0;
+    *nameLength = DWORD(valueName.size());
+    return _ValueData(value, type, data, dataSize);
+}
+
+LSTATUS HiveBackend::QueryValue(HKEY hKey, const Char *name, DWORD *type, BYTE *data, DWORD *dataSize)
+{
+    if (data != nullptr && dataSize == nullptr)
+        return ERROR_INVALID_PARAMETER;
+
+    std::shared_lock<std::shared_mutex> lock(_treeMutex);
+    uint32_t key;
+    LSTATUS status = _Resolve(hKey, &key);
+    if (status != ERROR_SUCCESS)
+        return status;
+
+    size_t index;
+    uint32_t value = _FindValue(key, name, &index);
+    if (value == NoCell)
+        return ERROR_FILE_NOT_FOUND;
+    return _ValueData(value, type, data, dataSize);
+}
+
+LSTATUS HiveBackend::SetValue(HKEY hKey, const Char *name, DWORD type, const BYTE *data, DWORD dataSize)
+{
+    if (data == nullptr && dataSize > 0)
+        return ERROR_INVALID_PARAMETER;
+
+    std::unique_lock<std::shared_mutex> lock(_treeMutex);
+    uint32_t key;
+    LSTATUS status = _Resolve(hKey, &key);
+    if (status != ERROR_SUCCESS)
+        return status;
+    if (name == nullptr)
+        name = STR("");
+    return _PutValue(key, name, STRLEN(name), type, data, dataSize);
+}
+
+LSTATUS HiveBackend::DeleteValue(HKEY hKey, const Char *name)
+{
+    std::unique_lock<std::shared_mutex> lock(_treeMutex);
+    uint32_t key;
+    LSTATUS status = _Resolve(hKey, &key);
+    if (status != ERROR_SUCCESS)
+        return status;
+
+    size_t index;
+    uint32_t value = _FindValue(key, name, &index);
+    if (value == NoCell)
+        return ERROR_FILE_NOT_FOUND;
+    if (!_writable)
+        return ERROR_ACCESS_DENIED;
+
+    _FreeData(value);
+    _Free(value);
+    BYTE *nk = _Cell(key, NkName);
+    uint32_t count = Get32(nk + NkValueCount);
+    uint32_t list = Get32(nk + NkValueList);
+    BYTE *entries = _Cell(list, count * 4);
+    memmove(entries + index * 4, entries + (index + 1) * 4, (count - index - 1) * 4);
+    _Dirty(list + 4, count * 4);
+    Put32(nk + NkValueCount, count - 1);
+    if (count == 1)
+    {
+        Put32(nk + NkValueList, NoCell);
+        _Free(list);
+    }
+    _DirtyCell(key);
+    _Touch(key);
+    return ERROR_SUCCESS;
+}
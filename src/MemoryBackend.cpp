@@ -0,0 +1,722 @@
+#include "MemoryBackend.h"
+#include "RegString.h"
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+
+namespace
+{
+    const struct
+    {
+        HKEY key;
+        const Char *name;
+    } predefinedKeys[] = {
+        {HKEY_CLASSES_ROOT, STR("HKEY_CLASSES_ROOT")},
+        {HKEY_CURRENT_USER, STR("HKEY_CURRENT_USER")},
+        {HKEY_LOCAL_MACHINE, STR("HKEY_LOCAL_MACHINE")},
+        {HKEY_USERS, STR("HKEY_USERS")},
+        {HKEY_PERFORMANCE_DATA, STR("HKEY_PERFORMANCE_DATA")},
+        {HKEY_CURRENT_CONFIG, STR("HKEY_CURRENT_CONFIG")},
+        {HKEY_PERFORMANCE_TEXT, STR("HKEY_PERFORMANCE_TEXT")},
+        {HKEY_PERFORMANCE_NLSTEXT, STR("HKEY_PERFORMANCE_NLSTEXT")},
+    };
+
+    bool IsPredefinedKey(HKEY hKey)
+    {
+        for (size_t i = 0; i < sizeof(predefinedKeys) / sizeof(predefinedKeys[0]); i++)
+        {
+            if (predefinedKeys[i].key == hKey)
+                return true;
+        }
+        return false;
+    }
+
+    uint32_t PredefinedKeyId(HKEY hKey)
+    {
+        return uint32_t(uintptr_t(hKey));
+    }
+
+    String FoldString(const Char *str, size_t length)
+    {
+        return RegString::Fold(str, length);
+    }
+
+    QWORD CurrentFileTime()
+    {
+        // FILETIME counts 100ns intervals from 1601, the system clock from 1970.
+        auto sinceEpoch = std::chrono::system_clock::now().time_since_epoch();
+        return QWORD(std::chrono::duration_cast<std::chrono::microseconds>(sinceEpoch).count()) * 10 +
+               116444736000000000ULL;
+    }
+}
+
+MemoryArena::MemoryArena()
+    : _cursor(nullptr)
+    , _remaining(0)
+{
+    for (int i = 0; i < SizeClasses; i++)
+        _freeLists[i] = nullptr;
+}
+
+MemoryArena::~MemoryArena()
+{
+    for (auto it = _chunks.begin(); it != _chunks.end(); it++)
+        delete[] *it;
+}
+
+BYTE *MemoryArena::Allocate(DWORD size, DWORD *capacity)
+{
+    if (size == 0)
+    {
+        *capacity = 0;
+        return nullptr;
+    }
+
+    int sizeClass = 0;
+    DWORD blockSize = MinBlockSize;
+    while (blockSize < size && sizeClass < SizeClasses)
+    {
+        blockSize <<= 1;
+        sizeClass++;
+    }
+    if (sizeClass == SizeClasses)
+    {
+        *capacity = size;
+        return new BYTE[size];
+    }
+
+    *capacity = blockSize;
+    BYTE *block = _freeLists[sizeClass];
+    if (block != nullptr)
+    {
+        memcpy(&_freeLists[sizeClass], block, sizeof(BYTE *));
+        return block;
+    }
+
+    if (_remaining < blockSize)
+    {
+        // The tail of the previous chunk is handed to the free lists instead of being lost.
+        while (_remaining >= MinBlockSize)
+        {
+            DWORD tailSize = MinBlockSize;
+            int tailClass = 0;
+            while ((tailSize << 1) <= _remaining && tailClass + 1 < SizeClasses)
+            {
+                tailSize <<= 1;
+                tailClass++;
+            }
+            Free(_cursor, tailSize);
+            _cursor += tailSize;
+            _remaining -= tailSize;
+        }
+        _cursor = new BYTE[ChunkSize];
+        _remaining = ChunkSize;
+        _chunks.push_back(_cursor);
+    }
+
+    block = _cursor;
+    _cursor += blockSize;
+    _remaining -= blockSize;
+    return block;
+}
+
+void MemoryArena::Free(BYTE *data, DWORD capacity)
+{
+    if (data == nullptr)
+        return;
+
+    int sizeClass = 0;
+    DWORD blockSize = MinBlockSize;
+    while (blockSize < capacity && sizeClass < SizeClasses)
+    {
+        blockSize <<= 1;
+        sizeClass++;
+    }
+    if (sizeClass == SizeClasses || blockSize != capacity)
+    {
+        delete[] data;
+        return;
+    }
+
+    memcpy(data, &_freeLists[sizeClass], sizeof(BYTE *));
+    _freeLists[sizeClass] = data;
+}
+
+MemoryBackend::MemoryBackend()
+{
+    for (size_t i = 0; i < sizeof(predefinedKeys) / sizeof(predefinedKeys[0]); i++)
+        _GetRoot(STR(""), predefinedKeys[i].key);
+}
+
+MemoryBackend::~MemoryBackend()
+{
+    for (auto node = _nodes.begin(); node != _nodes.end(); node++)
+    {
+        for (auto value = node->values.begin(); value != node->values.end(); value++)
+            _arena.Free(value->data, value->capacity);
+    }
+}
+
+uint32_t MemoryBackend::_NewNode(uint32_t parent, const String &name, const String &foldedName)
+{
+    uint32_t id;
+    if (!_freeNodes.empty())
+    {
+        id = _freeNodes.back();
+        _freeNodes.pop_back();
+    }
+    else
+    {
+        id = uint32_t(_nodes.size());
+        _nodes.emplace_back();
+        _nodes[id].generation = 0;
+    }
+
+    MemoryNode &node = _nodes[id];
+    node.name = name;
+    node.foldedName = foldedName;
+    node.parent = parent;
+    node.live = true;
+    node.lastWriteTime = CurrentFileTime();
+    return id;
+}
+
+uint32_t MemoryBackend::_GetRoot(const String &host, HKEY baseKey)
+{
+    auto root = std::make_pair(FoldString(host.c_str(), host.size()), PredefinedKeyId(baseKey));
+    auto it = _roots.find(root);
+    if (it != _roots.end())
+        return it->second;
+
+    String name;
+    for (size_t i = 0; i < sizeof(predefinedKeys) / sizeof(predefinedKeys[0]); i++)
+    {
+        if (predefinedKeys[i].key == baseKey)
+            name = predefinedKeys[i].name;
+    }
+    uint32_t node = _NewNode(NoNode, name, FoldString(name.c_str(), name.size()));
+    _roots[root] = node;
+    return node;
+}
+
+LSTATUS MemoryBackend::_Resolve(HKEY hKey, uint32_t *node) const
+{
+    if (IsPredefinedKey(hKey))
+    {
+        auto it = _roots.find(std::make_pair(String(), PredefinedKeyId(hKey)));
+        if (it == _roots.end())
+            return ERROR_INVALID_HANDLE;
+        *node = it->second;
+        return ERROR_SUCCESS;
+    }
+
+    uintptr_t index = (uintptr_t(hKey) >> 2) - 1;
+    std::shared_lock<std::shared_mutex> lock(_handleMutex);
+    if (hKey == NULL || index >= _handles.size() || !_handles[index].used)
+        return ERROR_INVALID_HANDLE;
+
+    const HandleSlot &slot = _handles[index];
+    if (!_nodes[slot.node].live || _nodes[slot.node].generation != slot.generation)
+        return ERROR_KEY_DELETED;
+    *node = slot.node;
+    return ERROR_SUCCESS;
+}
+
+uint32_t MemoryBackend::_FindChild(uint32_t parent, const String &foldedName) const
+{
+    const std::vector<uint32_t> &children = _nodes[parent].children;
+    auto it = std::lower_bound(children.begin(), children.end(), foldedName,
+                               [this](uint32_t child, const String &name) {
+                                   return _nodes[child].foldedName < name;
+                               });
+    if (it != children.end() && _nodes[*it].foldedName == foldedName)
+        return *it;
+    return NoNode;
+}
+
+void MemoryBackend::_InsertChild(uint32_t parent, uint32_t child)
+{
+    std::vector<uint32_t> &children = _nodes[parent].children;
+    const String &foldedName = _nodes[child].foldedName;
+    auto it = std::lower_bound(children.begin(), children.end(), foldedName,
+                               [this](uint32_t sibling, const String &name) {
+                                   return _nodes[sibling].foldedName < name;
+                               });
+    children.insert(it, child);
+}
+
+void MemoryBackend::_RemoveChild(uint32_t parent, uint32_t child)
+{
+    std::vector<uint32_t> &children = _nodes[parent].children;
+    children.erase(std::remove(children.begin(), children.end(), child), children.end());
+}
+
+LSTATUS MemoryBackend::_Walk(uint32_t from, const Char *path, bool create, uint32_t *node)
+{
+    uint32_t current = from;
+    const Char *p = path;
+    while (p != nullptr && *p != 0)
+    {
+        const Char *end = p;
+        while (*end != 0 && *end != '\\')
+            end++;
+        if (end != p)
+        {
+            String folded = FoldString(p, end - p);
+            uint32_t child = _FindChild(current, folded);
+            if (child == NoNode)
+            {
+                if (!create)
+                    return ERROR_FILE_NOT_FOUND;
+                child = _NewNode(current, String(p, end - p), folded);
+                _InsertChild(current, child);
+                _Touch(current);
+            }
+            current = child;
+        }
+        p = *end != 0 ? end + 1 : end;
+    }
+    *node = current;
+    return ERROR_SUCCESS;
+}
+
+MemoryValue *MemoryBackend::_FindValue(uint32_t node, const Char *name)
+{
+    String folded = name != nullptr ? FoldString(name, STRLEN(name)) : String();
+    uint32_t hash = RegString::HashFold(folded);
+    std::vector<MemoryValue> &values = _nodes[node].values;
+    for (auto it = values.begin(); it != values.end(); it++)
+    {
+        if (it->hash == hash && it->foldedName == folded)
+            return &*it;
+    }
+    return nullptr;
+}
+
+void MemoryBackend::_PutValue(uint32_t node, const String &name, DWORD type, const BYTE *data, DWORD size)
+{
+    MemoryValue *value = _FindValue(node, name.c_str());
+    if (value == nullptr)
+    {
+        MemoryValue newValue;
+        newValue.name = name;
+        newValue.foldedName = FoldString(name.c_str(), name.size());
+        newValue.hash = RegString::HashFold(newValue.foldedName);
+        newValue.size = 0;
+        newValue.capacity = 0;
+        newValue.data = nullptr;
+        _nodes[node].values.push_back(newValue);
+        value = &_nodes[node].values.back();
+    }
+
+    if (value->capacity < size)
+    {
+        _arena.Free(value->data, value->capacity);
+        value->data = _arena.Allocate(size, &value->capacity);
+    }
+    if (size > 0)
+        memcpy(value->data, data, size);
+    value->type = type;
+    value->size = size;
+    _Touch(node);
+}
+
+void MemoryBackend::_ClearNode(uint32_t node)
+{
+    for (auto it = _nodes[node].values.begin(); it != _nodes[node].values.end(); it++)
+        _arena.Free(it->data, it->capacity);
+    _nodes[node].values.clear();
+
+    std::vector<uint32_t> children;
+    children.swap(_nodes[node].children);
+    for (auto it = children.begin(); it != children.end(); it++)
+        _FreeSubtree(*it);
+    _Touch(node);
+}
+
+void MemoryBackend::_FreeSubtree(uint32_t node)
+{
+    std::vector<uint32_t> pending(1, node);
+    while (!pending.empty())
+    {
+        uint32_t current = pending.back();
+        pending.pop_back();
+
+        MemoryNode &entry = _nodes[current];
+        pending.insert(pending.end(), entry.children.begin(), entry.children.end());
+        for (auto it = entry.values.begin(); it != entry.values.end(); it++)
+            _arena.Free(it->data, it->capacity);
+
+        entry.values.clear();
+        entry.values.shrink_to_fit();
+        entry.children.clear();
+        entry.children.shrink_to_fit();
+        entry.name.clear();
+        entry.foldedName.clear();
+        entry.live = false;
+        entry.generation++;
+        _freeNodes.push_back(current);
+    }
+}
+
+void MemoryBackend::_CopyInto(uint32_t src, uint32_t dest)
+{
+    for (size_t i = 0; i < _nodes[src].values.size(); i++)
+    {
+        const MemoryValue &value = _nodes[src].values[i];
+        _PutValue(dest, value.name, value.type, value.data, value.size);
+    }
+
+    std::vector<uint32_t> children = _nodes[src].children;
+    for (auto it = children.begin(); it != children.end(); it++)
+    {
+        // Copied first, _NewNode may grow the node vector.
+        String name = _nodes[*it].name;
+        String foldedName = _nodes[*it].foldedName;
+        uint32_t destChild = _FindChild(dest, foldedName);
+        if (destChild == NoNode)
+        {
+            destChild = _NewNode(dest, name, foldedName);
+            _InsertChild(dest, destChild);
+            _Touch(dest);
+        }
+        _CopyInto(*it, destChild);
+    }
+}
+
+void MemoryBackend::_Touch(uint32_t node)
+{
+    _nodes[node].lastWriteTime = CurrentFileTime();
+}
+
+HKEY MemoryBackend::_NewHandle(uint32_t node)
+{
+    std::unique_lock<std::shared_mutex> lock(_handleMutex);
+    uint32_t index;
+    if (!_freeHandles.empty())
+    {
+        index = _freeHandles.back();
+        _freeHandles.pop_back();
+    }
+    else
+    {
+        index = uint32_t(_handles.size());
+        _handles.emplace_back();
+    }
+
+    HandleSlot &slot = _handles[index];
+    slot.node = node;
+    slot.generation = _nodes[node].generation;
+    slot.used = true;
+    return HKEY(uintptr_t(index + 1) << 2);
+}
+
+LSTATUS MemoryBackend::OpenKey(HKEY hKey, const Char *subKey, REGSAM, HKEY *result)
+{
+    std::shared_lock<std::shared_mutex> lock(_treeMutex);
+    uint32_t node;
+    LSTATUS status = _Resolve(hKey, &node);
+    if (status != ERROR_SUCCESS)
+        return status;
+    if ((status = _Walk(node, subKey, false, &node)) != ERROR_SUCCESS)
+        return status;
+    *result = _NewHandle(node);
+    return ERROR_SUCCESS;
+}
+
+LSTATUS MemoryBackend::CreateKey(HKEY hKey, const Char *subKey, REGSAM, HKEY *result)
+{
+    std::unique_lock<std::shared_mutex> lock(_treeMutex);
+    uint32_t node;
+    LSTATUS status = _Resolve(hKey, &node);
+    if (status != ERROR_SUCCESS)
+        return status;
+    if ((status = _Walk(node, subKey, true, &node)) != ERROR_SUCCESS)
+        return status;
+    *result = _NewHandle(node);
+    return ERROR_SUCCESS;
+}
+
+LSTATUS MemoryBackend::ConnectRegistry(const Char *host, HKEY hKey, HKEY *result)
+{
+    if (!IsPredefinedKey(hKey))
+        return ERROR_INVALID_HANDLE;
+
+    String hostname = host != nullptr ? host : STR("");
+    while (!hostname.empty() && hostname[0] == '\\')
+        hostname.erase(0, 1);
+
+    std::unique_lock<std::shared_mutex> lock(_treeMutex);
+    *result = _NewHandle(_GetRoot(hostname, hKey));
+    return ERROR_SUCCESS;
+}
+
+LSTATUS MemoryBackend::CloseKey(HKEY hKey)
+{
+    if (IsPredefinedKey(hKey))
+        return ERROR_SUCCESS;
+
+    uintptr_t index = (uintptr_t(hKey) >> 2) - 1;
+    std::unique_lock<std::shared_mutex> lock(_handleMutex);
+    if (hKey == NULL || index >= _handles.size() || !_handles[index].used)
+        return ERROR_INVALID_HANDLE;
+    _handles[index].used = false;
+    _freeHandles.push_back(uint32_t(index));
+    return ERROR_SUCCESS;
+}
+
+LSTATUS MemoryBackend::FlushKey(HKEY hKey)
+{
+    std::shared_lock<std::shared_mutex> lock(_treeMutex);
+    uint32_t node;
+    return _Resolve(hKey, &node);
+}
+
+LSTATUS MemoryBackend::CopyTree(HKEY hSrc, const Char *subKey, HKEY hDest)
+{
+    std::unique_lock<std::shared_mutex> lock(_treeMutex);
+    uint32_t src, dest;
+    LSTATUS status = _Resolve(hSrc, &src);
+    if (status != ERROR_SUCCESS || (status = _Resolve(hDest, &dest)) != ERROR_SUCCESS)
+        return status;
+    if ((status = _Walk(src, subKey, false, &src)) != ERROR_SUCCESS)
+        return status;
+
+    for (uint32_t node = dest; node != NoNode; node = _nodes[node].parent)
+    {
+        if (node == src)
+            return ERROR_INVALID_PARAMETER;
+    }
+    _CopyInto(src, dest);
+    return ERROR_SUCCESS;
+}
+
+LSTATUS MemoryBackend::RenameKey(HKEY hKey, const Char *subKey, const Char *newName)
+{
+    if (newName == nullptr || *newName == 0)
+        return ERROR_INVALID_PARAMETER;
+    for (const Char *p = newName; *p != 0; p++)
+    {
+        if (*p == '\\')
+            return ERROR_INVALID_PARAMETER;
+    }
+
+    std::unique_lock<std::shared_mutex> lock(_treeMutex);
+    uint32_t node;
+    LSTATUS status = _Resolve(hKey, &node);
+    if (status != ERROR_SUCCESS || (status = _Walk(node, subKey, false, &node)) != ERROR_SUCCESS)
+        return status;
+
+    uint32_t parent = _nodes[node].parent;
+    if (parent == NoNode)
+        return ERROR_ACCESS_DENIED;
+
+    String folded = FoldString(newName, STRLEN(newName));
+    uint32_t sibling = _FindChild(parent, folded);
+    if (sibling != NoNode && sibling != node)
+        return ERROR_ACCESS_DENIED;
+
+    _RemoveChild(parent, node);
+    _nodes[node].name = newName;
+    _nodes[node].foldedName = folded;
+    _InsertChild(parent, node);
+    _Touch(parent);
+    return ERROR_SUCCESS;
+}
+
+LSTATUS MemoryBackend::DeleteTree(HKEY hKey, const Char *subKey)
+{
+    std::unique_lock<std::shared_mutex> lock(_treeMutex);
+    uint32_t node;
+    LSTATUS status = _Resolve(hKey, &node);
+    if (status != ERROR_SUCCESS)
+        return status;
+
+    if (subKey == nullptr || *subKey == 0)
+    {
+        _ClearNode(node);
+        return ERROR_SUCCESS;
+    }
+
+    if ((status = _Walk(node, subKey, false, &node)) != ERROR_SUCCESS)
+        return status;
+    uint32_t parent = _nodes[node].parent;
+    if (parent == NoNode)
+        return ERROR_ACCESS_DENIED;
+    _RemoveChild(parent, node);
+    _FreeSubtree(node);
+    _Touch(parent);
+    return ERROR_SUCCESS;
+}
+
+LSTATUS MemoryBackend::DeleteKey(HKEY hKey, const Char *subKey)
+{
+    std::unique_lock<std::shared_mutex> lock(_treeMutex);
+    uint32_t node;
+    LSTATUS status = _Resolve(hKey, &node);
+    if (status != ERROR_SUCCESS || (status = _Walk(node, subKey, false, &node)) != ERROR_SUCCESS)
+        return status;
+
+    uint32_t parent = _nodes[node].parent;
+    if (parent == NoNode || !_nodes[node].children.empty())
+        return ERROR_ACCESS_DENIED;
+    _RemoveChild(parent, node);
+    _FreeSubtree(node);
+    _Touch(parent);
+    return ERROR_SUCCESS;
+}
+
+LSTATUS MemoryBackend::QueryInfoKey(HKEY hKey, RegKeyInfo *info)
+{
+    std::shared_lock<std::shared_mutex> lock(_treeMutex);
+    uint32_t node;
+    LSTATUS status = _Resolve(hKey, &node);
+    if (status != ERROR_SUCCESS)
+        return status;
+
+    const MemoryNode &entry = _nodes[node];
+    info->subKeys = DWORD(entry.children.size());
+    info->values = DWORD(entry.values.size());
+    info->maxSubKeyLength = 0;
+    info->maxValueNameLength = 0;
+    info->maxValueLength = 0;
+    info->lastWriteTime = entry.lastWriteTime;
+    for (auto it = entry.children.begin(); it != entry.children.end(); it++)
+        info->maxSubKeyLength = std::max(info->maxSubKeyLength, DWORD(_nodes[*it].name.size()));
+    for (auto it = entry.values.begin(); it != entry.values.end(); it++)
+    {
+        info->maxValueNameLength = std::max(info->maxValueNameLength, DWORD(it->name.size()));
+        info->maxValueLength = std::max(info->maxValueLength, it->size);
+    }
+    return ERROR_SUCCESS;
+}
+
+LSTATUS MemoryBackend::EnumKey(HKEY hKey, DWORD index, Char *name, DWORD *nameLength)
+{
+    std::shared_lock<std::shared_mutex> lock(_treeMutex);
+    uint32_t node;
+    LSTATUS status = _Resolve(hKey, &node);
+    if (status != ERROR_SUCCESS)
+        return status;
+
+    const std::vector<uint32_t> &children = _nodes[node].children;
+    if (index >= children.size())
+        return ERROR_NO_MORE_ITEMS;
+
+    const String &childName = _nodes[children[index]].name;
+    if (*nameLength < childName.size() + 1)
+        return ERROR_MORE_DATA;
+    std::copy(childName.begin(), childName.end(), name);
+    name[childName.size()] = 0;
+    *nameLength = DWORD(childName.size());
+    return ERROR_SUCCESS;
+}
+
+LSTATUS MemoryBackend::EnumValue(HKEY hKey, DWORD index, Char *name, DWORD *nameLength,
+                                 DWORD *type, BYTE *data, DWORD *dataSize)
+{
+    std::shared_lock<std::shared_mutex> lock(_treeMutex);
+    uint32_t node;
+    LSTATUS status = _Resolve(hKey, &node);
+    if (status != ERROR_SUCCESS)
+        return status;
+
+    const std::vector<MemoryValue> &values = _nodes[node].values;
+    if (index >= values.size())
+        return ERROR_NO_MORE_ITEMS;
+
+    const MemoryValue &value = values[index];
+    if (*nameLength < value.name.size() + 1)
+        return ERROR_MORE_DATA;
+    std::copy(value.name.begin(), value.name.end(), name);
+    name[value.name.size()] = 0;
+    *nameLength = DWORD(value.name.size());
+
+    if (type != nullptr)
+        *type = value.type;
+    if (dataSize != nullptr)
+    {
+        DWORD bufferSize = *dataSize;
+        *dataSize = value.size;
+        if (data != nullptr)
+        {
+            if (bufferSize < value.size)
+                return ERROR_MORE_DATA;
+            if (value.size > 0)
+                memcpy(data, value.data, value.size);
+        }
+    }
+    return ERROR_SUCCESS;
+}
+
+LSTATUS MemoryBackend::QueryValue(HKEY hKey, const Char *name, DWORD *type, BYTE *data, DWORD *dataSize)
+{
+    if (data != nullptr && dataSize == nullptr)
+        return ERROR_INVALID_PARAMETER;
+
+    std::shared_lock<std::shared_mutex> lock(_treeMutex);
+    uint32_t node;
+    LSTATUS status = _Resolve(hKey, &node);
+    if (status != ERROR_SUCCESS)
+        return status;
+
+    const MemoryValue *value = _FindValue(node, name);
+    if (value == nullptr)
+        return ERROR_FILE_NOT_FOUND;
+
+    if (type != nullptr)
+        *type = value->type;
+    if (dataSize != nullptr)
+    {
+        DWORD bufferSize = *dataSize;
+        *dataSize = value->size;
+        if (data != nullptr)
+        {
+            if (bufferSize < value->size)
+                return ERROR_MORE_DATA;
+            if (value->size > 0)
+                memcpy(data, value->data, value->size);
+        }
+    }
+    return ERROR_SUCCESS;
+}
+
+LSTATUS MemoryBackend::SetValue(HKEY hKey, const Char *name, DWORD type, const BYTE *data, DWORD dataSize)
+{
+    if (data == nullptr && dataSize > 0)
+        return ERROR_INVALID_PARAMETER;
+
+    std::unique_lock<std::shared_mutex> lock(_treeMutex);
+    uint32_t node;
+    LSTATUS status = _Resolve(hKey, &node);
+    if (status != ERROR_SUCCESS)
+        return status;
+    _PutValue(node, name != nullptr ? name : STR(""), type, data, dataSize);
+    return ERROR_SUCCESS;
+}
+
+LSTATUS MemoryBackend::DeleteValue(HKEY hKey, const Char *name)
+{
+    std::unique_lock<std::shared_mutex> lock(_treeMutex);
+    uint32_t node;
+    LSTATUS status = _Resolve(hKey, &node);
+    if (status != ERROR_SUCCESS)
+        return status;
+
+    MemoryValue *value = _FindValue(node, name);
+    if (value == nullptr)
+        return ERROR_FILE_NOT_FOUND;
+
+    std::vector<MemoryValue> &values = _nodes[node].values;
+    _arena.Free(value->data, value->capacity);
+    values.erase(values.begin() + (value - values.data()));
+    _Touch(node);
+    return ERROR_SUCCESS;
+}
+
+void MemoryBackend::Clear()
+{
+    std::unique_lock<std::shared_mutex> lock(_treeMutex);
+    for (auto it = _roots.begin(); it != _roots.end(); it++)
+        _ClearNode(it->second);
+}
@@ -0,0 +1,93 @@
+#include "RegBackend.h"
+#include "MemoryBackend.h"
+#include "Win32Backend.h"
+#include "RegRecorder.h"
+#include <map>
+#include <mutex>
+
+namespace
+{
+    std::mutex defaultBackendMutex;
+    std::shared_ptr<RegBackend> defaultBackend;
+
+    std::mutex mountMutex;
+    std::map<std::string, std::shared_ptr<RegBackend>> mounted;
+}
+
+std::shared_ptr<RegBackend> RegBackend::_Find(const std::string &name)
+{
+#ifdef _WIN32
+    static std::shared_ptr<RegBackend> win32 = std::make_shared<Win32Backend>();
+    if (name == "win32")
+        return win32;
+#endif
+    static std::shared_ptr<RegBackend> memory = std::make_shared<MemoryBackend>();
+    if (name == "memory")
+        return memory;
+
+    std::lock_guard<std::mutex> lock(mountMutex);
+    auto it = mounted.find(name);
+    return it != mounted.end() ? it->second : nullptr;
+}
+
+std::shared_ptr<RegBackend> RegBackend::Get(const std::string &name)
+{
+    std::shared_ptr<RegBackend> backend = _Find(name);
+    return backend ? RegRecorder::Wrap(backend) : nullptr;
+}
+
+std::shared_ptr<RegBackend> RegBackend::GetDefault()
+{
+    std::shared_ptr<RegBackend> backend;
+    {
+        std::lock_guard<std::mutex> lock(defaultBackendMutex);
+        if (!defaultBackend)
+        {
+#ifdef _WIN32
+            defaultBackend = _Find("win32");
+#else
+            defaultBackend = _Find("memory");
+#endif
+        }
+        backend = defaultBackend;
+    }
+    return RegRecorder::Wrap(backend);
+}
+
+bool RegBackend::SetDefault(const std::string &name)
+{
+    std::shared_ptr<RegBackend> backend = _Find(name);
+    if (!backend)
+        return false;
+
+    std::lock_guard<std::mutex> lock(defaultBackendMutex);
+    defaultBackend = backend;
+    return true;
+}
+
+bool RegBackend::Mount(const std::string &name, const std::shared_ptr<RegBackend> &backend)
+{
+    if (name.empty() || name == "memory" || name == "win32" || !backend)
+        return false;
+
+    std::lock_guard<std::mutex> lock(mountMutex);
+    return mounted.emplace(name, backend).second;
+}
+
+std::shared_ptr<RegBackend> RegBackend::Unmount(const std::string &name)
+{
+    std::shared_ptr<RegBackend> backend;
+    {
+        std::lock_guard<std::mutex> lock(mountMutex);
+        auto it = mounted.find(name);
+        if (it == mounted.end())
+            return nullptr;
+        backend = it->second;
+        mounted.erase(it);
+    }
+
+    std::lock_guard<std::mutex> lock(defaultBackendMutex);
+    if (defaultBackend == backend)
+        defaultBackend.reset();
+    return backend;
+}
@@ -0,0 +1,189 @@
+#include "RegBatch.h"
+#include "RegCodec.h"
+#include "RegString.h"
+#include <algorithm>
+#include <map>
+#include <numeric>
+
+namespace
+{
+    String ParentOf(const String &subKey)
+    {
+        size_t pos = subKey.find_last_of(STR('\\'));
+        return pos == String::npos ? String() : subKey.substr(0, pos);
+    }
+
+    bool SameRoot(const RegReadRequest &a, const RegReadRequest &b)
+    {
+        return a.baseKey == b.baseKey && RegString::EqualsFold(a.host, b.host);
+    }
+}
+
+RegBatchReader::RegBatchReader(const std::shared_ptr<RegBackend> &backend,
+                               std::vector<RegReadRequest> &&requests,
+                               REGSAM access)
+    : _backend(backend)
+    , _requests(std::move(requests))
+    , _results(_requests.size())
+    , _access(access)
+    , _openCount(0)
+{
+    // Until served; requests still pending after a task failed take the failure.
+    for (auto it = _results.begin(); it != _results.end(); it++)
+        it->status = ERROR_IO_PENDING;
+}
+
+void RegBatchReader::Run()
+{
+    std::vector<size_t> order(_requests.size());
+    std::iota(order.begin(), order.end(), size_t(0));
+    std::sort(order.begin(), order.end(), [this](size_t a, size_t b) {
+        const RegReadRequest &ra = _requests[a];
+        const RegReadRequest &rb = _requests[b];
+        int host = RegString::CompareFold(ra.host.c_str(), ra.host.size(), rb.host.c_str(), rb.host.size());
+        if (host != 0)
+            return host < 0;
+        if (ra.baseKey != rb.baseKey)
+            return uintptr_t(ra.baseKey) < uintptr_t(rb.baseKey);
+        return RegString::CompareFold(ra.subKey.c_str(), ra.subKey.size(), rb.subKey.c_str(), rb.subKey.size()) < 0;
+    });
+
+    RegTaskGroup group;
+    std::vector<std::unique_ptr<RegKey>> connections;
+    for (size_t begin = 0; begin < order.size();)
+    {
+        const RegReadRequest &first = _requests[order[begin]];
+        size_t end = begin + 1;
+        while (end < order.size() && SameRoot(first, _requests[order[end]]))
+            end++;
+
+        HKEY root = first.baseKey;
+        if (!first.host.empty())
+        {
+            std::unique_ptr<RegKey> connection(new RegKey(_backend));
+            if (connection->Connect(first.host, first.baseKey) == NULL)
+            {
+                for (size_t i = begin; i < end; i++)
+                    _Fail(order[i], connection->GetLastStatus());
+                begin = end;
+                continue;
+            }
+            root = connection->GetHandle();
+            connections.push_back(std::move(connection));
+        }
+
+        // Requests stay in path order inside each parent, so repeated keys are adjacent.
+        std::map<String, std::vector<size_t>> parents;
+        for (size_t i = begin; i < end; i++)
+            parents[RegString::Fold(ParentOf(_requests[order[i]].subKey))].push_back(order[i]);
+        for (auto it = parents.begin(); it != parents.end(); it++)
+        {
+            String parent = ParentOf(_requests[it->second.front()].subKey);
+            std::vector<size_t> indexes = std::move(it->second);
+            group.Run([this, root, parent, indexes]() {
+                _ReadGroup(root, parent, indexes);
+            });
+        }
+        begin = end;
+    }
+    group.Wait();
+
+    LSTATUS status = group.GetStatus();
+    if (status == ERROR_SUCCESS)
+        return;
+    for (size_t i = 0; i < _results.size(); i++)
+    {
+        if (_results[i].status != ERROR_IO_PENDING)
+            continue;
+        _results[i].values.clear();
+        _results[i].statuses.clear();
+        _Fail(i, status);
+    }
+}
+
+void RegBatchReader::_ReadGroup(HKEY root, const String &parent, const std::vector<size_t> &indexes)
+{
+    RegKey parentKey(_backend);
+    if (parent.empty())
+        parentKey.Attach(root);
+    else if (parentKey.Open(root, parent, _access) == NULL)
+    {
+        for (auto it = indexes.begin(); it != indexes.end(); it++)
+            _Fail(*it, parentKey.GetLastStatus());
+        return;
+    }
+    else
+        _openCount.fetch_add(1, std::memory_order_relaxed);
+
+    RegKey child(_backend);
+    String childName;
+    for (auto it = indexes.begin(); it != indexes.end(); it++)
+    {
+        const RegReadRequest &request = _requests[*it];
+        if (request.subKey.empty())
+        {
+            _ReadKey(parentKey, request, _results[*it]);
+            continue;
+        }
+
+        String name = parent.empty() ? request.subKey : request.subKey.substr(parent.size() + 1);
+        if (!child.IsValid() || !RegString::EqualsFold(name, childName))
+        {
+            childName = name;
+            if (child.Open(parentKey.GetHandle(), name, _access) == NULL)
+            {
+                _Fail(*it, child.GetLastStatus());
+                continue;
+            }
+            _openCount.fetch_add(1, std::memory_order_relaxed);
+        }
+        _ReadKey(child, request, _results[*it]);
+    }
+
+    if (parent.empty())
+        parentKey.Detach();
+}
+
+void RegBatchReader::_ReadKey(RegKey &key, const RegReadRequest &request, RegReadResult &result)
+{
+    if (request.values.empty())
+    {
+        result.values = key.GetValues();
+        result.statuses.assign(result.values.size(), ERROR_SUCCESS);
+    }
+    else
+    {
+        for (auto it = request.values.begin(); it != request.values.end(); it++)
+        {
+            bool success = false;
+            result.values.push_back(key.GetValue(*it, &success));
+            result.statuses.push_back(success ? ERROR_SUCCESS : key.GetLastStatus());
+        }
+    }
+
+    if (_environment)
+    {
+        for (auto it = result.values.begin(); it != result.values.end(); it++)
+        {
+            if (it->type != REG_EXPAND_SZ)
+                continue;
+            String text;
+            RegCodec<REG_EXPAND_SZ>::Decode(it->data.data(), it->data.size(), text);
+            RegCodec<REG_EXPAND_SZ>::Encode(_environment->Expand(text), it->data);
+        }
+    }
+    // Set last, so a read cut short by an exception is still pending.
+    result.status = ERROR_SUCCESS;
+}
+
+void RegBatchReader::_Fail(size_t index, LSTATUS status)
+{
+    const RegReadRequest &request = _requests[index];
+    RegReadResult &result = _results[index];
+    result.status = status;
+    for (auto it = request.values.begin(); it != request.values.end(); it++)
+    {
+        result.values.push_back({*it, REG_NONE, ByteArray()});
+        result.statuses.push_back(status);
+    }
+}
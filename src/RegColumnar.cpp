@@ -0,0 +1,523 @@
+#include "RegColumnar.h"
+#include "RegFile.h"
+#include "RegString.h"
+#include <algorithm>
+#include <cstring>
+#include <numeric>
+
+namespace
+{
+    const BYTE Magic[4] = {'R', 'K', 'C', 'D'};
+    const uint32_t Version = 1;
+    const size_t TrailerSize = sizeof(uint64_t) + sizeof(Magic);
+    const size_t PageIndexEntrySize = sizeof(uint64_t) + sizeof(uint32_t) * 4;
+    // Data pages end early past this size, so a page of large values stays small enough to read at once.
+    const size_t MaxDataPageSize = 1024 * 1024;
+
+    static_assert(sizeof(Char) == 2, "Names are stored as UTF-16 code units.");
+
+    template <typename T>
+    void Put(ByteArray &out, T value)
+    {
+        size_t at = out.size();
+        out.resize(at + sizeof(T));
+        memcpy(out.data() + at, &value, sizeof(T));
+    }
+
+    void PutString(ByteArray &out, const String &str)
+    {
+        Put(out, uint32_t(str.size()));
+        size_t at = out.size();
+        out.resize(at + str.size() * sizeof(Char));
+        if (!str.empty())
+            memcpy(out.data() + at, str.data(), str.size() * sizeof(Char));
+    }
+
+    bool LessFold(const String &a, const String &b)
+    {
+        int order = RegString::CompareFold(a.c_str(), a.size(), b.c_str(), b.size());
+        return order != 0 ? order < 0 : a < b;
+    }
+
+    bool StartsWithFold(const String &str, const String &prefix)
+    {
+        return str.size() >= prefix.size() && RegString::EqualsFold(str.c_str(), prefix.size(), prefix.c_str(), prefix.size());
+    }
+
+    // Sorts `strings` and returns the new position of each old one.
+    std::vector<uint32_t> SortDictionary(std::vector<String> &strings)
+    {
+        std::vector<uint32_t> order(strings.size());
+        std::iota(order.begin(), order.end(), 0);
+        std::sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b) {
+            return LessFold(strings[a], strings[b]);
+        });
+
+        std::vector<uint32_t> codes(strings.size());
+        std::vector<String> sorted(strings.size());
+        for (uint32_t i = 0; i < order.size(); i++)
+        {
+            codes[order[i]] = i;
+            sorted[i] = std::move(strings[order[i]]);
+        }
+        strings.swap(sorted);
+        return codes;
+    }
+
+    void PutIntegerPage(ByteArray &out, const uint32_t *values, uint32_t count, RegColumnPage &page)
+    {
+        page.min = *std::min_element(values, values + count);
+        page.max = *std::max_element(values, values + count);
+        BYTE width = page.max <= 0xFF ? 1 : (page.max <= 0xFFFF ? 2 : 4);
+        out.push_back(width);
+        size_t at = out.size();
+        out.resize(at + size_t(count) * width);
+        BYTE *dst = out.data() + at;
+        for (uint32_t i = 0; i < count; i++, dst += width)
+        {
+            uint32_t value = values[i];
+            memcpy(dst, &value, width);
+        }
+    }
+
+    // Plain loops over fixed-size loads, which compilers turn into vector code.
+    template <typename T>
+    void Widen(const BYTE *src, uint32_t count, uint32_t *out)
+    {
+        for (uint32_t i = 0; i < count; i++)
+        {
+            T value;
+            memcpy(&value, src + size_t(i) * sizeof(T), sizeof(T));
+            out[i] = value;
+        }
+    }
+
+    // Appends the rows within [min, max] without branching on each row.
+    void AppendInRange(const uint32_t *values, uint32_t count, uint32_t firstRow, uint32_t min, uint32_t max,
+                       RegColumnScan &result)
+    {
+        size_t kept = result.rows.size();
+        result.rows.resize(kept + count);
+        result.values.resize(kept + count);
+        uint32_t *rows = result.rows.data();
+        uint32_t *out = result.values.data();
+        uint32_t span = max - min;
+        for (uint32_t i = 0; i < count; i++)
+        {
+            uint32_t value = values[i];
+            rows[kept] = firstRow + i;
+            out[kept] = value;
+            kept += uint32_t(value - min) <= span;
+        }
+        result.rows.resize(kept);
+        result.values.resize(kept);
+    }
+
+    // Whether all values are within [min, max], in the same branch-free way.
+    bool AllInRange(const uint32_t *values, uint32_t count, uint32_t min, uint32_t max)
+    {
+        uint32_t span = max - min;
+        uint32_t outside = 0;
+        for (uint32_t i = 0; i < count; i++)
+            outside |= uint32_t(uint32_t(values[i] - min) > span);
+        return outside == 0;
+    }
+}
+
+RegColumnarWriter::RegColumnarWriter(const String &source, uint32_t pageRows)
+    : _source(source)
+    , _pageRows(pageRows > 0 ? pageRows : 1)
+{
+}
+
+uint32_t RegColumnarWriter::_Intern(std::unordered_map<String, uint32_t> &ids, std::vector<String> &strings,
+                                    const String &str)
+{
+    auto inserted = ids.emplace(str, uint32_t(strings.size()));
+    if (inserted.second)
+        strings.push_back(str);
+    return inserted.first->second;
+}
+
+void RegColumnarWriter::Add(const String &path, const String &name, DWORD type, const BYTE *data, size_t size)
+{
+    Row row;
+    row.path = _Intern(_pathIds, _paths, path);
+    row.name = _Intern(_nameIds, _names, name);
+    row.type = type;
+    row.offset = _data.size();
+    row.size = uint32_t(size);
+    _data.insert(_data.end(), data, data + size);
+    _rows.push_back(row);
+}
+
+void RegColumnarWriter::_AddKey(RegKey &key, const String &path)
+{
+    std::vector<RegValue> values = key.GetValues();
+    for (auto it = values.begin(); it != values.end(); it++)
+        Add(path, it->name, it->type, it->data.data(), it->data.size());
+
+    std::vector<String> subKeys = key.GetSubKeyNames();
+    for (auto it = subKeys.begin(); it != subKeys.end(); it++)
+    {
+        RegKey subKey(key.GetBackend());
+        if (subKey.Open(key.GetHandle(), *it, KEY_READ) != NULL)
+            _AddKey(subKey, path.empty() ? *it : path + STR('\\') + *it);
+    }
+}
+
+bool RegColumnarWriter::AddTree(RegKey &root)
+{
+    RegKeyInfo info;
+    if (!root.QueryInfo(&info))
+        return false;
+    _AddKey(root, String());
+    return true;
+}
+
+void RegColumnarWriter::AddState(const RegTreeState &state)
+{
+    // Parents before children, in the order a walk of the tree would give.
+    std::vector<const RegTreeState::Key *> keys;
+    keys.reserve(state.keys.size());
+    for (auto it = state.keys.begin(); it != state.keys.end(); it++)
+        keys.push_back(&it->second);
+    std::sort(keys.begin(), keys.end(), [](const RegTreeState::Key *a, const RegTreeState::Key *b) {
+        return LessFold(a->path, b->path);
+    });
+
+    for (auto key = keys.begin(); key != keys.end(); key++)
+    {
+        for (auto it = (*key)->values.begin(); it != (*key)->values.end(); it++)
+            Add((*key)->path, it->name, it->type, it->data.data(), it->data.size());
+    }
+}
+
+bool RegColumnarWriter::Write(const std::string &file, size_t *bytes)
+{
+    std::vector<uint32_t> pathCodes = SortDictionary(_paths);
+    std::vector<uint32_t> nameCodes = SortDictionary(_names);
+    // Interned ids refer to the old order from now on.
+    _pathIds.clear();
+    _nameIds.clear();
+    for (auto it = _rows.begin(); it != _rows.end(); it++)
+    {
+        it->path = pathCodes[it->path];
+        it->name = nameCodes[it->name];
+    }
+
+    ByteArray out;
+    out.insert(out.end(), Magic, Magic + sizeof(Magic));
+    Put(out, Version);
+    Put(out, uint32_t(_rows.size()));
+    PutString(out, _source);
+    const std::vector<String> *dictionaries[] = {&_paths, &_names};
+    for (size_t i = 0; i < 2; i++)
+    {
+        Put(out, uint32_t(dictionaries[i]->size()));
+        for (auto it = dictionaries[i]->begin(); it != dictionaries[i]->end(); it++)
+            PutString(out, *it);
+    }
+
+    std::vector<RegColumnPage> pages[RegColumnCount];
+    std::vector<uint32_t> values(_rows.size());
+    for (size_t column = 0; column < size_t(RegColumn::Data); column++)
+    {
+        for (size_t i = 0; i < _rows.size(); i++)
+        {
+            const Row &row = _rows[i];
+            values[i] = column == size_t(RegColumn::Path) ? row.path : (column == size_t(RegColumn::Name) ? row.name : row.type);
+        }
+        for (size_t first = 0; first < _rows.size(); first += _pageRows)
+        {
+            RegColumnPage page;
+            page.offset = out.size();
+            page.rows = uint32_t(std::min<size_t>(_pageRows, _rows.size() - first));
+            PutIntegerPage(out, values.data() + first, page.rows, page);
+            page.size = uint32_t(out.size() - page.offset);
+            pages[column].push_back(page);
+        }
+    }
+
+    for (size_t first = 0; first < _rows.size();)
+    {
+        RegColumnPage page;
+        page.offset = out.size();
+        page.rows = 0;
+        page.min = 0xFFFFFFFF;
+        page.max = 0;
+        while (first < _rows.size() && page.rows < _pageRows && (page.rows == 0 || out.size() - page.offset < MaxDataPageSize))
+        {
+            const Row &row = _rows[first++];
+            Put(out, row.size);
+            out.insert(out.end(), _data.data() + row.offset, _data.data() + row.offset + row.size);
+            page.rows++;
+            page.min = std::min(page.min, row.size);
+            page.max = std::max(page.max, row.size);
+        }
+        page.size = uint32_t(out.size() - page.offset);
+        pages[size_t(RegColumn::Data)].push_back(page);
+    }
+
+    uint64_t indexOffset = out.size();
+    for (size_t column = 0; column < RegColumnCount; column++)
+    {
+        Put(out, uint32_t(pages[column].size()));
+        for (auto it = pages[column].begin(); it != pages[column].end(); it++)
+        {
+            Put(out, it->offset);
+            Put(out, it->size);
+            Put(out, it->rows);
+            Put(out, it->min);
+            Put(out, it->max);
+        }
+    }
+    Put(out, indexOffset);
+    out.insert(out.end(), Magic, Magic + sizeof(Magic));
+
+    std::string temporary = file + ".tmp";
+    FILE *fp = RegFile::Open(temporary, "wb");
+    if (fp == NULL)
+        return false;
+    bool written = fwrite(out.data(), 1, out.size(), fp) == out.size();
+    written = fclose(fp) == 0 && written;
+    if (!written || !RegFile::Replace(temporary, file))
+    {
+        RegFile::Remove(temporary);
+        return false;
+    }
+    if (bytes != nullptr)
+        *bytes = out.size();
+    return true;
+}
+
+RegColumnarReader::RegColumnarReader()
+    : _fp(NULL)
+    , _size(0)
+    , _rowCount(0)
+{
+}
+
+RegColumnarReader::~RegColumnarReader()
+{
+    if (_fp != NULL)
+        fclose(_fp);
+}
+
+bool RegColumnarReader::Open(const std::string &file)
+{
+    if (_fp != NULL)
+        fclose(_fp);
+    _fp = RegFile::Open(file, "rb");
+    if (_fp == NULL)
+        return false;
+
+    long size = fseek(_fp, 0, SEEK_END) == 0 ? ftell(_fp) : -1;
+    if (size < long(sizeof(Magic) + sizeof(uint32_t) * 5 + TrailerSize))
+        return false;
+    _size = uint64_t(size);
+
+    // The trailer first: the page index bounds everything before it.
+    BYTE trailer[TrailerSize];
+    uint64_t indexOffset;
+    if (fseek(_fp, size - long(TrailerSize), SEEK_SET) != 0 || fread(trailer, 1, TrailerSize, _fp) != TrailerSize ||
+        memcmp(trailer + sizeof(uint64_t), Magic, sizeof(Magic)) != 0)
+        return false;
+    memcpy(&indexOffset, trailer, sizeof(indexOffset));
+    if (indexOffset > _size - TrailerSize)
+        return false;
+
+    ByteArray head;
+    head.resize(size_t(indexOffset));
+    if (fseek(_fp, 0, SEEK_SET) != 0)
+        return false;
+
+    // Reads the header and dictionaries, which end where the first page starts.
+    size_t at = 0;
+    bool ok = true;
+    auto need = [&](size_t bytes) {
+        if (!ok || head.size() - at < bytes)
+            return ok = false;
+        return true;
+    };
+    auto getU32 = [&]() {
+        uint32_t value = 0;
+        if (need(sizeof(value)))
+        {
+            memcpy(&value, head.data() + at, sizeof(value));
+            at += sizeof(value);
+        }
+        return value;
+    };
+    auto getString = [&](String &str) {
+        uint32_t length = getU32();
+        if (need(size_t(length) * sizeof(Char)))
+        {
+            str.resize(length);
+            if (length > 0)
+                memcpy(&str[0], head.data() + at, size_t(length) * sizeof(Char));
+            at += size_t(length) * sizeof(Char);
+        }
+    };
+
+    ByteArray index(size_t(_size - TrailerSize - indexOffset));
+    if (fread(head.data(), 1, head.size(), _fp) != head.size() ||
+        (!index.empty() && fread(index.data(), 1, index.size(), _fp) != index.size()))
+        return false;
+
+    BYTE magic[sizeof(Magic)];
+    if (need(sizeof(magic)))
+        memcpy(magic, head.data(), sizeof(magic));
+    at = sizeof(magic);
+    if (!ok || memcmp(magic, Magic, sizeof(Magic)) != 0 || getU32() != Version)
+        return false;
+    _rowCount = getU32();
+    getString(_source);
+    std::vector<String> *dictionaries[] = {&_paths, &_names};
+    for (size_t i = 0; i < 2 && ok; i++)
+    {
+        uint32_t count = getU32();
+        if (!need(size_t(count) * sizeof(uint32_t)))
+            break;
+        dictionaries[i]->resize(count);
+        for (uint32_t j = 0; j < count && ok; j++)
+            getString((*dictionaries[i])[j]);
+    }
+    if (!ok)
+        return false;
+    uint64_t pagesBegin = at;
+
+    head.swap(index);
+    at = 0;
+    for (size_t column = 0; column < RegColumnCount && ok; column++)
+    {
+        uint32_t count = getU32();
+        if (!need(size_t(count) * PageIndexEntrySize))
+            break;
+        _pages[column].resize(count);
+        uint64_t rows = 0;
+        for (uint32_t i = 0; i < count; i++)
+        {
+            RegColumnPage &page = _pages[column][i];
+            memcpy(&page.offset, head.data() + at, sizeof(page.offset));
+            at += sizeof(page.offset);
+            page.size = getU32();
+            page.rows = getU32();
+            page.min = getU32();
+            page.max = getU32();
+            rows += page.rows;
+            if (page.offset < pagesBegin || page.offset > indexOffset || indexOffset - page.offset < page.size ||
+                (page.rows > 0 && page.min > page.max))
+                ok = false;
+        }
+        if (rows != _rowCount)
+            ok = false;
+    }
+    return ok && at == head.size();
+}
+
+const std::vector<String> &RegColumnarReader::GetDictionary(RegColumn column) const
+{
+    static const std::vector<String> none;
+    if (column == RegColumn::Path)
+        return _paths;
+    if (column == RegColumn::Name)
+        return _names;
+    return none;
+}
+
+bool RegColumnarReader::FindPrefix(RegColumn column, const String &prefix, uint32_t *min, uint32_t *max) const
+{
+    const std::vector<String> &dictionary = GetDictionary(column);
+    auto first = std::partition_point(dictionary.begin(), dictionary.end(), [&](const String &str) {
+        return RegString::CompareFold(str.c_str(), str.size(), prefix.c_str(), prefix.size()) < 0;
+    });
+    // Sorted case-insensitively, so the strings sharing a prefix are next to each other.
+    auto last = std::partition_point(first, dictionary.end(), [&](const String &str) {
+        return StartsWithFold(str, prefix);
+    });
+    if (first == last)
+        return false;
+    *min = uint32_t(first - dictionary.begin());
+    *max = uint32_t(last - dictionary.begin() - 1);
+    return true;
+}
+
+bool RegColumnarReader::_ReadPage(const RegColumnPage &page, ByteArray &buffer)
+{
+    buffer.resize(page.size);
+    return _fp != NULL && fseek(_fp, long(page.offset), SEEK_SET) == 0 &&
+           (page.size == 0 || fread(buffer.data(), 1, page.size, _fp) == page.size);
+}
+
+bool RegColumnarReader::Scan(RegColumn column, uint32_t min, uint32_t max, RegColumnScan &result)
+{
+    if (min > max)
+        return true;
+
+    ByteArray page;
+    std::vector<uint32_t> decoded;
+    uint32_t firstRow = 0;
+    const std::vector<RegColumnPage> &pages = _pages[size_t(column)];
+    const std::vector<String> &dictionary = GetDictionary(column);
+    bool coded = column == RegColumn::Path || column == RegColumn::Name;
+    for (auto it = pages.begin(); it != pages.end(); firstRow += it->rows, it++)
+    {
+        if (it->rows == 0 || it->max < min || it->min > max)
+            continue;
+        // Pages are skipped and taken whole by their index entry, so a page that does not keep
+        // within it, or codes past the dictionary, make the dump corrupt.
+        if ((coded && it->max >= dictionary.size()) || !_ReadPage(*it, page))
+            return false;
+
+        if (column == RegColumn::Data)
+        {
+            size_t at = 0;
+            for (uint32_t i = 0; i < it->rows; i++)
+            {
+                uint32_t length;
+                if (page.size() - at < sizeof(length))
+                    return false;
+                memcpy(&length, page.data() + at, sizeof(length));
+                at += sizeof(length);
+                if (page.size() - at < length || length < it->min || length > it->max)
+                    return false;
+                if (length >= min && length <= max)
+                {
+                    result.rows.push_back(firstRow + i);
+                    result.values.push_back(length);
+                    result.data.insert(result.data.end(), page.data() + at, page.data() + at + length);
+                }
+                at += length;
+            }
+            if (at != page.size())
+                return false;
+            continue;
+        }
+
+        BYTE width = page.empty() ? 0 : page[0];
+        if ((width != 1 && width != 2 && width != 4) || page.size() != 1 + size_t(it->rows) * width)
+            return false;
+        decoded.resize(it->rows);
+        if (width == 1)
+            Widen<uint8_t>(page.data() + 1, it->rows, decoded.data());
+        else if (width == 2)
+            Widen<uint16_t>(page.data() + 1, it->rows, decoded.data());
+        else
+            Widen<uint32_t>(page.data() + 1, it->rows, decoded.data());
+        if (!AllInRange(decoded.data(), it->rows, it->min, it->max))
+            return false;
+
+        if (min <= it->min && it->max <= max)
+        {
+            // The whole page matches.
+            size_t kept = result.rows.size();
+            result.rows.resize(kept + it->rows);
+            std::iota(result.rows.begin() + kept, result.rows.end(), firstRow);
+            result.values.insert(result.values.end(), decoded.begin(), decoded.end());
+        }
+        else
+            AppendInRange(decoded.data(), it->rows, firstRow, min, max, result);
+    }
+    return true;
+}
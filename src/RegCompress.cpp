@@ -0,0 +1,366 @@
+#include "RegCompress.h"
+#include <algorithm>
+#include <cstring>
+#include <memory>
+
+namespace
+{
+    const BYTE Magic[4] = {'R', 'K', 'Z', 1};
+    const uint32_t StoredFlag = 0x80000000u;
+
+    // LZ4 block rules: matches are at least 4 bytes, the last 5 bytes are always literals
+    // and no match starts in the last 12 bytes.
+    const size_t MinMatch = 4;
+    const size_t LastLiterals = 5;
+    const size_t MatchFindLimit = 12;
+    const size_t MaxOffset = 65535;
+    const int HashBits = 12;
+
+    uint32_t Read32(const BYTE *p)
+    {
+        uint32_t value;
+        memcpy(&value, p, sizeof(value));
+        return value;
+    }
+
+    uint32_t ReadLE32(const BYTE *p)
+    {
+        return uint32_t(p[0]) | (uint32_t(p[1]) << 8) | (uint32_t(p[2]) << 16) | (uint32_t(p[3]) << 24);
+    }
+
+    void WriteLE32(BYTE *p, uint32_t value)
+    {
+        p[0] = BYTE(value);
+        p[1] = BYTE(value >> 8);
+        p[2] = BYTE(value >> 16);
+        p[3] = BYTE(value >> 24);
+    }
+
+    void AppendLE32(ByteArray &out, uint32_t value)
+    {
+        size_t at = out.size();
+        out.resize(at + 4);
+        WriteLE32(out.data() + at, value);
+    }
+
+    uint32_t Hash(uint32_t sequence)
+    {
+        return (sequence * 2654435761u) >> (32 - HashBits);
+    }
+
+    void AppendLength(ByteArray &out, size_t length)
+    {
+        for (; length >= 255; length -= 255)
+            out.push_back(255);
+        out.push_back(BYTE(length));
+    }
+
+    // Upper bound of a compressed block, past which the data cannot be valid.
+    size_t MaxCompressedSize(size_t rawSize)
+    {
+        return rawSize + rawSize / 255 + 16;
+    }
+
+    void CompressBlock(const BYTE *src, size_t size, ByteArray &out, int32_t *table)
+    {
+        std::fill(table, table + (1 << HashBits), -1);
+        const BYTE *ip = src;
+        const BYTE *anchor = src;
+        const BYTE *end = src + size;
+
+        if (size >= MatchFindLimit)
+        {
+            const BYTE *limit = end - MatchFindLimit;
+            const BYTE *matchLimit = end - LastLiterals;
+            // Incompressible data is skipped over faster and faster until a match is found.
+            size_t misses = 0;
+            while (ip <= limit)
+            {
+                uint32_t sequence = Read32(ip);
+                uint32_t h = Hash(sequence);
+                int32_t candidate = table[h];
+                table[h] = int32_t(ip - src);
+                if (candidate < 0 || size_t(ip - src - candidate) > MaxOffset || Read32(src + candidate) != sequence)
+                {
+                    ip += 1 + (misses++ >> 6);
+                    continue;
+                }
+                misses = 0;
+
+                const BYTE *match = src + candidate;
+                while (ip > anchor && match > src && ip[-1] == match[-1])
+                {
+                    ip--;
+                    match--;
+                }
+                const BYTE *matchEnd = ip + MinMatch;
+                const BYTE *ref = match + MinMatch;
+                while (matchEnd < matchLimit && *matchEnd == *ref)
+                {
+                    matchEnd++;
+                    ref++;
+                }
+
+                size_t literals = size_t(ip - anchor);
+                size_t matchLength = size_t(matchEnd - ip) - MinMatch;
+                out.push_back(BYTE((std::min<size_t>(literals, 15) << 4) | std::min<size_t>(matchLength, 15)));
+                if (literals >= 15)
+                    AppendLength(out, literals - 15);
+                out.insert(out.end(), anchor, ip);
+                size_t offset = size_t(ip - match);
+                out.push_back(BYTE(offset));
+                out.push_back(BYTE(offset >> 8));
+                if (matchLength >= 15)
+                    AppendLength(out, matchLength - 15);
+
+                ip = matchEnd;
+                anchor = ip;
+            }
+        }
+
+        size_t literals = size_t(end - anchor);
+        out.push_back(BYTE(std::min<size_t>(literals, 15) << 4));
+        if (literals >= 15)
+            AppendLength(out, literals - 15);
+        out.insert(out.end(), anchor, end);
+    }
+
+    bool DecompressBlock(const BYTE *src, size_t size, BYTE *dst, size_t dstSize)
+    {
+        const BYTE *ip = src;
+        const BYTE *end = src + size;
+        BYTE *op = dst;
+        BYTE *outEnd = dst + dstSize;
+
+        while (ip < end)
+        {
+            BYTE token = *ip++;
+            size_t literals = token >> 4;
+            if (literals == 15)
+            {
+                BYTE extra;
+                do
+                {
+                    if (ip >= end)
+                        return false;
+                    extra = *ip++;
+                    literals += extra;
+                } while (extra == 255);
+            }
+            if (size_t(end - ip) < literals || size_t(outEnd - op) < literals)
+                return false;
+            memcpy(op, ip, literals);
+            ip += literals;
+            op += literals;
+
+            // The last sequence has no match.
+            if (ip == end)
+                break;
+
+            if (end - ip < 2)
+                return false;
+            size_t offset = size_t(ip[0]) | (size_t(ip[1]) << 8);
+            ip += 2;
+            if (offset == 0 || offset > size_t(op - dst))
+                return false;
+
+            size_t matchLength = token & 15;
+            if (matchLength == 15)
+            {
+                BYTE extra;
+                do
+                {
+                    if (ip >= end)
+                        return false;
+                    extra = *ip++;
+                    matchLength += extra;
+                } while (extra == 255);
+            }
+            matchLength += MinMatch;
+            if (size_t(outEnd - op) < matchLength)
+                return false;
+
+            const BYTE *match = op - offset;
+            if (offset >= matchLength)
+                memcpy(op, match, matchLength);
+            else
+            {
+                // Overlapping matches repeat the last `offset` bytes, so whatever has been written
+                // can be copied again from `match`, doubling the run each time.
+                for (size_t copied = 0; copied < matchLength; )
+                {
+                    size_t n = std::min(matchLength - copied, offset + copied);
+                    memcpy(op + copied, match, n);
+                    copied += n;
+                }
+            }
+            op += matchLength;
+        }
+        return op == outEnd;
+    }
+
+    // Decodes one block given its length word; `out` receives `rawSize` bytes.
+    bool DecodeBlock(uint32_t length, const BYTE *data, BYTE *out, size_t rawSize)
+    {
+        if (length & StoredFlag)
+        {
+            if ((length & ~StoredFlag) != rawSize)
+                return false;
+            memcpy(out, data, rawSize);
+            return true;
+        }
+        return DecompressBlock(data, length, out, rawSize);
+    }
+}
+
+bool RegCompress::IsCompressed(const BYTE *data, size_t size)
+{
+    if (size < HeaderSize || memcmp(data, Magic, sizeof(Magic)) != 0)
+        return false;
+    uint32_t blockSize = ReadLE32(data + 8);
+    return blockSize > 0 && blockSize <= BlockSize;
+}
+
+bool RegCompress::IsCompleteValue(const BYTE *data, size_t size)
+{
+    if (!IsCompressed(data, size))
+        return false;
+
+    uint32_t rawSize = GetRawSize(data);
+    uint32_t blockSize = ReadLE32(data + 8);
+    size_t at = HeaderSize;
+    for (size_t produced = 0; produced < rawSize; produced += blockSize)
+    {
+        if (size - at < 4)
+            return false;
+        uint32_t length = ReadLE32(data + at);
+        at += 4;
+        size_t stored = length & ~StoredFlag;
+        // Stored blocks hold the raw bytes; compressed ones are never empty.
+        if (size - at < stored || ((length & StoredFlag) ? stored != std::min<size_t>(blockSize, rawSize - produced) : stored == 0))
+            return false;
+        at += stored;
+    }
+    return rawSize > 0 && at == size;
+}
+
+uint32_t RegCompress::GetRawSize(const BYTE *data)
+{
+    return ReadLE32(data + 4);
+}
+
+bool RegCompress::Compress(const BYTE *data, size_t size, ByteArray &out)
+{
+    out.clear();
+    if (size == 0 || size > 0xFFFFFFFFu)
+        return false;
+
+    out.reserve(HeaderSize + MaxCompressedSize(size));
+    out.insert(out.end(), Magic, Magic + sizeof(Magic));
+    AppendLE32(out, uint32_t(size));
+    AppendLE32(out, BlockSize);
+
+    std::unique_ptr<int32_t[]> table(new int32_t[1 << HashBits]);
+    for (size_t offset = 0; offset < size; offset += BlockSize)
+    {
+        size_t rawSize = std::min<size_t>(BlockSize, size - offset);
+        size_t at = out.size();
+        out.resize(at + 4);
+        CompressBlock(data + offset, rawSize, out, table.get());
+        size_t length = out.size() - at - 4;
+        if (length >= rawSize)
+        {
+            out.resize(at + 4);
+            out.insert(out.end(), data + offset, data + offset + rawSize);
+            WriteLE32(out.data() + at, uint32_t(rawSize) | StoredFlag);
+        }
+        else
+            WriteLE32(out.data() + at, uint32_t(length));
+        // Give up as soon as the result cannot end up smaller.
+        if (out.size() >= size)
+        {
+            out.clear();
+            return false;
+        }
+    }
+    return true;
+}
+
+bool RegCompress::Decompress(const BYTE *data, size_t size, BYTE *out, size_t outSize)
+{
+    if (!IsCompressed(data, size) || GetRawSize(data) != outSize)
+        return false;
+
+    uint32_t blockSize = ReadLE32(data + 8);
+    size_t at = HeaderSize;
+    for (size_t produced = 0; produced < outSize; produced += blockSize)
+    {
+        if (size - at < 4)
+            return false;
+        uint32_t length = ReadLE32(data + at);
+        at += 4;
+        size_t stored = length & ~StoredFlag;
+        size_t rawSize = std::min<size_t>(blockSize, outSize - produced);
+        if (size - at < stored || !DecodeBlock(length, data + at, out + produced, rawSize))
+            return false;
+        at += stored;
+    }
+    return at == size;
+}
+
+RegCompress::Decoder::Decoder()
+    : _rawSize(0)
+    , _blockSize(0)
+    , _produced(0)
+    , _header(false)
+    , _failed(false)
+{
+}
+
+bool RegCompress::Decoder::Feed(const BYTE *data, size_t size, const Sink &sink)
+{
+    if (_failed)
+        return false;
+
+    _pending.insert(_pending.end(), data, data + size);
+    size_t at = 0;
+    if (!_header)
+    {
+        if (_pending.size() < HeaderSize)
+            return true;
+        if (!IsCompressed(_pending.data(), _pending.size()))
+            return !(_failed = true);
+        _rawSize = RegCompress::GetRawSize(_pending.data());
+        _blockSize = ReadLE32(_pending.data() + 8);
+        _block.resize(_blockSize);
+        _header = true;
+        at = HeaderSize;
+    }
+
+    while (_produced < _rawSize && _pending.size() - at >= 4)
+    {
+        uint32_t length = ReadLE32(_pending.data() + at);
+        size_t stored = length & ~StoredFlag;
+        size_t rawSize = std::min<uint32_t>(_blockSize, _rawSize - _produced);
+        if (stored > MaxCompressedSize(_blockSize))
+            return !(_failed = true);
+        if (_pending.size() - at - 4 < stored)
+            break;
+        if (!DecodeBlock(length, _pending.data() + at + 4, _block.data(), rawSize))
+            return !(_failed = true);
+        at += 4 + stored;
+        _produced += uint32_t(rawSize);
+        sink(_block.data(), rawSize);
+    }
+
+    // Data past the last block means the value is not what the header says.
+    if (IsDone() && at < _pending.size())
+        return !(_failed = true);
+    _pending.erase(_pending.begin(), _pending.begin() + at);
+    return true;
+}
+
+bool RegCompress::Decoder::IsDone() const
+{
+    return _header && _produced == _rawSize;
+}
@@ -0,0 +1,322 @@
+#include "RegConnectionPool.h"
+#include "RegString.h"
+#include "RegTrace.h"
+#include <algorithm>
+#include <thread>
+
+namespace
+{
+    // "\\\\Server" and "server" name the same host.
+    String NormalizeHost(const String &host)
+    {
+        size_t begin = 0;
+        while (begin < host.size() && host[begin] == '\\')
+            begin++;
+        return RegString::Fold(host.substr(begin));
+    }
+}
+
+RegConnectionPool &RegConnectionPool::Shared()
+{
+    // Leaked on purpose, like the write-back timer: its thread is never joined.
+    static RegConnectionPool *pool = new RegConnectionPool();
+    return *pool;
+}
+
+RegConnectionPool::RegConnectionPool()
+    : _stats()
+    , _started(false)
+{
+}
+
+void RegConnectionPool::SetOptions(const RegConnectionPoolOptions &options)
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    _options = options;
+    // Expiry times may have moved.
+    _wake.notify_one();
+}
+
+RegConnectionPoolOptions RegConnectionPool::GetOptions()
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    return _options;
+}
+
+bool RegConnectionPool::IsConnectionError(LSTATUS status)
+{
+    switch (status)
+    {
+    case ERROR_INVALID_HANDLE:
+    case ERROR_BAD_NETPATH:
+    case ERROR_UNEXP_NET_ERR:
+    case ERROR_NETNAME_DELETED:
+    case RPC_S_SERVER_UNAVAILABLE:
+    case RPC_S_CALL_FAILED:
+        return true;
+    default:
+        return false;
+    }
+}
+
+LSTATUS RegConnectionPool::Acquire(const std::shared_ptr<RegBackend> &backend, const String &host, HKEY root, HKEY *result)
+{
+    String name = NormalizeHost(host);
+    std::unique_lock<std::mutex> lock(_mutex);
+    for (;;)
+    {
+        if (_options.maxPerHost == 0)
+            return _Connect(lock, backend, host, name, root, true, result);
+
+        Host &entry = _hosts[name];
+        Connection *idle = nullptr;
+        Connection *shared = nullptr;
+        for (auto it = entry.connections.begin(); it != entry.connections.end(); it++)
+        {
+            Connection *connection = it->get();
+            if (connection->retired || connection->root != root || connection->backend != backend)
+                continue;
+            if (connection->users == 0)
+            {
+                idle = connection;
+                break;
+            }
+            if (shared == nullptr || connection->users < shared->users)
+                shared = connection;
+        }
+
+        if (idle != nullptr)
+        {
+            idle->users++;
+            if (Clock::now() - idle->lastUsed < std::chrono::milliseconds(_options.healthCheckInterval))
+            {
+                _stats.reuses++;
+                *result = idle->hKey;
+                return ERROR_SUCCESS;
+            }
+
+            // The server may have gone away while the connection sat unused.
+            HKEY hKey = idle->hKey;
+            lock.unlock();
+            RegKeyInfo info;
+            LSTATUS status = REG_TRACED(QueryInfoKey, hKey, nullptr, backend->QueryInfoKey(hKey, &info));
+            lock.lock();
+            if (status == ERROR_SUCCESS || !IsConnectionError(status))
+            {
+                idle->lastUsed = Clock::now();
+                _stats.reuses++;
+                *result = hKey;
+                return ERROR_SUCCESS;
+            }
+
+            _stats.unhealthy++;
+            idle->users--;
+            if (idle->users == 0)
+            {
+                std::vector<std::unique_ptr<Connection>> closing;
+                closing.push_back(_Remove(name, idle));
+                lock.unlock();
+                _Close(closing);
+                lock.lock();
+            }
+            else
+                idle->retired = true;
+            continue;
+        }
+
+        if (entry.connections.size() + entry.connecting < _options.maxPerHost)
+            return _Connect(lock, backend, host, name, root, false, result);
+
+        if (shared != nullptr)
+        {
+            shared->users++;
+            _stats.reuses++;
+            *result = shared->hKey;
+            return ERROR_SUCCESS;
+        }
+
+        // Connections still being opened may turn out to be for this root.
+        if (entry.connecting > 0)
+        {
+            _connected.wait(lock);
+            continue;
+        }
+
+        // The host is at its limit with connections to other roots.
+        return _Connect(lock, backend, host, name, root, true, result);
+    }
+}
+
+LSTATUS RegConnectionPool::_Connect(std::unique_lock<std::mutex> &lock,
+                                    const std::shared_ptr<RegBackend> &backend,
+                                    const String &host,
+                                    const String &name,
+                                    HKEY root,
+                                    bool retired,
+                                    HKEY *result)
+{
+    _stats.connects++;
+    _hosts[name].connecting++;
+    lock.unlock();
+    HKEY hKey = NULL;
+    LSTATUS status = REG_TRACED(ConnectRegistry, root, host.c_str(), backend->ConnectRegistry(host.c_str(), root, &hKey));
+    if (status == ERROR_SUCCESS && RegTrace::IsEnabled())
+        RegTrace::NameKey(hKey, STR("\\\\") + host + STR("\\") + RegTrace::GetKeyPath(root));
+    lock.lock();
+
+    // Host entries are kept while connections are being opened, so the reference is still valid.
+    Host &entry = _hosts[name];
+    entry.connecting--;
+    _connected.notify_all();
+    if (status != ERROR_SUCCESS)
+    {
+        if (entry.connections.empty() && entry.connecting == 0)
+            _hosts.erase(name);
+        return status;
+    }
+
+    std::unique_ptr<Connection> connection(new Connection());
+    connection->backend = backend;
+    connection->root = root;
+    connection->hKey = hKey;
+    connection->users = 1;
+    connection->retired = retired;
+    connection->lastUsed = Clock::now();
+    _handles[std::make_pair(backend.get(), hKey)] = std::make_pair(name, connection.get());
+    entry.connections.push_back(std::move(connection));
+
+    if (!_started)
+    {
+        std::thread([this]() {
+            _Run();
+        }).detach();
+        _started = true;
+    }
+    *result = hKey;
+    return ERROR_SUCCESS;
+}
+
+void RegConnectionPool::Release(const std::shared_ptr<RegBackend> &backend, HKEY hKey, LSTATUS status)
+{
+    std::unique_lock<std::mutex> lock(_mutex);
+    auto it = _handles.find(std::make_pair(backend.get(), hKey));
+    if (it == _handles.end())
+        return;
+
+    Connection *connection = it->second.second;
+    connection->users--;
+    connection->lastUsed = Clock::now();
+    if (IsConnectionError(status) && !connection->retired)
+    {
+        _stats.unhealthy++;
+        connection->retired = true;
+    }
+
+    if (connection->users == 0 && connection->retired)
+    {
+        std::vector<std::unique_ptr<Connection>> closing;
+        closing.push_back(_Remove(it->second.first, connection));
+        lock.unlock();
+        _Close(closing);
+    }
+    else if (connection->users == 0)
+        _wake.notify_one();
+}
+
+std::unique_ptr<RegConnectionPool::Connection> RegConnectionPool::_Remove(const String &name, Connection *connection)
+{
+    std::unique_ptr<Connection> removed;
+    Host &entry = _hosts[name];
+    for (auto it = entry.connections.begin(); it != entry.connections.end(); it++)
+    {
+        if (it->get() == connection)
+        {
+            removed = std::move(*it);
+            entry.connections.erase(it);
+            break;
+        }
+    }
+    if (entry.connections.empty() && entry.connecting == 0)
+        _hosts.erase(name);
+    // `name` may live in the handle entry.
+    _handles.erase(std::make_pair(connection->backend.get(), connection->hKey));
+    return removed;
+}
+
+void RegConnectionPool::_Close(std::vector<std::unique_ptr<Connection>> &connections)
+{
+    // Closing a remote handle may wait on the network, so it is never done under the lock.
+    for (auto it = connections.begin(); it != connections.end(); it++)
+        REG_TRACED(CloseKey, (*it)->hKey, nullptr, (*it)->backend->CloseKey((*it)->hKey));
+    connections.clear();
+}
+
+void RegConnectionPool::Clear()
+{
+    std::vector<std::unique_ptr<Connection>> closing;
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        std::vector<std::pair<String, Connection *>> idle;
+        for (auto it = _handles.begin(); it != _handles.end(); it++)
+        {
+            if (it->second.second->users == 0)
+                idle.push_back(it->second);
+        }
+        for (auto it = idle.begin(); it != idle.end(); it++)
+            closing.push_back(_Remove(it->first, it->second));
+    }
+    _Close(closing);
+}
+
+RegConnectionPoolStats RegConnectionPool::GetStats()
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    RegConnectionPoolStats stats = _stats;
+    stats.open = _handles.size();
+    stats.busy = 0;
+    for (auto it = _handles.begin(); it != _handles.end(); it++)
+    {
+        if (it->second.second->users > 0)
+            stats.busy++;
+    }
+    return stats;
+}
+
+void RegConnectionPool::_Run()
+{
+    std::unique_lock<std::mutex> lock(_mutex);
+    for (;;)
+    {
+        Clock::time_point now = Clock::now();
+        Clock::time_point next = Clock::time_point::max();
+        std::chrono::milliseconds timeout(_options.idleTimeout);
+        std::vector<std::pair<String, Connection *>> expired;
+        for (auto it = _handles.begin(); it != _handles.end(); it++)
+        {
+            Connection *connection = it->second.second;
+            if (connection->users > 0)
+                continue;
+            if (connection->lastUsed + timeout <= now)
+                expired.push_back(it->second);
+            else
+                next = std::min(next, connection->lastUsed + timeout);
+        }
+
+        if (!expired.empty())
+        {
+            std::vector<std::unique_ptr<Connection>> closing;
+            for (auto it = expired.begin(); it != expired.end(); it++)
+                closing.push_back(_Remove(it->first, it->second));
+            _stats.expired += closing.size();
+            lock.unlock();
+            _Close(closing);
+            lock.lock();
+            continue;
+        }
+
+        if (next == Clock::time_point::max())
+            _wake.wait(lock);
+        else
+            _wake.wait_until(lock, next);
+    }
+}
@@ -0,0 +1,184 @@
+#include "RegExpand.h"
+#include "RegString.h"
+#include <cstring>
+
+#ifndef _WIN32
+extern char **environ;
+#endif
+
+namespace
+{
+#ifndef _WIN32
+    // Environment strings are UTF-8 outside Windows; invalid bytes are kept as U+FFFD.
+    String DecodeUtf8(const char *str, size_t length)
+    {
+        String result;
+        result.reserve(length);
+        for (size_t i = 0; i < length;)
+        {
+            unsigned char c = static_cast<unsigned char>(str[i]);
+            uint32_t code;
+            size_t extra;
+            if (c < 0x80)
+            {
+                code = c;
+                extra = 0;
+            }
+            else if ((c & 0xE0) == 0xC0)
+            {
+                code = c & 0x1F;
+                extra = 1;
+            }
+            else if ((c & 0xF0) == 0xE0)
+            {
+                code = c & 0x0F;
+                extra = 2;
+            }
+            else if ((c & 0xF8) == 0xF0)
+            {
+                code = c & 0x07;
+                extra = 3;
+            }
+            else
+            {
+                result.push_back(Char(0xFFFD));
+                i++;
+                continue;
+            }
+
+            size_t j = 1;
+            for (; j <= extra && i + j < length && (static_cast<unsigned char>(str[i + j]) & 0xC0) == 0x80; j++)
+                code = (code << 6) | (static_cast<unsigned char>(str[i + j]) & 0x3F);
+            i += j;
+            if (j <= extra)
+                code = 0xFFFD;
+
+            if (code >= 0x10000)
+            {
+                code -= 0x10000;
+                result.push_back(Char(0xD800 + (code >> 10)));
+                result.push_back(Char(0xDC00 + (code & 0x3FF)));
+            }
+            else
+                result.push_back(Char(code));
+        }
+        return result;
+    }
+#endif
+}
+
+RegEnvironment::RegEnvironment()
+    : _slots(64, 0)
+    , _count(0)
+{
+}
+
+std::shared_ptr<RegEnvironment> RegEnvironment::Snapshot()
+{
+    std::shared_ptr<RegEnvironment> environment = std::make_shared<RegEnvironment>();
+#ifdef _WIN32
+    LPWCH block = GetEnvironmentStringsW();
+    if (block == NULL)
+        return environment;
+    for (const Char *entry = block; *entry != 0; entry += STRLEN(entry) + 1)
+    {
+        // Entries like "=C:=C:\dir" hold per-drive directories, not variables.
+        const Char *equals = entry[0] == '=' ? nullptr : wcschr(entry, L'=');
+        if (equals != nullptr)
+            environment->Set(String(entry, equals - entry), String(equals + 1));
+    }
+    FreeEnvironmentStringsW(block);
+#else
+    for (char **entry = environ; entry != nullptr && *entry != nullptr; entry++)
+    {
+        const char *equals = strchr(*entry, '=');
+        if (equals != nullptr && equals != *entry)
+            environment->Set(DecodeUtf8(*entry, equals - *entry), DecodeUtf8(equals + 1, strlen(equals + 1)));
+    }
+#endif
+    return environment;
+}
+
+size_t RegEnvironment::_FindSlot(const Char *name, size_t length, uint32_t hash) const
+{
+    size_t mask = _slots.size() - 1;
+    for (size_t slot = hash & mask;; slot = (slot + 1) & mask)
+    {
+        uint32_t index = _slots[slot];
+        if (index == 0)
+            return slot;
+        const Variable &variable = _variables[index - 1];
+        if (variable.hash == hash && RegString::EqualsFold(variable.name.c_str(), variable.name.size(), name, length))
+            return slot;
+    }
+}
+
+void RegEnvironment::_Grow()
+{
+    std::vector<uint32_t> slots(_slots.size() * 2, 0);
+    size_t mask = slots.size() - 1;
+    for (size_t i = 0; i < _variables.size(); i++)
+    {
+        size_t slot = _variables[i].hash & mask;
+        while (slots[slot] != 0)
+            slot = (slot + 1) & mask;
+        slots[slot] = uint32_t(i + 1);
+    }
+    _slots.swap(slots);
+}
+
+void RegEnvironment::Set(const String &name, const String &value)
+{
+    uint32_t hash = RegString::HashFold(name);
+    size_t slot = _FindSlot(name.c_str(), name.size(), hash);
+    if (_slots[slot] != 0)
+    {
+        _variables[_slots[slot] - 1].value = value;
+        return;
+    }
+
+    _variables.push_back({name, value, hash});
+    _slots[slot] = uint32_t(_variables.size());
+    // Keep the load factor under a half so probe runs stay short.
+    if (++_count * 2 > _slots.size())
+        _Grow();
+}
+
+const String *RegEnvironment::Find(const Char *name, size_t length) const
+{
+    size_t slot = _FindSlot(name, length, RegString::HashFold(name, length));
+    uint32_t index = _slots[slot];
+    return index != 0 ? &_variables[index - 1].value : nullptr;
+}
+
+String RegEnvironment::Expand(const Char *text, size_t length) const
+{
+    String result;
+    result.reserve(length);
+    size_t copied = 0;
+    for (size_t i = 0; i < length; i++)
+    {
+        if (text[i] != '%')
+            continue;
+
+        size_t end = i + 1;
+        while (end < length && text[end] != '%')
+            end++;
+        if (end == length)
+            break;
+
+        // An unknown name is kept along with its first '%'; the closing one may open the next name.
+        const String *value = end > i + 1 ? Find(text + i + 1, end - i - 1) : nullptr;
+        if (value == nullptr)
+        {
+            i = end - 1;
+            continue;
+        }
+        result.append(text + copied, i - copied);
+        result.append(*value);
+        copied = end + 1;
+        i = end;
+    }
+    result.append(text + copied, length - copied);
+    return result;
+}
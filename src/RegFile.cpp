@@ -0,0 +1,63 @@
+#include "RegFile.h"
+#include <cstring>
+
+namespace
+{
+#ifdef _WIN32
+    std::wstring WidenPath(const std::string &file)
+    {
+        int length = MultiByteToWideChar(CP_UTF8, 0, file.c_str(), int(file.size()), NULL, 0);
+        std::wstring result(length, L'\0');
+        if (length > 0)
+            MultiByteToWideChar(CP_UTF8, 0, file.c_str(), int(file.size()), &result[0], length);
+        return result;
+    }
+#endif
+}
+
+FILE *RegFile::Open(const std::string &file, const char *mode)
+{
+#ifdef _WIN32
+    std::wstring wideMode(mode, mode + strlen(mode));
+    return _wfopen(WidenPath(file).c_str(), wideMode.c_str());
+#else
+    return fopen(file.c_str(), mode);
+#endif
+}
+
+bool RegFile::Replace(const std::string &from, const std::string &to)
+{
+#ifdef _WIN32
+    return MoveFileExW(WidenPath(from).c_str(), WidenPath(to).c_str(), MOVEFILE_REPLACE_EXISTING) != FALSE;
+#else
+    return rename(from.c_str(), to.c_str()) == 0;
+#endif
+}
+
+void RegFile::Remove(const std::string &file)
+{
+#ifdef _WIN32
+    DeleteFileW(WidenPath(file).c_str());
+#else
+    remove(file.c_str());
+#endif
+}
+
+bool RegFile::Read(const std::string &file, ByteArray &out)
+{
+    FILE *fp = Open(file, "rb");
+    if (fp == NULL)
+        return false;
+
+    out.clear();
+    bool read = fseek(fp, 0, SEEK_END) == 0;
+    long size = read ? ftell(fp) : -1;
+    read = size >= 0 && fseek(fp, 0, SEEK_SET) == 0;
+    if (read && size > 0)
+    {
+        out.resize(size_t(size));
+        read = fread(out.data(), 1, out.size(), fp) == out.size();
+    }
+    fclose(fp);
+    return read;
+}
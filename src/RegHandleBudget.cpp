@@ -0,0 +1,89 @@
+#include "RegHandleBudget.h"
+
+RegHandleBudget &RegHandleBudget::Shared()
+{
+    // Leaked on purpose: keys may be finalized after static destructors have run.
+    static RegHandleBudget *budget = new RegHandleBudget();
+    return *budget;
+}
+
+RegHandleBudget::RegHandleBudget()
+    : _limit(0)
+    , _stats()
+{
+}
+
+void RegHandleBudget::SetLimit(size_t limit)
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    _limit.store(limit, std::memory_order_relaxed);
+    _Trim(nullptr);
+}
+
+void RegHandleBudget::Opened(Entry *entry, bool reopened)
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    if (entry->_listed)
+        _entries.erase(entry->_position);
+    else
+        _stats.open++;
+    _entries.push_front(entry);
+    entry->_position = _entries.begin();
+    entry->_thread = std::this_thread::get_id();
+    entry->_listed = true;
+    if (reopened)
+        _stats.reopens++;
+    if (_stats.open > _stats.peak)
+        _stats.peak = _stats.open;
+    _Trim(entry);
+}
+
+void RegHandleBudget::Closed(Entry *entry)
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    if (!entry->_listed)
+        return;
+    _entries.erase(entry->_position);
+    entry->_listed = false;
+    _stats.open--;
+}
+
+void RegHandleBudget::_Touch(Entry *entry)
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    if (entry->_listed && entry->_position != _entries.begin())
+        _entries.splice(_entries.begin(), _entries, entry->_position);
+}
+
+void RegHandleBudget::_Pin(Entry *entry, int delta)
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    entry->_pins += delta;
+}
+
+void RegHandleBudget::_Trim(const Entry *keep)
+{
+    size_t limit = _limit.load(std::memory_order_relaxed);
+    if (limit == 0)
+        return;
+
+    std::thread::id thread = std::this_thread::get_id();
+    auto it = _entries.end();
+    while (_stats.open > limit && it != _entries.begin())
+    {
+        --it;
+        Entry *entry = *it;
+        if (entry == keep || entry->_pins > 0 || entry->_thread != thread || !entry->_Evict())
+            continue;
+        it = _entries.erase(it);
+        entry->_listed = false;
+        _stats.open--;
+        _stats.evictions++;
+    }
+}
+
+RegHandleBudgetStats RegHandleBudget::GetStats()
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    return _stats;
+}
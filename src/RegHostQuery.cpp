@@ -0,0 +1,187 @@
+#include "RegHostQuery.h"
+#include "RegConnectionPool.h"
+#include <algorithm>
+#include <thread>
+
+std::shared_ptr<RegHostQuery> RegHostQuery::Create(const std::shared_ptr<RegBackend> &backend,
+                                                   std::vector<String> &&hosts,
+                                                   HKEY baseKey,
+                                                   const String &subKey,
+                                                   std::vector<String> &&values,
+                                                   const RegHostQueryOptions &options,
+                                                   ResultCallback onResult,
+                                                   DoneCallback onDone)
+{
+    return std::shared_ptr<RegHostQuery>(new RegHostQuery(backend, std::move(hosts), baseKey, subKey,
+                                                          std::move(values), options,
+                                                          std::move(onResult), std::move(onDone)));
+}
+
+RegHostQuery::RegHostQuery(const std::shared_ptr<RegBackend> &backend,
+                           std::vector<String> &&hosts,
+                           HKEY baseKey,
+                           const String &subKey,
+                           std::vector<String> &&values,
+                           const RegHostQueryOptions &options,
+                           ResultCallback onResult,
+                           DoneCallback onDone)
+    : _backend(backend)
+    , _hosts(std::move(hosts))
+    , _baseKey(baseKey)
+    , _subKey(subKey)
+    , _values(std::move(values))
+    , _options(options)
+    , _onResult(std::move(onResult))
+    , _onDone(std::move(onDone))
+    , _next(0)
+    , _remaining(_hosts.size())
+    , _cancelled(false)
+{
+    if (_options.concurrency == 0)
+        _options.concurrency = 1;
+}
+
+void RegHostQuery::Start()
+{
+    std::shared_ptr<RegHostQuery> self = shared_from_this();
+    size_t workers = std::min(_options.concurrency, _hosts.size());
+    for (size_t i = 0; i < workers; i++)
+    {
+        std::thread([self]() {
+            self->_Work();
+        }).detach();
+    }
+    std::thread([self]() {
+        self->_Watch();
+    }).detach();
+}
+
+void RegHostQuery::Cancel()
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    if (_cancelled)
+        return;
+    _cancelled = true;
+    _remaining -= _hosts.size() - _next;
+    _next = _hosts.size();
+    _changed.notify_all();
+}
+
+void RegHostQuery::_Work()
+{
+    std::unique_lock<std::mutex> lock(_mutex);
+    while (_next < _hosts.size())
+    {
+        Running running;
+        running.index = _next++;
+        running.start = Clock::now();
+        running.deadline = _options.timeout > 0 ? running.start + std::chrono::milliseconds(_options.timeout)
+                                                : Clock::time_point::max();
+        _running.push_back(running);
+        _changed.notify_all();
+        lock.unlock();
+
+        RegHostResult result = _Query(_hosts[running.index]);
+        result.elapsed = std::chrono::duration<double, std::milli>(Clock::now() - running.start).count();
+
+        lock.lock();
+        auto it = std::find_if(_running.begin(), _running.end(), [&running](const Running &r) {
+            return r.index == running.index;
+        });
+        // Timed out: the host was reported and this thread has been replaced.
+        if (it == _running.end())
+            return;
+        _running.erase(it);
+        lock.unlock();
+        _onResult(std::move(result));
+        lock.lock();
+        _remaining--;
+        _changed.notify_all();
+    }
+}
+
+void RegHostQuery::_Watch()
+{
+    std::unique_lock<std::mutex> lock(_mutex);
+    while (_remaining > 0)
+    {
+        Clock::time_point now = Clock::now();
+        Clock::time_point next = Clock::time_point::max();
+        std::vector<Running> expired;
+        for (auto it = _running.begin(); it != _running.end();)
+        {
+            if (it->deadline <= now)
+            {
+                expired.push_back(*it);
+                it = _running.erase(it);
+            }
+            else
+            {
+                next = std::min(next, it->deadline);
+                it++;
+            }
+        }
+
+        if (!expired.empty())
+        {
+            std::shared_ptr<RegHostQuery> self = shared_from_this();
+            for (size_t i = 0; i < expired.size() && _next < _hosts.size(); i++)
+            {
+                std::thread([self]() {
+                    self->_Work();
+                }).detach();
+            }
+            lock.unlock();
+            for (auto it = expired.begin(); it != expired.end(); it++)
+            {
+                RegHostResult result;
+                result.host = _hosts[it->index];
+                result.status = ERROR_TIMEOUT;
+                result.elapsed = std::chrono::duration<double, std::milli>(now - it->start).count();
+                _onResult(std::move(result));
+            }
+            lock.lock();
+            _remaining -= expired.size();
+            continue;
+        }
+
+        if (next == Clock::time_point::max())
+            _changed.wait(lock);
+        else
+            _changed.wait_until(lock, next);
+    }
+    bool cancelled = _cancelled;
+    lock.unlock();
+    _onDone(cancelled ? ERROR_CANCELLED : ERROR_SUCCESS);
+}
+
+RegHostResult RegHostQuery::_Query(const String &host)
+{
+    RegHostResult result;
+    result.host = host;
+
+    HKEY root = NULL;
+    result.status = RegConnectionPool::Shared().Acquire(_backend, host, _baseKey, &root);
+    if (result.status != ERROR_SUCCESS)
+        return result;
+    RegKey key(_backend);
+    key.Open(root, _subKey, _options.access);
+    result.status = key.GetLastStatus();
+    RegConnectionPool::Shared().Release(_backend, root, result.status);
+    if (result.status != ERROR_SUCCESS)
+        return result;
+
+    if (_values.empty())
+    {
+        result.values = key.GetValues();
+        result.statuses.assign(result.values.size(), ERROR_SUCCESS);
+        return result;
+    }
+    for (auto it = _values.begin(); it != _values.end(); it++)
+    {
+        bool success = false;
+        result.values.push_back(key.GetValue(*it, &success));
+        result.statuses.push_back(success ? ERROR_SUCCESS : key.GetLastStatus());
+    }
+    return result;
+}
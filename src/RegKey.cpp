@@ -1,27 +1,51 @@
 #include "RegKey.h"
+#include "RegCodec.h"
+#include "RegConnectionPool.h"
+#include "RegString.h"
+#include "RegTrace.h"
+#include <algorithm>
+
+namespace
+{
+    template <DWORD Type>
+    bool DecodeAs(DWORD type, const ByteArray &data, typename RegCodec<Type>::Value &value)
+    {
+        return type == Type && RegCodec<Type>::Decode(data.data(), data.size(), value);
+    }
+
+    template <DWORD Type>
+    bool EncodeAs(const typename RegCodec<Type>::Value &value, ByteArray &data)
+    {
+        return RegCodec<Type>::Encode(value, data);
+    }
+}
 
 RegKey::RegKey(HKEY baseKey, const String &subKeyName, const String &hostname, REGSAM access)
-    : _hKey(NULL)
+    : _backend(RegBackend::GetDefault())
+    , _hKey(NULL)
     , _lastStatus(ERROR_SUCCESS)
 {
     if (baseKey)
         ConnectAndCreate(baseKey, subKeyName, hostname, access);
 }
 
+RegKey::RegKey(const std::shared_ptr<RegBackend> &backend, HKEY hKey)
+    : _backend(backend)
+    , _hKey(hKey)
+    , _lastStatus(ERROR_SUCCESS)
+{
+}
+
 HKEY RegKey::Open(HKEY baseKey, const String &subKeyName, REGSAM access)
 {
     if (!Close())
         return NULL;
 
-    if (access)
+    if (SetLastStatus(REG_TRACED(OpenKey, baseKey, subKeyName.c_str(),
+                                 _backend->OpenKey(baseKey, subKeyName.c_str(), access, &_hKey))) == ERROR_SUCCESS)
     {
-        if (SetLastStatus(RegOpenKeyExW(baseKey, subKeyName.c_str(), access, 0, &_hKey)) == ERROR_SUCCESS)
-            return _hKey;
-    }
-    else
-    {
-        if (SetLastStatus(RegOpenKeyW(baseKey, subKeyName.c_str(), &_hKey)) == ERROR_SUCCESS)
-            return _hKey;
+        RegTrace::NameKey(_hKey, baseKey, subKeyName.c_str());
+        return _hKey;
     }
     _hKey = NULL;
     return NULL;
@@ -32,16 +56,11 @@ HKEY RegKey::Create(HKEY baseKey, const String &subKeyName, REGSAM access)
     if (!Close())
         return NULL;
 
-    if (access)
-    {
-        if (SetLastStatus(RegCreateKeyExW(baseKey, subKeyName.c_str(), 0, NULL,
-                                          REG_OPTION_NON_VOLATILE, access, NULL, &_hKey, NULL)) == ERROR_SUCCESS)
-            return _hKey;
-    }
-    else
+    if (SetLastStatus(REG_TRACED(CreateKey, baseKey, subKeyName.c_str(),
+                                 _backend->CreateKey(baseKey, subKeyName.c_str(), access, &_hKey))) == ERROR_SUCCESS)
     {
-        if (SetLastStatus(RegCreateKeyW(baseKey, subKeyName.c_str(), &_hKey)) == ERROR_SUCCESS)
-            return _hKey;
+        RegTrace::NameKey(_hKey, baseKey, subKeyName.c_str());
+        return _hKey;
     }
     _hKey = NULL;
     return NULL;
@@ -52,8 +71,13 @@ HKEY RegKey::Connect(const String &hostname, HKEY baseKey)
     if (!Close())
         return NULL;
 
-    if (SetLastStatus(RegConnectRegistryW(hostname.c_str(), baseKey, &_hKey)) == ERROR_SUCCESS)
+    if (SetLastStatus(REG_TRACED(ConnectRegistry, baseKey, hostname.c_str(),
+                                 _backend->ConnectRegistry(hostname.c_str(), baseKey, &_hKey))) == ERROR_SUCCESS)
+    {
+        if (RegTrace::IsEnabled())
+            RegTrace::NameKey(_hKey, STR("\\\\") + hostname + STR("\\") + RegTrace::GetKeyPath(baseKey));
         return _hKey;
+    }
     _hKey = NULL;
     return NULL;
 }
@@ -63,40 +87,47 @@ HKEY RegKey::ConnectAndCreate(HKEY baseKey, const String &subKeyName, const Stri
     if (!Close())
         return NULL;
 
-    HKEY hKey = baseKey;
+    HKEY rootKey = baseKey;
     if (!hostname.empty())
     {
-        if (SetLastStatus(RegConnectRegistryW(hostname.c_str(), hKey, &hKey)) != ERROR_SUCCESS)
+        if (SetLastStatus(RegConnectionPool::Shared().Acquire(_backend, hostname, baseKey, &rootKey)) != ERROR_SUCCESS)
             return NULL;
     }
-    if (!subKeyName.empty())
+    else if (subKeyName.empty())
     {
-        if (access)
-        {
-            if (SetLastStatus(RegCreateKeyExW(baseKey, subKeyName.c_str(), 0, NULL,
-                                              REG_OPTION_NON_VOLATILE, access, NULL, &hKey, NULL)) != ERROR_SUCCESS)
-            {
-                if (hKey != baseKey)
-                    RegCloseKey(hKey);
-                return NULL;
-            }
-        }
-        else
-        {
-            if (SetLastStatus(RegCreateKeyW(baseKey, subKeyName.c_str(), &hKey)) != ERROR_SUCCESS)
-            {
-                if (hKey != baseKey)
-                    RegCloseKey(hKey);
-                return NULL;
-            }
-        }
+        _hKey = rootKey;
+        return _hKey;
+    }
+
+    HKEY hKey = NULL;
+    if (subKeyName.empty())
+    {
+        // The connection stays with the pool, so the key gets a handle of its own to the root.
+        SetLastStatus(REG_TRACED(OpenKey, rootKey, STR(""),
+                                 _backend->OpenKey(rootKey, STR(""), access != 0 ? access : MAXIMUM_ALLOWED, &hKey)));
     }
+    else
+        SetLastStatus(REG_TRACED(CreateKey, rootKey, subKeyName.c_str(),
+                                 _backend->CreateKey(rootKey, subKeyName.c_str(), access, &hKey)));
+    if (_lastStatus == ERROR_SUCCESS)
+        RegTrace::NameKey(hKey, rootKey, subKeyName.c_str());
+    // The connected root is only needed to reach the key.
+    if (rootKey != baseKey)
+        RegConnectionPool::Shared().Release(_backend, rootKey, _lastStatus);
+    if (_lastStatus != ERROR_SUCCESS)
+        return NULL;
     _hKey = hKey;
     return hKey;
 }
 
 HKEY RegKey::Attach(HKEY hKey)
 {
+    // The buffer belongs to the old handle.
+    if (_writeBuffer)
+    {
+        _writeBuffer->Close();
+        _writeBuffer.reset();
+    }
     HKEY oldKey = _hKey;
     _hKey = hKey;
     _lastStatus = ERROR_SUCCESS;
@@ -105,9 +136,22 @@ HKEY RegKey::Attach(HKEY hKey)
 
 bool RegKey::Close()
 {
+    if (_writeBuffer)
+    {
+        LSTATUS status = _writeBuffer->Close();
+        _writeBuffer.reset();
+        if (SetLastStatus(status) != ERROR_SUCCESS)
+        {
+            // Pending writes are lost, but the handle must not leak.
+            if (_hKey != NULL)
+                REG_TRACED(CloseKey, _hKey, nullptr, _backend->CloseKey(_hKey));
+            _hKey = NULL;
+            return false;
+        }
+    }
     if (_hKey != NULL)
     {
-        SetLastStatus(RegCloseKey(_hKey));
+        SetLastStatus(REG_TRACED(CloseKey, _hKey, nullptr, _backend->CloseKey(_hKey)));
         _hKey = NULL;
         return _lastStatus == ERROR_SUCCESS;
     }
@@ -117,39 +161,69 @@ bool RegKey::Close()
 bool RegKey::IsWritable()
 {
     HKEY hKey = NULL;
-    if (SetLastStatus(RegOpenKeyExW(_hKey, NULL, 0, KEY_WRITE, &hKey)) != ERROR_SUCCESS)
+    if (SetLastStatus(REG_TRACED(OpenKey, _hKey, nullptr, _backend->OpenKey(_hKey, nullptr, KEY_WRITE, &hKey))) != ERROR_SUCCESS)
         return false;
-    RegCloseKey(hKey);
+    REG_TRACED(CloseKey, hKey, nullptr, _backend->CloseKey(hKey));
     return true;
 }
 
 bool RegKey::Flush()
 {
-    return SetLastStatus(RegFlushKey(_hKey)) == ERROR_SUCCESS;
+    if (!FlushWriteBack())
+        return false;
+    return SetLastStatus(REG_TRACED(FlushKey, _hKey, nullptr, _backend->FlushKey(_hKey))) == ERROR_SUCCESS;
+}
+
+bool RegKey::EnableWriteBack(const RegWriteBackOptions &options)
+{
+    if (_hKey == NULL)
+    {
+        SetLastStatus(ERROR_INVALID_HANDLE);
+        return false;
+    }
+    if (!DisableWriteBack())
+        return false;
+    _writeBuffer = RegWriteBuffer::Create(_backend, _hKey, options);
+    return true;
+}
+
+bool RegKey::DisableWriteBack()
+{
+    if (!_writeBuffer)
+        return true;
+    LSTATUS status = _writeBuffer->Close();
+    _writeBuffer.reset();
+    return SetLastStatus(status) == ERROR_SUCCESS;
+}
+
+bool RegKey::FlushWriteBack()
+{
+    if (!_writeBuffer)
+        return true;
+    return SetLastStatus(_writeBuffer->Flush()) == ERROR_SUCCESS;
 }
 
 bool RegKey::CopyTree(HKEY hSrc)
 {
-    return SetLastStatus(RegCopyTreeW(hSrc, NULL, _hKey)) == ERROR_SUCCESS;
+    if (!FlushWriteBack())
+        return false;
+    return SetLastStatus(REG_TRACED(CopyTree, hSrc, nullptr, _backend->CopyTree(hSrc, nullptr, _hKey))) == ERROR_SUCCESS;
 }
 
 bool RegKey::Rename(const String &newName)
 {
-    return SetLastStatus(RegRenameKey(_hKey, NULL, newName.c_str())) == ERROR_SUCCESS;
+    return SetLastStatus(REG_TRACED(RenameKey, _hKey, newName.c_str(),
+                                    _backend->RenameKey(_hKey, nullptr, newName.c_str()))) == ERROR_SUCCESS;
 }
 
 HKEY RegKey::OpenSubKey(const String &subKeyName, REGSAM access)
 {
     HKEY hKey = NULL;
-    if (access)
-    {
-        if (SetLastStatus(RegOpenKeyExW(_hKey, subKeyName.c_str(), 0, access, &hKey)) == ERROR_SUCCESS)
-            return hKey;
-    }
-    else
+    if (SetLastStatus(REG_TRACED(OpenKey, _hKey, subKeyName.c_str(),
+                                 _backend->OpenKey(_hKey, subKeyName.c_str(), access, &hKey))) == ERROR_SUCCESS)
     {
-        if (SetLastStatus(RegOpenKeyW(_hKey, subKeyName.c_str(), &hKey)) == ERROR_SUCCESS)
-            return hKey;
+        RegTrace::NameKey(hKey, _hKey, subKeyName.c_str());
+        return hKey;
     }
 
     return NULL;
@@ -158,16 +232,11 @@ HKEY RegKey::OpenSubKey(const String &subKeyName, REGSAM access)
 HKEY RegKey::CreateSubKey(const String &subKeyName, REGSAM access)
 {
     HKEY hKey = NULL;
-    if (access)
-    {
-        if (SetLastStatus(RegCreateKeyExW(_hKey, subKeyName.c_str(), 0, NULL,
-                                          REG_OPTION_NON_VOLATILE, access, NULL, &hKey, NULL)) == ERROR_SUCCESS)
-            return hKey;
-    }
-    else
+    if (SetLastStatus(REG_TRACED(CreateKey, _hKey, subKeyName.c_str(),
+                                 _backend->CreateKey(_hKey, subKeyName.c_str(), access, &hKey))) == ERROR_SUCCESS)
     {
-        if (SetLastStatus(RegCreateKeyW(_hKey, subKeyName.c_str(), &hKey)) == ERROR_SUCCESS)
-            return hKey;
+        RegTrace::NameKey(hKey, _hKey, subKeyName.c_str());
+        return hKey;
     }
 
     return NULL;
@@ -175,86 +244,126 @@ HKEY RegKey::CreateSubKey(const String &subKeyName, REGSAM access)
 
 bool RegKey::DeleteTree()
 {
-    return SetLastStatus(RegDeleteTreeW(_hKey, NULL)) == ERROR_SUCCESS;
+    if (!FlushWriteBack())
+        return false;
+    return SetLastStatus(REG_TRACED(DeleteTree, _hKey, nullptr, _backend->DeleteTree(_hKey, nullptr))) == ERROR_SUCCESS;
 }
 
 bool RegKey::DeleteTree(const String &subKeyName)
 {
-    return SetLastStatus(RegDeleteKeyW(_hKey, subKeyName.c_str())) == ERROR_SUCCESS;
+    return SetLastStatus(REG_TRACED(DeleteKey, _hKey, subKeyName.c_str(),
+                                    _backend->DeleteKey(_hKey, subKeyName.c_str()))) == ERROR_SUCCESS;
 }
 
 bool RegKey::DeleteSubKey(const String &subKeyName)
 {
-    return SetLastStatus(RegDeleteTreeW(_hKey, subKeyName.c_str())) == ERROR_SUCCESS;
+    return SetLastStatus(REG_TRACED(DeleteTree, _hKey, subKeyName.c_str(),
+                                    _backend->DeleteTree(_hKey, subKeyName.c_str()))) == ERROR_SUCCESS;
 }
 
 bool RegKey::HasSubKey(const String &subKeyName)
 {
     HKEY hKey = NULL;
-    if (SetLastStatus(RegOpenKeyW(_hKey, subKeyName.c_str(), &hKey)) != ERROR_SUCCESS)
+    if (SetLastStatus(REG_TRACED(OpenKey, _hKey, subKeyName.c_str(),
+                                 _backend->OpenKey(_hKey, subKeyName.c_str(), 0, &hKey))) != ERROR_SUCCESS)
     {
         return false;
     }
-    RegCloseKey(hKey);
+    REG_TRACED(CloseKey, hKey, nullptr, _backend->CloseKey(hKey));
     return true;
 }
 
+bool RegKey::QueryInfo(RegKeyInfo *info)
+{
+    // Counts and enumerations must include buffered values.
+    if (!FlushWriteBack())
+        return false;
+    return SetLastStatus(REG_TRACED(QueryInfoKey, _hKey, nullptr, _backend->QueryInfoKey(_hKey, info))) == ERROR_SUCCESS;
+}
+
 std::vector<String> RegKey::GetSubKeyNames()
 {
     std::vector<String> subKeyNames;
-    DWORD maxKeyLen = 0;
-    if (SetLastStatus(RegQueryInfoKeyW(_hKey, NULL, NULL, NULL, NULL, &maxKeyLen, NULL, NULL, NULL, NULL, NULL, NULL)) != ERROR_SUCCESS)
+    RegKeyInfo info;
+    if (!QueryInfo(&info))
         return subKeyNames;
-    maxKeyLen++;
-    std::unique_ptr<wchar_t[]> subkeyName(new wchar_t[maxKeyLen]);
+    DWORD maxKeyLen = info.maxSubKeyLength + 1;
+    std::unique_ptr<Char[]> subkeyName(new Char[maxKeyLen]);
     for (DWORD index = 0;; index++)
     {
-        if (SetLastStatus(RegEnumKeyW(_hKey, index, subkeyName.get(), maxKeyLen)) != ERROR_SUCCESS)
+        DWORD nameLength = maxKeyLen;
+        if (SetLastStatus(REG_TRACED(EnumKey, _hKey, nullptr,
+                                     _backend->EnumKey(_hKey, index, subkeyName.get(), &nameLength))) != ERROR_SUCCESS)
             break;
-        subKeyNames.push_back(subkeyName.get());
+        subKeyNames.push_back(String(subkeyName.get(), nameLength));
     }
     return subKeyNames;
 }
 
+LSTATUS RegKey::_QueryValue(const String &valueName, DWORD *type, BYTE *data, DWORD *size)
+{
+    LSTATUS status;
+    if (_writeBuffer && _writeBuffer->QueryValue(valueName, type, data, size, &status))
+        return SetLastStatus(status);
+    return SetLastStatus(REG_TRACED(QueryValue, _hKey, valueName.c_str(),
+                                    _backend->QueryValue(_hKey, valueName.c_str(), type, data, size)));
+}
+
+LSTATUS RegKey::_SetValue(const String &valueName, DWORD type, const BYTE *data, DWORD size)
+{
+    if (_writeBuffer)
+        return SetLastStatus(_writeBuffer->SetValue(valueName, type, data, size));
+    return SetLastStatus(REG_TRACED(SetValue, _hKey, valueName.c_str(),
+                                    _backend->SetValue(_hKey, valueName.c_str(), type, data, size)));
+}
+
+LSTATUS RegKey::_QueryData(const String &valueName, DWORD *type, ByteArray &data, DWORD sizeHint)
+{
+    // Most values fit the first guess, which saves a separate size query.
+    DWORD size = sizeHint > 0 ? sizeHint : 1;
+    for (;;)
+    {
+        data.resize(size);
+        LSTATUS status = _QueryValue(valueName, type, data.data(), &size);
+        if (status == ERROR_SUCCESS)
+        {
+            data.resize(size);
+            return status;
+        }
+        if (status != ERROR_MORE_DATA)
+        {
+            data.clear();
+            return status;
+        }
+        // Some keys (HKEY_PERFORMANCE_DATA) do not report the size they need.
+        if (size <= data.size())
+            size = DWORD(data.size() * 2);
+    }
+}
+
 RegValue RegKey::GetValue(const String &valueName, bool *success)
 {
     RegValue info;
     info.name = valueName;
     info.type = REG_NONE;
 
-    DWORD size = 0;
-    if (SetLastStatus(RegQueryValueExW(_hKey, valueName.c_str(), NULL, &info.type, NULL, &size)) != ERROR_SUCCESS)
-    {
-        if (success != NULL)
-            *success = false;
-        return info;
-    }
-    if (size > 0)
-    {
-        info.data.resize(size);
-        if (SetLastStatus(RegQueryValueExW(_hKey, valueName.c_str(), NULL, NULL, info.data.data(), &size)) != ERROR_SUCCESS)
-    {
-            if (success != NULL)
-                *success = false;
-            return info;
-        }
-    }
+    bool res = _QueryData(valueName, &info.type, info.data) == ERROR_SUCCESS;
     if (success != NULL)
-        *success = true;
+        *success = res;
     return info;
 }
 
 DWORD RegKey::GetValueType(const String &valueName)
 {
     DWORD type = REG_NONE;
-    SetLastStatus(RegQueryValueExW(_hKey, valueName.c_str(), NULL, &type, NULL, NULL));
+    _QueryValue(valueName, &type, NULL, NULL);
     return type;
 }
 
 DWORD RegKey::GetValueSize(const String &valueName)
 {
     DWORD size = 0;
-    if (SetLastStatus(RegQueryValueExW(_hKey, valueName.c_str(), NULL, NULL, NULL, &size)) == ERROR_SUCCESS)
+    if (_QueryValue(valueName, NULL, NULL, &size) == ERROR_SUCCESS)
         return size;
     else
         return 0;
@@ -262,23 +371,8 @@ DWORD RegKey::GetValueSize(const String &valueName)
 
 ByteArray RegKey::GetBinaryValue(const String &valueName, bool *success)
 {
-    DWORD valueSize = 0;
-    if (SetLastStatus(RegQueryValueExW(_hKey, valueName.c_str(), NULL, NULL, NULL, &valueSize)) != ERROR_SUCCESS)
-    {
-        if (success != NULL)
-            *success = false;
-        return ByteArray();
-    }
-    if (valueSize == 0)
-    {
-        if (success != NULL)
-            *success = true;
-        return ByteArray();
-    }
-
-    ByteArray value(valueSize, 0);
-    bool res = (SetLastStatus(RegQueryValueExW(_hKey, valueName.c_str(), NULL, NULL, value.data(), &valueSize)) == ERROR_SUCCESS);
-
+    ByteArray value;
+    bool res = _QueryData(valueName, NULL, value) == ERROR_SUCCESS;
     if (success != NULL)
         *success = res;
     return value;
@@ -286,45 +380,28 @@ ByteArray RegKey::GetBinaryValue(const String &valueName, bool *success)
 
 String RegKey::GetStringValue(const String &valueName, bool *success)
 {
-    DWORD valueSize = 0;
-    DWORD type = 0;
-    if (SetLastStatus(RegQueryValueExW(_hKey, valueName.c_str(), NULL, &type, NULL, &valueSize)) != ERROR_SUCCESS)
-    {
-        if (success != NULL)
-            *success = false;
-        return STR("");
-    }
-    if (type != REG_SZ && type != REG_EXPAND_SZ)
+    String value;
+    DWORD type = REG_NONE;
+    ByteArray data;
+    bool res = _QueryData(valueName, &type, data) == ERROR_SUCCESS;
+    if (res && !DecodeAs<REG_SZ>(type, data, value) && !DecodeAs<REG_EXPAND_SZ>(type, data, value))
     {
         SetLastStatus(ERROR_INVALID_DATA);
-        if (success != NULL)
-            *success = false;
-        return STR("");
-    }
-    if (valueSize <= 0)
-    {
-        if (success != NULL)
-            *success = true;
-        return STR("");
+        res = false;
     }
-    
-    std::unique_ptr<Char[]> valueData(new Char[valueSize]);
-    bool res = (SetLastStatus(RegQueryValueExW(_hKey, valueName.c_str(), NULL, NULL, LPBYTE(valueData.get()), &valueSize)) == ERROR_SUCCESS);
+
     if (success != NULL)
         *success = res;
-
-    String value = res ? valueData.get() : STR("");
     return value;
 }
 
 DWORD RegKey::GetDwordValue(const String &valueName, bool *success)
 {
     DWORD value = 0;
-    DWORD valueSize = sizeof(value);
     DWORD type = REG_NONE;
-    bool res = (SetLastStatus(RegQueryValueExW(_hKey, valueName.c_str(), NULL, &type, LPBYTE(&value), &valueSize)) == ERROR_SUCCESS);
-
-    if (type != REG_DWORD)
+    ByteArray data;
+    bool res = _QueryData(valueName, &type, data, sizeof(DWORD)) == ERROR_SUCCESS;
+    if (res && !DecodeAs<REG_DWORD>(type, data, value) && !DecodeAs<REG_DWORD_BIG_ENDIAN>(type, data, value))
     {
         SetLastStatus(ERROR_INVALID_DATA);
         res = false;
@@ -338,11 +415,10 @@ DWORD RegKey::GetDwordValue(const String &valueName, bool *success)
 QWORD RegKey::GetQwordValue(const String &valueName, bool *success)
 {
     QWORD value = 0;
-    DWORD valueSize = sizeof(value);
     DWORD type = REG_NONE;
-    bool res = (SetLastStatus(RegQueryValueExW(_hKey, valueName.c_str(), NULL, &type, LPBYTE(&value), &valueSize)) == ERROR_SUCCESS);
-
-    if (type != REG_QWORD)
+    ByteArray data;
+    bool res = _QueryData(valueName, &type, data, sizeof(QWORD)) == ERROR_SUCCESS;
+    if (res && !DecodeAs<REG_QWORD>(type, data, value))
     {
         SetLastStatus(ERROR_INVALID_DATA);
         res = false;
@@ -355,39 +431,16 @@ QWORD RegKey::GetQwordValue(const String &valueName, bool *success)
 
 std::vector<String> RegKey::GetMultiStringValue(const String &valueName, bool *success)
 {
-    DWORD valueSize = 0;
+    std::vector<String> values;
     DWORD type = REG_NONE;
-    if (SetLastStatus(RegQueryValueExW(_hKey, valueName.c_str(), NULL, &type, NULL, &valueSize)) != ERROR_SUCCESS)
-    {
-        if (success != NULL)
-            *success = false;
-        return {};
-    }
-    if (type != REG_MULTI_SZ)
+    ByteArray data;
+    bool res = _QueryData(valueName, &type, data) == ERROR_SUCCESS;
+    if (res && !DecodeAs<REG_MULTI_SZ>(type, data, values))
     {
         SetLastStatus(ERROR_INVALID_DATA);
-        if (success != NULL)
-            *success = false;
-        return {};
-    }
-
-    std::vector<String> values;
-
-    if (valueSize <= 0)
-    {
-        if (success != NULL)
-            *success = true;
-        return values;
+        res = false;
     }
 
-    std::unique_ptr<Char[]> valueData(new Char[valueSize]);
-    bool res = (SetLastStatus(RegQueryValueExW(_hKey, valueName.c_str(), NULL, NULL, LPBYTE(valueData.get()), &valueSize)) == ERROR_SUCCESS);
-    if (res)
-    {
-        for (wchar_t *p = valueData.get(); *p != 0; p += STRLEN(p) + 1)
-            values.push_back(p);
-    }
-    
     if (success != NULL)
         *success = res;
     return values;
@@ -395,62 +448,62 @@ std::vector<String> RegKey::GetMultiStringValue(const String &valueName, bool *s
 
 std::vector<RegValue> RegKey::GetValues()
 {
-    DWORD maxName = 0, maxValue = 0;
-    if (SetLastStatus(
-            RegQueryInfoKeyW(_hKey, NULL, NULL, NULL, NULL, NULL, NULL, NULL, &maxName, &maxValue, NULL, NULL)
-            != ERROR_SUCCESS))
+    RegKeyInfo info;
+    if (!QueryInfo(&info))
         return {};
-    maxName++;
+    DWORD maxName = info.maxValueNameLength + 1;
+    DWORD maxValue = info.maxValueLength;
 
     std::vector<RegValue> values;
-    wchar_t *valueName = new wchar_t[maxName];
-    byte *valueData = new byte[maxValue];
+    std::unique_ptr<Char[]> valueName(new Char[maxName]);
+    ByteArray valueData(maxValue);
 
     for (DWORD index = 0; ; index++)
     {
         RegValue valueInfo;
         DWORD valueNameSize = maxName;
         valueInfo.type = REG_NONE;
-        DWORD valueSize = 0;
-        if (SetLastStatus(RegEnumValueW(_hKey, index, valueName, &valueNameSize, NULL,
-                &valueInfo.type, NULL, &valueSize)) != ERROR_SUCCESS)
-            break;
-            
-        valueInfo.name = valueName;
-
-        if (valueSize > 0)
+        DWORD valueSize = maxValue;
+        LSTATUS status = SetLastStatus(REG_TRACED(EnumValue, _hKey, nullptr,
+            _backend->EnumValue(_hKey, index, valueName.get(), &valueNameSize, &valueInfo.type,
+                                valueData.data(), &valueSize)));
+        if (status == ERROR_MORE_DATA)
         {
-            if (SetLastStatus(RegQueryValueExW(_hKey, valueInfo.name.c_str(), NULL, NULL, LPBYTE(valueData), &valueSize)) != ERROR_SUCCESS)
+            // The value grew since QueryInfo, read it by name instead.
+            valueInfo = GetValue(String(valueName.get(), valueNameSize));
+            if (_lastStatus != ERROR_SUCCESS)
                 continue;
-            valueInfo.data.assign(valueData, valueData + valueSize);
+        }
+        else if (status != ERROR_SUCCESS)
+            break;
+        else
+        {
+            valueInfo.name.assign(valueName.get(), valueNameSize);
+            valueInfo.data.assign(valueData.data(), valueData.data() + valueSize);
         }
         values.push_back(valueInfo);
     }
 
-    delete[] valueData;
-    delete[] valueName;
-
     return values;
 }
 
 std::vector<String> RegKey::GetValueNames()
 {
     std::vector<String> valueNames;
-    DWORD maxNameSize = 0;
-    if (SetLastStatus(
-            RegQueryInfoKeyW(_hKey, NULL, NULL, NULL, NULL, NULL, NULL, NULL, &maxNameSize, NULL, NULL, NULL)
-            != ERROR_SUCCESS))
+    RegKeyInfo info;
+    if (!QueryInfo(&info))
         return valueNames;
-    
-    maxNameSize++;
+
+    DWORD maxNameSize = info.maxValueNameLength + 1;
     std::unique_ptr<Char[]> valueName(new Char[maxNameSize]);
     DWORD valueNameSize;
     for (DWORD index = 0; ; index++) {
         valueNameSize = maxNameSize;
-        if (SetLastStatus(RegEnumValueW(_hKey, index, valueName.get(), &valueNameSize, nullptr, nullptr, nullptr, nullptr))
+        if (SetLastStatus(REG_TRACED(EnumValue, _hKey, nullptr,
+                _backend->EnumValue(_hKey, index, valueName.get(), &valueNameSize, nullptr, nullptr, nullptr)))
                 != ERROR_SUCCESS)
             break;
-        valueNames.push_back(valueName.get());
+        valueNames.push_back(String(valueName.get(), valueNameSize));
     }
 
     return valueNames;
@@ -459,13 +512,12 @@ std::vector<String> RegKey::GetValueNames()
 bool RegKey::HasValue(const String &valueName)
 {
     DWORD valueSize = 0;
-    return SetLastStatus(RegQueryValueExW(_hKey, valueName.c_str(), NULL, NULL, NULL, &valueSize)) == ERROR_SUCCESS;
+    return _QueryValue(valueName, NULL, NULL, &valueSize) == ERROR_SUCCESS;
 }
 
 bool RegKey::PutValue(const RegValue &value)
 {
-    return SetLastStatus(RegSetValueExW(_hKey, value.name.c_str(), 0,
-        value.type, value.data.data(), DWORD(value.data.size()))) == ERROR_SUCCESS;
+    return _SetValue(value.name, value.type, value.data.data(), DWORD(value.data.size())) == ERROR_SUCCESS;
 }
 
 size_t RegKey::PutValues(const std::vector<RegValue> &values)
@@ -483,49 +535,178 @@ size_t RegKey::PutValues(const std::vector<RegValue> &values)
 
 bool RegKey::SetStringValue(const String &valueName, const String &value, DWORD type)
 {
-    return SetLastStatus(RegSetValueExW(_hKey, valueName.c_str(), 0, type, 
-        reinterpret_cast<const BYTE *>(value.c_str()), DWORD(sizeof(Char) * (value.size() + 1)))) == ERROR_SUCCESS;
+    ByteArray data;
+    EncodeAs<REG_SZ>(value, data);
+    return _SetValue(valueName, type, data.data(), DWORD(data.size())) == ERROR_SUCCESS;
 }
 
 bool RegKey::SetBinaryValue(const String &valueName, const void *value, size_t size, DWORD type)
 {
-    return SetLastStatus(RegSetValueExW(_hKey, valueName.c_str(), 0, type,
-        static_cast<const BYTE *>(value), DWORD(size))) == ERROR_SUCCESS;
+    return _SetValue(valueName, type, static_cast<const BYTE *>(value), DWORD(size)) == ERROR_SUCCESS;
 }
 
 bool RegKey::SetDwordValue(const String &valueName, DWORD value, DWORD type)
 {
-    return SetLastStatus(RegSetValueExW(_hKey, valueName.c_str(), 0, type,
-        reinterpret_cast<const BYTE*>(&value), sizeof(DWORD))) == ERROR_SUCCESS;
+    ByteArray data;
+    if (type == REG_DWORD_BIG_ENDIAN)
+        EncodeAs<REG_DWORD_BIG_ENDIAN>(value, data);
+    else
+        EncodeAs<REG_DWORD>(value, data);
+    return _SetValue(valueName, type, data.data(), DWORD(data.size())) == ERROR_SUCCESS;
 }
 
 bool RegKey::SetQwordValue(const String &valueName, QWORD value, DWORD type)
 {
-    return SetLastStatus(RegSetValueExW(_hKey, valueName.c_str(), 0, type,
-        reinterpret_cast<const BYTE*>(&value), sizeof(QWORD))) == ERROR_SUCCESS;
+    ByteArray data;
+    EncodeAs<REG_QWORD>(value, data);
+    return _SetValue(valueName, type, data.data(), DWORD(data.size())) == ERROR_SUCCESS;
 }
 
 bool RegKey::SetMultiStringValue(const String &valueName, const std::vector<String> &values, DWORD type)
 {
-    size_t size = 1;
-    for (auto it = values.begin(); it != values.end(); it++)
-        size += it->size() + 1;
-        
-    std::unique_ptr<Char[]> valueData(new Char[size]);
-    wchar_t *p = valueData.get();
-    for (auto it = values.begin(); it != values.end(); it++)
+    ByteArray data;
+    if (!EncodeAs<REG_MULTI_SZ>(values, data))
     {
-        STRCOPY(p, it->size() + 1, it->c_str());
-        p += it->size() + 1;
+        SetLastStatus(ERROR_INVALID_PARAMETER);
+        return false;
     }
-    *p = 0;
-    bool res = (SetLastStatus(RegSetValueExW(_hKey, valueName.c_str(), 0, type, LPBYTE(valueData.get()), DWORD(sizeof(Char) * size)))
-                    == ERROR_SUCCESS);
-
-    return res;
+    return _SetValue(valueName, type, data.data(), DWORD(data.size())) == ERROR_SUCCESS;
 }
 
 bool RegKey::DeleteValue(const String &valueName)
 {
-    return SetLastStatus(RegDeleteValueW(_hKey, valueName.c_str())) == ERROR_SUCCESS;
-}
\ No newline at end of file
+    if (_writeBuffer)
+    {
+        // Keep the Win32 result for values that exist neither in the buffer nor in the key.
+        if (!HasValue(valueName))
+            return false;
+        return SetLastStatus(_writeBuffer->DeleteValue(valueName)) == ERROR_SUCCESS;
+    }
+    return SetLastStatus(REG_TRACED(DeleteValue, _hKey, valueName.c_str(),
+                                    _backend->DeleteValue(_hKey, valueName.c_str()))) == ERROR_SUCCESS;
+}
+
+bool RegKey::MoveValue(const String &from, const String &to, bool overwrite)
+{
+    if (from == to)
+        return HasValue(from);
+    // Setting a name that differs only in case would write over the value, then delete it.
+    if (RegString::EqualsFold(from, to))
+    {
+        SetLastStatus(ERROR_ALREADY_EXISTS);
+        return false;
+    }
+
+    DWORD type = REG_NONE;
+    ByteArray data;
+    if (_QueryData(from, &type, data) != ERROR_SUCCESS)
+        return false;
+    if (!overwrite && HasValue(to))
+    {
+        SetLastStatus(ERROR_ALREADY_EXISTS);
+        return false;
+    }
+    if (_SetValue(to, type, data.data(), DWORD(data.size())) != ERROR_SUCCESS)
+        return false;
+    return DeleteValue(from);
+}
+
+bool RegKey::CopyValues(RegKey &dest, const RegValueCopyOptions &options, size_t *copied)
+{
+    size_t count = 0;
+    if (copied != nullptr)
+        *copied = 0;
+
+    // Enumeration does not see buffered writes.
+    RegKeyInfo info;
+    if (!FlushWriteBack() || !QueryInfo(&info))
+        return false;
+
+    std::unique_ptr<Char[]> name(new Char[info.maxValueNameLength + 1]);
+    // Never empty, so EnumValue gets a buffer to fill rather than a size query.
+    ByteArray data(std::max<DWORD>(info.maxValueLength, 1));
+
+    // Writes the value held in `data`; returns false on failure.
+    auto copy = [&](const String &valueName, DWORD type) -> bool
+    {
+        if (!options.patterns.empty())
+        {
+            bool matched = false;
+            for (auto it = options.patterns.begin(); it != options.patterns.end() && !matched; it++)
+                matched = RegString::MatchPattern(*it, valueName);
+            if (!matched)
+                return true;
+        }
+        if (options.filter && !options.filter(valueName, type))
+            return true;
+        if (!options.overwrite && dest.HasValue(valueName))
+            return true;
+        if (dest._SetValue(valueName, type, data.data(), DWORD(data.size())) != ERROR_SUCCESS)
+        {
+            SetLastStatus(dest.GetLastStatus());
+            return false;
+        }
+        count++;
+        if (copied != nullptr)
+            *copied = count;
+        return true;
+    };
+
+    // Reads reuse the buffer, which only grows for values larger than the first guess.
+    auto read = [&](const String &valueName, DWORD *type) -> LSTATUS
+    {
+        return _QueryData(valueName, type, data, DWORD(std::max<size_t>(data.capacity(), 1)));
+    };
+
+    if (!options.names.empty())
+    {
+        for (auto it = options.names.begin(); it != options.names.end(); it++)
+        {
+            DWORD type = REG_NONE;
+            LSTATUS status = read(*it, &type);
+            if (status == ERROR_FILE_NOT_FOUND)
+                continue;
+            if (status != ERROR_SUCCESS)
+            {
+                dest.SetLastStatus(status);
+                return false;
+            }
+            if (!copy(*it, type))
+                return false;
+        }
+        return SetLastStatus(ERROR_SUCCESS) == ERROR_SUCCESS;
+    }
+
+    for (DWORD index = 0; ; index++)
+    {
+        DWORD nameLength = info.maxValueNameLength + 1;
+        DWORD type = REG_NONE;
+        DWORD size = DWORD(data.capacity());
+        data.resize(size);
+        LSTATUS status = SetLastStatus(REG_TRACED(EnumValue, _hKey, nullptr,
+            _backend->EnumValue(_hKey, index, name.get(), &nameLength, &type, data.data(), &size)));
+        String valueName;
+        if (status == ERROR_MORE_DATA)
+        {
+            // The value grew since QueryInfo, read it by name instead.
+            valueName.assign(name.get(), nameLength);
+            status = read(valueName, &type);
+        }
+        else if (status == ERROR_SUCCESS)
+        {
+            valueName.assign(name.get(), nameLength);
+            data.resize(size);
+        }
+
+        if (status == ERROR_NO_MORE_ITEMS)
+            break;
+        if (status != ERROR_SUCCESS)
+        {
+            dest.SetLastStatus(status);
+            return false;
+        }
+        if (!copy(valueName, type))
+            return false;
+    }
+    return SetLastStatus(ERROR_SUCCESS) == ERROR_SUCCESS;
+}
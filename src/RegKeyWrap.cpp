@@ -1,48 +1,81 @@
 #include "RegKeyWrap.h"
+#include "RegBatch.h"
+#include "RegCodec.h"
+#include "RegColumnar.h"
+#include "RegCompress.h"
+#include "RegExpand.h"
+#include "RegHandleBudget.h"
+#include "RegHostQuery.h"
+#include "RegQuery.h"
+#include "RegSchema.h"
+#include "RegSearch.h"
+#include "RegString.h"
+#include "RegTreeCache.h"
+#include "RegTreeOp.h"
+#include "RegTreeSync.h"
+#include <cstring>
+#include <mutex>
+#include <unordered_map>
 
 inline Napi::String ConvertToNapiString(Napi::Env env, const String &str)
 {
-    return Napi::String::New(
-        env,
-        reinterpret_cast<const char16_t *>(str.c_str()),
-        str.size()
-    );
+    return RegMarshal::NewString(env, str);
+}
+
+inline RegMarshal &GetMarshal(Napi::Env env)
+{
+    return env.GetInstanceData<RegAddonData>()->marshal;
 }
 
 inline String ConvertToStdString(const Napi::String &str)
 {
     const auto wstr = str.Utf16Value();
     return String(
-        reinterpret_cast<const wchar_t *>(wstr.c_str()),
+        reinterpret_cast<const Char *>(wstr.c_str()),
         wstr.size()
     );
 }
 
+const struct
+{
+    const Char *name;
+    const Char *shortName;
+    HKEY key;
+} baseKeys[] = {
+    {STR("HKEY_CLASSES_ROOT"), STR("HKCR"), HKEY_CLASSES_ROOT},
+    {STR("HKEY_CURRENT_USER"), STR("HKCU"), HKEY_CURRENT_USER},
+    {STR("HKEY_LOCAL_MACHINE"), STR("HKLM"), HKEY_LOCAL_MACHINE},
+    {STR("HKEY_USERS"), STR("HKU"), HKEY_USERS},
+    {STR("HKEY_PERFORMANCE_DATA"), STR("HKPD"), HKEY_PERFORMANCE_DATA},
+    {STR("HKEY_PERFORMANCE_NLSTEXT"), STR("HKPN"), HKEY_PERFORMANCE_NLSTEXT},
+    {STR("HKEY_PERFORMANCE_TEXT"), STR("HKPT"), HKEY_PERFORMANCE_TEXT},
+    {STR("HKEY_CURRENT_CONFIG"), STR("HKCC"), HKEY_CURRENT_CONFIG},
+};
+
 HKEY ParseBaseKey(const String &baseKeyName)
 {
-    String upperName = baseKeyName;
-    std::transform(upperName.begin(), upperName.end(), upperName.begin(), ::toupper);
-
-    if (upperName == STR("HKEY_CLASSES_ROOT") || upperName == STR("HKCR"))
-        return HKEY_CLASSES_ROOT;
-    else if (upperName == STR("HKEY_CURRENT_USER") || upperName == STR("HKCU"))
-        return HKEY_CURRENT_USER;
-    else if (upperName == STR("HKEY_LOCAL_MACHINE") || upperName == STR("HKLM"))
-        return HKEY_LOCAL_MACHINE;
-    else if (upperName == STR("HKEY_USERS") || upperName == STR("HKU"))
-        return HKEY_USERS;
-    else if (upperName == STR("HKEY_PERFORMANCE_DATA") || upperName == STR("HKPD"))
-        return HKEY_PERFORMANCE_DATA;
-    else if (upperName == STR("HKEY_PERFORMANCE_NLSTEXT") || upperName == STR("HKPN"))
-        return HKEY_PERFORMANCE_NLSTEXT;
-    else if (upperName == STR("HKEY_PERFORMANCE_TEXT") || upperName == STR("HKPT"))
-        return HKEY_PERFORMANCE_TEXT;
-    else if (upperName == STR("HKEY_CURRENT_CONFIG") || upperName == STR("HKCC"))
-        return HKEY_CURRENT_CONFIG;
-    
+    const Char *name = baseKeyName.c_str();
+    size_t length = baseKeyName.size();
+    for (size_t i = 0; i < sizeof(baseKeys) / sizeof(baseKeys[0]); i++)
+    {
+        if (RegString::EqualsFold(name, length, baseKeys[i].name, STRLEN(baseKeys[i].name)) ||
+            RegString::EqualsFold(name, length, baseKeys[i].shortName, STRLEN(baseKeys[i].shortName)))
+            return baseKeys[i].key;
+    }
+
     return NULL;
 }
 
+bool IsPredefinedKey(HKEY hKey)
+{
+    for (size_t i = 0; i < sizeof(baseKeys) / sizeof(baseKeys[0]); i++)
+    {
+        if (baseKeys[i].key == hKey)
+            return true;
+    }
+    return false;
+}
+
 DWORD ParseKeyType(const String &keyType, DWORD fallbackValue = REG_NONE)
 {
     if (keyType == STR("REG_SZ"))
@@ -69,37 +102,6 @@ DWORD ParseKeyType(const String &keyType, DWORD fallbackValue = REG_NONE)
     return fallbackValue;
 }
 
-String StringifyKeyTypeName(DWORD keyType)
-{
-    switch (keyType)
-    {
-    case REG_NONE:
-        return STR("REG_NONE");
-    case REG_SZ:
-        return STR("REG_SZ");
-    case REG_EXPAND_SZ:
-        return STR("REG_EXPAND_SZ");
-    case REG_BINARY:
-        return STR("REG_BINARY");
-    case REG_DWORD:
-        return STR("REG_DWORD");
-    case REG_DWORD_BIG_ENDIAN:
-        return STR("REG_DWORD_BIG_ENDIAN");
-    case REG_QWORD:
-        return STR("REG_QWORD");
-    case REG_MULTI_SZ:
-        return STR("REG_MULTI_SZ");
-    case REG_RESOURCE_LIST:
-        return STR("REG_RESOURCE_LIST");
-    case REG_FULL_RESOURCE_DESCRIPTOR:
-        return STR("REG_FULL_RESOURCE_DESCRIPTOR");
-    case REG_RESOURCE_REQUIREMENTS_LIST:
-        return STR("REG_RESOURCE_REQUIREMENTS_LIST");
-    default:
-        return STR("");
-    }
-}
-
 String ReplaceString(const String &str, const String &from, const String &to)
 {
     String result = str;
@@ -112,7 +114,9 @@ String ReplaceString(const String &str, const String &from, const String &to)
     return result;
 }
 
-String TranslateError(DWORD errorCode)
+#ifdef _WIN32
+
+String FormatError(DWORD errorCode)
 {
 	LPWSTR messageBuffer = nullptr;
 	size_t size = FormatMessageW(
@@ -140,7 +144,291 @@ String TranslateError(DWORD errorCode)
 	return errorMessage;
 }
 
-Napi::FunctionReference RegKeyWrap::constructor;
+#else
+
+String FormatError(DWORD errorCode)
+{
+    // The messages FormatMessageW returns for the codes the backends produce.
+    const char *message = nullptr;
+    switch (errorCode)
+    {
+    case ERROR_SUCCESS:
+        message = "The operation completed successfully.\r\n";
+        break;
+    case ERROR_FILE_NOT_FOUND:
+        message = "The system cannot find the file specified.\r\n";
+        break;
+    case ERROR_ACCESS_DENIED:
+        message = "Access is denied.\r\n";
+        break;
+    case ERROR_INVALID_HANDLE:
+        message = "The handle is invalid.\r\n";
+        break;
+    case ERROR_NOT_ENOUGH_MEMORY:
+        message = "Not enough memory resources are available to process this command.\r\n";
+        break;
+    case ERROR_INVALID_DATA:
+        message = "The data is invalid.\r\n";
+        break;
+    case ERROR_NOT_SAME_DEVICE:
+        message = "The system cannot move the file to a different disk drive.\r\n";
+        break;
+    case ERROR_NOT_SUPPORTED:
+        message = "The request is not supported.\r\n";
+        break;
+    case ERROR_BAD_NETPATH:
+        message = "The network path was not found.\r\n";
+        break;
+    case ERROR_INVALID_PARAMETER:
+        message = "The parameter is incorrect.\r\n";
+        break;
+    case ERROR_ALREADY_EXISTS:
+        message = "Cannot create a file when that file already exists.\r\n";
+        break;
+    case ERROR_MORE_DATA:
+        message = "More data is available.\r\n";
+        break;
+    case ERROR_NO_MORE_ITEMS:
+        message = "No more data is available.\r\n";
+        break;
+    case ERROR_BADDB:
+        message = "The configuration registry database is corrupt.\r\n";
+        break;
+    case ERROR_BADKEY:
+        message = "The configuration registry key is invalid.\r\n";
+        break;
+    case ERROR_CANTREAD:
+        message = "The configuration registry key could not be read.\r\n";
+        break;
+    case ERROR_CANTWRITE:
+        message = "The configuration registry key could not be written.\r\n";
+        break;
+    case ERROR_KEY_DELETED:
+        message = "Illegal operation attempted on a registry key that has been marked for deletion.\r\n";
+        break;
+    case ERROR_CANCELLED:
+        message = "The operation was canceled by the user.\r\n";
+        break;
+    case ERROR_TIMEOUT:
+        message = "This operation returned because the timeout period expired.\r\n";
+        break;
+    }
+
+    if (message == nullptr)
+    {
+        std::string unknown = "An unknown error occurred. (code " + std::to_string(errorCode) + ")";
+        return String(unknown.begin(), unknown.end());
+    }
+    return String(message, message + strlen(message));
+}
+
+#endif
+
+// Formatting a message is slow and the same few codes keep failing, so each is formatted once.
+const String &TranslateError(DWORD errorCode)
+{
+    static std::mutex mutex;
+    static std::unordered_map<DWORD, String> messages;
+    std::lock_guard<std::mutex> lock(mutex);
+    auto it = messages.find(errorCode);
+    if (it == messages.end())
+        it = messages.emplace(errorCode, FormatError(errorCode)).first;
+    return it->second;
+}
+
+namespace
+{
+    Napi::Value ConvertToNapiValue(Napi::Env env, const String &value)
+    {
+        return ConvertToNapiString(env, value);
+    }
+
+    Napi::Value ConvertToNapiValue(Napi::Env env, const std::vector<String> &value)
+    {
+        return GetMarshal(env).NewArray(env, value, [env](const String &item) { return ConvertToNapiString(env, item); });
+    }
+
+    Napi::Value ConvertToNapiValue(Napi::Env env, DWORD value)
+    {
+        return Napi::Number::New(env, double(value));
+    }
+
+    Napi::Value ConvertToNapiValue(Napi::Env env, QWORD value)
+    {
+        return Napi::BigInt::New(env, uint64_t(value));
+    }
+
+    Napi::Value ConvertToNapiValue(Napi::Env env, const ByteArray &value)
+    {
+        return Napi::Buffer<BYTE>::Copy(env, value.data(), value.size());
+    }
+
+    bool ConvertFromNapiValue(const Napi::Value &value, String &result)
+    {
+        result = ConvertToStdString(value.ToString());
+        return true;
+    }
+
+    bool ConvertFromNapiValue(const Napi::Value &value, std::vector<String> &result)
+    {
+        if (!value.IsArray())
+            return false;
+        Napi::Array array = value.As<Napi::Array>();
+        result.resize(array.Length());
+        for (uint32_t i = 0; i < array.Length(); i++)
+            result[i] = ConvertToStdString(array.Get(i).ToString());
+        return true;
+    }
+
+    bool ConvertFromNapiValue(const Napi::Value &value, DWORD &result)
+    {
+        if (value.IsNumber())
+            result = value.As<Napi::Number>().Uint32Value();
+        else if (value.IsBigInt())
+        {
+            bool lossless = false;
+            uint64_t big = value.As<Napi::BigInt>().Uint64Value(&lossless);
+            if (!lossless || big > 0xFFFFFFFFull)
+                return false;
+            result = DWORD(big);
+        }
+        else
+            return false;
+        return true;
+    }
+
+    bool ConvertFromNapiValue(const Napi::Value &value, QWORD &result)
+    {
+        if (value.IsNumber())
+            result = QWORD(value.As<Napi::Number>().Int64Value());
+        else if (value.IsBigInt())
+        {
+            bool lossless = false;
+            result = value.As<Napi::BigInt>().Uint64Value(&lossless);
+            if (!lossless)
+                return false;
+        }
+        else
+            return false;
+        return true;
+    }
+
+    bool ConvertFromNapiValue(const Napi::Value &, ByteArray &)
+    {
+        // Buffers are taken as raw data before a codec is picked.
+        return false;
+    }
+
+    // Decodes value data with the codec of its type. Data the codec rejects is returned as a Buffer,
+    // or as an empty value when `strict` is set.
+    struct DecodeToNapi
+    {
+        typedef Napi::Value Result;
+
+        Napi::Env env;
+        const ByteArray &data;
+        bool strict;
+
+        template <DWORD Type>
+        Napi::Value Visit()
+        {
+            typename RegCodec<Type>::Value value;
+            if (!RegCodec<Type>::Decode(data.data(), data.size(), value))
+                return strict ? Napi::Value() : ConvertToNapiValue(env, data);
+            return ConvertToNapiValue(env, value);
+        }
+    };
+
+    // Encodes a JavaScript value as data of the given type. Fails with ERROR_BAD_FORMAT when the value
+    // has the wrong JavaScript type and ERROR_INVALID_PARAMETER when the codec rejects it.
+    struct EncodeFromNapi
+    {
+        typedef LSTATUS Result;
+
+        const Napi::Value &value;
+        ByteArray &data;
+
+        template <DWORD Type>
+        LSTATUS Visit()
+        {
+            typename RegCodec<Type>::Value native;
+            if (!ConvertFromNapiValue(value, native))
+                return ERROR_BAD_FORMAT;
+            return RegCodec<Type>::Encode(native, data) ? ERROR_SUCCESS : ERROR_INVALID_PARAMETER;
+        }
+    };
+
+    Napi::Value ConvertValueData(Napi::Env env, const RegValue &value)
+    {
+        DecodeToNapi visitor = {env, value.data, false};
+        return RegVisitCodec(value.type, visitor);
+    }
+
+    // Snapshots the process environment, overridden by the properties of `variables` when it is an object.
+    std::shared_ptr<RegEnvironment> CreateEnvironment(const Napi::Value &variables)
+    {
+        std::shared_ptr<RegEnvironment> environment = RegEnvironment::Snapshot();
+        if (variables.IsObject())
+        {
+            Napi::Object object = variables.As<Napi::Object>();
+            Napi::Array names = object.GetPropertyNames();
+            for (uint32_t i = 0; i < names.Length(); i++)
+            {
+                Napi::Value name = names.Get(i);
+                environment->Set(ConvertToStdString(name.ToString()), ConvertToStdString(object.Get(name).ToString()));
+            }
+        }
+        return environment;
+    }
+
+    // A schema compiled by compileSchema(), along with the JavaScript side of its fields.
+    struct CompiledSchema
+    {
+        RegSchema schema;
+        // Property names of the result, aligned with the fields.
+        std::vector<Napi::Reference<Napi::String>> keys;
+        Napi::ObjectReference defaults;
+    };
+
+    // Marks the Externals returned by compileSchema(), so no other External is read as one.
+    const napi_type_tag CompiledSchemaTag = {0x5f3a8c1e27d94b60, 0xa1c7e03d9b2f4856};
+
+    // Marks the External NewInstance() hands to the constructor, the only External it moves a key out of.
+    const napi_type_tag RegKeyTag = {0x2b7e4f91c06d3a58, 0xd4903a6e81f25c17};
+
+    // Keys handed over by transfer() until an environment receives them.
+    // Entries left behind are closed when the process exits.
+    struct TransferredKey
+    {
+        RegKey regKey;
+        String path;
+        REGSAM access;
+    };
+
+    std::mutex transferMutex;
+    std::unordered_map<uint32_t, TransferredKey> transferredKeys;
+    uint32_t nextTransferId = 1;
+}
+
+void RegKeyWrap::_CloseKeys(RegAddonData *addon)
+{
+    for (RegKeyWrap *key : addon->keys)
+    {
+        key->_regKey.Close();
+        key->_evicted = false;
+        RegHandleBudget::Shared().Closed(key);
+    }
+}
+
+RegAddonData &RegKeyWrap::_GetAddonData(Napi::Env env)
+{
+    return *env.GetInstanceData<RegAddonData>();
+}
+
+bool RegKeyWrap::IsInstance(Napi::Env env, const Napi::Value &value)
+{
+    return value.IsObject() && value.As<Napi::Object>().InstanceOf(_GetAddonData(env).constructor.Value());
+}
 
 Napi::Object RegKeyWrap::Init(Napi::Env env, Napi::Object exports)
 {
@@ -150,12 +438,17 @@ Napi::Object RegKeyWrap::Init(Napi::Env env, Napi::Object exports)
         InstanceAccessor("name", &RegKeyWrap::GetName, &RegKeyWrap::SetName),
         InstanceAccessor("valid", &RegKeyWrap::IsValid, nullptr),
         InstanceAccessor("lastStatus", &RegKeyWrap::GetLastStatus, &RegKeyWrap::SetLastStatus),
+        InstanceAccessor("backend", &RegKeyWrap::GetBackend, nullptr),
         InstanceMethod("isWritable", &RegKeyWrap::IsWritable),
         InstanceMethod("flush", &RegKeyWrap::Flush),
+        InstanceMethod("enableWriteBack", &RegKeyWrap::EnableWriteBack),
+        InstanceMethod("disableWriteBack", &RegKeyWrap::DisableWriteBack),
+        InstanceAccessor("writeBackStats", &RegKeyWrap::GetWriteBackStats, nullptr),
 
         InstanceMethod("getLastError", &RegKeyWrap::GetLastError),
         InstanceMethod("copyTree", &RegKeyWrap::CopyTree),
         InstanceMethod("close", &RegKeyWrap::Close),
+        InstanceMethod("info", &RegKeyWrap::Info),
 
         InstanceMethod("deleteTree", &RegKeyWrap::DeleteTree),
         InstanceMethod("openSubKey", &RegKeyWrap::OpenSubKey),
@@ -163,9 +456,29 @@ Napi::Object RegKeyWrap::Init(Napi::Env env, Napi::Object exports)
         InstanceMethod("deleteSubKey", &RegKeyWrap::DeleteSubKey),
         InstanceMethod("getSubKeyNames", &RegKeyWrap::GetSubKeyNames),
         InstanceMethod("hasSubKey", &RegKeyWrap::HasSubKey),
-
+        InstanceMethod("__search__", &RegKeyWrap::Search),
+        InstanceMethod("__treeOp__", &RegKeyWrap::TreeOp),
+        InstanceMethod("__readSchema__", &RegKeyWrap::ReadSchema),
+        InstanceMethod("syncTree", &RegKeyWrap::SyncTree),
+        InstanceMethod("syncTreeAsync", &RegKeyWrap::SyncTreeAsync),
+        InstanceMethod("__cachedTree__", &RegKeyWrap::CachedTree),
+        InstanceMethod("transfer", &RegKeyWrap::Transfer),
+        InstanceMethod("exportColumnar", &RegKeyWrap::ExportColumnar),
+        StaticMethod("receive", &RegKeyWrap::Receive),
+
+        InstanceMethod("tryOpenSubKey", &RegKeyWrap::_Try<&RegKeyWrap::OpenSubKey>),
+        InstanceMethod("tryGetValue", &RegKeyWrap::_Try<&RegKeyWrap::GetValue>),
+        InstanceMethod("tryGetBinaryValue", &RegKeyWrap::_Try<&RegKeyWrap::GetBinaryValue>),
+        InstanceMethod("tryGetStringValue", &RegKeyWrap::_Try<&RegKeyWrap::GetStringValue>),
+        InstanceMethod("tryGetExpandedValue", &RegKeyWrap::_Try<&RegKeyWrap::GetExpandedValue>),
+        InstanceMethod("tryGetMultiStringValue", &RegKeyWrap::_Try<&RegKeyWrap::GetMultiStringValue>),
+        InstanceMethod("tryGetDwordValue", &RegKeyWrap::_Try<&RegKeyWrap::GetDwordValue>),
+        InstanceMethod("tryGetQwordValue", &RegKeyWrap::_Try<&RegKeyWrap::GetQwordValue>),
+
+        InstanceMethod("getValue", &RegKeyWrap::GetValue),
         InstanceMethod("getBinaryValue", &RegKeyWrap::GetBinaryValue),
         InstanceMethod("getStringValue", &RegKeyWrap::GetStringValue),
+        InstanceMethod("getExpandedValue", &RegKeyWrap::GetExpandedValue),
         InstanceMethod("getMultiStringValue", &RegKeyWrap::GetMultiStringValue),
         InstanceMethod("getDwordValue", &RegKeyWrap::GetDwordValue),
         InstanceMethod("getQwordValue", &RegKeyWrap::GetQwordValue),
@@ -173,74 +486,83 @@ Napi::Object RegKeyWrap::Init(Napi::Env env, Napi::Object exports)
         InstanceMethod("hasValue", &RegKeyWrap::HasValue),
         InstanceMethod("getValueNames", &RegKeyWrap::GetValueNames),
 
+        InstanceMethod("setValue", &RegKeyWrap::SetValue),
         InstanceMethod("setBinaryValue", &RegKeyWrap::SetBinaryValue),
         InstanceMethod("setStringValue", &RegKeyWrap::SetStringValue),
         InstanceMethod("setMultiStringValue", &RegKeyWrap::SetMultiStringValue),
         InstanceMethod("setDwordValue", &RegKeyWrap::SetDwordValue),
         InstanceMethod("setQwordValue", &RegKeyWrap::SetQwordValue),
-        InstanceMethod("deleteValue", &RegKeyWrap::DeleteValue)
+        InstanceMethod("deleteValue", &RegKeyWrap::DeleteValue),
+        InstanceMethod("moveValue", &RegKeyWrap::MoveValue),
+        InstanceMethod("__copyValues__", &RegKeyWrap::CopyValues)
     });
 
-    constructor = Napi::Persistent(cons);
-    constructor.SuppressDestruct();
+    // Deleted by Node.js after the environment's objects have been finalized.
+    RegAddonData *addon = new RegAddonData();
+    addon->constructor = Napi::Persistent(cons);
+    env.SetInstanceData(addon);
+    env.AddCleanupHook(_CloseKeys, addon);
     exports.Set("RegKey", cons);
 
     return exports;
 }
 
 Napi::Object RegKeyWrap::NewInstance(Napi::Env env, HKEY hKey, const String &path)
+{
+    return NewInstance(env, RegKey(RegBackend::GetDefault(), hKey), path);
+}
+
+Napi::Object RegKeyWrap::NewInstance(Napi::Env env, RegKey &&regKey, const String &path, REGSAM access)
 {
     Napi::EscapableHandleScope scope(env);
-    Napi::Object obj = constructor.New({
-        Napi::External<HKEY>::New(env, &hKey),
-        ConvertToNapiString(env, path)
+    Napi::External<RegKey> external = Napi::External<RegKey>::New(env, &regKey);
+    external.TypeTag(&RegKeyTag);
+    Napi::Object obj = _GetAddonData(env).constructor.New({
+        external,
+        ConvertToNapiString(env, path),
+        Napi::Number::New(env, access)
     });
     return scope.Escape(obj).ToObject();
 }
 
-RegKeyWrap::RegKeyWrap(const Napi::CallbackInfo &info) : Napi::ObjectWrap<RegKeyWrap>(info)
+RegKeyWrap::RegKeyWrap(const Napi::CallbackInfo &info)
+    : Napi::ObjectWrap<RegKeyWrap>(info)
+    , _tracker(_GetAddonData(info.Env()), this)
+    , _access(0)
+    , _evicted(false)
+    , _quiet(false)
+    , _failed(false)
 {
+    if (_GetAddonData(info.Env()).captureStacks)
+    {
+        // Drop the "Error" line, leaving the frames that created the key.
+        std::string stack = Napi::Error::New(info.Env(), "").Get("stack").ToString().Utf8Value();
+        size_t newline = stack.find('\n');
+        _stack = newline != std::string::npos ? stack.substr(newline + 1) : std::string();
+    }
+
     String hostname, baseKeyName, subKeyName;
     REGSAM access = 0;
+    std::shared_ptr<RegBackend> backend = RegBackend::GetDefault();
     if (info[0].IsExternal())
     {
-        Napi::External<HKEY> external = info[0].As<Napi::External<HKEY>>();
-        _regKey.Attach(*external.Data());
+        Napi::External<RegKey> external = info[0].As<Napi::External<RegKey>>();
+        if (!external.CheckTypeTag(&RegKeyTag))
+            throw Napi::TypeError::New(info.Env(), "Path or options expected.");
+        _regKey = std::move(*external.Data());
         _path = ConvertToStdString(info[1].As<Napi::String>());
+        if (info[2].IsNumber())
+            _access = info[2].As<Napi::Number>().Uint32Value();
+        _Track();
         return;
     }
     else if (info[0].IsString())
     {
-        String path = ReplaceString(ConvertToStdString(info[0].As<Napi::String>()), STR("/"), STR("\\"));
-        if (path.substr(0, 2) == STR("\\\\"))
-        {
-            size_t slashPos = path.find(STR('\\'), 2);
-            if (slashPos != std::string::npos)
-            {
-                hostname = path.substr(2, slashPos);
-                path = path.substr(slashPos + 1);
-            }
-            else
-            {
-                _ThrowRegKeyError(info, "Invalid path format.");
-                return;
-            }
-        }
-
-        size_t slashPos = path.find(STR('\\'));
-        // Allow leading slash
-        if (slashPos == 0)
-        {
-            path = path.substr(1);
-            slashPos = path.find(STR('\\'));
-        }
-        if (slashPos != std::string::npos)
+        if (!ParsePath(ConvertToStdString(info[0].As<Napi::String>()), hostname, baseKeyName, subKeyName))
         {
-            baseKeyName = path.substr(0, slashPos);
-            subKeyName = path.substr(slashPos + 1);
+            _ThrowRegKeyError(info, "Invalid path format.");
+            return;
         }
-        else
-            baseKeyName = path;
 
         Napi::Value accessValue = info[1];
         if (accessValue.IsNumber())
@@ -260,6 +582,7 @@ RegKeyWrap::RegKeyWrap(const Napi::CallbackInfo &info) : Napi::ObjectWrap<RegKey
         Napi::Value baseKeyValue = options.Get("baseKey");
         Napi::Value subkeyValue = options.Get("subKey");
         Napi::Value accessValue = options.Get("access");
+        Napi::Value backendValue = options.Get("backend");
 
         if (!baseKeyValue.IsString())
             throw Napi::TypeError::New(info.Env(), "baseKey must be a string.");
@@ -277,6 +600,12 @@ RegKeyWrap::RegKeyWrap(const Napi::CallbackInfo &info) : Napi::ObjectWrap<RegKey
             for (uint32_t i = 0; i < arr.Length(); i++)
                 access |= arr.Get(i).As<Napi::Number>().Uint32Value();
         }
+        if (backendValue.IsString())
+        {
+            backend = RegBackend::Get(backendValue.As<Napi::String>().Utf8Value());
+            if (!backend)
+                throw Napi::TypeError::New(info.Env(), "Unknown backend.");
+        }
     }
     else
         throw Napi::TypeError::New(info.Env(), "Path or options expected.");
@@ -289,16 +618,54 @@ RegKeyWrap::RegKeyWrap(const Napi::CallbackInfo &info) : Napi::ObjectWrap<RegKey
     if (!subKeyName.empty())
         _path += STR('\\') + subKeyName;
 
+    _regKey = RegKey(backend);
+
     HKEY baseKey = ParseBaseKey(baseKeyName);
     if (baseKey == NULL)
     {
         _ThrowRegKeyError(info, "Invalid base key name.");
         return;
     }
+    _access = access;
     if (_regKey.ConnectAndCreate(baseKey, subKeyName, hostname, access) == NULL)
     {
         _ThrowRegKeyError(info, "Failed to create registry key.");
+        return;
+    }
+    _Track();
+}
+
+bool RegKeyWrap::ParsePath(const String &keyPath, String &hostname, String &baseKeyName, String &subKeyName)
+{
+    String path = ReplaceString(keyPath, STR("/"), STR("\\"));
+    hostname.clear();
+    if (path.substr(0, 2) == STR("\\\\"))
+    {
+        size_t slashPos = path.find(STR('\\'), 2);
+        if (slashPos == std::string::npos)
+            return false;
+        hostname = path.substr(2, slashPos - 2);
+        path = path.substr(slashPos + 1);
+    }
+
+    size_t slashPos = path.find(STR('\\'));
+    // Allow leading slash
+    if (slashPos == 0)
+    {
+        path = path.substr(1);
+        slashPos = path.find(STR('\\'));
+    }
+    if (slashPos != std::string::npos)
+    {
+        baseKeyName = path.substr(0, slashPos);
+        subKeyName = path.substr(slashPos + 1);
     }
+    else
+    {
+        baseKeyName = path;
+        subKeyName.clear();
+    }
+    return true;
 }
 
 Napi::Value RegKeyWrap::GetPath(const Napi::CallbackInfo &info)
@@ -328,16 +695,21 @@ void RegKeyWrap::SetName(const Napi::CallbackInfo &info, const Napi::Value &valu
     if (value.IsString())
     {
         String newName = ConvertToStdString(info[0].As<Napi::String>());
-        if (_regKey.Rename(newName))
+        if (_Use().Rename(newName))
             _path = _path.substr(0, _path.find_last_of(STR('\\'))) + STR('\\') + newName;
     }
     else
         throw Napi::TypeError::New(info.Env(), "New key name expected.");
 }
 
+Napi::Value RegKeyWrap::GetBackend(const Napi::CallbackInfo &info)
+{
+    return Napi::String::New(info.Env(), _regKey.GetBackend()->GetName());
+}
+
 Napi::Value RegKeyWrap::IsValid(const Napi::CallbackInfo &info)
 {
-    return Napi::Boolean::New(info.Env(), _regKey.IsValid());
+    return Napi::Boolean::New(info.Env(), _regKey.IsValid() || _evicted);
 }
 
 Napi::Value RegKeyWrap::GetLastStatus(const Napi::CallbackInfo &info)
@@ -355,17 +727,63 @@ void RegKeyWrap::SetLastStatus(const Napi::CallbackInfo &info, const Napi::Value
 
 Napi::Value RegKeyWrap::IsWritable(const Napi::CallbackInfo &info)
 {
-    return Napi::Boolean::New(info.Env(), _regKey.IsWritable());
+    return Napi::Boolean::New(info.Env(), _Use().IsWritable());
 }
 
 Napi::Value RegKeyWrap::Flush(const Napi::CallbackInfo &info)
 {
-    bool res = _regKey.Flush();
+    bool res = _Use().Flush();
     if (!res)
         _ThrowRegKeyError(info, "Failed to flush key.");
     return Napi::Boolean::New(info.Env(), res);
 }
 
+Napi::Value RegKeyWrap::EnableWriteBack(const Napi::CallbackInfo &info)
+{
+    RegWriteBackOptions options;
+    if (info[0].IsObject())
+    {
+        Napi::Object optionsObject = info[0].As<Napi::Object>();
+        Napi::Value interval = optionsObject.Get("interval");
+        Napi::Value maxBytes = optionsObject.Get("maxBytes");
+        if (interval.IsNumber())
+            options.interval = interval.As<Napi::Number>().Uint32Value();
+        if (maxBytes.IsNumber())
+            options.maxBytes = size_t(maxBytes.As<Napi::Number>().Int64Value());
+    }
+    bool res = _Use().EnableWriteBack(options);
+    if (!res)
+        _ThrowRegKeyError(info, "Failed to enable write-back.");
+    return Napi::Boolean::New(info.Env(), res);
+}
+
+Napi::Value RegKeyWrap::DisableWriteBack(const Napi::CallbackInfo &info)
+{
+    bool res = _regKey.DisableWriteBack();
+    if (!res)
+        _ThrowRegKeyError(info, "Failed to flush buffered writes.");
+    return Napi::Boolean::New(info.Env(), res);
+}
+
+Napi::Value RegKeyWrap::GetWriteBackStats(const Napi::CallbackInfo &info)
+{
+    const std::shared_ptr<RegWriteBuffer> &buffer = _regKey.GetWriteBuffer();
+    if (!buffer)
+        return info.Env().Null();
+
+    RegWriteBackStats stats = buffer->GetStats();
+    Napi::Object object = Napi::Object::New(info.Env());
+    object.Set("writes", Napi::Number::New(info.Env(), double(stats.writes)));
+    object.Set("merged", Napi::Number::New(info.Env(), double(stats.merged)));
+    object.Set("mergeRatio", Napi::Number::New(info.Env(), stats.writes ? double(stats.merged) / double(stats.writes) : 0.0));
+    object.Set("flushes", Napi::Number::New(info.Env(), double(stats.flushes)));
+    object.Set("flushed", Napi::Number::New(info.Env(), double(stats.flushed)));
+    object.Set("failed", Napi::Number::New(info.Env(), double(stats.failed)));
+    object.Set("pending", Napi::Number::New(info.Env(), double(stats.pending)));
+    object.Set("lastStatus", Napi::Number::New(info.Env(), stats.lastStatus));
+    return object;
+}
+
 Napi::Value RegKeyWrap::GetLastError(const Napi::CallbackInfo &info)
 {
     return ConvertToNapiString(info.Env(), TranslateError(_regKey.GetLastStatus()));
@@ -373,10 +791,22 @@ Napi::Value RegKeyWrap::GetLastError(const Napi::CallbackInfo &info)
 
 Napi::Value RegKeyWrap::CopyTree(const Napi::CallbackInfo &info)
 {
-    if (info[0].IsObject() && info[0].As<Napi::Object>().InstanceOf(RegKeyWrap::constructor.Value()))
+    if (IsInstance(info.Env(), info[0]))
     {
         RegKeyWrap *pRegKeyWrap = Napi::ObjectWrap<RegKeyWrap>::Unwrap(info[0].As<Napi::Object>());
-        bool res = _regKey.CopyTree(pRegKeyWrap->_regKey.GetHandle());
+        bool res;
+        if (pRegKeyWrap->_regKey.GetBackend()->GetTarget() != _regKey.GetBackend()->GetTarget())
+        {
+            _regKey.SetLastStatus(ERROR_NOT_SAME_DEVICE);
+            res = false;
+        }
+        else
+        {
+            // Reopening either key must not evict the other.
+            RegHandleBudget::Pin sourcePin(pRegKeyWrap), destPin(this);
+            pRegKeyWrap->_Use().FlushWriteBack();
+            res = _Use().CopyTree(pRegKeyWrap->_regKey.GetHandle());
+        }
         if (!res)
             _ThrowRegKeyError(info, "Failed to copy tree.");
         return Napi::Boolean::New(info.Env(), res);
@@ -385,9 +815,32 @@ Napi::Value RegKeyWrap::CopyTree(const Napi::CallbackInfo &info)
         throw Napi::TypeError::New(info.Env(), "Invalid source key.");
 }
 
+Napi::Value RegKeyWrap::Info(const Napi::CallbackInfo &info)
+{
+    RegKeyInfo keyInfo;
+    if (!_Use().QueryInfo(&keyInfo))
+    {
+        _ThrowRegKeyError(info, "Failed to query key info.");
+        return info.Env().Null();
+    }
+
+    Napi::Env env = info.Env();
+    Napi::Object result = Napi::Object::New(env);
+    result.Set("subKeys", Napi::Number::New(env, keyInfo.subKeys));
+    result.Set("values", Napi::Number::New(env, keyInfo.values));
+    result.Set("maxSubKeyLength", Napi::Number::New(env, keyInfo.maxSubKeyLength));
+    result.Set("maxValueNameLength", Napi::Number::New(env, keyInfo.maxValueNameLength));
+    result.Set("maxValueLength", Napi::Number::New(env, keyInfo.maxValueLength));
+    // FILETIME counts 100 ns from 1601; Date counts milliseconds from 1970.
+    result.Set("lastWriteTime", Napi::Date::New(env, double(keyInfo.lastWriteTime / 10000) - 11644473600000.0));
+    return result;
+}
+
 Napi::Value RegKeyWrap::Close(const Napi::CallbackInfo &info)
 {
     _regKey.Close();
+    _evicted = false;
+    RegHandleBudget::Shared().Closed(this);
     return info.Env().Undefined();
 }
 
@@ -395,9 +848,9 @@ Napi::Value RegKeyWrap::DeleteTree(const Napi::CallbackInfo &info)
 {
     bool res;
     if (info[0].IsString())
-        res = _regKey.DeleteTree(ConvertToStdString(info[0].As<Napi::String>()));
+        res = _Use().DeleteTree(ConvertToStdString(info[0].As<Napi::String>()));
     else if (info.Length() == 0)
-        res = _regKey.DeleteTree();
+        res = _Use().DeleteTree();
     else
     {
         _ThrowRegKeyError(info, "Invalid arguments.");
@@ -431,14 +884,14 @@ Napi::Value RegKeyWrap::OpenSubKey(const Napi::CallbackInfo &info)
         }
     }
 
-    hKey = _regKey.OpenSubKey(keyName, access);
+    hKey = _Use().OpenSubKey(keyName, access);
     if (hKey == NULL)
     {
         _ThrowRegKeyError(info, "Failed to open subkey.");
         return info.Env().Null();
     }
 
-    return RegKeyWrap::NewInstance(info.Env(), hKey, _path + STR('\\') + keyName);
+    return RegKeyWrap::NewInstance(info.Env(), RegKey(_regKey.GetBackend(), hKey), _path + STR('\\') + keyName, access);
 }
 
 Napi::Value RegKeyWrap::CreateSubKey(const Napi::CallbackInfo &info)
@@ -463,14 +916,14 @@ Napi::Value RegKeyWrap::CreateSubKey(const Napi::CallbackInfo &info)
         }
     }
 
-    hKey = _regKey.CreateSubKey(keyName, access);
+    hKey = _Use().CreateSubKey(keyName, access);
     if (hKey == NULL)
     {
         _ThrowRegKeyError(info, "Failed to create subkey.");
         return info.Env().Null();
     }
 
-    return RegKeyWrap::NewInstance(info.Env(), hKey, _path + STR('\\') + keyName);
+    return RegKeyWrap::NewInstance(info.Env(), RegKey(_regKey.GetBackend(), hKey), _path + STR('\\') + keyName, access);
 }
 
 Napi::Value RegKeyWrap::DeleteSubKey(const Napi::CallbackInfo &info)
@@ -478,7 +931,7 @@ Napi::Value RegKeyWrap::DeleteSubKey(const Napi::CallbackInfo &info)
     if (info[0].IsString())
     {
         String keyName = ConvertToStdString(info[0].As<Napi::String>());
-        bool res = _regKey.DeleteSubKey(keyName);
+        bool res = _Use().DeleteSubKey(keyName);
         if (!res)
             _ThrowRegKeyError(info, "Failed to delete subkey.");
         return Napi::Boolean::New(info.Env(), res);
@@ -489,13 +942,9 @@ Napi::Value RegKeyWrap::DeleteSubKey(const Napi::CallbackInfo &info)
 
 Napi::Value RegKeyWrap::GetSubKeyNames(const Napi::CallbackInfo &info)
 {
-    Napi::Array results = Napi::Array::New(info.Env());
-    auto subkeys = _regKey.GetSubKeyNames();
-    int i = 0;
-    for (auto it = subkeys.begin(); it != subkeys.end(); it++)
-        results.Set(i++, ConvertToNapiString(info.Env(), *it));
-        
-    return results;
+    Napi::Env env = info.Env();
+    RegMarshal &marshal = GetMarshal(env);
+    return marshal.NewArray(env, _Use().GetSubKeyNames(), [env, &marshal](const String &name) { return marshal.NewName(env, name); });
 }
 
 Napi::Value RegKeyWrap::HasSubKey(const Napi::CallbackInfo &info)
@@ -503,25 +952,55 @@ Napi::Value RegKeyWrap::HasSubKey(const Napi::CallbackInfo &info)
     if (info[0].IsString())
     {
         String keyName = ConvertToStdString(info[0].As<Napi::String>());
-        return Napi::Boolean::New(info.Env(), _regKey.HasSubKey(keyName));
+        return Napi::Boolean::New(info.Env(), _Use().HasSubKey(keyName));
     }
     else
         throw Napi::TypeError::New(info.Env(), "Subkey name expected.");
 }
 
+Napi::Value RegKeyWrap::GetValue(const Napi::CallbackInfo &info)
+{
+    if (info[0].IsString())
+    {
+        String valueName = ConvertToStdString(info[0].As<Napi::String>());
+        bool success = false;
+        RegValue value = _Use().GetValue(valueName, &success);
+        if (!success)
+        {
+            _ThrowRegKeyError(info, "Failed to get value.", valueName);
+            return info.Env().Null();
+        }
+        return ConvertValueData(info.Env(), value);
+    }
+    else
+        throw Napi::TypeError::New(info.Env(), "Value name expected.");
+}
+
 Napi::Value RegKeyWrap::GetBinaryValue(const Napi::CallbackInfo &info)
 {
     if (info[0].IsString())
     {
         String valueName = ConvertToStdString(info[0].As<Napi::String>());
         bool success = false;
-        ByteArray buffer = _regKey.GetBinaryValue(valueName, &success);
+        ByteArray buffer = _Use().GetBinaryValue(valueName, &success);
         if (!success)
         {
             _ThrowRegKeyError(info, "Failed to get value.", valueName);
             return info.Env().Null();
         }
-            
+
+        // Compressed values are decoded straight into the returned buffer. Data that only looks
+        // compressed is plain data that starts with the magic, and is returned as it is.
+        if (info[1].IsObject() && info[1].As<Napi::Object>().Get("decompress").ToBoolean().Value() &&
+            RegCompress::IsCompleteValue(buffer.data(), buffer.size()))
+        {
+            size_t rawSize = RegCompress::GetRawSize(buffer.data());
+            Napi::Buffer<BYTE> raw = Napi::Buffer<BYTE>::New(info.Env(), rawSize);
+            if (RegCompress::Decompress(buffer.data(), buffer.size(), raw.Data(), rawSize))
+                return raw;
+        }
+
+
         return Napi::Buffer<BYTE>::Copy(info.Env(), buffer.data(), buffer.size());
     }
     else
@@ -534,7 +1013,7 @@ Napi::Value RegKeyWrap::GetStringValue(const Napi::CallbackInfo &info)
     {
         String valueName = ConvertToStdString(info[0].As<Napi::String>());
         bool success = false;
-        String value = _regKey.GetStringValue(valueName, &success);
+        String value = _Use().GetStringValue(valueName, &success);
         if (!success)
         {
             _ThrowRegKeyError(info, "Failed to get value.", valueName);
@@ -547,25 +1026,48 @@ Napi::Value RegKeyWrap::GetStringValue(const Napi::CallbackInfo &info)
         throw Napi::TypeError::New(info.Env(), "Value name expected.");
 }
 
+Napi::Value RegKeyWrap::GetExpandedValue(const Napi::CallbackInfo &info)
+{
+    if (info[0].IsString())
+    {
+        String valueName = ConvertToStdString(info[0].As<Napi::String>());
+        bool success = false;
+        RegValue value = _Use().GetValue(valueName, &success);
+        String text;
+        if (success && !(value.type == REG_SZ || value.type == REG_EXPAND_SZ))
+        {
+            _regKey.SetLastStatus(ERROR_INVALID_DATA);
+            success = false;
+        }
+        if (!success)
+        {
+            _ThrowRegKeyError(info, "Failed to get value.", valueName);
+            return info.Env().Null();
+        }
+
+        RegCodec<REG_EXPAND_SZ>::Decode(value.data.data(), value.data.size(), text);
+        if (value.type == REG_EXPAND_SZ)
+            text = CreateEnvironment(info[1])->Expand(text);
+        return ConvertToNapiString(info.Env(), text);
+    }
+    else
+        throw Napi::TypeError::New(info.Env(), "Value name expected.");
+}
+
 Napi::Value RegKeyWrap::GetMultiStringValue(const Napi::CallbackInfo &info)
 {
     if (info[0].IsString())
     {
         String valueName = ConvertToStdString(info[0].As<Napi::String>());
         bool success = false;
-        auto values = _regKey.GetMultiStringValue(valueName, &success);
+        auto values = _Use().GetMultiStringValue(valueName, &success);
         if (!success)
         {
             _ThrowRegKeyError(info, "Failed to get value.", valueName);
             return info.Env().Null();
         }
 
-        Napi::Array results = Napi::Array::New(info.Env());
-        int i = 0;
-        for (auto it = values.begin(); it != values.end(); it++)
-            results.Set(i++, ConvertToNapiString(info.Env(), *it));
-            
-        return results;
+        return ConvertToNapiValue(info.Env(), values);
     }
     else
         throw Napi::TypeError::New(info.Env(), "Value name expected.");
@@ -577,7 +1079,7 @@ Napi::Value RegKeyWrap::GetDwordValue(const Napi::CallbackInfo &info)
     {
         String valueName = ConvertToStdString(info[0].As<Napi::String>());
         bool success = false;
-        DWORD value = _regKey.GetDwordValue(valueName, &success);
+        DWORD value = _Use().GetDwordValue(valueName, &success);
         if (!success)
         {
             _ThrowRegKeyError(info, "Failed to get value.", valueName);
@@ -595,13 +1097,13 @@ Napi::Value RegKeyWrap::GetQwordValue(const Napi::CallbackInfo &info)
     {
         String valueName = ConvertToStdString(info[0].As<Napi::String>());
         bool success = false;
-        QWORD value = _regKey.GetQwordValue(valueName, &success);
+        QWORD value = _Use().GetQwordValue(valueName, &success);
         if (!success)
         {
             _ThrowRegKeyError(info, "Failed to get value.", valueName);
             return info.Env().Null();
         }
-        return Napi::BigInt::New(info.Env(), value);
+        return Napi::BigInt::New(info.Env(), uint64_t(value));
     }
     else
         throw Napi::TypeError::New(info.Env(), "Value name expected.");
@@ -612,11 +1114,11 @@ Napi::Value RegKeyWrap::GetValueType(const Napi::CallbackInfo &info)
     if (info[0].IsString())
     {
         String valueName = ConvertToStdString(info[0].As<Napi::String>());
-        DWORD type = _regKey.GetValueType(valueName);
+        DWORD type = _Use().GetValueType(valueName);
         if (!type)
             _ThrowRegKeyError(info, "Failed to get value type.", valueName);
             
-        return ConvertToNapiString(info.Env(), StringifyKeyTypeName(type));
+        return GetMarshal(info.Env()).TypeName(info.Env(), type);
     }
     else
         throw Napi::TypeError::New(info.Env(), "Value name expected.");
@@ -627,7 +1129,7 @@ Napi::Value RegKeyWrap::HasValue(const Napi::CallbackInfo &info)
     if (info[0].IsString())
     {
         String valueName = ConvertToStdString(info[0].As<Napi::String>());
-        return Napi::Boolean::New(info.Env(), _regKey.HasValue(valueName));
+        return Napi::Boolean::New(info.Env(), _Use().HasValue(valueName));
     }
     else
         throw Napi::TypeError::New(info.Env(), "Value name expected.");
@@ -635,13 +1137,44 @@ Napi::Value RegKeyWrap::HasValue(const Napi::CallbackInfo &info)
 
 Napi::Value RegKeyWrap::GetValueNames(const Napi::CallbackInfo &info)
 {
-    Napi::Array results = Napi::Array::New(info.Env());
-    auto values = _regKey.GetValueNames();
-    int i = 0;
-    for (auto it = values.begin(); it != values.end(); it++)
-        results.Set(i++, ConvertToNapiString(info.Env(), *it));
-        
-    return results;
+    Napi::Env env = info.Env();
+    RegMarshal &marshal = GetMarshal(env);
+    return marshal.NewArray(env, _Use().GetValueNames(), [env, &marshal](const String &name) { return marshal.NewName(env, name); });
+}
+
+Napi::Value RegKeyWrap::SetValue(const Napi::CallbackInfo &info)
+{
+    if (!info[0].IsString())
+        throw Napi::TypeError::New(info.Env(), "Value name expected.");
+    if (!info[2].IsString())
+        throw Napi::TypeError::New(info.Env(), "Value type expected.");
+
+    RegValue value;
+    value.name = ConvertToStdString(info[0].As<Napi::String>());
+    value.type = ParseKeyType(ConvertToStdString(info[2].As<Napi::String>()), REG_NONE);
+    if (info[1].IsBuffer())
+    {
+        Napi::Buffer<BYTE> buffer = info[1].As<Napi::Buffer<BYTE>>();
+        value.data.assign(buffer.Data(), buffer.Data() + buffer.Length());
+    }
+    else
+    {
+        EncodeFromNapi visitor = {info[1], value.data};
+        LSTATUS status = RegVisitCodec(value.type, visitor);
+        if (status == ERROR_BAD_FORMAT)
+            throw Napi::TypeError::New(info.Env(), "Invalid value for " + info[2].As<Napi::String>().Utf8Value() + ".");
+        if (status != ERROR_SUCCESS)
+        {
+            _regKey.SetLastStatus(status);
+            _ThrowRegKeyError(info, "Failed to set value.", value.name);
+            return Napi::Boolean::New(info.Env(), false);
+        }
+    }
+
+    bool res = _Use().PutValue(value);
+    if (!res)
+        _ThrowRegKeyError(info, "Failed to set value.", value.name);
+    return Napi::Boolean::New(info.Env(), res);
 }
 
 Napi::Value RegKeyWrap::SetBinaryValue(const Napi::CallbackInfo &info)
@@ -653,14 +1186,30 @@ Napi::Value RegKeyWrap::SetBinaryValue(const Napi::CallbackInfo &info)
         throw Napi::TypeError::New(info.Env(), "Buffer value expected.");
 
     DWORD type = REG_BINARY;
+    bool compress = false;
+    size_t threshold = RegCompress::DefaultThreshold;
     if (info[2].IsString())
         type = ParseKeyType(ConvertToStdString(info[2].As<Napi::String>()), REG_BINARY);
+    else if (info[2].IsObject())
+    {
+        Napi::Object options = info[2].As<Napi::Object>();
+        Napi::Value typeValue = options.Get("type");
+        Napi::Value thresholdValue = options.Get("threshold");
+        if (typeValue.IsString())
+            type = ParseKeyType(ConvertToStdString(typeValue.As<Napi::String>()), REG_BINARY);
+        if (thresholdValue.IsNumber())
+            threshold = thresholdValue.As<Napi::Number>().Uint32Value();
+        compress = options.Get("compress").ToBoolean().Value();
+    }
 
     Napi::Buffer<byte> data = info[1].As<Napi::Buffer<byte>>();
-    bool res = _regKey.SetBinaryValue(ConvertToStdString(info[0].As<Napi::String>()),
-                                      data.Data(),
-                                      data.Length(),
-                                      type);
+    // Payloads that do not shrink are stored as they are.
+    ByteArray compressed;
+    if (compress && data.Length() >= threshold)
+        RegCompress::Compress(data.Data(), data.Length(), compressed);
+    bool res = compressed.empty()
+        ? _Use().SetBinaryValue(ConvertToStdString(info[0].As<Napi::String>()), data.Data(), data.Length(), type)
+        : _Use().SetBinaryValue(ConvertToStdString(info[0].As<Napi::String>()), compressed.data(), compressed.size(), type);
     if (!res)
         _ThrowRegKeyError(info, "Failed to set binary value.");
     return Napi::Boolean::New(info.Env(), res);
@@ -680,7 +1229,7 @@ Napi::Value RegKeyWrap::SetStringValue(const Napi::CallbackInfo &info)
 
     String valueName = ConvertToStdString(info[0].As<Napi::String>());
     String value = ConvertToStdString(info[1].As<Napi::String>());
-    bool res = _regKey.SetStringValue(valueName, value, type);
+    bool res = _Use().SetStringValue(valueName, value, type);
     if (!res)
         _ThrowRegKeyError(info, "Failed to set string value.");
     return Napi::Boolean::New(info.Env(), res);
@@ -703,7 +1252,7 @@ Napi::Value RegKeyWrap::SetMultiStringValue(const Napi::CallbackInfo &info)
     for (uint32_t i = 0; i < values.Length(); i++)
         data.push_back(ConvertToStdString(values.Get(i).ToString()));
 
-    bool res = _regKey.SetMultiStringValue(
+    bool res = _Use().SetMultiStringValue(
         ConvertToStdString(info[0].As<Napi::String>()), data, type);
     if (!res)
         _ThrowRegKeyError(info, "Failed to set multi-string value.");
@@ -715,16 +1264,15 @@ Napi::Value RegKeyWrap::SetDwordValue(const Napi::CallbackInfo &info)
     if (!info[0].IsString())
         throw Napi::TypeError::New(info.Env(), "Value name expected.");
         
-    if (!info[1].IsNumber())
+    DWORD value = 0;
+    if (!ConvertFromNapiValue(info[1], value))
         throw Napi::TypeError::New(info.Env(), "Number value expected.");
     
     DWORD type = REG_DWORD;
     if (info[2].IsString())
         type = ParseKeyType(ConvertToStdString(info[2].As<Napi::String>()), REG_DWORD);
 
-    bool res = _regKey.SetDwordValue(ConvertToStdString(info[0].As<Napi::String>()),
-                                     info[1].As<Napi::Number>().Uint32Value(),
-                                     type);
+    bool res = _Use().SetDwordValue(ConvertToStdString(info[0].As<Napi::String>()), value, type);
     if (!res)
         _ThrowRegKeyError(info, "Failed to set DWORD value.");
     return Napi::Boolean::New(info.Env(), res);
@@ -732,33 +1280,25 @@ Napi::Value RegKeyWrap::SetDwordValue(const Napi::CallbackInfo &info)
 
 Napi::Value RegKeyWrap::SetQwordValue(const Napi::CallbackInfo &info)
 {
-    if (!info[0].IsString()) {
+    if (!info[0].IsString())
         throw Napi::TypeError::New(info.Env(), "Value name expected.");
-    }
-    if (!info[1].IsNumber()) {
-        throw Napi::TypeError::New(info.Env(), "Number value expected.");
-    }
 
     QWORD value = 0;
-    if (info[1].IsNumber())
-        value = QWORD(info[1].As<Napi::Number>().Uint32Value());
-    else if (info[1].IsBigInt())
+    if (!ConvertFromNapiValue(info[1], value))
     {
-        bool loss = false;
-        value = info[1].As<Napi::BigInt>().Uint64Value(&loss);
-        if (loss)
+        if (info[1].IsBigInt())
         {
             _ThrowRegKeyError(info, "BigInt value too big.");
             return Napi::Boolean::New(info.Env(), false);
         }
-    }
-    else
         throw Napi::TypeError::New(info.Env(), "Number value expected.");
+    }
+
     DWORD type = REG_QWORD;
     if (info[2].IsString())
         type = ParseKeyType(ConvertToStdString(info[2].As<Napi::String>()), REG_QWORD);
 
-    bool res = _regKey.SetQwordValue(ConvertToStdString(info[0].As<Napi::String>()), value, type);
+    bool res = _Use().SetQwordValue(ConvertToStdString(info[0].As<Napi::String>()), value, type);
     if (!res)
         _ThrowRegKeyError(info, "Failed to set QWORD value.");
     return Napi::Boolean::New(info.Env(), res);
@@ -769,7 +1309,7 @@ Napi::Value RegKeyWrap::DeleteValue(const Napi::CallbackInfo &info)
     if (info[0].IsString())
     {
         String valueName = ConvertToStdString(info[0].As<Napi::String>());
-        bool res = _regKey.DeleteValue(valueName);
+        bool res = _Use().DeleteValue(valueName);
         if (!res)
             _ThrowRegKeyError(info, "Failed to set delete value.");
         return Napi::Boolean::New(info.Env(), res);
@@ -778,21 +1318,1358 @@ Napi::Value RegKeyWrap::DeleteValue(const Napi::CallbackInfo &info)
         throw Napi::TypeError::New(info.Env(), "Value name expected.");
 }
 
-void RegKeyWrap::_ThrowRegKeyError(const Napi::CallbackInfo &info,
-                                   const std::string &message,
-                                   const String &value)
+namespace
 {
-    // 从 prototype 获取 __throwRegKeyError__ 函数
-    Napi::Object thisObj = info.This().As<Napi::Object>();
-    Napi::Value regKeyError = thisObj.Get("__throwRegKeyError__");
-    if (regKeyError.IsFunction())
-    {
-        Napi::Function throwFunc = regKeyError.As<Napi::Function>();
-        throwFunc.Call({
-            Napi::String::New(info.Env(), message),
-            thisObj,
-            ConvertToNapiString(info.Env(), value),
-            ConvertToNapiString(info.Env(), TranslateError(_regKey.GetLastStatus()))
-        });
-    }
+    struct SearchBatch
+    {
+        std::vector<RegSearchHit> hits;
+        LSTATUS status;
+        bool done;
+    };
+
+    const char *StringifySearchField(RegSearchField field)
+    {
+        switch (field)
+        {
+        case RegSearchField::Key:
+            return "keys";
+        case RegSearchField::Name:
+            return "names";
+        default:
+            return "data";
+        }
+    }
+}
+
+Napi::Value RegKeyWrap::Search(const Napi::CallbackInfo &info)
+{
+    if (!info[0].IsString())
+        throw Napi::TypeError::New(info.Env(), "Search pattern expected.");
+    if (!info[2].IsFunction())
+        throw Napi::TypeError::New(info.Env(), "Callback expected.");
+
+    RegSearchOptions options;
+    options.pattern = ConvertToStdString(info[0].As<Napi::String>());
+    if (info[1].IsObject())
+    {
+        Napi::Object optionsObject = info[1].As<Napi::Object>();
+        Napi::Value inValue = optionsObject.Get("in");
+        Napi::Value typesValue = optionsObject.Get("types");
+        Napi::Value maxDepthValue = optionsObject.Get("maxDepth");
+
+        if (inValue.IsArray())
+        {
+            Napi::Array inArray = inValue.As<Napi::Array>();
+            options.fields = 0;
+            for (uint32_t i = 0; i < inArray.Length(); i++)
+            {
+                std::string field = inArray.Get(i).ToString().Utf8Value();
+                if (field == "keys")
+                    options.fields |= uint32_t(RegSearchField::Key);
+                else if (field == "names")
+                    options.fields |= uint32_t(RegSearchField::Name);
+                else if (field == "data")
+                    options.fields |= uint32_t(RegSearchField::Data);
+                else
+                    throw Napi::TypeError::New(info.Env(), "Unknown search field: " + field);
+            }
+        }
+        if (typesValue.IsArray())
+        {
+            Napi::Array typesArray = typesValue.As<Napi::Array>();
+            for (uint32_t i = 0; i < typesArray.Length(); i++)
+            {
+                Napi::Value type = typesArray.Get(i);
+                if (type.IsNumber())
+                    options.types.push_back(type.As<Napi::Number>().Uint32Value());
+                else
+                    options.types.push_back(ParseKeyType(ConvertToStdString(type.ToString())));
+            }
+        }
+        if (maxDepthValue.IsNumber())
+            options.maxDepth = maxDepthValue.As<Napi::Number>().Int32Value();
+    }
+
+    // The search owns its own handle, so closing this key does not cut it short.
+    // That handle does not see buffered writes; failed ones show in the write-back stats.
+    _Use().FlushWriteBack();
+    RegKey root(_regKey.GetBackend());
+    if (root.Open(_regKey.GetHandle(), STR(""), KEY_READ) == NULL)
+    {
+        _regKey.SetLastStatus(root.GetLastStatus());
+        _ThrowRegKeyError(info, "Failed to open key for search.");
+        return info.Env().Null();
+    }
+
+    String basePath = _path;
+    Napi::ThreadSafeFunction callback = Napi::ThreadSafeFunction::New(
+        info.Env(), info[2].As<Napi::Function>(), "RegKeySearch", 0, 1);
+    auto deliver = [basePath](Napi::Env env, Napi::Function jsCallback, SearchBatch *batch) {
+        if (env != nullptr)
+        {
+            if (batch->done)
+                jsCallback.Call({env.Null(), Napi::Number::New(env, batch->status)});
+            else
+            {
+                RegMarshal &marshal = GetMarshal(env);
+                Napi::Array hits = marshal.NewArray(env, batch->hits, [&](const RegSearchHit &hit) {
+                    Napi::Object hitObject = Napi::Object::New(env);
+                    marshal.Set(hitObject, RegMarshal::PathProperty, ConvertToNapiString(env, hit.path.empty() ? basePath : basePath + STR('\\') + hit.path));
+                    if (hit.field != RegSearchField::Key)
+                    {
+                        marshal.Set(hitObject, RegMarshal::ValueProperty, marshal.NewName(env, hit.valueName));
+                        marshal.Set(hitObject, RegMarshal::TypeProperty, marshal.TypeName(env, hit.type));
+                    }
+                    hitObject.Set("in", Napi::String::New(env, StringifySearchField(hit.field)));
+                    return hitObject;
+                });
+                jsCallback.Call({hits, Napi::Number::New(env, ERROR_SUCCESS)});
+            }
+        }
+        delete batch;
+    };
+
+    std::shared_ptr<RegSearch> search = RegSearch::Create(
+        std::move(root), options,
+        [callback, deliver](std::vector<RegSearchHit> &&hits) {
+            callback.NonBlockingCall(new SearchBatch{std::move(hits), ERROR_SUCCESS, false}, deliver);
+        },
+        [callback, deliver](LSTATUS status) {
+            callback.NonBlockingCall(new SearchBatch{{}, status, true}, deliver);
+            callback.Release();
+        });
+    search->Start();
+
+    return Napi::Function::New(info.Env(), [search](const Napi::CallbackInfo &info) {
+        search->Cancel();
+        return info.Env().Undefined();
+    }, "cancel");
+}
+
+namespace
+{
+    struct TreeOpEvent
+    {
+        RegTreeOpResult result;
+        bool done;
+    };
+
+    std::vector<String> ConvertToStringArray(const Napi::Value &value)
+    {
+        std::vector<String> strings;
+        if (value.IsString())
+            strings.push_back(ReplaceString(ConvertToStdString(value.As<Napi::String>()), STR("/"), STR("\\")));
+        else if (value.IsArray())
+        {
+            Napi::Array array = value.As<Napi::Array>();
+            for (uint32_t i = 0; i < array.Length(); i++)
+                strings.push_back(ReplaceString(ConvertToStdString(array.Get(i).ToString()), STR("/"), STR("\\")));
+        }
+        return strings;
+    }
+
+    Napi::Object ConvertTreeOpProgress(Napi::Env env, const RegTreeOpProgress &progress)
+    {
+        Napi::Object object = Napi::Object::New(env);
+        object.Set("keys", Napi::Number::New(env, double(progress.keys)));
+        object.Set("values", Napi::Number::New(env, double(progress.values)));
+        object.Set("bytes", Napi::Number::New(env, double(progress.bytes)));
+        object.Set("skipped", Napi::Number::New(env, double(progress.skipped)));
+        return object;
+    }
+}
+
+Napi::Value RegKeyWrap::TreeOp(const Napi::CallbackInfo &info)
+{
+    if (!info[0].IsString())
+        throw Napi::TypeError::New(info.Env(), "Operation expected.");
+    if (!info[3].IsFunction())
+        throw Napi::TypeError::New(info.Env(), "Callback expected.");
+
+    std::string kindName = info[0].As<Napi::String>().Utf8Value();
+    RegTreeOpKind kind;
+    if (kindName == "copy")
+        kind = RegTreeOpKind::Copy;
+    else if (kindName == "move")
+        kind = RegTreeOpKind::Move;
+    else if (kindName == "delete")
+        kind = RegTreeOpKind::Delete;
+    else
+        throw Napi::TypeError::New(info.Env(), "Unknown operation: " + kindName);
+
+    RegTreeOpOptions options;
+    if (info[2].IsObject())
+    {
+        Napi::Object optionsObject = info[2].As<Napi::Object>();
+        options.include = ConvertToStringArray(optionsObject.Get("include"));
+        options.exclude = ConvertToStringArray(optionsObject.Get("exclude"));
+        options.excludeValues = ConvertToStringArray(optionsObject.Get("excludeValues"));
+        options.resume = ConvertToStringArray(optionsObject.Get("resume"));
+    }
+
+    // Copies and moves are applied to this key from the given one, deletions to this key itself.
+    // Both sides get handles of their own, so closing either key does not cut the operation short.
+    _Use().FlushWriteBack();
+    RegKey source(_regKey.GetBackend());
+    RegKey dest(_regKey.GetBackend());
+    if (kind == RegTreeOpKind::Delete)
+    {
+        if (source.Open(_regKey.GetHandle(), STR(""), KEY_READ | KEY_WRITE) == NULL)
+        {
+            _regKey.SetLastStatus(source.GetLastStatus());
+            _ThrowRegKeyError(info, "Failed to open key.");
+            return info.Env().Null();
+        }
+    }
+    else
+    {
+        if (!IsInstance(info.Env(), info[1]))
+            throw Napi::TypeError::New(info.Env(), "Invalid source key.");
+        RegKeyWrap *pRegKeyWrap = Napi::ObjectWrap<RegKeyWrap>::Unwrap(info[1].As<Napi::Object>());
+        REGSAM sourceAccess = kind == RegTreeOpKind::Move ? KEY_READ | KEY_WRITE : KEY_READ;
+        pRegKeyWrap->_Use().FlushWriteBack();
+        source = RegKey(pRegKeyWrap->_regKey.GetBackend());
+        if (source.Open(pRegKeyWrap->_regKey.GetHandle(), STR(""), sourceAccess) == NULL)
+        {
+            _regKey.SetLastStatus(source.GetLastStatus());
+            _ThrowRegKeyError(info, "Failed to open source key.", pRegKeyWrap->_path);
+            return info.Env().Null();
+        }
+        // Reopening the source may have evicted this key.
+        if (dest.Open(_Use().GetHandle(), STR(""), KEY_READ | KEY_WRITE) == NULL)
+        {
+            _regKey.SetLastStatus(dest.GetLastStatus());
+            _ThrowRegKeyError(info, "Failed to open key.");
+            return info.Env().Null();
+        }
+    }
+
+    Napi::ThreadSafeFunction callback = Napi::ThreadSafeFunction::New(
+        info.Env(), info[3].As<Napi::Function>(), "RegKeyTreeOp", 0, 1);
+    auto deliver = [](Napi::Env env, Napi::Function jsCallback, TreeOpEvent *event) {
+        if (env != nullptr)
+        {
+            Napi::Object payload = ConvertTreeOpProgress(env, event->result.progress);
+            if (event->done)
+            {
+                const RegTreeOpResult &result = event->result;
+                payload.Set("status", Napi::Number::New(env, result.status));
+                if (result.status != ERROR_SUCCESS && result.status != ERROR_CANCELLED)
+                {
+                    payload.Set("error", ConvertToNapiString(env, TranslateError(result.status)));
+                    payload.Set("failedPath", ConvertToNapiString(env, result.failedPath));
+                }
+                if (result.status != ERROR_SUCCESS)
+                {
+                    payload.Set("completed", ConvertToNapiValue(env, result.completed));
+                }
+            }
+            jsCallback.Call({Napi::String::New(env, event->done ? "done" : "progress"), payload});
+        }
+        delete event;
+    };
+
+    std::shared_ptr<RegTreeOp> op = RegTreeOp::Create(
+        kind, std::move(source), std::move(dest), options,
+        [callback, deliver](const RegTreeOpProgress &progress) {
+            TreeOpEvent *event = new TreeOpEvent{RegTreeOpResult(), false};
+            event->result.progress = progress;
+            callback.NonBlockingCall(event, deliver);
+        },
+        [callback, deliver](RegTreeOpResult &&result) {
+            callback.NonBlockingCall(new TreeOpEvent{std::move(result), true}, deliver);
+            callback.Release();
+        });
+    op->Start();
+
+    return Napi::Function::New(info.Env(), [op](const Napi::CallbackInfo &info) {
+        op->Cancel();
+        return info.Env().Undefined();
+    }, "cancel");
+}
+
+namespace
+{
+    Napi::Array ConvertReadResults(Napi::Env env, const RegBatchReader &reader, const std::vector<Napi::Reference<Napi::Value>> &paths)
+    {
+        const std::vector<RegReadResult> &results = reader.GetResults();
+        RegMarshal &marshal = GetMarshal(env);
+        std::vector<napi_value> items;
+        items.reserve(results.size());
+        for (size_t i = 0; i < results.size(); i++)
+        {
+            const RegReadResult &result = results[i];
+            Napi::Object item = Napi::Object::New(env);
+            marshal.Set(item, RegMarshal::PathProperty, paths[i].Value());
+            marshal.Set(item, RegMarshal::StatusProperty, Napi::Number::New(env, result.status));
+
+            std::vector<napi_value> values;
+            values.reserve(result.values.size());
+            for (size_t j = 0; j < result.values.size(); j++)
+            {
+                const RegValue &value = result.values[j];
+                Napi::Object valueObject = Napi::Object::New(env);
+                marshal.Set(valueObject, RegMarshal::NameProperty, marshal.NewName(env, value.name));
+                marshal.Set(valueObject, RegMarshal::StatusProperty, Napi::Number::New(env, result.statuses[j]));
+                if (result.statuses[j] == ERROR_SUCCESS)
+                {
+                    marshal.Set(valueObject, RegMarshal::TypeProperty, marshal.TypeName(env, value.type));
+                    marshal.Set(valueObject, RegMarshal::ValueProperty, ConvertValueData(env, value));
+                }
+                values.push_back(valueObject);
+            }
+            item.Set("values", marshal.NewArray(env, values));
+            items.push_back(item);
+        }
+        return marshal.NewArray(env, items);
+    }
+
+    class ReadManyWorker : public Napi::AsyncWorker
+    {
+    public:
+        ReadManyWorker(Napi::Env env, std::unique_ptr<RegBatchReader> &&reader,
+                       std::vector<Napi::Reference<Napi::Value>> &&paths)
+            : Napi::AsyncWorker(env, "RegKeyReadMany")
+            , _deferred(Napi::Promise::Deferred::New(env))
+            , _reader(std::move(reader))
+            , _paths(std::move(paths))
+        {
+        }
+
+        Napi::Value GetPromise() const
+        {
+            return _deferred.Promise();
+        }
+
+        void Execute() override
+        {
+            _reader->Run();
+        }
+
+        void OnOK() override
+        {
+            _deferred.Resolve(ConvertReadResults(Env(), *_reader, _paths));
+        }
+
+        void OnError(const Napi::Error &error) override
+        {
+            _deferred.Reject(error.Value());
+        }
+
+    private:
+        Napi::Promise::Deferred _deferred;
+        std::unique_ptr<RegBatchReader> _reader;
+        std::vector<Napi::Reference<Napi::Value>> _paths;
+    };
+
+    // Parses readMany(requests, options) into a reader; the paths are kept for the results.
+    std::unique_ptr<RegBatchReader> ParseReadRequests(const Napi::CallbackInfo &info,
+                                                      std::vector<Napi::Reference<Napi::Value>> &paths)
+    {
+        if (!info[0].IsArray())
+            throw Napi::TypeError::New(info.Env(), "Array of requests expected.");
+
+        std::shared_ptr<RegBackend> backend = RegBackend::GetDefault();
+        std::shared_ptr<RegEnvironment> environment;
+        REGSAM access = KEY_READ;
+        if (info[1].IsObject())
+        {
+            Napi::Object options = info[1].As<Napi::Object>();
+            Napi::Value backendValue = options.Get("backend");
+            Napi::Value accessValue = options.Get("access");
+            // One snapshot of the environment serves the whole batch.
+            if (options.Get("expand").ToBoolean())
+                environment = CreateEnvironment(options.Get("env"));
+            if (backendValue.IsString())
+            {
+                backend = RegBackend::Get(backendValue.As<Napi::String>().Utf8Value());
+                if (!backend)
+                    throw Napi::TypeError::New(info.Env(), "Unknown backend.");
+            }
+            if (accessValue.IsNumber())
+                access |= accessValue.As<Napi::Number>().Uint32Value();
+        }
+
+        Napi::Array array = info[0].As<Napi::Array>();
+        std::vector<RegReadRequest> requests(array.Length());
+        for (uint32_t i = 0; i < array.Length(); i++)
+        {
+            Napi::Value entry = array.Get(i);
+            Napi::Value pathValue = entry;
+            Napi::Value valuesValue = info.Env().Undefined();
+            if (entry.IsObject())
+            {
+                pathValue = entry.As<Napi::Object>().Get("path");
+                valuesValue = entry.As<Napi::Object>().Get("values");
+            }
+            if (!pathValue.IsString())
+                throw Napi::TypeError::New(info.Env(), "Request " + std::to_string(i) + " has no path.");
+
+            RegReadRequest &request = requests[i];
+            String baseKeyName;
+            if (!RegKeyWrap::ParsePath(ConvertToStdString(pathValue.As<Napi::String>()),
+                                       request.host, baseKeyName, request.subKey))
+                throw Napi::TypeError::New(info.Env(), "Invalid path format: " + pathValue.As<Napi::String>().Utf8Value());
+            while (!request.subKey.empty() && request.subKey.back() == STR('\\'))
+                request.subKey.pop_back();
+            request.baseKey = ParseBaseKey(baseKeyName);
+
+            if (valuesValue.IsString())
+                request.values.push_back(ConvertToStdString(valuesValue.As<Napi::String>()));
+            else if (valuesValue.IsArray())
+            {
+                Napi::Array names = valuesValue.As<Napi::Array>();
+                for (uint32_t j = 0; j < names.Length(); j++)
+                    request.values.push_back(ConvertToStdString(names.Get(j).ToString()));
+            }
+            paths.push_back(Napi::Persistent(pathValue));
+        }
+
+        std::unique_ptr<RegBatchReader> reader(new RegBatchReader(backend, std::move(requests), access));
+        reader->SetEnvironment(environment);
+        return reader;
+    }
+}
+
+Napi::Value RegKeyWrap::ReadMany(const Napi::CallbackInfo &info)
+{
+    std::vector<Napi::Reference<Napi::Value>> paths;
+    std::unique_ptr<RegBatchReader> reader = ParseReadRequests(info, paths);
+    ReadManyWorker *worker = new ReadManyWorker(info.Env(), std::move(reader), std::move(paths));
+    Napi::Value promise = worker->GetPromise();
+    worker->Queue();
+    return promise;
+}
+
+Napi::Value RegKeyWrap::ReadManySync(const Napi::CallbackInfo &info)
+{
+    std::vector<Napi::Reference<Napi::Value>> paths;
+    std::unique_ptr<RegBatchReader> reader = ParseReadRequests(info, paths);
+    reader->Run();
+    return ConvertReadResults(info.Env(), *reader, paths);
+}
+
+namespace
+{
+    struct HostQueryEvent
+    {
+        RegHostResult result;
+        LSTATUS status;
+        bool done;
+    };
+
+    Napi::Object ConvertHostResult(Napi::Env env, const RegHostResult &result)
+    {
+        RegMarshal &marshal = GetMarshal(env);
+        Napi::Object item = Napi::Object::New(env);
+        item.Set("host", ConvertToNapiString(env, result.host));
+        marshal.Set(item, RegMarshal::StatusProperty, Napi::Number::New(env, result.status));
+        item.Set("elapsed", Napi::Number::New(env, result.elapsed));
+
+        std::vector<napi_value> values;
+        values.reserve(result.values.size());
+        for (size_t i = 0; i < result.values.size(); i++)
+        {
+            const RegValue &value = result.values[i];
+            Napi::Object valueObject = Napi::Object::New(env);
+            marshal.Set(valueObject, RegMarshal::NameProperty, marshal.NewName(env, value.name));
+            marshal.Set(valueObject, RegMarshal::StatusProperty, Napi::Number::New(env, result.statuses[i]));
+            if (result.statuses[i] == ERROR_SUCCESS)
+            {
+                marshal.Set(valueObject, RegMarshal::TypeProperty, marshal.TypeName(env, value.type));
+                marshal.Set(valueObject, RegMarshal::ValueProperty, ConvertValueData(env, value));
+            }
+            values.push_back(valueObject);
+        }
+        item.Set("values", marshal.NewArray(env, values));
+        return item;
+    }
+}
+
+Napi::Value RegKeyWrap::QueryHosts(const Napi::CallbackInfo &info)
+{
+    if (!info[0].IsArray())
+        throw Napi::TypeError::New(info.Env(), "Array of hosts expected.");
+    if (!info[1].IsString())
+        throw Napi::TypeError::New(info.Env(), "Key path expected.");
+    if (!info[4].IsFunction())
+        throw Napi::TypeError::New(info.Env(), "Callback expected.");
+
+    std::vector<String> hosts;
+    Napi::Array hostArray = info[0].As<Napi::Array>();
+    for (uint32_t i = 0; i < hostArray.Length(); i++)
+        hosts.push_back(ConvertToStdString(hostArray.Get(i).ToString()));
+
+    String hostname, baseKeyName, subKeyName;
+    if (!ParsePath(ConvertToStdString(info[1].As<Napi::String>()), hostname, baseKeyName, subKeyName) ||
+        !hostname.empty() || ParseBaseKey(baseKeyName) == NULL)
+        throw Napi::TypeError::New(info.Env(), "Invalid path format: " + info[1].As<Napi::String>().Utf8Value());
+    while (!subKeyName.empty() && subKeyName.back() == STR('\\'))
+        subKeyName.pop_back();
+
+    std::vector<String> values;
+    if (info[2].IsString())
+        values.push_back(ConvertToStdString(info[2].As<Napi::String>()));
+    else if (info[2].IsArray())
+    {
+        Napi::Array names = info[2].As<Napi::Array>();
+        for (uint32_t i = 0; i < names.Length(); i++)
+            values.push_back(ConvertToStdString(names.Get(i).ToString()));
+    }
+
+    std::shared_ptr<RegBackend> backend = RegBackend::GetDefault();
+    RegHostQueryOptions options;
+    if (info[3].IsObject())
+    {
+        Napi::Object optionsObject = info[3].As<Napi::Object>();
+        Napi::Value concurrencyValue = optionsObject.Get("concurrency");
+        Napi::Value timeoutValue = optionsObject.Get("timeoutMs");
+        Napi::Value backendValue = optionsObject.Get("backend");
+        Napi::Value accessValue = optionsObject.Get("access");
+        if (concurrencyValue.IsNumber())
+            options.concurrency = concurrencyValue.As<Napi::Number>().Uint32Value();
+        if (timeoutValue.IsNumber())
+            options.timeout = timeoutValue.As<Napi::Number>().Uint32Value();
+        if (backendValue.IsString())
+        {
+            backend = RegBackend::Get(backendValue.As<Napi::String>().Utf8Value());
+            if (!backend)
+                throw Napi::TypeError::New(info.Env(), "Unknown backend.");
+        }
+        if (accessValue.IsNumber())
+            options.access |= accessValue.As<Napi::Number>().Uint32Value();
+    }
+
+    Napi::ThreadSafeFunction callback = Napi::ThreadSafeFunction::New(
+        info.Env(), info[4].As<Napi::Function>(), "RegKeyQueryHosts", 0, 1);
+    auto deliver = [](Napi::Env env, Napi::Function jsCallback, HostQueryEvent *event) {
+        if (env != nullptr)
+        {
+            if (event->done)
+                jsCallback.Call({env.Null(), Napi::Number::New(env, event->status)});
+            else
+            {
+                Napi::Array results = Napi::Array::New(env, 1);
+                results.Set(uint32_t(0), ConvertHostResult(env, event->result));
+                jsCallback.Call({results, Napi::Number::New(env, ERROR_SUCCESS)});
+            }
+        }
+        delete event;
+    };
+
+    std::shared_ptr<RegHostQuery> query = RegHostQuery::Create(
+        backend, std::move(hosts), ParseBaseKey(baseKeyName), subKeyName, std::move(values), options,
+        [callback, deliver](RegHostResult &&result) {
+            callback.NonBlockingCall(new HostQueryEvent{std::move(result), ERROR_SUCCESS, false}, deliver);
+        },
+        [callback, deliver](LSTATUS status) {
+            callback.NonBlockingCall(new HostQueryEvent{RegHostResult(), status, true}, deliver);
+            callback.Release();
+        });
+    query->Start();
+
+    return Napi::Function::New(info.Env(), [query](const Napi::CallbackInfo &info) {
+        query->Cancel();
+        return info.Env().Undefined();
+    }, "cancel");
+}
+
+namespace
+{
+    struct QueryBatch
+    {
+        std::vector<RegQueryMatch> matches;
+        LSTATUS status;
+        bool done;
+    };
+}
+
+Napi::Value RegKeyWrap::Query(const Napi::CallbackInfo &info)
+{
+    if (!info[0].IsString())
+        throw Napi::TypeError::New(info.Env(), "Query expected.");
+    if (!info[2].IsFunction())
+        throw Napi::TypeError::New(info.Env(), "Callback expected.");
+
+    RegQueryPlan plan;
+    std::string error;
+    size_t position;
+    if (!RegQuery::Compile(ConvertToStdString(info[0].As<Napi::String>()), plan, error, &position))
+        throw Napi::TypeError::New(info.Env(), "Invalid query at " + std::to_string(position) + ": " + error);
+    HKEY baseKey = ParseBaseKey(plan.baseKey);
+    if (baseKey == NULL)
+        throw Napi::TypeError::New(info.Env(), "Invalid query at 0: Unknown base key.");
+
+    std::shared_ptr<RegBackend> backend = RegBackend::GetDefault();
+    if (info[1].IsObject())
+    {
+        Napi::Value backendValue = info[1].As<Napi::Object>().Get("backend");
+        if (backendValue.IsString())
+        {
+            backend = RegBackend::Get(backendValue.As<Napi::String>().Utf8Value());
+            if (!backend)
+                throw Napi::TypeError::New(info.Env(), "Unknown backend.");
+        }
+    }
+
+    // No key under a missing root can match.
+    RegKey root(backend);
+    if (root.Open(baseKey, plan.root, KEY_READ) == NULL)
+    {
+        if (root.GetLastStatus() == ERROR_FILE_NOT_FOUND)
+            return info.Env().Null();
+        Napi::Error openError = Napi::Error::New(info.Env(), "Failed to open the root of the query.");
+        openError.Set("status", Napi::Number::New(info.Env(), root.GetLastStatus()));
+        throw openError;
+    }
+
+    String basePath = plan.root.empty() ? plan.baseKey : plan.baseKey + STR('\\') + plan.root;
+    Napi::ThreadSafeFunction callback = Napi::ThreadSafeFunction::New(
+        info.Env(), info[2].As<Napi::Function>(), "RegKeyQuery", 0, 1);
+    auto deliver = [basePath](Napi::Env env, Napi::Function jsCallback, QueryBatch *batch) {
+        if (env != nullptr)
+        {
+            if (batch->done)
+                jsCallback.Call({env.Null(), Napi::Number::New(env, batch->status)});
+            else
+            {
+                RegMarshal &marshal = GetMarshal(env);
+                std::vector<napi_value> matches;
+                matches.reserve(batch->matches.size());
+                for (RegQueryMatch &match : batch->matches)
+                {
+                    Napi::Object matchObject = Napi::Object::New(env);
+                    marshal.Set(matchObject, RegMarshal::PathProperty, ConvertToNapiString(env, match.path.empty() ? basePath : basePath + STR('\\') + match.path));
+                    if (match.isValue)
+                    {
+                        RegValue value = {std::move(match.valueName), match.type, std::move(match.data)};
+                        marshal.Set(matchObject, RegMarshal::ValueProperty, marshal.NewName(env, value.name));
+                        marshal.Set(matchObject, RegMarshal::TypeProperty, marshal.TypeName(env, value.type));
+                        marshal.Set(matchObject, RegMarshal::DataProperty, ConvertValueData(env, value));
+                    }
+                    matches.push_back(matchObject);
+                }
+                jsCallback.Call({marshal.NewArray(env, matches), Napi::Number::New(env, ERROR_SUCCESS)});
+            }
+        }
+        delete batch;
+    };
+
+    std::shared_ptr<RegQuery> query = RegQuery::Create(
+        std::move(root), plan,
+        [callback, deliver](std::vector<RegQueryMatch> &&matches) {
+            callback.NonBlockingCall(new QueryBatch{std::move(matches), ERROR_SUCCESS, false}, deliver);
+        },
+        [callback, deliver](LSTATUS status) {
+            callback.NonBlockingCall(new QueryBatch{{}, status, true}, deliver);
+            callback.Release();
+        });
+    query->Start();
+
+    return Napi::Function::New(info.Env(), [query](const Napi::CallbackInfo &info) {
+        query->Cancel();
+        return info.Env().Undefined();
+    }, "cancel");
+}
+
+namespace
+{
+    typedef std::shared_ptr<const RegTreeState> TreeStatePtr;
+
+    // Marks the External inside the state returned by syncTree(), so no other External is read as one.
+    const napi_type_tag TreeStateTag = {0x7c05e2b94f1a6d83, 0x3e8d71c0a5b92f46};
+
+    const char *StringifyTreeChangeKind(RegTreeChangeKind kind)
+    {
+        switch (kind)
+        {
+        case RegTreeChangeKind::KeyAdded:
+            return "keyAdded";
+        case RegTreeChangeKind::KeyRemoved:
+            return "keyRemoved";
+        case RegTreeChangeKind::ValueSet:
+            return "valueSet";
+        default:
+            return "valueRemoved";
+        }
+    }
+
+    TreeStatePtr ParseTreeState(const Napi::Value &value)
+    {
+        Napi::Value external = value.IsObject() ? value.As<Napi::Object>().Get("__state__") : value;
+        if (!external.IsExternal())
+            return TreeStatePtr();
+        Napi::External<TreeStatePtr> state = external.As<Napi::External<TreeStatePtr>>();
+        if (!state.CheckTypeTag(&TreeStateTag))
+            throw Napi::TypeError::New(value.Env(), "Tree state expected.");
+        return *state.Data();
+    }
+
+    Napi::Object ConvertSyncResult(Napi::Env env, const String &basePath, const TreeStatePtr &state,
+                                   const std::vector<RegTreeChange> &changes, const RegTreeSyncStats &stats)
+    {
+        RegMarshal &marshal = GetMarshal(env);
+        Napi::Array changeArray = marshal.NewArray(env, changes, [&](const RegTreeChange &change) {
+            Napi::Object changeObject = Napi::Object::New(env);
+            changeObject.Set("kind", Napi::String::New(env, StringifyTreeChangeKind(change.kind)));
+            marshal.Set(changeObject, RegMarshal::PathProperty, ConvertToNapiString(env, change.path.empty() ? basePath : basePath + STR('\\') + change.path));
+            if (change.kind == RegTreeChangeKind::ValueSet || change.kind == RegTreeChangeKind::ValueRemoved)
+                marshal.Set(changeObject, RegMarshal::NameProperty, marshal.NewName(env, change.value.name));
+            if (change.kind == RegTreeChangeKind::ValueSet)
+            {
+                marshal.Set(changeObject, RegMarshal::TypeProperty, marshal.TypeName(env, change.value.type));
+                marshal.Set(changeObject, RegMarshal::ValueProperty, ConvertValueData(env, change.value));
+            }
+            return changeObject;
+        });
+
+        Napi::Object result = Napi::Object::New(env);
+        // Opaque to JavaScript; handed back to the next pass.
+        Napi::Object stateObject = Napi::Object::New(env);
+        Napi::External<TreeStatePtr> external = Napi::External<TreeStatePtr>::New(env, new TreeStatePtr(state), [](Napi::Env, TreeStatePtr *state) {
+            delete state;
+        });
+        external.TypeTag(&TreeStateTag);
+        stateObject.Set("__state__", external);
+        stateObject.Set("keys", Napi::Number::New(env, double(state->keys.size())));
+        result.Set("state", stateObject);
+        result.Set("changes", changeArray);
+        result.Set("visited", Napi::Number::New(env, double(stats.visited)));
+        result.Set("reread", Napi::Number::New(env, double(stats.reread)));
+        return result;
+    }
+
+    class SyncTreeWorker : public Napi::AsyncWorker
+    {
+    public:
+        SyncTreeWorker(Napi::Env env, RegKey &&root, const TreeStatePtr &previous, const String &basePath)
+            : Napi::AsyncWorker(env, "RegKeySyncTree")
+            , _deferred(Napi::Promise::Deferred::New(env))
+            , _root(std::move(root))
+            , _previous(previous)
+            , _basePath(basePath)
+            , _stats()
+        {
+        }
+
+        Napi::Value GetPromise() const
+        {
+            return _deferred.Promise();
+        }
+
+        void Execute() override
+        {
+            _state = RegTreeSync::Sync(_root, _previous, _changes, &_stats);
+            if (!_state)
+                SetError("Failed to sync tree.");
+        }
+
+        void OnOK() override
+        {
+            _deferred.Resolve(ConvertSyncResult(Env(), _basePath, _state, _changes, _stats));
+        }
+
+        void OnError(const Napi::Error &error) override
+        {
+            error.Set("lastError", Napi::Number::New(Env(), _root.GetLastStatus()));
+            _deferred.Reject(error.Value());
+        }
+
+    private:
+        Napi::Promise::Deferred _deferred;
+        RegKey _root;
+        TreeStatePtr _previous;
+        String _basePath;
+        TreeStatePtr _state;
+        std::vector<RegTreeChange> _changes;
+        RegTreeSyncStats _stats;
+    };
+}
+
+Napi::Value RegKeyWrap::SyncTree(const Napi::CallbackInfo &info)
+{
+    _Use().FlushWriteBack();
+    std::vector<RegTreeChange> changes;
+    RegTreeSyncStats stats;
+    TreeStatePtr state = RegTreeSync::Sync(_regKey, ParseTreeState(info[0]), changes, &stats);
+    if (!state)
+    {
+        _ThrowRegKeyError(info, "Failed to sync tree.");
+        return info.Env().Null();
+    }
+    return ConvertSyncResult(info.Env(), _path, state, changes, stats);
+}
+
+Napi::Value RegKeyWrap::SyncTreeAsync(const Napi::CallbackInfo &info)
+{
+    // The pass owns its own handle, so closing this key does not cut it short.
+    _Use().FlushWriteBack();
+    RegKey root(_regKey.GetBackend());
+    if (root.Open(_regKey.GetHandle(), STR(""), KEY_READ) == NULL)
+    {
+        _regKey.SetLastStatus(root.GetLastStatus());
+        _ThrowRegKeyError(info, "Failed to open key for sync.");
+        return info.Env().Null();
+    }
+
+    SyncTreeWorker *worker = new SyncTreeWorker(info.Env(), std::move(root), ParseTreeState(info[0]), _path);
+    Napi::Value promise = worker->GetPromise();
+    worker->Queue();
+    return promise;
+}
+
+namespace
+{
+    class SaveTreeCacheWorker : public Napi::AsyncWorker
+    {
+    public:
+        SaveTreeCacheWorker(Napi::Env env, const std::string &file, const String &source, const TreeStatePtr &state)
+            : Napi::AsyncWorker(env, "RegKeySaveTreeCache")
+            , _deferred(Napi::Promise::Deferred::New(env))
+            , _file(file)
+            , _source(source)
+            , _state(state)
+            , _saved(false)
+        {
+        }
+
+        Napi::Value GetPromise() const
+        {
+            return _deferred.Promise();
+        }
+
+        void Execute() override
+        {
+            _saved = RegTreeCache::Save(_file, _source, *_state);
+        }
+
+        void OnOK() override
+        {
+            _deferred.Resolve(Napi::Boolean::New(Env(), _saved));
+        }
+
+    private:
+        Napi::Promise::Deferred _deferred;
+        std::string _file;
+        String _source;
+        TreeStatePtr _state;
+        bool _saved;
+    };
+
+    // A cache is only valid for the backend and path it was saved from.
+    String GetTreeSource(const RegKey &key, const String &path)
+    {
+        const char *backend = key.GetBackend()->GetName();
+        return String(backend, backend + strlen(backend)) + STR(':') + path;
+    }
+}
+
+Napi::Value RegKeyWrap::CachedTree(const Napi::CallbackInfo &info)
+{
+    Napi::Env env = info.Env();
+    if (!info[0].IsString())
+        throw Napi::TypeError::New(env, "Cache file path expected.");
+
+    std::string file = info[0].As<Napi::String>().Utf8Value();
+    String source = GetTreeSource(_regKey, _path);
+    TreeStatePtr cached = RegTreeCache::Load(file, source);
+
+    _Use().FlushWriteBack();
+    std::vector<RegTreeChange> changes;
+    RegTreeSyncStats stats;
+    TreeStatePtr state = RegTreeSync::Sync(_regKey, cached, changes, &stats);
+    if (!state)
+    {
+        _ThrowRegKeyError(info, "Failed to sync tree.");
+        return env.Null();
+    }
+
+    Napi::Object result = ConvertSyncResult(env, _path, state, changes, stats);
+    result.Set("fromCache", Napi::Boolean::New(env, cached != nullptr));
+    if (cached && changes.empty())
+    {
+        // The file already holds this state.
+        Napi::Promise::Deferred deferred = Napi::Promise::Deferred::New(env);
+        deferred.Resolve(Napi::Boolean::New(env, true));
+        result.Set("saved", deferred.Promise());
+    }
+    else
+    {
+        SaveTreeCacheWorker *worker = new SaveTreeCacheWorker(env, file, source, state);
+        result.Set("saved", worker->GetPromise());
+        worker->Queue();
+    }
+    return result;
+}
+
+Napi::Value RegKeyWrap::ReadTreeState(const Napi::CallbackInfo &info)
+{
+    Napi::Env env = info.Env();
+    TreeStatePtr state = ParseTreeState(info[0]);
+    if (!state)
+        throw Napi::TypeError::New(env, "Tree state expected.");
+
+    String path = info[1].IsString() ? ConvertToStdString(info[1].As<Napi::String>()) : String();
+    while (!path.empty() && path.back() == '\\')
+        path.pop_back();
+    auto found = state->keys.find(RegString::Fold(path));
+    if (found == state->keys.end())
+        return env.Null();
+
+    const RegTreeState::Key &key = found->second;
+    RegMarshal &marshal = GetMarshal(env);
+    Napi::Array subKeys = marshal.NewArray(env, key.subKeys, [&](const String &name) { return marshal.NewName(env, name); });
+    Napi::Array values = marshal.NewArray(env, key.values, [&](const RegValue &value) {
+        Napi::Object valueObject = Napi::Object::New(env);
+        marshal.Set(valueObject, RegMarshal::NameProperty, marshal.NewName(env, value.name));
+        marshal.Set(valueObject, RegMarshal::TypeProperty, marshal.TypeName(env, value.type));
+        marshal.Set(valueObject, RegMarshal::ValueProperty, ConvertValueData(env, value));
+        return valueObject;
+    });
+
+    Napi::Object result = Napi::Object::New(env);
+    marshal.Set(result, RegMarshal::PathProperty, ConvertToNapiString(env, key.path));
+    result.Set("lastWriteTime", Napi::Date::New(env, double(key.lastWriteTime / 10000) - 11644473600000.0));
+    result.Set("subKeys", subKeys);
+    result.Set("values", values);
+    return result;
+}
+
+Napi::Value RegKeyWrap::ExportColumnar(const Napi::CallbackInfo &info)
+{
+    Napi::Env env = info.Env();
+    if (!info[0].IsString())
+        throw Napi::TypeError::New(env, "Dump file path expected.");
+
+    Napi::Object options = info[1].IsObject() ? info[1].As<Napi::Object>() : Napi::Object::New(env);
+    uint32_t pageRows = options.Get("pageRows").IsNumber() ? options.Get("pageRows").As<Napi::Number>().Uint32Value() : 4096;
+    RegColumnarWriter writer(GetTreeSource(_regKey, _path), pageRows);
+    if (options.Has("state"))
+    {
+        TreeStatePtr state = ParseTreeState(options.Get("state"));
+        if (!state)
+            throw Napi::TypeError::New(env, "Tree state expected.");
+        writer.AddState(*state);
+    }
+    else
+    {
+        _Use().FlushWriteBack();
+        if (!writer.AddTree(_regKey))
+        {
+            _ThrowRegKeyError(info, "Failed to read tree for export.");
+            return env.Null();
+        }
+    }
+
+    size_t bytes = 0;
+    if (!writer.Write(info[0].As<Napi::String>().Utf8Value(), &bytes))
+    {
+        _regKey.SetLastStatus(ERROR_CANTWRITE);
+        _ThrowRegKeyError(info, "Failed to write columnar dump.");
+        return env.Null();
+    }
+
+    Napi::Object result = Napi::Object::New(env);
+    result.Set("rows", Napi::Number::New(env, double(writer.GetRowCount())));
+    result.Set("bytes", Napi::Number::New(env, double(bytes)));
+    return result;
+}
+
+namespace
+{
+    bool ParseColumn(const std::string &name, RegColumn &column)
+    {
+        const char *names[] = {"path", "name", "type", "data"};
+        for (size_t i = 0; i < RegColumnCount; i++)
+        {
+            if (name == names[i])
+            {
+                column = RegColumn(i);
+                return true;
+            }
+        }
+        return false;
+    }
+
+    Napi::Uint32Array ConvertUint32Array(Napi::Env env, const std::vector<uint32_t> &values)
+    {
+        Napi::Uint32Array array = Napi::Uint32Array::New(env, values.size());
+        if (!values.empty())
+            memcpy(array.Data(), values.data(), values.size() * sizeof(uint32_t));
+        return array;
+    }
+}
+
+Napi::Value RegKeyWrap::ScanColumnar(const Napi::CallbackInfo &info)
+{
+    Napi::Env env = info.Env();
+    if (!info[0].IsArray())
+        throw Napi::TypeError::New(env, "Array of dump files expected.");
+    RegColumn column;
+    if (!info[1].IsString() || !ParseColumn(info[1].As<Napi::String>().Utf8Value(), column))
+        throw Napi::TypeError::New(env, "Column must be 'path', 'name', 'type' or 'data'.");
+
+    Napi::Object options = info[2].IsObject() ? info[2].As<Napi::Object>() : Napi::Object::New(env);
+    uint32_t min = options.Get("min").IsNumber() ? options.Get("min").As<Napi::Number>().Uint32Value() : 0;
+    uint32_t max = options.Get("max").IsNumber() ? options.Get("max").As<Napi::Number>().Uint32Value() : 0xFFFFFFFF;
+    bool hasPrefix = options.Get("prefix").IsString();
+    String prefix = hasPrefix ? ConvertToStdString(options.Get("prefix").As<Napi::String>()) : String();
+    if (hasPrefix && column != RegColumn::Path && column != RegColumn::Name)
+        throw Napi::TypeError::New(env, "Prefixes apply to the path and name columns.");
+    if (options.Get("type").IsString())
+    {
+        if (column != RegColumn::Type)
+            throw Napi::TypeError::New(env, "Types apply to the type column.");
+        min = max = ParseKeyType(ConvertToStdString(options.Get("type").As<Napi::String>()), REG_NONE);
+    }
+
+    Napi::Array files = info[0].As<Napi::Array>();
+    Napi::Array results = Napi::Array::New(env, files.Length());
+    for (uint32_t i = 0; i < files.Length(); i++)
+    {
+        std::string file = files.Get(i).ToString().Utf8Value();
+        Napi::Object result = Napi::Object::New(env);
+        result.Set("file", Napi::String::New(env, file));
+        results.Set(i, result);
+
+        RegColumnarReader reader;
+        if (!reader.Open(file))
+        {
+            result.Set("error", Napi::String::New(env, "Failed to open columnar dump."));
+            continue;
+        }
+        result.Set("source", ConvertToNapiString(env, reader.GetSource()));
+        result.Set("rowCount", Napi::Number::New(env, reader.GetRowCount()));
+
+        // Dictionaries are per dump, so a prefix is a different range of codes in each.
+        RegColumnScan scan;
+        uint32_t first = min, last = max;
+        bool found = !hasPrefix || reader.FindPrefix(column, prefix, &first, &last);
+        if (found && !reader.Scan(column, first, last, scan))
+        {
+            result.Set("error", Napi::String::New(env, "Columnar dump is corrupt."));
+            continue;
+        }
+
+        result.Set("rows", ConvertUint32Array(env, scan.rows));
+        if (column == RegColumn::Data)
+        {
+            result.Set("sizes", ConvertUint32Array(env, scan.values));
+            result.Set("data", Napi::Buffer<BYTE>::Copy(env, scan.data.data(), scan.data.size()));
+        }
+        else if (column == RegColumn::Type)
+            result.Set("types", ConvertUint32Array(env, scan.values));
+        else
+        {
+            const std::vector<String> &dictionary = reader.GetDictionary(column);
+            result.Set("codes", ConvertUint32Array(env, scan.values));
+            result.Set("dictionary", ConvertToNapiValue(env, dictionary));
+        }
+    }
+    return results;
+}
+
+Napi::Value RegKeyWrap::CompileSchema(const Napi::CallbackInfo &info)
+{
+    if (!info[0].IsObject())
+        throw Napi::TypeError::New(info.Env(), "Schema object expected.");
+
+    Napi::Object spec = info[0].As<Napi::Object>();
+    std::unique_ptr<CompiledSchema> compiled(new CompiledSchema());
+    Napi::Array names = spec.GetPropertyNames();
+    for (uint32_t i = 0; i < names.Length(); i++)
+    {
+        Napi::String name = names.Get(i).ToString();
+        if (name.Utf8Value() == "defaults")
+            continue;
+
+        Napi::Value typeName = spec.Get(name);
+        DWORD type = typeName.IsString() ? ParseKeyType(ConvertToStdString(typeName.As<Napi::String>())) : REG_NONE;
+        if (type == REG_NONE)
+            throw Napi::TypeError::New(info.Env(), "Invalid value type for " + name.Utf8Value() + ".");
+        compiled->schema.AddField(ConvertToStdString(name), type);
+        compiled->keys.push_back(Napi::Persistent(name));
+    }
+
+    Napi::Value defaults = spec.Get("defaults");
+    compiled->defaults = Napi::Persistent(defaults.IsObject() ? defaults.As<Napi::Object>() : Napi::Object::New(info.Env()));
+
+    Napi::External<CompiledSchema> external = Napi::External<CompiledSchema>::New(info.Env(), compiled.release(), [](Napi::Env, CompiledSchema *schema) {
+        delete schema;
+    });
+    external.TypeTag(&CompiledSchemaTag);
+    return external;
+}
+
+Napi::Value RegKeyWrap::ReadSchema(const Napi::CallbackInfo &info)
+{
+    if (!info[0].IsExternal() || !info[0].As<Napi::External<CompiledSchema>>().CheckTypeTag(&CompiledSchemaTag))
+        throw Napi::TypeError::New(info.Env(), "Compiled schema expected.");
+
+    Napi::Env env = info.Env();
+    const CompiledSchema &compiled = *info[0].As<Napi::External<CompiledSchema>>().Data();
+    const std::vector<RegSchemaField> &fields = compiled.schema.GetFields();
+    std::vector<RegValue> values;
+    std::vector<LSTATUS> statuses;
+    compiled.schema.Read(_Use(), values, statuses);
+
+    Napi::Object result = Napi::Object::New(env);
+    Napi::Array errors = Napi::Array::New(env);
+    Napi::Object defaults = compiled.defaults.Value();
+    for (size_t i = 0; i < fields.size(); i++)
+    {
+        Napi::String key = compiled.keys[i].Value();
+        LSTATUS status = statuses[i];
+        Napi::Value value;
+        if (status == ERROR_SUCCESS)
+        {
+            DecodeToNapi visitor = {env, values[i].data, true};
+            value = RegVisitCodec(values[i].type, visitor);
+            if (value.IsEmpty())
+                status = ERROR_INVALID_DATA;
+        }
+
+        if (status != ERROR_SUCCESS)
+        {
+            // Missing values simply take their defaults; anything else is reported.
+            if (status != ERROR_FILE_NOT_FOUND)
+            {
+                Napi::Object error = Napi::Object::New(env);
+                error.Set("name", key);
+                error.Set("status", Napi::Number::New(env, status));
+                error.Set("expected", GetMarshal(env).TypeName(env, fields[i].type));
+                if (status != ERROR_DATATYPE_MISMATCH && status != ERROR_INVALID_DATA)
+                    error.Set("type", env.Null());
+                else
+                    error.Set("type", GetMarshal(env).TypeName(env, values[i].type));
+                errors.Set(errors.Length(), error);
+            }
+            if (!defaults.Has(key))
+                continue;
+            value = defaults.Get(key);
+        }
+        result.Set(key, value);
+    }
+
+    Napi::Object read = Napi::Object::New(env);
+    read.Set("values", result);
+    read.Set("errors", errors);
+    return read;
+}
+
+Napi::Value RegKeyWrap::MoveValue(const Napi::CallbackInfo &info)
+{
+    if (!info[0].IsString() || !info[1].IsString())
+        throw Napi::TypeError::New(info.Env(), "Value names expected.");
+
+    String from = ConvertToStdString(info[0].As<Napi::String>());
+    String to = ConvertToStdString(info[1].As<Napi::String>());
+    bool res = _Use().MoveValue(from, to, info[2].ToBoolean().Value());
+    if (!res)
+        _ThrowRegKeyError(info, "Failed to move value.", from);
+    return Napi::Boolean::New(info.Env(), res);
+}
+
+Napi::Value RegKeyWrap::CopyValues(const Napi::CallbackInfo &info)
+{
+    Napi::Env env = info.Env();
+    if (!IsInstance(env, info[0]))
+        throw Napi::TypeError::New(env, "Invalid source key.");
+    RegKeyWrap *pRegKeyWrap = Napi::ObjectWrap<RegKeyWrap>::Unwrap(info[0].As<Napi::Object>());
+
+    RegValueCopyOptions options;
+    if (info[1].IsObject())
+    {
+        Napi::Object optionsObject = info[1].As<Napi::Object>();
+        Napi::Value names = optionsObject.Get("names");
+        Napi::Value filter = optionsObject.Get("filter");
+        Napi::Value overwrite = optionsObject.Get("overwrite");
+        if (names.IsArray())
+        {
+            Napi::Array array = names.As<Napi::Array>();
+            for (uint32_t i = 0; i < array.Length(); i++)
+                options.names.push_back(ConvertToStdString(array.Get(i).ToString()));
+        }
+        if (filter.IsFunction())
+        {
+            Napi::Function callback = filter.As<Napi::Function>();
+            options.filter = [env, callback](const String &name, DWORD type)
+            {
+                return callback.Call({
+                    ConvertToNapiString(env, name),
+                    GetMarshal(env).TypeName(env, type)
+                }).ToBoolean().Value();
+            };
+        }
+        else
+            options.patterns = ConvertToStringArray(filter);
+        if (!overwrite.IsUndefined())
+            options.overwrite = overwrite.ToBoolean().Value();
+    }
+
+    size_t copied = 0;
+    // Reopening either key must not evict the other.
+    RegHandleBudget::Pin sourcePin(pRegKeyWrap), destPin(this);
+    RegKey &source = pRegKeyWrap->_Use();
+    // Values go through a buffer, so the keys may belong to different backends.
+    if (!source.CopyValues(_Use(), options, &copied))
+        _ThrowRegKeyError(info, "Failed to copy values.", pRegKeyWrap->_path);
+    return Napi::Number::New(env, double(copied));
+}
+
+Napi::Value RegKeyWrap::ConfigureHandles(const Napi::CallbackInfo &info)
+{
+    Napi::Env env = info.Env();
+    RegAddonData &addon = _GetAddonData(env);
+    if (info[0].IsObject())
+    {
+        Napi::Object object = info[0].As<Napi::Object>();
+        Napi::Value limit = object.Get("limit");
+        Napi::Value captureStacks = object.Get("captureStacks");
+        if (limit.IsNumber())
+            RegHandleBudget::Shared().SetLimit(limit.As<Napi::Number>().Uint32Value());
+        if (captureStacks.IsBoolean())
+            addon.captureStacks = captureStacks.As<Napi::Boolean>().Value();
+    }
+
+    Napi::Object result = Napi::Object::New(env);
+    result.Set("limit", Napi::Number::New(env, double(RegHandleBudget::Shared().GetLimit())));
+    result.Set("captureStacks", Napi::Boolean::New(env, addon.captureStacks));
+    return result;
+}
+
+Napi::Value RegKeyWrap::HandleReport(const Napi::CallbackInfo &info)
+{
+    Napi::Env env = info.Env();
+    Napi::Array report = Napi::Array::New(env);
+    for (RegKeyWrap *key : _GetAddonData(env).keys)
+    {
+        // Predefined root keys are not handles of their own.
+        if (!key->_evicted && (!key->_regKey.IsValid() || IsPredefinedKey(key->_regKey.GetHandle())))
+            continue;
+
+        Napi::Object entry = Napi::Object::New(env);
+        entry.Set("path", ConvertToNapiString(env, key->_path));
+        entry.Set("backend", Napi::String::New(env, key->_regKey.GetBackend()->GetName()));
+        entry.Set("open", Napi::Boolean::New(env, !key->_evicted));
+        entry.Set("stack", key->_stack.empty() ? env.Null() : Napi::String::New(env, key->_stack));
+        report.Set(report.Length(), entry);
+    }
+    return report;
+}
+
+RegKey &RegKeyWrap::_Use()
+{
+    if (_evicted)
+    {
+        // Evicted keys are always local and below a root key, see _Track.
+        String hostname, baseKeyName, subKeyName;
+        ParsePath(_path, hostname, baseKeyName, subKeyName);
+        _evicted = false;
+        if (_regKey.Open(ParseBaseKey(baseKeyName), subKeyName, _access) != NULL)
+            RegHandleBudget::Shared().Opened(this, true);
+    }
+    else
+        RegHandleBudget::Shared().Touch(this);
+    return _regKey;
+}
+
+void RegKeyWrap::_Track()
+{
+    // Root keys are not handles of their own, and remote keys would have to connect again
+    // to be reopened, so only local subkeys count against the budget.
+    String hostname, baseKeyName, subKeyName;
+    if (_regKey.IsValid() && ParsePath(_path, hostname, baseKeyName, subKeyName) &&
+        hostname.empty() && !subKeyName.empty() && ParseBaseKey(baseKeyName) != NULL)
+        RegHandleBudget::Shared().Opened(this);
+}
+
+bool RegKeyWrap::_Evict()
+{
+    // Buffered writes belong to the handle.
+    if (_regKey.GetWriteBuffer())
+        return false;
+
+    LSTATUS status = _regKey.GetLastStatus();
+    _regKey.Close();
+    _regKey.SetLastStatus(status);
+    _evicted = true;
+    return true;
+}
+
+Napi::Value RegKeyWrap::Transfer(const Napi::CallbackInfo &info)
+{
+    if (!_Use().IsValid())
+    {
+        _regKey.SetLastStatus(ERROR_INVALID_HANDLE);
+        _ThrowRegKeyError(info, "Failed to transfer key.");
+        return info.Env().Null();
+    }
+
+    // The handle moves out of this environment; the key is left closed.
+    _regKey.FlushWriteBack();
+    uint32_t id;
+    {
+        std::lock_guard<std::mutex> lock(transferMutex);
+        id = nextTransferId++;
+        transferredKeys.emplace(id, TransferredKey{ std::move(_regKey), _path, _access });
+    }
+    RegHandleBudget::Shared().Closed(this);
+    return Napi::Number::New(info.Env(), id);
+}
+
+Napi::Value RegKeyWrap::Receive(const Napi::CallbackInfo &info)
+{
+    if (!info[0].IsNumber())
+        throw Napi::TypeError::New(info.Env(), "Transfer token expected.");
+
+    TransferredKey key;
+    {
+        std::lock_guard<std::mutex> lock(transferMutex);
+        auto it = transferredKeys.find(info[0].As<Napi::Number>().Uint32Value());
+        if (it == transferredKeys.end())
+            throw Napi::Error::New(info.Env(), "Unknown or already received transfer token.");
+        key = std::move(it->second);
+        transferredKeys.erase(it);
+    }
+    return NewInstance(info.Env(), std::move(key.regKey), key.path, key.access);
+}
+
+Napi::Value RegKeyWrap::TranslateStatus(const Napi::CallbackInfo &info)
+{
+    if (!info[0].IsNumber())
+        throw Napi::TypeError::New(info.Env(), "Status code expected.");
+    return ConvertToNapiString(info.Env(), TranslateError(info[0].As<Napi::Number>().Int32Value()));
+}
+
+void RegKeyWrap::_ThrowRegKeyError(const Napi::CallbackInfo &info,
+                                   const std::string &message,
+                                   const String &value)
+{
+    // A try* call only reports the failure through lastStatus.
+    if (_quiet)
+    {
+        _failed = true;
+        return;
+    }
+
+    // 从 prototype 获取 __throwRegKeyError__ 函数
+    // It is looked up on the first error of the environment and kept.
+    RegAddonData &addon = _GetAddonData(info.Env());
+    Napi::Object thisObj = info.This().As<Napi::Object>();
+    if (addon.throwRegKeyError.IsEmpty())
+    {
+        Napi::Value regKeyError = thisObj.Get("__throwRegKeyError__");
+        if (!regKeyError.IsFunction())
+            return;
+        addon.throwRegKeyError = Napi::Persistent(regKeyError.As<Napi::Function>());
+    }
+
+    // The message is only formatted if the error's lastError is read, see TranslateStatus.
+    addon.throwRegKeyError.Call({
+        Napi::String::New(info.Env(), message),
+        thisObj,
+        ConvertToNapiString(info.Env(), value),
+        Napi::Number::New(info.Env(), _regKey.GetLastStatus())
+    });
 }
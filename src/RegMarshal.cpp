@@ -0,0 +1,264 @@
+#include "RegMarshal.h"
+#include <algorithm>
+#include <atomic>
+
+#ifndef _WIN32
+#include <dlfcn.h>
+#endif
+
+namespace
+{
+    // Node-API 10 functions, declared here with the ABI they have in every version of the headers.
+    typedef void (*FinalizeExternal)(napi_env env, void *data, void *hint);
+    typedef napi_status (*CreateExternalLatin1)(napi_env env, char *str, size_t length, FinalizeExternal finalize,
+                                                void *hint, napi_value *result, bool *copied);
+    typedef napi_status (*CreateExternalUtf16)(napi_env env, char16_t *str, size_t length, FinalizeExternal finalize,
+                                               void *hint, napi_value *result, bool *copied);
+    typedef napi_status (*CreatePropertyKeyUtf16)(napi_env env, const char16_t *str, size_t length, napi_value *result);
+
+    template <typename Function>
+    Function FindHostFunction(const char *name)
+    {
+#ifdef _WIN32
+        // Addons link Node-API against the host executable (see win_delay_load_hook).
+        return reinterpret_cast<Function>(GetProcAddress(GetModuleHandleW(NULL), name));
+#else
+        return reinterpret_cast<Function>(dlsym(RTLD_DEFAULT, name));
+#endif
+    }
+
+    // Looked up in the running host rather than linked, so a build for Node-API 8 still uses
+    // them wherever the host has them; null where it does not.
+    struct HostFunctions
+    {
+        CreateExternalLatin1 createExternalLatin1;
+        CreateExternalUtf16 createExternalUtf16;
+        CreatePropertyKeyUtf16 createPropertyKeyUtf16;
+
+        HostFunctions()
+            : createExternalLatin1(FindHostFunction<CreateExternalLatin1>("node_api_create_external_string_latin1"))
+            , createExternalUtf16(FindHostFunction<CreateExternalUtf16>("node_api_create_external_string_utf16"))
+            , createPropertyKeyUtf16(FindHostFunction<CreatePropertyKeyUtf16>("node_api_create_property_key_utf16"))
+        {
+        }
+    };
+
+    const HostFunctions &Host()
+    {
+        static const HostFunctions functions;
+        return functions;
+    }
+
+    struct Counters
+    {
+        std::atomic<uint64_t> strings;
+        std::atomic<uint64_t> latin1Strings;
+        std::atomic<uint64_t> externalStrings;
+        std::atomic<uint64_t> namesReused;
+        std::atomic<uint64_t> namesCreated;
+        std::atomic<uint64_t> arrays;
+        std::atomic<uint64_t> arrayCalls;
+    } counters;
+
+    void Count(std::atomic<uint64_t> &counter, uint64_t amount = 1)
+    {
+        counter.fetch_add(amount, std::memory_order_relaxed);
+    }
+
+    const Char *const typeNames[REG_QWORD + 1] = {
+        STR("REG_NONE"),
+        STR("REG_SZ"),
+        STR("REG_EXPAND_SZ"),
+        STR("REG_BINARY"),
+        STR("REG_DWORD"),
+        STR("REG_DWORD_BIG_ENDIAN"),
+        nullptr,
+        STR("REG_MULTI_SZ"),
+        STR("REG_RESOURCE_LIST"),
+        STR("REG_FULL_RESOURCE_DESCRIPTOR"),
+        STR("REG_RESOURCE_REQUIREMENTS_LIST"),
+        STR("REG_QWORD"),
+    };
+
+    const Char *const propertyNames[RegMarshal::PropertyCount] = {
+        STR("path"),
+        STR("name"),
+        STR("type"),
+        STR("value"),
+        STR("data"),
+        STR("status"),
+    };
+
+    bool IsLatin1(const Char *str, size_t length)
+    {
+        // Or-ing the whole string keeps the loop branch-free, so it vectorizes.
+        Char bits = 0;
+        for (size_t i = 0; i < length; i++)
+            bits |= str[i];
+        return bits < 0x100;
+    }
+
+    void Narrow(const Char *str, size_t length, char *narrow)
+    {
+        for (size_t i = 0; i < length; i++)
+            narrow[i] = char(str[i]);
+    }
+
+    template <typename T>
+    void FreeExternal(napi_env, void *data, void *)
+    {
+        delete[] static_cast<T *>(data);
+    }
+}
+
+Napi::String RegMarshal::NewString(Napi::Env env, const Char *str, size_t length)
+{
+    bool latin1 = IsLatin1(str, length);
+    Count(counters.strings);
+    if (latin1)
+        Count(counters.latin1Strings);
+
+    napi_value result;
+    napi_status status;
+    if (length >= ExternalThreshold && HasExternalStrings())
+    {
+        // The engine takes ownership of the buffer; when it copies instead, it frees it at once.
+        bool copied = false;
+        if (latin1)
+        {
+            char *buffer = new char[length];
+            Narrow(str, length, buffer);
+            status = Host().createExternalLatin1(env, buffer, length, FreeExternal<char>, nullptr, &result, &copied);
+        }
+        else
+        {
+            char16_t *buffer = new char16_t[length];
+            std::copy(str, str + length, buffer);
+            status = Host().createExternalUtf16(env, buffer, length, FreeExternal<char16_t>, nullptr, &result, &copied);
+        }
+        NAPI_THROW_IF_FAILED(env, status, Napi::String());
+        if (!copied)
+            Count(counters.externalStrings);
+        return Napi::String(env, result);
+    }
+
+    if (latin1)
+    {
+        char stackBuffer[256];
+        std::vector<char> heapBuffer;
+        char *buffer = stackBuffer;
+        if (length > sizeof(stackBuffer))
+        {
+            heapBuffer.resize(length);
+            buffer = heapBuffer.data();
+        }
+        Narrow(str, length, buffer);
+        status = napi_create_string_latin1(env, buffer, length, &result);
+    }
+    else
+        status = napi_create_string_utf16(env, reinterpret_cast<const char16_t *>(str), length, &result);
+    NAPI_THROW_IF_FAILED(env, status, Napi::String());
+    return Napi::String(env, result);
+}
+
+Napi::String RegMarshal::_NewKey(Napi::Env env, const Char *str, size_t length)
+{
+    if (!HasPropertyKeys())
+        return NewString(env, str, length);
+    napi_value result;
+    napi_status status = Host().createPropertyKeyUtf16(env, reinterpret_cast<const char16_t *>(str), length, &result);
+    NAPI_THROW_IF_FAILED(env, status, Napi::String());
+    return Napi::String(env, result);
+}
+
+Napi::String RegMarshal::NewName(Napi::Env env, const String &name)
+{
+    if (name.size() > MaxNameLength)
+        return NewString(env, name);
+
+    auto it = _names.find(name);
+    if (it != _names.end())
+    {
+        Count(counters.namesReused);
+        return it->second.Value();
+    }
+
+    if (_names.size() >= MaxNames)
+        _names.clear();
+    Count(counters.namesCreated);
+    Napi::String key = _NewKey(env, name.c_str(), name.size());
+    _names.emplace(name, Napi::Persistent(key));
+    return key;
+}
+
+Napi::String RegMarshal::TypeName(Napi::Env env, DWORD type)
+{
+    Napi::Reference<Napi::String> &cached = type <= REG_QWORD && typeNames[type] ? _typeNames[type] : _unknownType;
+    if (cached.IsEmpty())
+    {
+        const Char *name = type <= REG_QWORD && typeNames[type] ? typeNames[type] : STR("");
+        cached = Napi::Persistent(_NewKey(env, name, STRLEN(name)));
+    }
+    return cached.Value();
+}
+
+void RegMarshal::Set(Napi::Object &object, Property property, napi_value value)
+{
+    Napi::Reference<Napi::String> &cached = _properties[property];
+    if (cached.IsEmpty())
+    {
+        const Char *name = propertyNames[property];
+        cached = Napi::Persistent(_NewKey(object.Env(), name, STRLEN(name)));
+    }
+    object.Set(cached.Value(), value);
+}
+
+Napi::Array RegMarshal::NewArray(Napi::Env env, const std::vector<napi_value> &elements)
+{
+    Napi::Array result = _NewArray(env, elements.size());
+    for (size_t i = 0; i < elements.size(); i++)
+        result.Set(uint32_t(i), elements[i]);
+    return result;
+}
+
+Napi::Array RegMarshal::_NewArray(Napi::Env env, size_t length)
+{
+    Count(counters.arrays);
+    // One call to create the array and one per element.
+    Count(counters.arrayCalls, 1 + length);
+    return Napi::Array::New(env, length);
+}
+
+RegMarshalStats RegMarshal::GetStats()
+{
+    RegMarshalStats stats;
+    stats.strings = counters.strings.load(std::memory_order_relaxed);
+    stats.latin1Strings = counters.latin1Strings.load(std::memory_order_relaxed);
+    stats.externalStrings = counters.externalStrings.load(std::memory_order_relaxed);
+    stats.namesReused = counters.namesReused.load(std::memory_order_relaxed);
+    stats.namesCreated = counters.namesCreated.load(std::memory_order_relaxed);
+    stats.arrays = counters.arrays.load(std::memory_order_relaxed);
+    stats.arrayCalls = counters.arrayCalls.load(std::memory_order_relaxed);
+    return stats;
+}
+
+void RegMarshal::ResetStats()
+{
+    counters.strings = 0;
+    counters.latin1Strings = 0;
+    counters.externalStrings = 0;
+    counters.namesReused = 0;
+    counters.namesCreated = 0;
+    counters.arrays = 0;
+    counters.arrayCalls = 0;
+}
+
+bool RegMarshal::HasExternalStrings()
+{
+    return Host().createExternalLatin1 != nullptr && Host().createExternalUtf16 != nullptr;
+}
+
+bool RegMarshal::HasPropertyKeys()
+{
+    return Host().createPropertyKeyUtf16 != nullptr;
+}
@@ -0,0 +1,682 @@
+#include "RegQuery.h"
+#include "RegCodec.h"
+#include "RegString.h"
+#include <algorithm>
+
+namespace
+{
+    const struct
+    {
+        const Char *name;
+        DWORD type;
+    } typeNames[] = {
+        {STR("REG_NONE"), REG_NONE},
+        {STR("REG_SZ"), REG_SZ},
+        {STR("REG_EXPAND_SZ"), REG_EXPAND_SZ},
+        {STR("REG_BINARY"), REG_BINARY},
+        {STR("REG_DWORD"), REG_DWORD},
+        {STR("REG_DWORD_BIG_ENDIAN"), REG_DWORD_BIG_ENDIAN},
+        {STR("REG_MULTI_SZ"), REG_MULTI_SZ},
+        {STR("REG_RESOURCE_LIST"), REG_RESOURCE_LIST},
+        {STR("REG_FULL_RESOURCE_DESCRIPTOR"), REG_FULL_RESOURCE_DESCRIPTOR},
+        {STR("REG_RESOURCE_REQUIREMENTS_LIST"), REG_RESOURCE_REQUIREMENTS_LIST},
+        {STR("REG_QWORD"), REG_QWORD},
+    };
+
+    // The steps of a plan are states of a 16-bit state machine.
+    const size_t MaxSteps = 1024;
+
+    // Accepts REG_SZ as well as SZ, ignoring case.
+    bool ParseTypeName(const String &name, DWORD *type)
+    {
+        for (size_t i = 0; i < sizeof(typeNames) / sizeof(typeNames[0]); i++)
+        {
+            const Char *full = typeNames[i].name;
+            size_t length = STRLEN(full);
+            if (RegString::EqualsFold(name.c_str(), name.size(), full, length) ||
+                RegString::EqualsFold(name.c_str(), name.size(), full + 4, length - 4))
+            {
+                *type = typeNames[i].type;
+                return true;
+            }
+        }
+        return false;
+    }
+
+    String FormatNumber(QWORD number)
+    {
+        Char digits[24];
+        size_t length = 0;
+        do
+        {
+            digits[length++] = Char('0' + number % 10);
+            number /= 10;
+        } while (number > 0);
+        std::reverse(digits, digits + length);
+        return String(digits, length);
+    }
+
+    bool IsSpace(Char c)
+    {
+        return c == ' ' || c == '\t';
+    }
+
+    bool IsSeparator(Char c)
+    {
+        return c == '/' || c == '\\';
+    }
+
+    bool IsOperator(Char c)
+    {
+        return c == '=' || c == '!' || c == '~' || c == '<' || c == '>';
+    }
+
+    class QueryParser
+    {
+    public:
+        QueryParser(const String &text)
+            : _text(text)
+            , _position(0)
+            , _defaultValue(false)
+        {
+        }
+
+        bool Parse(RegQueryPlan &plan)
+        {
+            if (_Peek() == '\\' && _position + 1 < _text.size() && _text[_position + 1] == '\\')
+                return _Fail("Remote queries are not supported.");
+            if (IsSeparator(_Peek()))
+                _position++;
+
+            bool quoted;
+            if (!_ReadName(plan.baseKey, &quoted, false))
+                return false;
+            if (plan.baseKey.empty() || quoted)
+                return _Fail("Base key expected.");
+            if (!_AtEnd() && !IsSeparator(_Peek()))
+                return _Fail("Base keys take no type or predicates.");
+
+            std::vector<RegQueryStep> steps;
+            while (!_AtEnd())
+            {
+                _position++;
+                RegQueryStep step;
+                if (!_ReadStep(step))
+                    return false;
+                // Empty steps ("a//b" or a trailing separator) are skipped, as in key paths.
+                if (step.kind != RegQueryStepKind::Literal || !step.name.empty() || step.typed ||
+                    !step.predicates.empty() || _defaultValue)
+                    steps.push_back(std::move(step));
+                if (steps.size() > MaxSteps)
+                    return _Fail("Too many steps.");
+            }
+
+            // Leading plain names are a fixed path: open it once rather than step through it.
+            size_t fixed = 0;
+            while (fixed + 1 < steps.size() && steps[fixed].kind == RegQueryStepKind::Literal &&
+                   !steps[fixed].name.empty() && !steps[fixed].typed && steps[fixed].predicates.empty())
+            {
+                if (!plan.root.empty())
+                    plan.root += STR('\\');
+                plan.root += steps[fixed].name;
+                fixed++;
+            }
+            plan.steps.assign(std::make_move_iterator(steps.begin() + fixed), std::make_move_iterator(steps.end()));
+            return true;
+        }
+
+        const std::string &GetError() const
+        {
+            return _error;
+        }
+
+        size_t GetPosition() const
+        {
+            return _position;
+        }
+
+    private:
+        bool _AtEnd() const
+        {
+            return _position >= _text.size();
+        }
+
+        Char _Peek() const
+        {
+            return _AtEnd() ? Char(0) : _text[_position];
+        }
+
+        void _SkipSpaces()
+        {
+            while (!_AtEnd() && IsSpace(_text[_position]))
+                _position++;
+        }
+
+        bool _Fail(const char *message)
+        {
+            _error = message;
+            return false;
+        }
+
+        bool _ReadQuoted(String &text)
+        {
+            size_t start = _position++;
+            while (!_AtEnd() && _text[_position] != '"')
+            {
+                if (_text[_position] == '\\' && _position + 1 < _text.size())
+                    _position++;
+                text += _text[_position++];
+            }
+            if (_AtEnd())
+            {
+                _position = start;
+                return _Fail("Unterminated string.");
+            }
+            _position++;
+            return true;
+        }
+
+        // Names of steps end at a separator, a type or a predicate; names in predicates end at
+        // an operator or the closing bracket and lose their surrounding spaces.
+        bool _ReadName(String &name, bool *quoted, bool inPredicate)
+        {
+            name.clear();
+            *quoted = false;
+            if (inPredicate)
+                _SkipSpaces();
+            if (_Peek() == '"')
+            {
+                *quoted = true;
+                if (!_ReadQuoted(name))
+                    return false;
+                if (inPredicate)
+                    _SkipSpaces();
+                return true;
+            }
+
+            while (!_AtEnd())
+            {
+                Char c = _text[_position];
+                if (c == ':' || (!inPredicate && (c == '[' || IsSeparator(c))) || (inPredicate && (c == ']' || IsOperator(c))))
+                    break;
+                if (c == '"' || c == '[' || c == ']')
+                    return _Fail("Unexpected character.");
+                name += c;
+                _position++;
+            }
+            if (inPredicate)
+            {
+                while (!name.empty() && IsSpace(name.back()))
+                    name.pop_back();
+            }
+            return true;
+        }
+
+        bool _ReadType(bool *typed, DWORD *type)
+        {
+            *typed = false;
+            if (_Peek() != ':')
+                return true;
+            _position++;
+            _SkipSpaces();
+            size_t start = _position;
+            String name;
+            while (!_AtEnd())
+            {
+                Char c = _text[_position];
+                if (!((c >= 'A' && c <= 'Z') || (c >= 'a' && c <= 'z') || c == '_'))
+                    break;
+                name += c;
+                _position++;
+            }
+            if (!ParseTypeName(name, type))
+            {
+                _position = start;
+                return _Fail("Unknown value type.");
+            }
+            *typed = true;
+            _SkipSpaces();
+            return true;
+        }
+
+        bool _ReadLiteral(RegQueryPredicate &predicate)
+        {
+            _SkipSpaces();
+            if (_Peek() == '"')
+                return _ReadQuoted(predicate.text);
+
+            size_t start = _position;
+            int base = 10;
+            if (_Peek() == '0' && _position + 1 < _text.size() && (_text[_position + 1] == 'x' || _text[_position + 1] == 'X'))
+            {
+                base = 16;
+                _position += 2;
+            }
+            QWORD number = 0;
+            size_t digits = 0;
+            while (!_AtEnd())
+            {
+                Char c = _text[_position];
+                int digit = c >= '0' && c <= '9' ? c - '0'
+                          : base == 16 && c >= 'a' && c <= 'f' ? c - 'a' + 10
+                          : base == 16 && c >= 'A' && c <= 'F' ? c - 'A' + 10
+                          : -1;
+                if (digit < 0)
+                    break;
+                if (number > (~QWORD(0) - QWORD(digit)) / QWORD(base))
+                {
+                    _position = start;
+                    return _Fail("Number out of range.");
+                }
+                number = number * base + digit;
+                digits++;
+                _position++;
+            }
+            if (digits == 0)
+            {
+                _position = start;
+                return _Fail("Quoted string or number expected.");
+            }
+            predicate.numeric = true;
+            predicate.number = number;
+            predicate.text = FormatNumber(number);
+            return true;
+        }
+
+        bool _ReadPredicate(RegQueryPredicate &predicate)
+        {
+            bool quoted;
+            if (!_ReadName(predicate.valueName, &quoted, true))
+                return false;
+            if (predicate.valueName.empty() && !quoted)
+                return _Fail("Value name expected.");
+            if (!quoted && predicate.valueName == STR("@"))
+                predicate.valueName.clear();
+            if (!_ReadType(&predicate.typed, &predicate.type))
+                return false;
+
+            predicate.op = RegQueryOp::Exists;
+            predicate.numeric = false;
+            predicate.number = 0;
+            size_t start = _position;
+            Char c = _Peek();
+            Char next = _position + 1 < _text.size() ? _text[_position + 1] : Char(0);
+            if (c == '=')
+                predicate.op = RegQueryOp::Equal;
+            else if (c == '~')
+                predicate.op = RegQueryOp::Match;
+            else if (c == '!' && next == '=')
+                predicate.op = RegQueryOp::NotEqual;
+            else if (c == '<')
+                predicate.op = next == '=' ? RegQueryOp::LessEqual : RegQueryOp::Less;
+            else if (c == '>')
+                predicate.op = next == '=' ? RegQueryOp::GreaterEqual : RegQueryOp::Greater;
+            else if (c != ']')
+                return _Fail("Operator expected.");
+
+            if (predicate.op != RegQueryOp::Exists)
+            {
+                _position += next == '=' && c != '=' && c != '~' ? 2 : 1;
+                if (!_ReadLiteral(predicate))
+                    return false;
+                if (predicate.op == RegQueryOp::Match && predicate.numeric)
+                {
+                    _position = start;
+                    return _Fail("Patterns must be quoted strings.");
+                }
+                _SkipSpaces();
+            }
+            if (_Peek() != ']')
+                return _Fail("']' expected.");
+            _position++;
+            return true;
+        }
+
+        bool _ReadStep(RegQueryStep &step)
+        {
+            size_t start = _position;
+            bool quoted;
+            if (!_ReadName(step.name, &quoted, false))
+                return false;
+            if (!quoted && step.name == STR("**"))
+                step.kind = RegQueryStepKind::Recursive;
+            else if (!quoted && step.name.find_first_of(STR("*?")) != String::npos)
+                step.kind = RegQueryStepKind::Pattern;
+            else
+                step.kind = RegQueryStepKind::Literal;
+            // @ and "" name the default value; no key can have an empty name.
+            _defaultValue = quoted ? step.name.empty() : step.name == STR("@");
+            if (_defaultValue)
+                step.name.clear();
+
+            if (!_ReadType(&step.typed, &step.type))
+                return false;
+            while (_Peek() == '[')
+            {
+                _position++;
+                RegQueryPredicate predicate;
+                if (!_ReadPredicate(predicate))
+                    return false;
+                step.predicates.push_back(std::move(predicate));
+            }
+            if (step.kind == RegQueryStepKind::Recursive && (step.typed || !step.predicates.empty()))
+            {
+                _position = start;
+                return _Fail("'**' takes no type or predicates.");
+            }
+            if (step.typed && !step.predicates.empty())
+            {
+                _position = start;
+                return _Fail("A step selects values with a type or keys with predicates, not both.");
+            }
+            if (!_AtEnd() && !IsSeparator(_Peek()))
+                return _Fail("Separator expected.");
+            return true;
+        }
+
+        const String &_text;
+        size_t _position;
+        std::string _error;
+        bool _defaultValue;
+    };
+
+    bool DecodeNumber(const RegValue &value, QWORD *number)
+    {
+        DWORD dword;
+        switch (value.type)
+        {
+        case REG_DWORD:
+            if (!RegCodec<REG_DWORD>::Decode(value.data.data(), value.data.size(), dword))
+                return false;
+            *number = dword;
+            return true;
+        case REG_DWORD_BIG_ENDIAN:
+            if (!RegCodec<REG_DWORD_BIG_ENDIAN>::Decode(value.data.data(), value.data.size(), dword))
+                return false;
+            *number = dword;
+            return true;
+        case REG_QWORD:
+            return RegCodec<REG_QWORD>::Decode(value.data.data(), value.data.size(), *number);
+        default:
+            return false;
+        }
+    }
+
+    bool CompareText(const String &text, const RegQueryPredicate &predicate)
+    {
+        const String &literal = predicate.text;
+        int order;
+        switch (predicate.op)
+        {
+        case RegQueryOp::Equal:
+            return RegString::EqualsFold(text, literal);
+        case RegQueryOp::NotEqual:
+            return !RegString::EqualsFold(text, literal);
+        case RegQueryOp::Match:
+            return RegString::MatchPattern(literal, text);
+        default:
+            order = RegString::CompareFold(text.c_str(), text.size(), literal.c_str(), literal.size());
+            break;
+        }
+        switch (predicate.op)
+        {
+        case RegQueryOp::Less:
+            return order < 0;
+        case RegQueryOp::LessEqual:
+            return order <= 0;
+        case RegQueryOp::Greater:
+            return order > 0;
+        default:
+            return order >= 0;
+        }
+    }
+
+    bool CompareNumber(QWORD number, const RegQueryPredicate &predicate)
+    {
+        if (!predicate.numeric || predicate.op == RegQueryOp::Match)
+            return CompareText(FormatNumber(number), predicate);
+        switch (predicate.op)
+        {
+        case RegQueryOp::Equal:
+            return number == predicate.number;
+        case RegQueryOp::NotEqual:
+            return number != predicate.number;
+        case RegQueryOp::Less:
+            return number < predicate.number;
+        case RegQueryOp::LessEqual:
+            return number <= predicate.number;
+        case RegQueryOp::Greater:
+            return number > predicate.number;
+        default:
+            return number >= predicate.number;
+        }
+    }
+}
+
+bool RegQuery::Compile(const String &expression, RegQueryPlan &plan, std::string &error, size_t *position)
+{
+    plan = RegQueryPlan();
+    QueryParser parser(expression);
+    if (parser.Parse(plan))
+        return true;
+    error = parser.GetError();
+    *position = parser.GetPosition();
+    return false;
+}
+
+std::shared_ptr<RegQuery> RegQuery::Create(RegKey &&root,
+                                           const RegQueryPlan &plan,
+                                           MatchCallback onMatches,
+                                           DoneCallback onDone)
+{
+    return std::shared_ptr<RegQuery>(new RegQuery(std::move(root), plan, std::move(onMatches), std::move(onDone)));
+}
+
+RegQuery::RegQuery(RegKey &&root, const RegQueryPlan &plan, MatchCallback onMatches, DoneCallback onDone)
+    : _root(std::move(root))
+    , _plan(plan)
+    , _onMatches(std::move(onMatches))
+    , _onDone(std::move(onDone))
+{
+}
+
+void RegQuery::Start()
+{
+    // Running tasks hold a reference, so `this` outlives the last one finishing.
+    _group.OnDone([this](LSTATUS status) {
+        _onDone(status);
+    });
+    std::shared_ptr<RegQuery> self = shared_from_this();
+    _group.Run([self]() {
+        // The root is where the first step starts, as if a parent had matched it by name.
+        self->_Visit(STR(""), {Transition{0, true}});
+    });
+}
+
+void RegQuery::_Close(std::vector<uint16_t> &states) const
+{
+    // A '**' may match no level at all, so a key at it is also at the step after it.
+    for (size_t i = 0; i < states.size(); i++)
+    {
+        uint16_t state = states[i];
+        if (state < _plan.steps.size() && _plan.steps[state].kind == RegQueryStepKind::Recursive &&
+            std::find(states.begin(), states.end(), uint16_t(state + 1)) == states.end())
+            states.push_back(uint16_t(state + 1));
+    }
+    std::sort(states.begin(), states.end());
+    states.erase(std::unique(states.begin(), states.end()), states.end());
+}
+
+bool RegQuery::_MatchName(const RegQueryStep &step, const String &name) const
+{
+    if (step.kind == RegQueryStepKind::Pattern)
+        return RegString::MatchPattern(step.name, name);
+    return RegString::EqualsFold(step.name, name);
+}
+
+bool RegQuery::_Test(RegKey &key, const RegQueryPredicate &predicate) const
+{
+    // Presence and type come from the value type alone, without reading the data.
+    if (predicate.op == RegQueryOp::Exists)
+    {
+        DWORD type = key.GetValueType(predicate.valueName);
+        return key.GetLastStatus() == ERROR_SUCCESS && (!predicate.typed || type == predicate.type);
+    }
+
+    bool success;
+    RegValue value = key.GetValue(predicate.valueName, &success);
+    if (!success || (predicate.typed && value.type != predicate.type))
+        return false;
+
+    QWORD number;
+    if (DecodeNumber(value, &number))
+        return CompareNumber(number, predicate);
+    if (value.type == REG_SZ || value.type == REG_EXPAND_SZ)
+    {
+        String text;
+        return RegCodec<REG_SZ>::Decode(value.data.data(), value.data.size(), text) && CompareText(text, predicate);
+    }
+    if (value.type == REG_MULTI_SZ)
+    {
+        // Holds when any of the strings does, except != which holds when none is equal.
+        std::vector<String> texts;
+        if (!RegCodec<REG_MULTI_SZ>::Decode(value.data.data(), value.data.size(), texts))
+            return false;
+        if (predicate.op == RegQueryOp::NotEqual)
+        {
+            return std::none_of(texts.begin(), texts.end(), [&predicate](const String &text) {
+                return RegString::EqualsFold(text, predicate.text);
+            });
+        }
+        return std::any_of(texts.begin(), texts.end(), [&predicate](const String &text) {
+            return CompareText(text, predicate);
+        });
+    }
+    return false;
+}
+
+void RegQuery::_MatchValues(RegKey &key, const String &path, const RegQueryStep &step,
+                            std::vector<RegQueryMatch> &matches)
+{
+    std::vector<String> names;
+    if (step.kind == RegQueryStepKind::Literal)
+        names.push_back(step.name);
+    else
+    {
+        names = key.GetValueNames();
+        names.erase(std::remove_if(names.begin(), names.end(), [&](const String &name) {
+            return !RegString::MatchPattern(step.name, name);
+        }), names.end());
+    }
+
+    for (auto it = names.begin(); it != names.end() && !IsCancelled(); it++)
+    {
+        bool success;
+        RegValue value = key.GetValue(*it, &success);
+        if (success && (!step.typed || value.type == step.type))
+            matches.push_back({path, true, std::move(value.name), value.type, std::move(value.data)});
+    }
+}
+
+void RegQuery::_Visit(const String &path, const std::vector<Transition> &transitions)
+{
+    // The root handle is shared by all tasks and only borrowed here.
+    RegKey key(_root.GetBackend());
+    if (path.empty())
+        key.Attach(_root.GetHandle());
+    else if (key.Open(_root.GetHandle(), path, KEY_READ) == NULL)
+        return;
+
+    // Predicates are checked here, where the key is open anyway, rather than by the parent.
+    std::vector<uint16_t> states;
+    for (auto it = transitions.begin(); it != transitions.end() && !IsCancelled(); it++)
+    {
+        if (it->recursive)
+        {
+            states.push_back(it->step);
+            continue;
+        }
+        const std::vector<RegQueryPredicate> &predicates = _plan.steps[it->step].predicates;
+        bool holds = true;
+        for (auto predicate = predicates.begin(); predicate != predicates.end() && holds; predicate++)
+            holds = _Test(key, *predicate);
+        if (holds)
+            states.push_back(uint16_t(it->step + 1));
+    }
+    _Close(states);
+
+    std::vector<RegQueryMatch> matches;
+    size_t stepCount = _plan.steps.size();
+    if (!states.empty() && states.back() == stepCount)
+        matches.push_back({path, false, String(), REG_NONE, ByteArray()});
+    if (stepCount > 0 && std::binary_search(states.begin(), states.end(), uint16_t(stepCount - 1)))
+    {
+        const RegQueryStep &last = _plan.steps[stepCount - 1];
+        if (last.kind != RegQueryStepKind::Recursive && last.predicates.empty())
+            _MatchValues(key, path, last, matches);
+    }
+
+    // Steps matching subkeys; typed steps only match values.
+    bool enumerate = false;
+    std::vector<uint16_t> consuming;
+    for (auto it = states.begin(); it != states.end(); it++)
+    {
+        if (*it >= stepCount || _plan.steps[*it].typed)
+            continue;
+        const RegQueryStep &step = _plan.steps[*it];
+        if (step.kind == RegQueryStepKind::Literal && step.name.empty())
+            continue;
+        consuming.push_back(*it);
+        enumerate = enumerate || step.kind != RegQueryStepKind::Literal;
+    }
+
+    std::vector<std::pair<String, std::vector<Transition>>> children;
+    if (enumerate)
+    {
+        std::vector<String> subKeys = key.GetSubKeyNames();
+        for (auto it = subKeys.begin(); it != subKeys.end() && !IsCancelled(); it++)
+        {
+            std::vector<Transition> next;
+            for (auto state = consuming.begin(); state != consuming.end(); state++)
+            {
+                const RegQueryStep &step = _plan.steps[*state];
+                if (step.kind == RegQueryStepKind::Recursive)
+                    next.push_back(Transition{*state, true});
+                else if (_MatchName(step, *it))
+                    next.push_back(Transition{*state, false});
+            }
+            if (!next.empty())
+                children.emplace_back(*it, std::move(next));
+        }
+    }
+    else
+    {
+        // Only exact names are left: open them directly instead of listing the subkeys.
+        for (auto state = consuming.begin(); state != consuming.end(); state++)
+        {
+            const String &name = _plan.steps[*state].name;
+            auto child = std::find_if(children.begin(), children.end(), [&name](const std::pair<String, std::vector<Transition>> &entry) {
+                return RegString::EqualsFold(entry.first, name);
+            });
+            if (child == children.end())
+                children.emplace_back(name, std::vector<Transition>{Transition{*state, false}});
+            else
+                child->second.push_back(Transition{*state, false});
+        }
+    }
+
+    std::shared_ptr<RegQuery> self = shared_from_this();
+    for (auto it = children.begin(); it != children.end() && !IsCancelled(); it++)
+    {
+        String subPath = path.empty() ? it->first : path + STR('\\') + it->first;
+        std::vector<Transition> next = std::move(it->second);
+        _group.Run([self, subPath, next]() {
+            self->_Visit(subPath, next);
+        });
+    }
+
+    if (path.empty())
+        key.Detach();
+    if (!matches.empty() && !IsCancelled())
+        _onMatches(std::move(matches));
+}
@@ -0,0 +1,1016 @@
+#include "RegRecorder.h"
+#include "RegFile.h"
+#include "RegString.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+
+namespace
+{
+    const BYTE Magic[4] = {'R', 'K', 'R', 'C'};
+    const BYTE Version = 1;
+    const size_t HeaderSize = 8;
+    const BYTE StringRecord = 0xFF;
+    const size_t FlushSize = 64 * 1024;
+    // Longest key name plus the terminator, and the longest value name.
+    const DWORD MaxKeyNameLength = 256;
+    const DWORD MaxValueNameLength = 16384;
+    // Largest value data a replay allocates; sizes past it only come from damaged recordings.
+    const DWORD MaxValueSize = 64 * 1024 * 1024;
+
+    static_assert(sizeof(Char) == 2, "Names are stored as UTF-16 code units.");
+
+    // Base keys are the sign-extended values 0x80000000 to 0x8000FFFF.
+    bool IsBaseKey(HKEY hKey)
+    {
+        intptr_t value = intptr_t(uintptr_t(hKey));
+        return value == intptr_t(int32_t(uint32_t(value))) && (uint32_t(value) & 0xFFFF0000u) == 0x80000000u;
+    }
+
+    HKEY MakeBaseKey(uint32_t low)
+    {
+        return (HKEY)(uintptr_t)(intptr_t)(int32_t)(0x80000000u | low);
+    }
+
+    void AppendVarint(ByteArray &out, uint64_t value)
+    {
+        while (value >= 0x80)
+        {
+            out.push_back(BYTE(value | 0x80));
+            value >>= 7;
+        }
+        out.push_back(BYTE(value));
+    }
+
+    uint64_t ZigZag(int64_t value)
+    {
+        return (uint64_t(value) << 1) ^ uint64_t(value >> 63);
+    }
+
+    int64_t UnZigZag(uint64_t value)
+    {
+        return int64_t(value >> 1) ^ -int64_t(value & 1);
+    }
+
+    struct RecordedCall
+    {
+        RegTraceOp op;
+        uint64_t begin;
+        uint64_t end;
+        LSTATUS status;
+        HKEY key;
+        const Char *name;
+        const Char *name2;
+        HKEY result;
+        HKEY dest;
+        REGSAM access;
+        DWORD index;
+        DWORD type;
+        DWORD size;
+        DWORD capacity;
+
+        RecordedCall(RegTraceOp op, HKEY key)
+            : op(op)
+            , begin(RegTrace::Now())
+            , end(0)
+            , status(ERROR_SUCCESS)
+            , key(key)
+            , name(nullptr)
+            , name2(nullptr)
+            , result(NULL)
+            , dest(NULL)
+            , access(0)
+            , index(0)
+            , type(0)
+            , size(0)
+            , capacity(0)
+        {
+        }
+    };
+
+    class RecordingSession
+    {
+    public:
+        RecordingSession(FILE *fp)
+            : _fp(fp)
+            , _lastBegin(RegTrace::Now())
+            , _nextHandle(0)
+            , _calls(0)
+            , _bytes(0)
+            , _failed(false)
+        {
+            _buffer.insert(_buffer.end(), Magic, Magic + sizeof(Magic));
+            _buffer.push_back(Version);
+            _buffer.resize(HeaderSize, 0);
+        }
+
+        void Record(RecordedCall &call)
+        {
+            call.end = RegTrace::Now();
+            std::lock_guard<std::mutex> lock(_mutex);
+            if (_fp == NULL)
+                return;
+
+            // Strings are defined before the record using them.
+            uint32_t name = _String(call.name);
+            uint32_t name2 = _String(call.name2);
+            _buffer.push_back(BYTE(call.op));
+            AppendVarint(_buffer, ZigZag(int64_t(call.begin - _lastBegin)));
+            AppendVarint(_buffer, call.end - call.begin);
+            AppendVarint(_buffer, uint32_t(call.status));
+            AppendVarint(_buffer, _Key(call.key));
+            _lastBegin = call.begin;
+
+            switch (call.op)
+            {
+            case RegTraceOp::OpenKey:
+            case RegTraceOp::CreateKey:
+                AppendVarint(_buffer, name);
+                AppendVarint(_buffer, call.access);
+                AppendVarint(_buffer, _Opened(call.result));
+                break;
+            case RegTraceOp::ConnectRegistry:
+                AppendVarint(_buffer, name);
+                AppendVarint(_buffer, _Opened(call.result));
+                break;
+            case RegTraceOp::CloseKey:
+                _handles.erase(call.key);
+                break;
+            case RegTraceOp::CopyTree:
+                AppendVarint(_buffer, name);
+                AppendVarint(_buffer, _Key(call.dest));
+                break;
+            case RegTraceOp::RenameKey:
+                AppendVarint(_buffer, name);
+                AppendVarint(_buffer, name2);
+                break;
+            case RegTraceOp::DeleteTree:
+            case RegTraceOp::DeleteKey:
+            case RegTraceOp::DeleteValue:
+                AppendVarint(_buffer, name);
+                break;
+            case RegTraceOp::EnumKey:
+                AppendVarint(_buffer, call.index);
+                AppendVarint(_buffer, name);
+                break;
+            case RegTraceOp::EnumValue:
+                AppendVarint(_buffer, call.index);
+                AppendVarint(_buffer, name);
+                AppendVarint(_buffer, call.type);
+                AppendVarint(_buffer, call.size);
+                AppendVarint(_buffer, call.capacity);
+                break;
+            case RegTraceOp::QueryValue:
+                AppendVarint(_buffer, name);
+                AppendVarint(_buffer, call.type);
+                AppendVarint(_buffer, call.size);
+                AppendVarint(_buffer, call.capacity);
+                break;
+            case RegTraceOp::SetValue:
+                AppendVarint(_buffer, name);
+                AppendVarint(_buffer, call.type);
+                AppendVarint(_buffer, call.size);
+                break;
+            default:
+                break;
+            }
+
+            _calls++;
+            if (_buffer.size() >= FlushSize)
+                _Flush();
+        }
+
+        bool Close(RegRecorder::Stats *stats)
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            if (_fp == NULL)
+                return false;
+            _Flush();
+            bool closed = fclose(_fp) == 0 && !_failed;
+            _fp = NULL;
+            if (stats != nullptr)
+            {
+                stats->calls = _calls;
+                stats->bytes = _bytes;
+            }
+            return closed;
+        }
+
+    private:
+        uint32_t _String(const Char *str)
+        {
+            if (str == nullptr)
+                return 0;
+            String key(str);
+            auto it = _strings.find(key);
+            if (it != _strings.end())
+                return it->second;
+
+            uint32_t id = uint32_t(_strings.size() + 1);
+            _buffer.push_back(StringRecord);
+            AppendVarint(_buffer, key.size());
+            for (auto c = key.begin(); c != key.end(); c++)
+            {
+                _buffer.push_back(BYTE(uint16_t(*c)));
+                _buffer.push_back(BYTE(uint16_t(*c) >> 8));
+            }
+            _strings.emplace(std::move(key), id);
+            return id;
+        }
+
+        uint64_t _Key(HKEY hKey) const
+        {
+            if (IsBaseKey(hKey))
+                return (uint64_t(uintptr_t(hKey) & 0xFFFF) << 1) | 1;
+            auto it = _handles.find(hKey);
+            return it == _handles.end() ? 0 : uint64_t(it->second) << 1;
+        }
+
+        uint32_t _Opened(HKEY hKey)
+        {
+            if (hKey == NULL)
+                return 0;
+            // Handle values are reused once closed, ids never are.
+            _handles[hKey] = ++_nextHandle;
+            return _nextHandle;
+        }
+
+        void _Flush()
+        {
+            if (!_buffer.empty() && fwrite(_buffer.data(), 1, _buffer.size(), _fp) != _buffer.size())
+                _failed = true;
+            _bytes += _buffer.size();
+            _buffer.clear();
+        }
+
+        std::mutex _mutex;
+        FILE *_fp;
+        ByteArray _buffer;
+        uint64_t _lastBegin;
+        std::unordered_map<String, uint32_t> _strings;
+        std::unordered_map<HKEY, uint32_t> _handles;
+        uint32_t _nextHandle;
+        uint64_t _calls;
+        uint64_t _bytes;
+        bool _failed;
+    };
+
+    // Forwards every call to the backend it wraps and records it in its session.
+    // Keeps forwarding, without recording, once the session is stopped.
+    class RecordingBackend : public RegBackend
+    {
+    public:
+        RecordingBackend(const std::shared_ptr<RegBackend> &backend, const std::shared_ptr<RecordingSession> &session)
+            : _backend(backend)
+            , _session(session)
+        {
+        }
+
+        const char *GetName() const override
+        {
+            return _backend->GetName();
+        }
+
+        RegBackend *GetTarget() override
+        {
+            return _backend->GetTarget();
+        }
+
+        LSTATUS OpenKey(HKEY hKey, const Char *subKey, REGSAM access, HKEY *result) override
+        {
+            RecordedCall call(RegTraceOp::OpenKey, hKey);
+            call.status = _backend->OpenKey(hKey, subKey, access, result);
+            return _RecordOpen(call, subKey, access, result);
+        }
+
+        LSTATUS CreateKey(HKEY hKey, const Char *subKey, REGSAM access, HKEY *result) override
+        {
+            RecordedCall call(RegTraceOp::CreateKey, hKey);
+            call.status = _backend->CreateKey(hKey, subKey, access, result);
+            return _RecordOpen(call, subKey, access, result);
+        }
+
+        LSTATUS ConnectRegistry(const Char *host, HKEY hKey, HKEY *result) override
+        {
+            RecordedCall call(RegTraceOp::ConnectRegistry, hKey);
+            call.status = _backend->ConnectRegistry(host, hKey, result);
+            return _RecordOpen(call, host, 0, result);
+        }
+
+        LSTATUS CloseKey(HKEY hKey) override
+        {
+            RecordedCall call(RegTraceOp::CloseKey, hKey);
+            call.status = _backend->CloseKey(hKey);
+            return _Record(call);
+        }
+
+        LSTATUS FlushKey(HKEY hKey) override
+        {
+            RecordedCall call(RegTraceOp::FlushKey, hKey);
+            call.status = _backend->FlushKey(hKey);
+            return _Record(call);
+        }
+
+        LSTATUS CopyTree(HKEY hSrc, const Char *subKey, HKEY hDest) override
+        {
+            RecordedCall call(RegTraceOp::CopyTree, hSrc);
+            call.status = _backend->CopyTree(hSrc, subKey, hDest);
+            call.name = subKey;
+            call.dest = hDest;
+            return _Record(call);
+        }
+
+        LSTATUS RenameKey(HKEY hKey, const Char *subKey, const Char *newName) override
+        {
+            RecordedCall call(RegTraceOp::RenameKey, hKey);
+            call.status = _backend->RenameKey(hKey, subKey, newName);
+            call.name = subKey;
+            call.name2 = newName;
+            return _Record(call);
+        }
+
+        LSTATUS DeleteTree(HKEY hKey, const Char *subKey) override
+        {
+            RecordedCall call(RegTraceOp::DeleteTree, hKey);
+            call.status = _backend->DeleteTree(hKey, subKey);
+            call.name = subKey;
+            return _Record(call);
+        }
+
+        LSTATUS DeleteKey(HKEY hKey, const Char *subKey) override
+        {
+            RecordedCall call(RegTraceOp::DeleteKey, hKey);
+            call.status = _backend->DeleteKey(hKey, subKey);
+            call.name = subKey;
+            return _Record(call);
+        }
+
+        LSTATUS QueryInfoKey(HKEY hKey, RegKeyInfo *info) override
+        {
+            RecordedCall call(RegTraceOp::QueryInfoKey, hKey);
+            call.status = _backend->QueryInfoKey(hKey, info);
+            return _Record(call);
+        }
+
+        LSTATUS EnumKey(HKEY hKey, DWORD index, Char *name, DWORD *nameLength) override
+        {
+            RecordedCall call(RegTraceOp::EnumKey, hKey);
+            call.status = _backend->EnumKey(hKey, index, name, nameLength);
+            call.index = index;
+            // The name found lets a replay seed the key.
+            String found;
+            if (call.status == ERROR_SUCCESS)
+            {
+                found.assign(name, *nameLength);
+                call.name = found.c_str();
+            }
+            return _Record(call);
+        }
+
+        LSTATUS EnumValue(HKEY hKey, DWORD index, Char *name, DWORD *nameLength,
+                          DWORD *type, BYTE *data, DWORD *dataSize) override
+        {
+            RecordedCall call(RegTraceOp::EnumValue, hKey);
+            call.capacity = data != nullptr && dataSize != nullptr ? *dataSize + 1 : 0;
+            call.status = _backend->EnumValue(hKey, index, name, nameLength, type, data, dataSize);
+            call.index = index;
+            String found;
+            if (call.status == ERROR_SUCCESS)
+            {
+                found.assign(name, *nameLength);
+                call.name = found.c_str();
+            }
+            call.type = type != nullptr ? *type : 0;
+            call.size = dataSize != nullptr ? *dataSize : 0;
+            return _Record(call);
+        }
+
+        LSTATUS QueryValue(HKEY hKey, const Char *name, DWORD *type, BYTE *data, DWORD *dataSize) override
+        {
+            RecordedCall call(RegTraceOp::QueryValue, hKey);
+            call.capacity = data != nullptr && dataSize != nullptr ? *dataSize + 1 : 0;
+            call.status = _backend->QueryValue(hKey, name, type, data, dataSize);
+            call.name = name;
+            call.type = type != nullptr ? *type : 0;
+            call.size = dataSize != nullptr ? *dataSize : 0;
+            return _Record(call);
+        }
+
+        LSTATUS SetValue(HKEY hKey, const Char *name, DWORD type, const BYTE *data, DWORD dataSize) override
+        {
+            RecordedCall call(RegTraceOp::SetValue, hKey);
+            call.status = _backend->SetValue(hKey, name, type, data, dataSize);
+            call.name = name;
+            call.type = type;
+            call.size = dataSize;
+            return _Record(call);
+        }
+
+        LSTATUS DeleteValue(HKEY hKey, const Char *name) override
+        {
+            RecordedCall call(RegTraceOp::DeleteValue, hKey);
+            call.status = _backend->DeleteValue(hKey, name);
+            call.name = name;
+            return _Record(call);
+        }
+
+    private:
+        LSTATUS _Record(RecordedCall &call)
+        {
+            _session->Record(call);
+            return call.status;
+        }
+
+        LSTATUS _RecordOpen(RecordedCall &call, const Char *name, REGSAM access, HKEY *result)
+        {
+            call.name = name;
+            call.access = access;
+            call.result = call.status == ERROR_SUCCESS ? *result : NULL;
+            return _Record(call);
+        }
+
+        std::shared_ptr<RegBackend> _backend;
+        std::shared_ptr<RecordingSession> _session;
+    };
+
+    std::mutex recorderMutex;
+    std::atomic<bool> recording(false);
+    std::shared_ptr<RecordingSession> currentSession;
+    // One wrapper per backend, dropped when recording stops.
+    std::unordered_map<RegBackend *, std::shared_ptr<RegBackend>> wrappers;
+
+    class RecordReader
+    {
+    public:
+        RecordReader(const ByteArray &data)
+            : _data(data.data())
+            , _size(data.size())
+            , _offset(HeaderSize)
+            , _ok(true)
+        {
+        }
+
+        bool AtEnd() const
+        {
+            return _offset >= _size;
+        }
+
+        bool IsOk() const
+        {
+            return _ok;
+        }
+
+        BYTE Byte()
+        {
+            if (_offset >= _size)
+            {
+                _ok = false;
+                return 0;
+            }
+            return _data[_offset++];
+        }
+
+        uint64_t Varint()
+        {
+            uint64_t value = 0;
+            for (int shift = 0; shift < 64; shift += 7)
+            {
+                BYTE b = Byte();
+                value |= uint64_t(b & 0x7F) << shift;
+                if (!(b & 0x80))
+                    return value;
+            }
+            _ok = false;
+            return 0;
+        }
+
+        uint32_t Varint32()
+        {
+            uint64_t value = Varint();
+            if (value > 0xFFFFFFFFu)
+                _ok = false;
+            return uint32_t(value);
+        }
+
+        bool Units(size_t count, String &out)
+        {
+            if ((_size - _offset) / 2 < count)
+                return _ok = false;
+            out.resize(count);
+            for (size_t i = 0; i < count; i++, _offset += 2)
+                out[i] = Char(_data[_offset] | (uint16_t(_data[_offset + 1]) << 8));
+            return true;
+        }
+
+    private:
+        const BYTE *_data;
+        size_t _size;
+        size_t _offset;
+        bool _ok;
+    };
+
+    // Nearest-rank percentiles; sorts `samples`.
+    RegLatencySummary Summarize(std::vector<uint64_t> &samples)
+    {
+        RegLatencySummary summary = RegLatencySummary();
+        if (samples.empty())
+            return summary;
+
+        std::sort(samples.begin(), samples.end());
+        size_t n = samples.size();
+        auto percentile = [&](double p) {
+            size_t rank = size_t(std::ceil(p * n));
+            return samples[std::min(n, std::max<size_t>(rank, 1)) - 1];
+        };
+        uint64_t total = 0;
+        for (auto it = samples.begin(); it != samples.end(); it++)
+            total += *it;
+        summary.calls = n;
+        summary.mean = total / n;
+        summary.p50 = percentile(0.5);
+        summary.p90 = percentile(0.9);
+        summary.p99 = percentile(0.99);
+        summary.p999 = percentile(0.999);
+        summary.max = samples.back();
+        return summary;
+    }
+}
+
+bool RegRecorder::Start(const std::string &file)
+{
+    std::lock_guard<std::mutex> lock(recorderMutex);
+    if (currentSession)
+        return false;
+    FILE *fp = RegFile::Open(file, "wb");
+    if (fp == NULL)
+        return false;
+    currentSession = std::make_shared<RecordingSession>(fp);
+    recording.store(true, std::memory_order_relaxed);
+    return true;
+}
+
+bool RegRecorder::Stop(Stats *stats)
+{
+    std::shared_ptr<RecordingSession> session;
+    {
+        std::lock_guard<std::mutex> lock(recorderMutex);
+        session.swap(currentSession);
+        wrappers.clear();
+        recording.store(false, std::memory_order_relaxed);
+    }
+    return session && session->Close(stats);
+}
+
+bool RegRecorder::IsRecording()
+{
+    return recording.load(std::memory_order_relaxed);
+}
+
+std::shared_ptr<RegBackend> RegRecorder::Wrap(const std::shared_ptr<RegBackend> &backend)
+{
+    if (!recording.load(std::memory_order_relaxed))
+        return backend;
+
+    std::lock_guard<std::mutex> lock(recorderMutex);
+    if (!currentSession)
+        return backend;
+    std::shared_ptr<RegBackend> &wrapper = wrappers[backend.get()];
+    if (!wrapper)
+        wrapper = std::make_shared<RecordingBackend>(backend, currentSession);
+    return wrapper;
+}
+
+struct RegReplay::Buffers
+{
+    ByteArray data;
+    ByteArray zeros;
+    String name;
+};
+
+bool RegReplay::Load(const std::string &file, std::string &error)
+{
+    ByteArray data;
+    if (!RegFile::Read(file, data))
+    {
+        error = "Cannot read the recording.";
+        return false;
+    }
+    if (data.size() < HeaderSize || memcmp(data.data(), Magic, sizeof(Magic)) != 0 || data[4] != Version)
+    {
+        error = "Not a recording, or one written by another version.";
+        return false;
+    }
+
+    _calls.clear();
+    _strings.clear();
+    _handleCount = 0;
+
+    RecordReader reader(data);
+    int64_t begin = 0;
+    while (!reader.AtEnd() && reader.IsOk())
+    {
+        BYTE op = reader.Byte();
+        if (op == StringRecord)
+        {
+            String str;
+            reader.Units(size_t(reader.Varint()), str);
+            _strings.push_back(std::move(str));
+            continue;
+        }
+        if (op > BYTE(RegTraceOp::DeleteValue))
+        {
+            error = "Unknown record in the recording.";
+            return false;
+        }
+
+        Call call = Call();
+        call.op = RegTraceOp(op);
+        begin += UnZigZag(reader.Varint());
+        call.begin = uint64_t(std::max<int64_t>(begin, 0));
+        call.duration = reader.Varint();
+        call.status = LSTATUS(reader.Varint32());
+        call.key = reader.Varint32();
+
+        switch (call.op)
+        {
+        case RegTraceOp::OpenKey:
+        case RegTraceOp::CreateKey:
+            call.name = reader.Varint32();
+            call.access = reader.Varint32();
+            call.result = reader.Varint32();
+            break;
+        case RegTraceOp::ConnectRegistry:
+            call.name = reader.Varint32();
+            call.result = reader.Varint32();
+            break;
+        case RegTraceOp::CopyTree:
+            call.name = reader.Varint32();
+            call.dest = reader.Varint32();
+            break;
+        case RegTraceOp::RenameKey:
+            call.name = reader.Varint32();
+            call.name2 = reader.Varint32();
+            break;
+        case RegTraceOp::DeleteTree:
+        case RegTraceOp::DeleteKey:
+        case RegTraceOp::DeleteValue:
+            call.name = reader.Varint32();
+            break;
+        case RegTraceOp::EnumKey:
+            call.index = reader.Varint32();
+            call.name = reader.Varint32();
+            break;
+        case RegTraceOp::EnumValue:
+            call.index = reader.Varint32();
+            call.name = reader.Varint32();
+            call.type = reader.Varint32();
+            call.size = reader.Varint32();
+            call.capacity = reader.Varint32();
+            break;
+        case RegTraceOp::QueryValue:
+            call.name = reader.Varint32();
+            call.type = reader.Varint32();
+            call.size = reader.Varint32();
+            call.capacity = reader.Varint32();
+            break;
+        case RegTraceOp::SetValue:
+            call.name = reader.Varint32();
+            call.type = reader.Varint32();
+            call.size = reader.Varint32();
+            break;
+        default:
+            break;
+        }
+
+        // Strings are defined before use, keys are numbered in the order they are opened and sizes are bounded.
+        if (call.name > _strings.size() || call.name2 > _strings.size() ||
+            (call.result != 0 && call.result != _handleCount + 1) ||
+            call.size > MaxValueSize || call.capacity > MaxValueSize + 1)
+        {
+            error = "The recording is corrupt.";
+            return false;
+        }
+        if (call.result != 0)
+            _handleCount++;
+        _calls.push_back(call);
+    }
+
+    if (!reader.IsOk())
+    {
+        error = "The recording is truncated.";
+        return false;
+    }
+    return true;
+}
+
+HKEY RegReplay::_Resolve(const std::vector<HKEY> &handles, uint32_t key) const
+{
+    if (key & 1)
+        return MakeBaseKey(key >> 1);
+    key >>= 1;
+    return key != 0 && key < handles.size() ? handles[key] : NULL;
+}
+
+const Char *RegReplay::_String(uint32_t id) const
+{
+    return id == 0 ? nullptr : _strings[id - 1].c_str();
+}
+
+LSTATUS RegReplay::_Execute(RegBackend *backend, std::vector<HKEY> &handles, const Call &call, Buffers &buffers)
+{
+    HKEY hKey = _Resolve(handles, call.key);
+    // Calls on keys that could not be opened fail the way they would on Windows.
+    if (hKey == NULL)
+        return ERROR_INVALID_HANDLE;
+
+    LSTATUS status = ERROR_SUCCESS;
+    HKEY result = NULL;
+    DWORD type = 0;
+    switch (call.op)
+    {
+    case RegTraceOp::OpenKey:
+        status = backend->OpenKey(hKey, _String(call.name), call.access, &result);
+        break;
+    case RegTraceOp::CreateKey:
+        status = backend->CreateKey(hKey, _String(call.name), call.access, &result);
+        break;
+    case RegTraceOp::ConnectRegistry:
+        status = backend->ConnectRegistry(_String(call.name), hKey, &result);
+        break;
+    case RegTraceOp::CloseKey:
+        status = backend->CloseKey(hKey);
+        if (!(call.key & 1))
+            handles[call.key >> 1] = NULL;
+        break;
+    case RegTraceOp::FlushKey:
+        status = backend->FlushKey(hKey);
+        break;
+    case RegTraceOp::CopyTree:
+        status = backend->CopyTree(hKey, _String(call.name), _Resolve(handles, call.dest));
+        break;
+    case RegTraceOp::RenameKey:
+        status = backend->RenameKey(hKey, _String(call.name), _String(call.name2));
+        break;
+    case RegTraceOp::DeleteTree:
+        status = backend->DeleteTree(hKey, _String(call.name));
+        break;
+    case RegTraceOp::DeleteKey:
+        status = backend->DeleteKey(hKey, _String(call.name));
+        break;
+    case RegTraceOp::QueryInfoKey:
+    {
+        RegKeyInfo info;
+        status = backend->QueryInfoKey(hKey, &info);
+        break;
+    }
+    case RegTraceOp::EnumKey:
+    {
+        DWORD length = MaxKeyNameLength;
+        status = backend->EnumKey(hKey, call.index, &buffers.name[0], &length);
+        break;
+    }
+    case RegTraceOp::EnumValue:
+    case RegTraceOp::QueryValue:
+    {
+        DWORD size = call.capacity != 0 ? call.capacity - 1 : 0;
+        if (buffers.data.size() < size + 1)
+            buffers.data.resize(size + 1);
+        BYTE *data = call.capacity != 0 ? buffers.data.data() : nullptr;
+        if (call.op == RegTraceOp::QueryValue)
+            status = backend->QueryValue(hKey, _String(call.name), &type, data, &size);
+        else
+        {
+            DWORD length = MaxValueNameLength;
+            status = backend->EnumValue(hKey, call.index, &buffers.name[0], &length, &type, data, &size);
+        }
+        break;
+    }
+    case RegTraceOp::SetValue:
+        if (buffers.zeros.size() < call.size + 1)
+            buffers.zeros.resize(call.size + 1);
+        status = backend->SetValue(hKey, _String(call.name), call.type, buffers.zeros.data(), call.size);
+        break;
+    case RegTraceOp::DeleteValue:
+        status = backend->DeleteValue(hKey, _String(call.name));
+        break;
+    }
+
+    if (status == ERROR_SUCCESS && result != NULL)
+    {
+        // A key the recording failed to open is never used again.
+        if (call.result != 0)
+            handles[call.result] = result;
+        else
+            backend->CloseKey(result);
+    }
+    return status;
+}
+
+void RegReplay::_Seed(RegBackend *backend)
+{
+    // Keys are identified by a root, a base key or a remote registry, and a path under it.
+    // The recording is gathered first, so a value takes the largest size any call reported.
+    struct SeedKey
+    {
+        uint32_t root;
+        String path;
+    };
+    struct SeedValue
+    {
+        size_t key;
+        const Char *name;
+        DWORD type;
+        DWORD size;
+    };
+
+    std::vector<uint32_t> roots(_handleCount + 1, 0);
+    std::vector<String> paths(_handleCount + 1);
+    std::map<uint32_t, const Call *> remotes;
+    std::vector<SeedKey> keys;
+    std::vector<SeedValue> values;
+    std::map<std::pair<uint32_t, String>, size_t> keyIndex;
+    std::map<std::pair<size_t, String>, size_t> valueIndex;
+
+    auto addKey = [&](uint32_t root, const String &path) {
+        auto inserted = keyIndex.emplace(std::make_pair(root, RegString::Fold(path)), keys.size());
+        if (inserted.second)
+            keys.push_back({root, path});
+        return inserted.first->second;
+    };
+    auto join = [](const String &path, const Char *name) {
+        if (name == nullptr || *name == 0)
+            return path;
+        return path.empty() ? String(name) : path + STR('\\') + name;
+    };
+
+    for (auto it = _calls.begin(); it != _calls.end(); it++)
+    {
+        const Call &call = *it;
+        if (call.status != ERROR_SUCCESS && call.status != ERROR_MORE_DATA)
+            continue;
+        uint32_t root = call.key;
+        String path;
+        if (!(call.key & 1))
+        {
+            uint32_t id = call.key >> 1;
+            if (id == 0 || id > _handleCount || roots[id] == 0)
+                continue;
+            root = roots[id];
+            path = paths[id];
+        }
+
+        switch (call.op)
+        {
+        case RegTraceOp::OpenKey:
+        case RegTraceOp::CreateKey:
+            if (call.result != 0)
+            {
+                roots[call.result] = root;
+                paths[call.result] = join(path, _String(call.name));
+                addKey(root, paths[call.result]);
+            }
+            break;
+        case RegTraceOp::ConnectRegistry:
+            if (call.result != 0 && (call.key & 1))
+            {
+                roots[call.result] = call.result << 1;
+                remotes[call.result << 1] = &call;
+            }
+            break;
+        case RegTraceOp::EnumKey:
+            if (call.status == ERROR_SUCCESS)
+                addKey(root, join(path, _String(call.name)));
+            break;
+        case RegTraceOp::EnumValue:
+        case RegTraceOp::QueryValue:
+        {
+            // Only reads report the size of a value they could not fit.
+            if (call.op == RegTraceOp::EnumValue && call.status != ERROR_SUCCESS)
+                break;
+            const Char *name = _String(call.name);
+            size_t key = addKey(root, path);
+            auto inserted = valueIndex.emplace(std::make_pair(key, RegString::Fold(name ? String(name) : String())),
+                                               values.size());
+            if (inserted.second)
+                values.push_back({key, name, call.type, call.size});
+            else
+            {
+                SeedValue &value = values[inserted.first->second];
+                value.type = call.type;
+                value.size = std::max(value.size, call.size);
+            }
+            break;
+        }
+        default:
+            break;
+        }
+    }
+
+    // Existing keys and values are left as they are.
+    std::vector<HKEY> handles(keys.size(), NULL);
+    std::map<uint32_t, HKEY> connections;
+    for (size_t i = 0; i < keys.size(); i++)
+    {
+        HKEY root = NULL;
+        if (keys[i].root & 1)
+            root = MakeBaseKey(keys[i].root >> 1);
+        else if (!connections.count(keys[i].root))
+        {
+            const Call *connect = remotes[keys[i].root];
+            if (connect == nullptr ||
+                backend->ConnectRegistry(_String(connect->name), MakeBaseKey(connect->key >> 1), &root) != ERROR_SUCCESS)
+                root = NULL;
+            connections[keys[i].root] = root;
+        }
+        else
+            root = connections[keys[i].root];
+
+        if (root != NULL)
+            backend->CreateKey(root, keys[i].path.empty() ? nullptr : keys[i].path.c_str(), 0, &handles[i]);
+    }
+
+    ByteArray zeros;
+    for (auto it = values.begin(); it != values.end(); it++)
+    {
+        HKEY hKey = handles[it->key];
+        DWORD size = 0;
+        if (hKey == NULL || backend->QueryValue(hKey, it->name, nullptr, nullptr, &size) != ERROR_FILE_NOT_FOUND)
+            continue;
+        if (zeros.size() < it->size + 1)
+            zeros.resize(it->size + 1);
+        backend->SetValue(hKey, it->name, it->type, zeros.data(), it->size);
+    }
+
+    for (auto it = handles.begin(); it != handles.end(); it++)
+    {
+        if (*it != NULL)
+            backend->CloseKey(*it);
+    }
+    for (auto it = connections.begin(); it != connections.end(); it++)
+    {
+        if (it->second != NULL)
+            backend->CloseKey(it->second);
+    }
+}
+
+RegReplayReport RegReplay::Run(const std::shared_ptr<RegBackend> &backend, const RegReplayOptions &options)
+{
+    RegReplayReport report = RegReplayReport();
+    if (options.seed)
+        _Seed(backend.get());
+
+    std::vector<HKEY> handles(_handleCount + 1, NULL);
+    Buffers buffers;
+    buffers.name.resize(MaxValueNameLength + 1);
+    std::vector<uint64_t> latencies;
+    std::vector<uint64_t> recorded;
+    std::vector<uint64_t> byOp[size_t(RegTraceOp::DeleteValue) + 1];
+    latencies.reserve(_calls.size());
+    recorded.reserve(_calls.size());
+
+    uint64_t start = RegTrace::Now();
+    for (auto it = _calls.begin(); it != _calls.end(); it++)
+    {
+        const Call &call = *it;
+        if (options.speed > 0)
+        {
+            uint64_t due = start + uint64_t(call.begin / options.speed);
+            uint64_t now = RegTrace::Now();
+            if (due > now)
+                std::this_thread::sleep_for(std::chrono::nanoseconds(due - now));
+        }
+
+        uint64_t begin = RegTrace::Now();
+        LSTATUS status = _Execute(backend.get(), handles, call, buffers);
+        uint64_t latency = RegTrace::Now() - begin;
+
+        if (status != call.status)
+            report.mismatches++;
+        latencies.push_back(latency);
+        recorded.push_back(call.duration);
+        byOp[size_t(call.op)].push_back(latency);
+    }
+    report.elapsed = RegTrace::Now() - start;
+
+    for (auto it = handles.begin(); it != handles.end(); it++)
+    {
+        if (*it != NULL)
+            backend->CloseKey(*it);
+    }
+
+    report.calls = _calls.size();
+    report.throughput = report.elapsed > 0 ? report.calls * 1e9 / report.elapsed : 0;
+    report.latency = Summarize(latencies);
+    report.recordedLatency = Summarize(recorded);
+    for (size_t op = 0; op < sizeof(byOp) / sizeof(byOp[0]); op++)
+    {
+        if (!byOp[op].empty())
+            report.ops[RegTrace::GetOpName(RegTraceOp(op))] = Summarize(byOp[op]);
+    }
+    return report;
+}
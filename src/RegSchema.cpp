@@ -0,0 +1,32 @@
+#include "RegSchema.h"
+
+bool RegSchema::Accepts(DWORD expected, DWORD actual)
+{
+    switch (expected)
+    {
+    case REG_SZ:
+    case REG_EXPAND_SZ:
+        return actual == REG_SZ || actual == REG_EXPAND_SZ;
+    case REG_DWORD:
+        return actual == REG_DWORD || actual == REG_DWORD_BIG_ENDIAN;
+    default:
+        return actual == expected;
+    }
+}
+
+void RegSchema::Read(RegKey &key, std::vector<RegValue> &values, std::vector<LSTATUS> &statuses) const
+{
+    values.resize(_fields.size());
+    statuses.resize(_fields.size());
+    for (size_t i = 0; i < _fields.size(); i++)
+    {
+        bool success = false;
+        values[i] = key.GetValue(_fields[i].name, &success);
+        if (!success)
+            statuses[i] = key.GetLastStatus();
+        else if (!Accepts(_fields[i].type, values[i].type))
+            statuses[i] = ERROR_DATATYPE_MISMATCH;
+        else
+            statuses[i] = ERROR_SUCCESS;
+    }
+}
@@ -0,0 +1,121 @@
+#include "RegSearch.h"
+#include "RegString.h"
+#include <algorithm>
+
+std::shared_ptr<RegSearch> RegSearch::Create(RegKey &&root,
+                                             const RegSearchOptions &options,
+                                             HitCallback onHits,
+                                             DoneCallback onDone)
+{
+    return std::shared_ptr<RegSearch>(new RegSearch(std::move(root), options, std::move(onHits), std::move(onDone)));
+}
+
+RegSearch::RegSearch(RegKey &&root, const RegSearchOptions &options, HitCallback onHits, DoneCallback onDone)
+    : _root(std::move(root))
+    , _options(options)
+    , _foldedPattern(RegString::Fold(options.pattern))
+    , _onHits(std::move(onHits))
+    , _onDone(std::move(onDone))
+{
+}
+
+void RegSearch::Start()
+{
+    // Running tasks hold a reference, so `this` outlives the last one finishing.
+    _group.OnDone([this](LSTATUS status) {
+        _onDone(status);
+    });
+    std::shared_ptr<RegSearch> self = shared_from_this();
+    _group.Run([self]() {
+        self->_Visit(STR(""), 0);
+    });
+}
+
+bool RegSearch::Match(const Char *text, size_t length) const
+{
+    if (_foldedPattern.empty())
+        return true;
+    if (length < _foldedPattern.size())
+        return false;
+
+    thread_local String folded;
+    folded.resize(length);
+    RegString::Fold(text, &folded[0], length);
+    return folded.find(_foldedPattern) != String::npos;
+}
+
+bool RegSearch::_MatchType(DWORD type, bool data) const
+{
+    if (_options.types.empty())
+        return !data || type == REG_SZ || type == REG_EXPAND_SZ || type == REG_MULTI_SZ;
+    return std::find(_options.types.begin(), _options.types.end(), type) != _options.types.end();
+}
+
+bool RegSearch::_MatchData(const ByteArray &data) const
+{
+    // Data of other types is scanned as UTF-16 too, which finds strings embedded in binary blobs.
+    const Char *text = reinterpret_cast<const Char *>(data.data());
+    size_t length = data.size() / sizeof(Char);
+    while (length > 0 && text[length - 1] == 0)
+        length--;
+    return Match(text, length);
+}
+
+void RegSearch::_Visit(const String &path, int depth)
+{
+    // The root handle is shared by all tasks and only borrowed here.
+    RegKey key(_root.GetBackend());
+    if (path.empty())
+        key.Attach(_root.GetHandle());
+    else if (key.Open(_root.GetHandle(), path, KEY_READ) == NULL)
+        return;
+
+    std::vector<RegSearchHit> hits;
+    bool matchNames = (_options.fields & uint32_t(RegSearchField::Name)) != 0;
+    bool matchData = (_options.fields & uint32_t(RegSearchField::Data)) != 0;
+
+    if (matchData)
+    {
+        std::vector<RegValue> values = key.GetValues();
+        for (auto it = values.begin(); it != values.end() && !IsCancelled(); it++)
+        {
+            if (matchNames && _MatchType(it->type, false) && Match(it->name.c_str(), it->name.size()))
+                hits.push_back({path, it->name, it->type, RegSearchField::Name});
+            if (_MatchType(it->type, true) && _MatchData(it->data))
+                hits.push_back({path, it->name, it->type, RegSearchField::Data});
+        }
+    }
+    else if (matchNames)
+    {
+        std::vector<String> names = key.GetValueNames();
+        for (auto it = names.begin(); it != names.end() && !IsCancelled(); it++)
+        {
+            if (!Match(it->c_str(), it->size()))
+                continue;
+            DWORD type = key.GetValueType(*it);
+            if (_MatchType(type, false))
+                hits.push_back({path, *it, type, RegSearchField::Name});
+        }
+    }
+
+    if (_options.maxDepth < 0 || depth < _options.maxDepth)
+    {
+        bool matchKeys = (_options.fields & uint32_t(RegSearchField::Key)) != 0;
+        std::vector<String> subKeys = key.GetSubKeyNames();
+        std::shared_ptr<RegSearch> self = shared_from_this();
+        for (auto it = subKeys.begin(); it != subKeys.end() && !IsCancelled(); it++)
+        {
+            String subPath = path.empty() ? *it : path + STR('\\') + *it;
+            if (matchKeys && Match(it->c_str(), it->size()))
+                hits.push_back({subPath, STR(""), REG_NONE, RegSearchField::Key});
+            _group.Run([self, subPath, depth]() {
+                self->_Visit(subPath, depth + 1);
+            });
+        }
+    }
+
+    if (path.empty())
+        key.Detach();
+    if (!hits.empty() && !IsCancelled())
+        _onHits(std::move(hits));
+}
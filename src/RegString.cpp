@@ -0,0 +1,711 @@
+#include "RegString.h"
+#include <algorithm>
+#include <cstring>
+#include <iterator>
+#include <vector>
+
+#if defined(_M_X64) || defined(__x86_64__) || defined(_M_IX86) || defined(__i386__)
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define REGSTRING_SSE2
+#endif
+#define REGSTRING_AVX2
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#if defined(_MSC_VER) && !defined(__clang__)
+#define REGSTRING_TARGET_AVX2
+#else
+#define REGSTRING_TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+#elif defined(__aarch64__) || defined(_M_ARM64)
+#define REGSTRING_NEON
+#include <arm_neon.h>
+#endif
+
+namespace
+{
+    // Folds full blocks while they only contain ASCII and returns the number of units written.
+    typedef size_t (*FoldAsciiKernel)(const Char *src, Char *dst, size_t length);
+    // Returns the number of leading units known to be equal after folding.
+    typedef size_t (*MatchAsciiKernel)(const Char *a, const Char *b, size_t length);
+    // Returns the number of leading units scanned without finding a zero, in whole blocks.
+    typedef size_t (*SkipNonZeroKernel)(const BYTE *units, size_t length);
+
+    const size_t ScalarRun = 16;
+
+    size_t FoldAsciiScalar(const Char *, Char *, size_t)
+    {
+        return 0;
+    }
+
+    size_t MatchAsciiScalar(const Char *, const Char *, size_t)
+    {
+        return 0;
+    }
+
+    size_t SkipNonZeroScalar(const BYTE *, size_t)
+    {
+        return 0;
+    }
+
+#ifdef REGSTRING_SSE2
+    inline bool FoldBlockSse2(__m128i &v)
+    {
+        const __m128i nonAscii = _mm_and_si128(v, _mm_set1_epi16(short(0xFF80)));
+        if (_mm_movemask_epi8(_mm_cmpeq_epi16(nonAscii, _mm_setzero_si128())) != 0xFFFF)
+            return false;
+        const __m128i lower = _mm_and_si128(_mm_cmpgt_epi16(v, _mm_set1_epi16('a' - 1)),
+                                            _mm_cmplt_epi16(v, _mm_set1_epi16('z' + 1)));
+        v = _mm_sub_epi16(v, _mm_and_si128(lower, _mm_set1_epi16(0x20)));
+        return true;
+    }
+
+    inline size_t FoldAsciiSse2(const Char *src, Char *dst, size_t length)
+    {
+        size_t i = 0;
+        for (; i + 8 <= length; i += 8)
+        {
+            __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + i));
+            if (!FoldBlockSse2(v))
+                break;
+            _mm_storeu_si128(reinterpret_cast<__m128i *>(dst + i), v);
+        }
+        return i;
+    }
+
+    inline size_t MatchAsciiSse2(const Char *a, const Char *b, size_t length)
+    {
+        size_t i = 0;
+        for (; i + 8 <= length; i += 8)
+        {
+            __m128i va = _mm_loadu_si128(reinterpret_cast<const __m128i *>(a + i));
+            __m128i vb = _mm_loadu_si128(reinterpret_cast<const __m128i *>(b + i));
+            if (!FoldBlockSse2(va) || !FoldBlockSse2(vb) ||
+                _mm_movemask_epi8(_mm_cmpeq_epi16(va, vb)) != 0xFFFF)
+                break;
+        }
+        return i;
+    }
+
+    inline size_t SkipNonZeroSse2(const BYTE *units, size_t length)
+    {
+        size_t i = 0;
+        for (; i + 8 <= length; i += 8)
+        {
+            __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(units + i * sizeof(Char)));
+            if (_mm_movemask_epi8(_mm_cmpeq_epi16(v, _mm_setzero_si128())) != 0)
+                break;
+        }
+        return i;
+    }
+#endif
+
+#ifdef REGSTRING_AVX2
+    REGSTRING_TARGET_AVX2 inline bool FoldBlockAvx2(__m256i &v)
+    {
+        const __m256i nonAscii = _mm256_and_si256(v, _mm256_set1_epi16(short(0xFF80)));
+        if (unsigned(_mm256_movemask_epi8(_mm256_cmpeq_epi16(nonAscii, _mm256_setzero_si256()))) != 0xFFFFFFFFu)
+            return false;
+        const __m256i lower = _mm256_andnot_si256(_mm256_cmpgt_epi16(v, _mm256_set1_epi16('z')),
+                                                  _mm256_cmpgt_epi16(v, _mm256_set1_epi16('a' - 1)));
+        v = _mm256_sub_epi16(v, _mm256_and_si256(lower, _mm256_set1_epi16(0x20)));
+        return true;
+    }
+
+    REGSTRING_TARGET_AVX2 size_t FoldAsciiAvx2(const Char *src, Char *dst, size_t length)
+    {
+        size_t i = 0;
+        for (; i + 16 <= length; i += 16)
+        {
+            __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(src + i));
+            if (!FoldBlockAvx2(v))
+                break;
+            _mm256_storeu_si256(reinterpret_cast<__m256i *>(dst + i), v);
+        }
+#ifdef REGSTRING_SSE2
+        // The remainder, and names shorter than a 16-unit block, still get 8-unit blocks.
+        i += FoldAsciiSse2(src + i, dst + i, length - i);
+#endif
+        return i;
+    }
+
+    REGSTRING_TARGET_AVX2 size_t MatchAsciiAvx2(const Char *a, const Char *b, size_t length)
+    {
+        size_t i = 0;
+        for (; i + 16 <= length; i += 16)
+        {
+            __m256i va = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(a + i));
+            __m256i vb = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(b + i));
+            if (!FoldBlockAvx2(va) || !FoldBlockAvx2(vb) ||
+                unsigned(_mm256_movemask_epi8(_mm256_cmpeq_epi16(va, vb))) != 0xFFFFFFFFu)
+                break;
+        }
+#ifdef REGSTRING_SSE2
+        i += MatchAsciiSse2(a + i, b + i, length - i);
+#endif
+        return i;
+    }
+
+    REGSTRING_TARGET_AVX2 size_t SkipNonZeroAvx2(const BYTE *units, size_t length)
+    {
+        size_t i = 0;
+        for (; i + 16 <= length; i += 16)
+        {
+            __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(units + i * sizeof(Char)));
+            if (_mm256_movemask_epi8(_mm256_cmpeq_epi16(v, _mm256_setzero_si256())) != 0)
+                break;
+        }
+#ifdef REGSTRING_SSE2
+        i += SkipNonZeroSse2(units + i * sizeof(Char), length - i);
+#endif
+        return i;
+    }
+
+    bool SupportsAvx2()
+    {
+#if defined(_MSC_VER) && !defined(__clang__)
+        int regs[4];
+        __cpuid(regs, 0);
+        if (regs[0] < 7)
+            return false;
+        __cpuid(regs, 1);
+        // OSXSAVE and the OS saving YMM state are required besides the AVX2 bit.
+        if (!(regs[2] & (1 << 27)) || (_xgetbv(0) & 6) != 6)
+            return false;
+        __cpuidex(regs, 7, 0);
+        return (regs[1] & (1 << 5)) != 0;
+#else
+        __builtin_cpu_init();
+        return __builtin_cpu_supports("avx2");
+#endif
+    }
+#endif
+
+#ifdef REGSTRING_NEON
+    inline bool FoldBlockNeon(uint16x8_t &v)
+    {
+        if (vmaxvq_u16(v) > 0x7F)
+            return false;
+        const uint16x8_t lower = vandq_u16(vcgeq_u16(v, vdupq_n_u16('a')), vcleq_u16(v, vdupq_n_u16('z')));
+        v = vsubq_u16(v, vandq_u16(lower, vdupq_n_u16(0x20)));
+        return true;
+    }
+
+    size_t FoldAsciiNeon(const Char *src, Char *dst, size_t length)
+    {
+        size_t i = 0;
+        for (; i + 8 <= length; i += 8)
+        {
+            uint16x8_t v = vld1q_u16(reinterpret_cast<const uint16_t *>(src + i));
+            if (!FoldBlockNeon(v))
+                break;
+            vst1q_u16(reinterpret_cast<uint16_t *>(dst + i), v);
+        }
+        return i;
+    }
+
+    size_t MatchAsciiNeon(const Char *a, const Char *b, size_t length)
+    {
+        size_t i = 0;
+        for (; i + 8 <= length; i += 8)
+        {
+            uint16x8_t va = vld1q_u16(reinterpret_cast<const uint16_t *>(a + i));
+            uint16x8_t vb = vld1q_u16(reinterpret_cast<const uint16_t *>(b + i));
+            if (!FoldBlockNeon(va) || !FoldBlockNeon(vb) || vminvq_u16(vceqq_u16(va, vb)) != 0xFFFF)
+                break;
+        }
+        return i;
+    }
+
+    size_t SkipNonZeroNeon(const BYTE *units, size_t length)
+    {
+        size_t i = 0;
+        for (; i + 8 <= length; i += 8)
+        {
+            uint16x8_t v = vld1q_u16(reinterpret_cast<const uint16_t *>(units + i * sizeof(Char)));
+            if (vminvq_u16(v) == 0)
+                break;
+        }
+        return i;
+    }
+#endif
+
+    struct FoldKernels
+    {
+        const char *name;
+        FoldAsciiKernel foldAscii;
+        MatchAsciiKernel matchAscii;
+        SkipNonZeroKernel skipNonZero;
+    };
+
+    // Kernels this machine can run, fastest first; the scalar fallback is always last.
+    std::vector<FoldKernels> FindKernels()
+    {
+        std::vector<FoldKernels> found;
+#ifdef REGSTRING_AVX2
+        if (SupportsAvx2())
+            found.push_back({"avx2", FoldAsciiAvx2, MatchAsciiAvx2, SkipNonZeroAvx2});
+#endif
+#ifdef REGSTRING_SSE2
+        found.push_back({"sse2", FoldAsciiSse2, MatchAsciiSse2, SkipNonZeroSse2});
+#elif defined(REGSTRING_NEON)
+        found.push_back({"neon", FoldAsciiNeon, MatchAsciiNeon, SkipNonZeroNeon});
+#endif
+        found.push_back({"scalar", FoldAsciiScalar, MatchAsciiScalar, SkipNonZeroScalar});
+        return found;
+    }
+
+    const std::vector<FoldKernels> availableKernels = FindKernels();
+    FoldKernels kernels = availableKernels.front();
+
+    void FoldScalar(const Char *src, Char *dst, size_t length)
+    {
+        for (size_t i = 0; i < length; i++)
+            dst[i] = RegString::FoldChar(src[i]);
+    }
+
+    // Hashes folded code units four at a time; shared by the scalar and vectorized paths.
+    class FoldHasher
+    {
+    public:
+        explicit FoldHasher(size_t length)
+            : _hash(0x9E3779B97F4A7C15ULL ^ (uint64_t(length) * 0xFF51AFD7ED558CCDULL))
+        {
+        }
+
+        void Update(const Char *folded, size_t length)
+        {
+            size_t i = 0;
+            for (; i + 4 <= length; i += 4)
+                Mix(Word(folded + i, 4));
+            if (i < length)
+                Mix(Word(folded + i, length - i));
+        }
+
+        uint32_t Finish() const
+        {
+            uint64_t h = _hash;
+            h ^= h >> 33;
+            h *= 0xFF51AFD7ED558CCDULL;
+            h ^= h >> 33;
+            h *= 0xC4CEB9FE1A85EC53ULL;
+            h ^= h >> 33;
+            return uint32_t(h ^ (h >> 32));
+        }
+
+    private:
+        static uint64_t Word(const Char *units, size_t count)
+        {
+            uint64_t word = 0;
+            for (size_t i = 0; i < count; i++)
+                word |= uint64_t(uint16_t(units[i])) << (16 * i);
+            return word;
+        }
+
+        void Mix(uint64_t word)
+        {
+            _hash ^= word * 0x87C37B91114253D5ULL;
+            _hash = ((_hash << 29) | (_hash >> 35)) * 0x4CF5AD432745937FULL;
+        }
+
+        uint64_t _hash;
+    };
+
+    // Chunks are a multiple of four units so words never straddle two chunks.
+    const size_t HashChunk = 128;
+}
+
+namespace
+{
+    struct UpcaseRange
+    {
+        uint16_t first;
+        uint16_t last;
+        // Added modulo 0x10000.
+        uint16_t delta;
+        // 2 when only every other unit from `first` on is mapped, as in runs of upper and lower case pairs.
+        uint16_t stride;
+    };
+
+    // The simple uppercase mappings of every UTF-16 code unit that has one, printed by tools/upcase.js.
+    // Like the upcase table of Windows, it leaves U+00DF, U+0131 and U+017F alone.
+    const UpcaseRange upcaseRanges[] = {
+        // Unicode 16.0
+        {0x0061, 0x007A, 0xFFE0, 1},
+        {0x00B5, 0x00B5, 0x02E7, 1},
+        {0x00E0, 0x00F6, 0xFFE0, 1},
+        {0x00F8, 0x00FE, 0xFFE0, 1},
+        {0x00FF, 0x00FF, 0x0079, 1},
+        {0x0101, 0x012F, 0xFFFF, 2},
+        {0x0133, 0x0137, 0xFFFF, 2},
+        {0x013A, 0x0148, 0xFFFF, 2},
+        {0x014B, 0x0177, 0xFFFF, 2},
+        {0x017A, 0x017E, 0xFFFF, 2},
+        {0x0180, 0x0180, 0x00C3, 1},
+        {0x0183, 0x0185, 0xFFFF, 2},
+        {0x0188, 0x0188, 0xFFFF, 1},
+        {0x018C, 0x018C, 0xFFFF, 1},
+        {0x0192, 0x0192, 0xFFFF, 1},
+        {0x0195, 0x0195, 0x0061, 1},
+        {0x0199, 0x0199, 0xFFFF, 1},
+        {0x019A, 0x019A, 0x00A3, 1},
+        {0x019B, 0x019B, 0xA641, 1},
+        {0x019E, 0x019E, 0x0082, 1},
+        {0x01A1, 0x01A5, 0xFFFF, 2},
+        {0x01A8, 0x01A8, 0xFFFF, 1},
+        {0x01AD, 0x01AD, 0xFFFF, 1},
+        {0x01B0, 0x01B0, 0xFFFF, 1},
+        {0x01B4, 0x01B6, 0xFFFF, 2},
+        {0x01B9, 0x01B9, 0xFFFF, 1},
+        {0x01BD, 0x01BD, 0xFFFF, 1},
+        {0x01BF, 0x01BF, 0x0038, 1},
+        {0x01C5, 0x01C5, 0xFFFF, 1},
+        {0x01C6, 0x01C6, 0xFFFE, 1},
+        {0x01C8, 0x01C8, 0xFFFF, 1},
+        {0x01C9, 0x01C9, 0xFFFE, 1},
+        {0x01CB, 0x01CB, 0xFFFF, 1},
+        {0x01CC, 0x01CC, 0xFFFE, 1},
+        {0x01CE, 0x01DC, 0xFFFF, 2},
+        {0x01DD, 0x01DD, 0xFFB1, 1},
+        {0x01DF, 0x01EF, 0xFFFF, 2},
+        {0x01F2, 0x01F2, 0xFFFF, 1},
+        {0x01F3, 0x01F3, 0xFFFE, 1},
+        {0x01F5, 0x01F5, 0xFFFF, 1},
+        {0x01F9, 0x021F, 0xFFFF, 2},
+        {0x0223, 0x0233, 0xFFFF, 2},
+        {0x023C, 0x023C, 0xFFFF, 1},
+        {0x023F, 0x0240, 0x2A3F, 1},
+        {0x0242, 0x0242, 0xFFFF, 1},
+        {0x0247, 0x024F, 0xFFFF, 2},
+        {0x0250, 0x0250, 0x2A1F, 1},
+        {0x0251, 0x0251, 0x2A1C, 1},
+        {0x0252, 0x0252, 0x2A1E, 1},
+        {0x0253, 0x0253, 0xFF2E, 1},
+        {0x0254, 0x0254, 0xFF32, 1},
+        {0x0256, 0x0257, 0xFF33, 1},
+        {0x0259, 0x0259, 0xFF36, 1},
+        {0x025B, 0x025B, 0xFF35, 1},
+        {0x025C, 0x025C, 0xA54F, 1},
+        {0x0260, 0x0260, 0xFF33, 1},
+        {0x0261, 0x0261, 0xA54B, 1},
+        {0x0263, 0x0263, 0xFF31, 1},
+        {0x0264, 0x0264, 0xA567, 1},
+        {0x0265, 0x0265, 0xA528, 1},
+        {0x0266, 0x0266, 0xA544, 1},
+        {0x0268, 0x0268, 0xFF2F, 1},
+        {0x0269, 0x0269, 0xFF2D, 1},
+        {0x026A, 0x026A, 0xA544, 1},
+        {0x026B, 0x026B, 0x29F7, 1},
+        {0x026C, 0x026C, 0xA541, 1},
+        {0x026F, 0x026F, 0xFF2D, 1},
+        {0x0271, 0x0271, 0x29FD, 1},
+        {0x0272, 0x0272, 0xFF2B, 1},
+        {0x0275, 0x0275, 0xFF2A, 1},
+        {0x027D, 0x027D, 0x29E7, 1},
+        {0x0280, 0x0280, 0xFF26, 1},
+        {0x0282, 0x0282, 0xA543, 1},
+        {0x0283, 0x0283, 0xFF26, 1},
+        {0x0287, 0x0287, 0xA52A, 1},
+        {0x0288, 0x0288, 0xFF26, 1},
+        {0x0289, 0x0289, 0xFFBB, 1},
+        {0x028A, 0x028B, 0xFF27, 1},
+        {0x028C, 0x028C, 0xFFB9, 1},
+        {0x0292, 0x0292, 0xFF25, 1},
+        {0x029D, 0x029D, 0xA515, 1},
+        {0x029E, 0x029E, 0xA512, 1},
+        {0x0345, 0x0345, 0x0054, 1},
+        {0x0371, 0x0373, 0xFFFF, 2},
+        {0x0377, 0x0377, 0xFFFF, 1},
+        {0x037B, 0x037D, 0x0082, 1},
+        {0x03AC, 0x03AC, 0xFFDA, 1},
+        {0x03AD, 0x03AF, 0xFFDB, 1},
+        {0x03B1, 0x03C1, 0xFFE0, 1},
+        {0x03C2, 0x03C2, 0xFFE1, 1},
+        {0x03C3, 0x03CB, 0xFFE0, 1},
+        {0x03CC, 0x03CC, 0xFFC0, 1},
+        {0x03CD, 0x03CE, 0xFFC1, 1},
+        {0x03D0, 0x03D0, 0xFFC2, 1},
+        {0x03D1, 0x03D1, 0xFFC7, 1},
+        {0x03D5, 0x03D5, 0xFFD1, 1},
+        {0x03D6, 0x03D6, 0xFFCA, 1},
+        {0x03D7, 0x03D7, 0xFFF8, 1},
+        {0x03D9, 0x03EF, 0xFFFF, 2},
+        {0x03F0, 0x03F0, 0xFFAA, 1},
+        {0x03F1, 0x03F1, 0xFFB0, 1},
+        {0x03F2, 0x03F2, 0x0007, 1},
+        {0x03F3, 0x03F3, 0xFF8C, 1},
+        {0x03F5, 0x03F5, 0xFFA0, 1},
+        {0x03F8, 0x03F8, 0xFFFF, 1},
+        {0x03FB, 0x03FB, 0xFFFF, 1},
+        {0x0430, 0x044F, 0xFFE0, 1},
+        {0x0450, 0x045F, 0xFFB0, 1},
+        {0x0461, 0x0481, 0xFFFF, 2},
+        {0x048B, 0x04BF, 0xFFFF, 2},
+        {0x04C2, 0x04CE, 0xFFFF, 2},
+        {0x04CF, 0x04CF, 0xFFF1, 1},
+        {0x04D1, 0x052F, 0xFFFF, 2},
+        {0x0561, 0x0586, 0xFFD0, 1},
+        {0x10D0, 0x10FA, 0x0BC0, 1},
+        {0x10FD, 0x10FF, 0x0BC0, 1},
+        {0x13F8, 0x13FD, 0xFFF8, 1},
+        {0x1C80, 0x1C80, 0xE792, 1},
+        {0x1C81, 0x1C81, 0xE793, 1},
+        {0x1C82, 0x1C82, 0xE79C, 1},
+        {0x1C83, 0x1C84, 0xE79E, 1},
+        {0x1C85, 0x1C85, 0xE79D, 1},
+        {0x1C86, 0x1C86, 0xE7A4, 1},
+        {0x1C87, 0x1C87, 0xE7DB, 1},
+        {0x1C88, 0x1C88, 0x89C2, 1},
+        {0x1C8A, 0x1C8A, 0xFFFF, 1},
+        {0x1D79, 0x1D79, 0x8A04, 1},
+        {0x1D7D, 0x1D7D, 0x0EE6, 1},
+        {0x1D8E, 0x1D8E, 0x8A38, 1},
+        {0x1E01, 0x1E95, 0xFFFF, 2},
+        {0x1E9B, 0x1E9B, 0xFFC5, 1},
+        {0x1EA1, 0x1EFF, 0xFFFF, 2},
+        {0x1F00, 0x1F07, 0x0008, 1},
+        {0x1F10, 0x1F15, 0x0008, 1},
+        {0x1F20, 0x1F27, 0x0008, 1},
+        {0x1F30, 0x1F37, 0x0008, 1},
+        {0x1F40, 0x1F45, 0x0008, 1},
+        {0x1F51, 0x1F57, 0x0008, 2},
+        {0x1F60, 0x1F67, 0x0008, 1},
+        {0x1F70, 0x1F71, 0x004A, 1},
+        {0x1F72, 0x1F75, 0x0056, 1},
+        {0x1F76, 0x1F77, 0x0064, 1},
+        {0x1F78, 0x1F79, 0x0080, 1},
+        {0x1F7A, 0x1F7B, 0x0070, 1},
+        {0x1F7C, 0x1F7D, 0x007E, 1},
+        {0x1F80, 0x1F87, 0x0008, 1},
+        {0x1F90, 0x1F97, 0x0008, 1},
+        {0x1FA0, 0x1FA7, 0x0008, 1},
+        {0x1FB0, 0x1FB1, 0x0008, 1},
+        {0x1FB3, 0x1FB3, 0x0009, 1},
+        {0x1FBE, 0x1FBE, 0xE3DB, 1},
+        {0x1FC3, 0x1FC3, 0x0009, 1},
+        {0x1FD0, 0x1FD1, 0x0008, 1},
+        {0x1FE0, 0x1FE1, 0x0008, 1},
+        {0x1FE5, 0x1FE5, 0x0007, 1},
+        {0x1FF3, 0x1FF3, 0x0009, 1},
+        {0x214E, 0x214E, 0xFFE4, 1},
+        {0x2170, 0x217F, 0xFFF0, 1},
+        {0x2184, 0x2184, 0xFFFF, 1},
+        {0x24D0, 0x24E9, 0xFFE6, 1},
+        {0x2C30, 0x2C5F, 0xFFD0, 1},
+        {0x2C61, 0x2C61, 0xFFFF, 1},
+        {0x2C65, 0x2C65, 0xD5D5, 1},
+        {0x2C66, 0x2C66, 0xD5D8, 1},
+        {0x2C68, 0x2C6C, 0xFFFF, 2},
+        {0x2C73, 0x2C73, 0xFFFF, 1},
+        {0x2C76, 0x2C76, 0xFFFF, 1},
+        {0x2C81, 0x2CE3, 0xFFFF, 2},
+        {0x2CEC, 0x2CEE, 0xFFFF, 2},
+        {0x2CF3, 0x2CF3, 0xFFFF, 1},
+        {0x2D00, 0x2D25, 0xE3A0, 1},
+        {0x2D27, 0x2D27, 0xE3A0, 1},
+        {0x2D2D, 0x2D2D, 0xE3A0, 1},
+        {0xA641, 0xA66D, 0xFFFF, 2},
+        {0xA681, 0xA69B, 0xFFFF, 2},
+        {0xA723, 0xA72F, 0xFFFF, 2},
+        {0xA733, 0xA76F, 0xFFFF, 2},
+        {0xA77A, 0xA77C, 0xFFFF, 2},
+        {0xA77F, 0xA787, 0xFFFF, 2},
+        {0xA78C, 0xA78C, 0xFFFF, 1},
+        {0xA791, 0xA793, 0xFFFF, 2},
+        {0xA794, 0xA794, 0x0030, 1},
+        {0xA797, 0xA7A9, 0xFFFF, 2},
+        {0xA7B5, 0xA7C3, 0xFFFF, 2},
+        {0xA7C8, 0xA7CA, 0xFFFF, 2},
+        {0xA7CD, 0xA7CD, 0xFFFF, 1},
+        {0xA7D1, 0xA7D1, 0xFFFF, 1},
+        {0xA7D7, 0xA7DB, 0xFFFF, 2},
+        {0xA7F6, 0xA7F6, 0xFFFF, 1},
+        {0xAB53, 0xAB53, 0xFC60, 1},
+        {0xAB70, 0xABBF, 0x6830, 1},
+        {0xFF41, 0xFF5A, 0xFFE0, 1},
+    };
+}
+
+Char RegString::FoldChar(Char c)
+{
+    if (c < 'a')
+        return c;
+    if (c <= 'z')
+        return Char(c - 0x20);
+    if (c < 0xB5)
+        return c;
+
+    uint16_t unit = uint16_t(c);
+    const UpcaseRange *range = std::lower_bound(std::begin(upcaseRanges), std::end(upcaseRanges), unit,
+                                                [](const UpcaseRange &range, uint16_t unit) { return range.last < unit; });
+    if (range == std::end(upcaseRanges) || unit < range->first || (unit - range->first) % range->stride != 0)
+        return c;
+    return Char(uint16_t(unit + range->delta));
+}
+
+void RegString::Fold(const Char *src, Char *dst, size_t length)
+{
+    size_t i = 0;
+    while (i < length)
+    {
+        i += kernels.foldAscii(src + i, dst + i, length - i);
+        size_t end = i + ScalarRun < length ? i + ScalarRun : length;
+        FoldScalar(src + i, dst + i, end - i);
+        i = end;
+    }
+}
+
+String RegString::Fold(const Char *str, size_t length)
+{
+    String folded(length, Char(0));
+    Fold(str, &folded[0], length);
+    return folded;
+}
+
+int RegString::CompareFold(const Char *a, size_t aLength, const Char *b, size_t bLength)
+{
+    size_t length = aLength < bLength ? aLength : bLength;
+    size_t i = 0;
+    while (i < length)
+    {
+        i += kernels.matchAscii(a + i, b + i, length - i);
+        size_t end = i + ScalarRun < length ? i + ScalarRun : length;
+        for (; i < end; i++)
+        {
+            Char fa = FoldChar(a[i]);
+            Char fb = FoldChar(b[i]);
+            if (fa != fb)
+                return fa < fb ? -1 : 1;
+        }
+    }
+    return aLength == bLength ? 0 : (aLength < bLength ? -1 : 1);
+}
+
+bool RegString::EqualsFold(const Char *a, size_t aLength, const Char *b, size_t bLength)
+{
+    return aLength == bLength && CompareFold(a, aLength, b, bLength) == 0;
+}
+
+uint32_t RegString::HashFold(const Char *str, size_t length)
+{
+    FoldHasher hasher(length);
+    Char folded[HashChunk];
+    for (size_t i = 0; i < length; i += HashChunk)
+    {
+        size_t count = length - i < HashChunk ? length - i : HashChunk;
+        Fold(str + i, folded, count);
+        hasher.Update(folded, count);
+    }
+    return hasher.Finish();
+}
+
+bool RegString::MatchPattern(const Char *pattern, size_t patternLength, const Char *text, size_t textLength)
+{
+    // Greedy matching with a single backtrack point, linear for patterns without '*'.
+    size_t p = 0, t = 0;
+    size_t starPattern = size_t(-1), starText = 0;
+    while (t < textLength)
+    {
+        if (p < patternLength && pattern[p] == '*')
+        {
+            starPattern = p++;
+            starText = t;
+        }
+        else if (p < patternLength && (pattern[p] == '?' || FoldChar(pattern[p]) == FoldChar(text[t])))
+        {
+            p++;
+            t++;
+        }
+        else if (starPattern != size_t(-1))
+        {
+            p = starPattern + 1;
+            t = ++starText;
+        }
+        else
+            return false;
+    }
+    while (p < patternLength && pattern[p] == '*')
+        p++;
+    return p == patternLength;
+}
+
+int RegString::CompareFoldScalar(const Char *a, size_t aLength, const Char *b, size_t bLength)
+{
+    size_t length = aLength < bLength ? aLength : bLength;
+    for (size_t i = 0; i < length; i++)
+    {
+        Char fa = FoldChar(a[i]);
+        Char fb = FoldChar(b[i]);
+        if (fa != fb)
+            return fa < fb ? -1 : 1;
+    }
+    return aLength == bLength ? 0 : (aLength < bLength ? -1 : 1);
+}
+
+uint32_t RegString::HashFoldScalar(const Char *str, size_t length)
+{
+    FoldHasher hasher(length);
+    Char folded[HashChunk];
+    for (size_t i = 0; i < length; i += HashChunk)
+    {
+        size_t count = length - i < HashChunk ? length - i : HashChunk;
+        FoldScalar(str + i, folded, count);
+        hasher.Update(folded, count);
+    }
+    return hasher.Finish();
+}
+
+const char *RegString::GetKernelName()
+{
+    return kernels.name;
+}
+
+std::vector<const char *> RegString::GetKernelNames()
+{
+    std::vector<const char *> names;
+    for (const FoldKernels &available : availableKernels)
+        names.push_back(available.name);
+    return names;
+}
+
+bool RegString::UseKernel(const char *name)
+{
+    for (const FoldKernels &available : availableKernels)
+    {
+        if (strcmp(available.name, name) == 0)
+        {
+            kernels = available;
+            return true;
+        }
+    }
+    return false;
+}
+
+size_t RegString::FindNull(const void *units, size_t length)
+{
+    const BYTE *bytes = static_cast<const BYTE *>(units);
+    size_t i = kernels.skipNonZero(bytes, length);
+    for (; i < length; i++)
+    {
+        Char c;
+        memcpy(&c, bytes + i * sizeof(Char), sizeof(Char));
+        if (c == 0)
+            break;
+    }
+    return i;
+}
+
+size_t RegString::FindNullScalar(const void *units, size_t length)
+{
+    const BYTE *bytes = static_cast<const BYTE *>(units);
+    size_t i = 0;
+    for (; i < length; i++)
+    {
+        Char c;
+        memcpy(&c, bytes + i * sizeof(Char), sizeof(Char));
+        if (c == 0)
+            break;
+    }
+    return i;
+}
@@ -0,0 +1,204 @@
+#include "RegThreadPool.h"
+#include <algorithm>
+#include <chrono>
+#include <new>
+
+namespace
+{
+    thread_local RegThreadPool *currentPool = nullptr;
+    thread_local size_t currentWorker = 0;
+}
+
+RegThreadPool &RegThreadPool::Shared()
+{
+    // Never destroyed: workers may still be blocked in a registry call when the process exits.
+    static RegThreadPool *pool = new RegThreadPool(std::max<size_t>(std::thread::hardware_concurrency(), 4));
+    return *pool;
+}
+
+RegThreadPool::RegThreadPool(size_t threadCount)
+    : _queued(0)
+    , _nextWorker(0)
+    , _stopping(false)
+{
+    if (threadCount == 0)
+        threadCount = 1;
+    for (size_t i = 0; i < threadCount; i++)
+        _workers.emplace_back(new Worker());
+    for (size_t i = 0; i < threadCount; i++)
+        _threads.emplace_back(&RegThreadPool::_Run, this, i);
+}
+
+RegThreadPool::~RegThreadPool()
+{
+    {
+        std::lock_guard<std::mutex> lock(_sleepMutex);
+        _stopping = true;
+    }
+    _wake.notify_all();
+    for (auto it = _threads.begin(); it != _threads.end(); it++)
+        it->join();
+}
+
+void RegThreadPool::Submit(Task task)
+{
+    if (currentPool == this)
+    {
+        Worker &worker = *_workers[currentWorker];
+        std::lock_guard<std::mutex> lock(worker.mutex);
+        worker.tasks.push_front(std::move(task));
+    }
+    else
+    {
+        Worker &worker = *_workers[_nextWorker.fetch_add(1, std::memory_order_relaxed) % _workers.size()];
+        std::lock_guard<std::mutex> lock(worker.mutex);
+        worker.tasks.push_back(std::move(task));
+    }
+
+    _queued.fetch_add(1, std::memory_order_release);
+    {
+        // Pairs with the predicate check in _Run so the wake-up cannot be lost.
+        std::lock_guard<std::mutex> lock(_sleepMutex);
+    }
+    _wake.notify_one();
+}
+
+bool RegThreadPool::RunPending()
+{
+    Task task;
+    if (!_Pop(currentPool == this ? currentWorker : 0, task))
+        return false;
+    task();
+    return true;
+}
+
+bool RegThreadPool::_Pop(size_t index, Task &task)
+{
+    {
+        Worker &own = *_workers[index];
+        std::lock_guard<std::mutex> lock(own.mutex);
+        if (!own.tasks.empty())
+        {
+            task = std::move(own.tasks.front());
+            own.tasks.pop_front();
+            _queued.fetch_sub(1, std::memory_order_relaxed);
+            return true;
+        }
+    }
+
+    for (size_t i = 1; i < _workers.size(); i++)
+    {
+        Worker &victim = *_workers[(index + i) % _workers.size()];
+        std::lock_guard<std::mutex> lock(victim.mutex);
+        if (!victim.tasks.empty())
+        {
+            task = std::move(victim.tasks.back());
+            victim.tasks.pop_back();
+            _queued.fetch_sub(1, std::memory_order_relaxed);
+            return true;
+        }
+    }
+    return false;
+}
+
+void RegThreadPool::_Run(size_t index)
+{
+    currentPool = this;
+    currentWorker = index;
+
+    for (;;)
+    {
+        Task task;
+        if (_Pop(index, task))
+        {
+            task();
+            continue;
+        }
+
+        std::unique_lock<std::mutex> lock(_sleepMutex);
+        _wake.wait(lock, [this]() {
+            return _stopping || _queued.load(std::memory_order_acquire) > 0;
+        });
+        if (_stopping && _queued.load(std::memory_order_acquire) == 0)
+            return;
+    }
+}
+
+RegTaskGroup::RegTaskGroup(RegThreadPool &pool)
+    : _pool(pool)
+    , _pending(0)
+    , _cancelled(false)
+    , _failure(ERROR_SUCCESS)
+{
+}
+
+void RegTaskGroup::Run(RegThreadPool::Task task)
+{
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _pending++;
+    }
+    _pool.Submit([this, task]() {
+        if (!IsCancelled())
+        {
+            try
+            {
+                task();
+            }
+            catch (const std::bad_alloc &)
+            {
+                _Fail(ERROR_NOT_ENOUGH_MEMORY);
+            }
+            catch (...)
+            {
+                _Fail(ERROR_INTERNAL_ERROR);
+            }
+        }
+        _Finish();
+    });
+}
+
+void RegTaskGroup::Wait()
+{
+    std::unique_lock<std::mutex> lock(_mutex);
+    while (_pending > 0)
+    {
+        lock.unlock();
+        bool ran = _pool.RunPending();
+        lock.lock();
+        if (!ran && _pending > 0)
+            _finished.wait_for(lock, std::chrono::milliseconds(1));
+    }
+}
+
+LSTATUS RegTaskGroup::GetStatus()
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    if (_failure != ERROR_SUCCESS)
+        return _failure;
+    return IsCancelled() ? ERROR_CANCELLED : ERROR_SUCCESS;
+}
+
+void RegTaskGroup::_Fail(LSTATUS status)
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    if (_failure == ERROR_SUCCESS)
+        _failure = status;
+}
+
+void RegTaskGroup::_Finish()
+{
+    DoneCallback done;
+    LSTATUS status;
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        if (--_pending > 0)
+            return;
+        done = _done;
+        status = _failure != ERROR_SUCCESS ? _failure : (IsCancelled() ? ERROR_CANCELLED : ERROR_SUCCESS);
+        _finished.notify_all();
+    }
+    // The group may be destroyed by a waiter from here on; only the local copies are used.
+    if (done)
+        done(status);
+}
@@ -0,0 +1,432 @@
+#include "RegTrace.h"
+#include <algorithm>
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+std::atomic<bool> RegTrace::enabled(false);
+
+namespace
+{
+    struct TraceSlot
+    {
+        // Odd while the owning thread is writing the slot (seqlock).
+        std::atomic<uint32_t> sequence;
+        RegTraceEvent event;
+    };
+
+    class TraceRing
+    {
+    public:
+        TraceRing(size_t capacity, uint32_t generation, uint32_t threadId)
+            : _slots(new TraceSlot[capacity])
+            , _mask(capacity - 1)
+            , _head(0)
+            , _generation(generation)
+            , _threadId(threadId)
+        {
+            for (size_t i = 0; i < capacity; i++)
+                _slots[i].sequence.store(0, std::memory_order_relaxed);
+        }
+
+        uint32_t GetGeneration() const
+        {
+            return _generation;
+        }
+
+        uint32_t GetThreadId() const
+        {
+            return _threadId;
+        }
+
+        // Only called by the thread owning the ring.
+        void Push(RegTraceOp op, HKEY hKey, uint32_t path, const Char *name, LSTATUS status, uint64_t begin, uint64_t end)
+        {
+            uint64_t head = _head.load(std::memory_order_relaxed);
+            TraceSlot &slot = _slots[head & _mask];
+            uint32_t sequence = slot.sequence.load(std::memory_order_relaxed);
+            slot.sequence.store(sequence + 1, std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_release);
+
+            RegTraceEvent &event = slot.event;
+            event.begin = begin;
+            event.end = end;
+            event.key = uint64_t(uintptr_t(hKey));
+            event.path = path;
+            event.status = int32_t(status);
+            event.op = op;
+            size_t length = 0;
+            if (name != nullptr)
+            {
+                while (length < RegTraceNameCapacity && name[length] != 0)
+                {
+                    event.name[length] = name[length];
+                    length++;
+                }
+            }
+            event.nameLength = uint8_t(length);
+
+            slot.sequence.store(sequence + 2, std::memory_order_release);
+            _head.store(head + 1, std::memory_order_release);
+        }
+
+        // May run concurrently with Push; slots being overwritten are skipped.
+        void Collect(std::vector<std::pair<uint32_t, RegTraceEvent>> &events) const
+        {
+            uint64_t head = _head.load(std::memory_order_acquire);
+            uint64_t capacity = _mask + 1;
+            uint64_t first = head > capacity ? head - capacity : 0;
+            for (uint64_t i = first; i < head; i++)
+            {
+                const TraceSlot &slot = _slots[i & _mask];
+                uint32_t before = slot.sequence.load(std::memory_order_acquire);
+                if (before & 1)
+                    continue;
+                RegTraceEvent event = slot.event;
+                std::atomic_thread_fence(std::memory_order_acquire);
+                if (slot.sequence.load(std::memory_order_relaxed) != before)
+                    continue;
+                events.emplace_back(_threadId, event);
+            }
+        }
+
+    private:
+        std::unique_ptr<TraceSlot[]> _slots;
+        uint64_t _mask;
+        std::atomic<uint64_t> _head;
+        uint32_t _generation;
+        uint32_t _threadId;
+    };
+
+    std::mutex ringsMutex;
+    std::vector<std::shared_ptr<TraceRing>> rings;
+    std::atomic<uint32_t> ringGeneration(0);
+    std::atomic<size_t> ringCapacity(4096);
+    std::atomic<uint32_t> nextThreadId(1);
+
+    thread_local std::shared_ptr<TraceRing> localRing;
+    thread_local uint32_t localThreadId = 0;
+
+    // Paths of the handles named while tracing is on, and the table events refer to them by.
+    // Index 0 of the table is the empty path of handles that were not named.
+    std::mutex pathsMutex;
+    std::unordered_map<uintptr_t, String> keyPaths;
+    std::unordered_map<String, uint32_t> pathIds;
+    std::vector<String> paths(1);
+
+    const std::pair<HKEY, const Char *> rootNames[] = {
+        {HKEY_CLASSES_ROOT, STR("HKEY_CLASSES_ROOT")},
+        {HKEY_CURRENT_USER, STR("HKEY_CURRENT_USER")},
+        {HKEY_LOCAL_MACHINE, STR("HKEY_LOCAL_MACHINE")},
+        {HKEY_USERS, STR("HKEY_USERS")},
+        {HKEY_PERFORMANCE_DATA, STR("HKEY_PERFORMANCE_DATA")},
+        {HKEY_CURRENT_CONFIG, STR("HKEY_CURRENT_CONFIG")},
+    };
+
+    // Called with pathsMutex held.
+    String FindKeyPath(HKEY hKey)
+    {
+        for (const auto &root : rootNames)
+        {
+            if (root.first == hKey)
+                return root.second;
+        }
+        auto it = keyPaths.find(uintptr_t(hKey));
+        return it != keyPaths.end() ? it->second : String();
+    }
+
+    // Called with pathsMutex held.
+    uint32_t GetPathId(const String &path)
+    {
+        if (path.empty())
+            return 0;
+        auto it = pathIds.find(path);
+        if (it != pathIds.end())
+            return it->second;
+        uint32_t id = uint32_t(paths.size());
+        paths.push_back(path);
+        pathIds.emplace(path, id);
+        return id;
+    }
+
+    // Events recorded before are dropped with their rings, so their path ids go too.
+    void ClearPaths()
+    {
+        std::lock_guard<std::mutex> lock(pathsMutex);
+        paths.assign(1, String());
+        pathIds.clear();
+    }
+
+    const std::chrono::steady_clock::time_point traceEpoch = std::chrono::steady_clock::now();
+
+    TraceRing *AcquireLocalRing()
+    {
+        uint32_t generation = ringGeneration.load(std::memory_order_acquire);
+        if (localRing && localRing->GetGeneration() == generation)
+            return localRing.get();
+
+        if (localThreadId == 0)
+            localThreadId = nextThreadId.fetch_add(1, std::memory_order_relaxed);
+
+        std::lock_guard<std::mutex> lock(ringsMutex);
+        localRing = std::make_shared<TraceRing>(ringCapacity.load(std::memory_order_relaxed),
+                                                generation, localThreadId);
+        rings.push_back(localRing);
+        return localRing.get();
+    }
+
+    void AppendUtf8(std::string &out, uint32_t codePoint)
+    {
+        if (codePoint < 0x80)
+            out += char(codePoint);
+        else if (codePoint < 0x800)
+        {
+            out += char(0xC0 | (codePoint >> 6));
+            out += char(0x80 | (codePoint & 0x3F));
+        }
+        else if (codePoint < 0x10000)
+        {
+            out += char(0xE0 | (codePoint >> 12));
+            out += char(0x80 | ((codePoint >> 6) & 0x3F));
+            out += char(0x80 | (codePoint & 0x3F));
+        }
+        else
+        {
+            out += char(0xF0 | (codePoint >> 18));
+            out += char(0x80 | ((codePoint >> 12) & 0x3F));
+            out += char(0x80 | ((codePoint >> 6) & 0x3F));
+            out += char(0x80 | (codePoint & 0x3F));
+        }
+    }
+
+    // Nanoseconds as microseconds with three decimals, exactly.
+    void AppendMicroseconds(std::string &out, uint64_t nanoseconds)
+    {
+        std::string fraction = std::to_string(nanoseconds % 1000);
+        out += std::to_string(nanoseconds / 1000);
+        out += '.';
+        out.append(3 - fraction.size(), '0');
+        out += fraction;
+    }
+
+    void AppendHex(std::string &out, uint64_t value)
+    {
+        const char digits[] = "0123456789abcdef";
+        char text[16];
+        size_t length = 0;
+        do
+        {
+            text[length++] = digits[value & 0xF];
+            value >>= 4;
+        } while (value != 0);
+        while (length > 0)
+            out += text[--length];
+    }
+
+    void AppendJsonString(std::string &out, const Char *str, size_t length)
+    {
+        out += '"';
+        for (size_t i = 0; i < length; i++)
+        {
+            uint32_t c = uint16_t(str[i]);
+            if (c >= 0xD800 && c <= 0xDBFF && i + 1 < length &&
+                uint16_t(str[i + 1]) >= 0xDC00 && uint16_t(str[i + 1]) <= 0xDFFF)
+            {
+                c = 0x10000 + ((c - 0xD800) << 10) + (uint16_t(str[++i]) - 0xDC00);
+                AppendUtf8(out, c);
+            }
+            else if (c >= 0xD800 && c <= 0xDFFF)
+                AppendUtf8(out, 0xFFFD);
+            else if (c == '"' || c == '\\')
+            {
+                out += '\\';
+                out += char(c);
+            }
+            else if (c < 0x20)
+            {
+                char escaped[8];
+                snprintf(escaped, sizeof(escaped), "\\u%04x", unsigned(c));
+                out += escaped;
+            }
+            else
+                AppendUtf8(out, c);
+        }
+        out += '"';
+    }
+}
+
+void RegTrace::Enable(size_t capacityPerThread)
+{
+    size_t capacity = 16;
+    while (capacity < capacityPerThread)
+        capacity <<= 1;
+
+    std::lock_guard<std::mutex> lock(ringsMutex);
+    ringCapacity.store(capacity, std::memory_order_relaxed);
+    ringGeneration.fetch_add(1, std::memory_order_release);
+    rings.clear();
+    ClearPaths();
+    enabled.store(true, std::memory_order_relaxed);
+}
+
+void RegTrace::Disable()
+{
+    enabled.store(false, std::memory_order_relaxed);
+    // Handles closed from now on are not seen, so their values could be reused under a stale path.
+    std::lock_guard<std::mutex> lock(pathsMutex);
+    keyPaths.clear();
+}
+
+void RegTrace::Clear()
+{
+    std::lock_guard<std::mutex> lock(ringsMutex);
+    ringGeneration.fetch_add(1, std::memory_order_release);
+    rings.clear();
+    ClearPaths();
+}
+
+const char *RegTrace::GetOpName(RegTraceOp op)
+{
+    switch (op)
+    {
+    case RegTraceOp::OpenKey:
+        return "OpenKey";
+    case RegTraceOp::CreateKey:
+        return "CreateKey";
+    case RegTraceOp::ConnectRegistry:
+        return "ConnectRegistry";
+    case RegTraceOp::CloseKey:
+        return "CloseKey";
+    case RegTraceOp::FlushKey:
+        return "FlushKey";
+    case RegTraceOp::CopyTree:
+        return "CopyTree";
+    case RegTraceOp::RenameKey:
+        return "RenameKey";
+    case RegTraceOp::DeleteTree:
+        return "DeleteTree";
+    case RegTraceOp::DeleteKey:
+        return "DeleteKey";
+    case RegTraceOp::QueryInfoKey:
+        return "QueryInfoKey";
+    case RegTraceOp::EnumKey:
+        return "EnumKey";
+    case RegTraceOp::EnumValue:
+        return "EnumValue";
+    case RegTraceOp::QueryValue:
+        return "QueryValue";
+    case RegTraceOp::SetValue:
+        return "SetValue";
+    case RegTraceOp::DeleteValue:
+        return "DeleteValue";
+    default:
+        return "Unknown";
+    }
+}
+
+uint64_t RegTrace::Now()
+{
+    return uint64_t(std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now() - traceEpoch).count());
+}
+
+void RegTrace::Record(RegTraceOp op, HKEY hKey, const Char *name, LSTATUS status, uint64_t begin, uint64_t end)
+{
+    uint32_t path;
+    {
+        std::lock_guard<std::mutex> lock(pathsMutex);
+        path = GetPathId(FindKeyPath(hKey));
+        if (op == RegTraceOp::CloseKey && status == ERROR_SUCCESS)
+            keyPaths.erase(uintptr_t(hKey));
+    }
+    AcquireLocalRing()->Push(op, hKey, path, name, status, begin, end);
+}
+
+void RegTrace::NameKey(HKEY hKey, const String &path)
+{
+    if (!IsEnabled() || hKey == NULL)
+        return;
+    std::lock_guard<std::mutex> lock(pathsMutex);
+    keyPaths[uintptr_t(hKey)] = path;
+}
+
+void RegTrace::NameKey(HKEY hKey, HKEY parent, const Char *subKey)
+{
+    if (!IsEnabled() || hKey == NULL)
+        return;
+    std::lock_guard<std::mutex> lock(pathsMutex);
+    String path = FindKeyPath(parent);
+    if (subKey != nullptr && subKey[0] != 0)
+    {
+        if (!path.empty())
+            path += STR('\\');
+        path += subKey;
+    }
+    keyPaths[uintptr_t(hKey)] = path;
+}
+
+String RegTrace::GetKeyPath(HKEY hKey)
+{
+    std::lock_guard<std::mutex> lock(pathsMutex);
+    return FindKeyPath(hKey);
+}
+
+std::string RegTrace::DumpChromeJson()
+{
+    std::vector<std::shared_ptr<TraceRing>> snapshot;
+    {
+        std::lock_guard<std::mutex> lock(ringsMutex);
+        snapshot = rings;
+    }
+
+    std::vector<String> pathTable;
+    {
+        std::lock_guard<std::mutex> lock(pathsMutex);
+        pathTable = paths;
+    }
+
+    std::vector<std::pair<uint32_t, RegTraceEvent>> events;
+    for (auto it = snapshot.begin(); it != snapshot.end(); it++)
+        (*it)->Collect(events);
+    std::sort(events.begin(), events.end(), [](const std::pair<uint32_t, RegTraceEvent> &a,
+                                               const std::pair<uint32_t, RegTraceEvent> &b) {
+        return a.second.begin < b.second.begin;
+    });
+
+    std::string json = "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[";
+    bool first = true;
+    for (auto it = snapshot.begin(); it != snapshot.end(); it++)
+    {
+        std::string threadId = std::to_string((*it)->GetThreadId());
+        json += first ? "" : ",";
+        json += "{\"ph\":\"M\",\"name\":\"thread_name\",\"pid\":1,\"tid\":" + threadId;
+        json += ",\"args\":{\"name\":\"regkey-" + threadId + "\"}}";
+        first = false;
+    }
+    for (auto it = events.begin(); it != events.end(); it++)
+    {
+        const RegTraceEvent &event = it->second;
+        json += first ? "" : ",";
+        json += "{\"ph\":\"X\",\"cat\":\"regkey\",\"name\":\"";
+        json += GetOpName(event.op);
+        json += "\",\"pid\":1,\"tid\":" + std::to_string(it->first) + ",\"ts\":";
+        AppendMicroseconds(json, event.begin);
+        json += ",\"dur\":";
+        AppendMicroseconds(json, event.end - event.begin);
+        json += ",\"args\":{\"status\":" + std::to_string(event.status) + ",\"key\":\"0x";
+        AppendHex(json, event.key);
+        json += "\",\"path\":";
+        // Events recorded while the table was being cleared may refer past its end.
+        const String &path = event.path < pathTable.size() ? pathTable[event.path] : pathTable[0];
+        AppendJsonString(json, path.c_str(), path.size());
+        json += ",\"name\":";
+        AppendJsonString(json, event.name, event.nameLength);
+        json += "}}";
+        first = false;
+    }
+    json += "]}";
+    return json;
+}
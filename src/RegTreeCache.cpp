@@ -0,0 +1,231 @@
+#include "RegTreeCache.h"
+#include "RegString.h"
+#include "RegFile.h"
+#include <cstdio>
+#include <cstring>
+
+namespace
+{
+    // "RKTC" read as a little-endian integer; a cache written with another byte order does not match.
+    const uint32_t CacheMagic = 0x43544B52;
+    const uint32_t CacheVersion = 1;
+
+    static_assert(sizeof(Char) == 2, "Names are stored as UTF-16 code units.");
+
+    uint32_t Checksum(const BYTE *data, size_t size)
+    {
+        // FNV-1a
+        uint32_t hash = 2166136261u;
+        for (size_t i = 0; i < size; i++)
+            hash = (hash ^ data[i]) * 16777619u;
+        return hash;
+    }
+
+    class Writer
+    {
+    public:
+        template <typename T>
+        void Put(T value)
+        {
+            const BYTE *bytes = reinterpret_cast<const BYTE *>(&value);
+            _buffer.insert(_buffer.end(), bytes, bytes + sizeof(T));
+        }
+
+        void PutBytes(const void *data, size_t size)
+        {
+            const BYTE *bytes = static_cast<const BYTE *>(data);
+            _buffer.insert(_buffer.end(), bytes, bytes + size);
+        }
+
+        void PutString(const String &str)
+        {
+            Put(uint32_t(str.size()));
+            PutBytes(str.c_str(), str.size() * sizeof(Char));
+        }
+
+        ByteArray &GetBuffer()
+        {
+            return _buffer;
+        }
+
+    private:
+        ByteArray _buffer;
+    };
+
+    // Every read is bounds-checked; once one fails, the rest fail too.
+    class Reader
+    {
+    public:
+        Reader(const BYTE *data, size_t size)
+            : _data(data)
+            , _size(size)
+            , _offset(0)
+            , _ok(true)
+        {
+        }
+
+        template <typename T>
+        T Get()
+        {
+            T value = T();
+            GetBytes(&value, sizeof(T));
+            return value;
+        }
+
+        bool GetBytes(void *data, size_t size)
+        {
+            if (!_ok || _size - _offset < size)
+                return _ok = false;
+            if (size > 0)
+                memcpy(data, _data + _offset, size);
+            _offset += size;
+            return true;
+        }
+
+        String GetString()
+        {
+            uint32_t length = Get<uint32_t>();
+            if (!_ok || (_size - _offset) / sizeof(Char) < length)
+            {
+                _ok = false;
+                return String();
+            }
+            String str(length, Char(0));
+            GetBytes(&str[0], length * sizeof(Char));
+            return str;
+        }
+
+        // Counts are checked against the bytes left, so a corrupt count cannot reserve huge amounts.
+        uint32_t GetCount(size_t minimumItemSize)
+        {
+            uint32_t count = Get<uint32_t>();
+            if (_ok && (_size - _offset) / minimumItemSize < count)
+                _ok = false;
+            return _ok ? count : 0;
+        }
+
+        bool IsOk() const
+        {
+            return _ok;
+        }
+
+        bool AtEnd() const
+        {
+            return _offset == _size;
+        }
+
+    private:
+        const BYTE *_data;
+        size_t _size;
+        size_t _offset;
+        bool _ok;
+    };
+}
+
+std::shared_ptr<RegTreeState> RegTreeCache::Load(const std::string &file, const String &source)
+{
+    FILE *fp = RegFile::Open(file, "rb");
+    if (fp == NULL)
+        return nullptr;
+
+    ByteArray buffer;
+    bool read = fseek(fp, 0, SEEK_END) == 0;
+    long size = read ? ftell(fp) : -1;
+    if (size > 0 && fseek(fp, 0, SEEK_SET) == 0)
+    {
+        buffer.resize(size_t(size));
+        read = fread(buffer.data(), 1, buffer.size(), fp) == buffer.size();
+    }
+    fclose(fp);
+    if (!read || buffer.size() < sizeof(uint32_t) * 3)
+        return nullptr;
+
+    // The checksum trails the payload.
+    size_t payloadSize = buffer.size() - sizeof(uint32_t);
+    uint32_t checksum;
+    memcpy(&checksum, buffer.data() + payloadSize, sizeof(checksum));
+    if (checksum != Checksum(buffer.data(), payloadSize))
+        return nullptr;
+
+    Reader reader(buffer.data(), payloadSize);
+    if (reader.Get<uint32_t>() != CacheMagic || reader.Get<uint32_t>() != CacheVersion)
+        return nullptr;
+    if (!reader.IsOk() || reader.GetString() != source)
+        return nullptr;
+
+    std::shared_ptr<RegTreeState> state = std::make_shared<RegTreeState>();
+    // A key takes at least its path length, time and two counts.
+    uint32_t keyCount = reader.GetCount(sizeof(uint32_t) * 3 + sizeof(QWORD));
+    state->keys.reserve(keyCount);
+    for (uint32_t i = 0; i < keyCount && reader.IsOk(); i++)
+    {
+        RegTreeState::Key key;
+        key.path = reader.GetString();
+        key.lastWriteTime = reader.Get<QWORD>();
+
+        uint32_t subKeyCount = reader.GetCount(sizeof(uint32_t));
+        key.subKeys.reserve(subKeyCount);
+        for (uint32_t j = 0; j < subKeyCount && reader.IsOk(); j++)
+            key.subKeys.push_back(reader.GetString());
+
+        uint32_t valueCount = reader.GetCount(sizeof(uint32_t) * 3);
+        key.values.resize(valueCount);
+        for (uint32_t j = 0; j < valueCount && reader.IsOk(); j++)
+        {
+            RegValue &value = key.values[j];
+            value.name = reader.GetString();
+            value.type = reader.Get<uint32_t>();
+            uint32_t dataSize = reader.GetCount(1);
+            value.data.resize(dataSize);
+            reader.GetBytes(value.data.data(), dataSize);
+        }
+
+        String folded = RegString::Fold(key.path);
+        state->keys[folded] = std::move(key);
+    }
+
+    if (!reader.IsOk() || !reader.AtEnd())
+        return nullptr;
+    return state;
+}
+
+bool RegTreeCache::Save(const std::string &file, const String &source, const RegTreeState &state)
+{
+    Writer writer;
+    writer.Put(CacheMagic);
+    writer.Put(CacheVersion);
+    writer.PutString(source);
+    writer.Put(uint32_t(state.keys.size()));
+    for (auto it = state.keys.begin(); it != state.keys.end(); it++)
+    {
+        const RegTreeState::Key &key = it->second;
+        writer.PutString(key.path);
+        writer.Put(QWORD(key.lastWriteTime));
+        writer.Put(uint32_t(key.subKeys.size()));
+        for (auto subKey = key.subKeys.begin(); subKey != key.subKeys.end(); subKey++)
+            writer.PutString(*subKey);
+        writer.Put(uint32_t(key.values.size()));
+        for (auto value = key.values.begin(); value != key.values.end(); value++)
+        {
+            writer.PutString(value->name);
+            writer.Put(uint32_t(value->type));
+            writer.Put(uint32_t(value->data.size()));
+            writer.PutBytes(value->data.data(), value->data.size());
+        }
+    }
+    ByteArray &buffer = writer.GetBuffer();
+    writer.Put(Checksum(buffer.data(), buffer.size()));
+
+    std::string temporary = file + ".tmp";
+    FILE *fp = RegFile::Open(temporary, "wb");
+    if (fp == NULL)
+        return false;
+    bool written = fwrite(buffer.data(), 1, buffer.size(), fp) == buffer.size();
+    written = fclose(fp) == 0 && written;
+    if (!written || !RegFile::Replace(temporary, file))
+    {
+        RegFile::Remove(temporary);
+        return false;
+    }
+    return true;
+}
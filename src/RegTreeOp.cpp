@@ -0,0 +1,338 @@
+#include "RegTreeOp.h"
+#include "RegString.h"
+#include <algorithm>
+
+std::shared_ptr<RegTreeOp> RegTreeOp::Create(RegTreeOpKind kind,
+                                             RegKey &&source,
+                                             RegKey &&dest,
+                                             const RegTreeOpOptions &options,
+                                             ProgressCallback onProgress,
+                                             DoneCallback onDone,
+                                             unsigned progressInterval)
+{
+    return std::shared_ptr<RegTreeOp>(new RegTreeOp(kind, std::move(source), std::move(dest), options,
+                                                    std::move(onProgress), std::move(onDone), progressInterval));
+}
+
+RegTreeOp::RegTreeOp(RegTreeOpKind kind, RegKey &&source, RegKey &&dest, const RegTreeOpOptions &options,
+                     ProgressCallback onProgress, DoneCallback onDone, unsigned progressInterval)
+    : _kind(kind)
+    , _source(std::move(source))
+    , _dest(std::move(dest))
+    , _options(options)
+    , _onProgress(std::move(onProgress))
+    , _onDone(std::move(onDone))
+    , _progressInterval(progressInterval)
+    , _closed(false)
+    , _readStatus(ERROR_SUCCESS)
+    , _progress()
+    , _lastReport(std::chrono::steady_clock::now())
+    , _status(ERROR_SUCCESS)
+    , _skipped(0)
+{
+    if (_options.queueSize == 0)
+        _options.queueSize = 1;
+    for (auto it = _options.resume.begin(); it != _options.resume.end(); it++)
+        _resume.insert(RegString::Fold(*it));
+}
+
+void RegTreeOp::Start()
+{
+    std::shared_ptr<RegTreeOp> self = shared_from_this();
+    // Running tasks hold a reference, so `this` outlives the last reader.
+    _group.OnDone([this](LSTATUS status) {
+        _Close(status);
+    });
+    std::thread([self]() {
+        self->_Write();
+    }).detach();
+    _group.Run([self]() {
+        self->_Read(STR(""), false);
+    });
+}
+
+void RegTreeOp::Cancel()
+{
+    _group.Cancel();
+    {
+        std::lock_guard<std::mutex> lock(_queueMutex);
+    }
+    _notFull.notify_all();
+    _notEmpty.notify_all();
+}
+
+bool RegTreeOp::_MatchAny(const std::vector<String> &patterns, const String &text) const
+{
+    for (auto it = patterns.begin(); it != patterns.end(); it++)
+    {
+        if (RegString::MatchPattern(*it, text))
+            return true;
+    }
+    return false;
+}
+
+bool RegTreeOp::_Push(Item &&item)
+{
+    std::unique_lock<std::mutex> lock(_queueMutex);
+    _notFull.wait(lock, [this]() {
+        return _queue.size() < _options.queueSize || IsCancelled();
+    });
+    if (IsCancelled())
+        return false;
+    _queue.push_back(std::move(item));
+    _notEmpty.notify_one();
+    return true;
+}
+
+bool RegTreeOp::_Pop(Item &item)
+{
+    std::unique_lock<std::mutex> lock(_queueMutex);
+    _notEmpty.wait(lock, [this]() {
+        return !_queue.empty() || _closed;
+    });
+    if (_queue.empty())
+        return false;
+    item = std::move(_queue.front());
+    _queue.pop_front();
+    _notFull.notify_one();
+    return true;
+}
+
+void RegTreeOp::_Close(LSTATUS readStatus)
+{
+    {
+        std::lock_guard<std::mutex> lock(_queueMutex);
+        _closed = true;
+        _readStatus = readStatus == ERROR_CANCELLED ? ERROR_SUCCESS : readStatus;
+    }
+    _notEmpty.notify_all();
+}
+
+void RegTreeOp::_Read(const String &path, bool selected)
+{
+    // The root handle is shared by all readers and only borrowed here.
+    RegKey key(_source.GetBackend());
+    if (path.empty())
+        key.Attach(_source.GetHandle());
+    else if (key.Open(_source.GetHandle(), path, KEY_READ) == NULL)
+    {
+        _skipped.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+
+    selected = selected || _options.include.empty() || _MatchAny(_options.include, path);
+    if (selected)
+    {
+        Item item;
+        item.path = path;
+        item.keep = false;
+        if (_kind == RegTreeOpKind::Delete)
+        {
+            std::vector<String> names = key.GetValueNames();
+            for (auto it = names.begin(); it != names.end(); it++)
+            {
+                if (_MatchAny(_options.excludeValues, *it))
+                    item.keep = true;
+                else
+                    item.values.push_back({*it, REG_NONE, ByteArray()});
+            }
+        }
+        else
+        {
+            std::vector<RegValue> values = key.GetValues();
+            for (auto it = values.begin(); it != values.end(); it++)
+            {
+                if (_MatchAny(_options.excludeValues, it->name))
+                    item.keep = true;
+                else
+                    item.values.push_back(std::move(*it));
+            }
+        }
+
+        if (!_Push(std::move(item)))
+        {
+            if (path.empty())
+                key.Detach();
+            return;
+        }
+    }
+
+    std::vector<String> subKeys = key.GetSubKeyNames();
+    if (path.empty())
+        key.Detach();
+
+    std::shared_ptr<RegTreeOp> self = shared_from_this();
+    for (auto it = subKeys.begin(); it != subKeys.end() && !IsCancelled(); it++)
+    {
+        String subPath = path.empty() ? *it : path + STR('\\') + *it;
+        if (_MatchAny(_options.exclude, subPath))
+            continue;
+        _group.Run([self, subPath, selected]() {
+            self->_Read(subPath, selected);
+        });
+    }
+}
+
+void RegTreeOp::_Write()
+{
+    Item item;
+    while (_Pop(item))
+    {
+        // Once failed or cancelled, keep draining so blocked readers can finish.
+        if (_status != ERROR_SUCCESS || IsCancelled())
+            continue;
+
+        if (_kind != RegTreeOpKind::Delete)
+        {
+            if (!_WriteItem(item))
+                continue;
+            if (_kind == RegTreeOpKind::Copy)
+                continue;
+            // Only the names are needed to delete the source afterwards.
+            for (auto it = item.values.begin(); it != item.values.end(); it++)
+                ByteArray().swap(it->data);
+        }
+        _visited.push_back(std::move(item));
+        _Report(false);
+    }
+
+    // A reader that failed left part of the tree unread, so nothing may be deleted.
+    if (_readStatus != ERROR_SUCCESS && _status == ERROR_SUCCESS)
+        _status = _readStatus;
+    if (_kind != RegTreeOpKind::Copy && _status == ERROR_SUCCESS && !IsCancelled())
+        _DeleteItems();
+
+    RegTreeOpResult result;
+    result.status = _status != ERROR_SUCCESS ? _status : (IsCancelled() ? ERROR_CANCELLED : ERROR_SUCCESS);
+    result.failedPath = _failedPath;
+    if (result.status != ERROR_SUCCESS)
+        result.completed = std::move(_completed);
+    _Report(true);
+    result.progress = _progress;
+    result.progress.skipped = _skipped.load(std::memory_order_relaxed);
+    _onDone(std::move(result));
+}
+
+bool RegTreeOp::_WriteItem(const Item &item)
+{
+    RegKey key(_dest.GetBackend());
+    if (item.path.empty())
+        key.Attach(_dest.GetHandle());
+    else if (key.Create(_dest.GetHandle(), item.path, KEY_WRITE) == NULL)
+    {
+        _Fail(key.GetLastStatus(), item.path);
+        return false;
+    }
+
+    bool success = true;
+    if (_resume.find(RegString::Fold(item.path)) == _resume.end())
+    {
+        for (auto it = item.values.begin(); it != item.values.end(); it++)
+        {
+            if (!key.PutValue(*it))
+            {
+                _Fail(key.GetLastStatus(), item.path);
+                success = false;
+                break;
+            }
+            _progress.values++;
+            _progress.bytes += it->data.size();
+            _Report(false);
+        }
+    }
+
+    if (item.path.empty())
+        key.Detach();
+    if (!success)
+        return false;
+    _progress.keys++;
+    _completed.push_back(item.path);
+    return true;
+}
+
+void RegTreeOp::_DeleteItems()
+{
+    // Children first; a parent whose child was kept cannot be deleted and only loses its values.
+    std::stable_sort(_visited.begin(), _visited.end(), [](const Item &a, const Item &b) {
+        return std::count(a.path.begin(), a.path.end(), Char('\\')) >
+               std::count(b.path.begin(), b.path.end(), Char('\\'));
+    });
+
+    bool counting = _kind == RegTreeOpKind::Delete;
+    for (auto it = _visited.begin(); it != _visited.end() && !IsCancelled(); it++)
+    {
+        if (!it->path.empty() && !it->keep)
+        {
+            RegKey root(_source.GetBackend(), _source.GetHandle());
+            bool deleted = root.DeleteTree(it->path);
+            LSTATUS status = root.GetLastStatus();
+            root.Detach();
+            if (deleted || status == ERROR_FILE_NOT_FOUND || status == ERROR_KEY_DELETED)
+            {
+                if (counting)
+                {
+                    _progress.keys++;
+                    _progress.values += it->values.size();
+                    _Report(false);
+                }
+                continue;
+            }
+        }
+
+        RegKey key(_source.GetBackend());
+        if (it->path.empty())
+            key.Attach(_source.GetHandle());
+        else if (key.Open(_source.GetHandle(), it->path, KEY_WRITE) == NULL)
+        {
+            _Fail(key.GetLastStatus(), it->path);
+            return;
+        }
+        bool success = _DeleteValues(key, *it);
+        if (it->path.empty())
+            key.Detach();
+        if (!success)
+            return;
+    }
+}
+
+bool RegTreeOp::_DeleteValues(RegKey &key, const Item &item)
+{
+    for (auto it = item.values.begin(); it != item.values.end(); it++)
+    {
+        if (!key.DeleteValue(it->name) && key.GetLastStatus() != ERROR_FILE_NOT_FOUND)
+        {
+            _Fail(key.GetLastStatus(), item.path);
+            return false;
+        }
+        if (_kind == RegTreeOpKind::Delete)
+        {
+            _progress.values++;
+            _Report(false);
+        }
+    }
+    return true;
+}
+
+void RegTreeOp::_Fail(LSTATUS status, const String &path)
+{
+    if (_status == ERROR_SUCCESS)
+    {
+        _status = status;
+        _failedPath = path;
+    }
+    Cancel();
+}
+
+void RegTreeOp::_Report(bool force)
+{
+    auto now = std::chrono::steady_clock::now();
+    if (!force && now - _lastReport < std::chrono::milliseconds(_progressInterval))
+        return;
+    _lastReport = now;
+    if (_onProgress)
+    {
+        RegTreeOpProgress progress = _progress;
+        progress.skipped = _skipped.load(std::memory_order_relaxed);
+        _onProgress(progress);
+    }
+}
@@ -0,0 +1,152 @@
+#include "RegTreeSync.h"
+#include "RegString.h"
+
+namespace
+{
+    struct SyncContext
+    {
+        const RegTreeState *previous;
+        RegTreeState *state;
+        std::vector<RegTreeChange> *changes;
+        RegTreeSyncStats stats;
+    };
+
+    String JoinPath(const String &parent, const String &name)
+    {
+        return parent.empty() ? name : parent + STR('\\') + name;
+    }
+
+    void AddChange(SyncContext &context, RegTreeChangeKind kind, const String &path, const RegValue &value = RegValue())
+    {
+        RegTreeChange change;
+        change.kind = kind;
+        change.path = path;
+        change.value = value;
+        context.changes->push_back(std::move(change));
+    }
+
+    const RegTreeState::Key *FindPrevious(const SyncContext &context, const String &folded)
+    {
+        if (context.previous == nullptr)
+            return nullptr;
+        auto it = context.previous->keys.find(folded);
+        return it != context.previous->keys.end() ? &it->second : nullptr;
+    }
+
+    // Reports a recorded key and everything below it as removed, deepest keys first.
+    void RemoveSubtree(SyncContext &context, const String &folded)
+    {
+        const RegTreeState::Key *key = FindPrevious(context, folded);
+        if (key == nullptr)
+            return;
+        for (auto it = key->subKeys.begin(); it != key->subKeys.end(); it++)
+            RemoveSubtree(context, JoinPath(folded, RegString::Fold(*it)));
+        AddChange(context, RegTreeChangeKind::KeyRemoved, key->path);
+    }
+
+    void DiffValues(SyncContext &context, const String &path, const std::vector<RegValue> &before,
+                    const std::vector<RegValue> &after)
+    {
+        std::unordered_map<String, const RegValue *> old;
+        for (auto it = before.begin(); it != before.end(); it++)
+            old[RegString::Fold(it->name)] = &*it;
+
+        for (auto it = after.begin(); it != after.end(); it++)
+        {
+            auto found = old.find(RegString::Fold(it->name));
+            if (found == old.end())
+                AddChange(context, RegTreeChangeKind::ValueSet, path, *it);
+            else
+            {
+                if (found->second->type != it->type || found->second->data != it->data)
+                    AddChange(context, RegTreeChangeKind::ValueSet, path, *it);
+                old.erase(found);
+            }
+        }
+        for (auto it = before.begin(); it != before.end(); it++)
+        {
+            if (old.count(RegString::Fold(it->name)) == 0)
+                continue;
+            RegValue removed;
+            removed.name = it->name;
+            removed.type = REG_NONE;
+            AddChange(context, RegTreeChangeKind::ValueRemoved, path, removed);
+        }
+    }
+
+    bool Visit(SyncContext &context, RegKey &key, const String &path, const String &folded)
+    {
+        RegKeyInfo info;
+        if (!key.QueryInfo(&info))
+            return false;
+        context.stats.visited++;
+
+        const RegTreeState::Key *previous = FindPrevious(context, folded);
+        RegTreeState::Key &current = context.state->keys[folded];
+        current.path = path;
+        current.lastWriteTime = info.lastWriteTime;
+
+        if (previous != nullptr && previous->lastWriteTime == info.lastWriteTime)
+        {
+            current.subKeys = previous->subKeys;
+            current.values = previous->values;
+        }
+        else
+        {
+            context.stats.reread++;
+            current.subKeys = key.GetSubKeyNames();
+            current.values = key.GetValues();
+            if (previous == nullptr)
+            {
+                // The root of a first pass is not news; new keys below it are.
+                if (context.previous != nullptr || !path.empty())
+                    AddChange(context, RegTreeChangeKind::KeyAdded, path);
+                DiffValues(context, path, std::vector<RegValue>(), current.values);
+            }
+            else
+            {
+                DiffValues(context, path, previous->values, current.values);
+                std::unordered_map<String, bool> kept;
+                for (auto it = current.subKeys.begin(); it != current.subKeys.end(); it++)
+                    kept[RegString::Fold(*it)] = true;
+                for (auto it = previous->subKeys.begin(); it != previous->subKeys.end(); it++)
+                {
+                    if (kept.count(RegString::Fold(*it)) == 0)
+                        RemoveSubtree(context, JoinPath(folded, RegString::Fold(*it)));
+                }
+            }
+        }
+
+        // Elements of an unordered_map stay in place as it grows, so `current` outlives the recursion.
+        for (auto it = current.subKeys.begin(); it != current.subKeys.end();)
+        {
+            RegKey subKey(key.GetBackend());
+            String subFolded = JoinPath(folded, RegString::Fold(*it));
+            if (subKey.Open(key.GetHandle(), *it, KEY_READ) != NULL)
+                Visit(context, subKey, JoinPath(path, *it), subFolded);
+            else if (subKey.GetLastStatus() == ERROR_FILE_NOT_FOUND)
+            {
+                // Deleted since the parent was read.
+                RemoveSubtree(context, subFolded);
+                it = current.subKeys.erase(it);
+                continue;
+            }
+            it++;
+        }
+        return true;
+    }
+}
+
+std::shared_ptr<const RegTreeState> RegTreeSync::Sync(RegKey &root,
+                                                      const std::shared_ptr<const RegTreeState> &previous,
+                                                      std::vector<RegTreeChange> &changes,
+                                                      RegTreeSyncStats *stats)
+{
+    std::shared_ptr<RegTreeState> state = std::make_shared<RegTreeState>();
+    SyncContext context = {previous.get(), state.get(), &changes, {0, 0}};
+    if (!Visit(context, root, String(), String()))
+        return nullptr;
+    if (stats != nullptr)
+        *stats = context.stats;
+    return state;
+}
@@ -0,0 +1,288 @@
+#include "RegWriteBack.h"
+#include "RegString.h"
+#include "RegTrace.h"
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstring>
+#include <queue>
+#include <thread>
+
+// Flushes buffers whose interval has passed. A single thread serves every buffer;
+// like the thread pool it is never joined.
+class RegWriteBackTimer
+{
+public:
+    static RegWriteBackTimer &Shared()
+    {
+        // Leaked on purpose: buffers may be flushed from static destructors.
+        static RegWriteBackTimer *timer = new RegWriteBackTimer();
+        return *timer;
+    }
+
+    void Schedule(const std::shared_ptr<RegWriteBuffer> &buffer, unsigned interval)
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        if (!_started)
+        {
+            std::thread([this]() {
+                _Run();
+            }).detach();
+            _started = true;
+        }
+        _due.push({Clock::now() + std::chrono::milliseconds(interval), buffer});
+        _wake.notify_one();
+    }
+
+    void Register(const std::shared_ptr<RegWriteBuffer> &buffer)
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _buffers.erase(std::remove_if(_buffers.begin(), _buffers.end(),
+                                      [](const std::weak_ptr<RegWriteBuffer> &it) { return it.expired(); }),
+                       _buffers.end());
+        _buffers.push_back(buffer);
+    }
+
+    std::vector<std::shared_ptr<RegWriteBuffer>> GetBuffers()
+    {
+        std::vector<std::shared_ptr<RegWriteBuffer>> buffers;
+        std::lock_guard<std::mutex> lock(_mutex);
+        for (auto it = _buffers.begin(); it != _buffers.end(); it++)
+        {
+            if (std::shared_ptr<RegWriteBuffer> buffer = it->lock())
+                buffers.push_back(std::move(buffer));
+        }
+        return buffers;
+    }
+
+private:
+    typedef std::chrono::steady_clock Clock;
+
+    struct Due
+    {
+        Clock::time_point time;
+        std::weak_ptr<RegWriteBuffer> buffer;
+
+        bool operator>(const Due &r) const
+        {
+            return time > r.time;
+        }
+    };
+
+    RegWriteBackTimer()
+        : _started(false)
+    {
+    }
+
+    void _Run()
+    {
+        std::unique_lock<std::mutex> lock(_mutex);
+        for (;;)
+        {
+            if (_due.empty())
+            {
+                _wake.wait(lock);
+                continue;
+            }
+            if (Clock::now() < _due.top().time)
+            {
+                _wake.wait_until(lock, _due.top().time);
+                continue;
+            }
+            std::shared_ptr<RegWriteBuffer> buffer = _due.top().buffer.lock();
+            _due.pop();
+            if (!buffer)
+                continue;
+            // Writers schedule while holding the buffer lock, so it is never taken under ours.
+            lock.unlock();
+            {
+                std::lock_guard<std::mutex> bufferLock(buffer->_mutex);
+                buffer->_Flush();
+            }
+            buffer.reset();
+            lock.lock();
+        }
+    }
+
+    std::mutex _mutex;
+    std::condition_variable _wake;
+    std::priority_queue<Due, std::vector<Due>, std::greater<Due>> _due;
+    std::vector<std::weak_ptr<RegWriteBuffer>> _buffers;
+    bool _started;
+};
+
+std::shared_ptr<RegWriteBuffer> RegWriteBuffer::Create(const std::shared_ptr<RegBackend> &backend,
+                                                       HKEY hKey,
+                                                       const RegWriteBackOptions &options)
+{
+    std::shared_ptr<RegWriteBuffer> buffer(new RegWriteBuffer(backend, hKey, options));
+    RegWriteBackTimer::Shared().Register(buffer);
+    return buffer;
+}
+
+RegWriteBuffer::RegWriteBuffer(const std::shared_ptr<RegBackend> &backend, HKEY hKey, const RegWriteBackOptions &options)
+    : _backend(backend)
+    , _options(options)
+    , _hKey(hKey)
+    , _pendingBytes(0)
+    , _scheduled(false)
+    , _stats()
+{
+    _stats.lastStatus = ERROR_SUCCESS;
+}
+
+LSTATUS RegWriteBuffer::SetValue(const String &name, DWORD type, const BYTE *data, DWORD size)
+{
+    Entry entry;
+    entry.name = name;
+    entry.type = type;
+    if (size > 0)
+        entry.data.assign(data, data + size);
+    entry.deleted = false;
+
+    std::lock_guard<std::mutex> lock(_mutex);
+    return _Put(name, std::move(entry));
+}
+
+LSTATUS RegWriteBuffer::DeleteValue(const String &name)
+{
+    Entry entry;
+    entry.name = name;
+    entry.type = REG_NONE;
+    entry.deleted = true;
+
+    std::lock_guard<std::mutex> lock(_mutex);
+    return _Put(name, std::move(entry));
+}
+
+LSTATUS RegWriteBuffer::_Put(const String &name, Entry &&entry)
+{
+    if (_hKey == NULL)
+        return ERROR_INVALID_HANDLE;
+
+    _stats.writes++;
+    size_t bytes = (name.size() + 1) * sizeof(Char) + entry.data.size();
+    auto it = _pending.find(RegString::Fold(name));
+    if (it != _pending.end())
+    {
+        _stats.merged++;
+        _pendingBytes -= (it->second.name.size() + 1) * sizeof(Char) + it->second.data.size();
+        it->second = std::move(entry);
+    }
+    else
+        _pending.emplace(RegString::Fold(name), std::move(entry));
+    _pendingBytes += bytes;
+
+    if (_pendingBytes >= _options.maxBytes)
+        return _Flush();
+    if (!_scheduled && _options.interval > 0)
+    {
+        _scheduled = true;
+        RegWriteBackTimer::Shared().Schedule(shared_from_this(), _options.interval);
+    }
+    return ERROR_SUCCESS;
+}
+
+bool RegWriteBuffer::QueryValue(const String &name, DWORD *type, BYTE *data, DWORD *size, LSTATUS *status)
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    if (_pending.empty())
+        return false;
+    auto it = _pending.find(RegString::Fold(name));
+    if (it == _pending.end())
+        return false;
+
+    const Entry &entry = it->second;
+    if (entry.deleted)
+    {
+        *status = ERROR_FILE_NOT_FOUND;
+        return true;
+    }
+
+    *status = ERROR_SUCCESS;
+    if (type != NULL)
+        *type = entry.type;
+    if (data != NULL)
+    {
+        if (size == NULL)
+            *status = ERROR_INVALID_PARAMETER;
+        else if (*size < entry.data.size())
+            *status = ERROR_MORE_DATA;
+        else if (!entry.data.empty())
+            memcpy(data, entry.data.data(), entry.data.size());
+    }
+    if (size != NULL)
+        *size = DWORD(entry.data.size());
+    return true;
+}
+
+LSTATUS RegWriteBuffer::Flush()
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    return _Flush();
+}
+
+LSTATUS RegWriteBuffer::Close()
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    LSTATUS status = _Flush();
+    _hKey = NULL;
+    return status;
+}
+
+LSTATUS RegWriteBuffer::_Flush()
+{
+    // A scheduled flush may find the buffer already flushed by size or by hand.
+    _scheduled = false;
+    if (_pending.empty() || _hKey == NULL)
+        return ERROR_SUCCESS;
+
+    LSTATUS result = ERROR_SUCCESS;
+    for (auto it = _pending.begin(); it != _pending.end(); it++)
+    {
+        const Entry &entry = it->second;
+        LSTATUS status;
+        if (entry.deleted)
+        {
+            status = REG_TRACED(DeleteValue, _hKey, entry.name.c_str(),
+                                _backend->DeleteValue(_hKey, entry.name.c_str()));
+            // The value may only have existed in the buffer.
+            if (status == ERROR_FILE_NOT_FOUND)
+                status = ERROR_SUCCESS;
+        }
+        else
+            status = REG_TRACED(SetValue, _hKey, entry.name.c_str(),
+                                _backend->SetValue(_hKey, entry.name.c_str(), entry.type,
+                                                   entry.data.data(), DWORD(entry.data.size())));
+
+        if (status == ERROR_SUCCESS)
+            _stats.flushed++;
+        else
+        {
+            _stats.failed++;
+            _stats.lastStatus = status;
+            if (result == ERROR_SUCCESS)
+                result = status;
+        }
+    }
+
+    _stats.flushes++;
+    _pending.clear();
+    _pendingBytes = 0;
+    return result;
+}
+
+RegWriteBackStats RegWriteBuffer::GetStats()
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    RegWriteBackStats stats = _stats;
+    stats.pending = _pending.size();
+    return stats;
+}
+
+void RegWriteBuffer::FlushAll()
+{
+    std::vector<std::shared_ptr<RegWriteBuffer>> buffers = RegWriteBackTimer::Shared().GetBuffers();
+    for (auto it = buffers.begin(); it != buffers.end(); it++)
+        (*it)->Flush();
+}
@@ -0,0 +1,93 @@
+#include "Win32Backend.h"
+
+#ifdef _WIN32
+
+LSTATUS Win32Backend::OpenKey(HKEY hKey, const Char *subKey, REGSAM access, HKEY *result)
+{
+    if (access)
+        return RegOpenKeyExW(hKey, subKey, 0, access, result);
+    else
+        return RegOpenKeyW(hKey, subKey, result);
+}
+
+LSTATUS Win32Backend::CreateKey(HKEY hKey, const Char *subKey, REGSAM access, HKEY *result)
+{
+    if (access)
+        return RegCreateKeyExW(hKey, subKey, 0, NULL, REG_OPTION_NON_VOLATILE, access, NULL, result, NULL);
+    else
+        return RegCreateKeyW(hKey, subKey, result);
+}
+
+LSTATUS Win32Backend::ConnectRegistry(const Char *host, HKEY hKey, HKEY *result)
+{
+    return RegConnectRegistryW(host, hKey, result);
+}
+
+LSTATUS Win32Backend::CloseKey(HKEY hKey)
+{
+    return RegCloseKey(hKey);
+}
+
+LSTATUS Win32Backend::FlushKey(HKEY hKey)
+{
+    return RegFlushKey(hKey);
+}
+
+LSTATUS Win32Backend::CopyTree(HKEY hSrc, const Char *subKey, HKEY hDest)
+{
+    return RegCopyTreeW(hSrc, subKey, hDest);
+}
+
+LSTATUS Win32Backend::RenameKey(HKEY hKey, const Char *subKey, const Char *newName)
+{
+    return RegRenameKey(hKey, subKey, newName);
+}
+
+LSTATUS Win32Backend::DeleteTree(HKEY hKey, const Char *subKey)
+{
+    return RegDeleteTreeW(hKey, subKey);
+}
+
+LSTATUS Win32Backend::DeleteKey(HKEY hKey, const Char *subKey)
+{
+    return RegDeleteKeyW(hKey, subKey);
+}
+
+LSTATUS Win32Backend::QueryInfoKey(HKEY hKey, RegKeyInfo *info)
+{
+    FILETIME lastWriteTime = {0, 0};
+    LSTATUS status = RegQueryInfoKeyW(hKey, NULL, NULL, NULL,
+                                      &info->subKeys, &info->maxSubKeyLength, NULL,
+                                      &info->values, &info->maxValueNameLength, &info->maxValueLength,
+                                      NULL, &lastWriteTime);
+    info->lastWriteTime = (QWORD(lastWriteTime.dwHighDateTime) << 32) | lastWriteTime.dwLowDateTime;
+    return status;
+}
+
+LSTATUS Win32Backend::EnumKey(HKEY hKey, DWORD index, Char *name, DWORD *nameLength)
+{
+    return RegEnumKeyExW(hKey, index, name, nameLength, NULL, NULL, NULL, NULL);
+}
+
+LSTATUS Win32Backend::EnumValue(HKEY hKey, DWORD index, Char *name, DWORD *nameLength,
+                                DWORD *type, BYTE *data, DWORD *dataSize)
+{
+    return RegEnumValueW(hKey, index, name, nameLength, NULL, type, data, dataSize);
+}
+
+LSTATUS Win32Backend::QueryValue(HKEY hKey, const Char *name, DWORD *type, BYTE *data, DWORD *dataSize)
+{
+    return RegQueryValueExW(hKey, name, NULL, type, data, dataSize);
+}
+
+LSTATUS Win32Backend::SetValue(HKEY hKey, const Char *name, DWORD type, const BYTE *data, DWORD dataSize)
+{
+    return RegSetValueExW(hKey, name, 0, type, data, dataSize);
+}
+
+LSTATUS Win32Backend::DeleteValue(HKEY hKey, const Char *name)
+{
+    return RegDeleteValueW(hKey, name);
+}
+
+#endif
@@ -1,4 +1,322 @@
 #include "RegKeyWrap.h"
+#include "RegTrace.h"
+#include "RegConnectionPool.h"
+#include "RegHandleBudget.h"
+#include "RegMarshal.h"
+#include "RegRecorder.h"
+#include "MemoryBackend.h"
+#include "HiveBackend.h"
+
+Napi::Value TraceEnable(const Napi::CallbackInfo &info)
+{
+    size_t capacity = 4096;
+    if (info[0].IsNumber())
+        capacity = info[0].As<Napi::Number>().Uint32Value();
+    RegTrace::Enable(capacity);
+    return info.Env().Undefined();
+}
+
+Napi::Value TraceDisable(const Napi::CallbackInfo &info)
+{
+    RegTrace::Disable();
+    return info.Env().Undefined();
+}
+
+Napi::Value TraceClear(const Napi::CallbackInfo &info)
+{
+    RegTrace::Clear();
+    return info.Env().Undefined();
+}
+
+Napi::Value TraceIsEnabled(const Napi::CallbackInfo &info)
+{
+    return Napi::Boolean::New(info.Env(), RegTrace::IsEnabled());
+}
+
+Napi::Value TraceDump(const Napi::CallbackInfo &info)
+{
+    return Napi::String::New(info.Env(), RegTrace::DumpChromeJson());
+}
+
+Napi::Value SetDefaultBackend(const Napi::CallbackInfo &info)
+{
+    if (!info[0].IsString())
+        throw Napi::TypeError::New(info.Env(), "Backend name expected.");
+    if (!RegBackend::SetDefault(info[0].As<Napi::String>().Utf8Value()))
+        throw Napi::TypeError::New(info.Env(), "Unknown backend.");
+    return info.Env().Undefined();
+}
+
+Napi::Value GetDefaultBackend(const Napi::CallbackInfo &info)
+{
+    return Napi::String::New(info.Env(), RegBackend::GetDefault()->GetName());
+}
+
+Napi::Value ClearMemoryRegistry(const Napi::CallbackInfo &info)
+{
+    static_cast<MemoryBackend *>(RegBackend::Get("memory")->GetTarget())->Clear();
+    return info.Env().Undefined();
+}
+
+// loadHive(name, file, { readOnly, create }) mounts a hive file as the backend `name`
+Napi::Value LoadHive(const Napi::CallbackInfo &info)
+{
+    if (!info[0].IsString() || !info[1].IsString())
+        throw Napi::TypeError::New(info.Env(), "Backend name and file path expected.");
+    std::string name = info[0].As<Napi::String>().Utf8Value();
+    std::string file = info[1].As<Napi::String>().Utf8Value();
+    bool readOnly = false, create = false;
+    if (info[2].IsObject())
+    {
+        Napi::Object options = info[2].As<Napi::Object>();
+        readOnly = options.Get("readOnly").ToBoolean();
+        create = options.Get("create").ToBoolean();
+    }
+    if (RegBackend::Get(name))
+        throw Napi::TypeError::New(info.Env(), "Backend name already in use.");
+
+    std::shared_ptr<HiveBackend> hive = std::make_shared<HiveBackend>(name);
+    LSTATUS status = hive->Load(file, !readOnly);
+    if (status == ERROR_FILE_NOT_FOUND && create && !readOnly)
+        status = hive->Create(file);
+    if (status != ERROR_SUCCESS)
+    {
+        Napi::Error error = Napi::Error::New(info.Env(), "Failed to load hive.");
+        error.Set("status", Napi::Number::New(info.Env(), status));
+        throw error;
+    }
+    if (!RegBackend::Mount(name, hive))
+        throw Napi::TypeError::New(info.Env(), "Backend name already in use.");
+    return info.Env().Undefined();
+}
+
+// unloadHive(name) writes the pending changes back and unmounts the hive
+Napi::Value UnloadHive(const Napi::CallbackInfo &info)
+{
+    if (!info[0].IsString())
+        throw Napi::TypeError::New(info.Env(), "Backend name expected.");
+    std::shared_ptr<RegBackend> backend = RegBackend::Unmount(info[0].As<Napi::String>().Utf8Value());
+    if (!backend)
+        return Napi::Boolean::New(info.Env(), false);
+
+    // Keys still open keep the image alive; the file is closed when the last one goes.
+    LSTATUS status = static_cast<HiveBackend *>(backend.get())->Flush();
+    if (status != ERROR_SUCCESS)
+    {
+        Napi::Error error = Napi::Error::New(info.Env(), "Failed to write hive.");
+        error.Set("status", Napi::Number::New(info.Env(), status));
+        throw error;
+    }
+    return Napi::Boolean::New(info.Env(), true);
+}
+
+Napi::Value FlushWriteBacks(const Napi::CallbackInfo &info)
+{
+    RegWriteBuffer::FlushAll();
+    return info.Env().Undefined();
+}
+
+Napi::Value ConfigureConnectionPool(const Napi::CallbackInfo &info)
+{
+    RegConnectionPoolOptions options = RegConnectionPool::Shared().GetOptions();
+    if (info[0].IsObject())
+    {
+        Napi::Object object = info[0].As<Napi::Object>();
+        Napi::Value maxPerHost = object.Get("maxPerHost");
+        Napi::Value idleTimeout = object.Get("idleTimeout");
+        Napi::Value healthCheckInterval = object.Get("healthCheckInterval");
+        if (maxPerHost.IsNumber())
+            options.maxPerHost = maxPerHost.As<Napi::Number>().Uint32Value();
+        if (idleTimeout.IsNumber())
+            options.idleTimeout = idleTimeout.As<Napi::Number>().Uint32Value();
+        if (healthCheckInterval.IsNumber())
+            options.healthCheckInterval = healthCheckInterval.As<Napi::Number>().Uint32Value();
+        RegConnectionPool::Shared().SetOptions(options);
+    }
+
+    Napi::Object result = Napi::Object::New(info.Env());
+    result.Set("maxPerHost", Napi::Number::New(info.Env(), double(options.maxPerHost)));
+    result.Set("idleTimeout", Napi::Number::New(info.Env(), options.idleTimeout));
+    result.Set("healthCheckInterval", Napi::Number::New(info.Env(), options.healthCheckInterval));
+    return result;
+}
+
+Napi::Value GetConnectionPoolStats(const Napi::CallbackInfo &info)
+{
+    RegConnectionPoolStats stats = RegConnectionPool::Shared().GetStats();
+    Napi::Object result = Napi::Object::New(info.Env());
+    result.Set("connects", Napi::Number::New(info.Env(), double(stats.connects)));
+    result.Set("reuses", Napi::Number::New(info.Env(), double(stats.reuses)));
+    result.Set("expired", Napi::Number::New(info.Env(), double(stats.expired)));
+    result.Set("unhealthy", Napi::Number::New(info.Env(), double(stats.unhealthy)));
+    result.Set("open", Napi::Number::New(info.Env(), double(stats.open)));
+    result.Set("busy", Napi::Number::New(info.Env(), double(stats.busy)));
+    return result;
+}
+
+Napi::Value ClearConnectionPool(const Napi::CallbackInfo &info)
+{
+    RegConnectionPool::Shared().Clear();
+    return info.Env().Undefined();
+}
+
+Napi::Value GetHandleStats(const Napi::CallbackInfo &info)
+{
+    RegHandleBudgetStats stats = RegHandleBudget::Shared().GetStats();
+    Napi::Object result = Napi::Object::New(info.Env());
+    result.Set("open", Napi::Number::New(info.Env(), double(stats.open)));
+    result.Set("peak", Napi::Number::New(info.Env(), double(stats.peak)));
+    result.Set("evictions", Napi::Number::New(info.Env(), double(stats.evictions)));
+    result.Set("reopens", Napi::Number::New(info.Env(), double(stats.reopens)));
+    result.Set("limit", Napi::Number::New(info.Env(), double(RegHandleBudget::Shared().GetLimit())));
+    return result;
+}
+
+Napi::Value GetMarshalStats(const Napi::CallbackInfo &info)
+{
+    RegMarshalStats stats = RegMarshal::GetStats();
+    Napi::Object result = Napi::Object::New(info.Env());
+    result.Set("strings", Napi::Number::New(info.Env(), double(stats.strings)));
+    result.Set("latin1Strings", Napi::Number::New(info.Env(), double(stats.latin1Strings)));
+    result.Set("externalStrings", Napi::Number::New(info.Env(), double(stats.externalStrings)));
+    result.Set("namesReused", Napi::Number::New(info.Env(), double(stats.namesReused)));
+    result.Set("namesCreated", Napi::Number::New(info.Env(), double(stats.namesCreated)));
+    result.Set("arrays", Napi::Number::New(info.Env(), double(stats.arrays)));
+    result.Set("arrayCalls", Napi::Number::New(info.Env(), double(stats.arrayCalls)));
+    return result;
+}
+
+Napi::Value ResetMarshalStats(const Napi::CallbackInfo &info)
+{
+    RegMarshal::ResetStats();
+    return info.Env().Undefined();
+}
+
+Napi::Value RecorderStart(const Napi::CallbackInfo &info)
+{
+    if (!info[0].IsString())
+        throw Napi::TypeError::New(info.Env(), "File path expected.");
+    return Napi::Boolean::New(info.Env(), RegRecorder::Start(info[0].As<Napi::String>().Utf8Value()));
+}
+
+Napi::Value RecorderStop(const Napi::CallbackInfo &info)
+{
+    RegRecorder::Stats stats;
+    if (!RegRecorder::Stop(&stats))
+        return info.Env().Null();
+    Napi::Object result = Napi::Object::New(info.Env());
+    result.Set("calls", Napi::Number::New(info.Env(), double(stats.calls)));
+    result.Set("bytes", Napi::Number::New(info.Env(), double(stats.bytes)));
+    return result;
+}
+
+Napi::Value RecorderIsRecording(const Napi::CallbackInfo &info)
+{
+    return Napi::Boolean::New(info.Env(), RegRecorder::IsRecording());
+}
+
+// Latencies in microseconds
+Napi::Object ConvertLatencySummary(Napi::Env env, const RegLatencySummary &summary)
+{
+    Napi::Object result = Napi::Object::New(env);
+    result.Set("calls", Napi::Number::New(env, double(summary.calls)));
+    result.Set("mean", Napi::Number::New(env, summary.mean / 1000.0));
+    result.Set("p50", Napi::Number::New(env, summary.p50 / 1000.0));
+    result.Set("p90", Napi::Number::New(env, summary.p90 / 1000.0));
+    result.Set("p99", Napi::Number::New(env, summary.p99 / 1000.0));
+    result.Set("p999", Napi::Number::New(env, summary.p999 / 1000.0));
+    result.Set("max", Napi::Number::New(env, summary.max / 1000.0));
+    return result;
+}
+
+class ReplayWorker : public Napi::AsyncWorker
+{
+public:
+    ReplayWorker(Napi::Env env, const std::string &file, const std::shared_ptr<RegBackend> &backend,
+                 const RegReplayOptions &options)
+        : Napi::AsyncWorker(env, "RegKeyReplay")
+        , _deferred(Napi::Promise::Deferred::New(env))
+        , _file(file)
+        , _backend(backend)
+        , _options(options)
+        , _report()
+    {
+    }
+
+    Napi::Value GetPromise() const
+    {
+        return _deferred.Promise();
+    }
+
+    void Execute() override
+    {
+        RegReplay replay;
+        std::string error;
+        if (!replay.Load(_file, error))
+            SetError(error);
+        else
+            _report = replay.Run(_backend, _options);
+    }
+
+    void OnOK() override
+    {
+        Napi::Env env = Env();
+        Napi::Object result = Napi::Object::New(env);
+        result.Set("calls", Napi::Number::New(env, double(_report.calls)));
+        result.Set("mismatches", Napi::Number::New(env, double(_report.mismatches)));
+        result.Set("elapsed", Napi::Number::New(env, _report.elapsed / 1e6));
+        result.Set("throughput", Napi::Number::New(env, _report.throughput));
+        result.Set("latency", ConvertLatencySummary(env, _report.latency));
+        result.Set("recordedLatency", ConvertLatencySummary(env, _report.recordedLatency));
+        Napi::Object ops = Napi::Object::New(env);
+        for (auto it = _report.ops.begin(); it != _report.ops.end(); it++)
+            ops.Set(it->first, ConvertLatencySummary(env, it->second));
+        result.Set("ops", ops);
+        _deferred.Resolve(result);
+    }
+
+    void OnError(const Napi::Error &error) override
+    {
+        _deferred.Reject(error.Value());
+    }
+
+private:
+    Napi::Promise::Deferred _deferred;
+    std::string _file;
+    std::shared_ptr<RegBackend> _backend;
+    RegReplayOptions _options;
+    RegReplayReport _report;
+};
+
+// replay(file, { backend, speed, seed }) runs on a worker thread and resolves to the report
+Napi::Value Replay(const Napi::CallbackInfo &info)
+{
+    if (!info[0].IsString())
+        throw Napi::TypeError::New(info.Env(), "File path expected.");
+
+    std::shared_ptr<RegBackend> backend = RegBackend::GetDefault();
+    RegReplayOptions options;
+    if (info[1].IsObject())
+    {
+        Napi::Object object = info[1].As<Napi::Object>();
+        Napi::Value backendValue = object.Get("backend");
+        Napi::Value speed = object.Get("speed");
+        if (backendValue.IsString())
+        {
+            backend = RegBackend::Get(backendValue.As<Napi::String>().Utf8Value());
+            if (!backend)
+                throw Napi::TypeError::New(info.Env(), "Unknown backend.");
+        }
+        if (speed.IsNumber())
+            options.speed = speed.As<Napi::Number>().DoubleValue();
+        options.seed = object.Get("seed").ToBoolean();
+    }
+
+    ReplayWorker *worker = new ReplayWorker(info.Env(), info[0].As<Napi::String>().Utf8Value(), backend, options);
+    Napi::Value promise = worker->GetPromise();
+    worker->Queue();
+    return promise;
+}
 
 Napi::Object Init(Napi::Env env, Napi::Object exports)
 {
@@ -46,6 +364,65 @@ Napi::Object Init(Napi::Env env, Napi::Object exports)
     access.Set("KEY_ALL_ACCESS",            Napi::Number::New(env, KEY_ALL_ACCESS));
 
     exports.Set("RegKeyAccess", access);
+
+    Napi::Object trace = Napi::Object::New(env);
+
+    trace.Set("enable",                     Napi::Function::New(env, TraceEnable));
+    trace.Set("disable",                    Napi::Function::New(env, TraceDisable));
+    trace.Set("clear",                      Napi::Function::New(env, TraceClear));
+    trace.Set("isEnabled",                  Napi::Function::New(env, TraceIsEnabled));
+    trace.Set("dump",                       Napi::Function::New(env, TraceDump));
+
+    exports.Set("trace", trace);
+
+    Napi::Object connectionPool = Napi::Object::New(env);
+
+    connectionPool.Set("configure",         Napi::Function::New(env, ConfigureConnectionPool));
+    connectionPool.Set("stats",             Napi::Function::New(env, GetConnectionPoolStats));
+    connectionPool.Set("clear",             Napi::Function::New(env, ClearConnectionPool));
+
+    exports.Set("connectionPool", connectionPool);
+
+    Napi::Object handles = Napi::Object::New(env);
+
+    handles.Set("configure",                Napi::Function::New(env, RegKeyWrap::ConfigureHandles));
+    handles.Set("stats",                    Napi::Function::New(env, GetHandleStats));
+    handles.Set("report",                   Napi::Function::New(env, RegKeyWrap::HandleReport));
+
+    exports.Set("handles", handles);
+
+    Napi::Object marshal = Napi::Object::New(env);
+
+    marshal.Set("stats",                    Napi::Function::New(env, GetMarshalStats));
+    marshal.Set("resetStats",               Napi::Function::New(env, ResetMarshalStats));
+    marshal.Set("externalStrings",          Napi::Boolean::New(env, RegMarshal::HasExternalStrings()));
+    marshal.Set("propertyKeys",             Napi::Boolean::New(env, RegMarshal::HasPropertyKeys()));
+
+    exports.Set("marshal", marshal);
+
+    Napi::Object recorder = Napi::Object::New(env);
+
+    recorder.Set("start",                   Napi::Function::New(env, RecorderStart));
+    recorder.Set("stop",                    Napi::Function::New(env, RecorderStop));
+    recorder.Set("isRecording",             Napi::Function::New(env, RecorderIsRecording));
+
+    exports.Set("recorder", recorder);
+    exports.Set("replay",                   Napi::Function::New(env, Replay));
+
+    exports.Set("setDefaultBackend",        Napi::Function::New(env, SetDefaultBackend));
+    exports.Set("getDefaultBackend",        Napi::Function::New(env, GetDefaultBackend));
+    exports.Set("clearMemoryRegistry",      Napi::Function::New(env, ClearMemoryRegistry));
+    exports.Set("loadHive",                 Napi::Function::New(env, LoadHive));
+    exports.Set("unloadHive",               Napi::Function::New(env, UnloadHive));
+    exports.Set("readMany",                 Napi::Function::New(env, RegKeyWrap::ReadMany));
+    exports.Set("readManySync",             Napi::Function::New(env, RegKeyWrap::ReadManySync));
+    exports.Set("__queryHosts__",           Napi::Function::New(env, RegKeyWrap::QueryHosts));
+    exports.Set("__query__",                Napi::Function::New(env, RegKeyWrap::Query));
+    exports.Set("compileSchema",            Napi::Function::New(env, RegKeyWrap::CompileSchema));
+    exports.Set("__readTreeState__",        Napi::Function::New(env, RegKeyWrap::ReadTreeState));
+    exports.Set("scanColumnar",             Napi::Function::New(env, RegKeyWrap::ScanColumnar));
+    exports.Set("__translateError__",       Napi::Function::New(env, RegKeyWrap::TranslateStatus));
+    exports.Set("flushWriteBacks",          Napi::Function::New(env, FlushWriteBacks));
     return exports;
 }
 
@@ -0,0 +1,23 @@
+const assert = require('assert')
+const regkey = require('..')
+const { RegKey } = regkey
+
+// Opaque values handed out by the addon are only accepted where they came from.
+// Run with `node tests/externals.js` against a local build; it uses the memory backend.
+const key = new RegKey({ baseKey: 'HKCU', subKey: 'Software/ExternalsTest', backend: 'memory' })
+key.setStringValue('Name', 'value')
+
+const { state } = key.syncTree()
+
+// The state of a sync pass is not a key to move into a new RegKey...
+assert.throws(() => new RegKey(state.__state__), TypeError)
+// ...nor a compiled schema.
+assert.throws(() => key.__readSchema__(state.__state__), /Compiled schema expected/)
+
+// Their own kinds still work.
+const schema = regkey.compileSchema({ Name: 'REG_SZ' })
+assert.strictEqual(schema.read(key).values.Name, 'value')
+assert.deepStrictEqual(key.syncTree(state).changes, [])
+
+key.close()
+console.log('externals: ok')
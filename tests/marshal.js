@@ -0,0 +1,82 @@
+const assert = require('assert')
+const regkey = require('..')
+const { RegKey, marshal } = regkey
+
+// Checks the marshal counters against a known workload and prints them with timings.
+// Run with `node tests/marshal.js` against a local build; it uses the memory backend.
+// External strings and property keys are only checked where the running Node.js has them (Node-API 10).
+const valueCount = 3000
+const largeLength = 20000
+const rounds = 200
+
+function measure(body) {
+  marshal.resetStats()
+  body()
+  return marshal.stats()
+}
+
+function time(label, body) {
+  const start = process.hrtime.bigint()
+  for (let i = 0; i < rounds; i++) {
+    body()
+  }
+  const elapsed = Number(process.hrtime.bigint() - start) / rounds
+  console.log(`${label}: ${(elapsed / 1000).toFixed(1)} us/call`)
+}
+
+const key = new RegKey({ baseKey: 'HKCU', subKey: 'Software/MarshalTest', backend: 'memory' })
+const names = key.createSubKey('Names')
+for (let i = 0; i < valueCount; i++) {
+  names.setDwordValue(`Value${i}`, i)
+}
+
+// Names are created once, then served from the cache; the array takes one call plus one per element.
+let stats = measure(() => assert.strictEqual(names.getValueNames().length, valueCount))
+assert.strictEqual(stats.namesCreated, valueCount)
+assert.strictEqual(stats.namesReused, 0)
+assert.strictEqual(stats.arrays, 1)
+assert.strictEqual(stats.arrayCalls, valueCount + 1)
+stats = measure(() => names.getValueNames())
+assert.strictEqual(stats.namesCreated, 0)
+assert.strictEqual(stats.namesReused, valueCount)
+assert.strictEqual(stats.strings, 0)
+
+// Names over 64 characters are not cached.
+const long = key.createSubKey('Long')
+long.setDwordValue('L'.repeat(100), 1)
+stats = measure(() => long.getValueNames())
+assert.strictEqual(stats.namesCreated, 0)
+assert.strictEqual(stats.strings, 1)
+
+// Latin-1 text is counted as such; anything wider is not.
+const text = key.createSubKey('Text')
+text.setStringValue('Ascii', 'plain text')
+text.setStringValue('Wide', '\u4e2d\u6587')
+stats = measure(() => {
+  assert.strictEqual(text.getStringValue('Ascii'), 'plain text')
+  assert.strictEqual(text.getStringValue('Wide'), '\u4e2d\u6587')
+})
+assert.strictEqual(stats.strings, 2)
+assert.strictEqual(stats.latin1Strings, 1)
+
+// Large text stays in native memory only where external strings were compiled in.
+const large = 'x'.repeat(largeLength)
+text.setStringValue('Large', large)
+stats = measure(() => assert.strictEqual(text.getStringValue('Large'), large))
+assert.strictEqual(stats.strings, 1)
+assert.strictEqual(stats.externalStrings, marshal.externalStrings ? 1 : 0)
+
+console.log(`externalStrings: ${marshal.externalStrings}, propertyKeys: ${marshal.propertyKeys}`)
+time(`getValueNames (${valueCount} names)`, () => names.getValueNames())
+time(`getStringValue (${largeLength} characters)`, () => text.getStringValue('Large'))
+marshal.resetStats()
+names.getValueNames()
+text.getStringValue('Large')
+console.log(marshal.stats())
+
+for (const subKey of [names, long, text]) {
+  subKey.close()
+}
+key.deleteTree()
+key.close()
+console.log('marshal: ok')
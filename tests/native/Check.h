@@ -0,0 +1,25 @@
+#pragma once
+
+#include <cstdio>
+
+// Failed checks are printed and counted; tests return CHECK_RESULT() from main.
+namespace Check
+{
+    inline int &Failures()
+    {
+        static int failures = 0;
+        return failures;
+    }
+}
+
+#define CHECK(condition)                                                         \
+    do                                                                           \
+    {                                                                            \
+        if (!(condition))                                                        \
+        {                                                                        \
+            std::printf("%s:%d: check failed: %s\n", __FILE__, __LINE__, #condition); \
+            Check::Failures()++;                                                 \
+        }                                                                        \
+    } while (0)
+
+#define CHECK_RESULT() (std::printf("%d check(s) failed\n", Check::Failures()), Check::Failures() == 0 ? 0 : 1)
@@ -0,0 +1,414 @@
+#include "Check.h"
+#include "HiveBackend.h"
+#include "MemoryBackend.h"
+#include "RegFile.h"
+#include "RegString.h"
+#include "TempFile.h"
+#include <algorithm>
+#include <cstring>
+#include <functional>
+#include <memory>
+#include <random>
+
+// Runs the same random operations on a hive and on the memory backend and compares the trees,
+// live and after every flush, re-parsing the file each time. fixtures/sample.hiv is a hive
+// written by this backend; it must still load and hold the sample tree, so format changes
+// that break existing files are caught. Regenerate it with `HiveBackendTest --generate fixtures/sample.hiv`.
+namespace
+{
+    std::mt19937 random(48);
+
+    const Char *const names[] = {STR("alpha"), STR("Beta"), STR("ALPHA2"), STR("gamma"), STR("\x0416\x0435\x0434"), STR("delta"), STR("Zeta"), STR("x")};
+
+    String RandomName()
+    {
+        return names[random() % 8];
+    }
+
+    String RandomPath()
+    {
+        String path;
+        for (int i = 0, depth = 1 + random() % 3; i < depth; i++)
+            path += (i > 0 ? STR("\\") : STR("")) + RandomName();
+        return path;
+    }
+
+    // Sizes around the inline, single-cell and big-data limits of the format.
+    ByteArray RandomData()
+    {
+        static const size_t sizes[] = {0, 1, 4, 5, 8, 100, 1000, 16344, 16345, 40000, 70000};
+        ByteArray data(random() % 3 == 0 ? random() % 3000 : sizes[random() % 11]);
+        for (BYTE &b : data)
+            b = BYTE(random());
+        return data;
+    }
+
+    std::string Narrow(const String &str)
+    {
+        std::string out;
+        for (Char c : str)
+            out += c < 128 ? char(c) : '?';
+        return out;
+    }
+
+    // One line per key and value, with the key counts and a checksum of each value, sorted.
+    void Dump(RegBackend &backend, HKEY key, const String &path, std::vector<std::string> &out)
+    {
+        RegKeyInfo info;
+        if (backend.QueryInfoKey(key, &info) != ERROR_SUCCESS)
+        {
+            out.push_back("error " + Narrow(path));
+            return;
+        }
+        out.push_back("key " + Narrow(path) + " " + std::to_string(info.subKeys) + " " + std::to_string(info.values) + " " +
+                      std::to_string(info.maxSubKeyLength) + " " + std::to_string(info.maxValueNameLength) + " " +
+                      std::to_string(info.maxValueLength));
+        for (DWORD i = 0;; i++)
+        {
+            Char name[300];
+            DWORD nameLength = 300, type = 0, size = 0;
+            LSTATUS status = backend.EnumValue(key, i, name, &nameLength, &type, nullptr, &size);
+            if (status == ERROR_NO_MORE_ITEMS)
+                break;
+            if (status != ERROR_SUCCESS)
+            {
+                out.push_back("value error " + Narrow(path));
+                break;
+            }
+            ByteArray data(size + 1);
+            status = backend.QueryValue(key, name, &type, data.data(), &size);
+            uint32_t sum = 0;
+            for (DWORD j = 0; j < size; j++)
+                sum = sum * 31 + data[j];
+            out.push_back("value " + Narrow(path) + "/" + Narrow(String(name, nameLength)) + " " + std::to_string(type) + " " +
+                          std::to_string(size) + " " + std::to_string(sum) + " " + std::to_string(status));
+        }
+        std::vector<String> children;
+        for (DWORD i = 0;; i++)
+        {
+            Char name[300];
+            DWORD nameLength = 300;
+            if (backend.EnumKey(key, i, name, &nameLength) != ERROR_SUCCESS)
+                break;
+            children.push_back(String(name, nameLength));
+        }
+        for (const String &child : children)
+        {
+            HKEY hChild = NULL;
+            if (backend.OpenKey(key, child.c_str(), KEY_READ, &hChild) != ERROR_SUCCESS)
+            {
+                out.push_back("open error " + Narrow(child));
+                continue;
+            }
+            Dump(backend, hChild, path + STR("\\") + child, out);
+            backend.CloseKey(hChild);
+        }
+    }
+
+    std::vector<std::string> Dump(RegBackend &backend)
+    {
+        std::vector<std::string> out;
+        Dump(backend, HKEY_LOCAL_MACHINE, String(), out);
+        std::sort(out.begin(), out.end());
+        return out;
+    }
+
+    bool SameTree(RegBackend &hive, RegBackend &memory)
+    {
+        return Dump(hive) == Dump(memory);
+    }
+
+    // Runs one random operation on both backends; returns whether both gave the same status.
+    bool Step(RegBackend &hive, RegBackend &memory)
+    {
+        String path = RandomPath();
+        HKEY hiveKey = NULL, memoryKey = NULL;
+        LSTATUS hiveStatus = ERROR_SUCCESS, memoryStatus = ERROR_SUCCESS;
+        auto both = [&](const std::function<LSTATUS(RegBackend &, HKEY &)> &op) {
+            hiveStatus = op(hive, hiveKey);
+            memoryStatus = op(memory, memoryKey);
+            return hiveStatus == ERROR_SUCCESS && memoryStatus == ERROR_SUCCESS;
+        };
+        switch (random() % 11)
+        {
+        case 0:
+        case 1:
+            both([&](RegBackend &b, HKEY &k) { return b.CreateKey(HKEY_LOCAL_MACHINE, path.c_str(), KEY_ALL_ACCESS, &k); });
+            break;
+        case 2:
+        case 3:
+        case 4:
+            if (both([&](RegBackend &b, HKEY &k) { return b.CreateKey(HKEY_LOCAL_MACHINE, path.c_str(), KEY_ALL_ACCESS, &k); }))
+            {
+                ByteArray data = RandomData();
+                String name = random() % 5 == 0 ? String() : RandomName();
+                DWORD type = random() % 12;
+                both([&](RegBackend &b, HKEY &k) { return b.SetValue(k, name.c_str(), type, data.data(), DWORD(data.size())); });
+            }
+            break;
+        case 5:
+            if (both([&](RegBackend &b, HKEY &k) { return b.OpenKey(HKEY_LOCAL_MACHINE, path.c_str(), KEY_ALL_ACCESS, &k); }))
+            {
+                String name = RandomName();
+                both([&](RegBackend &b, HKEY &k) { return b.DeleteValue(k, name.c_str()); });
+            }
+            break;
+        case 6:
+            both([&](RegBackend &b, HKEY &) { return b.DeleteKey(HKEY_LOCAL_MACHINE, path.c_str()); });
+            break;
+        case 7:
+            both([&](RegBackend &b, HKEY &) { return b.DeleteTree(HKEY_LOCAL_MACHINE, path.c_str()); });
+            break;
+        case 8:
+        {
+            // Long names do not fit in the cell of the old one.
+            String name = (random() % 4 == 0 ? STR("a_much_longer_name_that_will_not_fit_in_the_old_cell_") : STR("")) + RandomName();
+            both([&](RegBackend &b, HKEY &) { return b.RenameKey(HKEY_LOCAL_MACHINE, path.c_str(), name.c_str()); });
+            break;
+        }
+        case 9:
+        {
+            String dest = RandomPath();
+            if (both([&](RegBackend &b, HKEY &k) { return b.CreateKey(HKEY_LOCAL_MACHINE, dest.c_str(), KEY_ALL_ACCESS, &k); }))
+                both([&](RegBackend &b, HKEY &k) { return b.CopyTree(HKEY_LOCAL_MACHINE, path.c_str(), k); });
+            break;
+        }
+        default:
+            if (both([&](RegBackend &b, HKEY &k) { return b.OpenKey(HKEY_LOCAL_MACHINE, path.c_str(), KEY_ALL_ACCESS, &k); }))
+                both([&](RegBackend &b, HKEY &k) { return b.DeleteTree(k, nullptr); });
+            break;
+        }
+        if (hiveKey != NULL)
+            hive.CloseKey(hiveKey);
+        if (memoryKey != NULL)
+            memory.CloseKey(memoryKey);
+        return hiveStatus == memoryStatus;
+    }
+
+    void TestDifferential(const TempFile &file)
+    {
+        MemoryBackend memory;
+        std::unique_ptr<HiveBackend> hive(new HiveBackend("hive"));
+        CHECK(hive->Create(file.Path()) == ERROR_SUCCESS && hive->IsWritable());
+        for (int round = 0; round < 12; round++)
+        {
+            for (int i = 0; i < 300; i++)
+                CHECK(Step(*hive, memory));
+            CHECK(SameTree(*hive, memory));
+            CHECK(hive->Flush() == ERROR_SUCCESS);
+
+            // What was flushed parses back to the same tree, read-only and writable.
+            HiveBackend reread("reread");
+            CHECK(reread.Load(file.Path(), false) == ERROR_SUCCESS);
+            CHECK(SameTree(reread, memory));
+            if (round % 3 == 2)
+            {
+                hive.reset(new HiveBackend("hive"));
+                CHECK(hive->Load(file.Path(), true) == ERROR_SUCCESS);
+                CHECK(SameTree(*hive, memory));
+            }
+        }
+
+        // Enough subkeys for the list to be split under an index root, kept sorted.
+        HKEY hiveKey = NULL, memoryKey = NULL;
+        CHECK(hive->CreateKey(HKEY_LOCAL_MACHINE, STR("many"), KEY_ALL_ACCESS, &hiveKey) == ERROR_SUCCESS);
+        CHECK(memory.CreateKey(HKEY_LOCAL_MACHINE, STR("many"), KEY_ALL_ACCESS, &memoryKey) == ERROR_SUCCESS);
+        for (int i = 0; i < 1500; i++)
+        {
+            String name = STR("k");
+            for (char c : std::to_string(random() % 100000))
+                name += Char(c);
+            HKEY a = NULL, b = NULL;
+            CHECK(hive->CreateKey(hiveKey, name.c_str(), KEY_ALL_ACCESS, &a) == ERROR_SUCCESS);
+            CHECK(memory.CreateKey(memoryKey, name.c_str(), KEY_ALL_ACCESS, &b) == ERROR_SUCCESS);
+            hive->CloseKey(a);
+            memory.CloseKey(b);
+        }
+        String previous;
+        bool sorted = true;
+        for (DWORD i = 0;; i++)
+        {
+            Char name[300];
+            DWORD nameLength = 300;
+            if (hive->EnumKey(hiveKey, i, name, &nameLength) != ERROR_SUCCESS)
+                break;
+            sorted = sorted && (i == 0 || RegString::CompareFold(previous.c_str(), previous.size(), name, nameLength) < 0);
+            previous.assign(name, nameLength);
+        }
+        CHECK(sorted);
+        for (int i = 0; i < 700; i++)
+        {
+            Char name[300];
+            DWORD nameLength = 300;
+            CHECK(hive->EnumKey(hiveKey, 0, name, &nameLength) == ERROR_SUCCESS);
+            String first(name, nameLength);
+            CHECK(hive->DeleteKey(hiveKey, first.c_str()) == ERROR_SUCCESS);
+            CHECK(memory.DeleteKey(memoryKey, first.c_str()) == ERROR_SUCCESS);
+        }
+        hive->CloseKey(hiveKey);
+        memory.CloseKey(memoryKey);
+        CHECK(hive->Flush() == ERROR_SUCCESS);
+        HiveBackend reread("reread");
+        CHECK(reread.Load(file.Path(), false) == ERROR_SUCCESS);
+        CHECK(SameTree(reread, memory));
+
+        // Handles to deleted keys report it.
+        HKEY gone = NULL;
+        RegKeyInfo info;
+        CHECK(hive->CreateKey(HKEY_LOCAL_MACHINE, STR("gone\\child"), KEY_ALL_ACCESS, &gone) == ERROR_SUCCESS);
+        CHECK(hive->DeleteTree(HKEY_LOCAL_MACHINE, STR("gone")) == ERROR_SUCCESS);
+        CHECK(hive->QueryInfoKey(gone, &info) == ERROR_KEY_DELETED);
+        hive->CloseKey(gone);
+    }
+
+    // A flush that was cut short leaves the sequence numbers apart: the hive then only loads read-only.
+    void TestInterruptedFlush(const TempFile &file)
+    {
+        {
+            HiveBackend hive("hive");
+            CHECK(hive.Create(file.Path()) == ERROR_SUCCESS);
+            HKEY key = NULL;
+            CHECK(hive.CreateKey(HKEY_LOCAL_MACHINE, STR("Software"), KEY_ALL_ACCESS, &key) == ERROR_SUCCESS);
+            hive.CloseKey(key);
+            CHECK(hive.Flush() == ERROR_SUCCESS);
+        }
+        ByteArray image = file.Read();
+        uint32_t primary = 0, secondary = 0;
+        memcpy(&primary, image.data() + 4, 4);
+        memcpy(&secondary, image.data() + 8, 4);
+        CHECK(primary == secondary && primary > 1);
+
+        primary++;
+        memcpy(image.data() + 4, &primary, 4);
+        uint32_t checksum = 0;
+        for (size_t i = 0; i < 508; i += 4)
+        {
+            uint32_t word;
+            memcpy(&word, image.data() + i, 4);
+            checksum ^= word;
+        }
+        memcpy(image.data() + 508, &checksum, 4);
+        file.Write(image);
+
+        HiveBackend hive("dirty");
+        CHECK(hive.Load(file.Path(), true) == ERROR_BADDB);
+        CHECK(hive.Load(file.Path(), false) == ERROR_SUCCESS);
+        HKEY key = NULL;
+        CHECK(hive.OpenKey(HKEY_LOCAL_MACHINE, STR("Software"), KEY_READ, &key) == ERROR_SUCCESS);
+        hive.CloseKey(key);
+        CHECK(hive.CreateKey(HKEY_LOCAL_MACHINE, STR("new"), KEY_ALL_ACCESS, &key) == ERROR_ACCESS_DENIED);
+    }
+
+    // The tree stored in fixtures/sample.hiv: every value type, names outside ASCII, a value stored
+    // as big data and a few hundred subkeys.
+    void BuildSample(RegBackend &backend)
+    {
+        HKEY root = NULL, key = NULL;
+        CHECK(backend.CreateKey(HKEY_LOCAL_MACHINE, STR("Software\\RegKey\\Sample"), KEY_ALL_ACCESS, &root) == ERROR_SUCCESS);
+        String text = STR("C:\\Program Files\\RegKey");
+        backend.SetValue(root, STR(""), REG_SZ, reinterpret_cast<const BYTE *>(text.c_str()), DWORD((text.size() + 1) * sizeof(Char)));
+        String expand = STR("%SystemRoot%\\system32");
+        backend.SetValue(root, STR("Expand"), REG_EXPAND_SZ, reinterpret_cast<const BYTE *>(expand.c_str()), DWORD((expand.size() + 1) * sizeof(Char)));
+        const Char multi[] = STR("one\0two\0\x0442\x0440\x0438\0");
+        backend.SetValue(root, STR("Multi"), REG_MULTI_SZ, reinterpret_cast<const BYTE *>(multi), DWORD(sizeof(multi)));
+        DWORD dword = 0x12345678;
+        backend.SetValue(root, STR("Dword"), REG_DWORD, reinterpret_cast<const BYTE *>(&dword), 4);
+        backend.SetValue(root, STR("BigEndian"), REG_DWORD_BIG_ENDIAN, reinterpret_cast<const BYTE *>(&dword), 4);
+        QWORD qword = 0x0123456789ABCDEFull;
+        backend.SetValue(root, STR("Qword"), REG_QWORD, reinterpret_cast<const BYTE *>(&qword), 8);
+        ByteArray big(20000);
+        for (size_t i = 0; i < big.size(); i++)
+            big[i] = BYTE(i * 7 + i / 251);
+        backend.SetValue(root, STR("Big"), REG_BINARY, big.data(), DWORD(big.size()));
+        backend.SetValue(root, STR("Empty"), REG_NONE, nullptr, 0);
+        CHECK(backend.CreateKey(root, STR("\x0416\x0435\x0434\\\x4E2D\x6587"), KEY_ALL_ACCESS, &key) == ERROR_SUCCESS);
+        backend.SetValue(key, STR("\x540D\x524D"), REG_DWORD, reinterpret_cast<const BYTE *>(&dword), 4);
+        backend.CloseKey(key);
+        for (int i = 0; i < 300; i++)
+        {
+            String name = STR("Item");
+            for (char c : std::to_string(i * 37 % 1000))
+                name += Char(c);
+            CHECK(backend.CreateKey(root, name.c_str(), KEY_ALL_ACCESS, &key) == ERROR_SUCCESS);
+            DWORD index = DWORD(i);
+            backend.SetValue(key, STR("Index"), REG_DWORD, reinterpret_cast<const BYTE *>(&index), 4);
+            backend.CloseKey(key);
+        }
+        backend.CloseKey(root);
+    }
+
+    void TestFixture(const TempFile &file)
+    {
+        const char *fixture = "fixtures/sample.hiv";
+        MemoryBackend memory;
+        BuildSample(memory);
+
+        HiveBackend readOnly("fixture");
+        CHECK(readOnly.Load(fixture, false) == ERROR_SUCCESS);
+        CHECK(!readOnly.IsWritable());
+        CHECK(SameTree(readOnly, memory));
+
+        // A writable copy takes changes and still matches after they are flushed and parsed again.
+        ByteArray image;
+        CHECK(RegFile::Read(fixture, image));
+        file.Write(image);
+        {
+            HiveBackend hive("copy");
+            CHECK(hive.Load(file.Path(), true) == ERROR_SUCCESS);
+            for (int i = 0; i < 200; i++)
+                CHECK(Step(hive, memory));
+            CHECK(hive.Flush() == ERROR_SUCCESS);
+        }
+        HiveBackend reread("reread");
+        CHECK(reread.Load(file.Path(), false) == ERROR_SUCCESS);
+        CHECK(SameTree(reread, memory));
+    }
+
+    // Damaged copies of the fixture are rejected or read and written without harm.
+    void TestDamaged(const TempFile &file)
+    {
+        ByteArray image;
+        CHECK(RegFile::Read("fixtures/sample.hiv", image));
+        int loaded = 0;
+        for (int i = 0; i < 300; i++)
+        {
+            ByteArray damaged = image;
+            for (int j = 0, count = 1 + random() % 20; j < count; j++)
+                damaged[4096 + random() % (damaged.size() - 4096)] = BYTE(random());
+            if (random() % 10 == 0)
+                damaged.resize(4096 + random() % (damaged.size() - 4096));
+            file.Write(damaged);
+
+            HiveBackend hive("damaged");
+            if (hive.Load(file.Path(), true) != ERROR_SUCCESS)
+                continue;
+            loaded++;
+            Dump(hive);
+            // Statuses may differ from an empty backend; only safety is checked.
+            MemoryBackend scratch;
+            for (int j = 0; j < 50; j++)
+                Step(hive, scratch);
+        }
+        CHECK(loaded > 0);
+    }
+}
+
+int main(int argc, char **argv)
+{
+    if (argc == 3 && strcmp(argv[1], "--generate") == 0)
+    {
+        RegFile::Remove(argv[2]);
+        HiveBackend hive("fixture");
+        CHECK(hive.Create(argv[2]) == ERROR_SUCCESS);
+        BuildSample(hive);
+        CHECK(hive.Flush() == ERROR_SUCCESS);
+        return CHECK_RESULT();
+    }
+
+    TempFile file("hive-test.hiv");
+    TestDifferential(file);
+    TestInterruptedFlush(file);
+    TestFixture(file);
+    TestDamaged(file);
+    return CHECK_RESULT();
+}
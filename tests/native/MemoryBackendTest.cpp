@@ -0,0 +1,227 @@
+#include "Check.h"
+#include "MemoryBackend.h"
+#include <cstring>
+#include <thread>
+
+// The in-memory backend on its own: arena size classes and reuse, handle generations,
+// keys deleted while handles to them are open, and handle slots reused after a close.
+namespace
+{
+    void TestArena()
+    {
+        MemoryArena arena;
+
+        // Sizes round up to a power-of-two class of at least 16 bytes.
+        DWORD capacity = 0;
+        CHECK(arena.Allocate(0, &capacity) == nullptr && capacity == 0);
+        BYTE *small = arena.Allocate(1, &capacity);
+        CHECK(small != nullptr && capacity == 16);
+        BYTE *medium = arena.Allocate(100, &capacity);
+        CHECK(medium != nullptr && capacity == 128);
+        memset(medium, 0xAB, 100);
+
+        // A freed block is handed out again for the same class, not for another one.
+        arena.Free(small, 16);
+        BYTE *other = arena.Allocate(40, &capacity);
+        CHECK(other != small && capacity == 64);
+        BYTE *again = arena.Allocate(9, &capacity);
+        CHECK(again == small && capacity == 16);
+
+        // Free lists are last in, first out.
+        BYTE *first = arena.Allocate(256, &capacity);
+        BYTE *second = arena.Allocate(256, &capacity);
+        arena.Free(first, 256);
+        arena.Free(second, 256);
+        CHECK(arena.Allocate(256, &capacity) == second);
+        CHECK(arena.Allocate(256, &capacity) == first);
+
+        // Blocks beyond the largest class come from the heap with their exact size.
+        BYTE *large = arena.Allocate(1 << 20, &capacity);
+        CHECK(large != nullptr && capacity == DWORD(1 << 20));
+        large[(1 << 20) - 1] = 1;
+        arena.Free(large, capacity);
+
+        // Filling several chunks keeps blocks apart; the neighbours written above are intact.
+        std::vector<BYTE *> blocks;
+        for (int i = 0; i < 3000; i++)
+        {
+            BYTE *block = arena.Allocate(200, &capacity);
+            memset(block, i & 0xFF, 200);
+            blocks.push_back(block);
+        }
+        for (int i = 0; i < 3000; i++)
+            CHECK(blocks[i][0] == BYTE(i & 0xFF) && blocks[i][199] == BYTE(i & 0xFF));
+        CHECK(medium[0] == 0xAB && medium[99] == 0xAB);
+        for (BYTE *block : blocks)
+            arena.Free(block, 256);
+    }
+
+    DWORD QueryDword(MemoryBackend &backend, HKEY hKey, const Char *name, LSTATUS *status)
+    {
+        DWORD value = 0, type = 0, size = sizeof(value);
+        *status = backend.QueryValue(hKey, name, &type, reinterpret_cast<BYTE *>(&value), &size);
+        return value;
+    }
+
+    LSTATUS SetDword(MemoryBackend &backend, HKEY hKey, const Char *name, DWORD value)
+    {
+        return backend.SetValue(hKey, name, REG_DWORD, reinterpret_cast<const BYTE *>(&value), sizeof(value));
+    }
+
+    // Value data lives in the arena; growing, shrinking and deleting values must keep it intact.
+    void TestValueStorage()
+    {
+        MemoryBackend backend;
+        HKEY hKey = NULL;
+        CHECK(backend.CreateKey(HKEY_CURRENT_USER, STR("Software\\Values"), 0, &hKey) == ERROR_SUCCESS);
+
+        std::vector<BYTE> data(5000);
+        for (size_t size : {size_t(0), size_t(3), size_t(5000), size_t(17), size_t(4096)})
+        {
+            for (size_t i = 0; i < size; i++)
+                data[i] = BYTE(size + i);
+            CHECK(backend.SetValue(hKey, STR("Blob"), REG_BINARY, data.data(), DWORD(size)) == ERROR_SUCCESS);
+            CHECK(SetDword(backend, hKey, STR("Neighbour"), DWORD(size)) == ERROR_SUCCESS);
+
+            std::vector<BYTE> read(size + 1);
+            DWORD type = 0, readSize = DWORD(read.size());
+            CHECK(backend.QueryValue(hKey, STR("blob"), &type, read.data(), &readSize) == ERROR_SUCCESS);
+            CHECK(type == REG_BINARY && readSize == size && memcmp(read.data(), data.data(), size) == 0);
+            LSTATUS status;
+            CHECK(QueryDword(backend, hKey, STR("NEIGHBOUR"), &status) == DWORD(size) && status == ERROR_SUCCESS);
+        }
+
+        // Too small a buffer reports the size needed.
+        DWORD size = 2;
+        BYTE small[2];
+        CHECK(backend.QueryValue(hKey, STR("Blob"), nullptr, small, &size) == ERROR_MORE_DATA && size == 4096);
+
+        CHECK(backend.DeleteValue(hKey, STR("Blob")) == ERROR_SUCCESS);
+        CHECK(backend.DeleteValue(hKey, STR("Blob")) == ERROR_FILE_NOT_FOUND);
+        LSTATUS status;
+        CHECK(QueryDword(backend, hKey, STR("Neighbour"), &status) == 4096 && status == ERROR_SUCCESS);
+        CHECK(backend.CloseKey(hKey) == ERROR_SUCCESS);
+    }
+
+    void TestDeleteWhileOpen()
+    {
+        MemoryBackend backend;
+        HKEY parent = NULL, child = NULL, grandchild = NULL;
+        CHECK(backend.CreateKey(HKEY_CURRENT_USER, STR("Software\\Parent"), 0, &parent) == ERROR_SUCCESS);
+        CHECK(backend.CreateKey(parent, STR("Child"), 0, &child) == ERROR_SUCCESS);
+        CHECK(backend.CreateKey(child, STR("Grandchild"), 0, &grandchild) == ERROR_SUCCESS);
+        CHECK(SetDword(backend, grandchild, STR("Value"), 1) == ERROR_SUCCESS);
+
+        // A key with subkeys is only removed as a tree.
+        CHECK(backend.DeleteKey(parent, STR("Child")) == ERROR_ACCESS_DENIED);
+        CHECK(backend.DeleteTree(parent, STR("child")) == ERROR_SUCCESS);
+
+        // Handles into the deleted subtree fail, and keep failing once the nodes are reused.
+        LSTATUS status;
+        QueryDword(backend, grandchild, STR("Value"), &status);
+        CHECK(status == ERROR_KEY_DELETED);
+        CHECK(SetDword(backend, child, STR("Value"), 2) == ERROR_KEY_DELETED);
+        HKEY recreated = NULL;
+        CHECK(backend.CreateKey(parent, STR("Child\\Grandchild"), 0, &recreated) == ERROR_SUCCESS);
+        QueryDword(backend, grandchild, STR("Value"), &status);
+        CHECK(status == ERROR_KEY_DELETED);
+        HKEY reopened = NULL;
+        CHECK(backend.OpenKey(child, nullptr, 0, &reopened) == ERROR_KEY_DELETED);
+
+        // The recreated key starts empty.
+        QueryDword(backend, recreated, STR("Value"), &status);
+        CHECK(status == ERROR_FILE_NOT_FOUND);
+
+        // Clearing a key in place keeps handles to it valid, but not to its subkeys.
+        CHECK(backend.DeleteTree(parent, nullptr) == ERROR_SUCCESS);
+        CHECK(SetDword(backend, parent, STR("Value"), 3) == ERROR_SUCCESS);
+        CHECK(SetDword(backend, recreated, STR("Value"), 3) == ERROR_KEY_DELETED);
+
+        // Deleted handles still have to be closed, once.
+        for (HKEY hKey : {parent, child, grandchild, recreated})
+            CHECK(backend.CloseKey(hKey) == ERROR_SUCCESS);
+        CHECK(backend.CloseKey(child) == ERROR_INVALID_HANDLE);
+        CHECK(backend.QueryInfoKey(child, nullptr) == ERROR_INVALID_HANDLE);
+
+        // Clear removes everything; open handles fail as deleted.
+        HKEY key = NULL;
+        CHECK(backend.CreateKey(HKEY_LOCAL_MACHINE, STR("Software\\Cleared"), 0, &key) == ERROR_SUCCESS);
+        backend.Clear();
+        CHECK(SetDword(backend, key, STR("Value"), 4) == ERROR_KEY_DELETED);
+        CHECK(backend.OpenKey(HKEY_LOCAL_MACHINE, STR("Software"), 0, &reopened) == ERROR_FILE_NOT_FOUND);
+        CHECK(backend.CloseKey(key) == ERROR_SUCCESS);
+    }
+
+    void TestHandleSlots()
+    {
+        MemoryBackend backend;
+        HKEY first = NULL, second = NULL;
+        CHECK(backend.CreateKey(HKEY_CURRENT_USER, STR("Software\\First"), 0, &first) == ERROR_SUCCESS);
+        CHECK(backend.CreateKey(HKEY_CURRENT_USER, STR("Software\\Second"), 0, &second) == ERROR_SUCCESS);
+        CHECK(first != second);
+
+        // A closed slot is reused, and then refers to the key it was reopened on.
+        CHECK(backend.CloseKey(first) == ERROR_SUCCESS);
+        HKEY third = NULL;
+        CHECK(backend.OpenKey(HKEY_CURRENT_USER, STR("Software\\Second"), 0, &third) == ERROR_SUCCESS);
+        CHECK(third == first);
+        CHECK(SetDword(backend, third, STR("Value"), 5) == ERROR_SUCCESS);
+        LSTATUS status;
+        CHECK(QueryDword(backend, second, STR("Value"), &status) == 5 && status == ERROR_SUCCESS);
+
+        // Handles that were never issued are rejected.
+        HKEY bogus = HKEY(uintptr_t(1000) << 2);
+        CHECK(backend.QueryInfoKey(bogus, nullptr) == ERROR_INVALID_HANDLE);
+        CHECK(backend.CloseKey(NULL) == ERROR_INVALID_HANDLE);
+
+        // Predefined keys need no closing; remote roots are separate trees.
+        CHECK(backend.CloseKey(HKEY_CURRENT_USER) == ERROR_SUCCESS);
+        HKEY remote = NULL, remoteKey = NULL;
+        CHECK(backend.ConnectRegistry(STR("\\\\host"), HKEY_CURRENT_USER, &remote) == ERROR_SUCCESS);
+        CHECK(backend.OpenKey(remote, STR("Software\\Second"), 0, &remoteKey) == ERROR_FILE_NOT_FOUND);
+        CHECK(backend.ConnectRegistry(STR("host"), second, &remoteKey) == ERROR_INVALID_HANDLE);
+
+        for (HKEY hKey : {second, third, remote})
+            CHECK(backend.CloseKey(hKey) == ERROR_SUCCESS);
+    }
+
+    // Handles are opened and closed from several threads while others write through theirs.
+    void TestConcurrentHandles()
+    {
+        MemoryBackend backend;
+        std::vector<std::thread> threads;
+        for (int t = 0; t < 4; t++)
+        {
+            threads.emplace_back([&backend, t]() {
+                String path = STR("Software\\Thread") + String(1, Char('0' + t));
+                for (int i = 0; i < 500; i++)
+                {
+                    HKEY hKey = NULL;
+                    CHECK(backend.CreateKey(HKEY_CURRENT_USER, path.c_str(), 0, &hKey) == ERROR_SUCCESS);
+                    CHECK(SetDword(backend, hKey, STR("Value"), DWORD(i)) == ERROR_SUCCESS);
+                    LSTATUS status;
+                    CHECK(QueryDword(backend, hKey, STR("Value"), &status) == DWORD(i) && status == ERROR_SUCCESS);
+                    CHECK(backend.CloseKey(hKey) == ERROR_SUCCESS);
+                }
+            });
+        }
+        for (std::thread &thread : threads)
+            thread.join();
+
+        HKEY software = NULL;
+        RegKeyInfo info;
+        CHECK(backend.OpenKey(HKEY_CURRENT_USER, STR("Software"), 0, &software) == ERROR_SUCCESS);
+        CHECK(backend.QueryInfoKey(software, &info) == ERROR_SUCCESS && info.subKeys == 4);
+        CHECK(backend.CloseKey(software) == ERROR_SUCCESS);
+    }
+}
+
+int main()
+{
+    TestArena();
+    TestValueStorage();
+    TestDeleteWhileOpen();
+    TestHandleSlots();
+    TestConcurrentHandles();
+    return CHECK_RESULT();
+}
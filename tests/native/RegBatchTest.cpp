@@ -0,0 +1,164 @@
+#include "Check.h"
+#include "MemoryBackend.h"
+#include "RegBatch.h"
+#include "RegCodec.h"
+#include "RegString.h"
+#include <atomic>
+#include <cstring>
+#include <new>
+
+// Batch reads against a stand-in backend that counts the keys opened, fails to connect to one
+// host and throws while reading one value: results stay aligned with the requests, each key is
+// opened once, and a throwing task fails the requests it did not get to.
+namespace
+{
+    class StandInBackend : public MemoryBackend
+    {
+    public:
+        std::atomic<int> opens{0};
+
+        LSTATUS OpenKey(HKEY hKey, const Char *subKey, REGSAM access, HKEY *result) override
+        {
+            opens++;
+            return MemoryBackend::OpenKey(hKey, subKey, access, result);
+        }
+
+        LSTATUS ConnectRegistry(const Char *host, HKEY hKey, HKEY *result) override
+        {
+            if (RegString::Fold(String(host)).find(RegString::Fold(String(STR("down")))) != String::npos)
+                return ERROR_BAD_NETPATH;
+            return MemoryBackend::ConnectRegistry(host, hKey, result);
+        }
+
+        LSTATUS QueryValue(HKEY hKey, const Char *name, DWORD *type, BYTE *data, DWORD *dataSize) override
+        {
+            if (name != nullptr && String(name) == STR("Throw"))
+                throw std::bad_alloc();
+            return MemoryBackend::QueryValue(hKey, name, type, data, dataSize);
+        }
+    };
+
+    void Make(const std::shared_ptr<RegBackend> &backend, HKEY root, const String &path, DWORD value)
+    {
+        RegKey key(backend);
+        CHECK(key.Create(root, path, KEY_ALL_ACCESS) != NULL);
+        CHECK(key.SetDwordValue(STR("Value"), value));
+        CHECK(key.SetStringValue(STR("Path"), STR("%Root%\\bin;%Unknown%"), REG_EXPAND_SZ));
+    }
+
+    DWORD AsDword(const RegValue &value)
+    {
+        DWORD result = 0;
+        if (value.type == REG_DWORD && value.data.size() == sizeof(result))
+            memcpy(&result, value.data.data(), sizeof(result));
+        return result;
+    }
+
+    RegReadRequest Request(const String &subKey, std::vector<String> values, const String &host = STR(""))
+    {
+        return {host, HKEY_LOCAL_MACHINE, subKey, std::move(values)};
+    }
+
+    void TestRead()
+    {
+        std::shared_ptr<StandInBackend> backend = std::make_shared<StandInBackend>();
+        for (DWORD i = 0; i < 5; i++)
+            Make(backend, HKEY_LOCAL_MACHINE, STR("Software\\Batch\\Key") + String(1, Char('0' + i)), i);
+        Make(backend, HKEY_LOCAL_MACHINE, STR("Software\\Other\\Key"), 10);
+
+        std::vector<RegReadRequest> requests;
+        requests.push_back(Request(STR("Software\\Batch\\Key3"), {STR("Value")}));
+        requests.push_back(Request(STR("Software\\Other\\Key"), {STR("Value"), STR("Missing")}));
+        requests.push_back(Request(STR("Software\\Batch\\Key1"), {STR("Value")}));
+        requests.push_back(Request(STR("Software\\Batch\\KEY3"), {STR("Path")}));
+        requests.push_back(Request(STR("Software\\Batch\\Gone"), {STR("Value")}));
+        requests.push_back(Request(STR("Software\\Nowhere\\Key"), {STR("Value")}));
+        requests.push_back(Request(STR("Software\\Batch\\Key4"), {}));
+
+        std::shared_ptr<RegEnvironment> environment = std::make_shared<RegEnvironment>();
+        environment->Set(STR("ROOT"), STR("C:\\Tools"));
+        RegBatchReader reader(backend, std::move(requests));
+        reader.SetEnvironment(environment);
+        backend->opens = 0;
+        reader.Run();
+
+        const std::vector<RegReadResult> &results = reader.GetResults();
+        CHECK(results.size() == 7);
+        CHECK(results[0].status == ERROR_SUCCESS && results[0].values.size() == 1 && AsDword(results[0].values[0]) == 3);
+        CHECK(results[1].status == ERROR_SUCCESS && AsDword(results[1].values[0]) == 10);
+        CHECK(results[1].statuses.size() == 2 && results[1].statuses[0] == ERROR_SUCCESS);
+        CHECK(results[1].statuses[1] == ERROR_FILE_NOT_FOUND);
+        CHECK(results[2].status == ERROR_SUCCESS && AsDword(results[2].values[0]) == 1);
+
+        // Expanded with the environment given; unknown names are kept.
+        String path;
+        RegCodec<REG_EXPAND_SZ>::Decode(results[3].values[0].data.data(), results[3].values[0].data.size(), path);
+        CHECK(results[3].status == ERROR_SUCCESS && path == STR("C:\\Tools\\bin;%Unknown%"));
+
+        // Missing keys fail every value requested from them.
+        CHECK(results[4].status == ERROR_FILE_NOT_FOUND && results[4].statuses.size() == 1);
+        CHECK(results[4].statuses[0] == ERROR_FILE_NOT_FOUND && results[4].values[0].name == STR("Value"));
+        CHECK(results[5].status == ERROR_FILE_NOT_FOUND && results[5].statuses[0] == ERROR_FILE_NOT_FOUND);
+
+        // A request without names reads every value of the key.
+        CHECK(results[6].status == ERROR_SUCCESS && results[6].values.size() == 2);
+
+        // Two parents (Software\Batch, Software\Other) plus Key1, Key3 once for both requests,
+        // Key4, the missing Gone and Other\Key; the missing parent fails once.
+        CHECK(backend->opens == 8);
+        CHECK(reader.GetOpenCount() == 6);
+    }
+
+    void TestRemote()
+    {
+        std::shared_ptr<StandInBackend> backend = std::make_shared<StandInBackend>();
+        HKEY remote = NULL;
+        CHECK(backend->ConnectRegistry(STR("\\\\up"), HKEY_LOCAL_MACHINE, &remote) == ERROR_SUCCESS);
+        Make(backend, remote, STR("Software\\Remote"), 7);
+        CHECK(backend->CloseKey(remote) == ERROR_SUCCESS);
+
+        std::vector<RegReadRequest> requests;
+        requests.push_back(Request(STR("Software\\Remote"), {STR("Value")}, STR("\\\\down")));
+        requests.push_back(Request(STR("Software\\Remote"), {STR("Value")}, STR("\\\\up")));
+        requests.push_back(Request(STR("Software\\Remote"), {STR("Value")}));
+        requests.push_back(Request(STR("Software\\Other"), {STR("Value"), STR("Path")}, STR("\\\\DOWN")));
+        RegBatchReader reader(backend, std::move(requests));
+        reader.Run();
+
+        const std::vector<RegReadResult> &results = reader.GetResults();
+        CHECK(results[0].status == ERROR_BAD_NETPATH && results[0].statuses[0] == ERROR_BAD_NETPATH);
+        CHECK(results[1].status == ERROR_SUCCESS && AsDword(results[1].values[0]) == 7);
+        CHECK(results[2].status == ERROR_FILE_NOT_FOUND);
+        CHECK(results[3].status == ERROR_BAD_NETPATH && results[3].statuses.size() == 2);
+    }
+
+    void TestThrowingTask()
+    {
+        std::shared_ptr<StandInBackend> backend = std::make_shared<StandInBackend>();
+        Make(backend, HKEY_LOCAL_MACHINE, STR("Software\\Throwing\\A"), 1);
+        Make(backend, HKEY_LOCAL_MACHINE, STR("Software\\Throwing\\B"), 2);
+        Make(backend, HKEY_LOCAL_MACHINE, STR("Software\\Fine\\C"), 3);
+
+        std::vector<RegReadRequest> requests;
+        requests.push_back(Request(STR("Software\\Throwing\\B"), {STR("Value")}));
+        requests.push_back(Request(STR("Software\\Throwing\\A"), {STR("Value"), STR("Throw")}));
+        requests.push_back(Request(STR("Software\\Fine\\C"), {STR("Value")}));
+        RegBatchReader reader(backend, std::move(requests));
+        reader.Run();
+
+        // A is read before B in the same task, so both take the failure; C has its own task.
+        const std::vector<RegReadResult> &results = reader.GetResults();
+        CHECK(results[1].status == ERROR_NOT_ENOUGH_MEMORY);
+        CHECK(results[1].values.size() == 2 && results[1].statuses[0] == ERROR_NOT_ENOUGH_MEMORY);
+        CHECK(results[0].status == ERROR_NOT_ENOUGH_MEMORY && results[0].statuses.size() == 1);
+        CHECK(results[2].status == ERROR_SUCCESS && AsDword(results[2].values[0]) == 3);
+    }
+}
+
+int main()
+{
+    TestRead();
+    TestRemote();
+    TestThrowingTask();
+    return CHECK_RESULT();
+}
@@ -0,0 +1,100 @@
+#include "RegCodec.h"
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <vector>
+
+// Times string decoding, which is bound by the null scan, with every kernel against the scalar one.
+// The data starts one byte off alignment, as value data read into a byte buffer can.
+// Usage: RegCodecBenchmark [scale], where scale multiplies the number of rounds (default 10).
+namespace
+{
+    volatile size_t sink;
+
+    template <typename Body>
+    double NanosecondsPerCall(int calls, Body body)
+    {
+        auto start = std::chrono::steady_clock::now();
+        size_t total = 0;
+        for (int i = 0; i < calls; i++)
+            total += body();
+        auto elapsed = std::chrono::steady_clock::now() - start;
+        sink = total;
+        return std::chrono::duration<double, std::nano>(elapsed).count() / calls;
+    }
+
+    std::vector<BYTE> Encode(const std::vector<String> &strings)
+    {
+        ByteArray data;
+        RegCodec<REG_MULTI_SZ>::Encode(strings, data);
+        // One byte off alignment.
+        std::vector<BYTE> unaligned(data.size() + 1);
+        memcpy(unaligned.data() + 1, data.data(), data.size());
+        return unaligned;
+    }
+}
+
+int main(int argc, char **argv)
+{
+    int scale = argc > 1 ? atoi(argv[1]) : 10;
+    if (scale < 1)
+        scale = 1;
+
+    std::mt19937 random(5);
+    auto randomString = [&](size_t length) {
+        String value;
+        for (size_t i = 0; i < length; i++)
+            value += Char('A' + random() % 58);
+        return value;
+    };
+
+    // A path-like REG_SZ, a long REG_EXPAND_SZ-sized one, and a REG_MULTI_SZ of 64 short items.
+    struct Case
+    {
+        const char *name;
+        bool multi;
+        std::vector<BYTE> data;
+    };
+    std::vector<String> items;
+    for (int i = 0; i < 64; i++)
+        items.push_back(randomString(8 + random() % 24));
+    std::vector<Case> cases = {
+        {"REG_SZ 40", false, Encode({randomString(40)})},
+        {"REG_SZ 2000", false, Encode({randomString(2000)})},
+        {"REG_MULTI_SZ 64", true, Encode(items)},
+    };
+
+    std::printf("%-18s %-8s %12s %12s %10s\n", "data", "kernel", "decode ns", "findnull ns", "vs scalar");
+    for (const Case &test : cases)
+    {
+        const BYTE *data = test.data.data() + 1;
+        size_t size = test.data.size() - 1;
+        int calls = int(scale * 2000000 / (size + 64));
+        double scalarDecode = 0;
+        std::vector<const char *> kernels = RegString::GetKernelNames();
+        for (auto it = kernels.rbegin(); it != kernels.rend(); it++)
+        {
+            RegString::UseKernel(*it);
+            double decode = NanosecondsPerCall(calls, [&]() {
+                if (test.multi)
+                {
+                    std::vector<String> value;
+                    RegCodec<REG_MULTI_SZ>::Decode(data, size, value);
+                    return value.size();
+                }
+                String value;
+                RegCodec<REG_SZ>::Decode(data, size, value);
+                return value.size();
+            });
+            double findNull = NanosecondsPerCall(calls, [&]() {
+                return RegString::FindNull(data, size / sizeof(Char));
+            });
+            if (it == kernels.rbegin())
+                scalarDecode = decode;
+            std::printf("%-18s %-8s %12.1f %12.1f %9.2fx\n", test.name, *it, decode, findNull, scalarDecode / decode);
+        }
+    }
+    RegString::UseKernel(RegString::GetKernelNames().front());
+    return 0;
+}
@@ -0,0 +1,155 @@
+#include "Check.h"
+#include "RegCodec.h"
+#include <cstdlib>
+#include <random>
+#include <vector>
+
+// Fuzzes the value codecs with random and unaligned data under every name kernel.
+// Built as a plain test it runs a fixed number of seeded iterations (RegCodecFuzz [iterations]);
+// define REGKEY_LIBFUZZER and link with -fsanitize=fuzzer to drive FuzzOne from libFuzzer instead.
+namespace
+{
+    // What StringCodec::Decode must return, computed without the kernels.
+    String ReferenceString(const BYTE *data, size_t size)
+    {
+        size_t length = RegString::FindNullScalar(data, size / sizeof(Char));
+        String value(length, Char(0));
+        if (length > 0)
+            memcpy(&value[0], data, length * sizeof(Char));
+        return value;
+    }
+
+    std::vector<String> ReferenceMultiString(const BYTE *data, size_t size)
+    {
+        std::vector<String> value;
+        size_t count = size / sizeof(Char);
+        for (size_t begin = 0; begin < count;)
+        {
+            String item = ReferenceString(data + begin * sizeof(Char), (count - begin) * sizeof(Char));
+            if (item.empty())
+                break;
+            begin += item.size() + 1;
+            value.push_back(std::move(item));
+        }
+        return value;
+    }
+
+    // Decoding any data and encoding the result back must give a value that decodes the same.
+    template <DWORD Type>
+    void CheckStable(const BYTE *data, size_t size)
+    {
+        typename RegCodec<Type>::Value value{};
+        if (!RegCodec<Type>::Decode(data, size, value))
+            return;
+        ByteArray encoded;
+        if (!RegCodec<Type>::Encode(value, encoded))
+            return;
+        typename RegCodec<Type>::Value again{};
+        CHECK(RegCodec<Type>::Decode(encoded.data(), encoded.size(), again));
+        CHECK(again == value);
+    }
+
+    // One input, decoded as every type at the alignment it was given.
+    void FuzzOne(const BYTE *data, size_t size)
+    {
+        String text;
+        CHECK(RegCodec<REG_SZ>::Decode(data, size, text));
+        CHECK(text == ReferenceString(data, size));
+
+        std::vector<String> strings;
+        CHECK(RegCodec<REG_MULTI_SZ>::Decode(data, size, strings));
+        CHECK(strings == ReferenceMultiString(data, size));
+
+        DWORD dword = 0;
+        CHECK(RegCodec<REG_DWORD>::Decode(data, size, dword) == (size == 4));
+        DWORD bigEndian = 0;
+        if (RegCodec<REG_DWORD_BIG_ENDIAN>::Decode(data, size, bigEndian))
+            CHECK(bigEndian == (DWORD(data[0]) << 24 | DWORD(data[1]) << 16 | DWORD(data[2]) << 8 | DWORD(data[3])));
+        QWORD qword = 0;
+        CHECK(RegCodec<REG_QWORD>::Decode(data, size, qword) == (size == 8));
+
+        CheckStable<REG_SZ>(data, size);
+        CheckStable<REG_EXPAND_SZ>(data, size);
+        CheckStable<REG_MULTI_SZ>(data, size);
+        CheckStable<REG_DWORD>(data, size);
+        CheckStable<REG_DWORD_BIG_ENDIAN>(data, size);
+        CheckStable<REG_QWORD>(data, size);
+        CheckStable<REG_BINARY>(data, size);
+    }
+
+    // Native values survive encoding and decoding; values the type cannot hold are rejected.
+    void RoundTripValues(std::mt19937 &random)
+    {
+        auto randomString = [&](size_t length, bool allowNull) {
+            String value;
+            for (size_t i = 0; i < length; i++)
+            {
+                Char c = Char(random() % 3 == 0 ? random() % 0x10000 : 'a' + random() % 26);
+                value += c == 0 && !allowNull ? Char('z') : c;
+            }
+            return value;
+        };
+
+        String text = randomString(random() % 200, false);
+        ByteArray data;
+        CHECK(RegCodec<REG_SZ>::Encode(text, data));
+        CHECK(data.size() == (text.size() + 1) * sizeof(Char));
+        String decoded;
+        CHECK(RegCodec<REG_SZ>::Decode(data.data(), data.size(), decoded) && decoded == text);
+
+        std::vector<String> strings(random() % 6);
+        for (String &item : strings)
+            item = randomString(1 + random() % 40, false);
+        CHECK(RegCodec<REG_MULTI_SZ>::Encode(strings, data));
+        std::vector<String> decodedStrings;
+        CHECK(RegCodec<REG_MULTI_SZ>::Decode(data.data(), data.size(), decodedStrings) && decodedStrings == strings);
+
+        // An empty element or one with a null would not come back the same.
+        std::vector<String> invalid = strings;
+        invalid.insert(invalid.begin() + random() % (invalid.size() + 1), random() % 2 ? String() : STR("a") + String(1, Char(0)) + STR("b"));
+        CHECK(!RegCodec<REG_MULTI_SZ>::Encode(invalid, data));
+
+        DWORD dword = DWORD(random());
+        CHECK(RegCodec<REG_DWORD_BIG_ENDIAN>::Encode(dword, data));
+        CHECK(data.size() == 4 && data[0] == BYTE(dword >> 24) && data[3] == BYTE(dword));
+        DWORD decodedDword = 0;
+        CHECK(RegCodec<REG_DWORD_BIG_ENDIAN>::Decode(data.data(), data.size(), decodedDword) && decodedDword == dword);
+
+        QWORD qword = QWORD(random()) << 32 | random();
+        CHECK(RegCodec<REG_QWORD>::Encode(qword, data));
+        QWORD decodedQword = 0;
+        CHECK(RegCodec<REG_QWORD>::Decode(data.data(), data.size(), decodedQword) && decodedQword == qword);
+    }
+}
+
+#ifdef REGKEY_LIBFUZZER
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size)
+{
+    FuzzOne(data, size);
+    return Check::Failures() == 0 ? 0 : (abort(), 0);
+}
+#else
+int main(int argc, char **argv)
+{
+    int iterations = argc > 1 ? atoi(argv[1]) : 20000;
+    std::mt19937 random(33);
+    std::vector<BYTE> buffer(4096 + 16);
+    for (const char *kernel : RegString::GetKernelNames())
+    {
+        RegString::UseKernel(kernel);
+        for (int i = 0; i < iterations; i++)
+        {
+            // Mostly text-like data with nulls, sometimes raw bytes, at any byte offset.
+            size_t size = random() % 4 == 0 ? random() % 4096 : random() % 64;
+            BYTE *data = buffer.data() + random() % 16;
+            bool raw = random() % 4 == 0;
+            for (size_t j = 0; j < size; j++)
+                data[j] = raw ? BYTE(random()) : BYTE(random() % 8 == 0 ? 0 : (j % 2 == 0 ? 'a' + random() % 26 : 0));
+            FuzzOne(data, size);
+            RoundTripValues(random);
+        }
+    }
+    RegString::UseKernel(RegString::GetKernelNames().front());
+    return CHECK_RESULT();
+}
+#endif
@@ -0,0 +1,247 @@
+#include "Check.h"
+#include "RegColumnar.h"
+#include "RegKey.h"
+#include "RegString.h"
+#include "TempFile.h"
+#include <random>
+
+// Writes dumps with small pages, checks every kind of scan against the rows that were added,
+// and opens damaged copies: they must fail to open or scan, or scan consistently.
+namespace
+{
+    std::mt19937 random(47);
+
+    struct Row
+    {
+        String path;
+        String name;
+        DWORD type;
+        ByteArray data;
+    };
+
+    std::vector<Row> RandomRows(size_t count)
+    {
+        static const Char *const paths[] = {STR(""), STR("App"), STR("app\\Sub"), STR("Apple"), STR("Banana"), STR("banana\\Deep\\Er"), STR("Cherry")};
+        static const Char *const names[] = {STR(""), STR("Path"), STR("path2"), STR("Version"), STR("Install"), STR("installDate"), STR("Z")};
+        static const DWORD types[] = {REG_SZ, REG_DWORD, REG_BINARY, REG_MULTI_SZ, REG_QWORD};
+        std::vector<Row> rows(count);
+        for (Row &row : rows)
+        {
+            row.path = paths[random() % 7];
+            row.name = names[random() % 7];
+            row.type = types[random() % 5];
+            row.data.resize(random() % 8 == 0 ? random() % 3000 : random() % 40);
+            for (BYTE &b : row.data)
+                b = BYTE(random());
+        }
+        return rows;
+    }
+
+    bool IsSortedFold(const std::vector<String> &strings)
+    {
+        for (size_t i = 1; i < strings.size(); i++)
+            if (RegString::CompareFold(strings[i - 1].c_str(), strings[i - 1].size(), strings[i].c_str(), strings[i].size()) >= 0)
+                return false;
+        return true;
+    }
+
+    bool StartsWithFold(const String &str, const String &prefix)
+    {
+        return str.size() >= prefix.size() && RegString::EqualsFold(str.c_str(), prefix.size(), prefix.c_str(), prefix.size());
+    }
+
+    // The rows a scan of `column` over [min, max] must return, in order.
+    void CheckScan(RegColumnarReader &reader, const std::vector<Row> &rows, RegColumn column, uint32_t min, uint32_t max)
+    {
+        RegColumnScan scan;
+        CHECK(reader.Scan(column, min, max, scan));
+        CHECK(scan.rows.size() == scan.values.size());
+
+        const std::vector<String> &dictionary = reader.GetDictionary(column);
+        std::vector<uint32_t> expected;
+        ByteArray data;
+        for (uint32_t i = 0; i < rows.size(); i++)
+        {
+            const Row &row = rows[i];
+            uint32_t value = 0;
+            if (column == RegColumn::Type)
+                value = row.type;
+            else if (column == RegColumn::Data)
+                value = uint32_t(row.data.size());
+            else
+            {
+                const String &str = column == RegColumn::Path ? row.path : row.name;
+                value = uint32_t(std::find(dictionary.begin(), dictionary.end(), str) - dictionary.begin());
+            }
+            if (value < min || value > max)
+                continue;
+            expected.push_back(i);
+            if (column == RegColumn::Data)
+                data.insert(data.end(), row.data.begin(), row.data.end());
+        }
+        CHECK(scan.rows == expected);
+        if (column == RegColumn::Data)
+            CHECK(scan.data == data);
+    }
+
+    void TestScans(const TempFile &file)
+    {
+        std::vector<Row> rows = RandomRows(1000);
+        RegColumnarWriter writer(STR("HKCU\\Software\\ColumnarTest"), 16);
+        for (const Row &row : rows)
+            writer.Add(row.path, row.name, row.type, row.data.data(), row.data.size());
+        size_t bytes = 0;
+        CHECK(writer.Write(file.Path(), &bytes));
+        CHECK(bytes == file.Read().size());
+
+        RegColumnarReader reader;
+        CHECK(reader.Open(file.Path()));
+        CHECK(reader.GetRowCount() == rows.size());
+        CHECK(reader.GetSource() == STR("HKCU\\Software\\ColumnarTest"));
+        CHECK(IsSortedFold(reader.GetDictionary(RegColumn::Path)));
+        CHECK(IsSortedFold(reader.GetDictionary(RegColumn::Name)));
+        CHECK(reader.GetDictionary(RegColumn::Type).empty() && reader.GetDictionary(RegColumn::Data).empty());
+
+        // Prefixes map to the range of codes whose strings start with them.
+        const Char *const prefixes[] = {STR("app"), STR("APPLE"), STR("b"), STR("install"), STR("p"), STR("none"), STR("")};
+        for (RegColumn column : {RegColumn::Path, RegColumn::Name})
+        {
+            const std::vector<String> &dictionary = reader.GetDictionary(column);
+            for (const Char *prefix : prefixes)
+            {
+                uint32_t min = 0, max = 0;
+                bool found = reader.FindPrefix(column, prefix, &min, &max);
+                uint32_t count = 0;
+                for (uint32_t code = 0; code < dictionary.size(); code++)
+                {
+                    bool match = StartsWithFold(dictionary[code], prefix);
+                    count += match;
+                    if (found && match)
+                        CHECK(code >= min && code <= max);
+                }
+                CHECK(found == (count > 0));
+                if (found)
+                {
+                    CHECK(max - min + 1 == count);
+                    CheckScan(reader, rows, column, min, max);
+                }
+            }
+        }
+
+        CheckScan(reader, rows, RegColumn::Type, REG_DWORD, REG_DWORD);
+        CheckScan(reader, rows, RegColumn::Type, REG_SZ, REG_BINARY);
+        CheckScan(reader, rows, RegColumn::Type, 0, 0xFFFFFFFF);
+        CheckScan(reader, rows, RegColumn::Data, 1000, 0xFFFFFFFF);
+        CheckScan(reader, rows, RegColumn::Data, 0, 0);
+        CheckScan(reader, rows, RegColumn::Data, 0, 0xFFFFFFFF);
+        // An empty range, and one between the pages' values.
+        CheckScan(reader, rows, RegColumn::Type, 5, 4);
+        CheckScan(reader, rows, RegColumn::Type, 100, 200);
+    }
+
+    void TestTree(const TempFile &file)
+    {
+        std::shared_ptr<RegBackend> backend = RegBackend::Get("memory");
+        RegKey root(backend);
+        CHECK(root.Create(HKEY_CURRENT_USER, STR("Software\\ColumnarTree"), KEY_ALL_ACCESS) != NULL);
+        root.SetStringValue(STR(""), STR("root"));
+        size_t values = 1;
+        for (int i = 0; i < 30; i++)
+        {
+            RegKey app(backend);
+            CHECK(app.Create(root.GetHandle(), STR("App") + String(size_t(i % 5 + 1), Char('a' + i)), KEY_ALL_ACCESS) != NULL);
+            app.SetDwordValue(STR("Version"), DWORD(i));
+            app.SetStringValue(STR("Path"), String(size_t(i), Char('p')));
+            RegKey deep(backend);
+            CHECK(deep.Create(app.GetHandle(), STR("Deep"), KEY_ALL_ACCESS) != NULL);
+            deep.SetStringValue(STR("path"), STR("x"));
+            values += 3;
+        }
+
+        RegColumnarWriter writer(STR("HKCU\\Software\\ColumnarTree"), 8);
+        CHECK(writer.AddTree(root));
+        CHECK(writer.GetRowCount() == values);
+        CHECK(writer.Write(file.Path()));
+        RegColumnarReader reader;
+        CHECK(reader.Open(file.Path()));
+        uint32_t min = 0, max = 0;
+        CHECK(reader.FindPrefix(RegColumn::Name, STR("PATH"), &min, &max));
+        RegColumnScan names, dwords;
+        CHECK(reader.Scan(RegColumn::Name, min, max, names) && names.rows.size() == 60);
+        CHECK(reader.Scan(RegColumn::Type, REG_DWORD, REG_DWORD, dwords) && dwords.rows.size() == 30);
+        root.Close();
+        RegKey software(backend);
+        CHECK(software.Open(HKEY_CURRENT_USER, STR("Software"), KEY_ALL_ACCESS) != NULL);
+        CHECK(software.DeleteSubKey(STR("ColumnarTree")));
+
+        // A dump without rows opens and scans empty.
+        RegColumnarWriter empty(STR("empty"));
+        CHECK(empty.Write(file.Path()));
+        RegColumnarReader emptyReader;
+        RegColumnScan none;
+        CHECK(emptyReader.Open(file.Path()) && emptyReader.GetRowCount() == 0);
+        CHECK(emptyReader.Scan(RegColumn::Data, 0, 0xFFFFFFFF, none) && none.rows.empty());
+    }
+
+    // Damaged copies of a dump either fail to open, fail to scan, or give rows within the dump.
+    void TestDamaged(const TempFile &file)
+    {
+        std::vector<Row> rows = RandomRows(200);
+        RegColumnarWriter writer(STR("damaged"), 16);
+        for (const Row &row : rows)
+            writer.Add(row.path, row.name, row.type, row.data.data(), row.data.size());
+        CHECK(writer.Write(file.Path()));
+        ByteArray dump = file.Read();
+
+        RegColumnarReader reader;
+        file.Write(ByteArray());
+        CHECK(!reader.Open(file.Path()));
+        CHECK(!reader.Open(file.Path() + ".missing"));
+
+        int opened = 0;
+        for (int i = 0; i < 2000; i++)
+        {
+            ByteArray damaged = dump;
+            for (int j = 0, count = 1 + random() % 4; j < count; j++)
+                damaged[random() % damaged.size()] = BYTE(random());
+            if (random() % 4 == 0)
+                damaged.resize(random() % damaged.size());
+            file.Write(damaged);
+
+            RegColumnarReader damagedReader;
+            if (!damagedReader.Open(file.Path()))
+                continue;
+            opened++;
+            for (size_t column = 0; column < RegColumnCount; column++)
+            {
+                RegColumnScan scan;
+                if (!damagedReader.Scan(RegColumn(column), 0, 0xFFFFFFFF, scan))
+                    continue;
+                CHECK(scan.rows.size() == scan.values.size());
+                bool inRange = true;
+                size_t total = 0;
+                for (size_t k = 0; k < scan.rows.size(); k++)
+                {
+                    inRange = inRange && scan.rows[k] < damagedReader.GetRowCount();
+                    if (RegColumn(column) == RegColumn::Data)
+                        total += scan.values[k];
+                    else if (RegColumn(column) != RegColumn::Type)
+                        inRange = inRange && scan.values[k] < damagedReader.GetDictionary(RegColumn(column)).size();
+                }
+                CHECK(inRange);
+                if (RegColumn(column) == RegColumn::Data)
+                    CHECK(total == scan.data.size());
+            }
+        }
+        CHECK(opened > 0);
+    }
+}
+
+int main()
+{
+    TempFile file("columnar-test.rkcd");
+    TestScans(file);
+    TestTree(file);
+    TestDamaged(file);
+    return CHECK_RESULT();
+}
@@ -0,0 +1,83 @@
+#include "RegCompress.h"
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+
+// Times compression and decompression of REG_BINARY-sized payloads, and reports the ratio.
+// Usage: RegCompressBenchmark [scale], where scale multiplies the number of rounds (default 10).
+namespace
+{
+    volatile size_t sink;
+
+    template <typename Body>
+    double MegabytesPerSecond(size_t bytes, int rounds, Body body)
+    {
+        auto start = std::chrono::steady_clock::now();
+        size_t total = 0;
+        for (int round = 0; round < rounds; round++)
+            total += body();
+        auto elapsed = std::chrono::steady_clock::now() - start;
+        sink = total;
+        return double(bytes) * rounds / std::chrono::duration<double>(elapsed).count() / (1024 * 1024);
+    }
+}
+
+int main(int argc, char **argv)
+{
+    int scale = argc > 1 ? atoi(argv[1]) : 10;
+    if (scale < 1)
+        scale = 1;
+
+    std::mt19937 random(9);
+    const size_t size = 1024 * 1024;
+    struct Case
+    {
+        const char *name;
+        ByteArray data;
+    };
+    Case cases[] = {{"text", ByteArray()}, {"records", ByteArray()}, {"random", ByteArray()}};
+    // Words with some noise, fixed-size records with a few changing fields, and incompressible bytes.
+    static const char words[][8] = {"alpha", "beta", "gamma", "delta", "key", "value", "\\", "0x"};
+    while (cases[0].data.size() < size)
+    {
+        const char *word = words[random() % 8];
+        cases[0].data.insert(cases[0].data.end(), word, word + strlen(word));
+        if (random() % 16 == 0)
+            cases[0].data.push_back(BYTE(random()));
+    }
+    for (uint32_t i = 0; cases[1].data.size() < size; i++)
+    {
+        BYTE record[32] = {};
+        memcpy(record, &i, sizeof(i));
+        record[8] = BYTE(random() % 4);
+        cases[1].data.insert(cases[1].data.end(), record, record + sizeof(record));
+    }
+    for (size_t i = 0; i < size; i++)
+        cases[2].data.push_back(BYTE(random()));
+
+    std::printf("%-8s %8s %14s %14s\n", "data", "ratio", "compress MB/s", "decode MB/s");
+    for (Case &test : cases)
+    {
+        test.data.resize(size);
+        ByteArray compressed;
+        bool smaller = RegCompress::Compress(test.data.data(), size, compressed);
+        int rounds = scale * 2;
+        double compress = MegabytesPerSecond(size, rounds, [&]() {
+            ByteArray out;
+            RegCompress::Compress(test.data.data(), size, out);
+            return out.size();
+        });
+        double decode = 0;
+        if (smaller)
+        {
+            ByteArray raw(size);
+            decode = MegabytesPerSecond(size, rounds * 4, [&]() {
+                return size_t(RegCompress::Decompress(compressed.data(), compressed.size(), raw.data(), size));
+            });
+        }
+        std::printf("%-8s %7.2fx %14.0f %14.0f\n", test.name, smaller ? double(size) / compressed.size() : 1.0, compress, decode);
+    }
+    return 0;
+}
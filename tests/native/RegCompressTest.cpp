@@ -0,0 +1,112 @@
+#include "Check.h"
+#include "RegCompress.h"
+#include <cstring>
+#include <random>
+#include <vector>
+
+// Round-trips payloads through the codec and checks that plain data starting with the magic is
+// not taken for a compressed value.
+namespace
+{
+    std::mt19937 random(44);
+
+    // Repetitive text with some noise, compressible like most large REG_BINARY caches.
+    ByteArray Payload(size_t size)
+    {
+        static const char words[][8] = {"alpha", "beta", "gamma", "delta", "key", "value", "\\", "0x"};
+        ByteArray data;
+        while (data.size() < size)
+        {
+            if (random() % 16 == 0)
+                data.push_back(BYTE(random()));
+            else
+            {
+                const char *word = words[random() % 8];
+                data.insert(data.end(), word, word + strlen(word));
+            }
+        }
+        data.resize(size);
+        return data;
+    }
+
+    ByteArray WithMagic(size_t size)
+    {
+        ByteArray data(size);
+        for (BYTE &b : data)
+            b = BYTE(random());
+        const BYTE header[] = {'R', 'K', 'Z', 1, 0x10, 0, 0, 0, 0, 0, 1, 0};
+        memcpy(data.data(), header, std::min(size, sizeof(header)));
+        return data;
+    }
+
+    void TestRoundTrip()
+    {
+        const size_t sizes[] = {1, 100, RegCompress::BlockSize - 1, RegCompress::BlockSize, RegCompress::BlockSize * 3 + 17};
+        for (size_t size : sizes)
+        {
+            ByteArray data = Payload(size);
+            ByteArray compressed;
+            if (!RegCompress::Compress(data.data(), data.size(), compressed))
+            {
+                CHECK(compressed.empty());
+                continue;
+            }
+            CHECK(compressed.size() < data.size());
+            CHECK(RegCompress::IsCompleteValue(compressed.data(), compressed.size()));
+            CHECK(RegCompress::GetRawSize(compressed.data()) == size);
+            ByteArray raw(size);
+            CHECK(RegCompress::Decompress(compressed.data(), compressed.size(), raw.data(), raw.size()));
+            CHECK(raw == data);
+
+            // Fed in odd chunks, the decoder produces the same bytes.
+            ByteArray streamed;
+            RegCompress::Decoder decoder;
+            for (size_t at = 0; at < compressed.size();)
+            {
+                size_t chunk = std::min<size_t>(1 + random() % 5000, compressed.size() - at);
+                CHECK(decoder.Feed(compressed.data() + at, chunk, [&](const BYTE *block, size_t blockSize) {
+                    streamed.insert(streamed.end(), block, block + blockSize);
+                }));
+                at += chunk;
+            }
+            CHECK(decoder.IsDone() && streamed == data);
+
+            // Cut or extended, the value is no longer whole.
+            CHECK(!RegCompress::IsCompleteValue(compressed.data(), compressed.size() - 1));
+            compressed.push_back(0);
+            CHECK(!RegCompress::IsCompleteValue(compressed.data(), compressed.size()));
+        }
+    }
+
+    void TestPlainDataWithMagic()
+    {
+        for (int i = 0; i < 2000; i++)
+        {
+            ByteArray data = WithMagic(RegCompress::HeaderSize + random() % 300);
+            // The header is valid, so only the framing check can tell.
+            CHECK(RegCompress::IsCompressed(data.data(), data.size()));
+            CHECK(!RegCompress::IsCompleteValue(data.data(), data.size()));
+        }
+
+        // Corrupt blocks in a well-framed value fail to decode instead of reading out of bounds.
+        ByteArray data = Payload(RegCompress::BlockSize * 2);
+        ByteArray compressed;
+        CHECK(RegCompress::Compress(data.data(), data.size(), compressed));
+        ByteArray raw(data.size());
+        for (int i = 0; i < 200; i++)
+        {
+            ByteArray corrupt = compressed;
+            for (int j = 0; j < 4; j++)
+                corrupt[RegCompress::HeaderSize + 4 + random() % (corrupt.size() - RegCompress::HeaderSize - 4)] = BYTE(random());
+            if (RegCompress::IsCompleteValue(corrupt.data(), corrupt.size()))
+                RegCompress::Decompress(corrupt.data(), corrupt.size(), raw.data(), raw.size());
+        }
+    }
+}
+
+int main()
+{
+    TestRoundTrip();
+    TestPlainDataWithMagic();
+    return CHECK_RESULT();
+}
@@ -0,0 +1,214 @@
+#include "Check.h"
+#include "MemoryBackend.h"
+#include "RegConnectionPool.h"
+#include <atomic>
+#include <chrono>
+#include <thread>
+
+// The shared connection pool against a stand-in backend that counts connects and closes and can
+// be made to fail health checks: idle connections are reused, busy ones shared past maxPerHost,
+// and broken or expired ones closed.
+namespace
+{
+    class StandInBackend : public MemoryBackend
+    {
+    public:
+        std::atomic<int> connects{0};
+        std::atomic<int> closes{0};
+        std::atomic<bool> broken{false};
+
+        LSTATUS ConnectRegistry(const Char *host, HKEY hKey, HKEY *result) override
+        {
+            connects++;
+            return MemoryBackend::ConnectRegistry(host, hKey, result);
+        }
+
+        LSTATUS CloseKey(HKEY hKey) override
+        {
+            closes++;
+            return MemoryBackend::CloseKey(hKey);
+        }
+
+        LSTATUS QueryInfoKey(HKEY hKey, RegKeyInfo *info) override
+        {
+            if (broken)
+                return RPC_S_SERVER_UNAVAILABLE;
+            return MemoryBackend::QueryInfoKey(hKey, info);
+        }
+    };
+
+    RegConnectionPool &Pool(size_t maxPerHost, unsigned idleTimeout = 60000, unsigned healthCheckInterval = 60000)
+    {
+        RegConnectionPoolOptions options;
+        options.maxPerHost = maxPerHost;
+        options.idleTimeout = idleTimeout;
+        options.healthCheckInterval = healthCheckInterval;
+        RegConnectionPool::Shared().SetOptions(options);
+        return RegConnectionPool::Shared();
+    }
+
+    void TestReuse()
+    {
+        std::shared_ptr<StandInBackend> backend = std::make_shared<StandInBackend>();
+        RegConnectionPool &pool = Pool(2);
+        RegConnectionPoolStats before = pool.GetStats();
+
+        HKEY first = NULL, again = NULL;
+        CHECK(pool.Acquire(backend, STR("\\\\Server"), HKEY_LOCAL_MACHINE, &first) == ERROR_SUCCESS);
+        pool.Release(backend, first);
+        // The same host spelled differently gets the idle connection.
+        CHECK(pool.Acquire(backend, STR("SERVER"), HKEY_LOCAL_MACHINE, &again) == ERROR_SUCCESS);
+        CHECK(again == first);
+        pool.Release(backend, again);
+        CHECK(backend->connects == 1 && backend->closes == 0);
+
+        RegConnectionPoolStats stats = pool.GetStats();
+        CHECK(stats.connects - before.connects == 1);
+        CHECK(stats.reuses - before.reuses == 1);
+        CHECK(stats.open == before.open + 1 && stats.busy == before.busy);
+
+        // Another backend never gets this backend's connections.
+        std::shared_ptr<StandInBackend> other = std::make_shared<StandInBackend>();
+        HKEY separate = NULL;
+        CHECK(pool.Acquire(other, STR("server"), HKEY_LOCAL_MACHINE, &separate) == ERROR_SUCCESS);
+        CHECK(other->connects == 1);
+        pool.Release(other, separate);
+
+        pool.Clear();
+        CHECK(backend->closes == 1 && other->closes == 1);
+        CHECK(pool.GetStats().open == before.open);
+    }
+
+    void TestSharing()
+    {
+        std::shared_ptr<StandInBackend> backend = std::make_shared<StandInBackend>();
+        RegConnectionPool &pool = Pool(2);
+
+        // Busy connections are added up to maxPerHost, then the least used one is shared.
+        HKEY a = NULL, b = NULL, c = NULL, d = NULL;
+        CHECK(pool.Acquire(backend, STR("host"), HKEY_LOCAL_MACHINE, &a) == ERROR_SUCCESS);
+        CHECK(pool.Acquire(backend, STR("host"), HKEY_LOCAL_MACHINE, &b) == ERROR_SUCCESS);
+        CHECK(a != b && backend->connects == 2);
+        pool.Release(backend, a);
+        CHECK(pool.Acquire(backend, STR("host"), HKEY_LOCAL_MACHINE, &c) == ERROR_SUCCESS);
+        CHECK(c == a);
+        CHECK(pool.Acquire(backend, STR("host"), HKEY_LOCAL_MACHINE, &d) == ERROR_SUCCESS);
+        CHECK((d == a || d == b) && backend->connects == 2);
+
+        // At the limit with connections to another root, a connection is opened outside the pool
+        // and closed by its only user.
+        HKEY user = NULL;
+        CHECK(pool.Acquire(backend, STR("host"), HKEY_CURRENT_USER, &user) == ERROR_SUCCESS);
+        CHECK(backend->connects == 3);
+        pool.Release(backend, user);
+        CHECK(backend->closes == 1);
+
+        for (HKEY hKey : {b, c, d})
+            pool.Release(backend, hKey);
+        CHECK(pool.GetStats().busy == 0);
+        pool.Clear();
+        CHECK(backend->closes == 3);
+    }
+
+    void TestBroken()
+    {
+        std::shared_ptr<StandInBackend> backend = std::make_shared<StandInBackend>();
+        RegConnectionPool &pool = Pool(2, 60000, 0);
+        RegConnectionPoolStats before = pool.GetStats();
+
+        // A connection error reported on release retires the connection.
+        HKEY first = NULL, second = NULL;
+        CHECK(pool.Acquire(backend, STR("host"), HKEY_LOCAL_MACHINE, &first) == ERROR_SUCCESS);
+        pool.Release(backend, first, ERROR_BAD_NETPATH);
+        CHECK(backend->closes == 1);
+        CHECK(pool.Acquire(backend, STR("host"), HKEY_LOCAL_MACHINE, &second) == ERROR_SUCCESS);
+        CHECK(backend->connects == 2);
+        pool.Release(backend, second, ERROR_FILE_NOT_FOUND);
+        CHECK(backend->closes == 1);
+
+        // An idle connection that fails its health check is closed and replaced.
+        backend->broken = true;
+        HKEY third = NULL;
+        CHECK(pool.Acquire(backend, STR("host"), HKEY_LOCAL_MACHINE, &third) == ERROR_SUCCESS);
+        CHECK(backend->connects == 3 && backend->closes == 2);
+        pool.Release(backend, third);
+        backend->broken = false;
+        CHECK(pool.GetStats().unhealthy - before.unhealthy == 2);
+        pool.Clear();
+    }
+
+    void TestEviction()
+    {
+        std::shared_ptr<StandInBackend> backend = std::make_shared<StandInBackend>();
+        RegConnectionPool &pool = Pool(2, 50);
+        RegConnectionPoolStats before = pool.GetStats();
+
+        HKEY idle = NULL, busy = NULL;
+        CHECK(pool.Acquire(backend, STR("host"), HKEY_LOCAL_MACHINE, &idle) == ERROR_SUCCESS);
+        CHECK(pool.Acquire(backend, STR("host"), HKEY_LOCAL_MACHINE, &busy) == ERROR_SUCCESS);
+        pool.Release(backend, idle);
+
+        // Only the unused connection expires.
+        for (int i = 0; i < 100 && backend->closes == 0; i++)
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        CHECK(backend->closes == 1);
+        RegConnectionPoolStats stats = pool.GetStats();
+        CHECK(stats.expired - before.expired == 1);
+        CHECK(stats.open == before.open + 1 && stats.busy == before.busy + 1);
+
+        pool.Release(backend, busy);
+        for (int i = 0; i < 100 && backend->closes == 1; i++)
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        CHECK(backend->closes == 2);
+        CHECK(pool.GetStats().open == before.open);
+    }
+
+    void TestDisabled()
+    {
+        std::shared_ptr<StandInBackend> backend = std::make_shared<StandInBackend>();
+        RegConnectionPool &pool = Pool(0);
+
+        HKEY first = NULL, second = NULL;
+        CHECK(pool.Acquire(backend, STR("host"), HKEY_LOCAL_MACHINE, &first) == ERROR_SUCCESS);
+        CHECK(pool.Acquire(backend, STR("host"), HKEY_LOCAL_MACHINE, &second) == ERROR_SUCCESS);
+        CHECK(backend->connects == 2);
+        pool.Release(backend, first);
+        pool.Release(backend, second);
+        CHECK(backend->closes == 2);
+    }
+
+    // Many threads on one host never open more than maxPerHost pooled connections.
+    void TestConcurrent()
+    {
+        std::shared_ptr<StandInBackend> backend = std::make_shared<StandInBackend>();
+        RegConnectionPool &pool = Pool(3);
+        std::vector<std::thread> threads;
+        for (int t = 0; t < 8; t++)
+        {
+            threads.emplace_back([&]() {
+                for (int i = 0; i < 200; i++)
+                {
+                    HKEY hKey = NULL;
+                    CHECK(pool.Acquire(backend, STR("host"), HKEY_LOCAL_MACHINE, &hKey) == ERROR_SUCCESS);
+                    pool.Release(backend, hKey);
+                }
+            });
+        }
+        for (std::thread &thread : threads)
+            thread.join();
+        CHECK(backend->connects <= 3);
+        pool.Clear();
+        CHECK(backend->closes == backend->connects);
+    }
+}
+
+int main()
+{
+    TestReuse();
+    TestSharing();
+    TestBroken();
+    TestEviction();
+    TestDisabled();
+    TestConcurrent();
+    return CHECK_RESULT();
+}
@@ -0,0 +1,115 @@
+#include "Check.h"
+#include "RegExpand.h"
+#include <cstdlib>
+#include <string>
+
+// Expands REG_EXPAND_SZ text the way ExpandEnvironmentStrings does: unknown names and stray '%'
+// are kept, the result is not expanded again, and a snapshot does not follow later changes
+// to the process environment.
+namespace
+{
+    String Widen(const std::string &str)
+    {
+        return String(str.begin(), str.end());
+    }
+
+    void Expect(const RegEnvironment &environment, const std::string &text, const std::string &expected)
+    {
+        String result = environment.Expand(Widen(text));
+        if (result != Widen(expected))
+            std::printf("%s expanded to something other than %s\n", text.c_str(), expected.c_str());
+        CHECK(result == Widen(expected));
+    }
+
+    void TestExpand()
+    {
+        RegEnvironment environment;
+        environment.Set(STR("SystemRoot"), STR("C:\\Windows"));
+        environment.Set(STR("A"), STR("1"));
+        environment.Set(STR("Loop"), STR("%A%"));
+        environment.Set(STR("Empty"), STR(""));
+
+        Expect(environment, "%SystemRoot%\\System32", "C:\\Windows\\System32");
+        Expect(environment, "%SYSTEMROOT%", "C:\\Windows");
+        Expect(environment, "%A%%A%", "11");
+        Expect(environment, "[%Empty%]", "[]");
+        Expect(environment, "no variables", "no variables");
+        Expect(environment, "", "");
+
+        // Undefined names are kept as written.
+        Expect(environment, "%Undefined%\\bin", "%Undefined%\\bin");
+        Expect(environment, "%Undefined%A%", "%Undefined1");
+
+        // "%%" is not an escape, and unpaired '%' stay.
+        Expect(environment, "100%%", "100%%");
+        Expect(environment, "%%A%", "%1");
+        Expect(environment, "50% off", "50% off");
+        Expect(environment, "%A", "%A");
+        Expect(environment, "%", "%");
+
+        // A single pass: values are not expanded again.
+        Expect(environment, "%Loop%", "%A%");
+
+        // Set replaces, ignoring case.
+        environment.Set(STR("a"), STR("2"));
+        Expect(environment, "%A%", "2");
+        CHECK(environment.GetSize() == 4);
+    }
+
+    void TestGrowth()
+    {
+        RegEnvironment environment;
+        for (int i = 0; i < 500; i++)
+            environment.Set(Widen("Var" + std::to_string(i)), Widen(std::to_string(i * 7)));
+        CHECK(environment.GetSize() == 500);
+        for (int i = 0; i < 500; i++)
+        {
+            String name = Widen("VAR" + std::to_string(i));
+            const String *value = environment.Find(name.c_str(), name.size());
+            CHECK(value != nullptr && *value == Widen(std::to_string(i * 7)));
+        }
+        CHECK(environment.Find(STR("Var500"), 6) == nullptr);
+        Expect(environment, "%var1%-%VAR499%", "7-3493");
+    }
+
+#ifndef _WIN32
+    void TestSnapshot()
+    {
+        setenv("REGKEY_EXPAND_TEST", "before", 1);
+        setenv("REGKEY_EXPAND_UTF8", "caf\xC3\xA9 \xFF", 1);
+        std::shared_ptr<RegEnvironment> snapshot = RegEnvironment::Snapshot();
+
+        // Later changes to the process environment do not reach the snapshot, and the reverse.
+        setenv("REGKEY_EXPAND_TEST", "after", 1);
+        unsetenv("REGKEY_EXPAND_UTF8");
+        setenv("REGKEY_EXPAND_NEW", "new", 1);
+        Expect(*snapshot, "%regkey_expand_test%", "before");
+        Expect(*snapshot, "%REGKEY_EXPAND_NEW%", "%REGKEY_EXPAND_NEW%");
+        snapshot->Set(STR("REGKEY_EXPAND_TEST"), STR("changed"));
+        CHECK(std::string(getenv("REGKEY_EXPAND_TEST")) == "after");
+
+        std::shared_ptr<RegEnvironment> later = RegEnvironment::Snapshot();
+        Expect(*later, "%REGKEY_EXPAND_TEST%", "after");
+        Expect(*later, "%REGKEY_EXPAND_NEW%", "new");
+        Expect(*snapshot, "%REGKEY_EXPAND_TEST%", "changed");
+
+        // Values are decoded from UTF-8, with invalid bytes as U+FFFD.
+        const String *value = snapshot->Find(STR("REGKEY_EXPAND_UTF8"), 18);
+        CHECK(value != nullptr && *value == String(STR("caf\u00E9 \uFFFD")));
+        CHECK(later->Find(STR("REGKEY_EXPAND_UTF8"), 18) == nullptr);
+
+        unsetenv("REGKEY_EXPAND_TEST");
+        unsetenv("REGKEY_EXPAND_NEW");
+    }
+#endif
+}
+
+int main()
+{
+    TestExpand();
+    TestGrowth();
+#ifndef _WIN32
+    TestSnapshot();
+#endif
+    return CHECK_RESULT();
+}
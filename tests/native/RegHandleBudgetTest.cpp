@@ -0,0 +1,172 @@
+#include "Check.h"
+#include "RegHandleBudget.h"
+#include <memory>
+#include <thread>
+#include <vector>
+
+// The handle budget with stand-in keys: the least recently used idle keys of the calling thread
+// are evicted past the limit, busy, pinned and other threads' keys are kept, and the counts of
+// open handles, evictions and reopens stay exact.
+namespace
+{
+    class Key : public RegHandleBudget::Entry
+    {
+    public:
+        bool open = false;
+        // Like a key with buffered writes, which cannot be closed.
+        bool busy = false;
+        bool evicted = false;
+
+        void Open()
+        {
+            bool reopened = evicted;
+            open = true;
+            evicted = false;
+            RegHandleBudget::Shared().Opened(this, reopened);
+        }
+
+        // Reopens the key if it was evicted and marks it as used.
+        void Use()
+        {
+            if (evicted)
+                Open();
+            else
+                RegHandleBudget::Shared().Touch(this);
+        }
+
+        void Close()
+        {
+            open = false;
+            RegHandleBudget::Shared().Closed(this);
+        }
+
+    protected:
+        bool _Evict() override
+        {
+            if (busy)
+                return false;
+            open = false;
+            evicted = true;
+            return true;
+        }
+    };
+
+    typedef std::vector<std::unique_ptr<Key>> Keys;
+
+    Keys OpenKeys(size_t count)
+    {
+        Keys keys;
+        for (size_t i = 0; i < count; i++)
+        {
+            keys.emplace_back(new Key());
+            keys.back()->Open();
+        }
+        return keys;
+    }
+
+    RegHandleBudgetStats Delta(const RegHandleBudgetStats &before)
+    {
+        RegHandleBudgetStats stats = RegHandleBudget::Shared().GetStats();
+        stats.open -= before.open;
+        stats.evictions -= before.evictions;
+        stats.reopens -= before.reopens;
+        return stats;
+    }
+
+    void TestLru()
+    {
+        RegHandleBudget &budget = RegHandleBudget::Shared();
+        RegHandleBudgetStats before = budget.GetStats();
+        budget.SetLimit(3);
+
+        // The oldest keys go first.
+        Keys keys = OpenKeys(5);
+        CHECK(!keys[0]->open && !keys[1]->open && keys[2]->open && keys[3]->open && keys[4]->open);
+        RegHandleBudgetStats stats = Delta(before);
+        CHECK(stats.open == 3 && stats.evictions == 2 && stats.reopens == 0);
+
+        // Using a key makes it the most recent, so the next eviction skips it.
+        keys[2]->Use();
+        keys[0]->Use();
+        CHECK(keys[0]->open && keys[2]->open && !keys[3]->open && keys[4]->open);
+        stats = Delta(before);
+        CHECK(stats.open == 3 && stats.evictions == 3 && stats.reopens == 1);
+
+        // Reopening repeatedly keeps the count at the limit.
+        for (int round = 0; round < 10; round++)
+            for (auto &key : keys)
+                key->Use();
+        stats = Delta(before);
+        CHECK(stats.open == 3 && stats.reopens == stats.evictions - 2);
+
+        // Closed keys stop counting, once; lowering the limit evicts right away.
+        for (auto &key : keys)
+            if (key->open)
+            {
+                key->Close();
+                key->Close();
+                break;
+            }
+        CHECK(Delta(before).open == 2);
+        budget.SetLimit(1);
+        CHECK(Delta(before).open == 1);
+
+        // Without a limit nothing is evicted.
+        budget.SetLimit(0);
+        for (auto &key : keys)
+            key->Use();
+        CHECK(Delta(before).open == 4);
+        keys.clear();
+        CHECK(Delta(before).open == 0);
+        CHECK(budget.GetStats().peak >= before.open + 4);
+    }
+
+    void TestKept()
+    {
+        RegHandleBudget &budget = RegHandleBudget::Shared();
+        RegHandleBudgetStats before = budget.GetStats();
+        budget.SetLimit(2);
+
+        // A key that cannot be closed is skipped for the next one.
+        Keys keys = OpenKeys(2);
+        keys[0]->busy = true;
+        keys.emplace_back(new Key());
+        keys.back()->Open();
+        CHECK(keys[0]->open && !keys[1]->open && keys[2]->open);
+
+        // Pinned keys are kept, even when that leaves the count over the limit.
+        {
+            RegHandleBudget::Pin pin(keys[2].get());
+            keys[1]->Use();
+            CHECK(keys[0]->open && keys[1]->open && keys[2]->open);
+            CHECK(Delta(before).open == 3);
+        }
+        // Once unpinned, the next open trims again.
+        keys.emplace_back(new Key());
+        keys.back()->Open();
+        CHECK(Delta(before).open == 2 && keys[0]->open && keys[3]->open);
+
+        // A thread evicts only its own keys, so past the limit the other thread's keys are left open.
+        Keys other;
+        std::thread([&other]() {
+            other = OpenKeys(3);
+        }).join();
+        CHECK(!other[0]->open && !other[1]->open && other[2]->open);
+        keys.emplace_back(new Key());
+        keys.back()->Open();
+        CHECK(other[2]->open && !keys[3]->open);
+        CHECK(Delta(before).open == 3);
+
+        keys.clear();
+        other.clear();
+        budget.SetLimit(0);
+        CHECK(Delta(before).open == 0);
+    }
+}
+
+int main()
+{
+    TestLru();
+    TestKept();
+    return CHECK_RESULT();
+}
@@ -0,0 +1,189 @@
+#include "Check.h"
+#include "MemoryBackend.h"
+#include "RegConnectionPool.h"
+#include "RegHostQuery.h"
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstring>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+
+// Queries many hosts of a stand-in backend whose connects can be slow, hang past the deadline or
+// fail: no more than `concurrency` live hosts are in flight, hung hosts are reported as timed out
+// without holding up the rest, and every host is reported exactly once.
+namespace
+{
+    typedef std::chrono::steady_clock Clock;
+
+    // "slow*" hosts take 20 ms to connect, "hung*" hosts 600 ms, and "down*" hosts fail.
+    class StandInBackend : public MemoryBackend
+    {
+    public:
+        std::atomic<int> inFlight{0};
+        std::atomic<int> maxInFlight{0};
+
+        LSTATUS ConnectRegistry(const Char *host, HKEY hKey, HKEY *result) override
+        {
+            String name(host);
+            name.erase(0, name.find_first_not_of(STR('\\')));
+            int current = ++inFlight;
+            for (int max = maxInFlight; current > max && !maxInFlight.compare_exchange_weak(max, current);)
+            {
+            }
+            if (name.compare(0, 4, STR("slow")) == 0)
+                std::this_thread::sleep_for(std::chrono::milliseconds(20));
+            else if (name.compare(0, 4, STR("hung")) == 0)
+                std::this_thread::sleep_for(std::chrono::milliseconds(600));
+            inFlight--;
+            if (name.compare(0, 4, STR("down")) == 0)
+                return ERROR_BAD_NETPATH;
+            return MemoryBackend::ConnectRegistry(host, hKey, result);
+        }
+    };
+
+    String Host(const char *prefix, int i)
+    {
+        std::string name = prefix + std::to_string(i);
+        return String(name.begin(), name.end());
+    }
+
+    struct Outcome
+    {
+        std::map<String, RegHostResult> results;
+        int reports = 0;
+        LSTATUS status = ERROR_IO_PENDING;
+        double elapsed = 0;
+    };
+
+    // Waits `settle` milliseconds after the query is done, for answers that come in late.
+    Outcome Run(const std::shared_ptr<StandInBackend> &backend, std::vector<String> hosts,
+                const RegHostQueryOptions &options, bool cancelEarly = false, int settle = 0)
+    {
+        std::mutex mutex;
+        std::condition_variable finished;
+        Outcome outcome;
+        Clock::time_point start = Clock::now();
+        std::shared_ptr<RegHostQuery> query;
+        query = RegHostQuery::Create(backend, std::move(hosts), HKEY_LOCAL_MACHINE, STR("Software\\Inventory"),
+            {STR("Version")}, options,
+            [&](RegHostResult &&result) {
+                std::lock_guard<std::mutex> lock(mutex);
+                outcome.reports++;
+                outcome.results[result.host] = std::move(result);
+                if (cancelEarly && outcome.reports == 1)
+                    query->Cancel();
+            },
+            [&](LSTATUS status) {
+                std::lock_guard<std::mutex> lock(mutex);
+                outcome.status = status;
+                outcome.elapsed = std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+                finished.notify_all();
+            });
+        query->Start();
+        std::unique_lock<std::mutex> lock(mutex);
+        finished.wait(lock, [&] { return outcome.status != ERROR_IO_PENDING; });
+        lock.unlock();
+        std::this_thread::sleep_for(std::chrono::milliseconds(settle));
+        lock.lock();
+        return outcome;
+    }
+
+    void AddInventory(const std::shared_ptr<StandInBackend> &backend, const String &host, DWORD version)
+    {
+        HKEY root = NULL;
+        CHECK(backend->MemoryBackend::ConnectRegistry(host.c_str(), HKEY_LOCAL_MACHINE, &root) == ERROR_SUCCESS);
+        RegKey key(backend);
+        CHECK(key.Create(root, STR("Software\\Inventory"), KEY_ALL_ACCESS) != NULL);
+        CHECK(key.SetDwordValue(STR("Version"), version));
+        CHECK(backend->CloseKey(root) == ERROR_SUCCESS);
+    }
+
+    void TestConcurrency()
+    {
+        std::shared_ptr<StandInBackend> backend = std::make_shared<StandInBackend>();
+        std::vector<String> hosts;
+        for (int i = 0; i < 20; i++)
+        {
+            hosts.push_back(Host("slow", i));
+            AddInventory(backend, hosts.back(), DWORD(i));
+        }
+
+        RegHostQueryOptions options;
+        options.concurrency = 4;
+        options.timeout = 0;
+        Outcome outcome = Run(backend, hosts, options);
+        CHECK(outcome.status == ERROR_SUCCESS);
+        CHECK(outcome.reports == 20 && outcome.results.size() == 20);
+        CHECK(backend->maxInFlight == 4);
+        // Five rounds of four hosts at 20 ms each.
+        CHECK(outcome.elapsed >= 95);
+        for (int i = 0; i < 20; i++)
+        {
+            const RegHostResult &result = outcome.results[Host("slow", i)];
+            CHECK(result.status == ERROR_SUCCESS && result.statuses.size() == 1 && result.statuses[0] == ERROR_SUCCESS);
+            CHECK(result.values.size() == 1 && result.values[0].data.size() == sizeof(DWORD));
+            DWORD version = 0;
+            memcpy(&version, result.values[0].data.data(), sizeof(version));
+            CHECK(version == DWORD(i));
+        }
+        RegConnectionPool::Shared().Clear();
+    }
+
+    void TestTimeout()
+    {
+        std::shared_ptr<StandInBackend> backend = std::make_shared<StandInBackend>();
+        std::vector<String> hosts = {Host("hung", 0), Host("slow", 0), Host("hung", 1), Host("down", 0),
+                                     Host("slow", 1), Host("slow", 2), Host("none", 0)};
+        for (int i = 0; i < 3; i++)
+            AddInventory(backend, Host("slow", i), DWORD(i));
+
+        RegHostQueryOptions options;
+        options.concurrency = 2;
+        options.timeout = 100;
+        Outcome outcome = Run(backend, hosts, options, false, 700);
+        CHECK(outcome.status == ERROR_SUCCESS);
+        // The late answers of the hung hosts are dropped.
+        CHECK(outcome.reports == 7 && outcome.results.size() == 7);
+
+        // Both hung hosts time out; their threads are replaced, so the rest do not wait for them.
+        for (int i = 0; i < 2; i++)
+        {
+            const RegHostResult &result = outcome.results[Host("hung", i)];
+            CHECK(result.status == ERROR_TIMEOUT && result.values.empty());
+            CHECK(result.elapsed >= 100 && result.elapsed < 600);
+        }
+        CHECK(outcome.elapsed < 600);
+        for (int i = 0; i < 3; i++)
+            CHECK(outcome.results[Host("slow", i)].status == ERROR_SUCCESS);
+        CHECK(outcome.results[Host("down", 0)].status == ERROR_BAD_NETPATH);
+        CHECK(outcome.results[Host("none", 0)].status == ERROR_FILE_NOT_FOUND);
+        RegConnectionPool::Shared().Clear();
+    }
+
+    void TestCancel()
+    {
+        std::shared_ptr<StandInBackend> backend = std::make_shared<StandInBackend>();
+        std::vector<String> hosts;
+        for (int i = 0; i < 20; i++)
+            hosts.push_back(Host("slow", i));
+
+        RegHostQueryOptions options;
+        options.concurrency = 2;
+        Outcome outcome = Run(backend, hosts, options, true);
+        CHECK(outcome.status == ERROR_CANCELLED);
+        // The first report cancels; the other host in flight still reports.
+        CHECK(outcome.reports == 2);
+        RegConnectionPool::Shared().Clear();
+    }
+}
+
+int main()
+{
+    TestConcurrency();
+    TestTimeout();
+    TestCancel();
+    return CHECK_RESULT();
+}
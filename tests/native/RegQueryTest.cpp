@@ -0,0 +1,215 @@
+#include "Check.h"
+#include "RegQuery.h"
+#include <condition_variable>
+#include <mutex>
+#include <set>
+#include <string>
+
+// Compiles and runs path queries against a small tree on the memory backend, and checks the
+// message and offset of syntax errors.
+namespace
+{
+    std::string Narrow(const String &str)
+    {
+        std::string out;
+        for (Char c : str)
+            out += c < 128 ? char(c) : '?';
+        return out;
+    }
+
+    String Widen(const std::string &str)
+    {
+        return String(str.begin(), str.end());
+    }
+
+    // Matches as "path" for keys and "path @name:type:size" for values.
+    std::set<std::string> Run(const std::string &expression)
+    {
+        RegQueryPlan plan;
+        std::string error;
+        size_t position = 0;
+        std::set<std::string> matches;
+        if (!RegQuery::Compile(Widen(expression), plan, error, &position))
+        {
+            std::printf("%s: %s at %zu\n", expression.c_str(), error.c_str(), position);
+            matches.insert("error");
+            return matches;
+        }
+        RegKey root(RegBackend::Get("memory"));
+        if (root.Open(HKEY_LOCAL_MACHINE, plan.root, KEY_READ) == NULL)
+            return matches;
+
+        std::mutex mutex;
+        std::condition_variable finished;
+        bool done = false;
+        bool duplicates = false;
+        LSTATUS result = ERROR_CANCELLED;
+        std::shared_ptr<RegQuery> query = RegQuery::Create(std::move(root), plan,
+            [&](std::vector<RegQueryMatch> &&found) {
+                std::lock_guard<std::mutex> lock(mutex);
+                for (const RegQueryMatch &match : found)
+                {
+                    std::string line = Narrow(match.path);
+                    if (match.isValue)
+                        line += " @" + Narrow(match.valueName) + ":" + std::to_string(match.type) + ":" + std::to_string(match.data.size());
+                    duplicates = !matches.insert(line).second || duplicates;
+                }
+            },
+            [&](LSTATUS status) {
+                std::lock_guard<std::mutex> lock(mutex);
+                result = status;
+                done = true;
+                finished.notify_all();
+            });
+        query->Start();
+        std::unique_lock<std::mutex> lock(mutex);
+        finished.wait(lock, [&] { return done; });
+        CHECK(result == ERROR_SUCCESS);
+        CHECK(!duplicates);
+        return matches;
+    }
+
+    void Expect(const std::string &expression, const std::set<std::string> &expected)
+    {
+        std::set<std::string> matches = Run(expression);
+        if (matches != expected)
+        {
+            std::printf("%s matched:", expression.c_str());
+            for (const std::string &match : matches)
+                std::printf(" [%s]", match.c_str());
+            std::printf("\n");
+        }
+        CHECK(matches == expected);
+    }
+
+    void ExpectError(const std::string &expression, const std::string &message, size_t offset)
+    {
+        RegQueryPlan plan;
+        std::string error;
+        size_t position = 0;
+        CHECK(!RegQuery::Compile(Widen(expression), plan, error, &position));
+        CHECK(error == message);
+        CHECK(position == offset);
+    }
+
+    RegKey Make(const std::string &path)
+    {
+        RegKey key(RegBackend::Get("memory"));
+        CHECK(key.Create(HKEY_LOCAL_MACHINE, Widen(path), KEY_ALL_ACCESS) != NULL);
+        return key;
+    }
+
+    void BuildTree()
+    {
+        RegKey java = Make("Software\\Oracle\\Uninstall\\Java8");
+        java.SetStringValue(STR("DisplayName"), STR("Java 8 Update 361"));
+        java.SetStringValue(STR("DisplayVersion"), STR("8.0.3610"));
+        java.SetDwordValue(STR("EstimatedSize"), 200000);
+        RegKey jdk = Make("Software\\Oracle\\Uninstall\\JDK17");
+        jdk.SetStringValue(STR("DisplayName"), STR("java(TM) SE Development Kit 17"));
+        jdk.SetStringValue(STR("DisplayVersion"), STR("17.0.2"));
+        jdk.SetDwordValue(STR("EstimatedSize"), 300000);
+        RegKey tool = Make("Software\\Vendor\\Uninstall\\Tool");
+        tool.SetStringValue(STR("DisplayName"), STR("Some Tool"));
+        tool.SetDwordValue(STR("DisplayVersion"), 7);
+        tool.SetMultiStringValue(STR("Tags"), {STR("alpha"), STR("Beta")});
+        tool.SetStringValue(STR(""), STR("default"));
+        RegKey hidden = Make("Software\\Vendor\\Deep\\A\\B\\Uninstall\\Hidden");
+        hidden.SetStringValue(STR("DisplayName"), STR("Java hidden"));
+        Make("Software\\Vendor\\Uninstall\\Empty");
+        RegKey spaced = Make("Software\\With Space\\x/y");
+        spaced.SetQwordValue(STR("Big"), 0x100000000ULL);
+    }
+
+    void TestPlans()
+    {
+        // Leading literal steps are folded into the root.
+        RegQueryPlan plan;
+        std::string error;
+        size_t position = 0;
+        CHECK(RegQuery::Compile(STR("HKLM/Software/Oracle/Uninstall/*[DisplayName ~ \"Java*\"]/DisplayVersion"), plan, error, &position));
+        CHECK(plan.baseKey == STR("HKLM") && plan.root == STR("Software\\Oracle\\Uninstall"));
+        CHECK(plan.steps.size() == 2);
+        CHECK(plan.steps[0].kind == RegQueryStepKind::Pattern && plan.steps[0].predicates.size() == 1);
+        CHECK(plan.steps[0].predicates[0].op == RegQueryOp::Match && plan.steps[0].predicates[0].text == STR("Java*"));
+        CHECK(plan.steps[1].kind == RegQueryStepKind::Literal && plan.steps[1].name == STR("DisplayVersion"));
+
+        CHECK(RegQuery::Compile(STR("HKLM/Software/**/X:REG_DWORD[Size >= 0x10]"), plan, error, &position) == false);
+        CHECK(RegQuery::Compile(STR("HKLM/Software/**/*[Size >= 0x10]"), plan, error, &position));
+        CHECK(plan.steps.size() == 2 && plan.steps[0].kind == RegQueryStepKind::Recursive);
+        CHECK(plan.steps[1].predicates[0].numeric && plan.steps[1].predicates[0].number == 16);
+    }
+
+    void TestQueries()
+    {
+        Expect("HKLM/Software/*/Uninstall/*[DisplayName ~ \"Java*\"]/DisplayVersion",
+               {"Oracle\\Uninstall\\Java8 @DisplayVersion:1:18", "Oracle\\Uninstall\\JDK17 @DisplayVersion:1:14"});
+        Expect("HKLM/Software/Oracle/Uninstall/Java8", {"Java8"});
+        Expect("HKLM/Software/Oracle/Uninstall/Java8/DisplayName", {" @DisplayName:1:36"});
+        Expect("HKLM/Software/Oracle/Uninstall/*", {"Java8", "JDK17"});
+
+        // Recursion, including none and two in a row.
+        Expect("HKLM/Software/**/Uninstall/*[DisplayName ~ \"*java*\"]",
+               {"Oracle\\Uninstall\\Java8", "Oracle\\Uninstall\\JDK17", "Vendor\\Deep\\A\\B\\Uninstall\\Hidden"});
+        Expect("HKLM/Software/**/Hidden", {"Vendor\\Deep\\A\\B\\Uninstall\\Hidden"});
+        Expect("HKLM/Software/Vendor/**", {"", "Uninstall", "Uninstall\\Tool", "Uninstall\\Empty", "Deep", "Deep\\A",
+                                           "Deep\\A\\B", "Deep\\A\\B\\Uninstall", "Deep\\A\\B\\Uninstall\\Hidden"});
+        Expect("HKLM/Software/**/**/Hidden", {"Vendor\\Deep\\A\\B\\Uninstall\\Hidden"});
+
+        // Typed steps select values of that type only.
+        Expect("HKLM/Software/*/Uninstall/*/DisplayVersion:REG_DWORD", {"Vendor\\Uninstall\\Tool @DisplayVersion:4:4"});
+        Expect("HKLM/Software/*/Uninstall/*/DisplayVersion:sz",
+               {"Oracle\\Uninstall\\Java8 @DisplayVersion:1:18", "Oracle\\Uninstall\\JDK17 @DisplayVersion:1:14"});
+
+        // Predicates: numbers, hexadecimal, patterns on integers, several at once, types, multi-strings, the default value.
+        Expect("HKLM/Software/*/Uninstall/*[EstimatedSize > 250000]", {"Oracle\\Uninstall\\JDK17"});
+        Expect("HKLM/Software/*/Uninstall/*[EstimatedSize <= 200000]", {"Oracle\\Uninstall\\Java8"});
+        Expect("HKLM/Software/*/Uninstall/*[EstimatedSize = 0x30D40]", {"Oracle\\Uninstall\\Java8"});
+        Expect("HKLM/Software/*/Uninstall/*[EstimatedSize ~ \"3*\"]", {"Oracle\\Uninstall\\JDK17"});
+        Expect("HKLM/Software/*/Uninstall/*[EstimatedSize][DisplayName = \"JAVA 8 UPDATE 361\"]", {"Oracle\\Uninstall\\Java8"});
+        Expect("HKLM/Software/*/Uninstall/*[DisplayVersion:REG_DWORD]", {"Vendor\\Uninstall\\Tool"});
+        Expect("HKLM/Software/*/Uninstall/*[DisplayVersion != \"17.0.2\"]", {"Oracle\\Uninstall\\Java8", "Vendor\\Uninstall\\Tool"});
+        Expect("HKLM/Software/*/Uninstall/*[Tags = \"beta\"]", {"Vendor\\Uninstall\\Tool"});
+        Expect("HKLM/Software/*/Uninstall/*[Tags != \"beta\"]", {});
+        Expect("HKLM/Software/*/Uninstall/*[@ = \"default\"]", {"Vendor\\Uninstall\\Tool"});
+        Expect("HKLM/Software/With Space/*[Big > 4294967295]", {"x/y"});
+
+        // Values of the last step, by name, wildcard, @ and "".
+        Expect("HKLM/Software/Vendor/Uninstall/Tool/@", {" @:1:16"});
+        Expect("HKLM/Software/Vendor/Uninstall/Tool/\"\"", {" @:1:16"});
+        Expect("HKLM/Software/Vendor/Uninstall/Tool/*", {" @DisplayName:1:20", " @DisplayVersion:4:4", " @Tags:7:24", " @:1:16"});
+        Expect("HKLM/Software/Vendor/Uninstall/Tool/Display*", {" @DisplayName:1:20", " @DisplayVersion:4:4"});
+
+        // Quoting, separators, case and roots.
+        Expect("HKLM/Software/\"With Space\"/\"x/y\"/Big", {" @Big:11:8"});
+        Expect("HKLM\\Software\\vendor\\uninstall\\TOOL", {"TOOL"});
+        Expect("HKLM/Software//Oracle/", {"Oracle"});
+        Expect("HKLM", {""});
+        Expect("HKLM/Software/Missing/*", {});
+        Expect("HKLM/Software/Ora?le/Uninstall", {"Oracle\\Uninstall"});
+        Expect("HKLM/Software/*/Uninstall/[DisplayName]", {});
+    }
+
+    void TestErrors()
+    {
+        ExpectError("HKLM/Software/**:REG_SZ", "'**' takes no type or predicates.", 14);
+        ExpectError("HKLM/Software/*[Name ~ 5]", "Patterns must be quoted strings.", 21);
+        ExpectError("HKLM/Software/*[Name", "Operator expected.", 20);
+        ExpectError("HKLM/Software/*[Name = \"x]", "Unterminated string.", 23);
+        ExpectError("HKLM/Software/*:REG_FOO", "Unknown value type.", 16);
+        ExpectError("HKLM/Software/*[Name = bare]", "Quoted string or number expected.", 23);
+        ExpectError("\\\\host\\HKLM\\Software", "Remote queries are not supported.", 0);
+        ExpectError("HKLM:REG_SZ/x", "Base keys take no type or predicates.", 4);
+        ExpectError("HKLM/a]b", "Unexpected character.", 6);
+        ExpectError("HKLM/*:SZ[x]", "A step selects values with a type or keys with predicates, not both.", 5);
+    }
+}
+
+int main()
+{
+    BuildTree();
+    TestPlans();
+    TestQueries();
+    TestErrors();
+    return CHECK_RESULT();
+}
@@ -0,0 +1,173 @@
+#include "Check.h"
+#include "MemoryBackend.h"
+#include "RegKey.h"
+#include "RegRecorder.h"
+#include "TempFile.h"
+#include <random>
+
+// Records a workload on the memory backend, replays it, and loads and replays damaged copies of
+// the recording: they must be rejected with a message or replay without harm.
+namespace
+{
+    std::mt19937 random(46);
+
+    void ClearMemory()
+    {
+        static_cast<MemoryBackend *>(RegBackend::Get("memory")->GetTarget())->Clear();
+    }
+
+    // Writes then reads back a small tree.
+    void Workload()
+    {
+        std::shared_ptr<RegBackend> backend = RegBackend::Get("memory");
+        RegKey key(backend);
+        CHECK(key.Create(HKEY_CURRENT_USER, STR("Software\\RecorderTest"), KEY_ALL_ACCESS) != NULL);
+        for (int i = 0; i < 40; i++)
+        {
+            String name = STR("Value") + String(size_t(i % 7 + 1), Char('a' + i % 26));
+            key.SetDwordValue(name, DWORD(i));
+            key.SetStringValue(name + STR("s"), String(size_t(i * 3), Char('x')));
+        }
+        RegKey sub(backend);
+        CHECK(sub.Create(key.GetHandle(), STR("Sub\\Deep"), KEY_ALL_ACCESS) != NULL);
+        ByteArray data(300, 7);
+        sub.SetBinaryValue(STR("Binary"), data.data(), data.size());
+        for (const String &name : key.GetValueNames())
+            key.GetValue(name);
+        key.GetSubKeyNames();
+        RegKey missing(backend);
+        CHECK(missing.Open(HKEY_CURRENT_USER, STR("Software\\RecorderTestMissing"), KEY_READ) == NULL);
+    }
+
+    ByteArray Record(const TempFile &file, RegRecorder::Stats &stats)
+    {
+        CHECK(RegRecorder::Start(file.Path()));
+        CHECK(!RegRecorder::Start(file.Path()));
+        CHECK(RegRecorder::IsRecording());
+        Workload();
+        CHECK(RegRecorder::Stop(&stats));
+        CHECK(!RegRecorder::IsRecording());
+        return file.Read();
+    }
+
+    void TestRoundTrip(const TempFile &file, const RegRecorder::Stats &stats)
+    {
+        RegReplay replay;
+        std::string error;
+        CHECK(replay.Load(file.Path(), error));
+        CHECK(replay.GetCallCount() == stats.calls);
+        CHECK(stats.calls > 100 && stats.bytes == file.Read().size());
+
+        // The workload creates what it reads, so it replays on an empty backend as recorded.
+        ClearMemory();
+        RegReplayReport report = replay.Run(RegBackend::Get("memory"), RegReplayOptions());
+        CHECK(report.calls == stats.calls);
+        CHECK(report.mismatches == 0);
+        CHECK(report.latency.calls == report.calls && report.recordedLatency.calls == report.calls);
+        CHECK(report.latency.p50 <= report.latency.p99 && report.latency.p99 <= report.latency.max);
+        ClearMemory();
+    }
+
+    void CheckRejected(const TempFile &file, const ByteArray &data, const char *message)
+    {
+        file.Write(data);
+        RegReplay replay;
+        std::string error;
+        CHECK(!replay.Load(file.Path(), error));
+        CHECK(error == message);
+    }
+
+    void TestBadFiles(const TempFile &file, const ByteArray &recording)
+    {
+        RegReplay replay;
+        std::string error;
+        CHECK(!replay.Load(file.Path() + ".missing", error));
+        CHECK(error == "Cannot read the recording.");
+
+        const char *notRecording = "Not a recording, or one written by another version.";
+        CheckRejected(file, ByteArray(), notRecording);
+        CheckRejected(file, ByteArray(recording.begin(), recording.begin() + 5), notRecording);
+        ByteArray changed = recording;
+        changed[0] = 'X';
+        CheckRejected(file, changed, notRecording);
+        changed = recording;
+        changed[4]++;
+        CheckRejected(file, changed, notRecording);
+
+        // An op past the last one, and a string used before it is defined.
+        ByteArray header(recording.begin(), recording.begin() + 8);
+        changed = header;
+        changed.push_back(0xF0);
+        CheckRejected(file, changed, "Unknown record in the recording.");
+        changed = header;
+        const BYTE deleteValue[] = {BYTE(RegTraceOp::DeleteValue), 0, 0, 0, 0, 5};
+        changed.insert(changed.end(), deleteValue, deleteValue + sizeof(deleteValue));
+        CheckRejected(file, changed, "The recording is corrupt.");
+
+        // A value size no registry value has, which a replay would otherwise allocate.
+        changed = header;
+        const BYTE setValue[] = {BYTE(RegTraceOp::SetValue), 0, 0, 0, 0, 0, REG_BINARY, 0xFF, 0xFF, 0xFF, 0xFF, 0x0F};
+        changed.insert(changed.end(), setValue, setValue + sizeof(setValue));
+        CheckRejected(file, changed, "The recording is corrupt.");
+
+        // The header alone is an empty recording.
+        file.Write(header);
+        CHECK(replay.Load(file.Path(), error) && replay.GetCallCount() == 0);
+        CHECK(replay.Run(RegBackend::Get("memory"), RegReplayOptions()).calls == 0);
+    }
+
+    // Cut anywhere, the file either loads the calls before the cut or is reported truncated.
+    void TestTruncated(const TempFile &file, const ByteArray &recording, size_t calls)
+    {
+        for (size_t size = 8; size < recording.size(); size += 1 + random() % 7)
+        {
+            file.Write(ByteArray(recording.begin(), recording.begin() + size));
+            RegReplay replay;
+            std::string error;
+            if (replay.Load(file.Path(), error))
+                CHECK(replay.GetCallCount() < calls);
+            else
+                CHECK(error == "The recording is truncated." || error == "The recording is corrupt.");
+        }
+    }
+
+    // Damaged bytes after the header: loading may fail, and whatever loads must replay safely.
+    void TestDamaged(const TempFile &file, const ByteArray &recording)
+    {
+        int loaded = 0;
+        for (int i = 0; i < 300; i++)
+        {
+            ByteArray damaged = recording;
+            for (int j = 0, count = 1 + random() % 5; j < count; j++)
+                damaged[8 + random() % (damaged.size() - 8)] = BYTE(random());
+            file.Write(damaged);
+
+            RegReplay replay;
+            std::string error;
+            if (!replay.Load(file.Path(), error))
+            {
+                CHECK(!error.empty());
+                continue;
+            }
+            loaded++;
+            RegReplayOptions options;
+            options.seed = i % 2 == 0;
+            RegReplayReport report = replay.Run(RegBackend::Get("memory"), options);
+            CHECK(report.calls == replay.GetCallCount());
+            ClearMemory();
+        }
+        CHECK(loaded > 0);
+    }
+}
+
+int main()
+{
+    TempFile file("recorder-test.rkrc");
+    RegRecorder::Stats stats = RegRecorder::Stats();
+    ByteArray recording = Record(file, stats);
+    TestRoundTrip(file, stats);
+    TestBadFiles(file, recording);
+    TestTruncated(file, recording, stats.calls);
+    TestDamaged(file, recording);
+    return CHECK_RESULT();
+}
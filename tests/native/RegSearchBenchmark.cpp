@@ -0,0 +1,234 @@
+#include "Check.h"
+#include "RegSearch.h"
+#include "RegString.h"
+#include "RegTreeOp.h"
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <mutex>
+#include <random>
+#include <string>
+
+// Times a parallel search, tree copy and tree delete on the memory backend, and checks the
+// search hits against a brute-force scan and the copy against its source.
+// Usage: RegSearchBenchmark [scale], where scale multiplies the number of keys (default 10).
+namespace
+{
+    const Char *const pattern = STR("NeEdLe");
+
+    String Number(size_t n)
+    {
+        std::string digits = std::to_string(n);
+        return String(digits.begin(), digits.end());
+    }
+
+    // Three levels of keys with ten values each; about one name or string in seven contains the pattern.
+    size_t BuildTree(RegKey &root, int scale, std::mt19937 &random)
+    {
+        size_t keys = 0;
+        std::vector<String> paths;
+        for (size_t i = 0; i < 10; i++)
+        {
+            String first = (random() % 7 ? STR("Vendor") : STR("needleVendor")) + Number(i);
+            paths.push_back(first);
+            for (size_t j = 0; j < 10; j++)
+            {
+                String second = first + STR("\\Product") + Number(j);
+                paths.push_back(second);
+                for (size_t k = 0; k < size_t(8 * scale); k++)
+                    paths.push_back(second + (random() % 7 ? STR("\\Item") : STR("\\ItemNEEDLE")) + Number(k));
+            }
+        }
+        for (const String &path : paths)
+        {
+            RegKey key(root.GetBackend());
+            CHECK(key.Open(root.GetHandle(), path, KEY_ALL_ACCESS) != NULL || key.Create(root.GetHandle(), path, KEY_ALL_ACCESS) != NULL);
+            for (size_t v = 0; v < 10; v++)
+            {
+                String name = (random() % 7 ? STR("Value") : STR("Needle")) + Number(v);
+                String data = String(STR("C:\\Program Files\\")) + (random() % 7 ? STR("App") : STR("xneedlex")) + Number(random() % 1000);
+                if (v % 3 == 0)
+                    key.SetDwordValue(name, DWORD(random()));
+                else
+                    key.SetStringValue(name, data);
+            }
+            keys++;
+        }
+        return keys;
+    }
+
+    bool Contains(const String &text, const String &folded)
+    {
+        return RegString::Fold(text).find(folded) != String::npos;
+    }
+
+    // The same matching rules as RegSearch with the default options, on one thread.
+    void Scan(RegKey &key, const String &path, const String &folded, std::vector<String> &hits, size_t *values)
+    {
+        for (const RegValue &value : key.GetValues())
+        {
+            (*values)++;
+            if (Contains(value.name, folded))
+                hits.push_back(path + STR("|") + value.name + STR("|n"));
+            if (value.type == REG_SZ || value.type == REG_EXPAND_SZ || value.type == REG_MULTI_SZ)
+            {
+                String text(reinterpret_cast<const Char *>(value.data.data()), value.data.size() / sizeof(Char));
+                if (Contains(text, folded))
+                    hits.push_back(path + STR("|") + value.name + STR("|d"));
+            }
+        }
+        for (const String &name : key.GetSubKeyNames())
+        {
+            String subPath = path.empty() ? name : path + STR("\\") + name;
+            if (Contains(name, folded))
+                hits.push_back(subPath + STR("||k"));
+            RegKey subKey(key.GetBackend());
+            CHECK(subKey.Open(key.GetHandle(), name, KEY_READ) != NULL);
+            Scan(subKey, subPath, folded, hits, values);
+        }
+    }
+
+    std::vector<String> Search(RegKey &root)
+    {
+        RegKey searchRoot(root.GetBackend());
+        CHECK(searchRoot.Open(root.GetHandle(), STR(""), KEY_READ) != NULL);
+
+        std::mutex mutex;
+        std::condition_variable finished;
+        bool done = false;
+        LSTATUS result = ERROR_CANCELLED;
+        std::vector<String> hits;
+        RegSearchOptions options;
+        options.pattern = pattern;
+        std::shared_ptr<RegSearch> search = RegSearch::Create(std::move(searchRoot), options,
+            [&](std::vector<RegSearchHit> &&found) {
+                std::lock_guard<std::mutex> lock(mutex);
+                for (const RegSearchHit &hit : found)
+                {
+                    const Char *field = hit.field == RegSearchField::Key ? STR("|k") : hit.field == RegSearchField::Name ? STR("|n") : STR("|d");
+                    hits.push_back(hit.path + STR("|") + hit.valueName + field);
+                }
+            },
+            [&](LSTATUS status) {
+                std::lock_guard<std::mutex> lock(mutex);
+                result = status;
+                done = true;
+                finished.notify_all();
+            });
+        search->Start();
+        std::unique_lock<std::mutex> lock(mutex);
+        finished.wait(lock, [&] { return done; });
+        CHECK(result == ERROR_SUCCESS);
+        return hits;
+    }
+
+    RegTreeOpResult RunTreeOp(RegTreeOpKind kind, RegKey &&source, RegKey &&dest)
+    {
+        std::mutex mutex;
+        std::condition_variable finished;
+        bool done = false;
+        RegTreeOpResult result;
+        std::shared_ptr<RegTreeOp> op = RegTreeOp::Create(kind, std::move(source), std::move(dest), RegTreeOpOptions(),
+            [](const RegTreeOpProgress &) {},
+            [&](RegTreeOpResult &&opResult) {
+                std::lock_guard<std::mutex> lock(mutex);
+                result = std::move(opResult);
+                done = true;
+                finished.notify_all();
+            });
+        op->Start();
+        std::unique_lock<std::mutex> lock(mutex);
+        finished.wait(lock, [&] { return done; });
+        return result;
+    }
+
+    // Both trees hold the same keys and values.
+    void Compare(RegKey &a, RegKey &b)
+    {
+        std::vector<RegValue> aValues = a.GetValues(), bValues = b.GetValues();
+        CHECK(aValues.size() == bValues.size());
+        for (const RegValue &value : aValues)
+        {
+            RegValue copy = b.GetValue(value.name);
+            CHECK(copy.type == value.type && copy.data == value.data);
+        }
+        std::vector<String> aNames = a.GetSubKeyNames(), bNames = b.GetSubKeyNames();
+        CHECK(aNames.size() == bNames.size());
+        for (const String &name : aNames)
+        {
+            RegKey aSub(a.GetBackend()), bSub(b.GetBackend());
+            CHECK(aSub.Open(a.GetHandle(), name, KEY_READ) != NULL);
+            if (bSub.Open(b.GetHandle(), name, KEY_READ) == NULL)
+            {
+                CHECK(!"missing key in the copy");
+                continue;
+            }
+            Compare(aSub, bSub);
+        }
+    }
+
+    double Milliseconds(std::chrono::steady_clock::time_point start)
+    {
+        return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    }
+}
+
+int main(int argc, char **argv)
+{
+    int scale = argc > 1 ? atoi(argv[1]) : 10;
+    if (scale < 1)
+        scale = 1;
+
+    std::shared_ptr<RegBackend> backend = RegBackend::Get("memory");
+    RegKey root(backend);
+    CHECK(root.Create(HKEY_LOCAL_MACHINE, STR("Software\\SearchBenchmark"), KEY_ALL_ACCESS) != NULL);
+    std::mt19937 random(7);
+    size_t keys = BuildTree(root, scale, random);
+
+    auto start = std::chrono::steady_clock::now();
+    std::vector<String> hits = Search(root);
+    double searchTime = Milliseconds(start);
+
+    start = std::chrono::steady_clock::now();
+    std::vector<String> expected;
+    size_t values = 0;
+    Scan(root, STR(""), RegString::Fold(String(pattern)), expected, &values);
+    double scanTime = Milliseconds(start);
+
+    std::sort(hits.begin(), hits.end());
+    std::sort(expected.begin(), expected.end());
+    CHECK(!expected.empty());
+    CHECK(hits == expected);
+    std::printf("%zu keys, %zu values, %zu workers\n", keys, values, RegThreadPool::Shared().GetThreadCount());
+    std::printf("%-8s %10.1f ms, %zu hits (brute-force scan: %.1f ms, %zu hits)\n", "search", searchTime, hits.size(), scanTime, expected.size());
+
+    RegKey source(backend), dest(backend);
+    CHECK(source.Open(root.GetHandle(), STR(""), KEY_READ) != NULL);
+    CHECK(dest.Create(HKEY_LOCAL_MACHINE, STR("Software\\SearchBenchmarkCopy"), KEY_ALL_ACCESS) != NULL);
+    start = std::chrono::steady_clock::now();
+    RegTreeOpResult result = RunTreeOp(RegTreeOpKind::Copy, std::move(source), std::move(dest));
+    double copyTime = Milliseconds(start);
+    CHECK(result.status == ERROR_SUCCESS);
+    CHECK(result.progress.keys == keys + 1 && result.progress.values == values);
+    std::printf("%-8s %10.1f ms, %llu keys\n", "copy", copyTime, (unsigned long long)result.progress.keys);
+
+    RegKey copy(backend);
+    CHECK(copy.Open(HKEY_LOCAL_MACHINE, STR("Software\\SearchBenchmarkCopy"), KEY_READ) != NULL);
+    Compare(root, copy);
+    copy.Close();
+
+    CHECK(source.Open(HKEY_LOCAL_MACHINE, STR("Software\\SearchBenchmarkCopy"), KEY_ALL_ACCESS) != NULL);
+    start = std::chrono::steady_clock::now();
+    result = RunTreeOp(RegTreeOpKind::Delete, std::move(source), RegKey(backend));
+    double deleteTime = Milliseconds(start);
+    CHECK(result.status == ERROR_SUCCESS);
+    // The root itself stays, emptied.
+    CHECK(copy.Open(HKEY_LOCAL_MACHINE, STR("Software\\SearchBenchmarkCopy"), KEY_READ) != NULL);
+    CHECK(copy.GetSubKeyNames().empty() && copy.GetValues().empty());
+    std::printf("%-8s %10.1f ms, %llu keys\n", "delete", deleteTime, (unsigned long long)result.progress.keys);
+
+    CHECK(root.DeleteTree());
+    return CHECK_RESULT();
+}
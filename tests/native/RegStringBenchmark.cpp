@@ -0,0 +1,75 @@
+#include "RegString.h"
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <vector>
+
+// Times the name kernels against the scalar reference on typical registry names.
+// Usage: RegStringBenchmark [scale], where scale multiplies the number of rounds (default 10).
+namespace
+{
+    volatile uint64_t sink;
+
+    template <typename Body>
+    double NanosecondsPerName(size_t names, int rounds, Body body)
+    {
+        auto start = std::chrono::steady_clock::now();
+        uint64_t total = 0;
+        for (int round = 0; round < rounds; round++)
+            for (size_t i = 0; i < names; i++)
+                total += uint64_t(body(i));
+        auto elapsed = std::chrono::steady_clock::now() - start;
+        sink = total;
+        return std::chrono::duration<double, std::nano>(elapsed).count() / double(names * rounds);
+    }
+}
+
+int main(int argc, char **argv)
+{
+    int scale = argc > 1 ? atoi(argv[1]) : 10;
+    if (scale < 1)
+        scale = 1;
+
+    std::mt19937 random(7);
+    const size_t lengths[] = {8, 24, 64, 256};
+    std::printf("%-8s %-6s %12s %12s %12s %12s\n", "kernel", "length", "compare ns", "hash ns", "findnull ns", "vs scalar");
+
+    for (size_t length : lengths)
+    {
+        // Pairs equal ignoring case, the worst case for a comparison.
+        const size_t names = 1024;
+        std::vector<String> a(names), b(names);
+        for (size_t i = 0; i < names; i++)
+        {
+            for (size_t j = 0; j < length; j++)
+            {
+                Char c = Char('a' + random() % 26);
+                a[i] += c;
+                b[i] += random() % 2 ? Char(c - 'a' + 'A') : c;
+            }
+        }
+        int rounds = int(scale * 20000 / (length + 16));
+
+        double scalarCompare = 0;
+        std::vector<const char *> kernels = RegString::GetKernelNames();
+        for (auto it = kernels.rbegin(); it != kernels.rend(); it++)
+        {
+            RegString::UseKernel(*it);
+            double compare = NanosecondsPerName(names, rounds, [&](size_t i) {
+                return RegString::CompareFold(a[i].c_str(), a[i].size(), b[i].c_str(), b[i].size());
+            });
+            double hash = NanosecondsPerName(names, rounds, [&](size_t i) {
+                return RegString::HashFold(a[i].c_str(), a[i].size());
+            });
+            double findNull = NanosecondsPerName(names, rounds, [&](size_t i) {
+                return RegString::FindNull(a[i].c_str(), a[i].size());
+            });
+            if (it == kernels.rbegin())
+                scalarCompare = compare;
+            std::printf("%-8s %-6zu %12.1f %12.1f %12.1f %11.2fx\n", *it, length, compare, hash, findNull, scalarCompare / compare);
+        }
+    }
+    RegString::UseKernel(RegString::GetKernelNames().front());
+    return 0;
+}
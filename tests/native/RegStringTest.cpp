@@ -0,0 +1,189 @@
+#include "Check.h"
+#include "RegString.h"
+#include <cstring>
+#include <random>
+#include <vector>
+
+// Compares every vectorized kernel with the scalar reference on random mixed-script names,
+// at every alignment a block load can see.
+namespace
+{
+    std::mt19937 random(20240611);
+
+    // ASCII letters dominate, so the vector paths are taken, mixed with other scripts so the
+    // fallback to the scalar table happens at every position within a block.
+    Char RandomChar()
+    {
+        static const Char others[] = {
+            0x00C0, 0x00E9, 0x00FF, 0x0130, 0x0131, 0x017F, 0x0391, 0x03C9, 0x0410, 0x044F,
+            0x1E9E, 0x212A, 0x4E2D, 0xD83D, 0xDE00, 0xFF21, 0xFF41, '@', '[', '`', '{', '\\'};
+        unsigned pick = random() % 100;
+        if (pick < 40)
+            return Char('a' + random() % 26);
+        if (pick < 80)
+            return Char('A' + random() % 26);
+        if (pick < 88)
+            return Char(' ' + random() % 95);
+        return others[random() % (sizeof(others) / sizeof(others[0]))];
+    }
+
+    String RandomName(size_t length)
+    {
+        String name;
+        for (size_t i = 0; i < length; i++)
+            name += RandomChar();
+        return name;
+    }
+
+    // The same name with the case of ASCII letters flipped at random.
+    String Recase(const String &name)
+    {
+        String result = name;
+        for (Char &c : result)
+        {
+            if (random() % 2 == 0)
+                continue;
+            if (c >= 'a' && c <= 'z')
+                c = Char(c - 'a' + 'A');
+            else if (c >= 'A' && c <= 'Z')
+                c = Char(c - 'A' + 'a');
+        }
+        return result;
+    }
+
+    int Sign(int value)
+    {
+        return value < 0 ? -1 : (value > 0 ? 1 : 0);
+    }
+
+    size_t RandomLength()
+    {
+        // Mostly around the block sizes, sometimes long.
+        return random() % 4 == 0 ? random() % 600 : random() % 70;
+    }
+
+    void TestKernel(const char *kernel)
+    {
+        CHECK(RegString::UseKernel(kernel));
+        CHECK(strcmp(RegString::GetKernelName(), kernel) == 0);
+
+        std::vector<Char> bufferA(1024), bufferB(1024);
+        for (int iteration = 0; iteration < 20000; iteration++)
+        {
+            String a = RandomName(RandomLength());
+            String b;
+            switch (random() % 4)
+            {
+            case 0:
+                b = Recase(a);
+                break;
+            case 1:
+                // Equal up to one changed character.
+                b = Recase(a);
+                if (!b.empty())
+                    b[random() % b.size()] = RandomChar();
+                break;
+            case 2:
+                b = Recase(a.substr(0, a.empty() ? 0 : random() % a.size()));
+                break;
+            default:
+                b = RandomName(RandomLength());
+                break;
+            }
+
+            // Unaligned copies: block loads start anywhere within a 32-byte line.
+            Char *pa = bufferA.data() + random() % 16;
+            Char *pb = bufferB.data() + random() % 16;
+            std::copy(a.begin(), a.end(), pa);
+            std::copy(b.begin(), b.end(), pb);
+
+            int expected = RegString::CompareFoldScalar(pa, a.size(), pb, b.size());
+            CHECK(Sign(RegString::CompareFold(pa, a.size(), pb, b.size())) == expected);
+            CHECK(RegString::EqualsFold(pa, a.size(), pb, b.size()) == (expected == 0));
+            CHECK(RegString::HashFold(pa, a.size()) == RegString::HashFoldScalar(pa, a.size()));
+            if (expected == 0)
+                CHECK(RegString::HashFold(pa, a.size()) == RegString::HashFold(pb, b.size()));
+
+            String folded = RegString::Fold(pa, a.size());
+            bool foldedMatches = folded.size() == a.size();
+            for (size_t i = 0; foldedMatches && i < a.size(); i++)
+                foldedMatches = folded[i] == RegString::FoldChar(a[i]);
+            CHECK(foldedMatches);
+        }
+    }
+
+    void TestFindNull(const char *kernel)
+    {
+        CHECK(RegString::UseKernel(kernel));
+
+        std::vector<unsigned char> bytes(4096 + 2);
+        for (int iteration = 0; iteration < 20000; iteration++)
+        {
+            size_t length = RandomLength();
+            // Odd byte offsets too: data read from a value is not aligned to Char.
+            unsigned char *units = bytes.data() + random() % 33;
+            for (size_t i = 0; i < length; i++)
+            {
+                Char c = RandomChar();
+                // Units with one zero byte must not be taken for a terminator.
+                if (random() % 8 == 0)
+                    c = Char(random() % 2 == 0 ? 0x0100 : 0x0001);
+                memcpy(units + i * sizeof(Char), &c, sizeof(Char));
+            }
+            if (length > 0 && random() % 2 == 0)
+            {
+                Char zero = 0;
+                memcpy(units + (random() % length) * sizeof(Char), &zero, sizeof(Char));
+            }
+            CHECK(RegString::FindNull(units, length) == RegString::FindNullScalar(units, length));
+        }
+    }
+
+    // Pairs Windows treats as equal across the scripts the table covers, and the units it leaves alone.
+    void TestUpcaseTable()
+    {
+        static const Char pairs[][2] = {
+            {0x00E9, 0x00C9}, {0x00FF, 0x0178}, {0x0180, 0x0243}, {0x01C6, 0x01C4}, {0x01C5, 0x01C4},
+            {0x0229, 0x0228}, {0x1EC7, 0x1EC6}, {0x03C2, 0x03A3}, {0x03C9, 0x03A9}, {0x1FB3, 0x1FBC},
+            {0x044F, 0x042F}, {0x0561, 0x0531}, {0x10D0, 0x1C90}, {0x2D00, 0x10A0}, {0xAB70, 0x13A0},
+            {0x13F8, 0x13F0}, {0x2C81, 0x2C80}, {0x24D0, 0x24B6}, {0xFF41, 0xFF21}};
+        for (const auto &pair : pairs)
+        {
+            CHECK(RegString::FoldChar(pair[0]) == pair[1]);
+            CHECK(RegString::FoldChar(pair[1]) == pair[1]);
+            CHECK(RegString::EqualsFold(&pair[0], 1, &pair[1], 1));
+        }
+
+        static const Char unchanged[] = {0x00DF, 0x0131, 0x017F, 0x0130, 0x1E9E, 0x212A, 0x4E2D, 0xD83D, 0xDE00, 0xFFFF};
+        for (Char c : unchanged)
+            CHECK(RegString::FoldChar(c) == c);
+        CHECK(!RegString::EqualsFold(STR("\x0131"), 1, STR("I"), 1));
+        CHECK(!RegString::EqualsFold(STR("\x017F"), 1, STR("S"), 1));
+
+        // Folding is idempotent, so a folded name folds to itself.
+        for (uint32_t c = 0; c < 0x10000; c++)
+        {
+            Char folded = RegString::FoldChar(Char(c));
+            if (RegString::FoldChar(folded) != folded)
+            {
+                std::printf("U+%04X folds twice\n", unsigned(c));
+                CHECK(false);
+            }
+        }
+    }
+}
+
+int main()
+{
+    TestUpcaseTable();
+    std::vector<const char *> kernels = RegString::GetKernelNames();
+    CHECK(!kernels.empty() && strcmp(kernels.back(), "scalar") == 0);
+    CHECK(!RegString::UseKernel("none"));
+    for (const char *kernel : kernels)
+    {
+        std::printf("kernel %s\n", kernel);
+        TestKernel(kernel);
+        TestFindNull(kernel);
+    }
+    return CHECK_RESULT();
+}
@@ -0,0 +1,244 @@
+#include "Check.h"
+#include "RegKey.h"
+#include "RegTrace.h"
+#include <climits>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace
+{
+    // A strict JSON syntax check, enough to catch truncated or badly escaped output.
+    class JsonValidator
+    {
+    public:
+        explicit JsonValidator(const std::string &text)
+            : _text(text)
+            , _pos(0)
+        {
+        }
+
+        bool Validate()
+        {
+            return _Value() && (_Skip(), _pos == _text.size());
+        }
+
+    private:
+        void _Skip()
+        {
+            while (_pos < _text.size() && (_text[_pos] == ' ' || _text[_pos] == '\n' || _text[_pos] == '\r' || _text[_pos] == '\t'))
+                _pos++;
+        }
+
+        bool _Eat(char c)
+        {
+            _Skip();
+            if (_pos < _text.size() && _text[_pos] == c)
+            {
+                _pos++;
+                return true;
+            }
+            return false;
+        }
+
+        bool _String()
+        {
+            if (!_Eat('"'))
+                return false;
+            while (_pos < _text.size())
+            {
+                unsigned char c = _text[_pos++];
+                if (c == '"')
+                    return true;
+                if (c < 0x20)
+                    return false;
+                if (c == '\\')
+                {
+                    if (_pos >= _text.size())
+                        return false;
+                    char e = _text[_pos++];
+                    if (e == 'u')
+                    {
+                        for (int i = 0; i < 4; i++, _pos++)
+                            if (_pos >= _text.size() || !isxdigit((unsigned char)_text[_pos]))
+                                return false;
+                    }
+                    else if (std::string("\"\\/bfnrt").find(e) == std::string::npos)
+                        return false;
+                }
+            }
+            return false;
+        }
+
+        bool _Number()
+        {
+            _Skip();
+            size_t start = _pos;
+            if (_pos < _text.size() && _text[_pos] == '-')
+                _pos++;
+            while (_pos < _text.size() && (isdigit((unsigned char)_text[_pos]) || _text[_pos] == '.'))
+                _pos++;
+            return _pos > start && isdigit((unsigned char)_text[_pos - 1]);
+        }
+
+        bool _Value()
+        {
+            _Skip();
+            if (_pos >= _text.size())
+                return false;
+            char c = _text[_pos];
+            if (c == '"')
+                return _String();
+            if (c == '{')
+            {
+                _pos++;
+                if (_Eat('}'))
+                    return true;
+                do
+                {
+                    if (!_String() || !_Eat(':') || !_Value())
+                        return false;
+                } while (_Eat(','));
+                return _Eat('}');
+            }
+            if (c == '[')
+            {
+                _pos++;
+                if (_Eat(']'))
+                    return true;
+                do
+                {
+                    if (!_Value())
+                        return false;
+                } while (_Eat(','));
+                return _Eat(']');
+            }
+            return _Number();
+        }
+
+        const std::string &_text;
+        size_t _pos;
+    };
+
+    bool Contains(const std::string &text, const std::string &part)
+    {
+        return text.find(part) != std::string::npos;
+    }
+
+    void TestExtremeEvents()
+    {
+        RegTrace::Enable(16);
+
+        // Longer than the capacity, with characters that need escaping.
+        const String prefix = STR("\"quoted\"\\back\tslash");
+        String name = prefix;
+        while (name.size() < 100)
+            name += Char(0x4E2D);
+        RegTrace::Record(RegTraceOp::ConnectRegistry, HKEY(uintptr_t(UINT64_MAX)), name.c_str(),
+                         LSTATUS(INT_MIN), UINT64_MAX - 1, UINT64_MAX);
+        RegTrace::Record(RegTraceOp::EnumValue, HKEY(uintptr_t(1)), nullptr, ERROR_SUCCESS, 1234567, 1234567 + 5);
+        RegTrace::Record(RegTraceOp::QueryInfoKey, HKEY(uintptr_t(2)), nullptr, ERROR_SUCCESS, 0, 999);
+
+        // More threads than the ids of single-threaded runs, each with its own ring.
+        std::vector<std::thread> threads;
+        for (int i = 0; i < 20; i++)
+        {
+            threads.emplace_back([i]() {
+                String valueName = STR("Value") + String(size_t(i + 1), Char('x'));
+                RegTrace::Record(RegTraceOp::QueryValue, HKEY(uintptr_t(0x7FFFFFFFFFFFull)), valueName.c_str(),
+                                 ERROR_FILE_NOT_FOUND, 10, 20);
+            });
+        }
+        for (std::thread &thread : threads)
+            thread.join();
+
+        std::string json = RegTrace::DumpChromeJson();
+        CHECK(JsonValidator(json).Validate());
+        CHECK(Contains(json, "\"name\":\"ConnectRegistry\""));
+        CHECK(Contains(json, "\"status\":-2147483648"));
+        CHECK(Contains(json, "\"key\":\"0xffffffffffffffff\""));
+        CHECK(Contains(json, "\"ts\":18446744073709551.614"));
+        CHECK(Contains(json, "\"dur\":0.001"));
+        CHECK(Contains(json, "\"ts\":1234.567,\"dur\":0.005"));
+        CHECK(Contains(json, "\"ts\":0.000,\"dur\":0.999"));
+        CHECK(Contains(json, "\"name\":\"\\\"quoted\\\"\\\\back\\u0009slash"));
+        CHECK(Contains(json, "\"name\":\"Valuexxxxxxxxxxxxxxxxxxxx\""));
+        // Names without one are exported empty.
+        CHECK(Contains(json, "\"name\":\"EnumValue\",\"pid\":1"));
+        CHECK(Contains(json, "\"key\":\"0x1\",\"path\":\"\",\"name\":\"\"}"));
+
+        // The long name is cut at the capacity: the escaped ASCII prefix, then CJK characters.
+        std::string cjk = "\xE4\xB8\xAD";
+        std::string expected;
+        for (size_t i = prefix.size(); i < RegTraceNameCapacity; i++)
+            expected += cjk;
+        CHECK(Contains(json, "slash" + expected + "\"}"));
+        CHECK(!Contains(json, "slash" + expected + cjk));
+
+        RegTrace::Disable();
+    }
+
+    void TestRecordedCalls()
+    {
+        std::shared_ptr<RegBackend> memory = RegBackend::Get("memory");
+        RegTrace::Enable(64);
+        {
+            RegKey key(memory);
+            CHECK(key.Create(HKEY_CURRENT_USER, STR("Software\\RegTraceTest"), KEY_ALL_ACCESS) != NULL);
+            CHECK(key.SetStringValue(STR("Traced"), STR("yes")));
+            CHECK(key.GetValueNames().size() == 1);
+            key.Close();
+            RegKey parent(memory);
+            CHECK(parent.Open(HKEY_CURRENT_USER, STR("Software"), KEY_ALL_ACCESS) != NULL);
+            CHECK(parent.DeleteTree(STR("RegTraceTest")));
+        }
+        RegTrace::Disable();
+
+        std::string json = RegTrace::DumpChromeJson();
+        CHECK(JsonValidator(json).Validate());
+        CHECK(Contains(json, "\"name\":\"CreateKey\""));
+        CHECK(Contains(json, "\"name\":\"Software\\\\RegTraceTest\""));
+        CHECK(Contains(json, "\"name\":\"SetValue\""));
+        CHECK(Contains(json, "\"name\":\"EnumValue\""));
+        // Calls are exported with the path of the key they hit.
+        CHECK(Contains(json, "\"path\":\"HKEY_CURRENT_USER\\\\Software\\\\RegTraceTest\",\"name\":\"Traced\""));
+        CHECK(Contains(json, "\"path\":\"HKEY_CURRENT_USER\\\\Software\",\"name\":\"RegTraceTest\""));
+
+        // Nothing is recorded while disabled.
+        RegTrace::Clear();
+        RegKey key(memory);
+        key.Open(HKEY_CURRENT_USER, STR("Software"), KEY_READ);
+        CHECK(RegTrace::DumpChromeJson() == "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[]}");
+    }
+
+    // A handle value reused after a close is exported with the path of the key it was reopened on.
+    void TestReusedHandles()
+    {
+        RegTrace::Enable(16);
+        HKEY hKey = HKEY(uintptr_t(0x1234));
+        RegTrace::NameKey(hKey, HKEY_LOCAL_MACHINE, STR("Software\\First"));
+        RegTrace::Record(RegTraceOp::QueryValue, hKey, STR("A"), ERROR_SUCCESS, 1, 2);
+        RegTrace::Record(RegTraceOp::CloseKey, hKey, nullptr, ERROR_SUCCESS, 3, 4);
+        CHECK(RegTrace::GetKeyPath(hKey).empty());
+        RegTrace::NameKey(hKey, HKEY_LOCAL_MACHINE, STR("Software\\Second"));
+        RegTrace::Record(RegTraceOp::QueryValue, hKey, STR("B"), ERROR_SUCCESS, 5, 6);
+
+        std::string json = RegTrace::DumpChromeJson();
+        CHECK(Contains(json, "\"path\":\"HKEY_LOCAL_MACHINE\\\\Software\\\\First\",\"name\":\"A\""));
+        CHECK(Contains(json, "\"path\":\"HKEY_LOCAL_MACHINE\\\\Software\\\\Second\",\"name\":\"B\""));
+
+        // Handles are not named while tracing is off.
+        RegTrace::Disable();
+        RegTrace::NameKey(hKey, HKEY_LOCAL_MACHINE, STR("Software\\Third"));
+        CHECK(RegTrace::GetKeyPath(hKey).empty());
+        CHECK(RegTrace::GetKeyPath(HKEY_CURRENT_USER) == STR("HKEY_CURRENT_USER"));
+    }
+}
+
+int main()
+{
+    TestExtremeEvents();
+    TestReusedHandles();
+    TestRecordedCalls();
+    return CHECK_RESULT();
+}
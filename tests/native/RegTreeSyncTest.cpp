@@ -0,0 +1,178 @@
+#include "Check.h"
+#include "MemoryBackend.h"
+#include "RegTreeSync.h"
+#include <algorithm>
+#include <chrono>
+#include <string>
+#include <thread>
+
+// Diffs successive sync passes over a tree on the memory backend: keys and values added, removed
+// and changed are reported once, unchanged keys are not read again, and a key whose last write
+// time did not move keeps its recorded values.
+namespace
+{
+    // Can report one fixed last write time for every key, as a coarse clock would.
+    class StandInBackend : public MemoryBackend
+    {
+    public:
+        bool frozen = false;
+
+        LSTATUS QueryInfoKey(HKEY hKey, RegKeyInfo *info) override
+        {
+            LSTATUS status = MemoryBackend::QueryInfoKey(hKey, info);
+            if (status == ERROR_SUCCESS && info != nullptr && frozen)
+                info->lastWriteTime = 1;
+            return status;
+        }
+    };
+
+    std::string Narrow(const String &str)
+    {
+        return std::string(str.begin(), str.end());
+    }
+
+    // Changes as "kind path name" lines, sorted unless their order is being checked.
+    std::vector<std::string> Describe(const std::vector<RegTreeChange> &changes, bool sorted = true)
+    {
+        std::vector<std::string> lines;
+        for (const RegTreeChange &change : changes)
+        {
+            switch (change.kind)
+            {
+            case RegTreeChangeKind::KeyAdded:
+                lines.push_back("+key " + Narrow(change.path));
+                break;
+            case RegTreeChangeKind::KeyRemoved:
+                lines.push_back("-key " + Narrow(change.path));
+                break;
+            case RegTreeChangeKind::ValueSet:
+                lines.push_back("+value " + Narrow(change.path) + " " + Narrow(change.value.name));
+                break;
+            case RegTreeChangeKind::ValueRemoved:
+                lines.push_back("-value " + Narrow(change.path) + " " + Narrow(change.value.name));
+                break;
+            }
+        }
+        if (sorted)
+            std::sort(lines.begin(), lines.end());
+        return lines;
+    }
+
+    std::vector<std::string> Sync(RegKey &root, std::shared_ptr<const RegTreeState> &state, RegTreeSyncStats &stats,
+                                  bool sorted = true)
+    {
+        std::vector<RegTreeChange> changes;
+        state = RegTreeSync::Sync(root, state, changes, &stats);
+        CHECK(state != nullptr);
+        return Describe(changes, sorted);
+    }
+
+    RegKey Make(const std::shared_ptr<RegBackend> &backend, const String &path)
+    {
+        RegKey key(backend);
+        CHECK(key.Create(HKEY_CURRENT_USER, STR("Software\\Sync") + (path.empty() ? path : STR("\\") + path), KEY_ALL_ACCESS) != NULL);
+        return key;
+    }
+
+    // Writes made right after a pass must get a later time than the one it recorded.
+    void Tick()
+    {
+        std::this_thread::sleep_for(std::chrono::milliseconds(2));
+    }
+
+    void TestDiff()
+    {
+        std::shared_ptr<StandInBackend> backend = std::make_shared<StandInBackend>();
+        RegKey root = Make(backend, STR(""));
+        root.SetDwordValue(STR("Top"), 1);
+        Make(backend, STR("A")).SetStringValue(STR("Name"), STR("a"));
+        Make(backend, STR("A\\Deep")).SetDwordValue(STR("Count"), 1);
+        Make(backend, STR("B")).SetDwordValue(STR("Flag"), 0);
+
+        // A first pass reports everything below the root.
+        std::shared_ptr<const RegTreeState> state;
+        RegTreeSyncStats stats;
+        std::vector<std::string> expected = {"+key A", "+key A\\Deep", "+key B", "+value  Top", "+value A Name",
+                                             "+value A\\Deep Count", "+value B Flag"};
+        CHECK(Sync(root, state, stats) == expected);
+        CHECK(stats.visited == 4 && stats.reread == 4);
+        CHECK(state->keys.size() == 4 && state->keys.count(STR("A\\DEEP")) == 1);
+
+        // Nothing changed: every key is visited, none is read again.
+        CHECK(Sync(root, state, stats).empty());
+        CHECK(stats.visited == 4 && stats.reread == 0);
+
+        // A value changed deep down, one changed and one added in B, one removed from A, and a new key.
+        Tick();
+        Make(backend, STR("A\\Deep")).SetDwordValue(STR("Count"), 2);
+        RegKey b = Make(backend, STR("B"));
+        b.SetDwordValue(STR("Flag"), 1);
+        b.SetStringValue(STR("Extra"), STR("x"));
+        Make(backend, STR("A")).DeleteValue(STR("Name"));
+        Make(backend, STR("C")).SetDwordValue(STR("New"), 3);
+        // Writing the same data again still reads the key, but reports nothing.
+        root.SetDwordValue(STR("Top"), 1);
+        expected = {"+key C", "+value A\\Deep Count", "+value B Extra", "+value B Flag", "+value C New", "-value A Name"};
+        CHECK(Sync(root, state, stats) == expected);
+        CHECK(stats.visited == 5 && stats.reread == 5);
+
+        // A removed subtree is reported deepest key first.
+        Tick();
+        CHECK(Make(backend, STR("A")).DeleteTree());
+        CHECK(root.DeleteSubKey(STR("A")));
+        expected = {"-key A\\Deep", "-key A"};
+        CHECK(Sync(root, state, stats, false) == expected);
+        CHECK(stats.visited == 3 && stats.reread == 1);
+        CHECK(state->keys.count(STR("A")) == 0 && state->keys.count(STR("A\\DEEP")) == 0);
+        root.DeleteTree();
+    }
+
+    void TestUnchangedTime()
+    {
+        std::shared_ptr<StandInBackend> backend = std::make_shared<StandInBackend>();
+        backend->frozen = true;
+        RegKey root = Make(backend, STR(""));
+        RegKey key = Make(backend, STR("Key"));
+        key.SetDwordValue(STR("Value"), 1);
+
+        std::shared_ptr<const RegTreeState> state;
+        RegTreeSyncStats stats;
+        CHECK(Sync(root, state, stats).size() == 2);
+
+        // The time did not move, so the recorded values are kept and the change goes unseen.
+        key.SetDwordValue(STR("Value"), 2);
+        Make(backend, STR("Key\\Hidden"));
+        CHECK(Sync(root, state, stats).empty());
+        CHECK(stats.visited == 2 && stats.reread == 0);
+        const RegTreeState::Key &recorded = state->keys.at(STR("KEY"));
+        CHECK(recorded.values.size() == 1 && recorded.values[0].data[0] == 1 && recorded.subKeys.empty());
+
+        // Once it moves, the key is read again and both changes are reported.
+        backend->frozen = false;
+        std::vector<std::string> expected = {"+key Key\\Hidden", "+value Key Value"};
+        CHECK(Sync(root, state, stats) == expected);
+        root.DeleteTree();
+    }
+
+    void TestDeletedRoot()
+    {
+        std::shared_ptr<StandInBackend> backend = std::make_shared<StandInBackend>();
+        RegKey root = Make(backend, STR("Gone"));
+        std::shared_ptr<const RegTreeState> state;
+        RegTreeSyncStats stats;
+        Sync(root, state, stats);
+
+        CHECK(Make(backend, STR("")).DeleteTree());
+        std::vector<RegTreeChange> changes;
+        CHECK(RegTreeSync::Sync(root, state, changes) == nullptr);
+        CHECK(root.GetLastStatus() == ERROR_KEY_DELETED && changes.empty());
+    }
+}
+
+int main()
+{
+    TestDiff();
+    TestUnchangedTime();
+    TestDeletedRoot();
+    return CHECK_RESULT();
+}
@@ -0,0 +1,43 @@
+#pragma once
+
+#include "RegPlatform.h"
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <string>
+
+// A file in the temporary directory, removed when it goes out of scope.
+class TempFile
+{
+public:
+    explicit TempFile(const std::string &name)
+        : _path((std::filesystem::temp_directory_path() / ("regkey-" + name)).string())
+    {
+        std::remove(_path.c_str());
+    }
+
+    ~TempFile()
+    {
+        std::remove(_path.c_str());
+    }
+
+    const std::string &Path() const
+    {
+        return _path;
+    }
+
+    ByteArray Read() const
+    {
+        std::ifstream in(_path, std::ios::binary);
+        return ByteArray(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+    }
+
+    void Write(const ByteArray &data) const
+    {
+        std::ofstream out(_path, std::ios::binary | std::ios::trunc);
+        out.write(reinterpret_cast<const char *>(data.data()), std::streamsize(data.size()));
+    }
+
+private:
+    std::string _path;
+};
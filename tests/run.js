@@ -0,0 +1,26 @@
+const { spawnSync } = require('child_process')
+const fs = require('fs')
+const path = require('path')
+
+// Runs every script in this directory, each in its own process, against a local build.
+// They use the memory backend or a stand-in key, so they run on any platform; test.js reads
+// the real registry and only runs on Windows.
+const scripts = fs.readdirSync(__dirname)
+  .filter(file => file.endsWith('.js') && file !== 'run.js')
+  .filter(file => file !== 'test.js' || process.platform === 'win32')
+  .sort()
+
+const failed = []
+for (const script of scripts) {
+  console.log(`# ${script}`)
+  const result = spawnSync(process.execPath, ['--trace-warnings', path.join(__dirname, script)], { stdio: 'inherit' })
+  if (result.status !== 0) {
+    failed.push(script)
+  }
+}
+
+console.log(`${scripts.length - failed.length} of ${scripts.length} passed`)
+if (failed.length > 0) {
+  console.log(`failed: ${failed.join(', ')}`)
+  process.exit(1)
+}
@@ -0,0 +1,164 @@
+const assert = require('assert')
+const { RegValueReadStream, RegValueWriteStream } = require('../lib/RegValueStream')
+
+// Writes and reads back values of every size around the chunk boundaries, fed in pieces that
+// straddle them. Runs with `node tests/valueStream.js`; the key is a stand-in holding binary values,
+// so the addon does not need to be built.
+class MemoryKey {
+  constructor() {
+    this.values = new Map()
+  }
+  tryGetBinaryValue(name) {
+    return this.values.get(name)
+  }
+  getBinaryValue(name) {
+    if (!this.values.has(name)) {
+      throw new Error(`No value ${name}.`)
+    }
+    return Buffer.from(this.values.get(name))
+  }
+  setBinaryValue(name, data) {
+    this.values.set(name, Buffer.from(data))
+    return true
+  }
+  hasValue(name) {
+    return this.values.has(name)
+  }
+  deleteValue(name) {
+    return this.values.delete(name)
+  }
+  getLastError() {
+    return ''
+  }
+}
+
+let seed = 45
+function random(limit) {
+  seed = (seed * 1103515245 + 12345) & 0x7fffffff
+  return seed % limit
+}
+
+function payload(size) {
+  const data = Buffer.alloc(size)
+  for (let i = 0; i < size; i++) {
+    data[i] = random(256)
+  }
+  return data
+}
+
+// Pieces of random sizes, with single bytes and pieces larger than a chunk mixed in.
+function split(data, chunkSize) {
+  const pieces = []
+  for (let offset = 0; offset < data.length;) {
+    const kind = random(4)
+    const size = kind === 0 ? 1 : kind === 1 ? chunkSize + random(chunkSize) : 1 + random(chunkSize)
+    pieces.push(data.subarray(offset, offset + size))
+    offset += size
+  }
+  return pieces
+}
+
+function write(key, name, pieces, chunkSize) {
+  return new Promise((resolve, reject) => {
+    const stream = new RegValueWriteStream(key, name, { chunkSize })
+    stream.on('error', reject)
+    stream.on('finish', resolve)
+    for (const piece of pieces) {
+      stream.write(piece)
+    }
+    stream.end()
+  })
+}
+
+async function read(key, name) {
+  const chunks = []
+  for await (const chunk of new RegValueReadStream(key, name)) {
+    chunks.push(chunk)
+  }
+  return Buffer.concat(chunks)
+}
+
+function chunkNames(key, name) {
+  return [...key.values.keys()].filter(value => value.startsWith(`${name}~`))
+}
+
+async function testBoundaries() {
+  const chunkSize = 64
+  const sizes = [0, 1, chunkSize - 1, chunkSize, chunkSize + 1, 2 * chunkSize - 1, 2 * chunkSize,
+    2 * chunkSize + 1, 5 * chunkSize, 5 * chunkSize + 3]
+  for (const size of sizes) {
+    for (let round = 0; round < 20; round++) {
+      const key = new MemoryKey()
+      const data = payload(size)
+      await write(key, 'Blob', split(data, chunkSize), chunkSize)
+
+      // A value that fits in one chunk is stored as it is; larger ones are split into full chunks and a tail.
+      const chunks = chunkNames(key, 'Blob')
+      if (size <= chunkSize) {
+        assert.strictEqual(chunks.length, 0)
+        assert.ok(key.values.get('Blob').equals(data))
+      } else {
+        assert.strictEqual(chunks.length, Math.ceil(size / chunkSize))
+        assert.strictEqual(key.values.get('Blob').length, 28)
+        chunks.forEach((chunk, i) => assert.strictEqual(key.values.get(chunk).length,
+          i < chunks.length - 1 ? chunkSize : size - chunkSize * (chunks.length - 1)))
+      }
+      assert.ok((await read(key, 'Blob')).equals(data), `size ${size}`)
+    }
+  }
+}
+
+async function testRewrite() {
+  const chunkSize = 64
+  const key = new MemoryKey()
+  const first = payload(4 * chunkSize + 1)
+  await write(key, 'Blob', [first], chunkSize)
+  assert.strictEqual(chunkNames(key, 'Blob').length, 5)
+
+  // The next generation replaces the manifest and drops the old chunks.
+  const second = payload(2 * chunkSize + 1)
+  await write(key, 'Blob', split(second, chunkSize), chunkSize)
+  assert.ok(chunkNames(key, 'Blob').every(name => name.startsWith('Blob~1.')))
+  assert.strictEqual(chunkNames(key, 'Blob').length, 3)
+  assert.ok((await read(key, 'Blob')).equals(second))
+
+  // Shrinking to a plain value drops them too.
+  await write(key, 'Blob', [Buffer.from('small')], chunkSize)
+  assert.strictEqual(chunkNames(key, 'Blob').length, 0)
+  assert.strictEqual((await read(key, 'Blob')).toString(), 'small')
+}
+
+async function testBrokenValues() {
+  const chunkSize = 64
+  const key = new MemoryKey()
+  await write(key, 'Blob', [payload(3 * chunkSize)], chunkSize)
+
+  // A short or missing chunk makes the read fail instead of returning less data.
+  key.values.set('Blob~0.2', key.values.get('Blob~0.2').subarray(1))
+  await assert.rejects(read(key, 'Blob'), /truncated/)
+  key.values.delete('Blob~0.1')
+  await assert.rejects(read(key, 'Blob'), /No value Blob~0.1/)
+
+  // An aborted write leaves neither its chunks nor a new manifest.
+  const other = new MemoryKey()
+  const stream = new RegValueWriteStream(other, 'Blob', { chunkSize })
+  stream.on('error', () => {})
+  stream.write(payload(3 * chunkSize))
+  await new Promise(resolve => setImmediate(resolve))
+  assert.ok(chunkNames(other, 'Blob').length > 0)
+  stream.destroy(new Error('aborted'))
+  await new Promise(resolve => stream.on('close', resolve))
+  assert.strictEqual(other.values.size, 0)
+}
+
+async function main() {
+  await testBoundaries()
+  await testRewrite()
+  await testBrokenValues()
+  console.log('valueStream: ok')
+}
+
+main().catch(error => {
+  console.error(error)
+  process.exit(1)
+})
@@ -0,0 +1,119 @@
+const assert = require('assert')
+const { Worker, isMainThread, parentPort, workerData } = require('worker_threads')
+const regkey = require('..')
+const { RegKey } = regkey
+
+// Keys used from several worker threads at once, handed between them, and left open when a worker exits.
+// Every thread uses the memory backend, shared by the process. `npm run test:memory` runs it with the other
+// scripts (and CI on Linux); `node tests/workers.js` runs it alone against a local build.
+const base = 'Software/WorkersTest'
+const valuesPerWorker = 200
+
+function open(subKey) {
+  return new RegKey({ baseKey: 'HKCU', subKey, backend: 'memory' })
+}
+
+function runWorker(data) {
+  return new Promise((resolve, reject) => {
+    const worker = new Worker(__filename, { workerData: data })
+    const messages = []
+    worker.on('message', message => messages.push(message))
+    worker.on('error', reject)
+    worker.on('exit', code => code === 0 ? resolve(messages) : reject(new Error(`worker exited with ${code}`)))
+    if (data.token !== undefined) {
+      worker.postMessage(data.token)
+    }
+  })
+}
+
+const tasks = {
+  // Writes and reads back its own values while the other workers do the same.
+  write({ index }) {
+    const key = open(`${base}/Worker${index}`)
+    for (let i = 0; i < valuesPerWorker; i++) {
+      key.setDwordValue(`Value${i}`, index * 1000 + i)
+    }
+    for (let i = 0; i < valuesPerWorker; i++) {
+      assert.strictEqual(key.getDwordValue(`Value${i}`), index * 1000 + i)
+    }
+    parentPort.postMessage(key.getValueNames().length)
+    key.close()
+  },
+
+  // Takes over a key transferred by the main thread, uses it and hands back a key of its own.
+  receive() {
+    parentPort.once('message', token => {
+      const key = RegKey.receive(token)
+      assert.strictEqual(key.getStringValue('From'), 'main')
+      key.setStringValue('To', 'worker')
+      assert.throws(() => RegKey.receive(token))
+      const child = key.createSubKey('FromWorker')
+      child.setStringValue('Name', 'child')
+      key.close()
+      parentPort.postMessage(child.transfer())
+    })
+  },
+
+  // Exits with keys still open, one of them received from the main thread.
+  leave() {
+    parentPort.once('message', token => {
+      const received = RegKey.receive(token)
+      received.setStringValue('Left', 'open')
+      for (let i = 0; i < 20; i++) {
+        open(`${base}/Left${i}`).setDwordValue('Value', i)
+      }
+      parentPort.postMessage(regkey.handles.report().length)
+      process.exit(0)
+    })
+  }
+}
+
+async function main() {
+  const root = open(base)
+  const openBefore = regkey.handles.stats().open
+
+  // Concurrent keys.
+  const workers = 4
+  const counts = await Promise.all(Array.from({ length: workers }, (_, index) => runWorker({ task: 'write', index })))
+  assert.deepStrictEqual(counts, Array(workers).fill([valuesPerWorker]))
+  assert.strictEqual(root.getSubKeyNames().length, workers)
+  const last = open(`${base}/Worker${workers - 1}`)
+  assert.strictEqual(last.getDwordValue(`Value${valuesPerWorker - 1}`), (workers - 1) * 1000 + valuesPerWorker - 1)
+  last.close()
+
+  // transfer() and receive().
+  const shared = root.createSubKey('Shared')
+  shared.setStringValue('From', 'main')
+  const token = shared.transfer()
+  assert.strictEqual(shared.valid, false)
+  const [childToken] = await runWorker({ task: 'receive', token })
+  assert.throws(() => RegKey.receive(token))
+  const child = RegKey.receive(childToken)
+  assert.strictEqual(child.getStringValue('Name'), 'child')
+  child.close()
+  const reopened = open(`${base}/Shared`)
+  assert.strictEqual(reopened.getStringValue('To'), 'worker')
+  reopened.close()
+
+  // A worker exiting with open keys closes them.
+  const leftKey = root.createSubKey('Left')
+  const [leftOpen] = await runWorker({ task: 'leave', token: leftKey.transfer() })
+  assert.ok(leftOpen >= 21)
+  assert.strictEqual(regkey.handles.stats().open, openBefore)
+  const left = open(`${base}/Left`)
+  assert.strictEqual(left.getStringValue('Left'), 'open')
+  left.close()
+
+  root.deleteTree()
+  root.close()
+  console.log('workers: ok')
+}
+
+if (isMainThread) {
+  main().catch(error => {
+    console.error(error)
+    process.exit(1)
+  })
+} else {
+  tasks[workerData.task](workerData)
+}
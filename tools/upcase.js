@@ -0,0 +1,54 @@
+// Prints the upcase ranges of src/RegString.cpp: node tools/upcase.js
+// Registry names compare by upper-casing each UTF-16 code unit with the simple (one to one)
+// uppercase mappings of Unicode, as the upcase table of Windows does. Node's ICU only exposes
+// the full mappings, so a unit whose full mapping expands takes the single unit lowercasing to it.
+const units = 0x10000
+
+// Left alone: ß has no simple uppercase, and Windows does not fold dotless i or long s.
+const unmapped = new Set([0xDF, 0x131, 0x17F])
+
+function isSurrogate(c) {
+  return c >= 0xD800 && c <= 0xDFFF
+}
+
+function simpleUpper(c) {
+  if (isSurrogate(c) || unmapped.has(c)) {
+    return c
+  }
+  const str = String.fromCharCode(c)
+  const upper = str.toUpperCase()
+  if (upper.length === 1) {
+    return upper.charCodeAt(0)
+  }
+  for (let u = 0; u < units; u++) {
+    if (u !== c && !isSurrogate(u) && String.fromCharCode(u).toLowerCase() === str) {
+      return u
+    }
+  }
+  return c
+}
+
+// Runs of units with the same offset, either consecutive or every other unit (upper and lower alternating).
+const ranges = []
+for (let c = 0; c < units; c++) {
+  const upper = simpleUpper(c)
+  if (upper === c) {
+    continue
+  }
+  const delta = (upper - c + units) % units
+  const last = ranges[ranges.length - 1]
+  if (last && last.delta === delta && last.first === last.last && c - last.last <= 2) {
+    last.stride = c - last.last
+    last.last = c
+  } else if (last && last.delta === delta && c - last.last === last.stride) {
+    last.last = c
+  } else {
+    ranges.push({ first: c, last: c, delta, stride: 1 })
+  }
+}
+
+const hex = value => `0x${value.toString(16).toUpperCase().padStart(4, '0')}`
+console.log(`        // Unicode ${process.versions.unicode}`)
+for (const range of ranges) {
+  console.log(`        {${hex(range.first)}, ${hex(range.last)}, ${hex(range.delta)}, ${range.stride}},`)
+}